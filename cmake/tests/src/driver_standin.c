@@ -0,0 +1,114 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "driver_standin.h"
+
+typedef struct StandinSession {
+  bool              fail_stream;
+} StandinSession_t;
+
+
+bool standin_supports(const DBConfig_t *db) {
+  return strcmp(db->type, DRIVER_STANDIN_TYPE) == 0;
+}
+
+int standin_open(AppConfig_t *cfg, size_t workers, void **session, char *message, size_t len) {
+  StandinSession_t *s;
+
+  (void)workers;
+  if (strcmp(cfg->db->uri, "fail-open") == 0) {
+    snprintf(message, len, "standin cannot open %s", cfg->db->uri);
+
+    return 3;
+  }
+  s = calloc(1, sizeof(StandinSession_t));
+  if (!s) return 1;
+  s->fail_stream = strcmp(cfg->db->uri, "fail-stream") == 0;
+  *session = s;
+
+  return 0;
+}
+
+int standin_list(void *session, DriverAddFn_t add, void *ctx, char *message, size_t len) {
+  StandinSession_t *s = session;
+
+  if (add(ctx, "small", 1) != 0 || add(ctx, "large", 3) != 0 || add(ctx, "empty", 1) != 0
+    || (s->fail_stream && add(ctx, "broken", 1) != 0)) {
+    snprintf(message, len, "standin cannot add its objects");
+
+    return 1;
+  }
+
+  return 0;
+}
+
+uint64_t standin_estimate(void *session, const char *name) {
+  (void)session;
+  if (strcmp(name, "large") == 0) return 3 * DRIVER_STANDIN_ROWS * 16;
+
+  return strcmp(name, "empty") == 0 ? 0 : DRIVER_STANDIN_ROWS * 16;
+}
+
+/* lines through reserve/commit, cut wherever the room runs out */
+int standin_stream_direct(const char *name, uint32_t part, const DriverStream_t *out) {
+  char line[BUF_LEN_S];
+  unsigned char *room = NULL;
+  size_t size = 0, used = 0;
+
+  for (size_t i = 0; i < DRIVER_STANDIN_ROWS; i++) {
+    int n = snprintf(line, sizeof(line), DRIVER_STANDIN_LINE, name, part, i);
+
+    for (size_t done = 0; done < (size_t)n;) {
+      size_t take;
+
+      if (used == size) {
+        if (room && out->commit(out->ctx, used) != 0) return -1;
+        room = out->reserve(out->ctx, &size);
+        if (!room) return -1;
+        used = 0;
+      }
+      take = (size_t)n - done < size - used ? (size_t)n - done : size - used;
+      memcpy(room + used, line + done, take);
+      used += take;
+      done += take;
+    }
+  }
+
+  return room && used ? out->commit(out->ctx, used) : 0;
+}
+
+int standin_stream(void *session, const char *name, uint32_t part, size_t worker_id, const DriverStream_t *out,
+  char *message, size_t len) {
+  char line[BUF_LEN_S];
+
+  (void)session, (void)worker_id;
+  if (strcmp(name, "empty") == 0) return 0;
+  if (strcmp(name, "large") == 0) return standin_stream_direct(name, part, out) == 0 ? 0 : 1;
+  for (size_t i = 0; i < DRIVER_STANDIN_ROWS; i++) {
+    int n = snprintf(line, sizeof(line), DRIVER_STANDIN_LINE, name, part, i);
+
+    if (strcmp(name, "broken") == 0 && i == DRIVER_STANDIN_ROWS / 2) {
+      snprintf(message, len, "standin refused line %zu", i);
+
+      return DRIVER_STANDIN_FAIL_CODE;
+    }
+    if (out->write(out->ctx, line, (size_t)n) != 0) return 1;
+  }
+
+  return 0;
+}
+
+void standin_close(void *session) {
+  free(session);
+}
+
+const Driver_t dbeetle_driver = {
+  .abi_version = DRIVER_ABI_VERSION,
+  .name = "standin",
+  .supports = standin_supports,
+  .open = standin_open,
+  .list = standin_list,
+  .estimate = standin_estimate,
+  .stream = standin_stream,
+  .close = standin_close
+};
@@ -0,0 +1,37 @@
+#ifndef ___DRIVER_STANDIN_H___
+#define ___DRIVER_STANDIN_H___
+
+// standard library headers
+#include <stddef.h>
+#include <stdint.h>
+
+//internal library headers
+#include "include/driver.h"
+
+//macro defs
+#define DRIVER_STANDIN_TYPE ("standin")
+#define DRIVER_STANDIN_ROWS (4000)
+#define DRIVER_STANDIN_LINE ("%s %u %zu\n")
+#define DRIVER_STANDIN_FAIL_CODE (7)
+
+/*
+ * ==========================================================
+ * Driver Stand-in
+ * ----------------------------------------------------------
+ * A driver plugin, libdbeetle_standin.so, for the driver
+ * tests. It lists three objects:
+ *
+ *   small       one part, streamed with write()
+ *   large       three parts, streamed with reserve/commit
+ *   empty       one part of nothing
+ *
+ * part p of object n holding DRIVER_STANDIN_ROWS lines of
+ * DRIVER_STANDIN_LINE (n, p, line number) for small and large.
+ * A `db.uri` of "fail-open" makes open() fail, "fail-stream"
+ * adds a fourth object, broken, whose stream fails halfway
+ * with DRIVER_STANDIN_FAIL_CODE.
+ * ==========================================================
+ */
+
+
+#endif /* ___DRIVER_STANDIN_H___ */
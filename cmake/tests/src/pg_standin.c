@@ -0,0 +1,1658 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <time.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include "pg_standin.h"
+
+typedef struct PgStandinOut {
+  unsigned char     *data;
+  size_t            len;
+  size_t            cap;
+} PgStandinOut_t;
+
+typedef struct PgStandinConn {
+  PgStandin_t       *standin;
+  int               fd;
+  size_t            id;
+  bool              in_txn;
+  bool              failed;
+  bool              has_snapshot;
+  bool              replication;    // a WAL sender
+  bool              logical;        // replication=database: queries and slot commands
+  char              slot[BUF_LEN_XS];  // physical slot being streamed, moved by status updates
+  uint64_t          version;
+  PgStandinOut_t    out;
+} PgStandinConn_t;
+
+
+int pg_standin_read_full(int fd, void *buf, size_t len) {
+  unsigned char *p = buf;
+
+  while (len > 0) {
+    ssize_t n = recv(fd, p, len, 0);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+uint32_t pg_standin_be32(const unsigned char *p) {
+  return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+/* reads one typed message; the payload is malloc'ed and NUL-terminated */
+int pg_standin_read_message(int fd, char *type, unsigned char **payload, size_t *len) {
+  unsigned char header[5];
+  uint32_t n;
+
+  if (pg_standin_read_full(fd, header, 5) != 0) return -1;
+  n = pg_standin_be32(header + 1);
+  if (n < 4 || n > (1u << 24)) return -1;
+  *type = (char)header[0];
+  *len = n - 4;
+  *payload = malloc(*len + 1);
+  if (!*payload || pg_standin_read_full(fd, *payload, *len) != 0) {
+    free(*payload);
+
+    return -1;
+  }
+  (*payload)[*len] = '\0';
+
+  return 0;
+}
+
+void pg_standin_put(PgStandinOut_t *out, const void *data, size_t len) {
+  if (out->len + len > out->cap) {
+    size_t cap = out->cap ? out->cap : BUF_LEN;
+    unsigned char *grown;
+
+    while (cap < out->len + len) cap *= 2;
+    grown = realloc(out->data, cap);
+    if (!grown) return;
+    out->data = grown;
+    out->cap = cap;
+  }
+  memcpy(out->data + out->len, data, len);
+  out->len += len;
+}
+
+void pg_standin_put32(PgStandinOut_t *out, uint32_t v) {
+  unsigned char be[4] = { (unsigned char)(v >> 24), (unsigned char)(v >> 16), (unsigned char)(v >> 8), (unsigned char)v };
+
+  pg_standin_put(out, be, 4);
+}
+
+void pg_standin_put16(PgStandinOut_t *out, uint16_t v) {
+  unsigned char be[2] = { (unsigned char)(v >> 8), (unsigned char)v };
+
+  pg_standin_put(out, be, 2);
+}
+
+void pg_standin_put_str(PgStandinOut_t *out, const char *s) {
+  pg_standin_put(out, s, strlen(s) + 1);
+}
+
+/* starts a message; pg_standin_end() patches in its length */
+size_t pg_standin_begin(PgStandinOut_t *out, char type) {
+  size_t start = out->len;
+
+  pg_standin_put(out, &type, 1);
+  pg_standin_put32(out, 0);
+
+  return start;
+}
+
+void pg_standin_end(PgStandinOut_t *out, size_t start) {
+  uint32_t n = (uint32_t)(out->len - start - 1);
+
+  if (out->len < start + 5) return;
+  out->data[start + 1] = (unsigned char)(n >> 24);
+  out->data[start + 2] = (unsigned char)(n >> 16);
+  out->data[start + 3] = (unsigned char)(n >> 8);
+  out->data[start + 4] = (unsigned char)n;
+}
+
+int pg_standin_flush(PgStandinConn_t *conn) {
+  const unsigned char *p = conn->out.data;
+  size_t len = conn->out.len;
+
+  while (len > 0) {
+    ssize_t n = send(conn->fd, p, len, MSG_NOSIGNAL);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+  conn->out.len = 0;
+
+  return 0;
+}
+
+void pg_standin_error(PgStandinConn_t *conn, const char *sqlstate, const char *message) {
+  size_t start = pg_standin_begin(&conn->out, 'E');
+
+  pg_standin_put_str(&conn->out, "SERROR");
+  pg_standin_put(&conn->out, "C", 1);
+  pg_standin_put_str(&conn->out, sqlstate);
+  pg_standin_put(&conn->out, "M", 1);
+  pg_standin_put_str(&conn->out, message);
+  pg_standin_put(&conn->out, "", 1);
+  pg_standin_end(&conn->out, start);
+  if (conn->in_txn) conn->failed = true;
+}
+
+void pg_standin_notice(PgStandinConn_t *conn, const char *message) {
+  size_t start = pg_standin_begin(&conn->out, 'N');
+
+  pg_standin_put_str(&conn->out, "SNOTICE");
+  pg_standin_put_str(&conn->out, "C00000");
+  pg_standin_put(&conn->out, "M", 1);
+  pg_standin_put_str(&conn->out, message);
+  pg_standin_put(&conn->out, "", 1);
+  pg_standin_end(&conn->out, start);
+}
+
+void pg_standin_auth_request(PgStandinConn_t *conn, uint32_t code, const void *extra, size_t len) {
+  size_t start = pg_standin_begin(&conn->out, 'R');
+
+  pg_standin_put32(&conn->out, code);
+  if (len) pg_standin_put(&conn->out, extra, len);
+  pg_standin_end(&conn->out, start);
+}
+
+void pg_standin_complete(PgStandinConn_t *conn, const char *tag) {
+  size_t start = pg_standin_begin(&conn->out, 'C');
+
+  pg_standin_put_str(&conn->out, tag);
+  pg_standin_end(&conn->out, start);
+}
+
+void pg_standin_row_description(PgStandinConn_t *conn, const char **names, uint16_t cols) {
+  size_t start = pg_standin_begin(&conn->out, 'T');
+
+  pg_standin_put16(&conn->out, cols);
+  for (uint16_t i = 0; i < cols; i++) {
+    pg_standin_put_str(&conn->out, names[i]);
+    pg_standin_put32(&conn->out, 0);
+    pg_standin_put16(&conn->out, 0);
+    pg_standin_put32(&conn->out, 25);     // text
+    pg_standin_put16(&conn->out, 0xffff);
+    pg_standin_put32(&conn->out, 0xffffffffu);
+    pg_standin_put16(&conn->out, 0);
+  }
+  pg_standin_end(&conn->out, start);
+}
+
+void pg_standin_data_row(PgStandinConn_t *conn, const char **values, uint16_t cols) {
+  size_t start = pg_standin_begin(&conn->out, 'D');
+
+  pg_standin_put16(&conn->out, cols);
+  for (uint16_t i = 0; i < cols; i++) {
+    pg_standin_put32(&conn->out, values[i] ? (uint32_t)strlen(values[i]) : 0xffffffffu);
+    if (values[i]) pg_standin_put(&conn->out, values[i], strlen(values[i]));
+  }
+  pg_standin_end(&conn->out, start);
+}
+
+/* ---- authentication ---- */
+
+void pg_standin_md5_hex(const void *a, size_t a_len, const void *b, size_t b_len, char *hex) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  EVP_MD_CTX *md = EVP_MD_CTX_new();
+
+  EVP_DigestInit_ex(md, EVP_md5(), NULL);
+  EVP_DigestUpdate(md, a, a_len);
+  EVP_DigestUpdate(md, b, b_len);
+  EVP_DigestFinal_ex(md, digest, &digest_len);
+  EVP_MD_CTX_free(md);
+  for (unsigned int i = 0; i < digest_len; i++) snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+}
+
+/* expects a PasswordMessage; returns its payload or NULL */
+unsigned char *pg_standin_read_password(PgStandinConn_t *conn, size_t *len) {
+  unsigned char *payload = NULL;
+  char type;
+
+  if (pg_standin_flush(conn) != 0 || pg_standin_read_message(conn->fd, &type, &payload, len) != 0) return NULL;
+  if (type != 'p') {
+    free(payload);
+
+    return NULL;
+  }
+
+  return payload;
+}
+
+bool pg_standin_scram(PgStandinConn_t *conn) {
+  PgStandin_t *s = conn->standin;
+  unsigned char salt[16], server_raw[18], salted[SHA256_DIGEST_LENGTH], client_key[SHA256_DIGEST_LENGTH];
+  unsigned char stored_key[SHA256_DIGEST_LENGTH], signature[SHA256_DIGEST_LENGTH], proof[SHA256_DIGEST_LENGTH + 2];
+  unsigned char server_key[SHA256_DIGEST_LENGTH], server_signature[SHA256_DIGEST_LENGTH];
+  char salt_b64[BUF_LEN_XS], server_nonce[BUF_LEN_XS], server_first[BUF_LEN], auth_message[BUF_LEN * 3];
+  char verifier[BUF_LEN_XS], client_first_bare[BUF_LEN];
+  const char *bare, *client_nonce, *proof_b64;
+  unsigned char *first = NULL, *final = NULL;
+  unsigned int md_len = 0;
+  size_t len, without_proof_len;
+  bool ok = false;
+
+  pg_standin_auth_request(conn, 10, "SCRAM-SHA-256\0", 15);
+  first = pg_standin_read_password(conn, &len);
+  // "SCRAM-SHA-256\0" int32 "n,,n=,r=<nonce>"
+  if (!first || len < 19 || strcmp((char *)first, "SCRAM-SHA-256") != 0) goto done;
+  bare = (const char *)first + 14 + 4;
+  if (strncmp(bare, "n,,", 3) != 0) goto done;
+  bare += 3;
+  client_nonce = strstr(bare, "r=");
+  if (!client_nonce) goto done;
+  snprintf(client_first_bare, sizeof(client_first_bare), "%s", bare);
+
+  RAND_bytes(salt, sizeof(salt));
+  RAND_bytes(server_raw, sizeof(server_raw));
+  EVP_EncodeBlock((unsigned char *)salt_b64, salt, sizeof(salt));
+  EVP_EncodeBlock((unsigned char *)server_nonce, server_raw, sizeof(server_raw));
+  snprintf(server_first, sizeof(server_first), "r=%s%s,s=%s,i=4096", client_nonce + 2, server_nonce, salt_b64);
+  pg_standin_auth_request(conn, 11, server_first, strlen(server_first));
+
+  final = pg_standin_read_password(conn, &len);
+  if (!final || !(proof_b64 = strstr((char *)final, ",p="))) goto done;
+  without_proof_len = (size_t)(proof_b64 - (char *)final);
+  snprintf(auth_message, sizeof(auth_message), "%s,%s,%.*s", client_first_bare, server_first, (int)without_proof_len,
+    (char *)final);
+  if (EVP_DecodeBlock(proof, (const unsigned char *)proof_b64 + 3, (int)strlen(proof_b64 + 3)) < SHA256_DIGEST_LENGTH) {
+    goto done;
+  }
+
+  PKCS5_PBKDF2_HMAC(s->password, (int)strlen(s->password), salt, sizeof(salt), 4096, EVP_sha256(), sizeof(salted),
+    salted);
+  HMAC(EVP_sha256(), salted, sizeof(salted), (const unsigned char *)"Client Key", 10, client_key, &md_len);
+  SHA256(client_key, sizeof(client_key), stored_key);
+  HMAC(EVP_sha256(), stored_key, sizeof(stored_key), (const unsigned char *)auth_message, strlen(auth_message),
+    signature, &md_len);
+  for (size_t i = 0; i < SHA256_DIGEST_LENGTH; i++) proof[i] ^= signature[i];
+  SHA256(proof, SHA256_DIGEST_LENGTH, client_key);
+  if (CRYPTO_memcmp(client_key, stored_key, SHA256_DIGEST_LENGTH) != 0) goto done;
+
+  HMAC(EVP_sha256(), salted, sizeof(salted), (const unsigned char *)"Server Key", 10, server_key, &md_len);
+  HMAC(EVP_sha256(), server_key, sizeof(server_key), (const unsigned char *)auth_message, strlen(auth_message),
+    server_signature, &md_len);
+  memcpy(verifier, "v=", 2);
+  EVP_EncodeBlock((unsigned char *)verifier + 2, server_signature, sizeof(server_signature));
+  pg_standin_auth_request(conn, 12, verifier, strlen(verifier));
+  ok = true;
+
+done:
+  free(first);
+  free(final);
+
+  return ok;
+}
+
+bool pg_standin_authenticate(PgStandinConn_t *conn, const char *user) {
+  PgStandin_t *s = conn->standin;
+  unsigned char salt[4] = { 0x01, 0x02, 0x03, 0x04 }, *payload = NULL;
+  char inner[33], expected[36];
+  size_t len;
+  bool ok = false;
+
+  if (strcmp(user, s->user) != 0) return false;
+  switch (s->auth) {
+    case PG_STANDIN_TRUST:
+      ok = true;
+      break;
+    case PG_STANDIN_PASSWORD:
+      pg_standin_auth_request(conn, 3, NULL, 0);
+      payload = pg_standin_read_password(conn, &len);
+      ok = payload && strcmp((char *)payload, s->password) == 0;
+      break;
+    case PG_STANDIN_MD5:
+      pg_standin_auth_request(conn, 5, salt, sizeof(salt));
+      payload = pg_standin_read_password(conn, &len);
+      pg_standin_md5_hex(s->password, strlen(s->password), user, strlen(user), inner);
+      memcpy(expected, "md5", 3);
+      pg_standin_md5_hex(inner, 32, salt, sizeof(salt), expected + 3);
+      ok = payload && strcmp((char *)payload, expected) == 0;
+      break;
+    case PG_STANDIN_SCRAM:
+      ok = pg_standin_scram(conn);
+      break;
+  }
+  free(payload);
+
+  return ok;
+}
+
+/* reads the startup packet (answering SSLRequest with 'N'); the user name, or -1 */
+int pg_standin_startup(PgStandinConn_t *conn, char *user, size_t user_len) {
+  unsigned char header[4], *body;
+  uint32_t len, code;
+
+  for (;;) {
+    if (pg_standin_read_full(conn->fd, header, 4) != 0) return -1;
+    len = pg_standin_be32(header);
+    if (len < 8 || len > BUF_LEN * 10) return -1;
+    body = malloc(len - 4 + 1);
+    if (!body || pg_standin_read_full(conn->fd, body, len - 4) != 0) {
+      free(body);
+
+      return -1;
+    }
+    body[len - 4] = '\0';
+    code = pg_standin_be32(body);
+    if (code != 80877103) break;
+    free(body);
+    if (send(conn->fd, "N", 1, MSG_NOSIGNAL) != 1) return -1;
+  }
+  user[0] = '\0';
+  for (size_t pos = 4; code == 196608 && pos < len - 4 && body[pos];) {
+    const char *key = (const char *)body + pos, *value = key + strlen(key) + 1;
+
+    if (strcmp(key, "user") == 0) snprintf(user, user_len, "%s", value);
+    if (strcmp(key, "replication") == 0) conn->replication = strcmp(value, "true") == 0;
+    if (strcmp(key, "replication") == 0) conn->logical = strcmp(value, "database") == 0;
+    pos += strlen(key) + 1 + strlen(value) + 1;
+  }
+  free(body);
+
+  return code == 196608 && user[0] ? 0 : -1;
+}
+
+/* ---- queries ---- */
+
+/* gives the running transaction its version, once */
+void pg_standin_take_snapshot(PgStandinConn_t *conn) {
+  PgStandin_t *s = conn->standin;
+
+  if (conn->in_txn && conn->has_snapshot) return;
+  pthread_mutex_lock(&s->lock);
+  conn->version = ++s->version;
+  pthread_mutex_unlock(&s->lock);
+  conn->has_snapshot = conn->in_txn;
+}
+
+void pg_standin_end_txn(PgStandinConn_t *conn) {
+  PgStandin_t *s = conn->standin;
+
+  pthread_mutex_lock(&s->lock);
+  for (size_t i = 0; i < s->snapshot_count;) {
+    if (s->snapshots[i].owner == conn->id) s->snapshots[i] = s->snapshots[--s->snapshot_count];
+    else i++;
+  }
+  pthread_mutex_unlock(&s->lock);
+  conn->in_txn = conn->failed = conn->has_snapshot = false;
+}
+
+void pg_standin_export(PgStandinConn_t *conn) {
+  PgStandin_t *s = conn->standin;
+  const char *name = "pg_export_snapshot";
+  char id[BUF_LEN_XS];
+  const char *values[1] = { id };
+
+  if (!conn->in_txn) {
+    pg_standin_error(conn, "0A000", "cannot export a snapshot outside a transaction");
+
+    return;
+  }
+  pg_standin_take_snapshot(conn);
+  snprintf(id, sizeof(id), "%08zX-%08llX-1", conn->id, (unsigned long long)conn->version);
+  pthread_mutex_lock(&s->lock);
+  if (s->snapshot_count < PG_STANDIN_MAX_SNAPSHOTS) {
+    snprintf(s->snapshots[s->snapshot_count].id, sizeof(s->snapshots[0].id), "%s", id);
+    s->snapshots[s->snapshot_count].version = conn->version;
+    s->snapshots[s->snapshot_count++].owner = conn->id;
+  }
+  s->exported_version = conn->version;
+  pthread_mutex_unlock(&s->lock);
+  pg_standin_row_description(conn, &name, 1);
+  pg_standin_data_row(conn, values, 1);
+  pg_standin_complete(conn, "SELECT 1");
+}
+
+void pg_standin_import(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  const char *open = strchr(statement, '\''), *close = open ? strchr(open + 1, '\'') : NULL;
+  char message[BUF_LEN_S];
+  bool found = false;
+
+  if (!conn->in_txn || conn->has_snapshot) {
+    pg_standin_error(conn, "25001", "SET TRANSACTION SNAPSHOT must be called before any query");
+
+    return;
+  }
+  pthread_mutex_lock(&s->lock);
+  for (size_t i = 0; open && close && i < s->snapshot_count && !found; i++) {
+    found = strlen(s->snapshots[i].id) == (size_t)(close - open - 1)
+      && strncmp(s->snapshots[i].id, open + 1, (size_t)(close - open - 1)) == 0;
+    if (found) conn->version = s->snapshots[i].version;
+  }
+  if (found) s->imports++;
+  pthread_mutex_unlock(&s->lock);
+  if (!found) {
+    snprintf(message, sizeof(message), "invalid snapshot identifier: %s", open ? open : "");
+    pg_standin_error(conn, "22023", message);
+
+    return;
+  }
+  conn->has_snapshot = true;
+  pg_standin_complete(conn, "SET");
+}
+
+void pg_standin_post_data(const PgStandinTable_t *table, char *out, size_t len) {
+  snprintf(out, len, "CREATE INDEX %s_row_idx ON %s.%s USING btree (row);", table->name, table->schema, table->name);
+}
+
+void pg_standin_list(PgStandinConn_t *conn, bool post_data) {
+  PgStandin_t *s = conn->standin;
+  const char *names[3] = { "nspname", "relname", "pg_relation_size" };
+  char size[BUF_LEN_XS], statement[BUF_LEN_S], tag[BUF_LEN_XS];
+
+  pg_standin_take_snapshot(conn);
+  pg_standin_row_description(conn, names, post_data ? 1 : 3);
+  for (size_t i = 0; i < s->table_count; i++) {
+    const char *values[3] = { s->tables[i].schema, s->tables[i].name, size };
+
+    snprintf(size, sizeof(size), "%zu", s->tables[i].rows * PG_STANDIN_ROW_BYTES);
+    if (post_data) {
+      pg_standin_post_data(&s->tables[i], statement, sizeof(statement));
+      values[0] = statement;
+    }
+    pg_standin_data_row(conn, values, post_data ? 1 : 3);
+  }
+  snprintf(tag, sizeof(tag), "SELECT %zu", s->table_count);
+  pg_standin_complete(conn, tag);
+}
+
+/* reads one "quoted" identifier at @p into @out; the position after it */
+const char *pg_standin_ident(const char *p, char *out, size_t len) {
+  size_t n = 0;
+
+  if (*p++ != '"') return NULL;
+  for (; *p; p++) {
+    if (*p == '"' && p[1] != '"') break;
+    if (*p == '"') p++;
+    if (n + 1 < len) out[n++] = *p;
+  }
+  out[n] = '\0';
+
+  return *p == '"' ? p + 1 : NULL;
+}
+
+/* the table named "schema"."name" at @p, @end set past the name; NULL when unknown */
+const PgStandinTable_t *pg_standin_table(const PgStandin_t *s, const char *p, const char **end) {
+  char schema[BUF_LEN_XS], name[BUF_LEN_XS];
+
+  p = p ? pg_standin_ident(p, schema, sizeof(schema)) : NULL;
+  p = p && *p == '.' ? pg_standin_ident(p + 1, name, sizeof(name)) : NULL;
+  if (end) *end = p;
+  for (size_t i = 0; p && i < s->table_count; i++) {
+    if (strcmp(s->tables[i].schema, schema) == 0 && strcmp(s->tables[i].name, name) == 0) return &s->tables[i];
+  }
+
+  return NULL;
+}
+
+/* answers a one-row query, or an empty one when @values is NULL */
+void pg_standin_answer(PgStandinConn_t *conn, const char **names, const char **values, uint16_t cols) {
+  pg_standin_take_snapshot(conn);
+  pg_standin_row_description(conn, names, cols);
+  if (values) pg_standin_data_row(conn, values, cols);
+  pg_standin_complete(conn, values ? "SELECT 1" : "SELECT 0");
+}
+
+/* the queries planning a split: block size, primary key, key range and columns */
+void pg_standin_plan(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  const char *names[2] = { "value", "max" }, *values[2] = { NULL, NULL }, *at;
+  const PgStandinTable_t *table;
+  char max[BUF_LEN_XS];
+
+  if (strstr(statement, "current_setting('block_size')")) {
+    values[0] = "8192";
+  } else if ((at = strstr(statement, "i.indrelid = '"))) {
+    table = pg_standin_table(s, at + 14, NULL);
+    values[0] = table && table->keyed ? "id" : NULL;
+  } else if ((at = strstr(statement, "attrelid = '"))) {
+    table = pg_standin_table(s, at + 12, NULL);
+    values[0] = table ? "id, version" : NULL;
+  } else if ((at = strstr(statement, " FROM "))) {
+    table = pg_standin_table(s, at + 6, NULL);
+    if (!table || !table->keyed) {
+      pg_standin_error(conn, "42703", "column \"id\" does not exist");
+
+      return;
+    }
+    snprintf(max, sizeof(max), "%zu", table->rows - 1);
+    values[0] = table->rows ? "0" : NULL;
+    values[1] = table->rows ? max : NULL;
+    pg_standin_answer(conn, names, values, 2);
+
+    return;
+  }
+  pg_standin_answer(conn, names, values[0] ? values : NULL, 1);
+}
+
+/* narrows [@first, @last) to the rows a ranged COPY's WHERE clause keeps */
+bool pg_standin_range(const PgStandinTable_t *table, const char *where, size_t *first, size_t *last) {
+  const char *at;
+  long long bound;
+
+  if (!where) return true;
+  if ((at = strstr(where, "\"id\" >= ")) || (at = strstr(where, "\"id\" < "))) {
+    if (!table->keyed) return false;
+  }
+  if ((at = strstr(where, "\"id\" >= "))) {
+    bound = strtoll(at + 8, NULL, 10);
+    if (bound > 0 && (size_t)bound > *first) *first = (size_t)bound;
+  }
+  if ((at = strstr(where, "\"id\" < "))) {
+    bound = strtoll(at + 7, NULL, 10);
+    if (bound < 0) bound = 0;
+    if ((size_t)bound < *last) *last = (size_t)bound;
+  }
+  if ((at = strstr(where, "ctid >= '("))) {
+    bound = strtoll(at + 10, NULL, 10) * PG_STANDIN_ROWS_PER_BLOCK;
+    if ((size_t)bound > *first) *first = (size_t)bound;
+  }
+  if ((at = strstr(where, "ctid < '("))) {
+    bound = strtoll(at + 9, NULL, 10) * PG_STANDIN_ROWS_PER_BLOCK;
+    if ((size_t)bound < *last) *last = (size_t)bound;
+  }
+
+  return true;
+}
+
+/* COPY ... FROM STDIN (FORMAT binary) of id, version tuples; kept only once the client ends it */
+int pg_standin_copy_in(PgStandinConn_t *conn, PgStandinTable_t *table) {
+  PgStandin_t *s = conn->standin;
+  PgStandinOut_t in = { NULL, 0, 0 };
+  PgStandinRow_t *rows = NULL, *grown;
+  unsigned char *payload;
+  const unsigned char *p, *end;
+  size_t len, start, count = 0, cap = 0;
+  char type, tag[BUF_LEN_XS];
+  bool malformed;
+
+  start = pg_standin_begin(&conn->out, 'G');
+  pg_standin_put(&conn->out, "\1", 1);
+  pg_standin_put16(&conn->out, 2);
+  pg_standin_put16(&conn->out, 1);
+  pg_standin_put16(&conn->out, 1);
+  pg_standin_end(&conn->out, start);
+  if (pg_standin_flush(conn) != 0) return -1;
+  do {
+    if (pg_standin_read_message(conn->fd, &type, &payload, &len) != 0) {
+      free(in.data);
+
+      return -1;
+    }
+    if (type == 'd') pg_standin_put(&in, payload, len);
+    free(payload);
+  } while (type != 'c' && type != 'f');
+  if (type == 'f') {
+    free(in.data);
+    pg_standin_error(conn, "57014", "COPY from stdin failed");
+
+    return 0;
+  }
+
+  // signature, flags, empty extension, then two int8 fields per tuple up to the -1 trailer
+  p = in.data;
+  end = p + in.len;
+  if (in.len < 19 || memcmp(p, "PGCOPY\n\377\r\n\0", 11) != 0 || pg_standin_be32(p + 15) != 0) p = end;
+  else p += 19;
+  while (end - p >= 26 && p[0] == 0 && p[1] == 2 && pg_standin_be32(p + 2) == 8 && pg_standin_be32(p + 14) == 8) {
+    if (count == cap) {
+      cap = cap ? cap * 2 : 256;
+      if (!(grown = realloc(rows, cap * sizeof(PgStandinRow_t)))) break;
+      rows = grown;
+    }
+    rows[count].id = (uint64_t)pg_standin_be32(p + 6) << 32 | pg_standin_be32(p + 10);
+    rows[count++].version = (uint64_t)pg_standin_be32(p + 18) << 32 | pg_standin_be32(p + 22);
+    p += 26;
+  }
+  malformed = end - p != 2 || p[0] != 0xff || p[1] != 0xff;
+  free(in.data);
+  if (malformed) {
+    free(rows);
+    pg_standin_error(conn, "22P04", "invalid COPY file");
+
+    return 0;
+  }
+  pthread_mutex_lock(&s->lock);
+  grown = realloc(table->loaded, (table->loaded_rows + count + 1) * sizeof(PgStandinRow_t));
+  if (grown) {
+    table->loaded = grown;
+    if (count) memcpy(table->loaded + table->loaded_rows, rows, count * sizeof(PgStandinRow_t));
+    table->loaded_rows += count;
+  }
+  pthread_mutex_unlock(&s->lock);
+  free(rows);
+  snprintf(tag, sizeof(tag), "COPY %zu", count);
+  pg_standin_complete(conn, tag);
+
+  return 0;
+}
+
+/* CREATE INDEX ... ON schema.name ...: marks the table indexed */
+void pg_standin_create_index(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  const char *on = strstr(statement, " ON ");
+  char name[BUF_LEN_S];
+  bool found = false;
+
+  // names are written unquoted by pg_standin_post_data(), spaces and all
+  pthread_mutex_lock(&s->lock);
+  for (size_t i = 0; on && !found && i < s->table_count; i++) {
+    size_t n = (size_t)snprintf(name, sizeof(name), "%s.%s ", s->tables[i].schema, s->tables[i].name);
+
+    if ((found = strncmp(on + 4, name, n) == 0)) s->tables[i].indexed = true;
+  }
+  pthread_mutex_unlock(&s->lock);
+  if (found) pg_standin_complete(conn, "CREATE INDEX");
+  else pg_standin_error(conn, "42P01", "relation does not exist");
+}
+
+/* the replica identity of every keyed table: its name and "id" */
+void pg_standin_keys(PgStandinConn_t *conn) {
+  PgStandin_t *s = conn->standin;
+  const char *names[2] = { "format", "quote_ident" }, *values[2];
+  char table[BUF_LEN_S], tag[BUF_LEN_XS];
+  size_t rows = 0;
+
+  pg_standin_take_snapshot(conn);
+  pg_standin_row_description(conn, names, 2);
+  for (size_t i = 0; i < s->table_count; i++) {
+    if (!s->tables[i].keyed) continue;
+    snprintf(table, sizeof(table), "%s.%s", s->tables[i].schema, s->tables[i].name);
+    values[0] = table;
+    values[1] = "id";
+    pg_standin_data_row(conn, values, 2);
+    rows++;
+  }
+  snprintf(tag, sizeof(tag), "SELECT %zu", rows);
+  pg_standin_complete(conn, tag);
+}
+
+/*
+ * INSERT INTO t (id, version) VALUES (a, b), UPDATE t SET id = a,
+ * version = b WHERE id = k and DELETE FROM t WHERE id = k on the
+ * table's loaded rows, as a replay writes them; applied at once,
+ * a ROLLBACK does not take them back
+ */
+void pg_standin_dml(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  PgStandinTable_t *table = NULL;
+  PgStandinRow_t *grown;
+  unsigned long long id = 0, version = 0, key = 0;
+  const char *p = statement + (strncasecmp(statement, "UPDATE ", 7) == 0 ? 7 : 12);
+  char name[BUF_LEN_S], tag[BUF_LEN_XS];
+  size_t hits = 0;
+  int used = -1;
+
+  pthread_mutex_lock(&s->lock);
+  for (size_t i = 0; !table && i < s->table_count; i++) {
+    size_t n = (size_t)snprintf(name, sizeof(name), "%s.%s ", s->tables[i].schema, s->tables[i].name);
+
+    if (strncmp(p, name, n) == 0) {
+      table = &s->tables[i];
+      p += n;
+    }
+  }
+  if (!table) {
+    pthread_mutex_unlock(&s->lock);
+    pg_standin_error(conn, "42P01", "relation does not exist");
+
+    return;
+  }
+  if (strncasecmp(statement, "INSERT ", 7) == 0) {
+    if (sscanf(p, "(id, version) VALUES (%llu, %llu)%n", &id, &version, &used) != 2 || p[used]) used = -1;
+    for (size_t i = 0; used >= 0 && table->keyed && i < table->loaded_rows; i++) hits += table->loaded[i].id == id;
+    if (used >= 0 && !hits && (grown = realloc(table->loaded, (table->loaded_rows + 1) * sizeof(PgStandinRow_t)))) {
+      table->loaded = grown;
+      table->loaded[table->loaded_rows].id = id;
+      table->loaded[table->loaded_rows++].version = version;
+      snprintf(tag, sizeof(tag), "INSERT 0 1");
+    } else if (used >= 0) {
+      used = hits ? -2 : -1;
+    }
+  } else if (strncasecmp(statement, "UPDATE ", 7) == 0) {
+    if (sscanf(p, "SET id = %llu, version = %llu WHERE id = %llu%n", &id, &version, &key, &used) != 3 || p[used]) {
+      used = -1;
+    }
+    for (size_t i = 0; used >= 0 && i < table->loaded_rows; i++) {
+      if (table->loaded[i].id != key) continue;
+      table->loaded[i].id = id;
+      table->loaded[i].version = version;
+      hits++;
+    }
+    snprintf(tag, sizeof(tag), "UPDATE %zu", hits);
+  } else {
+    if (sscanf(p, "WHERE id = %llu%n", &key, &used) != 1 || p[used]) used = -1;
+    for (size_t i = 0; used >= 0 && i < table->loaded_rows;) {
+      if (table->loaded[i].id != key) {
+        i++;
+        continue;
+      }
+      memmove(&table->loaded[i], &table->loaded[i + 1], (table->loaded_rows - i - 1) * sizeof(PgStandinRow_t));
+      table->loaded_rows--;
+      hits++;
+    }
+    snprintf(tag, sizeof(tag), "DELETE %zu", hits);
+  }
+  pthread_mutex_unlock(&s->lock);
+  if (used == -2) pg_standin_error(conn, "23505", "duplicate key value violates unique constraint");
+  else if (used < 0) pg_standin_error(conn, "42601", "syntax error");
+  else pg_standin_complete(conn, tag);
+}
+
+int pg_standin_copy(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  const PgStandinTable_t *table = NULL;
+  char row[BUF_LEN_XS], message[BUF_LEN_S];
+  const char *p = NULL, *where = NULL;
+  size_t start, first = 0, last = 0;
+  bool ranged = strncmp(statement, "COPY (SELECT id, version FROM ONLY ", 35) == 0, binary;
+
+  if (ranged) {
+    table = pg_standin_table(s, statement + 35, &p);
+    if (p && strncmp(p, " WHERE ", 7) == 0) {
+      where = p + 7;
+      p = strstr(where, ") TO STDOUT");
+    }
+    if (p && *p == ')') p++;
+  } else {
+    table = pg_standin_table(s, statement + 5, &p);
+  }
+  if (table && !ranged && p && strcmp(p, " FROM STDIN (FORMAT binary)") == 0) {
+    return pg_standin_copy_in(conn, &s->tables[table - s->tables]);
+  }
+  if (table) last = table->rows;
+  binary = p && strcmp(p, " TO STDOUT (FORMAT binary)") == 0;
+  if (!table || !p || (!binary && strcmp(p, " TO STDOUT") != 0) || !pg_standin_range(table, where, &first, &last)) {
+    snprintf(message, sizeof(message), "relation in \"%s\" does not exist", statement);
+    pg_standin_error(conn, "42P01", message);
+
+    return 0;
+  }
+  pg_standin_take_snapshot(conn);
+  __atomic_add_fetch(&s->copies, 1, __ATOMIC_RELAXED);
+  if (ranged) __atomic_add_fetch(&s->ranges, 1, __ATOMIC_RELAXED);
+
+  start = pg_standin_begin(&conn->out, 'H');
+  pg_standin_put(&conn->out, binary ? "\1" : "", 1);
+  pg_standin_put16(&conn->out, 2);
+  pg_standin_put16(&conn->out, binary);
+  pg_standin_put16(&conn->out, binary);
+  pg_standin_end(&conn->out, start);
+  if (binary) {
+    // signature, flags and an empty header extension
+    start = pg_standin_begin(&conn->out, 'd');
+    pg_standin_put(&conn->out, "PGCOPY\n\377\r\n\0", 11);
+    pg_standin_put32(&conn->out, 0);
+    pg_standin_put32(&conn->out, 0);
+    pg_standin_end(&conn->out, start);
+  }
+  for (size_t i = first; i < last; i++) {
+    // a server may send a notice at any time, even in the midst of the data
+    if (i == first + (last - first) / 2) pg_standin_notice(conn, "halfway through the table");
+    start = pg_standin_begin(&conn->out, 'd');
+    if (binary) {
+      pg_standin_put16(&conn->out, 2);
+      pg_standin_put32(&conn->out, 8);
+      pg_standin_put32(&conn->out, (uint32_t)((uint64_t)i >> 32));
+      pg_standin_put32(&conn->out, (uint32_t)i);
+      pg_standin_put32(&conn->out, 8);
+      pg_standin_put32(&conn->out, (uint32_t)(conn->version >> 32));
+      pg_standin_put32(&conn->out, (uint32_t)conn->version);
+    } else {
+      snprintf(row, sizeof(row), "%zu\t%llu\n", i, (unsigned long long)conn->version);
+      pg_standin_put(&conn->out, row, strlen(row));
+    }
+    pg_standin_end(&conn->out, start);
+    // stream, rather than hold a whole table
+    if (conn->out.len > 64 * 1024 && pg_standin_flush(conn) != 0) return -1;
+  }
+  if (binary) {
+    start = pg_standin_begin(&conn->out, 'd');
+    pg_standin_put16(&conn->out, 0xffff);
+    pg_standin_end(&conn->out, start);
+  }
+  start = pg_standin_begin(&conn->out, 'c');
+  pg_standin_end(&conn->out, start);
+  snprintf(row, sizeof(row), "COPY %zu", last > first ? last - first : 0);
+  pg_standin_complete(conn, row);
+
+  return 0;
+}
+
+/* ---- replication ---- */
+
+void pg_standin_put64(PgStandinOut_t *out, uint64_t v) {
+  pg_standin_put32(out, (uint32_t)(v >> 32));
+  pg_standin_put32(out, (uint32_t)v);
+}
+
+uint64_t pg_standin_be64(const unsigned char *p) {
+  return ((uint64_t)pg_standin_be32(p) << 32) | pg_standin_be32(p + 4);
+}
+
+/* the server clock, microseconds since 2000-01-01 */
+uint64_t pg_standin_clock(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return ((uint64_t)ts.tv_sec - 946684800u) * 1000000u + (uint64_t)ts.tv_nsec / 1000u;
+}
+
+unsigned char pg_standin_wal_byte(PgStandin_t *standin, uint32_t timeline, uint64_t lsn) {
+  unsigned char byte = (unsigned char)((lsn * 0x9e3779b97f4a7c15ull) >> 56);
+  uint64_t fork = __atomic_load_n(&standin->wal_switch, __ATOMIC_RELAXED);
+
+  return timeline > 1 && lsn >= fork ? byte ^ 0xa5 : byte;
+}
+
+/* how far @timeline reaches, and whether it ended there */
+uint64_t pg_standin_wal_reach(PgStandin_t *s, uint32_t timeline, bool *ended) {
+  uint64_t end;
+
+  pthread_mutex_lock(&s->lock);
+  *ended = timeline < s->wal_timeline;
+  end = *ended ? s->wal_switch : s->wal_end;
+  pthread_mutex_unlock(&s->lock);
+
+  return end;
+}
+
+void pg_standin_identify(PgStandinConn_t *conn) {
+  PgStandin_t *s = conn->standin;
+  const char *names[4] = { "systemid", "timeline", "xlogpos", "dbname" }, *values[4];
+  char timeline[16], lsn[BUF_LEN_XS];
+  uint64_t end;
+
+  pthread_mutex_lock(&s->lock);
+  snprintf(timeline, sizeof(timeline), "%u", s->wal_timeline);
+  end = s->wal_end;
+  pthread_mutex_unlock(&s->lock);
+  snprintf(lsn, sizeof(lsn), "%X/%X", (unsigned int)(end >> 32), (unsigned int)end);
+  values[0] = "7000000000000000001";
+  values[1] = timeline;
+  values[2] = lsn;
+  values[3] = NULL;
+  pg_standin_answer(conn, names, values, 4);
+}
+
+/* XLogData of @len bytes of @timeline from @pos */
+void pg_standin_xlog(PgStandinConn_t *conn, uint32_t timeline, uint64_t pos, size_t len, uint64_t end) {
+  unsigned char data[PG_STANDIN_WAL_CHUNK];
+  size_t at = pg_standin_begin(&conn->out, 'd');
+
+  pg_standin_put(&conn->out, "w", 1);
+  pg_standin_put64(&conn->out, pos);
+  pg_standin_put64(&conn->out, end);
+  pg_standin_put64(&conn->out, pg_standin_clock());
+  for (size_t i = 0; i < len; i++) data[i] = pg_standin_wal_byte(conn->standin, timeline, pos + i);
+  pg_standin_put(&conn->out, data, len);
+  pg_standin_end(&conn->out, at);
+}
+
+/**
+ * pg_standin_listen - handles what the client sent during a stream
+ * @conn: the connection
+ * @wait_ms: how long to wait for a message
+ * @done: set when the client sent CopyDone
+ *
+ * Return: 0 to go on, -1 once the client is gone
+ **/
+int pg_standin_listen(PgStandinConn_t *conn, int wait_ms, bool *done) {
+  struct pollfd pfd = { .fd = conn->fd, .events = POLLIN };
+  unsigned char *payload;
+  size_t len;
+  char type;
+
+  while (poll(&pfd, 1, wait_ms) > 0) {
+    if (pg_standin_read_message(conn->fd, &type, &payload, &len) != 0) return -1;
+    if (type == 'd' && len >= 34 && payload[0] == 'r') {
+      PgStandin_t *s = conn->standin;
+
+      __atomic_store_n(&s->wal_flushed, pg_standin_be64(payload + 9), __ATOMIC_RELAXED);
+      pthread_mutex_lock(&s->lock);
+      for (size_t i = 0; conn->slot[0] && i < PG_STANDIN_MAX_SLOTS; i++) {
+        if (strcmp(s->physical[i].name, conn->slot) == 0) s->physical[i].restart_lsn = pg_standin_be64(payload + 9);
+      }
+      pthread_mutex_unlock(&s->lock);
+    }
+    free(payload);
+    if (type == 'X') return -1;
+    if (type == 'c') *done = true;
+    if (type == 'c' || wait_ms) break;
+  }
+
+  return 0;
+}
+
+/* START_REPLICATION: streams until the timeline ends or the client stops the stream */
+int pg_standin_stream(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  const char *names[2] = { "next_tli", "next_tli_startpos" }, *values[2];
+  char timeline_text[16], lsn[BUF_LEN_XS];
+  unsigned int hi, lo, timeline;
+  uint64_t pos, end = 0;
+  bool ended, done = false;
+  size_t at, idle = 0;
+
+  char slot[BUF_LEN_XS] = "", message[BUF_LEN_S];
+  const char *p = statement + 18;
+  bool found = false;
+
+  if (strncmp(p, "SLOT ", 5) == 0 && (p = pg_standin_ident(p + 5, slot, sizeof(slot))) != NULL) {
+    pthread_mutex_lock(&s->lock);
+    for (size_t i = 0; i < PG_STANDIN_MAX_SLOTS && !found; i++) found = strcmp(s->physical[i].name, slot) == 0;
+    pthread_mutex_unlock(&s->lock);
+    if (!found) {
+      snprintf(message, sizeof(message), "replication slot \"%s\" does not exist", slot);
+      pg_standin_error(conn, "42704", message);
+
+      return 0;
+    }
+  }
+  if (!p || sscanf(p, " PHYSICAL %X/%X TIMELINE %u", &hi, &lo, &timeline) != 3
+    || timeline == 0 || timeline > __atomic_load_n(&s->wal_timeline, __ATOMIC_RELAXED)) {
+    pg_standin_error(conn, "58P01", "requested timeline is not in this server's history");
+
+    return 0;
+  }
+  if (found) __atomic_add_fetch(&s->slot_streams, 1, __ATOMIC_RELAXED);
+  snprintf(conn->slot, sizeof(conn->slot), "%s", slot);
+  pos = ((uint64_t)hi << 32) | lo;
+  if (pos > pg_standin_wal_reach(s, timeline, &ended)) {
+    pg_standin_error(conn, "58P01", "requested starting point is ahead of the WAL flush position");
+
+    return 0;
+  }
+  __atomic_add_fetch(&s->wal_streams, 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&s->wal_start, pos, __ATOMIC_RELAXED);
+  at = pg_standin_begin(&conn->out, 'W');
+  pg_standin_put(&conn->out, "\0\0", 3);
+  pg_standin_end(&conn->out, at);
+  if (pg_standin_flush(conn) != 0) return -1;
+
+  while (!done) {
+    end = pg_standin_wal_reach(s, timeline, &ended);
+    if (pos < end) {
+      size_t len = end - pos < PG_STANDIN_WAL_CHUNK ? (size_t)(end - pos) : PG_STANDIN_WAL_CHUNK;
+
+      pg_standin_xlog(conn, timeline, pos, len, end);
+      pos += len;
+      idle = 0;
+      if (pg_standin_flush(conn) != 0 || pg_standin_listen(conn, 0, &done) != 0) return -1;
+      continue;
+    }
+    if (ended) break;
+
+    // caught up: a keepalive asking for a reply now and then
+    if (++idle * 20 >= PG_STANDIN_KEEPALIVE_MS) {
+      at = pg_standin_begin(&conn->out, 'd');
+      pg_standin_put(&conn->out, "k", 1);
+      pg_standin_put64(&conn->out, end);
+      pg_standin_put64(&conn->out, pg_standin_clock());
+      pg_standin_put(&conn->out, "\1", 1);
+      pg_standin_end(&conn->out, at);
+      if (pg_standin_flush(conn) != 0) return -1;
+      idle = 0;
+    }
+    if (pg_standin_listen(conn, 20, &done) != 0) return -1;
+  }
+
+  // CopyDone both ways, then where the next timeline starts when this one ended
+  at = pg_standin_begin(&conn->out, 'c');
+  pg_standin_end(&conn->out, at);
+  if (pg_standin_flush(conn) != 0) return -1;
+  while (!done) {
+    if (pg_standin_listen(conn, 1000, &done) != 0) return -1;
+  }
+  if (ended) {
+    snprintf(timeline_text, sizeof(timeline_text), "%u", timeline + 1);
+    snprintf(lsn, sizeof(lsn), "%X/%X", (unsigned int)(end >> 32), (unsigned int)end);
+    values[0] = timeline_text;
+    values[1] = lsn;
+    pg_standin_row_description(conn, names, 2);
+    pg_standin_data_row(conn, values, 2);
+    pg_standin_complete(conn, "SELECT 1");
+  }
+  pg_standin_complete(conn, "START_STREAMING");
+
+  return 0;
+}
+
+void pg_standin_format_lsn(uint64_t lsn, char *out, size_t len) {
+  snprintf(out, len, "%X/%X", (unsigned int)(lsn >> 32), (unsigned int)lsn);
+}
+
+/* ---- slots and backup mode ---- */
+
+/* CREATE_REPLICATION_SLOT "name" [TEMPORARY] PHYSICAL RESERVE_WAL */
+void pg_standin_create_physical(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  const char *names[4] = { "slot_name", "consistent_point", "snapshot_name", "output_plugin" }, *values[4];
+  char slot[BUF_LEN_XS], lsn[BUF_LEN_XS], message[BUF_LEN_S];
+  const char *p = pg_standin_ident(statement + 24, slot, sizeof(slot));
+  bool temporary = p && strcmp(p, " TEMPORARY PHYSICAL RESERVE_WAL") == 0;
+  PgStandinSlot_t *free_slot = NULL;
+  int code = 0;
+
+  if (!p || (!temporary && strcmp(p, " PHYSICAL RESERVE_WAL") != 0)) {
+    pg_standin_error(conn, "42601", "syntax error");
+
+    return;
+  }
+  pthread_mutex_lock(&s->lock);
+  for (size_t i = 0; i < PG_STANDIN_MAX_SLOTS; i++) {
+    if (strcmp(s->physical[i].name, slot) == 0) code = 1;
+    if (!s->physical[i].name[0] && !free_slot) free_slot = &s->physical[i];
+  }
+  if (!code && !free_slot) code = 2;
+  if (!code) {
+    snprintf(free_slot->name, sizeof(free_slot->name), "%s", slot);
+    free_slot->restart_lsn = s->wal_end;
+    free_slot->owner = temporary ? conn->id : 0;
+    pg_standin_format_lsn(s->wal_end, lsn, sizeof(lsn));
+  }
+  pthread_mutex_unlock(&s->lock);
+  if (code) {
+    snprintf(message, sizeof(message), code == 1 ? "replication slot \"%s\" already exists"
+      : "all replication slots are in use", slot);
+    pg_standin_error(conn, code == 1 ? "42710" : "53400", message);
+
+    return;
+  }
+  values[0] = slot;
+  values[1] = lsn;
+  values[2] = values[3] = NULL;
+  pg_standin_row_description(conn, names, 4);
+  pg_standin_data_row(conn, values, 4);
+  pg_standin_complete(conn, "CREATE_REPLICATION_SLOT");
+}
+
+/* SELECT pg_catalog.pg_backup_start('label', true) */
+void pg_standin_backup_start(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  const char *name = "pg_backup_start", *values[1], *open = strstr(statement, "('");
+  const char *close = open ? strstr(open + 2, "', true)") : NULL;
+  char lsn[BUF_LEN_XS];
+  bool busy;
+
+  if (!close || (size_t)(close - open - 2) >= sizeof(s->backup_label)) {
+    pg_standin_error(conn, "42601", "syntax error");
+
+    return;
+  }
+  pthread_mutex_lock(&s->lock);
+  busy = s->backup_label[0] != '\0';
+  if (!busy) {
+    memcpy(s->backup_label, open + 2, (size_t)(close - open - 2));
+    s->backup_label[close - open - 2] = '\0';
+    s->backup_owner = conn->id;
+    s->backup_start = s->wal_end;
+    pg_standin_format_lsn(s->wal_end, lsn, sizeof(lsn));
+  }
+  pthread_mutex_unlock(&s->lock);
+  if (busy) {
+    pg_standin_error(conn, "55000", "a backup is already in progress");
+
+    return;
+  }
+  values[0] = lsn;
+  pg_standin_answer(conn, &name, values, 1);
+}
+
+/* SELECT lsn, labelfile, spcmapfile FROM pg_catalog.pg_backup_stop(false) */
+void pg_standin_backup_stop(PgStandinConn_t *conn) {
+  PgStandin_t *s = conn->standin;
+  const char *names[3] = { "lsn", "labelfile", "spcmapfile" }, *values[3];
+  char start[BUF_LEN_XS], stop[BUF_LEN_XS], label[BUF_LEN];
+  bool ours;
+
+  pthread_mutex_lock(&s->lock);
+  ours = s->backup_label[0] && s->backup_owner == conn->id;
+  if (ours) {
+    s->wal_end += PG_STANDIN_BACKUP_END;
+    pg_standin_format_lsn(s->backup_start, start, sizeof(start));
+    pg_standin_format_lsn(s->wal_end, stop, sizeof(stop));
+    snprintf(label, sizeof(label), "START WAL LOCATION: %s\nSTOP WAL LOCATION: %s\nBACKUP METHOD: streamed\n"
+      "BACKUP FROM: primary\nLABEL: %s\nSTART TIMELINE: %u\n", start, stop, s->backup_label, s->wal_timeline);
+    s->backup_label[0] = '\0';
+    s->backups++;
+  }
+  pthread_mutex_unlock(&s->lock);
+  if (!ours) {
+    pg_standin_error(conn, "55000", "backup is not in progress");
+
+    return;
+  }
+  values[0] = stop;
+  values[1] = label;
+  values[2] = "";
+  pg_standin_answer(conn, names, values, 3);
+}
+
+/* ---- logical decoding ---- */
+
+/* CREATE_REPLICATION_SLOT "name" LOGICAL test_decoding EXPORT_SNAPSHOT */
+void pg_standin_create_slot(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  const char *names[4] = { "slot_name", "consistent_point", "snapshot_name", "output_plugin" }, *values[4];
+  const char *p;
+  char slot[BUF_LEN_XS], lsn[BUF_LEN_XS], id[BUF_LEN_XS], message[BUF_LEN_S];
+  bool exists;
+
+  p = pg_standin_ident(statement + 24, slot, sizeof(slot));
+  if (!p || strcmp(p, " LOGICAL test_decoding EXPORT_SNAPSHOT") != 0) {
+    pg_standin_error(conn, "42601", "syntax error");
+
+    return;
+  }
+  pthread_mutex_lock(&s->lock);
+  exists = s->slot[0] != '\0';
+  if (!exists) {
+    snprintf(s->slot, sizeof(s->slot), "%s", slot);
+    s->slot_lsn = s->change_lsn;
+    s->slot_version = conn->version = ++s->version;
+    s->slots_created++;
+    snprintf(id, sizeof(id), "%08zX-%08llX-1", conn->id, (unsigned long long)conn->version);
+    if (s->snapshot_count < PG_STANDIN_MAX_SNAPSHOTS) {
+      snprintf(s->snapshots[s->snapshot_count].id, sizeof(s->snapshots[0].id), "%s", id);
+      s->snapshots[s->snapshot_count].version = conn->version;
+      s->snapshots[s->snapshot_count++].owner = conn->id;
+    }
+    pg_standin_format_lsn(s->slot_lsn, lsn, sizeof(lsn));
+  }
+  pthread_mutex_unlock(&s->lock);
+  if (exists) {
+    snprintf(message, sizeof(message), "replication slot \"%s\" already exists", slot);
+    pg_standin_error(conn, "42710", message);
+
+    return;
+  }
+  values[0] = slot;
+  values[1] = lsn;
+  values[2] = id;
+  values[3] = "test_decoding";
+  pg_standin_row_description(conn, names, 4);
+  pg_standin_data_row(conn, values, 4);
+  pg_standin_complete(conn, "CREATE_REPLICATION_SLOT");
+}
+
+/* DROP_REPLICATION_SLOT "name" */
+void pg_standin_drop_slot(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  char slot[BUF_LEN_XS] = "", message[BUF_LEN_S];
+  bool found;
+
+  pthread_mutex_lock(&s->lock);
+  found = pg_standin_ident(statement + 22, slot, sizeof(slot)) && strcmp(s->slot, slot) == 0 && slot[0];
+  if (found) s->slot[0] = '\0';
+  pthread_mutex_unlock(&s->lock);
+  if (!found) {
+    snprintf(message, sizeof(message), "replication slot \"%s\" does not exist", slot);
+    pg_standin_error(conn, "42704", message);
+
+    return;
+  }
+  pg_standin_complete(conn, "DROP_REPLICATION_SLOT");
+}
+
+/* reads the 'slot' and 'X/X' arguments after @at; 0 when both are there */
+int pg_standin_slot_args(const char *at, char *slot, size_t len, uint64_t *lsn) {
+  const char *close = strchr(at, '\'');
+  unsigned int hi, lo;
+
+  if (!close || (size_t)(close - at) >= len) return -1;
+  memcpy(slot, at, (size_t)(close - at));
+  slot[close - at] = '\0';
+  if (sscanf(close, "', '%X/%X'", &hi, &lo) != 2) return -1;
+  *lsn = (uint64_t)hi << 32 | lo;
+
+  return 0;
+}
+
+/* SELECT pg_catalog.pg_replication_slot_advance('slot', 'X/X') */
+void pg_standin_advance(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  const char *names[2] = { "slot_name", "end_lsn" }, *values[2];
+  char slot[BUF_LEN_XS], lsn[BUF_LEN_XS], minimum[BUF_LEN_XS], message[BUF_LEN_S];
+  uint64_t to;
+  int code = 0;
+
+  if (pg_standin_slot_args(strstr(statement, "advance('") + 9, slot, sizeof(slot), &to) != 0) {
+    pg_standin_error(conn, "42601", "syntax error");
+
+    return;
+  }
+  pthread_mutex_lock(&s->lock);
+  if (!s->slot[0] || strcmp(s->slot, slot) != 0) code = 1;
+  else if (to < s->slot_lsn) code = 2;
+  else s->slot_lsn = to < s->change_lsn ? to : s->change_lsn;
+  pg_standin_format_lsn(to, lsn, sizeof(lsn));
+  pg_standin_format_lsn(s->slot_lsn, minimum, sizeof(minimum));
+  pthread_mutex_unlock(&s->lock);
+  if (code == 1) {
+    snprintf(message, sizeof(message), "replication slot \"%s\" does not exist", slot);
+    pg_standin_error(conn, "42704", message);
+  } else if (code == 2) {
+    snprintf(message, sizeof(message), "cannot advance replication slot to %s, minimum is %s", lsn, minimum);
+    pg_standin_error(conn, "55000", message);
+  } else {
+    values[0] = slot;
+    values[1] = minimum;
+    pg_standin_answer(conn, names, values, 2);
+  }
+}
+
+/* COPY (SELECT lsn, xid, data FROM pg_catalog.pg_logical_slot_peek_changes('slot', 'X/X', NULL)) TO STDOUT */
+int pg_standin_peek(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+  const char *at = strstr(statement, "peek_changes('");
+  char slot[BUF_LEN_XS], row[BUF_LEN], lsn[BUF_LEN_XS], text[BUF_LEN_S + 32], message[BUF_LEN_S];
+  size_t start, rows = 0;
+  uint64_t upto;
+
+  if (strncmp(statement, "COPY (SELECT lsn, xid, data FROM pg_catalog.pg_logical_slot_peek_changes('", 74) != 0
+    || pg_standin_slot_args(at + 14, slot, sizeof(slot), &upto) != 0 || !strstr(at, "', NULL)) TO STDOUT")) {
+    pg_standin_error(conn, "42601", "syntax error");
+
+    return 0;
+  }
+  pthread_mutex_lock(&s->lock);
+  if (!s->slot[0] || strcmp(s->slot, slot) != 0) {
+    pthread_mutex_unlock(&s->lock);
+    snprintf(message, sizeof(message), "replication slot \"%s\" does not exist", slot);
+    pg_standin_error(conn, "42704", message);
+
+    return 0;
+  }
+  s->peeks++;
+  start = pg_standin_begin(&conn->out, 'H');
+  pg_standin_put(&conn->out, "", 1);
+  pg_standin_put16(&conn->out, 3);
+  for (int i = 0; i < 3; i++) pg_standin_put16(&conn->out, 0);
+  pg_standin_end(&conn->out, start);
+  for (size_t i = 0; i < s->change_count; i++) {
+    const PgStandinChange_t *change = &s->changes[i];
+
+    if (change->lsn <= s->slot_lsn || change->lsn > upto) continue;
+    for (int part = 0; part < 3; part++) {
+      if (part == 0) snprintf(text, sizeof(text), "BEGIN %u", change->xid);
+      else if (part == 1) snprintf(text, sizeof(text), "%s", change->data);
+      else snprintf(text, sizeof(text), "COMMIT %u", change->xid);
+      pg_standin_format_lsn(change->lsn - (uint64_t)(2 - part) * 0x10, lsn, sizeof(lsn));
+      snprintf(row, sizeof(row), "%s\t%u\t%s\n", lsn, change->xid, text);
+      start = pg_standin_begin(&conn->out, 'd');
+      pg_standin_put(&conn->out, row, strlen(row));
+      pg_standin_end(&conn->out, start);
+      rows++;
+    }
+  }
+  pthread_mutex_unlock(&s->lock);
+  start = pg_standin_begin(&conn->out, 'c');
+  pg_standin_end(&conn->out, start);
+  snprintf(row, sizeof(row), "COPY %zu", rows);
+  pg_standin_complete(conn, row);
+
+  return 0;
+}
+
+/* the statements of a WAL sender */
+int pg_standin_replication(PgStandinConn_t *conn, const char *statement) {
+  if (strncasecmp(statement, "IDENTIFY_SYSTEM", 15) == 0) {
+    pg_standin_identify(conn);
+  } else if (strncasecmp(statement, "SHOW wal_segment_size", 21) == 0) {
+    const char *name = "wal_segment_size", *values[1];
+    char size[16];
+
+    snprintf(size, sizeof(size), "%uMB", __atomic_load_n(&conn->standin->wal_segment_size, __ATOMIC_RELAXED) >> 20);
+    values[0] = size;
+    pg_standin_answer(conn, &name, values, 1);
+  } else if (strncasecmp(statement, "CREATE_REPLICATION_SLOT ", 24) == 0) {
+    pg_standin_create_physical(conn, statement);
+  } else if (strncasecmp(statement, "TIMELINE_HISTORY ", 17) == 0) {
+    const char *names[2] = { "filename", "content" }, *values[2];
+    char name[BUF_LEN_XS], content[BUF_LEN_S];
+    unsigned int timeline = (unsigned int)strtoul(statement + 17, NULL, 10);
+
+    if (pg_standin_history(conn->standin, timeline, content, sizeof(content)) != 0) {
+      snprintf(name, sizeof(name), "could not open file \"pg_wal/%08X.history\"", timeline);
+      pg_standin_error(conn, "58P01", name);
+    } else {
+      snprintf(name, sizeof(name), "%08X.history", timeline);
+      values[0] = name;
+      values[1] = content;
+      pg_standin_answer(conn, names, values, 2);
+    }
+  } else if (strncasecmp(statement, "START_REPLICATION ", 18) == 0) {
+    return pg_standin_stream(conn, statement);
+  } else {
+    pg_standin_error(conn, "42601", "syntax error");
+  }
+
+  return 0;
+}
+
+int pg_standin_statement(PgStandinConn_t *conn, const char *statement) {
+  PgStandin_t *s = conn->standin;
+
+  if (conn->replication) return pg_standin_replication(conn, statement);
+  // a snapshot exported by CREATE_REPLICATION_SLOT lasts until the next command
+  if (conn->logical && !conn->in_txn) pg_standin_end_txn(conn);
+  if (conn->logical && strncasecmp(statement, "CREATE_REPLICATION_SLOT ", 24) == 0) {
+    pg_standin_create_slot(conn, statement);
+
+    return 0;
+  }
+  if (conn->logical && strncasecmp(statement, "DROP_REPLICATION_SLOT ", 22) == 0) {
+    pg_standin_drop_slot(conn, statement);
+
+    return 0;
+  }
+  if (conn->failed && strncasecmp(statement, "ROLLBACK", 8) != 0 && strncasecmp(statement, "COMMIT", 6) != 0) {
+    pg_standin_error(conn, "25P02", "current transaction is aborted, commands ignored until end of transaction block");
+  } else if (strncasecmp(statement, "BEGIN", 5) == 0) {
+    conn->in_txn = true;
+    pg_standin_complete(conn, "BEGIN");
+  } else if (strncasecmp(statement, "COMMIT", 6) == 0 || strncasecmp(statement, "ROLLBACK", 8) == 0) {
+    pg_standin_complete(conn, conn->failed ? "ROLLBACK" : "COMMIT");
+    pg_standin_end_txn(conn);
+  } else if (strncasecmp(statement, "SET TRANSACTION SNAPSHOT", 24) == 0) {
+    pg_standin_import(conn, statement);
+  } else if (strstr(statement, "set_config(")) {
+    const char *name = "set_config", *values[1] = { "" };
+
+    pg_standin_row_description(conn, &name, 1);
+    pg_standin_data_row(conn, values, 1);
+    pg_standin_complete(conn, "SELECT 1");
+  } else if (strstr(statement, "pg_export_snapshot()")) {
+    pg_standin_export(conn);
+  } else if (strstr(statement, "pg_current_wal_lsn()")) {
+    const char *name = "pg_current_wal_lsn", *values[1];
+    char lsn[BUF_LEN_XS];
+
+    pthread_mutex_lock(&s->lock);
+    pg_standin_format_lsn(s->change_lsn, lsn, sizeof(lsn));
+    pthread_mutex_unlock(&s->lock);
+    values[0] = lsn;
+    pg_standin_answer(conn, &name, values, 1);
+  } else if (strstr(statement, "pg_backup_start(")) {
+    pg_standin_backup_start(conn, statement);
+  } else if (strstr(statement, "pg_backup_stop(false)")) {
+    pg_standin_backup_stop(conn);
+  } else if (strstr(statement, "pg_replication_slot_advance('")) {
+    pg_standin_advance(conn, statement);
+  } else if (strstr(statement, "pg_logical_slot_peek_changes('")) {
+    return pg_standin_peek(conn, statement);
+  } else if (strstr(statement, "c.relreplident")) {
+    pg_standin_keys(conn);
+  } else if (strstr(statement, "current_setting('block_size')") || strstr(statement, "i.indisprimary")
+    || strstr(statement, "pg_catalog.min(") || strstr(statement, "string_agg(")) {
+    pg_standin_plan(conn, statement);
+  } else if (strstr(statement, "pg_get_indexdef(")) {
+    pg_standin_list(conn, true);
+  } else if (strstr(statement, "FROM pg_catalog.pg_class")) {
+    pg_standin_list(conn, false);
+  } else if (strncasecmp(statement, "LOCK TABLE ", 11) == 0) {
+    size_t tables = 1;
+
+    for (const char *p = statement; *p; p++) tables += *p == ',';
+    __atomic_add_fetch(&s->locked, tables, __ATOMIC_RELAXED);
+    pg_standin_complete(conn, "LOCK TABLE");
+  } else if (strncasecmp(statement, "COPY ", 5) == 0) {
+    return pg_standin_copy(conn, statement);
+  } else if (strncasecmp(statement, "CREATE INDEX ", 13) == 0) {
+    pg_standin_create_index(conn, statement);
+  } else if (strncasecmp(statement, "INSERT INTO ", 12) == 0 || strncasecmp(statement, "UPDATE ", 7) == 0
+    || strncasecmp(statement, "DELETE FROM ", 12) == 0) {
+    pg_standin_dml(conn, statement);
+  } else {
+    pg_standin_error(conn, "42601", "syntax error");
+  }
+
+  return 0;
+}
+
+/* runs the ';'-separated statements of a Query message, quotes respected */
+int pg_standin_query(PgStandinConn_t *conn, char *sql) {
+  char *start = sql;
+  bool quoted = false, last;
+  size_t at;
+
+  for (char *p = sql;; p++) {
+    if (*p == '\'') quoted = !quoted;
+    if ((*p != ';' || quoted) && *p != '\0') continue;
+    last = *p == '\0';
+    *p = '\0';
+    while (isspace((unsigned char)*start)) start++;
+    if (*start && pg_standin_statement(conn, start) != 0) return -1;
+    if (last) break;
+    start = p + 1;
+  }
+  at = pg_standin_begin(&conn->out, 'Z');
+  pg_standin_put(&conn->out, conn->failed ? "E" : conn->in_txn ? "T" : "I", 1);
+  pg_standin_end(&conn->out, at);
+  if (!conn->in_txn) conn->has_snapshot = false;
+
+  return pg_standin_flush(conn);
+}
+
+void *pg_standin_conn_main(void *arg) {
+  PgStandinConn_t *conn = arg;
+  PgStandin_t *s = conn->standin;
+  char user[BUF_LEN_XS], type;
+  unsigned char *payload;
+  size_t len, start;
+
+  if (pg_standin_startup(conn, user, sizeof(user)) != 0) goto done;
+  if (!pg_standin_authenticate(conn, user)) {
+    pg_standin_error(conn, "28P01", "password authentication failed");
+    pg_standin_flush(conn);
+    goto done;
+  }
+  __atomic_add_fetch(&s->logins, 1, __ATOMIC_RELAXED);
+  pg_standin_auth_request(conn, 0, NULL, 0);
+  start = pg_standin_begin(&conn->out, 'S');
+  pg_standin_put_str(&conn->out, "server_version");
+  pg_standin_put_str(&conn->out, "16.2");
+  pg_standin_end(&conn->out, start);
+  start = pg_standin_begin(&conn->out, 'K');
+  pg_standin_put32(&conn->out, (uint32_t)(1000 + conn->id));
+  pg_standin_put32(&conn->out, 0x5eed);
+  pg_standin_end(&conn->out, start);
+  start = pg_standin_begin(&conn->out, 'Z');
+  pg_standin_put(&conn->out, "I", 1);
+  pg_standin_end(&conn->out, start);
+  if (pg_standin_flush(conn) != 0) goto done;
+
+  while (pg_standin_read_message(conn->fd, &type, &payload, &len) == 0) {
+    int status = 0;
+
+    if (type == 'Q') status = pg_standin_query(conn, (char *)payload);
+    else if (type != 'X') {
+      pg_standin_error(conn, "08P01", "unexpected message");
+      status = pg_standin_flush(conn);
+    }
+    free(payload);
+    if (type == 'X' || status != 0) break;
+  }
+
+done:
+  // a closed connection ends its transaction and the snapshots it exported, its backup and its temporary slots
+  pg_standin_end_txn(conn);
+  pthread_mutex_lock(&s->lock);
+  if (s->backup_label[0] && s->backup_owner == conn->id) s->backup_label[0] = '\0';
+  for (size_t i = 0; i < PG_STANDIN_MAX_SLOTS; i++) {
+    if (s->physical[i].owner == conn->id) s->physical[i].name[0] = '\0';
+  }
+  pthread_mutex_unlock(&s->lock);
+  free(conn->out.data);
+  free(conn);
+
+  return NULL;
+}
+
+void *pg_standin_accept_main(void *arg) {
+  PgStandin_t *s = arg;
+
+  for (;;) {
+    int fd = accept(s->listen_fd, NULL, NULL);
+    PgStandinConn_t *conn;
+
+    if (fd < 0) {
+      if (__atomic_load_n(&s->stopping, __ATOMIC_ACQUIRE)) break;
+      continue;
+    }
+    pthread_mutex_lock(&s->lock);
+    conn = s->conn_count < PG_STANDIN_MAX_CONNECTIONS ? calloc(1, sizeof(PgStandinConn_t)) : NULL;
+    if (conn) {
+      conn->standin = s;
+      conn->fd = fd;
+      conn->id = s->conn_count + 1;
+      if (pthread_create(&s->conn_threads[s->conn_count], NULL, pg_standin_conn_main, conn) == 0) {
+        s->conn_fds[s->conn_count++] = fd;
+      } else {
+        free(conn);
+        conn = NULL;
+      }
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (!conn) close(fd);
+  }
+
+  return NULL;
+}
+
+PgStandin_t *pg_standin_start(const char *dir, PgStandinAuth_t auth, const char *user, const char *password) {
+  PgStandin_t *s = calloc(1, sizeof(PgStandin_t));
+  struct sockaddr_un addr;
+
+  if (!s) return NULL;
+  snprintf(s->dir, sizeof(s->dir), "%s", dir);
+  snprintf(s->user, sizeof(s->user), "%s", user);
+  snprintf(s->password, sizeof(s->password), "%s", password);
+  s->auth = auth;
+  s->change_lsn = PG_STANDIN_CHANGE_LSN;
+  pthread_mutex_init(&s->lock, NULL);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/.s.PGSQL.%d", dir, PG_STANDIN_PORT);
+  unlink(addr.sun_path);
+  s->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (s->listen_fd < 0 || bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0
+    || listen(s->listen_fd, 64) != 0 || pthread_create(&s->accept_thread, NULL, pg_standin_accept_main, s) != 0) {
+    if (s->listen_fd >= 0) close(s->listen_fd);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+
+    return NULL;
+  }
+
+  return s;
+}
+
+void pg_standin_add_table(PgStandin_t *standin, const char *schema, const char *name, size_t rows, bool keyed) {
+  PgStandinTable_t *table;
+
+  if (standin->table_count == PG_STANDIN_MAX_TABLES) return;
+  table = &standin->tables[standin->table_count++];
+  snprintf(table->schema, sizeof(table->schema), "%s", schema);
+  snprintf(table->name, sizeof(table->name), "%s", name);
+  table->rows = rows;
+  table->keyed = keyed;
+}
+
+void pg_standin_set_wal(PgStandin_t *standin, uint32_t segment_size, uint64_t end) {
+  pthread_mutex_lock(&standin->lock);
+  standin->wal_segment_size = segment_size;
+  standin->wal_timeline = 1;
+  standin->wal_end = end;
+  pthread_mutex_unlock(&standin->lock);
+}
+
+void pg_standin_write_wal(PgStandin_t *standin, uint64_t end) {
+  pthread_mutex_lock(&standin->lock);
+  standin->wal_end = end;
+  pthread_mutex_unlock(&standin->lock);
+}
+
+void pg_standin_promote(PgStandin_t *standin) {
+  pthread_mutex_lock(&standin->lock);
+  __atomic_store_n(&standin->wal_switch, standin->wal_end, __ATOMIC_RELAXED);
+  __atomic_store_n(&standin->wal_timeline, 2, __ATOMIC_RELAXED);
+  pthread_mutex_unlock(&standin->lock);
+}
+
+int pg_standin_history(PgStandin_t *standin, uint32_t timeline, char *out, size_t len) {
+  char lsn[BUF_LEN_XS];
+
+  if (timeline != 2 || __atomic_load_n(&standin->wal_timeline, __ATOMIC_RELAXED) < 2) return -1;
+  pg_standin_format_lsn(__atomic_load_n(&standin->wal_switch, __ATOMIC_RELAXED), lsn, sizeof(lsn));
+  snprintf(out, len, "1\t%s\tno recovery target specified\n", lsn);
+
+  return 0;
+}
+
+uint64_t pg_standin_change(PgStandin_t *standin, const char *data) {
+  PgStandinChange_t *change;
+  uint64_t lsn = 0;
+
+  pthread_mutex_lock(&standin->lock);
+  if (standin->change_count < PG_STANDIN_MAX_CHANGES) {
+    change = &standin->changes[standin->change_count];
+    change->lsn = lsn = standin->change_lsn += 0x30;
+    change->xid = (uint32_t)(700 + standin->change_count++);
+    snprintf(change->data, sizeof(change->data), "%s", data);
+    standin->version++;
+  }
+  pthread_mutex_unlock(&standin->lock);
+
+  return lsn;
+}
+
+void pg_standin_stop(PgStandin_t **standin) {
+  if (!standin || !*standin) return;
+  PgStandin_t *s = *standin;
+  char path[BUF_LEN];
+
+  __atomic_store_n(&s->stopping, true, __ATOMIC_RELEASE);
+  shutdown(s->listen_fd, SHUT_RDWR);
+  pthread_join(s->accept_thread, NULL);
+  close(s->listen_fd);
+  for (size_t i = 0; i < s->conn_count; i++) shutdown(s->conn_fds[i], SHUT_RDWR);
+  for (size_t i = 0; i < s->conn_count; i++) {
+    pthread_join(s->conn_threads[i], NULL);
+    close(s->conn_fds[i]);
+  }
+  snprintf(path, sizeof(path), "%s/.s.PGSQL.%d", s->dir, PG_STANDIN_PORT);
+  unlink(path);
+  for (size_t i = 0; i < s->table_count; i++) free(s->tables[i].loaded);
+  pthread_mutex_destroy(&s->lock);
+  free(s);
+  *standin = NULL;
+}
@@ -0,0 +1,226 @@
+#ifndef ___PG_STANDIN_H___
+#define ___PG_STANDIN_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "include/globals.h"
+
+//macro defs
+#define PG_STANDIN_MAX_CONNECTIONS (64)
+#define PG_STANDIN_MAX_TABLES (64)
+#define PG_STANDIN_MAX_SNAPSHOTS (16)
+#define PG_STANDIN_PORT (5432)
+#define PG_STANDIN_ROW_BYTES (64)
+#define PG_STANDIN_ROWS_PER_BLOCK (8192 / PG_STANDIN_ROW_BYTES)
+#define PG_STANDIN_WAL_CHUNK (64 << 10)
+#define PG_STANDIN_KEEPALIVE_MS (500)
+#define PG_STANDIN_MAX_CHANGES (256)
+#define PG_STANDIN_CHANGE_LSN (0x1000000)
+#define PG_STANDIN_MAX_SLOTS (4)
+#define PG_STANDIN_BACKUP_END (0x2000)
+
+/*
+ * ==========================================================
+ * PostgreSQL Stand-in
+ * ----------------------------------------------------------
+ * A threaded server on a unix socket speaking enough of the
+ * protocol 3.0 for the dump client: trust, cleartext, MD5 and
+ * SCRAM-SHA-256 authentication, and a handful of simple
+ * queries recognised by pattern (BEGIN, COMMIT, set_config,
+ * pg_export_snapshot, SET TRANSACTION SNAPSHOT, the table
+ * list, LOCK TABLE, the post-data query and COPY TO STDOUT,
+ * in text or binary format, with a notice halfway through).
+ *
+ * Tables have columns id and version, an integer primary key
+ * on id when keyed, and PG_STANDIN_ROW_BYTES per row on
+ * 8kB blocks, row i in block i / PG_STANDIN_ROWS_PER_BLOCK.
+ * The split planning queries are answered from that, and a
+ * ranged COPY (SELECT ... WHERE ...) keeps the rows its id
+ * or ctid bounds select. COPY ... FROM STDIN (FORMAT binary)
+ * takes rows in that same shape and keeps them apart, as the
+ * table's loaded rows, and the post-data CREATE INDEX marks
+ * it indexed: a restore into the stand-in shows what it put
+ * in. A COPY the client fails keeps nothing. INSERT, UPDATE
+ * and DELETE of an id, version row by id, as a replay of
+ * logical changes writes them, apply to those loaded rows at
+ * once, and the replica identity query names id as the key
+ * of every keyed table.
+ *
+ * MVCC is modelled with one counter: every transaction takes
+ * the next version when it runs its first query, unless it
+ * imported an exported snapshot first, in which case it
+ * shares the exporter's. COPY writes each row as
+ * "<row>\t<version>", so a dump that mixes snapshots shows
+ * it in the data. Snapshots die with their exporter's
+ * transaction, as on a real server.
+ *
+ * A replication=true connection is a WAL sender answering
+ * IDENTIFY_SYSTEM, SHOW wal_segment_size and
+ * START_REPLICATION PHYSICAL. The WAL is generated, byte at
+ * LSN x being pg_standin_wal_byte(), up to the end the test
+ * moved it to; it streams as XLogData, with keepalives while
+ * caught up, and the flush positions of status updates are
+ * kept. After pg_standin_promote(), timeline 1 ends where
+ * the WAL was and timeline 2 carries on with other bytes: a
+ * stream of timeline 1 ends there with CopyDone and names
+ * timeline 2, as a server does after a failover, and
+ * TIMELINE_HISTORY 2 sends the history file naming the fork.
+ * It also runs CREATE_REPLICATION_SLOT ... [TEMPORARY]
+ * PHYSICAL RESERVE_WAL, and START_REPLICATION SLOT on one of
+ * those, whose restart position follows the flush positions
+ * reported on it; a temporary slot goes with its connection.
+ *
+ * pg_backup_start() and pg_backup_stop(false) put the server
+ * in backup mode for the session calling them: start returns
+ * the end of WAL, stop writes PG_STANDIN_BACKUP_END more bytes
+ * and returns where they end and a backup_label naming the
+ * label and both positions. A session that closes in backup
+ * mode aborts it.
+ *
+ * A replication=database connection runs queries and also
+ * CREATE_REPLICATION_SLOT ... LOGICAL ... EXPORT_SNAPSHOT and
+ * DROP_REPLICATION_SLOT, for one logical slot. Its exported
+ * snapshot lives until the connection's next command. Each
+ * pg_standin_change() is one transaction of one change
+ * committed at the next logical LSN, from
+ * PG_STANDIN_CHANGE_LSN on; pg_current_wal_lsn() is the last
+ * of them. COPY of pg_logical_slot_peek_changes() gives the
+ * BEGIN, change and COMMIT rows of every transaction
+ * committed after the slot's confirmed position and before
+ * the given end, as test_decoding would, and
+ * pg_replication_slot_advance() moves that position.
+ * ==========================================================
+ */
+
+typedef enum {
+  PG_STANDIN_TRUST = 0,
+  PG_STANDIN_PASSWORD,
+  PG_STANDIN_MD5,
+  PG_STANDIN_SCRAM
+} PgStandinAuth_t;
+
+typedef struct PgStandinRow {
+  uint64_t          id;
+  uint64_t          version;
+} PgStandinRow_t;
+
+typedef struct PgStandinTable {
+  char              schema[BUF_LEN_XS];
+  char              name[BUF_LEN_XS];
+  size_t            rows;
+  bool              keyed;    // primary key on id
+  PgStandinRow_t    *loaded;  // rows COPY ... FROM STDIN put in, in arrival order
+  size_t            loaded_rows;
+  bool              indexed;  // its post-data CREATE INDEX ran
+} PgStandinTable_t;
+
+typedef struct PgStandinSnapshot {
+  char              id[BUF_LEN_XS];
+  uint64_t          version;
+  size_t            owner;
+} PgStandinSnapshot_t;
+
+typedef struct PgStandinChange {
+  uint64_t          lsn;      // of its COMMIT, BEGIN and the change are the two before
+  uint32_t          xid;
+  char              data[BUF_LEN_S];
+} PgStandinChange_t;
+
+typedef struct PgStandinSlot {
+  char              name[BUF_LEN_XS];   // "" for a free entry
+  uint64_t          restart_lsn;
+  size_t            owner;              // connection of a temporary slot, 0 for a persistent one
+} PgStandinSlot_t;
+
+typedef struct PgStandin {
+  int               listen_fd;
+  char              dir[BUF_LEN_S];
+  PgStandinAuth_t   auth;
+  char              user[BUF_LEN_XS];
+  char              password[BUF_LEN_XS];
+  PgStandinTable_t  tables[PG_STANDIN_MAX_TABLES];
+  size_t            table_count;
+  PgStandinSnapshot_t snapshots[PG_STANDIN_MAX_SNAPSHOTS];
+  size_t            snapshot_count;
+  uint64_t          version;
+  uint64_t          exported_version;   // of the last exported snapshot
+  size_t            imports;
+  size_t            copies;
+  size_t            ranges;             // copies of part of a table
+  size_t            locked;
+  size_t            logins;
+  uint32_t          wal_segment_size;
+  uint32_t          wal_timeline;       // the current one
+  uint64_t          wal_switch;         // where timeline 2 forked off, 0 before a promotion
+  uint64_t          wal_end;
+  uint64_t          wal_flushed;        // last flush position a client reported
+  size_t            wal_streams;
+  uint64_t          wal_start;          // of the last START_REPLICATION
+  PgStandinChange_t changes[PG_STANDIN_MAX_CHANGES];
+  size_t            change_count;
+  uint64_t          change_lsn;         // end of the logical changes
+  char              slot[BUF_LEN_XS];   // the logical slot, "" when there is none
+  uint64_t          slot_lsn;           // its confirmed position
+  uint64_t          slot_version;       // of the snapshot it exported
+  size_t            slots_created;
+  size_t            peeks;
+  PgStandinSlot_t   physical[PG_STANDIN_MAX_SLOTS];
+  size_t            slot_streams;       // START_REPLICATION SLOT ones
+  char              backup_label[BUF_LEN_S];  // of the backup in progress, "" when there is none
+  size_t            backup_owner;
+  uint64_t          backup_start;
+  size_t            backups;            // stopped ones
+  pthread_t         accept_thread;
+  int               conn_fds[PG_STANDIN_MAX_CONNECTIONS];
+  pthread_t         conn_threads[PG_STANDIN_MAX_CONNECTIONS];
+  size_t            conn_count;
+  bool              stopping;
+  pthread_mutex_t   lock;
+} PgStandin_t;
+
+
+/**
+ * pg_standin_start - starts a stand-in listening on
+ * @dir/.s.PGSQL.5432
+ * @dir: socket directory, the `host` of the URI
+ * @auth: authentication method asked of every client
+ * @user: the only user allowed in
+ * @password: its password
+ *
+ * Return: the running stand-in, or NULL on failure
+ **/
+PgStandin_t *pg_standin_start(const char *dir, PgStandinAuth_t auth, const char *user, const char *password);
+
+/* adds table @schema.@name holding @rows rows, @keyed by id; call before any client connects */
+void pg_standin_add_table(PgStandin_t *standin, const char *schema, const char *name, size_t rows, bool keyed);
+
+/* the statements answered to the post-data query, one per table */
+void pg_standin_post_data(const PgStandinTable_t *table, char *out, size_t len);
+
+/* gives the server WAL up to @end on timeline 1, in @segment_size segments; call before any client connects */
+void pg_standin_set_wal(PgStandin_t *standin, uint32_t segment_size, uint64_t end);
+
+/* writes WAL up to @end on the current timeline */
+void pg_standin_write_wal(PgStandin_t *standin, uint64_t end);
+
+/* ends timeline 1 at the current end of WAL, later WAL goes to timeline 2 */
+void pg_standin_promote(PgStandin_t *standin);
+
+/* the history file TIMELINE_HISTORY sends for @timeline; 0 when the server has one */
+int pg_standin_history(PgStandin_t *standin, uint32_t timeline, char *out, size_t len);
+
+/* the WAL byte at @lsn of @timeline */
+unsigned char pg_standin_wal_byte(PgStandin_t *standin, uint32_t timeline, uint64_t lsn);
+
+/* commits a transaction of one change, test_decoding text @data; its commit LSN */
+uint64_t pg_standin_change(PgStandin_t *standin, const char *data);
+
+void pg_standin_stop(PgStandin_t **standin);
+
+
+#endif /* ___PG_STANDIN_H___ */
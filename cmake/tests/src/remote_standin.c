@@ -0,0 +1,492 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include <arpa/inet.h>
+#include "remote_standin.h"
+
+typedef struct StandinRequest {
+  char              method[16];
+  char              path[BUF_LEN];
+  char              query[BUF_LEN];
+  size_t            content_length;
+  bool              has_range;
+  uint64_t          range_first;
+  uint64_t          range_last;
+  unsigned char     *body;
+} StandinRequest_t;
+
+typedef struct StandinConn {
+  Standin_t         *standin;
+  int               fd;
+} StandinConn_t;
+
+
+uint32_t standin_etag(const unsigned char *data, size_t len) {
+  uint32_t h = 2166136261u;
+
+  for (size_t i = 0; i < len; i++) h = (h ^ data[i]) * 16777619u;
+
+  return h;
+}
+
+int standin_send_all(int fd, const void *data, size_t len) {
+  const char *p = data;
+
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+int standin_reply(int fd, int status, const char *extra_headers, const void *body, size_t len) {
+  char head[BUF_LEN];
+  int n = snprintf(head, sizeof(head), "HTTP/1.1 %d %s\r\nContent-Length: %zu\r\n%s\r\n", status,
+    status < 300 ? "OK" : status == 404 ? "Not Found" : status < 500 ? "Bad Request" : "Service Unavailable",
+    len, extra_headers ? extra_headers : "");
+
+  if (standin_send_all(fd, head, (size_t)n) != 0) return -1;
+
+  return len ? standin_send_all(fd, body, len) : 0;
+}
+
+/* object file for a URL path, '/' becomes '_' */
+void standin_object_path(const Standin_t *s, const char *path, char *out, size_t out_len) {
+  size_t pos = (size_t)snprintf(out, out_len, "%s/", s->root);
+
+  for (const char *p = path[0] == '/' ? path + 1 : path; *p && pos + 1 < out_len; p++) out[pos++] = *p == '/' ? '_' : *p;
+  out[pos] = '\0';
+}
+
+int standin_query_value(const char *query, const char *key, char *out, size_t out_len) {
+  size_t key_len = strlen(key);
+
+  for (const char *p = query; p && *p; p = strchr(p, '&') ? strchr(p, '&') + 1 : NULL) {
+    if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+      size_t len = strcspn(p + key_len + 1, "&");
+
+      if (len >= out_len) return -1;
+      memcpy(out, p + key_len + 1, len);
+      out[len] = '\0';
+
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+int standin_write_file(const char *path, const unsigned char *data, size_t len) {
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+  int status = 0;
+
+  if (fd < 0) return -1;
+  while (len > 0 && status == 0) {
+    ssize_t n = write(fd, data, len);
+
+    if (n <= 0) status = -1;
+    else data += n, len -= (size_t)n;
+  }
+  close(fd);
+
+  return status;
+}
+
+unsigned char *standin_read_file(const char *path, size_t *len) {
+  FILE *fh = fopen(path, "rb");
+  unsigned char *data = NULL;
+
+  *len = 0;
+  if (fh && fseek(fh, 0, SEEK_END) == 0) {
+    long size = ftell(fh);
+
+    data = malloc(size > 0 ? (size_t)size : 1);
+    rewind(fh);
+    if (data && size > 0 && fread(data, 1, (size_t)size, fh) == (size_t)size) *len = (size_t)size;
+  }
+  if (fh) fclose(fh);
+
+  return data;
+}
+
+void standin_remove_parts(const Standin_t *s, const char *upload_id) {
+  char prefix[BUF_LEN_XS], path[BUF_LEN];
+  struct dirent *entry;
+  DIR *dir = opendir(s->root);
+
+  snprintf(prefix, sizeof(prefix), "%s.", upload_id);
+  while (dir && (entry = readdir(dir)) != NULL) {
+    if (strncmp(entry->d_name, prefix, strlen(prefix)) != 0) continue;
+    snprintf(path, sizeof(path), "%s/%s", s->root, entry->d_name);
+    unlink(path);
+  }
+  if (dir) closedir(dir);
+}
+
+int standin_put_part(Standin_t *s, int fd, const StandinRequest_t *req, const char *upload_id, const char *part) {
+  char path[BUF_LEN], header[BUF_LEN_XS];
+  bool fail;
+  int status;
+
+  pthread_mutex_lock(&s->lock);
+  fail = s->fail_every > 0 && ++s->part_attempts % (size_t)s->fail_every == 0;
+  if (fail) s->failures_injected++;
+  if (++s->inflight > s->max_inflight) s->max_inflight = s->inflight;
+  pthread_mutex_unlock(&s->lock);
+
+  if (s->delay_ms > 0) {
+    struct timespec delay = { s->delay_ms / 1000, (s->delay_ms % 1000) * 1000000L };
+
+    nanosleep(&delay, NULL);
+  }
+  if (!fail && !s->discard) {
+    snprintf(path, sizeof(path), "%s/%s.%s", s->root, upload_id, part);
+    fail = standin_write_file(path, req->body, req->content_length) != 0;
+  }
+
+  pthread_mutex_lock(&s->lock);
+  s->inflight--;
+  if (!fail) s->parts++, s->bytes += req->content_length;
+  pthread_mutex_unlock(&s->lock);
+
+  if (fail) return standin_reply(fd, 503, NULL, NULL, 0);
+  snprintf(header, sizeof(header), "ETag: \"%08x\"\r\n", standin_etag(req->body, req->content_length));
+  status = standin_reply(fd, 200, header, NULL, 0);
+
+  return status;
+}
+
+/* concatenates the listed parts, checking each against its ETag */
+int standin_complete(Standin_t *s, int fd, const StandinRequest_t *req, const char *upload_id) {
+  static const char ok[] = "<CompleteMultipartUploadResult></CompleteMultipartUploadResult>";
+  static const char bad[] = "<Error><Code>InvalidPart</Code></Error>";
+  char object[BUF_LEN], path[BUF_LEN], etag[BUF_LEN_XS];
+  const char *p = req->body ? (const char *)req->body : "";
+  int out = -1, valid = 1;
+
+  if (!s->discard) {
+    standin_object_path(s, req->path, object, sizeof(object));
+    out = open(object, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    valid = out >= 0;
+  }
+  while (valid && (p = strstr(p, "<PartNumber>")) != NULL) {
+    long number = strtol(p + strlen("<PartNumber>"), NULL, 10);
+    const char *tag = strstr(p, "<ETag>");
+    size_t len = 0;
+    unsigned char *data;
+
+    p += strlen("<PartNumber>");
+    if (!tag || s->discard) continue;
+    snprintf(path, sizeof(path), "%s/%s.%ld", s->root, upload_id, number);
+    data = standin_read_file(path, &len);
+    snprintf(etag, sizeof(etag), "<ETag>\"%08x\"</ETag>", data ? standin_etag(data, len) : 0);
+    valid = data && strncmp(tag, etag, strlen(etag)) == 0 && write(out, data, len) == (ssize_t)len;
+    free(data);
+  }
+  if (out >= 0) close(out);
+  if (!valid && !s->discard) unlink(object);
+  standin_remove_parts(s, upload_id);
+
+  if (!valid) return standin_reply(fd, 400, NULL, bad, strlen(bad));
+  pthread_mutex_lock(&s->lock);
+  s->completed++;
+  pthread_mutex_unlock(&s->lock);
+
+  return standin_reply(fd, 200, NULL, ok, strlen(ok));
+}
+
+/* answers a GET with a Range header, injecting faults like part PUTs */
+int standin_get_range(Standin_t *s, int fd, const StandinRequest_t *req, const unsigned char *data, size_t len) {
+  char header[BUF_LEN_S];
+  bool fail;
+  size_t first = (size_t)req->range_first, last = (size_t)req->range_last;
+
+  pthread_mutex_lock(&s->lock);
+  fail = s->fail_every > 0 && ++s->part_attempts % (size_t)s->fail_every == 0;
+  if (fail) s->failures_injected++;
+  if (!fail) s->ranges++;
+  pthread_mutex_unlock(&s->lock);
+
+  if (fail) return standin_reply(fd, 503, NULL, NULL, 0);
+  if (first >= len || last < first) return standin_reply(fd, 416, NULL, NULL, 0);
+  if (last >= len) last = len - 1;
+  snprintf(header, sizeof(header), "Content-Range: bytes %zu-%zu/%zu\r\n", first, last, len);
+
+  return standin_reply(fd, 206, header, data + first, last - first + 1);
+}
+
+int standin_handle(Standin_t *s, int fd, const StandinRequest_t *req) {
+  char upload_id[BUF_LEN_XS], part[BUF_LEN_XS], object[BUF_LEN], xml[BUF_LEN];
+  bool has_upload = standin_query_value(req->query, "uploadId", upload_id, sizeof(upload_id)) == 0;
+  unsigned char *data;
+  size_t len = 0;
+  int status;
+
+  if (strcmp(req->method, "POST") == 0 && strcmp(req->query, "uploads") == 0) {
+    pthread_mutex_lock(&s->lock);
+    snprintf(upload_id, sizeof(upload_id), "upload%u", ++s->upload_seq);
+    pthread_mutex_unlock(&s->lock);
+    len = (size_t)snprintf(xml, sizeof(xml),
+      "<InitiateMultipartUploadResult><UploadId>%s</UploadId></InitiateMultipartUploadResult>", upload_id);
+
+    return standin_reply(fd, 200, NULL, xml, len);
+  }
+  if (strcmp(req->method, "PUT") == 0 && has_upload
+    && standin_query_value(req->query, "partNumber", part, sizeof(part)) == 0) {
+    return standin_put_part(s, fd, req, upload_id, part);
+  }
+  if (strcmp(req->method, "POST") == 0 && has_upload) return standin_complete(s, fd, req, upload_id);
+  if (strcmp(req->method, "DELETE") == 0 && has_upload) {
+    standin_remove_parts(s, upload_id);
+
+    return standin_reply(fd, 204, NULL, NULL, 0);
+  }
+
+  standin_object_path(s, req->path, object, sizeof(object));
+  if (strcmp(req->method, "PUT") == 0) {
+    status = s->discard || standin_write_file(object, req->body, req->content_length) == 0 ? 200 : 500;
+
+    return standin_reply(fd, status, NULL, NULL, 0);
+  }
+  if (strcmp(req->method, "GET") == 0) {
+    data = access(object, R_OK) == 0 ? standin_read_file(object, &len) : NULL;
+    if (!data) status = standin_reply(fd, 404, NULL, NULL, 0);
+    else if (req->has_range) status = standin_get_range(s, fd, req, data, len);
+    else status = standin_reply(fd, 200, NULL, data, len);
+    free(data);
+
+    return status;
+  }
+  if (strcmp(req->method, "HEAD") == 0) {
+    static const char missing[] = "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    struct stat st;
+    char head[BUF_LEN_XS];
+    int n;
+
+    // the size of the object, without its body
+    if (stat(object, &st) != 0) return standin_send_all(fd, missing, sizeof(missing) - 1);
+    n = snprintf(head, sizeof(head), "HTTP/1.1 200 OK\r\nContent-Length: %lu\r\n\r\n", (unsigned long)st.st_size);
+
+    return standin_send_all(fd, head, (size_t)n);
+  }
+
+  return standin_reply(fd, 400, NULL, NULL, 0);
+}
+
+/* reads one request; -1 when the peer is gone */
+int standin_read_request(int fd, char *buf, size_t cap, size_t *have, StandinRequest_t *req) {
+  char *end = NULL, *line, *save = NULL, target[BUF_LEN];
+  size_t head_len, body_have;
+  bool expect_continue = false;
+
+  memset(req, 0, sizeof(*req));
+  while (!(end = memmem(buf, *have, "\r\n\r\n", 4))) {
+    ssize_t n;
+
+    if (*have == cap) return -1;
+    n = recv(fd, buf + *have, cap - *have, 0);
+    if (n <= 0) return -1;
+    *have += (size_t)n;
+  }
+  head_len = (size_t)(end - buf) + 4;
+  *end = '\0';
+
+  line = strtok_r(buf, "\r\n", &save);
+  if (!line || sscanf(line, "%15s %1023s", req->method, target) != 2) return -1;
+  snprintf(req->query, sizeof(req->query), "%s", strchr(target, '?') ? strchr(target, '?') + 1 : "");
+  if (strchr(target, '?')) *strchr(target, '?') = '\0';
+  snprintf(req->path, sizeof(req->path), "%s", target);
+  while ((line = strtok_r(NULL, "\r\n", &save)) != NULL) {
+    if (strncasecmp(line, "Content-Length:", 15) == 0) req->content_length = strtoul(line + 15, NULL, 10);
+    if (strncasecmp(line, "Range: bytes=", 13) == 0) {
+      unsigned long first = 0, last = 0;
+
+      req->has_range = sscanf(line + 13, "%lu-%lu", &first, &last) == 2;
+      req->range_first = first;
+      req->range_last = last;
+    }
+    if (strncasecmp(line, "Expect:", 7) == 0 && strcasestr(line, "100-continue")) expect_continue = true;
+  }
+  if (expect_continue && standin_send_all(fd, "HTTP/1.1 100 Continue\r\n\r\n", 25) != 0) return -1;
+
+  req->body = malloc(req->content_length + 1);
+  if (!req->body) return -1;
+  body_have = *have - head_len < req->content_length ? *have - head_len : req->content_length;
+  memcpy(req->body, buf + head_len, body_have);
+  // keep whatever belongs to the next request
+  memmove(buf, buf + head_len + body_have, *have - head_len - body_have);
+  *have -= head_len + body_have;
+  while (body_have < req->content_length) {
+    ssize_t n = recv(fd, req->body + body_have, req->content_length - body_have, 0);
+
+    if (n <= 0) {
+      free(req->body);
+      req->body = NULL;
+
+      return -1;
+    }
+    body_have += (size_t)n;
+  }
+  req->body[req->content_length] = '\0';
+
+  return 0;
+}
+
+void *standin_conn_main(void *arg) {
+  StandinConn_t *conn = arg;
+  char *buf = malloc(STANDIN_MAX_HEADER);
+  size_t have = 0;
+  StandinRequest_t req;
+
+  while (buf && standin_read_request(conn->fd, buf, STANDIN_MAX_HEADER, &have, &req) == 0) {
+    int status = standin_handle(conn->standin, conn->fd, &req);
+
+    free(req.body);
+    if (status != 0) break;
+  }
+  free(buf);
+  free(conn);
+
+  return NULL;
+}
+
+void *standin_accept_main(void *arg) {
+  Standin_t *s = arg;
+
+  for (;;) {
+    int fd = accept(s->listen_fd, NULL, NULL);
+    StandinConn_t *conn;
+
+    if (fd < 0) {
+      if (__atomic_load_n(&s->stopping, __ATOMIC_ACQUIRE)) break;
+      continue;
+    }
+    pthread_mutex_lock(&s->lock);
+    conn = s->conn_count < STANDIN_MAX_CONNECTIONS ? malloc(sizeof(StandinConn_t)) : NULL;
+    if (conn) {
+      conn->standin = s;
+      conn->fd = fd;
+      if (pthread_create(&s->conn_threads[s->conn_count], NULL, standin_conn_main, conn) == 0) {
+        s->conn_fds[s->conn_count++] = fd;
+      } else {
+        free(conn);
+        conn = NULL;
+      }
+    }
+    pthread_mutex_unlock(&s->lock);
+    if (!conn) close(fd);
+  }
+
+  return NULL;
+}
+
+Standin_t *standin_start(const char *root, uint16_t port, int fail_every, int delay_ms, bool discard) {
+  Standin_t *s = calloc(1, sizeof(Standin_t));
+  struct sockaddr_in addr;
+  socklen_t addr_len = sizeof(addr);
+  int one = 1;
+
+  if (!s) return NULL;
+  snprintf(s->root, sizeof(s->root), "%s", root);
+  s->fail_every = fail_every;
+  s->delay_ms = delay_ms;
+  s->discard = discard;
+  pthread_mutex_init(&s->lock, NULL);
+
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  s->listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (s->listen_fd < 0 || setsockopt(s->listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) != 0
+    || bind(s->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(s->listen_fd, 64) != 0
+    || getsockname(s->listen_fd, (struct sockaddr *)&addr, &addr_len) != 0
+    || pthread_create(&s->accept_thread, NULL, standin_accept_main, s) != 0) {
+    if (s->listen_fd >= 0) close(s->listen_fd);
+    pthread_mutex_destroy(&s->lock);
+    free(s);
+
+    return NULL;
+  }
+  s->port = ntohs(addr.sin_port);
+
+  return s;
+}
+
+void standin_stop(Standin_t **standin) {
+  if (!standin || !*standin) return;
+  Standin_t *s = *standin;
+
+  __atomic_store_n(&s->stopping, true, __ATOMIC_RELEASE);
+  shutdown(s->listen_fd, SHUT_RDWR);
+  pthread_join(s->accept_thread, NULL);
+  close(s->listen_fd);
+  for (size_t i = 0; i < s->conn_count; i++) shutdown(s->conn_fds[i], SHUT_RDWR);
+  for (size_t i = 0; i < s->conn_count; i++) {
+    pthread_join(s->conn_threads[i], NULL);
+    close(s->conn_fds[i]);
+  }
+  pthread_mutex_destroy(&s->lock);
+  free(s);
+  *standin = NULL;
+}
+
+#ifdef STANDIN_MAIN
+/* benchmark server: remote_standin [--port N] [--fail-every N] [--delay-ms N] [--discard] <root> */
+int main(int argc, char **argv) {
+  int port = 0, fail_every = 0, delay_ms = 0, sig;
+  bool discard = false;
+  const char *root = NULL;
+  Standin_t *s;
+  sigset_t set;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--port") == 0 && i + 1 < argc) port = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--fail-every") == 0 && i + 1 < argc) fail_every = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--delay-ms") == 0 && i + 1 < argc) delay_ms = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--discard") == 0) discard = true;
+    else root = argv[i];
+  }
+  if (!root) {
+    fprintf(stderr, "Usage: %s [--port N] [--fail-every N] [--delay-ms N] [--discard] <root>\n", argv[0]);
+    return 1;
+  }
+
+  // handled by sigwait below, never by a random worker thread
+  sigemptyset(&set);
+  sigaddset(&set, SIGINT);
+  sigaddset(&set, SIGTERM);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+
+  s = standin_start(root, (uint16_t)port, fail_every, delay_ms, discard);
+  if (!s) {
+    perror("standin_start");
+    return 1;
+  }
+  printf("listening on http://127.0.0.1:%u/\n", s->port);
+  fflush(stdout);
+  sigwait(&set, &sig);
+
+  printf("parts %zu, bytes %lu, completed %zu, injected failures %zu, max parallel parts %zu\n",
+    s->parts, (unsigned long)s->bytes, s->completed, s->failures_injected, s->max_inflight);
+  standin_stop(&s);
+
+  return 0;
+}
+#endif
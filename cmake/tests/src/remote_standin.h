@@ -0,0 +1,74 @@
+#ifndef ___REMOTE_STANDIN_H___
+#define ___REMOTE_STANDIN_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "include/globals.h"
+
+//macro defs
+#define STANDIN_MAX_CONNECTIONS (64)
+#define STANDIN_MAX_HEADER (16 * 1024)
+
+/*
+ * ==========================================================
+ * Remote Stand-in
+ * ----------------------------------------------------------
+ * A small threaded HTTP/1.1 server speaking the part of the
+ * S3 API the uploader uses (multipart create, part PUT,
+ * complete, abort) plus plain object GET, ranged GET, HEAD
+ * and PUT. Objects land in `root`, named after their URL
+ * path with '/' turned into '_'.
+ *
+ * Faults are injected on purpose: every `fail_every`-th part
+ * PUT or ranged GET gets a 503, and each part answer is held
+ * `delay_ms` so parallel connections overlap. With `discard`
+ * set parts are only counted, which is what the benchmark
+ * binary uses to measure the uploader rather than the disk.
+ * ==========================================================
+ */
+
+typedef struct Standin {
+  int               listen_fd;
+  uint16_t          port;
+  char              root[BUF_LEN_S];
+  int               fail_every;
+  int               delay_ms;
+  bool              discard;
+  pthread_t         accept_thread;
+  int               conn_fds[STANDIN_MAX_CONNECTIONS];
+  pthread_t         conn_threads[STANDIN_MAX_CONNECTIONS];
+  size_t            conn_count;
+  bool              stopping;
+  unsigned          upload_seq;
+  size_t            part_attempts;
+  size_t            parts;
+  size_t            ranges;
+  size_t            failures_injected;
+  size_t            completed;
+  size_t            inflight;
+  size_t            max_inflight;
+  uint64_t          bytes;
+  pthread_mutex_t   lock;
+} Standin_t;
+
+
+/**
+ * standin_start - starts a stand-in listening on 127.0.0.1
+ * @root: directory receiving objects
+ * @port: port to bind, 0 for any free port (see ->port)
+ * @fail_every: answer every Nth part PUT or ranged GET with 503, 0 never
+ * @delay_ms: hold every part PUT this long
+ * @discard: count part bytes instead of storing them
+ *
+ * Return: the running stand-in, or NULL on failure
+ **/
+Standin_t *standin_start(const char *root, uint16_t port, int fail_every, int delay_ms, bool discard);
+void standin_stop(Standin_t **standin);
+
+
+#endif /* ___REMOTE_STANDIN_H___ */
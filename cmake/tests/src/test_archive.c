@@ -0,0 +1,319 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <zlib.h>
+#include "include/archive.h"
+#include "include/config_parser.h"
+#include "include/storage.h"
+
+#define OBJECT_COUNT (3)
+#define WRITE_STEP (48 * 1024 + 7)
+
+static const char hex_key[] = "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f\n";
+static const char *const names[OBJECT_COUNT] = { "public.orders", "public.users", "public.empty" };
+static const size_t sizes[OBJECT_COUNT] = { 6 * 1000 * 1000 + 11, 1500 * 1000, 0 };
+
+/* COPY-like rows, different for every object */
+void fill_object(unsigned char *dst, size_t len, uint32_t id) {
+  size_t pos = 0;
+  uint64_t row = 0;
+
+  while (pos < len) {
+    char line[BUF_LEN_XS];
+    int n = snprintf(line, sizeof(line), "%u\t%lu\tname-%lu\t%lu\n", id, (unsigned long)row,
+      (unsigned long)(row * 2654435761u % 100003), (unsigned long)(row * 40503u % 977));
+
+    for (int i = 0; i < n && pos < len; i++) dst[pos++] = (unsigned char)line[i];
+    row++;
+  }
+}
+
+/* dumps the objects through one pipeline, their writes interleaved as concurrent workers would */
+int write_archive(AppConfig_t *cfg, const char *name, unsigned char *const *payloads, uint64_t *archive_size) {
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  StorageSink_t *sink = init_storage_sink(cfg->storage, name, &storage_err);
+  Pipeline_t *pipe = sink ? init_storage_pipeline(cfg, sink, &pipe_err) : NULL;
+  PipeWriter_t writers[OBJECT_COUNT];
+  size_t done[OBJECT_COUNT] = { 0 };
+  bool pending = true;
+  int failed = 1;
+
+  if (pipe) {
+    for (uint32_t i = 0; i < OBJECT_COUNT; i++) {
+      init_pipe_writer(&writers[i], pipe, i + 1);
+      storage_sink_name_object(sink, i + 1, names[i]);
+    }
+    while (pending) {
+      pending = false;
+      for (size_t i = 0; i < OBJECT_COUNT; i++) {
+        size_t n = sizes[i] - done[i] < WRITE_STEP ? sizes[i] - done[i] : WRITE_STEP;
+
+        if (n) pipe_writer_write(&writers[i], payloads[i] + done[i], n);
+        done[i] += n;
+        pending = pending || done[i] < sizes[i];
+      }
+    }
+    for (size_t i = 0; i < OBJECT_COUNT; i++) pipe_writer_close(&writers[i]);
+    failed = pipeline_finish(pipe, &pipe_err) != PIPELINE_OK || storage_sink_commit(sink, &storage_err) != STORAGE_OK;
+    *archive_size = sink->bytes_written;
+  }
+  if (failed) printf("FAIL: %s archive: %s\n", cfg->storage->compression,
+    storage_err ? storage_err->message : pipe_err ? pipe_err->message : "?");
+
+  destroy_storage_error(&storage_err), destroy_pipeline_error(&pipe_err);
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+
+  return failed;
+}
+
+int restore_matches(ArchiveReader_t *reader, const char *dir, size_t i, const unsigned char *payload) {
+  char path[BUF_LEN];
+  ArchiveError_t *err = NULL;
+  ArchiveObject_t *obj = archive_find_object(reader, names[i]);
+  unsigned char *got = malloc(sizes[i] + 1);
+  int fd, ok = 0;
+
+  snprintf(path, sizeof(path), "%s/restored", dir);
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (obj && fd >= 0 && archive_restore_object(reader, obj, fd, &err) == ARCHIVE_OK) {
+    ok = pread(fd, got, sizes[i] + 1, 0) == (ssize_t)sizes[i] && memcmp(got, payload, sizes[i]) == 0
+      && obj->raw_bytes == sizes[i];
+  }
+  if (!ok) printf("FAIL: %s does not restore from %s: %s\n", names[i], reader->path, err ? err->message : "mismatch");
+
+  if (fd >= 0) close(fd);
+  unlink(path);
+  destroy_archive_error(&err);
+  free(got);
+
+  return ok ? 0 : 1;
+}
+
+/* restores into a pipe drained by a child, as `restore --table` into a shell pipeline */
+int restore_through_pipe(ArchiveReader_t *reader, size_t i, const unsigned char *payload) {
+  ArchiveObject_t *obj = archive_find_object(reader, names[i]);
+  unsigned char *got = malloc(sizes[i] + 1);
+  int fds[2], status = 0, ok = 0;
+  size_t have = 0;
+  ssize_t n;
+  pid_t child;
+
+  if (!obj || !got || pipe(fds) != 0) return 1;
+  child = fork();
+  if (child == 0) {
+    close(fds[0]);
+    _exit(archive_restore_object(reader, obj, fds[1], NULL) == ARCHIVE_OK ? 0 : 1);
+  }
+  close(fds[1]);
+  while (child > 0 && (n = read(fds[0], got + have, sizes[i] + 1 - have)) > 0) have += (size_t)n;
+  close(fds[0]);
+  if (child > 0 && waitpid(child, &status, 0) == child) {
+    ok = WIFEXITED(status) && WEXITSTATUS(status) == 0 && have == sizes[i] && memcmp(got, payload, have) == 0;
+  }
+  if (!ok) printf("FAIL: %s does not restore into a pipe from %s (%zu bytes)\n", names[i], reader->path, have);
+  free(got);
+
+  return ok ? 0 : 1;
+}
+
+int test_codec(const char *dir, const char *compression, const char *key_path, unsigned char *const *payloads) {
+  char name[BUF_LEN_S];
+  uint64_t archive_size = 0;
+  ArchiveError_t *err = NULL;
+  ArchiveReader_t *reader = NULL;
+  int failures = 0;
+
+  AppConfig_t *cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1),
+    init_storage_config(dir, compression, key_path ? key_path : DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 3, DEFAULT_RUNTIME_TMP_DIR));
+
+  snprintf(name, sizeof(name), "%s%s.dump", compression, key_path ? ".sealed" : "");
+  if (write_archive(cfg, name, payloads, &archive_size) != 0) {
+    destroy_app_config(&cfg);
+
+    return 1;
+  }
+
+  reader = init_archive_reader(cfg->storage, name, &err);
+  if (!reader) {
+    printf("FAIL: %s index does not load: %s\n", name, err ? err->message : "?");
+    failures++;
+  } else {
+    // the small table alone: only its frames are read
+    failures += restore_matches(reader, dir, 1, payloads[1]);
+    if (reader->bytes_read == 0 || reader->bytes_read * 2 > archive_size) {
+      printf("FAIL: %s restore of %s read %lu of %lu bytes\n", name, names[1], (unsigned long)reader->bytes_read,
+        (unsigned long)archive_size);
+      failures++;
+    }
+    failures += restore_matches(reader, dir, 0, payloads[0]);
+    failures += restore_matches(reader, dir, 2, payloads[2]);
+    failures += restore_through_pipe(reader, 0, payloads[0]);
+    if (archive_find_object(reader, "public.missing")) {
+      printf("FAIL: %s has an object it never stored\n", name);
+      failures++;
+    }
+  }
+
+  destroy_archive_reader(&reader);
+  destroy_archive_error(&err);
+  destroy_app_config(&cfg);
+
+  return failures;
+}
+
+/* the index members are empty to zlib: the data still reads as one gzip stream */
+int test_gzip_readable(const char *dir) {
+  char path[BUF_LEN];
+  size_t total = sizes[0] + sizes[1] + sizes[2];
+  unsigned char *out = malloc(total + 16);
+  gzFile gz;
+  int n, failures = 0;
+
+  snprintf(path, sizeof(path), "%s/gzip:1.dump", dir);
+  gz = gzopen(path, "rb");
+  n = gz ? gzread(gz, out, (unsigned)(total + 16)) : -1;
+  if (n != (int)total || gzclose(gz) != Z_OK) {
+    printf("FAIL: gzip archive with an index reads %d of %zu bytes\n", n, total);
+    failures++;
+  }
+  free(out);
+
+  return failures;
+}
+
+/* output_path - writes the archive to stdout, here a file, which then reads as any other */
+int test_stdout(const char *dir, unsigned char *const *payloads) {
+  char path[BUF_LEN];
+  uint64_t archive_size = 0;
+  ArchiveError_t *err = NULL;
+  ArchiveReader_t *reader = NULL;
+  StorageError_t *storage_err = NULL;
+  StorageSink_t *sink;
+  struct stat st;
+  int saved = dup(STDOUT_FILENO), fd, failures = 0;
+  AppConfig_t *cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1),
+    init_storage_config(STORAGE_STDOUT, "none", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 3, DEFAULT_RUNTIME_TMP_DIR));
+
+  snprintf(path, sizeof(path), "%s/stdout.dump", dir);
+  fflush(stdout);
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  if (saved < 0 || fd < 0 || dup2(fd, STDOUT_FILENO) < 0) failures++;
+  if (fd >= 0) close(fd);
+  if (!failures) failures += write_archive(cfg, "stdout.dump", payloads, &archive_size);
+  dup2(saved, STDOUT_FILENO);
+  if (saved >= 0) close(saved);
+
+  if (stat(STORAGE_STDOUT, &st) == 0) {
+    printf("FAIL: output_path - was taken for a directory\n");
+    failures++;
+  }
+  snprintf(cfg->storage->output_path, sizeof(cfg->storage->output_path), "%s", dir);
+  if (!failures && !(reader = init_archive_reader(cfg->storage, "stdout.dump", &err))) {
+    printf("FAIL: archive written to stdout does not load: %s\n", err ? err->message : "?");
+    failures++;
+  }
+  for (size_t i = 0; reader && i < OBJECT_COUNT; i++) failures += restore_matches(reader, dir, i, payloads[i]);
+  destroy_archive_reader(&reader);
+  destroy_archive_error(&err);
+
+  // dedup has nowhere to keep its chunks
+  snprintf(cfg->storage->output_path, sizeof(cfg->storage->output_path), "%s", STORAGE_STDOUT);
+  cfg->storage->dedup_enabled = 1;
+  sink = init_storage_sink(cfg->storage, "dedup.dump", &storage_err);
+  if (sink || !storage_err || storage_err->code != STORAGE_CONFIG_ERROR) {
+    printf("FAIL: dedup to stdout was accepted\n");
+    failures++;
+  }
+  destroy_storage_sink(&sink);
+  destroy_storage_error(&storage_err);
+  destroy_app_config(&cfg);
+
+  return failures;
+}
+
+int test_damaged(const char *dir, const char *key_path) {
+  char path[BUF_LEN];
+  unsigned char byte = 0;
+  ArchiveError_t *err = NULL;
+  ArchiveReader_t *reader;
+  StorageConfig_t *storage = init_storage_config(dir, "none", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE);
+  struct stat st;
+  int fd, failures = 0;
+
+  // a flipped bit in the middle of the index
+  snprintf(path, sizeof(path), "%s/none.dump", dir);
+  fd = open(path, O_RDWR);
+  if (fd < 0 || fstat(fd, &st) != 0 || pread(fd, &byte, 1, st.st_size - ARCHIVE_FOOTER_LEN - 3) != 1) failures++;
+  byte ^= 0x10;
+  if (fd >= 0 && pwrite(fd, &byte, 1, st.st_size - ARCHIVE_FOOTER_LEN - 3) != 1) failures++;
+  if (fd >= 0) close(fd);
+  reader = init_archive_reader(storage, "none.dump", &err);
+  if (reader || !err || err->code != ARCHIVE_FORMAT_ERROR) {
+    printf("FAIL: damaged index was loaded\n");
+    failures++;
+  }
+  destroy_archive_reader(&reader);
+  destroy_archive_error(&err);
+
+  // an encrypted archive without its key
+  if (key_path) {
+    reader = init_archive_reader(storage, "gzip:1.sealed.dump", &err);
+    if (reader || !err || err->code != ARCHIVE_KEY_ERROR) {
+      printf("FAIL: encrypted archive opened without a key\n");
+      failures++;
+    }
+    destroy_archive_reader(&reader);
+    destroy_archive_error(&err);
+  }
+
+  free(storage);
+
+  return failures;
+}
+
+int main(void) {
+  char dir[] = "/tmp/dbeetle_archive_XXXXXX", key_path[BUF_LEN], cmd[BUF_LEN];
+  unsigned char *payloads[OBJECT_COUNT];
+  FILE *fh;
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+  snprintf(key_path, sizeof(key_path), "%s/key", dir);
+  fh = fopen(key_path, "w");
+  if (!fh || fputs(hex_key, fh) == EOF) failures++;
+  if (fh) fclose(fh);
+  for (uint32_t i = 0; i < OBJECT_COUNT; i++) {
+    payloads[i] = malloc(sizes[i] + 1);
+    fill_object(payloads[i], sizes[i], i + 1);
+  }
+
+  failures += test_codec(dir, "none", NULL, payloads);
+  failures += test_codec(dir, "gzip:1", NULL, payloads);
+  failures += test_codec(dir, "gzip:1", key_path, payloads);
+#ifdef DBEETLE_HAVE_ZSTD
+  failures += test_codec(dir, "zstd", NULL, payloads);
+#endif
+#ifdef DBEETLE_HAVE_LZ4
+  failures += test_codec(dir, "lz4", NULL, payloads);
+#endif
+  failures += test_gzip_readable(dir);
+  failures += test_stdout(dir, payloads);
+  failures += test_damaged(dir, key_path);
+
+  for (size_t i = 0; i < OBJECT_COUNT; i++) free(payloads[i]);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  if (system(cmd) != 0) failures++;
+
+  if (failures) return 1;
+  printf("Archive test passed.\n");
+  return 0;
+}
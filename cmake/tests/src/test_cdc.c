@@ -0,0 +1,395 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "include/archive.h"
+#include "include/cdc.h"
+#include "include/config_parser.h"
+#include "include/pgload.h"
+#include "include/restore.h"
+#include "pg_standin.h"
+
+#define CHANGE_A "table public.orders: UPDATE: id[integer]:7 version[integer]:2"
+#define CHANGE_B "table public.orders: INSERT: id[integer]:501 version[integer]:1"
+#define CHANGE_C "table public.orders: DELETE: id[integer]:9"
+#define CHANGE_D "table public.orders: UPDATE: id[integer]:501 version[integer]:3"
+#define SQL_A "UPDATE public.orders SET id = 7, version = 2 WHERE id = 7;\n"
+#define SQL_B "INSERT INTO public.orders (id, version) VALUES (501, 1);\n"
+
+/* reads object @object of archive @archive into @out, NUL-terminated; its length, or -1 */
+ssize_t read_object(AppConfig_t *cfg, const char *archive, const char *object, char *out, size_t len) {
+  ArchiveError_t *err = NULL;
+  ArchiveReader_t *reader = init_archive_reader(cfg->storage, archive, &err);
+  ArchiveObject_t *obj = reader ? archive_find_object(reader, object) : NULL;
+  char path[BUF_LEN];
+  ssize_t n = -1;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s/object.out", cfg->storage->output_path);
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (fd >= 0 && obj && archive_restore_object(reader, obj, fd, &err) == ARCHIVE_OK && lseek(fd, 0, SEEK_SET) == 0) {
+    n = read(fd, out, len - 1);
+    if (n >= 0) out[n] = '\0';
+  }
+  if (fd >= 0) close(fd);
+  unlink(path);
+  destroy_archive_error(&err);
+  destroy_archive_reader(&reader);
+
+  return n;
+}
+
+/* one cdc_backup() that must succeed; 0 when it did */
+int backup(AppConfig_t *cfg, const char *name, CdcStats_t *stats) {
+  CdcError_t *err = NULL;
+
+  if (cdc_backup(cfg, name, stats, &err) == CDC_OK) return 0;
+  printf("FAIL: backup %s: %s\n", name, err ? err->message : "?");
+  destroy_cdc_error(&err);
+
+  return 1;
+}
+
+/* the YAML keys are checked, and only a PostgreSQL chain with the option on takes the strategy */
+int test_config(const char *dir) {
+  const char *bad[] = { "incremental_strategy: rows", "cdc_slot: Bad-Slot", "cdc_slot: \"\"", "wal_slot: wal-1" };
+  AppConfig_t *cfg = init_app_config(init_db_config("postgres", "postgresql://u@/db", 10, 1),
+    init_storage_config(dir, "none", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 1, DEFAULT_RUNTIME_TMP_DIR));
+  ConfigParserError_t *err = NULL;
+  char path[BUF_LEN];
+  int failures = 0;
+  FILE *fh;
+
+  snprintf(path, sizeof(path), "%s/config.yml", dir);
+  if (strcmp(cfg->db->incremental_strategy, "blocks") != 0 || strcmp(cfg->db->cdc_slot, "dbeetle") != 0
+    || cdc_selected(cfg->db)) {
+    printf("FAIL: the block strategy is not the default\n");
+    failures++;
+  }
+  fh = fopen(path, "w");
+  fprintf(fh, "db:\n  incremental_strategy: logical\n  cdc_slot: nightly_2\n  wal_slot: archive_1\n");
+  fclose(fh);
+  if (config_load_file(path, cfg, &err) != CONFIG_OK || strcmp(cfg->db->cdc_slot, "nightly_2") != 0
+    || strcmp(cfg->db->wal_slot, "archive_1") != 0
+    || !cdc_selected(cfg->db)) {
+    printf("FAIL: the logical strategy is not selected: %s\n", err ? err->message : "");
+    failures++;
+  }
+  if (err) destroy_parser_error(&err);
+  cfg->db->incremental_enabled = 0;
+  if (cdc_selected(cfg->db)) {
+    printf("FAIL: the logical strategy is selected with incrementals off\n");
+    failures++;
+  }
+  cfg->db->incremental_enabled = 1;
+  snprintf(cfg->db->type, sizeof(cfg->db->type), "sqlite");
+  if (cdc_selected(cfg->db)) {
+    printf("FAIL: the logical strategy is selected for SQLite\n");
+    failures++;
+  }
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    fh = fopen(path, "w");
+    fprintf(fh, "db:\n  %s\n", bad[i]);
+    fclose(fh);
+    if (config_load_file(path, cfg, &err) != CONFIG_VALIDATION_ERROR) {
+      printf("FAIL: \"%s\" is accepted\n", bad[i]);
+      failures++;
+    }
+    if (err) destroy_parser_error(&err);
+  }
+  unlink(path);
+  destroy_app_config(&cfg);
+
+  return failures;
+}
+
+/* a full backup whose head cannot be written leaves no slot behind */
+int test_failed_full(AppConfig_t *cfg, PgStandin_t *s, const char *dir) {
+  CdcError_t *err = NULL;
+  CdcHead_t head;
+  char blocker[BUF_LEN];
+  int failures = 0;
+  bool slot;
+
+  snprintf(blocker, sizeof(blocker), "%s/%s.partial", dir, CDC_HEAD_FILE);
+  mkdir(blocker, 0700);
+  if (cdc_backup(cfg, "full-0", NULL, &err) != CDC_STORAGE_ERROR) {
+    printf("FAIL: a full backup without its head: %s\n", err ? err->message : "succeeded");
+    failures++;
+  }
+  rmdir(blocker);
+  destroy_cdc_error(&err);
+  pthread_mutex_lock(&s->lock);
+  slot = s->slot[0] != '\0' || s->slots_created != 1;
+  pthread_mutex_unlock(&s->lock);
+  if (slot || cdc_read_head(dir, &head) != 1 || cfg->db->snapshot[0]) {
+    printf("FAIL: a failed full backup left its slot, head or snapshot\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+/* the full backup reads the snapshot the slot was created at */
+int test_full(AppConfig_t *cfg, PgStandin_t *s, const char *dir) {
+  CdcStats_t stats;
+  CdcHead_t head;
+  char data[BUF_LEN];
+  uint64_t slot_lsn, slot_version, exported;
+  int failures = 0;
+
+  if (backup(cfg, "full-1", &stats) != 0) return 1;
+  pthread_mutex_lock(&s->lock);
+  slot_lsn = s->slot_lsn;
+  slot_version = s->slot_version;
+  exported = s->exported_version;
+  pthread_mutex_unlock(&s->lock);
+  if (!stats.full || exported != slot_version) {
+    printf("FAIL: the dump read version %llu, the slot starts after %llu\n", (unsigned long long)exported,
+      (unsigned long long)slot_version);
+    failures++;
+  }
+  if (cdc_read_head(dir, &head) != 0 || strcmp(head.slot, "dbeetle") != 0 || strcmp(head.full, "full-1") != 0
+    || head.lsn != slot_lsn || head.seq != 0 || stats.to_lsn != slot_lsn) {
+    printf("FAIL: the head does not start at the slot\n");
+    failures++;
+  }
+  if (read_object(cfg, "full-1", "public.orders", data, sizeof(data)) <= 0 || cfg->db->snapshot[0]) {
+    printf("FAIL: the full backup holds no public.orders\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+/* batches hold each change committed after the last one exactly once, in order */
+int test_batches(AppConfig_t *cfg, PgStandin_t *s, const char *dir) {
+  CdcStats_t stats;
+  CdcHead_t head;
+  char data[BUF_LEN * 4], meta[BUF_LEN];
+  uint64_t lsn_d, slot_lsn;
+  int failures = 0;
+
+  pg_standin_change(s, CHANGE_A);
+  pg_standin_change(s, CHANGE_B);
+  if (backup(cfg, "batch-1", &stats) != 0) return 1;
+  if (stats.full || stats.seq != 1 || read_object(cfg, "batch-1", CDC_CHANGES_OBJECT, data, sizeof(data)) <= 0) {
+    printf("FAIL: batch-1 is not a batch of changes\n");
+    return failures + 1;
+  }
+  if (strcmp(data, "BEGIN;\n" SQL_A "COMMIT;\nBEGIN;\n" SQL_B "COMMIT;\n") != 0) {
+    printf("FAIL: batch-1 holds the wrong changes:\n%s", data);
+    failures++;
+  }
+  if (read_object(cfg, "batch-1", CDC_META_OBJECT, meta, sizeof(meta)) <= 0
+    || !strstr(meta, "slot=dbeetle full=full-1 ") || !strstr(meta, " seq=1\n")) {
+    printf("FAIL: batch-1 is described as %s\n", meta);
+    failures++;
+  }
+  pthread_mutex_lock(&s->lock);
+  slot_lsn = s->slot_lsn;
+  pthread_mutex_unlock(&s->lock);
+  if (cdc_read_head(dir, &head) != 0 || head.lsn != stats.to_lsn || head.seq != 1 || slot_lsn != stats.to_lsn) {
+    printf("FAIL: the head or the slot did not move past batch-1\n");
+    failures++;
+  }
+
+  // nothing new is an empty batch
+  if (backup(cfg, "batch-2", &stats) != 0) return failures + 1;
+  if (stats.seq != 2 || read_object(cfg, "batch-2", CDC_CHANGES_OBJECT, data, sizeof(data)) != 0) {
+    printf("FAIL: batch-2 has changes:\n%s", data);
+    failures++;
+  }
+
+  // an advance lost after a batch is caught up with rather than captured again
+  pg_standin_change(s, CHANGE_C);
+  if (backup(cfg, "batch-3", &stats) != 0) return failures + 1;
+  pthread_mutex_lock(&s->lock);
+  s->slot_lsn = stats.from_lsn;
+  pthread_mutex_unlock(&s->lock);
+  lsn_d = pg_standin_change(s, CHANGE_D);
+  if (backup(cfg, "batch-4", &stats) != 0) return failures + 1;
+  if (read_object(cfg, "batch-4", CDC_CHANGES_OBJECT, data, sizeof(data)) <= 0
+    || strcmp(data, "BEGIN;\nUPDATE public.orders SET id = 501, version = 3 WHERE id = 501;\nCOMMIT;\n") != 0
+    || stats.to_lsn != lsn_d || stats.seq != 4) {
+    printf("FAIL: batch-4 after a lost advance holds:\n%s", data);
+    failures++;
+  }
+
+  return failures;
+}
+
+/* test_decoding rows become statements that put the same change back */
+int test_translate(void) {
+  const char *cases[][2] = {
+    { "BEGIN 42", "BEGIN;\n" },
+    { "table public.\"Order Lines\": INSERT: \"Qty\"[integer]:3 note[text]:'two\nlines' ratio[double precision]:NaN "
+      "tags[text[]]:'{a,b}' gone[text]:null ok[boolean]:true",
+      "INSERT INTO public.\"Order Lines\" (\"Qty\", note, ratio, tags, gone, ok) "
+      "VALUES (3, E'two\\nlines', 'NaN', '{a,b}', NULL, true);\n" },
+    { "table public.docs: UPDATE: id[integer]:4 body[text]:unchanged-toast-datum title[text]:'it''s'",
+      "UPDATE public.docs SET id = 4, title = 'it''s' WHERE id = 4;\n" },
+    { "table public.docs: UPDATE: old-key: id[integer]:4 new-tuple: id[integer]:5 title[text]:null",
+      "UPDATE public.docs SET id = 5, title = NULL WHERE id = 4;\n" },
+    { "table public.docs: UPDATE: body[text]:unchanged-toast-datum", "" },
+    { "table public.logs: DELETE: at[timestamp]:'2024-01-01 00:00:00' host[text]:null",
+      "DELETE FROM public.logs WHERE at = '2024-01-01 00:00:00' AND host IS NULL;\n" },
+    { "table public.logs: TRUNCATE: restart_seqs cascade", "TRUNCATE public.logs RESTART IDENTITY CASCADE;\n" },
+    { "table public.logs: TRUNCATE: (no-flags)", "TRUNCATE public.logs;\n" },
+    { "message: transactional: 1 prefix: p, sz: 1 content:x", "" },
+    { "COMMIT 42", "COMMIT;\n" },
+  };
+  const char *bad[] = { "table public.logs: UPDATE: at[timestamp]:'2024-01-01 00:00:00'",
+    "table public.logs: DELETE: (no-tuple-data)", "table public.docs: INSERT: id[integer]:'4", "nonsense" };
+  CdcKey_t key = { .table = "public.docs", .columns = "id", .count = 1 }, *keys = NULL;
+  CdcText_t out = { NULL, 0, 0 };
+  char message[BUF_LEN_M];
+  int failures = 0;
+
+  HASH_ADD_STR(keys, table, &key);
+  for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+    out.len = 0;
+    if (out.data) out.data[0] = '\0';
+    if (cdc_change_sql(keys, cases[i][0], &out, message, sizeof(message)) != 0
+      || strcmp(out.data ? out.data : "", cases[i][1]) != 0) {
+      printf("FAIL: \"%s\" became \"%s\": %s\n", cases[i][0], out.data ? out.data : "", message);
+      failures++;
+    }
+  }
+  for (size_t i = 0; i < sizeof(bad) / sizeof(bad[0]); i++) {
+    out.len = 0;
+    if (out.data) out.data[0] = '\0';
+    if (cdc_change_sql(keys, bad[i], &out, message, sizeof(message)) == 0 || out.len || !message[0]) {
+      printf("FAIL: \"%s\" became \"%s\"\n", bad[i], out.data ? out.data : "");
+      failures++;
+    }
+  }
+  if (!strstr(message, "Cannot replay change \"nonsense\"")) {
+    printf("FAIL: an unknown change is reported as %s\n", message);
+    failures++;
+  }
+  HASH_CLEAR(hh, keys);
+  free(out.data);
+
+  return failures;
+}
+
+/* the full backup restored and the chain replayed on it hold the rows of the source */
+int test_replay(AppConfig_t *cfg, PgStandin_t *s, const char *dir) {
+  char target_dir[BUF_LEN_S], source_uri[BUF_LEN_S], path[BUF_LEN], gone[BUF_LEN];
+  PgStandin_t *target;
+  PgLoadSession_t *session = NULL;
+  PgLoadError_t *load_err = NULL;
+  RestoreEngine_t *engine = NULL;
+  RestoreError_t *restore_err = NULL;
+  CdcError_t *err = NULL;
+  uint64_t batches = 0, statements = 0, version;
+  size_t rows = 0, bad = 0;
+  int failures = 0;
+
+  snprintf(target_dir, sizeof(target_dir), "%s/target", dir);
+  if (mkdir(target_dir, 0700) != 0 || !(target = pg_standin_start(target_dir, PG_STANDIN_TRUST, "dbeetle", ""))) {
+    printf("FAIL: cannot start the replay target\n");
+
+    return 1;
+  }
+  pg_standin_add_table(target, "public", "orders", 0, true);
+  snprintf(source_uri, sizeof(source_uri), "%s", cfg->db->uri);
+  snprintf(cfg->db->uri, sizeof(cfg->db->uri), "postgresql://dbeetle@/shop?host=%.200s", target_dir);
+
+  if (!(session = init_pgload_session(cfg, &load_err)) || !(engine = init_restore_engine(cfg, "full-1", &restore_err))
+    || restore_run(engine, pgload_table, pgload_step, session, &restore_err) != RESTORE_OK) {
+    printf("FAIL: cannot restore full-1: %s %s\n",
+      load_err ? load_err->message : restore_err ? restore_err->message : "?", session ? session->message : "");
+    failures++;
+  } else if (cdc_replay(cfg, "batch-4", &batches, &statements, &err) != CDC_OK || batches != 4 || statements != 12) {
+    printf("FAIL: replayed %llu batch(es) and %llu statement(s): %s\n", (unsigned long long)batches,
+      (unsigned long long)statements, err ? err->message : "");
+    failures++;
+  }
+  destroy_cdc_error(&err);
+
+  // 0..499 as exported, but 7 updated, 9 deleted and 501 inserted then updated
+  pthread_mutex_lock(&target->lock);
+  for (size_t i = 0; !failures && i < target->tables[0].loaded_rows; i++) {
+    const PgStandinRow_t *row = &target->tables[0].loaded[i];
+
+    version = row->id == 7 ? 2 : row->id == 501 ? 3 : s->slot_version;
+    if (row->id == 9 || (row->id >= 500 && row->id != 501) || row->version != version) bad++;
+    rows++;
+  }
+  pthread_mutex_unlock(&target->lock);
+  if (!failures && (rows != 500 || bad)) {
+    printf("FAIL: the replay left %zu row(s), %zu of them wrong\n", rows, bad);
+    failures++;
+  }
+
+  // a chain with a batch gone cannot be replayed
+  snprintf(path, sizeof(path), "%s/batch-2", dir);
+  snprintf(gone, sizeof(gone), "%s/batch-2", target_dir);
+  rename(path, gone);
+  if (cdc_replay(cfg, "batch-4", NULL, NULL, &err) != CDC_CORRUPT_ERROR || !strstr(err->message, "Batch 2 ")) {
+    printf("FAIL: a chain without batch-2 replays: %s\n", err ? err->message : "");
+    failures++;
+  }
+  destroy_cdc_error(&err);
+
+  destroy_restore_engine(&engine);
+  destroy_restore_error(&restore_err);
+  destroy_pgload_session(&session);
+  destroy_pgload_error(&load_err);
+  pg_standin_stop(&target);
+  snprintf(cfg->db->uri, sizeof(cfg->db->uri), "%s", source_uri);
+
+  return failures;
+}
+
+int main(void) {
+  char dir[] = "/tmp/dbeetle_cdc_XXXXXX", uri[BUF_LEN], cmd[BUF_LEN];
+  CdcError_t *err = NULL;
+  AppConfig_t *cfg;
+  PgStandin_t *s;
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+  failures += test_config(dir);
+  failures += test_translate();
+  s = pg_standin_start(dir, PG_STANDIN_SCRAM, "dbeetle", "s3cret");
+  if (!s) {
+    printf("FAIL: cannot start the stand-in\n");
+
+    return 1;
+  }
+  pg_standin_add_table(s, "public", "orders", 500, true);
+  pg_standin_change(s, "table public.orders: UPDATE: before the slot");
+  snprintf(uri, sizeof(uri), "postgresql://dbeetle:s3cret@/shop?host=%s", dir);
+  cfg = init_app_config(init_db_config("postgres", uri, 10, 1),
+    init_storage_config(dir, "gzip:1", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 2, DEFAULT_RUNTIME_TMP_DIR));
+
+  // the block strategy is not this module's
+  if (cdc_backup(cfg, "full-0", NULL, &err) != CDC_CONFIG_ERROR) {
+    printf("FAIL: the block strategy took a logical backup\n");
+    failures++;
+  }
+  destroy_cdc_error(&err);
+  snprintf(cfg->db->incremental_strategy, sizeof(cfg->db->incremental_strategy), "logical");
+
+  failures += test_failed_full(cfg, s, dir);
+  if (!failures) failures += test_full(cfg, s, dir);
+  if (!failures) failures += test_batches(cfg, s, dir);
+  if (!failures) failures += test_replay(cfg, s, dir);
+
+  pg_standin_stop(&s);
+  destroy_app_config(&cfg);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  if (system(cmd) != 0) failures++;
+
+  if (failures) return 1;
+  printf("Cdc test passed.\n");
+  return 0;
+}
@@ -0,0 +1,267 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/cipher.h"
+#include "include/codec.h"
+#include "include/config_parser.h"
+#include "include/storage.h"
+
+#define PAYLOAD_BYTES (3 * 1000 * 1000 + 77)
+
+static const char hex_key[] = "000102030405060708090a0b0c0d0e0f101112131415161718191a1b1c1d1e1f\n";
+
+int write_file(const char *path, const void *data, size_t len) {
+  FILE *fh = fopen(path, "wb");
+  int ok = fh && fwrite(data, 1, len, fh) == len;
+
+  if (fh) fclose(fh);
+
+  return ok ? 0 : -1;
+}
+
+unsigned char *read_file(const char *path, size_t *len) {
+  FILE *fh = fopen(path, "rb");
+  unsigned char *data = NULL;
+
+  *len = 0;
+  if (fh && fseek(fh, 0, SEEK_END) == 0) {
+    *len = (size_t)ftell(fh);
+    data = malloc(*len + 1);
+    rewind(fh);
+    if (data && fread(data, 1, *len, fh) != *len) *len = 0;
+  }
+  if (fh) fclose(fh);
+
+  return data;
+}
+
+int test_key_files(const char *dir) {
+  char path[BUF_LEN], message[BUF_LEN_M];
+  unsigned char key[CIPHER_KEY_LEN], raw[CIPHER_KEY_LEN];
+  int failures = 0;
+
+  snprintf(path, sizeof(path), "%s/key", dir);
+  for (int i = 0; i < CIPHER_KEY_LEN; i++) raw[i] = (unsigned char)i;
+
+  write_file(path, hex_key, strlen(hex_key));
+  if (cipher_load_key(path, key, message, sizeof(message)) != 0 || memcmp(key, raw, CIPHER_KEY_LEN) != 0) {
+    printf("FAIL: hex key file not loaded\n");
+    failures++;
+  }
+  write_file(path, raw, sizeof(raw));
+  if (cipher_load_key(path, key, message, sizeof(message)) != 0 || memcmp(key, raw, CIPHER_KEY_LEN) != 0) {
+    printf("FAIL: raw key file not loaded\n");
+    failures++;
+  }
+  write_file(path, hex_key, 40);
+  if (cipher_load_key(path, key, message, sizeof(message)) == 0 || !strstr(message, "64 hex digits")) {
+    printf("FAIL: short key file accepted\n");
+    failures++;
+  }
+  unlink(path);
+  if (cipher_load_key(path, key, message, sizeof(message)) == 0) {
+    printf("FAIL: missing key file accepted\n");
+    failures++;
+  }
+
+  return failures;
+}
+
+/* sealing round-trips, and any flipped bit (body, header, file header) is refused */
+int test_chunks(CipherId_t id) {
+  unsigned char key[CIPHER_KEY_LEN] = {7};
+  unsigned char plain[4096], sealed[4096 + CIPHER_CHUNK_OVERHEAD], out[4096];
+  CipherStage_t *stage = init_cipher_stage(id, key, CODEC_GZIP, 2);
+  CipherChunk_t chunk = { 41, PIPE_BUF_LAST, sizeof(plain), 9000 }, opened;
+  size_t len = 0, consumed = 0;
+  int failures = 0;
+
+  for (size_t i = 0; i < sizeof(plain); i++) plain[i] = (unsigned char)(i * 31);
+  if (!stage || cipher_seal_chunk(stage, 1, &chunk, plain, sealed, sizeof(sealed), &len) != 0) {
+    printf("FAIL: %s cannot seal\n", cipher_name(id));
+    destroy_cipher_stage(&stage);
+
+    return 1;
+  }
+
+  if (cipher_open_chunk(stage->key, stage->file_header, sealed, len, out, sizeof(out), &opened, &consumed) != 0
+    || consumed != len || opened.seq != 41 || opened.flags != PIPE_BUF_LAST || opened.raw_len != 9000
+    || memcmp(out, plain, sizeof(plain)) != 0) {
+    printf("FAIL: %s chunk does not round-trip\n", cipher_name(id));
+    failures++;
+  }
+
+  size_t flips[] = { 0, CIPHER_CHUNK_HEADER_LEN + 100, len - 1 };
+  for (size_t i = 0; i < sizeof(flips) / sizeof(flips[0]); i++) {
+    sealed[flips[i]] ^= 0x01;
+    if (cipher_open_chunk(stage->key, stage->file_header, sealed, len, out, sizeof(out), &opened, &consumed) == 0) {
+      printf("FAIL: %s accepts a chunk with byte %zu flipped\n", cipher_name(id), flips[i]);
+      failures++;
+    }
+    sealed[flips[i]] ^= 0x01;
+  }
+  stage->file_header[9] = CODEC_ZSTD;
+  if (cipher_open_chunk(stage->key, stage->file_header, sealed, len, out, sizeof(out), &opened, &consumed) == 0) {
+    printf("FAIL: %s chunk opens under another archive's header\n", cipher_name(id));
+    failures++;
+  }
+
+  destroy_cipher_stage(&stage);
+
+  return failures;
+}
+
+/* the data key comes back only with the master key, also after a rewrap */
+int test_envelope(const char *dir) {
+  unsigned char master[CIPHER_KEY_LEN] = {1}, next[CIPHER_KEY_LEN] = {2}, data_key[CIPHER_KEY_LEN];
+  unsigned char header[CIPHER_FILE_HEADER_LEN];
+  CipherStage_t *stage = init_cipher_stage(cipher_preferred(), master, CODEC_NONE, 1);
+  char path[BUF_LEN], message[BUF_LEN_M];
+  size_t len = 0;
+  unsigned char *stored = NULL;
+  int failures = 0;
+
+  if (!stage) return 1;
+  snprintf(path, sizeof(path), "%s/envelope", dir);
+  write_file(path, stage->file_header, CIPHER_FILE_HEADER_LEN);
+
+  if (cipher_unwrap_key(master, stage->file_header, data_key) != 0 || memcmp(data_key, stage->key, CIPHER_KEY_LEN) != 0
+    || cipher_unwrap_key(next, stage->file_header, data_key) == 0) {
+    printf("FAIL: data key not wrapped under the master key alone\n");
+    failures++;
+  }
+  memcpy(header, stage->file_header, sizeof(header));
+  header[20] ^= 0x01;
+  if (cipher_unwrap_key(master, header, data_key) == 0) {
+    printf("FAIL: data key unwraps under a forged key id\n");
+    failures++;
+  }
+
+  if (cipher_rewrap_file(path, master, next, message, sizeof(message)) != 0
+    || (stored = read_file(path, &len)) == NULL || len != CIPHER_FILE_HEADER_LEN
+    || memcmp(stored, stage->file_header, CIPHER_FILE_PREFIX_LEN) != 0
+    || cipher_unwrap_key(next, stored, data_key) != 0 || memcmp(data_key, stage->key, CIPHER_KEY_LEN) != 0
+    || cipher_unwrap_key(master, stored, data_key) == 0) {
+    printf("FAIL: rewrapped archive does not move to the new master key\n");
+    failures++;
+  }
+  if (cipher_rewrap_file(path, master, next, message, sizeof(message)) == 0 || !strstr(message, "master key")) {
+    printf("FAIL: rewrap with a retired master key accepted\n");
+    failures++;
+  }
+
+  unlink(path);
+  free(stored);
+  destroy_cipher_stage(&stage);
+
+  return failures;
+}
+
+/* an encrypted gzip archive opens chunk by chunk, in order, up to the end chunk,
+ * with the master key it was rotated to */
+int test_archive(const char *dir) {
+  char key_path[BUF_LEN], next_path[BUF_LEN];
+  unsigned char key[CIPHER_KEY_LEN], *payload = malloc(PAYLOAD_BYTES), *archive = NULL;
+  unsigned char *plain = malloc(2 * PIPELINE_DEFAULT_BLOCK_SIZE), *out = malloc(PAYLOAD_BYTES);
+  const Codec_t *gzip = codec_lookup(CODEC_GZIP);
+  CipherId_t id;
+  CodecId_t codec;
+  size_t archive_len = 0, pos = CIPHER_FILE_HEADER_LEN, out_len = 0;
+  bool ended = false;
+  int failures = 0;
+  size_t rotated = 0;
+
+  snprintf(key_path, sizeof(key_path), "%s/key", dir);
+  write_file(key_path, hex_key, strlen(hex_key));
+  snprintf(next_path, sizeof(next_path), "%s/key.next", dir);
+  write_file(next_path, "ffeeddccbbaa99887766554433221100ffeeddccbbaa99887766554433221100", 64);
+  for (size_t i = 0; i < PAYLOAD_BYTES; i++) payload[i] = (unsigned char)("copy accounts from stdin;\n"[i % 26]);
+
+  AppConfig_t *cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1),
+    init_storage_config(dir, "gzip:1", key_path, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 4, DEFAULT_RUNTIME_TMP_DIR));
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  StorageSink_t *sink = init_storage_sink(cfg->storage, "sealed.dump", &storage_err);
+  Pipeline_t *pipe = sink ? init_storage_pipeline(cfg, sink, &pipe_err) : NULL;
+  PipeWriter_t writer;
+
+  if (!pipe) {
+    printf("FAIL: encrypted pipeline: %s\n", pipe_err ? pipe_err->message : "?");
+    failures++;
+  } else {
+    init_pipe_writer(&writer, pipe, 0);
+    pipe_writer_write(&writer, payload, PAYLOAD_BYTES);
+    pipe_writer_close(&writer);
+    if (pipeline_finish(pipe, &pipe_err) != PIPELINE_OK || storage_sink_commit(sink, &storage_err) != STORAGE_OK) {
+      printf("FAIL: encrypted archive not written\n");
+      failures++;
+    }
+    if (storage_rewrap_archives(cfg->storage, next_path, &rotated, &storage_err) != STORAGE_OK || rotated != 1
+      || storage_rewrap_archives(cfg->storage, next_path, &rotated, &storage_err) != STORAGE_OK || rotated != 0) {
+      printf("FAIL: rotation rewrapped %zu archives\n", rotated);
+      failures++;
+    }
+    archive = read_file(sink->path, &archive_len);
+    unlink(sink->path);
+  }
+
+  cipher_load_key(next_path, key, (char *)plain, BUF_LEN_M);
+  if (archive && cipher_parse_file_header(archive, archive_len, &id, &codec) == 0 && codec == CODEC_GZIP
+    && cipher_unwrap_key(key, archive, key) == 0) {
+    for (uint64_t seq = 0; pos < archive_len && !ended; seq++) {
+      CipherChunk_t chunk;
+      size_t consumed = 0, raw = 0;
+
+      if (cipher_open_chunk(key, archive, archive + pos, archive_len - pos, plain,
+        2 * PIPELINE_DEFAULT_BLOCK_SIZE, &chunk, &consumed) != 0 || chunk.seq != seq) break;
+      pos += consumed;
+      ended = (chunk.flags & CIPHER_CHUNK_END) != 0;
+      if (ended) break;
+      // the frame index precedes the end chunk, it is not part of the dump
+      if (chunk.flags & CIPHER_CHUNK_INDEX) continue;
+      // every chunk is a self-contained deflate block
+      if (gzip->decompress(plain, chunk.len, out + out_len, PAYLOAD_BYTES - out_len, &raw) != 0
+        || raw != chunk.raw_len) break;
+      out_len += raw;
+    }
+  }
+  if (!ended || pos != archive_len || out_len != PAYLOAD_BYTES || memcmp(out, payload, PAYLOAD_BYTES) != 0) {
+    printf("FAIL: encrypted archive does not open (%zu of %zu bytes)\n", out_len, (size_t)PAYLOAD_BYTES);
+    failures++;
+  }
+
+  destroy_storage_error(&storage_err), destroy_pipeline_error(&pipe_err);
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+  destroy_app_config(&cfg);
+  unlink(key_path);
+  unlink(next_path);
+  free(archive);
+  free(payload);
+  free(plain);
+  free(out);
+
+  return failures;
+}
+
+int main(void) {
+  char dir[] = "/tmp/dbeetle_cipher_XXXXXX";
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+
+  failures += test_key_files(dir);
+  failures += test_chunks(CIPHER_AES_256_GCM);
+  failures += test_chunks(CIPHER_CHACHA20_POLY1305);
+  failures += test_envelope(dir);
+  failures += test_archive(dir);
+
+  rmdir(dir);
+
+  if (failures) return 1;
+  printf("Cipher test passed.\n");
+  return 0;
+}
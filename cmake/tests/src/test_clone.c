@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/clone.h"
+#include "include/config_parser.h"
+
+#define SPLIT_BYTES (CLONE_RANGE_ALIGN)
+#define BIG_BYTES (3 * SPLIT_BYTES + 4097)
+#define SMALL_BYTES (12345)
+
+void fill(unsigned char *dst, size_t len, uint32_t seed) {
+  uint32_t x = seed * 2654435761u + 1;
+
+  for (size_t i = 0; i < len; i++) {
+    x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+    dst[i] = (unsigned char)x;
+  }
+}
+
+int write_file(const char *dir, const char *rel, const unsigned char *data, size_t len, mode_t mode, time_t mtime) {
+  char path[BUF_LEN];
+  struct timespec times[2] = { { mtime, 0 }, { mtime, 0 } };
+  int fd, ok;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, rel);
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+  ok = fd >= 0 && write(fd, data, len) == (ssize_t)len && fchmod(fd, mode) == 0 && futimens(fd, times) == 0;
+  if (fd >= 0) close(fd);
+
+  return ok ? 0 : 1;
+}
+
+/* @rel under @dir has @data, @mode and @mtime */
+int file_matches(const char *dir, const char *rel, const unsigned char *data, size_t len, mode_t mode, time_t mtime) {
+  char path[BUF_LEN];
+  unsigned char *got = malloc(len + 1);
+  struct stat st;
+  int fd, ok;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, rel);
+  fd = open(path, O_RDONLY);
+  ok = fd >= 0 && read(fd, got, len + 1) == (ssize_t)len && memcmp(got, data, len) == 0 && fstat(fd, &st) == 0
+    && (st.st_mode & 07777) == mode && st.st_mtim.tv_sec == mtime;
+  if (!ok) printf("FAIL: %s differs from its source\n", path);
+  if (fd >= 0) close(fd);
+  free(got);
+
+  return ok ? 0 : 1;
+}
+
+/* the tree both tests copy; returns the failures setting it up */
+int make_tree(const char *dir, const unsigned char *big, const unsigned char *small) {
+  char path[BUF_LEN];
+  struct timespec times[2] = { { 1500000000, 0 }, { 1500000000, 0 } };
+  int failures = 0;
+
+  snprintf(path, sizeof(path), "%s/base", dir);
+  failures += mkdir(path, 0750) != 0;
+  snprintf(path, sizeof(path), "%s/base/16384", dir);
+  failures += mkdir(path, 0700) != 0;
+  snprintf(path, sizeof(path), "%s/pg_tblspc", dir);
+  failures += mkdir(path, 0700) != 0;
+  failures += write_file(dir, "base/16384/2619", big, BIG_BYTES, 0600, 1600000000);
+  failures += write_file(dir, "base/16384/2619_fsm", small, SMALL_BYTES, 0640, 1600000001);
+  failures += write_file(dir, "PG_VERSION", (const unsigned char *)"16\n", 3, 0444, 1600000002);
+  failures += write_file(dir, "empty", small, 0, 0600, 1600000003);
+  snprintf(path, sizeof(path), "%s/pg_tblspc/16400", dir);
+  failures += symlink("/nonexistent/tablespace", path) != 0;
+  snprintf(path, sizeof(path), "%s/base", dir);
+  failures += utimensat(AT_FDCWD, path, times, 0) != 0;
+  snprintf(path, sizeof(path), "%s/postmaster.sock", dir);
+  failures += mkfifo(path, 0600) != 0;
+  if (failures) printf("FAIL: cannot set up %s\n", dir);
+
+  return failures;
+}
+
+/* the copy of make_tree's tree at @dir */
+int tree_matches(const char *dir, const unsigned char *big, const unsigned char *small) {
+  char path[BUF_LEN], target[BUF_LEN];
+  struct stat st;
+  ssize_t n;
+  int failures = 0;
+
+  failures += file_matches(dir, "base/16384/2619", big, BIG_BYTES, 0600, 1600000000);
+  failures += file_matches(dir, "base/16384/2619_fsm", small, SMALL_BYTES, 0640, 1600000001);
+  failures += file_matches(dir, "PG_VERSION", (const unsigned char *)"16\n", 3, 0444, 1600000002);
+  failures += file_matches(dir, "empty", small, 0, 0600, 1600000003);
+  snprintf(path, sizeof(path), "%s/pg_tblspc/16400", dir);
+  n = readlink(path, target, sizeof(target) - 1);
+  if (n < 0 || (target[n] = '\0', strcmp(target, "/nonexistent/tablespace")) != 0) {
+    printf("FAIL: link %s not copied as a link\n", path);
+    failures++;
+  }
+  snprintf(path, sizeof(path), "%s/base", dir);
+  if (stat(path, &st) != 0 || (st.st_mode & 07777) != 0750 || st.st_mtim.tv_sec != 1500000000) {
+    printf("FAIL: directory %s lost its mode or time\n", path);
+    failures++;
+  }
+  snprintf(path, sizeof(path), "%s/postmaster.sock", dir);
+  if (lstat(path, &st) == 0) {
+    printf("FAIL: fifo %s copied\n", path);
+    failures++;
+  }
+
+  return failures;
+}
+
+/* every byte is accounted for by one method */
+int stats_add_up(const CloneStats_t *stats) {
+  uint64_t bytes = BIG_BYTES + SMALL_BYTES + 3;
+
+  if (stats->files != 4 || stats->links != 1 || stats->directories != 3 || stats->bytes != bytes
+    || stats->bytes_cloned + stats->bytes_copied + stats->bytes_buffered != bytes) {
+    printf("FAIL: %llu files, %llu links, %llu dirs, %llu bytes (%llu cloned, %llu copied, %llu buffered)\n",
+      (unsigned long long)stats->files, (unsigned long long)stats->links, (unsigned long long)stats->directories,
+      (unsigned long long)stats->bytes, (unsigned long long)stats->bytes_cloned,
+      (unsigned long long)stats->bytes_copied, (unsigned long long)stats->bytes_buffered);
+    return 1;
+  }
+  if (stats->bytes_cloned == 0) printf("note: no reflinks here, %llu bytes copied in the kernel\n",
+    (unsigned long long)stats->bytes_copied);
+
+  return 0;
+}
+
+int main(void) {
+  char root[] = "/tmp/dbeetle_clone_XXXXXX", source[BUF_LEN_S], out[BUF_LEN], target[BUF_LEN], cmd[BUF_LEN + 16];
+  unsigned char *big = malloc(BIG_BYTES), *small = malloc(SMALL_BYTES);
+  CloneStats_t stats;
+  CloneError_t *err = NULL;
+  AppConfig_t *cfg;
+  struct stat st;
+  int failures = 0;
+
+  if (!big || !small || !mkdtemp(root)) return 1;
+  fill(big, BIG_BYTES, 1);
+  fill(small, SMALL_BYTES, 2);
+  snprintf(source, sizeof(source), "%s/data", root);
+  snprintf(out, sizeof(out), "%s/backups", root);
+  snprintf(target, sizeof(target), "%s/restored", root);
+  failures += mkdir(source, 0700) != 0;
+  failures += make_tree(source, big, small);
+
+  // split at 1 MiB, the big file goes as four ranges over three workers
+  cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 0),
+    init_storage_config(out, "none", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 3, DEFAULT_RUNTIME_TMP_DIR));
+  cfg->runtime->split_chunk_size = SPLIT_BYTES + 100;
+
+  if (clone_backup(cfg, source, "base1", &stats, &err) != CLONE_OK) {
+    printf("FAIL: backup: %s\n", err ? err->message : "?");
+    failures++;
+  } else {
+    snprintf(cmd, sizeof(cmd), "%s/base1", out);
+    failures += tree_matches(cmd, big, small);
+    failures += stats_add_up(&stats);
+    snprintf(cmd, sizeof(cmd), "%s/base1%s", out, CLONE_PARTIAL_SUFFIX);
+    if (lstat(cmd, &st) == 0) {
+      printf("FAIL: %s left behind\n", cmd);
+      failures++;
+    }
+  }
+  destroy_clone_error(&err);
+
+  // a backup is never overwritten, nor restored over an existing tree
+  if (clone_backup(cfg, source, "base1", NULL, &err) != CLONE_CONFIG_ERROR
+    || clone_backup(cfg, source, "../base2", NULL, NULL) != CLONE_CONFIG_ERROR
+    || clone_restore(cfg, "base1", source, NULL, NULL) != CLONE_IO_ERROR
+    || clone_restore(cfg, "missing", target, NULL, NULL) != CLONE_CONFIG_ERROR) {
+    printf("FAIL: existing backup, bad name, existing target or missing backup accepted\n");
+    failures++;
+  }
+  destroy_clone_error(&err);
+
+  // whole files this time, back out of the backup
+  cfg->runtime->split_chunk_size = 0;
+  if (clone_restore(cfg, "base1", target, &stats, &err) != CLONE_OK) {
+    printf("FAIL: restore: %s\n", err ? err->message : "?");
+    failures++;
+  } else {
+    failures += tree_matches(target, big, small);
+    failures += stats_add_up(&stats);
+  }
+  destroy_clone_error(&err);
+
+  // a failed copy leaves nothing behind: paths from the tree name engine objects, this one is too long
+  snprintf(cmd, sizeof(cmd), "%s/%0200d", source, 0);
+  failures += mkdir(cmd, 0700) != 0;
+  snprintf(target, sizeof(target), "%0100d", 1);
+  failures += write_file(cmd, target, small, 1, 0600, 1600000004);
+  if (clone_backup(cfg, source, "base3", NULL, &err) != CLONE_IO_ERROR || !err || !strstr(err->message, "00001")) {
+    printf("FAIL: path too long not reported: %s\n", err ? err->message : "no error");
+    failures++;
+  }
+  snprintf(cmd, sizeof(cmd), "%s/base3%s", out, CLONE_PARTIAL_SUFFIX);
+  if (lstat(cmd, &st) == 0) {
+    printf("FAIL: failed backup left %s\n", cmd);
+    failures++;
+  }
+  destroy_clone_error(&err);
+
+  destroy_app_config(&cfg);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", root);
+  if (system(cmd) != 0) printf("note: %s not removed\n", root);
+  free(big);
+  free(small);
+
+  if (failures) return 1;
+  printf("Clone test passed.\n");
+  return 0;
+}
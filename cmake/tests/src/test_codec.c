@@ -0,0 +1,325 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#ifdef DBEETLE_HAVE_ZSTD
+#include <zstd.h>
+#endif
+#ifdef DBEETLE_HAVE_LZ4
+#include <lz4frame.h>
+#endif
+#include "include/codec.h"
+#include "include/config_parser.h"
+#include "include/storage.h"
+
+#define PAYLOAD_BYTES (5 * 1000 * 1000 + 123)
+
+typedef struct SpecCase {
+  const char        *value;
+  int               ok;
+  CodecId_t         id;
+  int               level;
+  bool              long_window;
+} SpecCase_t;
+
+static const SpecCase_t spec_cases[] = {
+  { "gzip", 0, CODEC_GZIP, CODEC_LEVEL_DEFAULT, false },
+  { "gzip:9", 0, CODEC_GZIP, 9, false },
+  { "none", 0, CODEC_NONE, CODEC_LEVEL_DEFAULT, false },
+  { DEFAULT_STORAGE_COMPRESSION, 0, CODEC_NONE, CODEC_LEVEL_DEFAULT, false },
+  { "zstd", 0, CODEC_ZSTD, CODEC_LEVEL_DEFAULT, false },
+  { "zstd:19", 0, CODEC_ZSTD, 19, false },
+  { "zstd:long", 0, CODEC_ZSTD, CODEC_LEVEL_DEFAULT, true },
+  { "zstd:9:long", 0, CODEC_ZSTD, 9, true },
+  { "zstd:long:9", 0, CODEC_ZSTD, 9, true },
+  { "gzip:", -1, CODEC_NONE, 0, false },
+  { "gzip:x", -1, CODEC_NONE, 0, false },
+  { "gzip:10", -1, CODEC_NONE, 0, false },
+  { "gzip:long", -1, CODEC_NONE, 0, false },
+  { "zstd:23", -1, CODEC_NONE, 0, false },
+  { "zstd:3:4", -1, CODEC_NONE, 0, false },
+  { "zstd::long", -1, CODEC_NONE, 0, false },
+  { "lz4", 0, CODEC_LZ4, CODEC_LEVEL_DEFAULT, false },
+  { "lz4:8", 0, CODEC_LZ4, 8, false },
+  { "lz4:long", -1, CODEC_NONE, 0, false },
+  { "lz4:65", -1, CODEC_NONE, 0, false },
+  { "deflate2", -1, CODEC_NONE, 0, false },
+};
+
+/* half compressible text, half noise, so blocks differ in ratio */
+void fill_payload(unsigned char *buf, size_t len) {
+  uint32_t x = 2463534242u;
+
+  for (size_t i = 0; i < len; i++) {
+    if ((i / 65536) % 2 == 0) {
+      buf[i] = (unsigned char)("select * from accounts where id = "[i % 34]);
+    } else {
+      x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+      buf[i] = (unsigned char)x;
+    }
+  }
+}
+
+int test_spec_parsing(void) {
+  int failures = 0;
+  CodecSpec_t spec;
+
+  for (size_t i = 0; i < sizeof(spec_cases) / sizeof(spec_cases[0]); i++) {
+    const SpecCase_t *c = &spec_cases[i];
+    int ret = codec_parse_spec(c->value, &spec);
+
+    if (ret != c->ok || (ret == 0 && (spec.id != c->id || spec.level != c->level || spec.long_window != c->long_window))) {
+      printf("FAIL: codec spec '%s' parsed as %d (id %d, level %d)\n", c->value, ret, spec.id, spec.level);
+      failures++;
+    }
+  }
+
+  return failures;
+}
+
+/* writes @payload through a storage pipeline and returns the archive path in @path */
+int write_archive(const char *dir, const char *compression, const unsigned char *payload, size_t len,
+  char *path, size_t path_len) {
+  AppConfig_t *cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1),
+    init_storage_config(dir, compression, DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 4, DEFAULT_RUNTIME_TMP_DIR));
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  StorageSink_t *sink = init_storage_sink(cfg->storage, "codec.dump", &storage_err);
+  Pipeline_t *pipe = sink ? init_storage_pipeline(cfg, sink, &pipe_err) : NULL;
+  PipeWriter_t writer;
+  int failed = 1;
+
+  if (pipe) {
+    init_pipe_writer(&writer, pipe, 0);
+    pipe_writer_write(&writer, payload, len);
+    pipe_writer_close(&writer);
+    failed = pipeline_finish(pipe, &pipe_err) != PIPELINE_OK || storage_sink_commit(sink, &storage_err) != STORAGE_OK;
+  }
+  if (failed) printf("FAIL: %s archive: %s\n", compression,
+    storage_err ? storage_err->message : pipe_err ? pipe_err->message : "?");
+  snprintf(path, path_len, "%s", sink ? sink->path : "");
+
+  destroy_storage_error(&storage_err), destroy_pipeline_error(&pipe_err);
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+  destroy_app_config(&cfg);
+
+  return failed;
+}
+
+int test_gzip_stream(const char *dir, const unsigned char *payload) {
+  char path[BUF_LEN];
+  char command[BUF_LEN + 64];
+  unsigned char *out = malloc(PAYLOAD_BYTES + 16);
+  gzFile gz;
+  int n, failures = 0;
+
+  if (write_archive(dir, "gzip:1", payload, PAYLOAD_BYTES, path, sizeof(path)) != 0) {
+    free(out);
+
+    return 1;
+  }
+
+  // gzread validates the header, the deflate stream and the crc32/isize trailer
+  gz = gzopen(path, "rb");
+  n = gz ? gzread(gz, out, PAYLOAD_BYTES + 16) : -1;
+  if (n != PAYLOAD_BYTES || memcmp(out, payload, PAYLOAD_BYTES) != 0 || gzclose(gz) != Z_OK) {
+    printf("FAIL: gzip archive does not round-trip (%d bytes)\n", n);
+    failures++;
+  }
+
+  // and stock gzip agrees, when it is installed
+  if (system("command -v gzip >/dev/null 2>&1") == 0) {
+    snprintf(command, sizeof(command), "gzip -t < '%s'", path);
+    if (system(command) != 0) {
+      printf("FAIL: gzip -t rejects %s\n", path);
+      failures++;
+    }
+  }
+
+  unlink(path);
+  free(out);
+
+  return failures;
+}
+
+int test_zstd_frames(const char *dir, const unsigned char *payload, const char *compression) {
+#ifdef DBEETLE_HAVE_ZSTD
+  char path[BUF_LEN];
+  unsigned char *in = NULL, *out = malloc(PAYLOAD_BYTES + 16);
+  size_t in_len = 0, n;
+  FILE *fh;
+  int failures = 0;
+
+  if (write_archive(dir, compression, payload, PAYLOAD_BYTES, path, sizeof(path)) != 0) {
+    free(out);
+
+    return 1;
+  }
+
+  fh = fopen(path, "rb");
+  if (fh && fseek(fh, 0, SEEK_END) == 0) {
+    in_len = (size_t)ftell(fh);
+    in = malloc(in_len);
+    rewind(fh);
+    if (fread(in, 1, in_len, fh) != in_len) in_len = 0;
+  }
+  if (fh) fclose(fh);
+
+  // one frame per block; ZSTD_decompress walks concatenated frames
+  n = in ? ZSTD_decompress(out, PAYLOAD_BYTES + 16, in, in_len) : 0;
+  if (ZSTD_isError(n) || n != PAYLOAD_BYTES || memcmp(out, payload, PAYLOAD_BYTES) != 0) {
+    printf("FAIL: %s archive does not round-trip\n", compression);
+    failures++;
+  }
+
+  unlink(path);
+  free(in);
+  free(out);
+
+  return failures;
+#else
+  (void)dir, (void)payload;
+  printf("skipping %s round-trip: built without libzstd\n", compression);
+
+  return 0;
+#endif
+}
+
+int test_lz4_frames(const char *dir, const unsigned char *payload, const char *compression) {
+#ifdef DBEETLE_HAVE_LZ4
+  char path[BUF_LEN];
+  unsigned char *in = NULL, *out = malloc(PAYLOAD_BYTES + 16);
+  size_t in_len = 0, in_pos = 0, out_pos = 0, ret = 1;
+  LZ4F_dctx *dctx = NULL;
+  FILE *fh;
+  int failures = 0;
+
+  if (write_archive(dir, compression, payload, PAYLOAD_BYTES, path, sizeof(path)) != 0) {
+    free(out);
+
+    return 1;
+  }
+
+  fh = fopen(path, "rb");
+  if (fh && fseek(fh, 0, SEEK_END) == 0) {
+    in_len = (size_t)ftell(fh);
+    in = malloc(in_len);
+    rewind(fh);
+    if (fread(in, 1, in_len, fh) != in_len) in_len = 0;
+  }
+  if (fh) fclose(fh);
+
+  // a frame decoder resets itself after each frame, the way `lz4 -d` walks them
+  LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION);
+  while (in && in_pos < in_len && !LZ4F_isError(ret)) {
+    size_t src_size = in_len - in_pos, dst_size = PAYLOAD_BYTES + 16 - out_pos;
+
+    ret = LZ4F_decompress(dctx, out + out_pos, &dst_size, in + in_pos, &src_size, NULL);
+    in_pos += src_size;
+    out_pos += dst_size;
+  }
+  LZ4F_freeDecompressionContext(dctx);
+  if (LZ4F_isError(ret) || out_pos != PAYLOAD_BYTES || memcmp(out, payload, PAYLOAD_BYTES) != 0) {
+    printf("FAIL: %s archive does not round-trip\n", compression);
+    failures++;
+  }
+
+  unlink(path);
+  free(in);
+  free(out);
+
+  return failures;
+#else
+  (void)dir, (void)payload;
+  printf("skipping %s round-trip: built without liblz4\n", compression);
+
+  return 0;
+#endif
+}
+
+/* noise must be stored, text compressed, and stored blocks must decode */
+int test_adaptive(const char *dir, const unsigned char *payload) {
+  static const CodecId_t ids[] = { CODEC_GZIP, CODEC_ZSTD, CODEC_LZ4 };
+  size_t noise_len = 3 * PIPELINE_DEFAULT_BLOCK_SIZE + 17;
+  size_t cap = noise_len + PIPELINE_BLOCK_HEADROOM(noise_len);
+  unsigned char *noise = malloc(noise_len), *packed = malloc(cap), *out = malloc(cap);
+  char path[BUF_LEN];
+  struct stat st;
+  int failures = 0;
+  uint32_t x = 88172645u;
+
+  for (size_t i = 0; i < noise_len; i++) {
+    x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+    noise[i] = (unsigned char)x;
+  }
+  if (codec_sample_entropy(noise, noise_len) < CODEC_RAW_ENTROPY_BITS
+    || codec_sample_entropy(payload, 65536) >= CODEC_RAW_ENTROPY_BITS) {
+    printf("FAIL: entropy estimate does not separate noise from text\n");
+    failures++;
+  }
+
+  for (size_t i = 0; i < sizeof(ids) / sizeof(ids[0]); i++) {
+    const Codec_t *codec = codec_lookup(ids[i]);
+    CodecSpec_t spec = { ids[i], CODEC_LEVEL_DEFAULT, false, 0 };
+    void *state = codec ? codec->create(&spec) : NULL;
+    size_t packed_len = 0, out_len = 0;
+
+    if (!codec) continue;
+    if (!state || codec->store(state, noise, noise_len, packed, cap, &packed_len) != 0
+      || codec->decompress(packed, packed_len, out, cap, &out_len) != 0
+      || out_len != noise_len || memcmp(out, noise, noise_len) != 0) {
+      printf("FAIL: %s stored block does not round-trip\n", codec->name);
+      failures++;
+    }
+    if (state) codec->destroy(state);
+  }
+
+  // a noise archive costs only the framing of its stored blocks
+  if (write_archive(dir, "gzip:9", noise, noise_len, path, sizeof(path)) != 0) {
+    failures++;
+  } else {
+    gzFile gz = gzopen(path, "rb");
+    int n = gz ? gzread(gz, out, (unsigned)cap) : -1;
+
+    if (n != (int)noise_len || memcmp(out, noise, noise_len) != 0 || gzclose(gz) != Z_OK
+      || stat(path, &st) != 0 || (size_t)st.st_size > noise_len + noise_len / 1000) {
+      printf("FAIL: stored gzip archive does not round-trip at raw size\n");
+      failures++;
+    }
+    unlink(path);
+  }
+
+  free(noise);
+  free(packed);
+  free(out);
+
+  return failures;
+}
+
+int main(void) {
+  char dir[] = "/tmp/dbeetle_codec_XXXXXX";
+  unsigned char *payload = malloc(PAYLOAD_BYTES);
+  int failures = 0;
+
+  if (!payload || !mkdtemp(dir)) return 1;
+  fill_payload(payload, PAYLOAD_BYTES);
+
+  failures += test_spec_parsing();
+  failures += test_gzip_stream(dir, payload);
+  failures += test_zstd_frames(dir, payload, "zstd");
+  failures += test_zstd_frames(dir, payload, "zstd:19:long");
+  failures += test_lz4_frames(dir, payload, "lz4");
+  failures += test_adaptive(dir, payload);
+
+  rmdir(dir);
+  free(payload);
+
+  if (failures) return 1;
+  printf("Codec test passed.\n");
+  return 0;
+}
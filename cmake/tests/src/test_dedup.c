@@ -0,0 +1,281 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/archive.h"
+#include "include/chunkstore.h"
+#include "include/config_parser.h"
+#include "include/storage.h"
+
+#define DUMP_BYTES (8 << 20)
+
+/* dump-like rows: random ids and words, compressible but never periodic */
+void fill_rows(unsigned char *dst, size_t len, uint64_t seed) {
+  static const char *const words[] = { "alice", "bob", "carol", "dave", "erin", "frank", "grace", "heidi" };
+  uint64_t x = seed;
+  size_t pos = 0;
+
+  while (pos < len) {
+    char row[BUF_LEN_XS];
+    int n;
+
+    x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+    n = snprintf(row, sizeof(row), "%lu\t%s\t%s\t%lu\n", (unsigned long)(x % 1000000), words[x >> 61],
+      words[(x >> 40) & 7], (unsigned long)(x >> 20) % 99991);
+    for (int i = 0; i < n && pos < len; i++) dst[pos++] = (unsigned char)row[i];
+  }
+}
+
+/* chunk boundaries of @data, as offsets after each cut */
+size_t cut_points(const unsigned char *data, size_t len, size_t *cuts, size_t max_cuts) {
+  Chunker_t ch;
+  size_t count = 0, pos = 0;
+
+  init_chunker(&ch);
+  while (pos < len && count < max_cuts) {
+    bool cut = false;
+    // odd feed sizes: cut points must not depend on how the stream is split
+    size_t feed = len - pos < 9973 ? len - pos : 9973;
+
+    pos += chunker_scan(&ch, data + pos, feed, &cut);
+    if (cut || pos == len) cuts[count++] = pos;
+  }
+
+  return count;
+}
+
+int test_chunker(void) {
+  unsigned char *data = malloc(DUMP_BYTES + 100);
+  size_t *a = malloc(sizeof(size_t) * 4096), *b = malloc(sizeof(size_t) * 4096);
+  size_t na, nb, shared = 0, prev = 0;
+  int failures = 0;
+
+  fill_rows(data + 100, DUMP_BYTES, 42);
+  na = cut_points(data + 100, DUMP_BYTES, a, 4096);
+  for (size_t i = 0; i < na; i++) {
+    size_t size = a[i] - prev;
+
+    if (size > CHUNK_MAX_SIZE || (size < CHUNK_MIN_SIZE && i + 1 < na)) {
+      printf("FAIL: chunk %zu is %zu bytes\n", i, size);
+      failures++;
+      break;
+    }
+    prev = a[i];
+  }
+  if (na < DUMP_BYTES / CHUNK_MAX_SIZE || na > DUMP_BYTES / CHUNK_MIN_SIZE) {
+    printf("FAIL: %zu chunks for %d bytes\n", na, DUMP_BYTES);
+    failures++;
+  }
+
+  // 100 bytes inserted up front: boundaries resynchronise right after
+  memset(data, 'x', 100);
+  nb = cut_points(data, DUMP_BYTES + 100, b, 4096);
+  for (size_t i = 0, j = 0; i < na && j < nb;) {
+    if (a[i] + 100 == b[j]) shared++, i++, j++;
+    else if (a[i] + 100 < b[j]) i++;
+    else j++;
+  }
+  if (shared + 2 < na) {
+    printf("FAIL: only %zu of %zu cut points survived a shifted stream\n", shared, na);
+    failures++;
+  }
+
+  free(data);
+  free(a);
+  free(b);
+
+  return failures;
+}
+
+int backup(AppConfig_t *cfg, const char *name, const unsigned char *data, size_t len, uint64_t *new_chunks) {
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  StorageSink_t *sink = init_storage_sink(cfg->storage, name, &storage_err);
+  Pipeline_t *pipe = sink ? init_storage_pipeline(cfg, sink, &pipe_err) : NULL;
+  PipeWriter_t writer;
+  int failures = 0;
+
+  if (!pipe) {
+    printf("FAIL: dedup pipeline: %s\n", storage_err ? storage_err->message : pipe_err ? pipe_err->message : "?");
+    failures++;
+  } else {
+    init_pipe_writer(&writer, pipe, 0);
+    pipe_writer_write(&writer, data, len);
+    pipe_writer_close(&writer);
+    if (pipeline_finish(pipe, &pipe_err) != PIPELINE_OK || storage_sink_commit(sink, &storage_err) != STORAGE_OK) {
+      printf("FAIL: %s not committed: %s\n", name, storage_err ? storage_err->message : "?");
+      failures++;
+    }
+    *new_chunks = sink->dedup->new_chunks;
+  }
+
+  destroy_storage_error(&storage_err), destroy_pipeline_error(&pipe_err);
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+
+  return failures;
+}
+
+int restore_matches(const char *dir, const char *name, const unsigned char *data, size_t len) {
+  char manifest[BUF_LEN], out_path[BUF_LEN];
+  ChunkStoreError_t *err = NULL;
+  ChunkStore_t *store = init_chunk_store(dir, "gzip", &err);
+  unsigned char *restored = malloc(len + 1);
+  int fd, ok = 0;
+  ssize_t n = 0;
+
+  snprintf(manifest, sizeof(manifest), "%s/%s", dir, name);
+  snprintf(out_path, sizeof(out_path), "%s/restored", dir);
+  fd = open(out_path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if (store && fd >= 0 && chunk_store_restore(store, manifest, fd, &err) == CHUNKSTORE_OK) {
+    n = pread(fd, restored, len + 1, 0);
+    ok = n == (ssize_t)len && memcmp(restored, data, len) == 0;
+  }
+  if (!ok) printf("FAIL: %s restored %zd of %zu bytes: %s\n", name, n, len, err ? err->message : "mismatch");
+
+  if (fd >= 0) close(fd);
+  unlink(out_path);
+  destroy_chunk_store(&store);
+  destroy_chunk_store_error(&err);
+  free(restored);
+
+  return ok ? 0 : 1;
+}
+
+/* the manifest ends with the ranges of the stream each object was written as */
+int test_index(const char *dir, const char *name, size_t len) {
+  char manifest[BUF_LEN];
+  unsigned char *raw = NULL;
+  ArchiveIndex_t *index = NULL;
+  CodecId_t codec = CODEC_GZIP;
+  uint64_t end = 0, data_len = 0;
+  struct stat st;
+  bool last = false;
+  int fd, failures = 0;
+
+  snprintf(manifest, sizeof(manifest), "%s/%s", dir, name);
+  fd = open(manifest, O_RDONLY);
+  if (fd >= 0 && fstat(fd, &st) == 0) data_len = chunk_manifest_length(fd, (uint64_t)st.st_size);
+  if (data_len > 0 && data_len < (uint64_t)st.st_size && (raw = malloc((size_t)st.st_size - data_len))
+    && pread(fd, raw, (size_t)st.st_size - data_len, (off_t)data_len) == (ssize_t)((uint64_t)st.st_size - data_len)) {
+    index = archive_index_decode(raw, (size_t)st.st_size - data_len, &codec);
+  }
+  for (uint64_t i = 0; index && i < index->frame_count && !failures; i++) {
+    const ArchiveFrame_t *frame = &index->frames[i];
+
+    failures += frame->object_id != 0 || frame->offset != end || frame->stored_len != frame->raw_len || last;
+    end += frame->raw_len;
+    last = (frame->flags & PIPE_BUF_LAST) != 0;
+  }
+  if (!index || codec != CODEC_NONE || failures || end != len || !last) {
+    printf("FAIL: %s has no index of its stream, or a wrong one\n", name);
+    failures++;
+  }
+
+  if (fd >= 0) close(fd);
+  destroy_archive_index(&index);
+  free(raw);
+
+  return failures;
+}
+
+/* corrupts one stored chunk and expects the restore to refuse it */
+int test_damaged(const char *dir, const char *name) {
+  char manifest[BUF_LEN], hex[2 * CHUNK_ID_LEN + 1], path[BUF_LEN];
+  unsigned char header[CHUNKSTORE_HEADER_LEN + CHUNK_ID_LEN], byte = 0;
+  ChunkStoreError_t *err = NULL;
+  ChunkStore_t *store = init_chunk_store(dir, "gzip", &err);
+  int in, fd, out = open("/dev/null", O_WRONLY), failures = 0;
+
+  snprintf(manifest, sizeof(manifest), "%s/%s", dir, name);
+  in = open(manifest, O_RDONLY);
+  if (in < 0 || read(in, header, sizeof(header)) != (ssize_t)sizeof(header)) failures++;
+  chunk_id_hex(header + CHUNKSTORE_HEADER_LEN, hex);
+  snprintf(path, sizeof(path), "%s/%s/%.2s/%s", dir, CHUNKSTORE_DIR, hex, hex + 2);
+  fd = open(path, O_RDWR);
+  if (fd < 0 || pread(fd, &byte, 1, 40) != 1) failures++;
+  byte ^= 0x5a;
+  if (fd >= 0 && pwrite(fd, &byte, 1, 40) != 1) failures++;
+  if (failures || chunk_store_restore(store, manifest, out, &err) != CHUNKSTORE_CORRUPT_ERROR) {
+    printf("FAIL: damaged chunk was restored\n");
+    failures++;
+  }
+  byte ^= 0x5a;
+  if (fd >= 0 && pwrite(fd, &byte, 1, 40) != 1) failures++;
+
+  if (fd >= 0) close(fd);
+  if (in >= 0) close(in);
+  if (out >= 0) close(out);
+  destroy_chunk_store(&store);
+  destroy_chunk_store_error(&err);
+
+  return failures;
+}
+
+int test_repository(const char *dir) {
+  unsigned char *day1 = malloc(DUMP_BYTES), *day2 = malloc(DUMP_BYTES + 5000);
+  uint64_t first = 0, second = 0;
+  StorageError_t *storage_err = NULL;
+  StorageSink_t *sink;
+  int failures = 0;
+
+  AppConfig_t *cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1),
+    init_storage_config(dir, "gzip", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 2, DEFAULT_RUNTIME_TMP_DIR));
+  cfg->storage->dedup_enabled = 1;
+
+  // the next day: a few rows changed in place and a few thousand bytes of new rows in the middle
+  fill_rows(day1, DUMP_BYTES, 7);
+  memcpy(day2, day1, DUMP_BYTES / 2);
+  fill_rows(day2 + DUMP_BYTES / 2, 5000, 99);
+  memcpy(day2 + DUMP_BYTES / 2 + 5000, day1 + DUMP_BYTES / 2, DUMP_BYTES / 2);
+  memcpy(day2 + DUMP_BYTES / 4, "UPDATED", 7);
+  memcpy(day2 + 3 * (DUMP_BYTES / 4), "UPDATED", 7);
+
+  failures += backup(cfg, "day1.dump", day1, DUMP_BYTES, &first);
+  failures += backup(cfg, "day2.dump", day2, DUMP_BYTES + 5000, &second);
+  if (first < DUMP_BYTES / CHUNK_MAX_SIZE || second == 0 || second * 10 > first) {
+    printf("FAIL: day2 stored %lu new chunks, day1 %lu\n", (unsigned long)second, (unsigned long)first);
+    failures++;
+  }
+  failures += restore_matches(dir, "day1.dump", day1, DUMP_BYTES);
+  failures += restore_matches(dir, "day2.dump", day2, DUMP_BYTES + 5000);
+  failures += test_index(dir, "day2.dump", DUMP_BYTES + 5000);
+  failures += test_damaged(dir, "day2.dump");
+
+  // chunks outlive any one backup's data key
+  snprintf(cfg->storage->encryption_key_path, sizeof(cfg->storage->encryption_key_path), "%s/key", dir);
+  sink = init_storage_sink(cfg->storage, "sealed.dump", &storage_err);
+  if (sink || !storage_err || storage_err->code != STORAGE_CONFIG_ERROR) {
+    printf("FAIL: dedup accepted an encryption key\n");
+    failures++;
+  }
+
+  destroy_storage_sink(&sink);
+  destroy_storage_error(&storage_err);
+  destroy_app_config(&cfg);
+  free(day1);
+  free(day2);
+
+  return failures;
+}
+
+int main(void) {
+  char dir[] = "/tmp/dbeetle_dedup_XXXXXX", cmd[BUF_LEN];
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+
+  failures += test_chunker();
+  failures += test_repository(dir);
+
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  if (system(cmd) != 0) failures++;
+
+  if (failures) return 1;
+  printf("Dedup test passed.\n");
+  return 0;
+}
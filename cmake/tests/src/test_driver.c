@@ -0,0 +1,208 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "include/archive.h"
+#include "include/config_parser.h"
+#include "include/driver.h"
+#include "driver_standin.h"
+
+/* one object read back */
+typedef struct Read {
+  char              *data;
+  size_t            len;
+  size_t            cap;
+} Read_t;
+
+int read_append(void *ctx, const unsigned char *data, size_t len) {
+  Read_t *r = ctx;
+
+  if (len == 0) return 0;
+  if (r->len + len > r->cap) {
+    size_t cap = (r->len + len) * 2;
+    char *grown = realloc(r->data, cap);
+
+    if (!grown) return -1;
+    r->data = grown;
+    r->cap = cap;
+  }
+  memcpy(r->data + r->len, data, len);
+  r->len += len;
+
+  return 0;
+}
+
+/* the stand-in's part @part of object @name */
+char *expected_part(const char *name, uint32_t part, size_t *len) {
+  char *out = malloc(DRIVER_STANDIN_ROWS * BUF_LEN_S);
+  size_t used = 0;
+
+  if (!out) return NULL;
+  for (size_t i = 0; i < DRIVER_STANDIN_ROWS; i++) {
+    used += (size_t)sprintf(out + used, DRIVER_STANDIN_LINE, name, part, i);
+  }
+  *len = used;
+
+  return out;
+}
+
+/* every part of object @name is in the archive once, byte for byte */
+int check_object(ArchiveReader_t *reader, const char *name, uint32_t parts) {
+  ArchiveObject_t *obj = NULL;
+  ArchiveError_t *err = NULL;
+  uint32_t seen = 0, found = 0;
+  int failures = 0;
+
+  while (!failures && (obj = archive_find_next_object(reader, name, obj)) != NULL) {
+    Read_t r = { NULL, 0, 0 };
+    char *want = NULL;
+    size_t want_len = 0;
+    unsigned part = 0;
+
+    found++;
+    if (archive_read_object(reader, obj, read_append, &r, &err) != ARCHIVE_OK) {
+      printf("FAIL: reading %s: %s\n", name, err ? err->message : "?");
+      destroy_archive_error(&err);
+      failures++;
+    } else if (parts == 0) {
+      if (r.len != 0) {
+        printf("FAIL: %s holds %zu bytes\n", name, r.len);
+        failures++;
+      }
+    } else if (r.len == 0 || sscanf(r.data, "%*s %u", &part) != 1 || part >= parts || (seen & (1u << part))
+      || !(want = expected_part(name, part, &want_len)) || want_len != r.len || memcmp(want, r.data, r.len) != 0) {
+      printf("FAIL: %s part %u differs (%zu bytes)\n", name, part, r.len);
+      failures++;
+    } else {
+      seen |= 1u << part;
+    }
+    free(want);
+    free(r.data);
+  }
+  if (!failures && found != (parts ? parts : 1)) {
+    printf("FAIL: %s stored as %u objects\n", name, found);
+    failures++;
+  }
+
+  return failures;
+}
+
+/* a plugin driver's objects all land in one archive, in their parts */
+int test_plugin_backup(AppConfig_t *cfg) {
+  DriverError_t *err = NULL;
+  ArchiveError_t *archive_err = NULL;
+  ArchiveReader_t *reader;
+  int failures = 0;
+
+  snprintf(cfg->db->uri, sizeof(cfg->db->uri), "anything");
+  if (driver_run_backup(cfg, "standin.dump", &err) != DRIVER_OK) {
+    printf("FAIL: plugin backup: %s\n", err ? err->message : "?");
+    destroy_driver_error(&err);
+
+    return 1;
+  }
+  reader = init_archive_reader(cfg->storage, "standin.dump", &archive_err);
+  if (!reader) {
+    printf("FAIL: plugin archive: %s\n", archive_err ? archive_err->message : "?");
+    destroy_archive_error(&archive_err);
+
+    return 1;
+  }
+  failures += check_object(reader, "small", 1);
+  failures += check_object(reader, "large", 3);
+  failures += check_object(reader, "empty", 0);
+  destroy_archive_reader(&reader);
+
+  return failures;
+}
+
+/* the driver's own failure codes and messages come back, and a driver that cannot open leaves no archive */
+int test_plugin_failures(AppConfig_t *cfg) {
+  DriverError_t *err = NULL;
+  char path[BUF_LEN + 16];
+  struct stat st;
+  int failures = 0;
+
+  snprintf(cfg->db->uri, sizeof(cfg->db->uri), "fail-open");
+  snprintf(path, sizeof(path), "%s/fail-open.dump", cfg->storage->output_path);
+  if (driver_run_backup(cfg, "fail-open.dump", &err) != DRIVER_OPEN_ERROR || !err || err->driver_code != 3
+    || stat(path, &st) == 0) {
+    printf("FAIL: failed open: %s\n", err ? err->message : "backed up");
+    failures++;
+  }
+  destroy_driver_error(&err);
+
+  snprintf(cfg->db->uri, sizeof(cfg->db->uri), "fail-stream");
+  if (driver_run_backup(cfg, "fail-stream.dump", &err) != DRIVER_DUMP_ERROR || !err
+    || err->driver_code != DRIVER_STANDIN_FAIL_CODE || !strstr(err->message, "broken")) {
+    printf("FAIL: failed stream: %s\n", err ? err->message : "backed up");
+    failures++;
+  }
+  destroy_driver_error(&err);
+
+  return failures;
+}
+
+/* built-ins answer to their types, unknown or unsafe types load nothing */
+int test_find(AppConfig_t *cfg) {
+  const char *missing[] = { "nosuch", "../standin", "" };
+  const char *builtin[] = { "sqlite", "postgres" };
+  DriverHandle_t handle;
+  DriverError_t *err = NULL;
+  int failures = 0;
+
+  for (size_t i = 0; i < sizeof(missing) / sizeof(missing[0]); i++) {
+    snprintf(cfg->db->type, sizeof(cfg->db->type), "%s", missing[i]);
+    if (driver_find(cfg->db, &handle, &err) != DRIVER_LOAD_ERROR) {
+      printf("FAIL: driver found for type \"%s\"\n", missing[i]);
+      if (!err) driver_release(&handle);
+      failures++;
+    }
+    destroy_driver_error(&err);
+  }
+  for (size_t i = 0; i < sizeof(builtin) / sizeof(builtin[0]); i++) {
+    snprintf(cfg->db->type, sizeof(cfg->db->type), "%s", builtin[i]);
+    if (driver_find(cfg->db, &handle, &err) != DRIVER_OK) {
+      printf("FAIL: no driver for %s: %s\n", builtin[i], err ? err->message : "?");
+      destroy_driver_error(&err);
+      failures++;
+      continue;
+    }
+    if (strcmp(handle.driver->name, builtin[i]) != 0 || handle.library) {
+      printf("FAIL: %s resolved to %s\n", builtin[i], handle.driver->name);
+      failures++;
+    }
+    driver_release(&handle);
+  }
+
+  return failures;
+}
+
+int main(int argc, char **argv) {
+  char dir[] = "/tmp/dbeetle_driver_XXXXXX", cmd[BUF_LEN];
+  AppConfig_t *cfg;
+  int failures = 0;
+
+  if (argc < 2 || !mkdtemp(dir)) {
+    printf("usage: test_driver <plugin directory>\n");
+
+    return 1;
+  }
+  cfg = init_app_config(init_db_config(DRIVER_STANDIN_TYPE, "", 10, 0),
+    init_storage_config(dir, "gzip:1", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 3, DEFAULT_RUNTIME_TMP_DIR));
+  snprintf(cfg->db->driver_path, sizeof(cfg->db->driver_path), "%s", argv[1]);
+
+  failures += test_plugin_backup(cfg);
+  failures += test_plugin_failures(cfg);
+  failures += test_find(cfg);
+
+  destroy_app_config(&cfg);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  if (system(cmd) != 0) failures++;
+  if (failures) return 1;
+  printf("driver test passed.\n");
+
+  return 0;
+}
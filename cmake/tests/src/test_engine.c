@@ -0,0 +1,207 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/config_parser.h"
+#include "include/engine.h"
+
+#define OBJECT_COUNT (2000)
+#define FANOUT_DEPTH (6)
+#define ORDER_COUNT (64)
+
+typedef struct DumpCounter {
+  int               hits[OBJECT_COUNT];
+  size_t            workers_seen[SCHED_MAX_WORKERS];
+  pthread_mutex_t   lock;
+} DumpCounter_t;
+
+static Scheduler_t *g_sched;
+static size_t g_fanout_leaves;
+static pthread_mutex_t g_fanout_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int count_dump(const DumpObject_t *obj, size_t worker_id, void *ctx) {
+  DumpCounter_t *counter = ctx;
+  int index = atoi(obj->name + strlen("table_"));
+
+  pthread_mutex_lock(&counter->lock);
+  counter->hits[index]++;
+  counter->workers_seen[worker_id]++;
+  pthread_mutex_unlock(&counter->lock);
+
+  return strcmp(obj->name, "table_13") == 0 ? -1 : 0;
+}
+
+void fanout_task(void *arg, size_t worker_id) {
+  size_t depth = (size_t)arg;
+
+  (void)worker_id;
+  if (depth == 0) {
+    pthread_mutex_lock(&g_fanout_lock);
+    g_fanout_leaves++;
+    pthread_mutex_unlock(&g_fanout_lock);
+
+    return;
+  }
+  // spawned from a worker: lands on its own deque and gets stolen
+  scheduler_submit(g_sched, fanout_task, (void *)(depth - 1));
+  scheduler_submit(g_sched, fanout_task, (void *)(depth - 1));
+}
+
+typedef struct StartOrder {
+  int               started[ORDER_COUNT];
+  size_t            count;
+  pthread_mutex_t   lock;
+} StartOrder_t;
+
+/* object order_<i> is the i-th largest; the largest one keeps its worker busy */
+int order_dump(const DumpObject_t *obj, size_t worker_id, void *ctx) {
+  StartOrder_t *order = ctx;
+  int rank = atoi(obj->name + strlen("order_"));
+
+  (void)worker_id;
+  pthread_mutex_lock(&order->lock);
+  order->started[order->count++] = rank;
+  pthread_mutex_unlock(&order->lock);
+  if (rank == 0) usleep(100 * 1000);
+
+  return 0;
+}
+
+/* submits the second half of the objects from a worker, as a walk finding them would */
+void submit_half(void *arg, size_t worker_id) {
+  BackupEngine_t *engine = arg;
+  char name[BUF_LEN_S];
+
+  (void)worker_id;
+  for (int i = OBJECT_COUNT / 2; i < OBJECT_COUNT; i++) {
+    snprintf(name, sizeof(name), "table_%d", i);
+    if (engine_submit(engine, name, 1, 0, 1) != ENGINE_OK) return;
+  }
+}
+
+int main(int argc, char *argv[]) {
+  if (argc < 2) {
+    fprintf(stderr, "Usage: %s <config.yml>\n", argv[0]);
+    return 1;
+  }
+
+  DBConfig_t *cfg_db = init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1);
+  StorageConfig_t *cfg_storage = init_storage_config(DEFAULT_STORAGE_OUTPUT_PATH, DEFAULT_STORAGE_COMPRESSION,
+    DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE);
+  RuntimeConfig_t *cfg_runtime = init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, DEFAULT_RUNTIME_THREAD_COUNT,
+    DEFAULT_RUNTIME_TMP_DIR);
+  AppConfig_t *cfg = init_app_config(cfg_db, cfg_storage, cfg_runtime);
+  ConfigParserError_t *cfg_err = NULL;
+  EngineError_t *engine_err = NULL;
+  DumpCounter_t counter = {0};
+  char name[BUF_LEN_S];
+  int failures = 0;
+
+  if (config_load_file(argv[1], cfg, &cfg_err) != CONFIG_OK) {
+    printf("Error: %s\n", cfg_err ? cfg_err->message : "unknown");
+    destroy_parser_error(&cfg_err);
+    destroy_app_config(&cfg);
+    return 1;
+  }
+
+  // 1. nested spawns are all accounted for by scheduler_wait
+  g_sched = init_scheduler(cfg->runtime->thread_count);
+  scheduler_submit(g_sched, fanout_task, (void *)FANOUT_DEPTH);
+  scheduler_wait(g_sched);
+  if (g_fanout_leaves != (1u << FANOUT_DEPTH)) {
+    printf("FAIL: fanout reached %zu leaves, expected %u\n", g_fanout_leaves, 1u << FANOUT_DEPTH);
+    failures++;
+  }
+  destroy_scheduler(&g_sched);
+
+  // 2. every object is dumped exactly once and failures are reported
+  pthread_mutex_init(&counter.lock, NULL);
+  BackupEngine_t *engine = init_backup_engine(cfg);
+  for (int i = 0; i < OBJECT_COUNT; i++) {
+    snprintf(name, sizeof(name), "table_%d", i);
+    engine_add_object(engine, name, (size_t)((i * 7919) % 1000));
+  }
+
+  EngineStatus_t status = engine_run(engine, count_dump, &counter, &engine_err);
+  if (status != ENGINE_DUMP_ERROR || !engine_err || !strstr(engine_err->message, "table_13")) {
+    printf("FAIL: expected table_13 to be reported, got status %d\n", status);
+    failures++;
+  }
+  for (int i = 0; i < OBJECT_COUNT; i++) {
+    if (counter.hits[i] != 1) {
+      printf("FAIL: table_%d dumped %d times\n", i, counter.hits[i]);
+      failures++;
+      break;
+    }
+  }
+  printf("engine ran %d objects on %zu workers\n", OBJECT_COUNT, engine->sched->worker_count);
+
+  destroy_engine_error(&engine_err);
+  destroy_backup_engine(&engine);
+
+  // 3. objects submitted while the run goes, from outside the pool and from a worker
+  memset(counter.hits, 0, sizeof(counter.hits));
+  engine = init_backup_engine(cfg);
+  if (engine_start(engine, count_dump, &counter, &engine_err) != ENGINE_OK) {
+    printf("FAIL: engine did not start\n");
+    failures++;
+  } else {
+    scheduler_submit(engine->sched, submit_half, engine);
+    for (int i = 0; i < OBJECT_COUNT / 2; i++) {
+      snprintf(name, sizeof(name), "table_%d", i);
+      engine_submit(engine, name, 1, 0, 1);
+    }
+    status = engine_wait(engine, &engine_err);
+    if (status != ENGINE_DUMP_ERROR || !engine_err || !strstr(engine_err->message, "table_13")) {
+      printf("FAIL: expected submitted table_13 to be reported, got status %d\n", status);
+      failures++;
+    }
+    for (int i = 0; i < OBJECT_COUNT; i++) {
+      if (counter.hits[i] != 1) {
+        printf("FAIL: submitted table_%d dumped %d times\n", i, counter.hits[i]);
+        failures++;
+        break;
+      }
+    }
+  }
+
+  destroy_engine_error(&engine_err);
+  destroy_backup_engine(&engine);
+
+  // 4. a worker that frees up takes the largest object left, never a small one ahead of a big one
+  StartOrder_t order = { .count = 0 };
+  size_t threads = cfg->runtime->thread_count;
+  int previous = 0;
+
+  pthread_mutex_init(&order.lock, NULL);
+  cfg->runtime->thread_count = 2;
+  engine = init_backup_engine(cfg);
+  for (int i = ORDER_COUNT - 1; i >= 0; i--) {
+    snprintf(name, sizeof(name), "order_%d", i);
+    engine_add_object(engine, name, (size_t)(ORDER_COUNT - i) * 1000);
+  }
+  if (engine_run(engine, order_dump, &order, &engine_err) != ENGINE_OK || order.count != ORDER_COUNT) {
+    printf("FAIL: ordered run dumped %zu objects\n", order.count);
+    failures++;
+  }
+  // while one worker holds the largest, the other goes through the rest largest first
+  for (size_t i = 0; i < order.count; i++) {
+    if (order.started[i] == 0) continue;
+    if (order.started[i] != previous + 1) {
+      printf("FAIL: order_%d started after order_%d\n", order.started[i], previous);
+      failures++;
+      break;
+    }
+    previous = order.started[i];
+  }
+  cfg->runtime->thread_count = threads;
+  destroy_engine_error(&engine_err);
+  destroy_backup_engine(&engine);
+  pthread_mutex_destroy(&order.lock);
+  pthread_mutex_destroy(&counter.lock);
+  destroy_app_config(&cfg);
+
+  if (failures) return 1;
+  printf("Engine test passed.\n");
+  return 0;
+}
@@ -0,0 +1,407 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/incremental.h"
+#include "include/config_parser.h"
+#include "pg_standin.h"
+
+#define BIG_BYTES (40 * INCR_BLOCK_SIZE + 1234)
+#define SMALL_BYTES (3 * INCR_BLOCK_SIZE + 77)
+#define RELATIONS (16)
+#define SEGMENT (1 << 20)
+
+/* page-like content: a header per 8K page over compressible filler */
+void fill_pages(unsigned char *dst, size_t len, uint64_t seed) {
+  uint64_t x = seed;
+
+  for (size_t pos = 0; pos < len; pos++) {
+    if (pos % 8192 == 0) x ^= x << 13, x ^= x >> 7, x ^= x << 17;
+    dst[pos] = pos % 8192 < 16 ? (unsigned char)(x >> (pos % 8)) : (unsigned char)("tuple data "[pos % 11]);
+  }
+}
+
+int write_file(const char *dir, const char *rel, const unsigned char *data, size_t len) {
+  char path[BUF_LEN];
+  int fd, ok;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, rel);
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+  ok = fd >= 0 && write(fd, data, len) == (ssize_t)len;
+  if (fd >= 0) close(fd);
+
+  return ok ? 0 : 1;
+}
+
+/* rewrites @len bytes at @offset and moves mtime forward, as a checkpoint would */
+int touch_range(const char *dir, const char *rel, off_t offset, const unsigned char *data, size_t len, time_t mtime) {
+  char path[BUF_LEN];
+  struct timespec times[2] = { { mtime, 0 }, { mtime, 0 } };
+  int fd, ok;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, rel);
+  fd = open(path, O_WRONLY);
+  ok = fd >= 0 && pwrite(fd, data, len, offset) == (ssize_t)len && futimens(fd, times) == 0;
+  if (fd >= 0) close(fd);
+
+  return ok ? 0 : 1;
+}
+
+int file_matches(const char *dir, const char *rel, const unsigned char *data, size_t len) {
+  char path[BUF_LEN];
+  unsigned char *got = malloc(len + 1);
+  int fd, ok;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, rel);
+  fd = open(path, O_RDONLY);
+  ok = fd >= 0 && read(fd, got, len + 1) == (ssize_t)len && memcmp(got, data, len) == 0;
+  if (!ok) printf("FAIL: %s differs after restore\n", path);
+  if (fd >= 0) close(fd);
+  free(got);
+
+  return ok ? 0 : 1;
+}
+
+int run_backup(AppConfig_t *cfg, const char *src, const char *name, IncrStats_t *stats) {
+  IncrError_t *err = NULL;
+  int failures = 0;
+
+  if (incremental_backup(cfg, src, name, stats, &err) != INCR_OK) {
+    printf("FAIL: backup %s: %s\n", name, err ? err->message : "?");
+    failures++;
+  }
+  destroy_incr_error(&err);
+
+  return failures;
+}
+
+int run_restore(AppConfig_t *cfg, const char *name, const char *target) {
+  IncrError_t *err = NULL;
+  int failures = 0;
+
+  if (incremental_restore(cfg->storage, name, target, &err) != INCR_OK) {
+    printf("FAIL: restore %s: %s\n", name, err ? err->message : "?");
+    failures++;
+  }
+  destroy_incr_error(&err);
+
+  return failures;
+}
+
+/* flips a byte of the first stored block of @name and expects the restore to refuse it */
+int test_damaged(AppConfig_t *cfg, const char *dir, const char *name) {
+  char path[BUF_LEN], target[BUF_LEN];
+  unsigned char byte = 0;
+  IncrError_t *err = NULL;
+  int fd, failures = 0;
+
+  snprintf(path, sizeof(path), "%s/%s%s", cfg->storage->output_path, name, INCR_BLOCKS_SUFFIX);
+  snprintf(target, sizeof(target), "%s/damaged", dir);
+  fd = open(path, O_RDWR);
+  if (fd < 0 || pread(fd, &byte, 1, INCR_HEADER_LEN + 5) != 1) failures++;
+  byte ^= 0x5a;
+  if (fd >= 0 && pwrite(fd, &byte, 1, INCR_HEADER_LEN + 5) != 1) failures++;
+  if (failures || incremental_restore(cfg->storage, name, target, &err) != INCR_CORRUPT_ERROR) {
+    printf("FAIL: damaged block was restored\n");
+    failures++;
+  }
+  byte ^= 0x5a;
+  if (fd >= 0 && pwrite(fd, &byte, 1, INCR_HEADER_LEN + 5) != 1) failures++;
+
+  if (fd >= 0) close(fd);
+  destroy_incr_error(&err);
+
+  return failures;
+}
+
+int test_chain(const char *dir) {
+  char src[BUF_LEN_S], repo[BUF_LEN_S], out1[BUF_LEN_S], out2[BUF_LEN_S], empty[BUF_LEN], rel[BUF_LEN_S];
+  unsigned char *big = malloc(BIG_BYTES), *small = malloc(SMALL_BYTES + INCR_BLOCK_SIZE), *cold = malloc(SMALL_BYTES);
+  unsigned char *big1 = malloc(BIG_BYTES);
+  IncrStats_t s1, s2, s3;
+  IncrError_t *err = NULL;
+  struct stat st;
+  int failures = 0;
+
+  AppConfig_t *cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1),
+    init_storage_config(DEFAULT_STORAGE_OUTPUT_PATH, "gzip", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 4, DEFAULT_RUNTIME_TMP_DIR));
+
+  snprintf(src, sizeof(src), "%s/data", dir);
+  snprintf(repo, sizeof(repo), "%s/repo", dir);
+  snprintf(out1, sizeof(out1), "%s/out1", dir);
+  snprintf(out2, sizeof(out2), "%s/out2", dir);
+  snprintf(cfg->storage->output_path, sizeof(cfg->storage->output_path), "%s", repo);
+  snprintf(empty, sizeof(empty), "%s/pg_tblspc", src);
+  mkdir(src, 0750);
+  mkdir(empty, 0750);
+  snprintf(empty, sizeof(empty), "%s/base", src);
+  mkdir(empty, 0750);
+  snprintf(empty, sizeof(empty), "%s/base/1", src);
+  mkdir(empty, 0750);
+
+  fill_pages(big, BIG_BYTES, 1);
+  fill_pages(small, SMALL_BYTES + INCR_BLOCK_SIZE, 2);
+  fill_pages(cold, SMALL_BYTES, 3);
+  failures += write_file(src, "base/16384", big, BIG_BYTES);
+  failures += write_file(src, "base/pg_filenode.map", small, SMALL_BYTES);
+  failures += write_file(src, "PG_VERSION", cold, SMALL_BYTES);
+  // enough files for every worker to read some while the walk goes on
+  for (int i = 0; i < RELATIONS; i++) {
+    snprintf(rel, sizeof(rel), "base/1/%d", 1000 + i);
+    failures += write_file(src, rel, small + i, SMALL_BYTES);
+  }
+  memcpy(big1, big, BIG_BYTES);
+
+  failures += run_backup(cfg, src, "b1", &s1);
+  if (s1.generation != 0 || s1.blocks_written != s1.blocks || s1.files_unchanged != 0) {
+    printf("FAIL: first backup is not a full one (generation %u, %lu of %lu blocks)\n", s1.generation,
+      (unsigned long)s1.blocks_written, (unsigned long)s1.blocks);
+    failures++;
+  }
+
+  // one block rewritten in place, one file grown by a block, the rest untouched
+  memcpy(big + 17 * INCR_BLOCK_SIZE + 100, "CHECKPOINT", 10);
+  failures += touch_range(src, "base/16384", 17 * INCR_BLOCK_SIZE + 100, (const unsigned char *)"CHECKPOINT", 10,
+    2000000000);
+  failures += touch_range(src, "base/pg_filenode.map", SMALL_BYTES, small + SMALL_BYTES, INCR_BLOCK_SIZE, 2000000000);
+  failures += run_backup(cfg, src, "b2", &s2);
+  if (s2.generation != 1 || s2.files_unchanged != 1 + RELATIONS || s2.blocks_written > 3
+    || s2.bytes_read > BIG_BYTES + SMALL_BYTES + INCR_BLOCK_SIZE) {
+    printf("FAIL: incremental wrote %lu blocks, read %lu bytes, %lu files unchanged\n",
+      (unsigned long)s2.blocks_written, (unsigned long)s2.bytes_read, (unsigned long)s2.files_unchanged);
+    failures++;
+  }
+
+  // every backup of the chain restores on its own
+  failures += run_restore(cfg, "b1", out1);
+  failures += file_matches(out1, "base/16384", big1, BIG_BYTES);
+  failures += file_matches(out1, "base/pg_filenode.map", small, SMALL_BYTES);
+  failures += file_matches(out1, "PG_VERSION", cold, SMALL_BYTES);
+  failures += run_restore(cfg, "b2", out2);
+  failures += file_matches(out2, "base/16384", big, BIG_BYTES);
+  failures += file_matches(out2, "base/pg_filenode.map", small, SMALL_BYTES + INCR_BLOCK_SIZE);
+  failures += file_matches(out2, "PG_VERSION", cold, SMALL_BYTES);
+  for (int i = 0; i < RELATIONS; i++) {
+    snprintf(rel, sizeof(rel), "base/1/%d", 1000 + i);
+    failures += file_matches(out1, rel, small + i, SMALL_BYTES);
+    failures += file_matches(out2, rel, small + i, SMALL_BYTES);
+  }
+  snprintf(empty, sizeof(empty), "%s/pg_tblspc", out2);
+  if (stat(empty, &st) != 0 || !S_ISDIR(st.st_mode)) {
+    printf("FAIL: empty directory was not restored\n");
+    failures++;
+  }
+
+  // without a data directory the CLI keeps the driver dump
+  if (incremental_selected(cfg->db)) {
+    printf("FAIL: the block strategy is selected without db.data_dir\n");
+    failures++;
+  }
+  // with one it takes the strategy by default and tells these backups from archives by their manifest
+  snprintf(cfg->db->data_dir, sizeof(cfg->db->data_dir), "%s", src);
+  if (!incremental_selected(cfg->db) || !incremental_backup_exists(cfg->storage, "b2")
+    || incremental_backup_exists(cfg->storage, "b9") || incremental_backup_exists(cfg->storage, "../repo/b2")) {
+    printf("FAIL: the block strategy or its backups are not recognised\n");
+    failures++;
+  }
+  failures += test_damaged(cfg, dir, "b2");
+  if (incremental_backup(cfg, src, "b2", NULL, &err) != INCR_CONFIG_ERROR) {
+    printf("FAIL: an existing backup was overwritten\n");
+    failures++;
+  }
+  destroy_incr_error(&err);
+
+  // with the option off every backup starts a new chain
+  cfg->db->incremental_enabled = 0;
+  if (incremental_selected(cfg->db)) {
+    printf("FAIL: the block strategy is selected with incrementals off\n");
+    failures++;
+  }
+  failures += run_backup(cfg, src, "b3", &s3);
+  if (s3.generation != 0 || s3.blocks_written != s3.blocks) {
+    printf("FAIL: backup without incremental_enabled was not full\n");
+    failures++;
+  }
+
+  destroy_app_config(&cfg);
+  free(big);
+  free(big1);
+  free(small);
+  free(cold);
+
+  return failures;
+}
+
+/* whether @rel under @dir is there, or gone */
+int expect_path(const char *dir, const char *rel, bool there) {
+  char path[BUF_LEN];
+  struct stat st;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, rel);
+  if ((stat(path, &st) == 0) == there) return 0;
+  printf("FAIL: %s %s\n", path, there ? "is missing" : "should not be there");
+
+  return 1;
+}
+
+/* segment @name restored from @dir holds the WAL of @standin from its start up to @end, zeros after */
+int check_segment(const char *dir, const char *name, PgStandin_t *standin, uint64_t start, uint64_t end) {
+  char path[BUF_LEN];
+  unsigned char *got = malloc(SEGMENT + 1);
+  int fd, failures = 0;
+
+  snprintf(path, sizeof(path), "%s/pg_wal/%s", dir, name);
+  fd = open(path, O_RDONLY);
+  if (fd < 0 || read(fd, got, SEGMENT + 1) != SEGMENT) {
+    printf("FAIL: %s is missing or not a whole segment\n", path);
+    failures++;
+  }
+  for (uint64_t i = 0; !failures && i < SEGMENT; i++) {
+    unsigned char want = start + i < end ? pg_standin_wal_byte(standin, 1, start + i) : 0;
+
+    if (got[i] != want) {
+      printf("FAIL: %s differs from the server's WAL at %llu\n", path, (unsigned long long)i);
+      failures++;
+    }
+  }
+  if (fd >= 0) close(fd);
+  free(got);
+
+  return failures;
+}
+
+int test_backup_mode(const char *dir) {
+  char live[BUF_LEN_S], out[BUF_LEN_S], repo[BUF_LEN_S], uri[BUF_LEN], path[BUF_LEN], label[BUF_LEN];
+  unsigned char *data = malloc(SMALL_BYTES);
+  uint64_t stop = 4 * SEGMENT - 0x1000 + PG_STANDIN_BACKUP_END;
+  const char *pid_line = "4242\n";
+  IncrError_t *err = NULL;
+  PgStandin_t *standin = pg_standin_start(dir, PG_STANDIN_TRUST, "dbeetle", "");
+  AppConfig_t *cfg;
+  FILE *fh;
+  int failures = 0, cwd;
+  bool dropped = false;
+
+  if (!standin || !data) {
+    printf("FAIL: cannot start the stand-in\n");
+    pg_standin_stop(&standin);
+    free(data);
+
+    return 1;
+  }
+  pg_standin_set_wal(standin, SEGMENT, 4 * SEGMENT - 0x1000);
+  snprintf(uri, sizeof(uri), "postgresql://dbeetle@/shop?host=%s", dir);
+  cfg = init_app_config(init_db_config("postgres", uri, 10, 1),
+    init_storage_config(DEFAULT_STORAGE_OUTPUT_PATH, "none", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 4, DEFAULT_RUNTIME_TMP_DIR));
+  snprintf(live, sizeof(live), "%s/live", dir);
+  snprintf(out, sizeof(out), "%s/live_out", dir);
+  snprintf(repo, sizeof(repo), "%s/live_repo", dir);
+  snprintf(cfg->storage->output_path, sizeof(cfg->storage->output_path), "%s", repo);
+  snprintf(cfg->db->data_dir, sizeof(cfg->db->data_dir), "%s", live);
+
+  // a running server's tree: the files it rebuilds or writes for itself must stay out
+  fill_pages(data, SMALL_BYTES, 99);
+  mkdir(live, 0750);
+  for (const char *sub = "base\0base/1\0pg_wal\0pg_replslot\0pg_replslot/s\0"; *sub; sub += strlen(sub) + 1) {
+    snprintf(path, sizeof(path), "%s/%s", live, sub);
+    mkdir(path, 0750);
+  }
+  failures += write_file(live, "PG_VERSION", (const unsigned char *)"16\n", 3);
+  failures += write_file(live, "base/1/1000", data, SMALL_BYTES);
+  failures += write_file(live, "base/1/pg_internal.init", data, 100);
+  failures += write_file(live, "pg_wal/000000010000000000000001", data, SMALL_BYTES);
+  failures += write_file(live, "pg_replslot/s/state", data, 100);
+  failures += write_file(live, "backup_label", (const unsigned char *)"stale", 5);
+  failures += write_file(live, "postmaster.pid", (const unsigned char *)pid_line, strlen(pid_line));
+
+  if (incremental_backup(cfg, live, "pgb", NULL, &err) != INCR_OK) {
+    printf("FAIL: backup in backup mode: %s\n", err ? err->message : "?");
+    failures++;
+  }
+  destroy_incr_error(&err);
+  if (incremental_restore(cfg->storage, "pgb", out, &err) != INCR_OK) {
+    printf("FAIL: restore of the backup mode copy: %s\n", err ? err->message : "?");
+    failures++;
+  }
+  destroy_incr_error(&err);
+
+  failures += file_matches(out, "base/1/1000", data, SMALL_BYTES);
+  failures += expect_path(out, "PG_VERSION", true);
+  failures += expect_path(out, "pg_wal", true);
+  failures += expect_path(out, "pg_replslot", true);
+  failures += expect_path(out, "pg_replslot/s", false);
+  failures += expect_path(out, "pg_wal/000000010000000000000001", false);
+  failures += expect_path(out, "base/1/pg_internal.init", false);
+  failures += expect_path(out, "postmaster.pid", false);
+  failures += expect_path(repo, "pgb.stage", false);
+  // the label of pg_backup_stop(), and the WAL from the start segment to the stop point
+  snprintf(path, sizeof(path), "%s/backup_label", out);
+  fh = fopen(path, "r");
+  label[0] = '\0';
+  if (fh) label[fread(label, 1, sizeof(label) - 1, fh)] = '\0';
+  if (fh) fclose(fh);
+  if (!strstr(label, "LABEL: dbeetle pgb\n") || !strstr(label, "START WAL LOCATION: 0/3FF000\n")) {
+    printf("FAIL: backup_label is not the server's: %s\n", label);
+    failures++;
+  }
+  failures += check_segment(out, "000000010000000000000003", standin, 3 * SEGMENT, stop);
+  failures += check_segment(out, "000000010000000000000004", standin, 4 * SEGMENT, stop);
+  failures += expect_path(out, "pg_wal/000000010000000000000005", false);
+  if (standin->backups != 1 || standin->slot_streams != 1 || standin->backup_label[0]) {
+    printf("FAIL: backup mode was not started and stopped around a streamed slot\n");
+    failures++;
+  }
+  for (int i = 0; i < 100 && !dropped; i++) {
+    pthread_mutex_lock(&standin->lock);
+    dropped = !standin->physical[0].name[0];
+    pthread_mutex_unlock(&standin->lock);
+    if (!dropped) usleep(10000);
+  }
+  if (!dropped) {
+    printf("FAIL: the temporary slot outlived the backup\n");
+    failures++;
+  }
+
+  // without db.uri the tree must not be in use: here the test itself plays a server running in it
+  snprintf(cfg->db->type, sizeof(cfg->db->type), "%s", DEFAULT_DB_TYPE);
+  snprintf(cfg->db->uri, sizeof(cfg->db->uri), "%s", DEFAULT_DB_URI);
+  snprintf(path, sizeof(path), "%d\n", (int)getpid());
+  failures += write_file(live, "postmaster.pid", (const unsigned char *)path, strlen(path));
+  cwd = open(".", O_RDONLY | O_DIRECTORY);
+  if (cwd < 0 || chdir(live) != 0 || incremental_backup(cfg, live, "pgc", NULL, &err) != INCR_CONFIG_ERROR
+    || !strstr(err->message, "runs in")) {
+    printf("FAIL: a tree with a server running in it was backed up without backup mode\n");
+    failures++;
+  }
+  if (cwd >= 0 && fchdir(cwd) != 0) failures++;
+  if (cwd >= 0) close(cwd);
+  destroy_incr_error(&err);
+
+  destroy_app_config(&cfg);
+  pg_standin_stop(&standin);
+  free(data);
+
+  return failures;
+}
+
+int main(void) {
+  char dir[] = "/tmp/dbeetle_incremental_XXXXXX", cmd[BUF_LEN];
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+
+  failures += test_chain(dir);
+  failures += test_backup_mode(dir);
+
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  if (system(cmd) != 0) failures++;
+
+  if (failures) return 1;
+  printf("Incremental test passed.\n");
+  return 0;
+}
@@ -0,0 +1,199 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/config_parser.h"
+#include "include/pagecache.h"
+#include "include/pipeline.h"
+#include "include/storage.h"
+
+#define OBJECTS (3)
+#define OBJECT_BYTES (5 * 1000 * 1000 + 17)
+#define FILE_PAGES (64)
+#define WARM_PAGES (8)
+
+unsigned char pattern_byte(uint32_t object, size_t offset) {
+  return (unsigned char)((object * 131u + offset * 7u + offset / 4093u) & 0xff);
+}
+
+/* pages of [0, @len) of @fd in the page cache, -1 when unknown */
+long resident_pages(int fd, size_t len, unsigned char *vec) {
+  void *map = mmap(NULL, len, PROT_READ, MAP_SHARED, fd, 0);
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  long count = 0;
+
+  if (map == MAP_FAILED) return -1;
+  if (mincore(map, len, vec) != 0) count = -1;
+  for (size_t i = 0; count >= 0 && i < (len + page - 1) / page; i++) count += vec[i] & 1;
+  munmap(map, len);
+
+  return count;
+}
+
+/* pages the probe found cached stay, those the reader brought in go */
+int test_probe_and_drop(void) {
+  char path[] = "/tmp/dbeetle_pagecache_XXXXXX";
+  size_t page = (size_t)sysconf(_SC_PAGESIZE), len = FILE_PAGES * page;
+  unsigned char *data = malloc(len), vec[FILE_PAGES];
+  PageCache_t cache;
+  int fd = mkstemp(path), failures = 0;
+  long resident;
+
+  init_page_cache(&cache);
+  memset(data, 'p', len);
+  if (fd < 0 || !data || write(fd, data, len) != (ssize_t)len || fsync(fd) != 0
+    || posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED) != 0) {
+    printf("FAIL: cannot set up %s\n", path);
+    failures++;
+  } else if (resident_pages(fd, len, vec) != 0) {
+    printf("note: the page cache keeps pages here, probe not checked\n");
+  } else {
+    // no read-ahead while warming, then as much of it as the backup reads get
+    posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+    if (pread(fd, data, WARM_PAGES * page, 0) != (ssize_t)(WARM_PAGES * page)) failures++;
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (pagecache_probe(&cache, fd, NULL, 0, len) != 0 || cache.pages != FILE_PAGES) {
+      printf("FAIL: probe of %d pages failed\n", FILE_PAGES);
+      failures++;
+    }
+    // read in two halves, each dropped behind itself
+    for (size_t half = 0; half < 2; half++) {
+      if (pread(fd, data, len / 2, (off_t)(half * len / 2)) != (ssize_t)(len / 2)) failures++;
+      pagecache_drop(&cache, NULL, half * len / 2, len / 2);
+    }
+    resident = resident_pages(fd, len, vec);
+    if (resident != WARM_PAGES || !(vec[0] & 1) || !(vec[WARM_PAGES - 1] & 1)) {
+      printf("FAIL: %ld pages cached after the drop, %d were before the probe\n", resident, WARM_PAGES);
+      failures++;
+    }
+  }
+  // without a probe residency is unknown and nothing goes
+  destroy_page_cache(&cache);
+  if (fd >= 0 && pread(fd, data, len, 0) == (ssize_t)len) {
+    pagecache_drop(&cache, NULL, 0, len);
+    if (resident_pages(fd, len, vec) < WARM_PAGES) {
+      printf("FAIL: a drop without a probe evicted pages\n");
+      failures++;
+    }
+  }
+
+  free(data);
+  if (fd >= 0) close(fd);
+  unlink(path);
+
+  return failures;
+}
+
+/* writes OBJECTS objects through the storage pipeline; returns the archive bytes */
+unsigned char *write_archive(const char *dir, const char *name, bool direct_io, bool *o_direct, long *cached,
+  size_t *len) {
+  char path[BUF_LEN];
+  AppConfig_t *cfg;
+  StorageSink_t *sink;
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  Pipeline_t *pipe;
+  unsigned char *bytes = NULL, *chunk = malloc(65536), *vec = NULL;
+  struct stat st;
+  FILE *fh;
+
+  cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1),
+    init_storage_config(dir, "gzip", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 2, DEFAULT_RUNTIME_TMP_DIR));
+  cfg->storage->direct_io = direct_io;
+  sink = init_storage_sink(cfg->storage, name, &storage_err);
+  pipe = sink ? init_storage_pipeline(cfg, sink, &pipe_err) : NULL;
+  if (!pipe || !chunk) {
+    printf("FAIL: storage pipeline: %s\n", storage_err ? storage_err->message : pipe_err ? pipe_err->message : "?");
+    destroy_storage_error(&storage_err), destroy_pipeline_error(&pipe_err);
+    destroy_storage_sink(&sink);
+    destroy_app_config(&cfg);
+    free(chunk);
+
+    return NULL;
+  }
+  *o_direct = sink->o_direct;
+
+  for (uint32_t id = 0; id < OBJECTS; id++) {
+    PipeWriter_t pw;
+
+    init_pipe_writer(&pw, pipe, id);
+    for (size_t offset = 0; offset < OBJECT_BYTES; ) {
+      size_t n = OBJECT_BYTES - offset < 65536 ? OBJECT_BYTES - offset : 65536;
+
+      for (size_t i = 0; i < n; i++) chunk[i] = pattern_byte(id, offset + i);
+      pipe_writer_write(&pw, chunk, n);
+      offset += n;
+    }
+    pipe_writer_close(&pw);
+    storage_sink_name_object(sink, id, id == 0 ? "a" : id == 1 ? "b" : "c");
+  }
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  if (pipeline_finish(pipe, &pipe_err) == PIPELINE_OK && storage_sink_commit(sink, &storage_err) == STORAGE_OK) {
+    if ((fh = fopen(path, "rb")) != NULL) {
+      if (fstat(fileno(fh), &st) == 0 && (vec = malloc((size_t)st.st_size / 4096 + 2)) != NULL) {
+        *cached = resident_pages(fileno(fh), (size_t)st.st_size, vec);
+      }
+      if (vec && (bytes = malloc((size_t)st.st_size + 1))) *len = fread(bytes, 1, (size_t)st.st_size, fh);
+      fclose(fh);
+    }
+    unlink(path);
+  } else {
+    printf("FAIL: archive not completed: %s\n", pipe_err ? pipe_err->message : storage_err ? storage_err->message : "?");
+  }
+
+  destroy_storage_error(&storage_err), destroy_pipeline_error(&pipe_err);
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+  destroy_app_config(&cfg);
+  free(chunk);
+  free(vec);
+
+  return bytes;
+}
+
+int test_direct_archive(void) {
+  char dir[] = "/tmp/dbeetle_direct_XXXXXX";
+  unsigned char *plain, *direct;
+  size_t plain_len = 0, direct_len = 0;
+  bool o_direct_plain = true, o_direct = false;
+  long cached_plain = -1, cached = -1;
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+  plain = write_archive(dir, "plain.dump", false, &o_direct_plain, &cached_plain, &plain_len);
+  direct = write_archive(dir, "direct.dump", true, &o_direct, &cached, &direct_len);
+  if (!plain || !direct || o_direct_plain) {
+    printf("FAIL: archives missing, or O_DIRECT used without direct_io\n");
+    failures++;
+  } else if (plain_len != direct_len || memcmp(plain, direct, plain_len) != 0) {
+    printf("FAIL: direct_io archive (%zu bytes) differs from the buffered one (%zu bytes)\n", direct_len, plain_len);
+    failures++;
+  } else if (cached != 0) {
+    // staged through O_DIRECT or evicted behind the writer, nothing of it is left cached
+    printf("FAIL: %ld pages of the direct_io archive are cached (O_DIRECT %s)\n", cached, o_direct ? "on" : "off");
+    failures++;
+  }
+  if (!o_direct) printf("note: O_DIRECT is refused here, the archive was evicted behind the writer\n");
+  free(plain);
+  free(direct);
+  rmdir(dir);
+
+  return failures;
+}
+
+int main(void) {
+  int failures = 0;
+
+  failures += test_probe_and_drop();
+  failures += test_direct_archive();
+
+  if (failures) return 1;
+  printf("Pagecache test passed.\n");
+  return 0;
+}
@@ -0,0 +1,216 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/config_parser.h"
+#include "include/pipeline.h"
+#include "include/storage.h"
+
+#define PRODUCERS (4)
+#define OBJECT_BYTES (300 * 1000)
+#define BLOCK_SIZE (4096)
+
+typedef struct Collected {
+  unsigned char     *bytes[PRODUCERS];
+  size_t            len[PRODUCERS];
+  int               closed[PRODUCERS];
+  uint64_t          next_seq;
+  int               errors;
+} Collected_t;
+
+typedef struct Producer {
+  Pipeline_t        *pipe;
+  uint32_t          id;
+} Producer_t;
+
+unsigned char pattern_byte(uint32_t object, size_t offset) {
+  return (unsigned char)((object * 31u + offset * 7u) & 0xff);
+}
+
+/* grows each block by a 4 byte length prefix and inverts the payload */
+int invert_stage(void *ctx, PipeBuffer_t *buf, size_t worker_id) {
+  unsigned char *tmp;
+  uint32_t len = (uint32_t)buf->len;
+
+  (void)ctx, (void)worker_id;
+  memcpy(buf->scratch, &len, sizeof(len));
+  for (size_t i = 0; i < buf->len; i++) buf->scratch[sizeof(len) + i] = (unsigned char)~buf->data[i];
+  tmp = buf->data, buf->data = buf->scratch, buf->scratch = tmp;
+  buf->len += sizeof(len);
+
+  return 0;
+}
+
+int collect_sink(void *ctx, const PipeBuffer_t *buf) {
+  Collected_t *out = ctx;
+  uint32_t len;
+  uint32_t id = buf->object_id;
+
+  if (buf->seq != out->next_seq++) out->errors++;
+  memcpy(&len, buf->data, sizeof(len));
+  if (len + sizeof(len) != buf->len || len != buf->raw_len) out->errors++;
+  for (size_t i = 0; i < len; i++) out->bytes[id][out->len[id] + i] = (unsigned char)~buf->data[sizeof(len) + i];
+  out->len[id] += len;
+  if (buf->flags & PIPE_BUF_LAST) out->closed[id]++;
+
+  return 0;
+}
+
+void *produce(void *arg) {
+  Producer_t *p = arg;
+  PipeWriter_t writer;
+  unsigned char chunk[777];
+  size_t offset = 0;
+
+  init_pipe_writer(&writer, p->pipe, p->id);
+  while (offset < OBJECT_BYTES) {
+    size_t n = OBJECT_BYTES - offset < sizeof(chunk) ? OBJECT_BYTES - offset : sizeof(chunk), room;
+    // odd objects are written in place, as a direct COPY reads into the block
+    unsigned char *dst = p->id % 2 ? pipe_writer_reserve(&writer, &room) : chunk;
+
+    if (!dst) break;
+    if (dst != chunk && n > room) n = room;
+    for (size_t i = 0; i < n; i++) dst[i] = pattern_byte(p->id, offset + i);
+    if (dst == chunk) pipe_writer_write(&writer, chunk, n);
+    else pipe_writer_commit(&writer, n);
+    offset += n;
+  }
+  pipe_writer_close(&writer);
+
+  return NULL;
+}
+
+int test_ordered_transform(void) {
+  Pipeline_t *pipe = init_pipeline(BLOCK_SIZE, 8);
+  Collected_t out = {0};
+  Producer_t producers[PRODUCERS];
+  pthread_t threads[PRODUCERS];
+  PipelineError_t *err = NULL;
+  int failures = 0;
+
+  for (int i = 0; i < PRODUCERS; i++) out.bytes[i] = malloc(OBJECT_BYTES);
+  pipeline_add_stage(pipe, "invert", invert_stage, NULL, NULL, 3);
+  pipeline_set_sink(pipe, collect_sink, &out);
+  pipeline_start(pipe);
+
+  for (uint32_t i = 0; i < PRODUCERS; i++) {
+    producers[i].pipe = pipe;
+    producers[i].id = i;
+    pthread_create(&threads[i], NULL, produce, &producers[i]);
+  }
+  for (int i = 0; i < PRODUCERS; i++) pthread_join(threads[i], NULL);
+
+  if (pipeline_finish(pipe, &err) != PIPELINE_OK) {
+    printf("FAIL: pipeline finished with %s\n", err ? err->message : "unknown error");
+    failures++;
+  }
+  if (out.errors) {
+    printf("FAIL: %d out-of-order or malformed blocks\n", out.errors);
+    failures++;
+  }
+  for (uint32_t i = 0; i < PRODUCERS; i++) {
+    if (out.len[i] != OBJECT_BYTES || out.closed[i] != 1) {
+      printf("FAIL: object %u has %zu bytes, closed %d times\n", i, out.len[i], out.closed[i]);
+      failures++;
+      continue;
+    }
+    for (size_t k = 0; k < OBJECT_BYTES; k++) {
+      if (out.bytes[i][k] != pattern_byte(i, k)) {
+        printf("FAIL: object %u differs at byte %zu\n", i, k);
+        failures++;
+        break;
+      }
+    }
+  }
+
+  for (int i = 0; i < PRODUCERS; i++) free(out.bytes[i]);
+  destroy_pipeline_error(&err);
+  destroy_pipeline(&pipe);
+
+  return failures;
+}
+
+int test_storage_output(void) {
+  char dir[] = "/tmp/dbeetle_pipeline_XXXXXX";
+  char archive[BUF_LEN];
+  AppConfig_t *cfg;
+  StorageSink_t *sink;
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  Pipeline_t *pipe;
+  Producer_t producer;
+  ArchiveReader_t *reader;
+  const ArchiveFrame_t *last;
+  struct stat st;
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+  cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1),
+    init_storage_config(dir, "none", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 2, DEFAULT_RUNTIME_TMP_DIR));
+
+  sink = init_storage_sink(cfg->storage, "test.dump", &storage_err);
+  pipe = sink ? init_storage_pipeline(cfg, sink, &pipe_err) : NULL;
+  if (!pipe) {
+    printf("FAIL: storage pipeline: %s\n", storage_err ? storage_err->message : pipe_err ? pipe_err->message : "?");
+    destroy_storage_error(&storage_err), destroy_pipeline_error(&pipe_err);
+    destroy_storage_sink(&sink);
+    destroy_app_config(&cfg);
+
+    return 1;
+  }
+
+  producer.pipe = pipe;
+  producer.id = 0;
+  produce(&producer);
+  if (pipeline_finish(pipe, &pipe_err) != PIPELINE_OK || storage_sink_commit(sink, &storage_err) != STORAGE_OK) {
+    printf("FAIL: could not complete archive\n");
+    failures++;
+  }
+
+  snprintf(archive, sizeof(archive), "%s/test.dump", dir);
+  // uncompressed, the data part is the object itself, with the frame index right behind it
+  reader = init_archive_reader(cfg->storage, "test.dump", NULL);
+  last = reader && reader->index->frame_count ? &reader->index->frames[reader->index->frame_count - 1] : NULL;
+  if (stat(archive, &st) != 0 || !last || last->offset + last->stored_len != OBJECT_BYTES
+    || (uint64_t)st.st_size <= OBJECT_BYTES) {
+    printf("FAIL: archive %s missing or wrong size\n", archive);
+    failures++;
+  }
+  destroy_archive_reader(&reader);
+  unlink(archive);
+
+  // backup names stay inside output_path
+  for (size_t i = 0; i < 3; i++) {
+    const char *names[] = { "../escape.dump", "sub/x.dump", "" };
+    StorageSink_t *bad = init_storage_sink(cfg->storage, names[i], &storage_err);
+
+    if (bad || !storage_err || storage_err->code != STORAGE_CONFIG_ERROR) {
+      printf("FAIL: backup name \"%s\" accepted\n", names[i]);
+      failures++;
+    }
+    destroy_storage_sink(&bad);
+    destroy_storage_error(&storage_err);
+  }
+  rmdir(dir);
+
+  destroy_storage_error(&storage_err), destroy_pipeline_error(&pipe_err);
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+  destroy_app_config(&cfg);
+
+  return failures;
+}
+
+int main(void) {
+  int failures = 0;
+
+  failures += test_ordered_transform();
+  failures += test_storage_output();
+
+  if (failures) return 1;
+  printf("Pipeline test passed.\n");
+  return 0;
+}
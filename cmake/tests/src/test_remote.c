@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "include/config_parser.h"
+#include "include/remote.h"
+#include "include/storage.h"
+#include "remote_standin.h"
+
+#define PAYLOAD_BYTES ((5 << 20) + 1234)
+#define TEST_PART_SIZE (256 << 10)
+
+unsigned char *read_file(const char *path, size_t *len) {
+  FILE *fh = fopen(path, "rb");
+  unsigned char *data = NULL;
+
+  *len = 0;
+  if (fh && fseek(fh, 0, SEEK_END) == 0) {
+    long size = ftell(fh);
+
+    data = malloc(size > 0 ? (size_t)size : 1);
+    rewind(fh);
+    if (data && size > 0 && fread(data, 1, (size_t)size, fh) == (size_t)size) *len = (size_t)size;
+  }
+  if (fh) fclose(fh);
+
+  return data;
+}
+
+/* removes every file in @dir, returning how many there were */
+size_t clear_dir(const char *dir) {
+  char path[BUF_LEN];
+  struct dirent *entry;
+  DIR *d = opendir(dir);
+  size_t count = 0;
+
+  while (d && (entry = readdir(d)) != NULL) {
+    if (entry->d_name[0] == '.') continue;
+    snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+    unlink(path);
+    count++;
+  }
+  if (d) closedir(d);
+
+  return count;
+}
+
+int test_multipart(Standin_t *s, const char *target, const char *root) {
+  char path[BUF_LEN];
+  unsigned char *payload = malloc(PAYLOAD_BYTES), *object;
+  RemoteError_t *err = NULL;
+  RemoteUploader_t *up = init_remote_uploader(target, "direct.bin", 4, TEST_PART_SIZE, &err);
+  size_t object_len = 0, expected_parts = (PAYLOAD_BYTES + TEST_PART_SIZE - 1) / TEST_PART_SIZE;
+  int failures = 0;
+
+  for (size_t i = 0; i < PAYLOAD_BYTES; i++) payload[i] = (unsigned char)(i * 2654435761u >> 13);
+  if (!up) {
+    printf("FAIL: uploader: %s\n", err ? err->message : "?");
+    destroy_remote_error(&err);
+    free(payload);
+
+    return 1;
+  }
+  // odd write sizes so writes straddle part boundaries
+  for (size_t pos = 0; pos < PAYLOAD_BYTES; pos += 77777) {
+    size_t n = PAYLOAD_BYTES - pos < 77777 ? PAYLOAD_BYTES - pos : 77777;
+
+    if (remote_uploader_write(up, payload + pos, n) != 0) break;
+  }
+  if (remote_uploader_finish(up, &err) != REMOTE_OK) {
+    printf("FAIL: upload not completed: %s\n", err ? err->message : "?");
+    failures++;
+  }
+
+  snprintf(path, sizeof(path), "%s/bucket_direct.bin", root);
+  object = read_file(path, &object_len);
+  if (!object || object_len != PAYLOAD_BYTES || memcmp(object, payload, PAYLOAD_BYTES) != 0) {
+    printf("FAIL: remote object differs (%zu of %d bytes)\n", object_len, PAYLOAD_BYTES);
+    failures++;
+  }
+  if (s->parts != expected_parts || up->bytes_sent != PAYLOAD_BYTES) {
+    printf("FAIL: %zu parts and %lu bytes sent, expected %zu parts\n", s->parts,
+      (unsigned long)up->bytes_sent, expected_parts);
+    failures++;
+  }
+  if (up->retries != s->failures_injected || s->failures_injected == 0) {
+    printf("FAIL: %lu retries for %zu injected failures\n", (unsigned long)up->retries, s->failures_injected);
+    failures++;
+  }
+  if (s->max_inflight < 2) {
+    printf("FAIL: parts were not uploaded in parallel\n");
+    failures++;
+  }
+
+  destroy_remote_uploader(&up);
+  destroy_remote_error(&err);
+  unlink(path);
+  free(object);
+  free(payload);
+
+  return failures;
+}
+
+int test_abort(const char *target, const char *root) {
+  unsigned char part[TEST_PART_SIZE] = { 0 };
+  RemoteError_t *err = NULL;
+  RemoteUploader_t *up = init_remote_uploader(target, "aborted.bin", 2, TEST_PART_SIZE, &err);
+  int failures = 0;
+
+  if (!up) {
+    printf("FAIL: uploader: %s\n", err ? err->message : "?");
+    destroy_remote_error(&err);
+
+    return 1;
+  }
+  for (int i = 0; i < 3; i++) remote_uploader_write(up, part, sizeof(part));
+  // never finished, so destroying it aborts the upload and the parts go away
+  destroy_remote_uploader(&up);
+  if (clear_dir(root) != 0) {
+    printf("FAIL: aborted upload left parts behind\n");
+    failures++;
+  }
+
+  up = init_remote_uploader("http://127.0.0.1:1/bucket", "refused.bin", 2, TEST_PART_SIZE, &err);
+  if (up || !err || err->code != REMOTE_HTTP_ERROR) {
+    printf("FAIL: unreachable remote accepted\n");
+    failures++;
+  }
+
+  destroy_remote_uploader(&up);
+  destroy_remote_error(&err);
+
+  return failures;
+}
+
+int test_archive(const char *target, const char *dir, const char *root) {
+  char remote_path[BUF_LEN];
+  unsigned char *payload = malloc(PAYLOAD_BYTES), *local = NULL, *object = NULL;
+  size_t local_len = 0, object_len = 0;
+  int failures = 0;
+
+  for (size_t i = 0; i < PAYLOAD_BYTES; i++) payload[i] = (unsigned char)("insert into t values (42);\n"[i % 27]);
+
+  AppConfig_t *cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1),
+    init_storage_config(dir, "gzip:1", DEFAULT_STORAGE_ENC_KEY_PATH, target),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 2, DEFAULT_RUNTIME_TMP_DIR));
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  StorageSink_t *sink;
+  Pipeline_t *pipe;
+  PipeWriter_t writer;
+
+  cfg->storage->remote_connections = 3;
+  sink = init_storage_sink(cfg->storage, "remote.dump", &storage_err);
+  pipe = sink ? init_storage_pipeline(cfg, sink, &pipe_err) : NULL;
+  if (!pipe) {
+    printf("FAIL: remote pipeline: %s\n", storage_err ? storage_err->message : pipe_err ? pipe_err->message : "?");
+    failures++;
+  } else {
+    init_pipe_writer(&writer, pipe, 0);
+    pipe_writer_write(&writer, payload, PAYLOAD_BYTES);
+    pipe_writer_close(&writer);
+    if (pipeline_finish(pipe, &pipe_err) != PIPELINE_OK || storage_sink_commit(sink, &storage_err) != STORAGE_OK) {
+      printf("FAIL: archive not committed: %s\n", storage_err ? storage_err->message : "?");
+      failures++;
+    }
+    local = read_file(sink->path, &local_len);
+    unlink(sink->path);
+  }
+
+  snprintf(remote_path, sizeof(remote_path), "%s/bucket_remote.dump", root);
+  object = read_file(remote_path, &object_len);
+  if (!local || local_len == 0 || object_len != local_len || memcmp(object, local, local_len) != 0) {
+    printf("FAIL: remote copy differs from the local archive (%zu vs %zu bytes)\n", object_len, local_len);
+    failures++;
+  }
+
+  destroy_storage_error(&storage_err), destroy_pipeline_error(&pipe_err);
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+  destroy_app_config(&cfg);
+  unlink(remote_path);
+  free(local);
+  free(object);
+  free(payload);
+
+  return failures;
+}
+
+int main(void) {
+#ifndef DBEETLE_HAVE_CURL
+  printf("Built without libcurl, skipping remote test.\n");
+  return 0;
+#else
+  char dir[] = "/tmp/dbeetle_remote_XXXXXX", root[BUF_LEN], target[BUF_LEN_S];
+  Standin_t *s;
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+  snprintf(root, sizeof(root), "%s/remote", dir);
+  if (mkdir(root, 0750) != 0) return 1;
+
+  s = standin_start(root, 0, 3, 20, false);
+  if (!s) {
+    printf("FAIL: stand-in did not start\n");
+    return 1;
+  }
+  snprintf(target, sizeof(target), "http://127.0.0.1:%u/bucket", s->port);
+
+  failures += test_multipart(s, target, root);
+  failures += test_abort(target, root);
+  failures += test_archive(target, dir, root);
+
+  standin_stop(&s);
+  clear_dir(root);
+  rmdir(root);
+  rmdir(dir);
+
+  if (failures) return 1;
+  printf("Remote test passed.\n");
+  return 0;
+#endif
+}
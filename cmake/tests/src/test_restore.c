@@ -0,0 +1,378 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/chunkstore.h"
+#include "include/config_parser.h"
+#include "include/restore.h"
+#include "include/storage.h"
+#include "remote_standin.h"
+
+#define TABLE_COUNT (24)
+#define WRITE_STEP (40 * 1024 + 3)
+
+static const char post_data[] =
+  "-- post-data of the test database\n"
+  "\n"
+  "ALTER TABLE public.t0 ADD CONSTRAINT t0_pkey PRIMARY KEY (id);\n"
+  "ALTER TABLE public.t1 ADD CONSTRAINT t1_pkey PRIMARY KEY (id);\n"
+  "CREATE INDEX t2_name_idx ON public.t2 USING btree (name);\n"
+  "CREATE UNIQUE INDEX t3_code_key\n"
+  "  ON public.t3 (code);\n"
+  "ALTER TABLE ONLY public.t2\n"
+  "  ADD CONSTRAINT t2_t0_fkey FOREIGN KEY (t0_id) REFERENCES public.t0(id);\n"
+  "ALTER TABLE public.t3 ADD CONSTRAINT t3_t1_fkey foreign key (t1_id) REFERENCES public.t1(id) NOT VALID;\n"
+  "ALTER TABLE public.t3 VALIDATE CONSTRAINT t3_t1_fkey;\n";
+
+#define INDEX_STEPS (4)
+#define CONSTRAINT_STEPS (3)
+
+typedef struct Payloads {
+  char              names[TABLE_COUNT][BUF_LEN_XS];
+  unsigned char     *data[TABLE_COUNT];
+  size_t            sizes[TABLE_COUNT];
+} Payloads_t;
+
+/* what the callbacks saw, checked once the restore is over */
+typedef struct Observed {
+  const Payloads_t  *payloads;
+  int               loads[TABLE_COUNT];
+  size_t            loads_done;
+  size_t            index_done;
+  size_t            steps_seen;
+  size_t            out_of_order;
+  size_t            mismatches;
+  const char        *fail_table;
+  pthread_mutex_t   lock;
+} Observed_t;
+
+typedef struct Buffer {
+  unsigned char     *data;
+  size_t            len;
+  size_t            capacity;
+} Buffer_t;
+
+void fill_table(unsigned char *dst, size_t len, size_t id) {
+  for (size_t i = 0; i < len; i++) dst[i] = (unsigned char)((i * 2654435761u >> 11) + id);
+}
+
+int collect(void *ctx, const unsigned char *data, size_t len) {
+  Buffer_t *buf = ctx;
+
+  if (buf->len + len > buf->capacity) return -1;
+  memcpy(buf->data + buf->len, data, len);
+  buf->len += len;
+
+  return 0;
+}
+
+int load_table(ArchiveReader_t *reader, const ArchiveObject_t *obj, size_t worker_id, void *ctx) {
+  Observed_t *seen = ctx;
+  ArchiveError_t *err = NULL;
+  Buffer_t buf = { NULL, 0, 0 };
+  int table = atoi(obj->name + strlen("public.t")), status = 0;
+
+  (void)worker_id;
+  if (table < 0 || table >= TABLE_COUNT) return -1;
+  buf.capacity = seen->payloads->sizes[table];
+  buf.data = malloc(buf.capacity + 1);
+  if (archive_read_object(reader, obj, collect, &buf, &err) != ARCHIVE_OK || buf.len != buf.capacity
+    || memcmp(buf.data, seen->payloads->data[table], buf.len) != 0) {
+    status = -1;
+  }
+  if (seen->fail_table && strcmp(obj->name, seen->fail_table) == 0) status = -1;
+
+  pthread_mutex_lock(&seen->lock);
+  seen->loads[table]++;
+  seen->loads_done++;
+  if (status != 0 && !seen->fail_table) seen->mismatches++;
+  pthread_mutex_unlock(&seen->lock);
+  destroy_archive_error(&err);
+  free(buf.data);
+
+  return status;
+}
+
+int run_step(const RestoreStep_t *step, size_t worker_id, void *ctx) {
+  Observed_t *seen = ctx;
+
+  (void)worker_id;
+  pthread_mutex_lock(&seen->lock);
+  // every table is in before the first index, every index before the first foreign key
+  if (seen->loads_done != TABLE_COUNT) seen->out_of_order++;
+  if (step->kind == RESTORE_STEP_CONSTRAINT && seen->index_done != INDEX_STEPS) seen->out_of_order++;
+  if (step->kind == RESTORE_STEP_INDEX) seen->index_done++;
+  if (step->sql[strlen(step->sql) - 1] != ';') seen->mismatches++;
+  seen->steps_seen++;
+  pthread_mutex_unlock(&seen->lock);
+
+  return 0;
+}
+
+int write_archive(AppConfig_t *cfg, const char *name, const Payloads_t *p) {
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  StorageSink_t *sink = init_storage_sink(cfg->storage, name, &storage_err);
+  Pipeline_t *pipe = sink ? init_storage_pipeline(cfg, sink, &pipe_err) : NULL;
+  PipeWriter_t writers[TABLE_COUNT + 1];
+  int failed = 1;
+
+  if (pipe) {
+    for (uint32_t i = 0; i < TABLE_COUNT; i++) {
+      init_pipe_writer(&writers[i], pipe, i + 1);
+      storage_sink_name_object(sink, i + 1, p->names[i]);
+      for (size_t pos = 0; pos < p->sizes[i]; pos += WRITE_STEP) {
+        pipe_writer_write(&writers[i], p->data[i] + pos, p->sizes[i] - pos < WRITE_STEP ? p->sizes[i] - pos : WRITE_STEP);
+      }
+      pipe_writer_close(&writers[i]);
+    }
+    init_pipe_writer(&writers[TABLE_COUNT], pipe, TABLE_COUNT + 1);
+    storage_sink_name_object(sink, TABLE_COUNT + 1, RESTORE_POST_DATA_OBJECT);
+    pipe_writer_write(&writers[TABLE_COUNT], post_data, strlen(post_data));
+    pipe_writer_close(&writers[TABLE_COUNT]);
+    failed = pipeline_finish(pipe, &pipe_err) != PIPELINE_OK || storage_sink_commit(sink, &storage_err) != STORAGE_OK;
+  }
+  if (failed) printf("FAIL: %s: %s\n", name, storage_err ? storage_err->message : pipe_err ? pipe_err->message : "?");
+
+  destroy_storage_error(&storage_err);
+  destroy_pipeline_error(&pipe_err);
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+
+  return failed;
+}
+
+int check_restore(AppConfig_t *cfg, const char *name, const Payloads_t *p, const char *fail_table) {
+  Observed_t seen;
+  RestoreError_t *err = NULL;
+  RestoreEngine_t *engine = init_restore_engine(cfg, name, &err);
+  RestoreStatus_t status;
+  int failures = 0;
+
+  memset(&seen, 0, sizeof(seen));
+  seen.payloads = p;
+  seen.fail_table = fail_table;
+  pthread_mutex_init(&seen.lock, NULL);
+  if (!engine) {
+    printf("FAIL: %s does not open: %s\n", name, err ? err->message : "?");
+    destroy_restore_error(&err);
+    pthread_mutex_destroy(&seen.lock);
+
+    return 1;
+  }
+
+  status = restore_run(engine, load_table, run_step, &seen, &err);
+  if (fail_table) {
+    // nothing is indexed on top of a partial load
+    if (status != RESTORE_LOAD_ERROR || !err || !strstr(err->message, fail_table) || seen.steps_seen != 0) {
+      printf("FAIL: failed load of %s reported as %d, %zu statement(s) ran\n", fail_table, status, seen.steps_seen);
+      failures++;
+    }
+  } else if (status != RESTORE_OK || seen.mismatches || seen.out_of_order
+    || seen.steps_seen != INDEX_STEPS + CONSTRAINT_STEPS || engine->tables_loaded != TABLE_COUNT) {
+    printf("FAIL: %s restore: %s, %zu mismatch(es), %zu out of order, %zu statement(s)\n", name,
+      err ? err->message : "ok", seen.mismatches, seen.out_of_order, seen.steps_seen);
+    failures++;
+  }
+  for (size_t i = 0; i < TABLE_COUNT; i++) {
+    if (seen.loads[i] != 1) {
+      printf("FAIL: %s loaded %d times\n", p->names[i], seen.loads[i]);
+      failures++;
+      break;
+    }
+  }
+
+  destroy_restore_error(&err);
+  destroy_restore_engine(&engine);
+  pthread_mutex_destroy(&seen.lock);
+
+  return failures;
+}
+
+int test_post_data_parser(AppConfig_t *cfg, const char *name) {
+  RestoreError_t *err = NULL;
+  RestoreEngine_t *engine = init_restore_engine(cfg, name, &err);
+  static const char cut[] = "CREATE INDEX a ON t (a);\nCREATE INDEX b\n  ON t (b)\n";
+  size_t constraints = 0;
+  int failures = 0;
+
+  if (!engine) {
+    destroy_restore_error(&err);
+
+    return 1;
+  }
+  if (restore_parse_post_data(engine, post_data, strlen(post_data)) != 0
+    || engine->step_count != INDEX_STEPS + CONSTRAINT_STEPS
+    || strcmp(engine->steps[3].sql, "CREATE UNIQUE INDEX t3_code_key\n  ON public.t3 (code);") != 0) {
+    printf("FAIL: post-data split into %zu statement(s)\n", engine->step_count);
+    failures++;
+  }
+  for (size_t i = 0; i < engine->step_count; i++) constraints += engine->steps[i].kind == RESTORE_STEP_CONSTRAINT;
+  if (constraints != CONSTRAINT_STEPS) {
+    printf("FAIL: %zu foreign key statement(s), expected %d\n", constraints, CONSTRAINT_STEPS);
+    failures++;
+  }
+  if (restore_parse_post_data(engine, cut, strlen(cut)) == 0) {
+    printf("FAIL: statement without its ';' accepted\n");
+    failures++;
+  }
+  destroy_restore_engine(&engine);
+
+  return failures;
+}
+
+/* table @table of backup @name restored on its own, as `dbeetle restore --table` does */
+int check_table(AppConfig_t *cfg, const char *name, const Payloads_t *p, size_t table, const char *path) {
+  RestoreError_t *err = NULL;
+  ArchiveError_t *archive_err = NULL;
+  RestoreEngine_t *engine = init_restore_engine(cfg, name, &err);
+  ArchiveObject_t *obj = engine ? archive_find_object(engine->reader, p->names[table]) : NULL;
+  unsigned char *data = malloc(p->sizes[table] + 1);
+  int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600), failures = 0;
+
+  if (!obj || fd < 0 || archive_restore_object(engine->reader, obj, fd, &archive_err) != ARCHIVE_OK
+    || pread(fd, data, p->sizes[table] + 1, 0) != (ssize_t)p->sizes[table]
+    || memcmp(data, p->data[table], p->sizes[table]) != 0) {
+    printf("FAIL: %s of %s: %s\n", p->names[table], name,
+      err ? err->message : archive_err ? archive_err->message : "wrong bytes");
+    failures++;
+  }
+
+  if (fd >= 0) close(fd);
+  unlink(path);
+  free(data);
+  destroy_archive_error(&archive_err);
+  destroy_restore_error(&err);
+  destroy_restore_engine(&engine);
+
+  return failures;
+}
+
+int test_dedup_restore(AppConfig_t *cfg, const char *dir, const Payloads_t *p) {
+  char path[BUF_LEN];
+  RestoreError_t *err = NULL;
+  RestoreEngine_t *engine;
+  ArchiveError_t *archive_err = NULL;
+  Buffer_t buf = { NULL, 0, 0 };
+  struct stat st;
+  int failures = 0;
+
+  // the second backup is all chunks of the first: both read back table by table
+  cfg->storage->dedup_enabled = 1;
+  failures += write_archive(cfg, "dedup1.dump", p);
+  failures += write_archive(cfg, "dedup2.dump", p);
+  if (failures) return failures;
+  failures += check_restore(cfg, "dedup1.dump", p, NULL);
+  failures += check_restore(cfg, "dedup2.dump", p, NULL);
+  snprintf(path, sizeof(path), "%s/table.out", dir);
+  failures += check_table(cfg, "dedup2.dump", p, 7, path);
+  failures += check_table(cfg, "dedup2.dump", p, 5, path);
+
+  // a lost chunk is named, not restored as a hole
+  engine = init_restore_engine(cfg, "dedup1.dump", &err);
+  if (engine) {
+    char hex[2 * CHUNK_ID_LEN + 1];
+
+    chunk_id_hex(engine->reader->chunk_ids, hex);
+    snprintf(path, sizeof(path), "%s/%s/%.2s/%s", dir, CHUNKSTORE_DIR, hex, hex + 2);
+    buf.capacity = p->sizes[0];
+    buf.data = malloc(buf.capacity + 1);
+    if (stat(path, &st) != 0 || unlink(path) != 0
+      || archive_read_object(engine->reader, archive_find_object(engine->reader, p->names[0]), collect, &buf,
+        &archive_err) != ARCHIVE_FORMAT_ERROR || !strstr(archive_err->message, hex)) {
+      printf("FAIL: lost chunk %s reported as: %s\n", hex, archive_err ? archive_err->message : "ok");
+      failures++;
+    }
+  } else {
+    printf("FAIL: dedup1.dump does not open: %s\n", err ? err->message : "?");
+    failures++;
+  }
+  free(buf.data);
+  destroy_archive_error(&archive_err);
+  destroy_restore_error(&err);
+  destroy_restore_engine(&engine);
+  cfg->storage->dedup_enabled = 0;
+
+  return failures;
+}
+
+int test_remote_restore(AppConfig_t *cfg, const char *dir, const Payloads_t *p) {
+  char target[BUF_LEN_S], path[BUF_LEN];
+  RestoreError_t *err = NULL;
+  RestoreEngine_t *engine;
+  Standin_t *s = standin_start(dir, 0, 3, 0, false);
+  int failures = 0;
+
+  if (!s) {
+    printf("FAIL: stand-in did not start\n");
+
+    return 1;
+  }
+  snprintf(target, sizeof(target), "http://127.0.0.1:%u/bucket", s->port);
+  snprintf(cfg->storage->remote_target, sizeof(cfg->storage->remote_target), "%s", target);
+  snprintf(cfg->storage->compression, sizeof(cfg->storage->compression), "none");
+  failures += write_archive(cfg, "remote.dump", p);
+
+  // only the remote copy is left: it is fetched in ranges, some of them failing once
+  snprintf(path, sizeof(path), "%s/remote.dump", dir);
+  unlink(path);
+  failures += check_restore(cfg, "remote.dump", p, NULL);
+  if (s->ranges < 2 || s->failures_injected == 0) {
+    printf("FAIL: fetched in %zu range(s), %zu failure(s) injected\n", s->ranges, s->failures_injected);
+    failures++;
+  }
+  snprintf(path, sizeof(path), "%s/remote.dump%s", dir, RESTORE_FETCH_SUFFIX);
+  if (access(path, F_OK) == 0) {
+    printf("FAIL: fetched copy left behind\n");
+    failures++;
+  }
+
+  engine = init_restore_engine(cfg, "missing.dump", &err);
+  if (engine || !err || err->code != RESTORE_FETCH_ERROR) {
+    printf("FAIL: missing remote archive reported as %d\n", err ? (int)err->code : -1);
+    failures++;
+  }
+  destroy_restore_engine(&engine);
+  destroy_restore_error(&err);
+  standin_stop(&s);
+
+  return failures;
+}
+
+int main(void) {
+  char dir[] = "/tmp/dbeetle_restore_XXXXXX", cmd[BUF_LEN];
+  Payloads_t p;
+  AppConfig_t *cfg;
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+  for (size_t i = 0; i < TABLE_COUNT; i++) {
+    snprintf(p.names[i], sizeof(p.names[i]), "public.t%zu", i);
+    // a few big tables among many small ones, one of them empty
+    p.sizes[i] = i % 7 == 0 ? (3 << 20) + i : i == 5 ? 0 : (i * 37 * 1024) + 11;
+    p.data[i] = malloc(p.sizes[i] + 1);
+    fill_table(p.data[i], p.sizes[i], i);
+  }
+  cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1),
+    init_storage_config(dir, "gzip:1", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 4, DEFAULT_RUNTIME_TMP_DIR));
+
+  failures += write_archive(cfg, "local.dump", &p);
+  failures += check_restore(cfg, "local.dump", &p, NULL);
+  failures += check_restore(cfg, "local.dump", &p, "public.t7");
+  failures += test_post_data_parser(cfg, "local.dump");
+  failures += test_dedup_restore(cfg, dir, &p);
+  failures += test_remote_restore(cfg, dir, &p);
+
+  for (size_t i = 0; i < TABLE_COUNT; i++) free(p.data[i]);
+  destroy_app_config(&cfg);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  if (system(cmd) != 0) failures++;
+
+  if (failures) return 1;
+  printf("Restore test passed.\n");
+  return 0;
+}
@@ -0,0 +1,317 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sqlite3.h>
+#include "include/archive.h"
+#include "include/config_parser.h"
+#include "include/sqlitedump.h"
+
+#define ACCOUNTS (100)
+#define BALANCE (1000)
+#define FILLER_ROWS (3000)
+#define ATTEMPTS (5)
+
+/* commits transfers and log rows into a database until told to stop */
+typedef struct Writer {
+  char              path[BUF_LEN_S];
+  int               stop;
+  uint64_t          commits;
+  int               failed;
+  pthread_t         thread;
+} Writer_t;
+
+int exec_sql(sqlite3 *db, const char *sql) {
+  char *message = NULL;
+
+  if (sqlite3_exec(db, sql, NULL, NULL, &message) == SQLITE_OK) return 0;
+  printf("FAIL: %s: %s\n", sql, message ? message : "?");
+  sqlite3_free(message);
+
+  return -1;
+}
+
+int64_t query_int(sqlite3 *db, const char *sql) {
+  sqlite3_stmt *stmt = NULL;
+  int64_t value = -1;
+
+  if (sqlite3_prepare_v2(db, sql, -1, &stmt, NULL) == SQLITE_OK && sqlite3_step(stmt) == SQLITE_ROW) {
+    value = sqlite3_column_int64(stmt, 0);
+  }
+  sqlite3_finalize(stmt);
+
+  return value;
+}
+
+void *writer_main(void *arg) {
+  Writer_t *w = arg;
+  sqlite3 *db = NULL;
+  int failed = sqlite3_open(w->path, &db) != SQLITE_OK;
+
+  if (failed) __atomic_store_n(&w->failed, failed, __ATOMIC_RELAXED);
+  sqlite3_busy_timeout(db, 10000);
+  while (!failed && !__atomic_load_n(&w->stop, __ATOMIC_RELAXED)) {
+    // every transaction keeps the total balance and the log in step with meta.n
+    if (exec_sql(db, "BEGIN IMMEDIATE; UPDATE meta SET n = n + 1; "
+      "INSERT INTO log (n, pad) SELECT n, randomblob(200) FROM meta; "
+      "UPDATE acct SET bal = bal - 7 WHERE id = (SELECT n * 37 % 100 FROM meta); "
+      "UPDATE acct SET bal = bal + 7 WHERE id = (SELECT n * 61 % 100 FROM meta); "
+      "UPDATE filler SET pad = randomblob(300) WHERE id = (SELECT n * 613 % 3000 FROM meta); COMMIT;") != 0) {
+      failed = 1;
+      __atomic_store_n(&w->failed, failed, __ATOMIC_RELAXED);
+    } else {
+      __atomic_add_fetch(&w->commits, 1, __ATOMIC_RELAXED);
+    }
+  }
+  sqlite3_close(db);
+
+  return NULL;
+}
+
+int create_database(const char *path, const char *journal_mode) {
+  char sql[BUF_LEN];
+  sqlite3 *db = NULL;
+  int status;
+
+  unlink(path);
+  if (sqlite3_open(path, &db) != SQLITE_OK) return -1;
+  snprintf(sql, sizeof(sql), "PRAGMA page_size = 1024; PRAGMA journal_mode = %s; PRAGMA synchronous = OFF; "
+    "PRAGMA wal_autocheckpoint = 64; "
+    "CREATE TABLE acct (id INTEGER PRIMARY KEY, bal INTEGER); CREATE TABLE meta (n INTEGER); "
+    "CREATE TABLE log (n INTEGER PRIMARY KEY, pad BLOB); CREATE TABLE filler (id INTEGER PRIMARY KEY, pad BLOB); "
+    "INSERT INTO meta VALUES (0); "
+    "WITH RECURSIVE k(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM k WHERE i + 1 < %d) "
+    "INSERT INTO acct SELECT i, %d FROM k; "
+    "WITH RECURSIVE k(i) AS (SELECT 0 UNION ALL SELECT i + 1 FROM k WHERE i + 1 < %d) "
+    "INSERT INTO filler SELECT i, randomblob(300) FROM k;", journal_mode, ACCOUNTS, BALANCE, FILLER_ROWS);
+  status = exec_sql(db, sql);
+  sqlite3_close(db);
+
+  return status;
+}
+
+/* sqlitedump_backup() by hand, to read the dump's counters */
+int backup(AppConfig_t *cfg, const char *name, uint64_t *recopied) {
+  SqliteDumpError_t *err = NULL;
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  SqliteDump_t *dump = init_sqlitedump(cfg, &err);
+  StorageSink_t *sink = dump ? init_storage_sink(cfg->storage, name, &storage_err) : NULL;
+  Pipeline_t *pipe = sink ? init_storage_pipeline(cfg, sink, &pipe_err) : NULL;
+  PipeWriter_t writer;
+  DriverStream_t out;
+  SqliteDumpStatus_t copied = SQLITEDUMP_DUMP_ERROR;
+  int status = -1;
+
+  if (pipe && storage_sink_name_object(sink, 1, SQLITEDUMP_OBJECT) == 0) {
+    init_pipe_writer(&writer, pipe, 1);
+    driver_pipe_stream(&out, &writer);
+    copied = sqlitedump_run(dump, &out, &err);
+    if (pipe_writer_close(&writer) != PIPELINE_OK) copied = SQLITEDUMP_DUMP_ERROR;
+  }
+  if (copied == SQLITEDUMP_OK && pipeline_finish(pipe, &pipe_err) == PIPELINE_OK
+    && storage_sink_commit(sink, &storage_err) == STORAGE_OK) {
+    *recopied = dump->pages_recopied;
+    status = 0;
+  } else {
+    printf("FAIL: backup of %s: %s\n", cfg->db->uri,
+      err ? err->message : storage_err ? storage_err->message : pipe_err ? pipe_err->message : "?");
+    if (pipe) pipeline_finish(pipe, NULL);
+  }
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+  destroy_storage_error(&storage_err);
+  destroy_pipeline_error(&pipe_err);
+  destroy_sqlitedump_error(&err);
+  destroy_sqlitedump(&dump);
+
+  return status;
+}
+
+/* restores archive @name to @path and opens it with SQLite: it must check out and hold its invariants */
+int check_restore(AppConfig_t *cfg, const char *name, const char *path, int64_t *commits) {
+  ArchiveError_t *err = NULL;
+  ArchiveReader_t *reader = init_archive_reader(cfg->storage, name, &err);
+  ArchiveObject_t *obj = reader ? archive_find_object(reader, SQLITEDUMP_OBJECT) : NULL;
+  sqlite3 *db = NULL;
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640), failures = 0;
+  char *check = NULL;
+  sqlite3_stmt *stmt = NULL;
+
+  if (!obj || fd < 0 || sqlitedump_restore(reader, obj, fd, &err) != ARCHIVE_OK) {
+    printf("FAIL: cannot restore %s: %s\n", name, err ? err->message : "no database object");
+    failures++;
+  }
+  if (fd >= 0) close(fd);
+  destroy_archive_error(&err);
+  destroy_archive_reader(&reader);
+  if (failures) return failures;
+
+  if (sqlite3_open_v2(path, &db, SQLITE_OPEN_READONLY, NULL) != SQLITE_OK
+    || sqlite3_prepare_v2(db, "PRAGMA integrity_check", -1, &stmt, NULL) != SQLITE_OK
+    || sqlite3_step(stmt) != SQLITE_ROW || !(check = (char *)sqlite3_column_text(stmt, 0)) || strcmp(check, "ok") != 0) {
+    printf("FAIL: restored %s does not check out: %s\n", name, check ? check : sqlite3_errmsg(db));
+    failures++;
+  }
+  sqlite3_finalize(stmt);
+  *commits = query_int(db, "SELECT n FROM meta");
+  if (!failures && (query_int(db, "SELECT sum(bal) FROM acct") != ACCOUNTS * BALANCE
+    || query_int(db, "SELECT count(*) FROM log") != *commits || query_int(db, "SELECT count(*) FROM filler") != FILLER_ROWS)) {
+    printf("FAIL: restored %s is torn at %lld commits\n", name, (long long)*commits);
+    failures++;
+  }
+  sqlite3_close(db);
+
+  return failures;
+}
+
+/* backs up a database under a busy writer: the copy is a commit, and pages changed under it were copied again */
+int test_live_backup(AppConfig_t *cfg, const char *dir, const char *journal_mode) {
+  Writer_t w;
+  char restored[BUF_LEN + 16], name[BUF_LEN_S];
+  uint64_t recopied = 0, before = 0, during = 0;
+  int64_t commits = 0;
+  int failures = 0, attempt;
+
+  memset(&w, 0, sizeof(w));
+  snprintf(w.path, sizeof(w.path), "%s/%s.db", dir, journal_mode);
+  snprintf(restored, sizeof(restored), "%s/%s.restored.db", dir, journal_mode);
+  snprintf(cfg->db->uri, sizeof(cfg->db->uri), "%s", w.path);
+  if (create_database(w.path, journal_mode) != 0) return 1;
+  if (pthread_create(&w.thread, NULL, writer_main, &w) != 0) return 1;
+  while (__atomic_load_n(&w.commits, __ATOMIC_RELAXED) < 20 && !__atomic_load_n(&w.failed, __ATOMIC_RELAXED)) {
+    usleep(1000);
+  }
+
+  // the writer has to land a commit inside one of the copies
+  for (attempt = 0; !failures && attempt < ATTEMPTS && !during; attempt++) {
+    snprintf(name, sizeof(name), "%s.%d.dump", journal_mode, attempt);
+    before = __atomic_load_n(&w.commits, __ATOMIC_RELAXED);
+    if (backup(cfg, name, &recopied) != 0) failures++;
+    during = recopied ? __atomic_load_n(&w.commits, __ATOMIC_RELAXED) - before : 0;
+    if (!failures) failures += check_restore(cfg, name, restored, &commits);
+  }
+  __atomic_store_n(&w.stop, 1, __ATOMIC_RELAXED);
+  pthread_join(w.thread, NULL);
+  if (__atomic_load_n(&w.failed, __ATOMIC_RELAXED)) failures++;
+  if (!failures && (!during || commits < (int64_t)before)) {
+    printf("FAIL: %s: %llu commits during the copy, %llu pages copied again, restored at %lld\n", journal_mode,
+      (unsigned long long)during, (unsigned long long)recopied, (long long)commits);
+    failures++;
+  }
+
+  return failures;
+}
+
+/* a journal left by a crashed writer must be rolled back by SQLite, not copied around */
+int test_hot_journal(AppConfig_t *cfg, const char *dir) {
+  SqliteDumpError_t *err = NULL;
+  char path[BUF_LEN_S], journal[BUF_LEN_S + 16];
+  const unsigned char header[8] = { 0xd9, 0xd5, 0x05, 0xf9, 0x20, 0xa1, 0x63, 0xd7 };
+  int fd, failures = 0;
+
+  snprintf(path, sizeof(path), "%s/hot.db", dir);
+  snprintf(journal, sizeof(journal), "%s-journal", path);
+  snprintf(cfg->db->uri, sizeof(cfg->db->uri), "%s", path);
+  if (create_database(path, "delete") != 0) return 1;
+  fd = open(journal, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+  if (fd < 0 || write(fd, header, sizeof(header)) != (ssize_t)sizeof(header)) failures++;
+  if (fd >= 0) close(fd);
+  if (sqlitedump_backup(cfg, "hot.dump", &err) != SQLITEDUMP_FORMAT_ERROR) {
+    printf("FAIL: hot journal: %s\n", err ? err->message : "backed up");
+    failures++;
+  }
+  destroy_sqlitedump_error(&err);
+
+  // zeroed out, the journal is done with
+  fd = open(journal, O_WRONLY | O_TRUNC);
+  if (fd < 0 || write(fd, "\0\0\0\0", 4) != 4) failures++;
+  if (fd >= 0) close(fd);
+  if (sqlitedump_backup(cfg, "cold.dump", &err) != SQLITEDUMP_OK) {
+    printf("FAIL: zeroed journal: %s\n", err ? err->message : "?");
+    failures++;
+  }
+  destroy_sqlitedump_error(&err);
+
+  return failures;
+}
+
+/* an empty file is an empty database, anything else without the header is refused */
+int test_odd_files(AppConfig_t *cfg, const char *dir) {
+  SqliteDumpError_t *err = NULL;
+  char path[BUF_LEN_S], restored[BUF_LEN_S + 16];
+  int fd, failures = 0;
+
+  snprintf(path, sizeof(path), "%s/empty.db", dir);
+  snprintf(restored, sizeof(restored), "%s/empty.restored.db", dir);
+  snprintf(cfg->db->uri, sizeof(cfg->db->uri), "%s", path);
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+  if (fd >= 0) close(fd);
+  if (sqlitedump_backup(cfg, "empty.dump", &err) != SQLITEDUMP_OK) {
+    printf("FAIL: empty database: %s\n", err ? err->message : "?");
+    failures++;
+  } else {
+    ArchiveReader_t *reader = init_archive_reader(cfg->storage, "empty.dump", NULL);
+    ArchiveObject_t *obj = reader ? archive_find_object(reader, SQLITEDUMP_OBJECT) : NULL;
+    struct stat st;
+
+    fd = open(restored, O_WRONLY | O_CREAT | O_TRUNC, 0640);
+    if (!obj || sqlitedump_restore(reader, obj, fd, NULL) != ARCHIVE_OK || fstat(fd, &st) != 0 || st.st_size != 0) {
+      printf("FAIL: empty database restored wrong\n");
+      failures++;
+    }
+    if (fd >= 0) close(fd);
+    destroy_archive_reader(&reader);
+  }
+  destroy_sqlitedump_error(&err);
+
+  fd = open(path, O_WRONLY | O_TRUNC);
+  if (fd < 0 || write(fd, "not a database at all, really not", 33) != 33) failures++;
+  if (fd >= 0) close(fd);
+  if (sqlitedump_backup(cfg, "junk.dump", &err) != SQLITEDUMP_FORMAT_ERROR) {
+    printf("FAIL: junk file: %s\n", err ? err->message : "backed up");
+    failures++;
+  }
+  destroy_sqlitedump_error(&err);
+
+  snprintf(cfg->db->uri, sizeof(cfg->db->uri), "%s/missing.db", dir);
+  if (sqlitedump_backup(cfg, "missing.dump", &err) != SQLITEDUMP_OPEN_ERROR) {
+    printf("FAIL: missing file: %s\n", err ? err->message : "backed up");
+    failures++;
+  }
+  destroy_sqlitedump_error(&err);
+
+  return failures;
+}
+
+int main(void) {
+  char dir[] = "/tmp/dbeetle_sqlite_XXXXXX", cmd[BUF_LEN];
+  AppConfig_t *cfg;
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+  cfg = init_app_config(init_db_config("sqlite", "", 10, 0),
+    init_storage_config(dir, "gzip:1", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 2, DEFAULT_RUNTIME_TMP_DIR));
+
+  if (!sqlitedump_supported(cfg->db)) {
+    printf("FAIL: sqlite not taken for a SQLite database\n");
+    failures++;
+  }
+  failures += test_live_backup(cfg, dir, "delete");
+  failures += test_live_backup(cfg, dir, "wal");
+  failures += test_hot_journal(cfg, dir);
+  failures += test_odd_files(cfg, dir);
+
+  destroy_app_config(&cfg);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  if (system(cmd) != 0) failures++;
+
+  if (failures) return 1;
+  printf("SqliteDump test passed.\n");
+  return 0;
+}
@@ -0,0 +1,179 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/scheduler.h"
+#include "include/treewalk.h"
+
+#define TOP_DIRS (24)
+#define SUB_DIRS (8)
+#define FILES (6)
+#define ENTRIES (TOP_DIRS + TOP_DIRS * SUB_DIRS + TOP_DIRS * SUB_DIRS * FILES + 2)
+
+typedef struct Seen {
+  char              *path;
+  int               visits;
+  UT_hash_handle    hh;
+} Seen_t;
+
+typedef struct Visits {
+  Seen_t            *seen;
+  size_t            files;
+  size_t            dirs;
+  size_t            links;
+  size_t            orphans;        // visited before their directory
+  size_t            wrong_size;
+  size_t            workers[SCHED_MAX_WORKERS];
+  const char        *stop_at;
+  const char        *skip;
+  pthread_mutex_t   lock;
+} Visits_t;
+
+int record(const TreeEntry_t *entry, size_t worker_id, void *ctx) {
+  Visits_t *v = ctx;
+  Seen_t *seen, *parent = NULL;
+  const char *slash = strrchr(entry->path, '/');
+  int status = 0;
+
+  pthread_mutex_lock(&v->lock);
+  HASH_FIND_STR(v->seen, entry->path, seen);
+  if (!seen) {
+    seen = calloc(1, sizeof(Seen_t));
+    seen->path = strdup(entry->path);
+    HASH_ADD_KEYPTR(hh, v->seen, seen->path, strlen(seen->path), seen);
+  }
+  seen->visits++;
+  if (slash) HASH_FIND(hh, v->seen, entry->path, (unsigned)(slash - entry->path), parent);
+  if (slash && !parent) v->orphans++;
+  if (S_ISDIR(entry->stx->stx_mode)) v->dirs++;
+  else if (S_ISLNK(entry->stx->stx_mode)) v->links++;
+  else if (S_ISREG(entry->stx->stx_mode)) v->files++;
+  // file i holds i bytes, the size is only there when asked for
+  if (S_ISREG(entry->stx->stx_mode) && (entry->stx->stx_mask & STATX_SIZE)
+    && entry->stx->stx_size != (uint64_t)atoi(entry->name + 1)) {
+    v->wrong_size++;
+  }
+  v->workers[worker_id]++;
+  if (v->skip && strcmp(entry->path, v->skip) == 0) status = TREEWALK_SKIP;
+  if (v->stop_at && strcmp(entry->path, v->stop_at) == 0) status = -1;
+  pthread_mutex_unlock(&v->lock);
+
+  return status;
+}
+
+void reset(Visits_t *v) {
+  Seen_t *seen, *tmp;
+
+  HASH_ITER(hh, v->seen, seen, tmp) {
+    HASH_DEL(v->seen, seen);
+    free(seen->path);
+    free(seen);
+  }
+  memset(v, 0, offsetof(Visits_t, lock));
+}
+
+/* walks @root on @sched; the walk's status */
+TreeWalkStatus_t walk(Scheduler_t *sched, const char *root, unsigned int mask, Visits_t *v, TreeWalkError_t **err) {
+  TreeWalk_t *w = init_tree_walk(root, mask, record, v, err);
+  TreeWalkStatus_t status;
+
+  if (!w) return (*err)->code;
+  status = tree_walk_submit(w, sched);
+  scheduler_wait(sched);
+  if (status == TREEWALK_OK) status = tree_walk_finish(w, err);
+  destroy_tree_walk(&w);
+
+  return status;
+}
+
+int main(void) {
+  char root[] = "/tmp/dbeetle_treewalk_XXXXXX", path[BUF_LEN];
+  Scheduler_t *sched = init_scheduler(4);
+  TreeWalkError_t *err = NULL;
+  Visits_t v;
+  size_t workers = 0;
+  int failures = 0;
+
+  memset(&v, 0, sizeof(v));
+  pthread_mutex_init(&v.lock, NULL);
+  if (!sched || !mkdtemp(root)) return 1;
+  for (int d = 0; d < TOP_DIRS; d++) {
+    snprintf(path, sizeof(path), "%s/d%d", root, d);
+    failures += mkdir(path, 0700) != 0;
+    for (int s = 0; s < SUB_DIRS; s++) {
+      snprintf(path, sizeof(path), "%s/d%d/s%d", root, d, s);
+      failures += mkdir(path, 0700) != 0;
+      for (int f = 0; f < FILES; f++) {
+        snprintf(path, sizeof(path), "%s/d%d/s%d/f%d", root, d, s, f);
+        int fd = open(path, O_WRONLY | O_CREAT, 0600);
+
+        failures += fd < 0 || write(fd, "xxxxxxxx", (size_t)f) != f;
+        if (fd >= 0) close(fd);
+      }
+    }
+  }
+  snprintf(path, sizeof(path), "%s/link", root);
+  failures += symlink("d0", path) != 0;
+  snprintf(path, sizeof(path), "%s/fifo", root);
+  failures += mkfifo(path, 0600) != 0;
+  if (failures) printf("FAIL: cannot set up %s\n", root);
+
+  // every entry once, each after its directory, sizes as asked for, links not followed
+  if (walk(sched, root, STATX_SIZE, &v, &err) != TREEWALK_OK) {
+    printf("FAIL: walk: %s\n", err ? err->message : "?");
+    failures++;
+  }
+  if (HASH_COUNT(v.seen) != ENTRIES || v.files != TOP_DIRS * SUB_DIRS * FILES || v.links != 1
+    || v.dirs != TOP_DIRS + TOP_DIRS * SUB_DIRS || v.orphans || v.wrong_size) {
+    printf("FAIL: %u entries of %d, %zu files, %zu dirs, %zu links, %zu orphans, %zu wrong sizes\n",
+      HASH_COUNT(v.seen), ENTRIES, v.files, v.dirs, v.links, v.orphans, v.wrong_size);
+    failures++;
+  }
+  for (Seen_t *seen = v.seen; seen; seen = seen->hh.next) {
+    if (seen->visits != 1) {
+      printf("FAIL: %s visited %d times\n", seen->path, seen->visits);
+      failures++;
+      break;
+    }
+  }
+  for (size_t i = 0; i < SCHED_MAX_WORKERS; i++) workers += v.workers[i] > 0;
+  printf("walked %u entries on %zu workers\n", HASH_COUNT(v.seen), workers);
+  destroy_treewalk_error(&err);
+
+  // types alone come from the listing, skipped directories are not listed
+  reset(&v);
+  v.skip = "d3";
+  if (walk(sched, root, 0, &v, &err) != TREEWALK_OK || v.dirs != TOP_DIRS + (TOP_DIRS - 1) * SUB_DIRS
+    || v.files != (TOP_DIRS - 1) * SUB_DIRS * FILES || v.links != 1) {
+    printf("FAIL: walk without a mask: %zu dirs, %zu files, %zu links\n", v.dirs, v.files, v.links);
+    failures++;
+  }
+  destroy_treewalk_error(&err);
+
+  // a visitor failure stops the walk and names the entry
+  reset(&v);
+  v.stop_at = "d5/s2";
+  if (walk(sched, root, 0, &v, &err) != TREEWALK_VISIT_ERROR || !err || !strstr(err->message, "d5/s2")) {
+    printf("FAIL: stopped walk: %s\n", err ? err->message : "not reported");
+    failures++;
+  }
+  destroy_treewalk_error(&err);
+  if (init_tree_walk("/nonexistent/tree", 0, record, &v, &err) || !err || err->code != TREEWALK_IO_ERROR) {
+    printf("FAIL: missing root accepted\n");
+    failures++;
+  }
+  destroy_treewalk_error(&err);
+
+  reset(&v);
+  pthread_mutex_destroy(&v.lock);
+  destroy_scheduler(&sched);
+  snprintf(path, sizeof(path), "rm -rf %s", root);
+  if (system(path) != 0) printf("note: %s not removed\n", root);
+
+  if (failures) return 1;
+  printf("Treewalk test passed.\n");
+  return 0;
+}
@@ -0,0 +1,241 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/config_parser.h"
+#include "include/pipeline.h"
+#include "include/storage.h"
+#include "include/uring.h"
+
+#define OBJECTS (3)
+#define OBJECT_BYTES (5 * 1000 * 1000 + 17)
+
+typedef struct Holder {
+  Pipeline_t        *pipe;
+  const PipeBuffer_t *held[2];
+  size_t            count;
+  size_t            blocks;
+  size_t            flushes;
+  size_t            most_held;
+} Holder_t;
+
+unsigned char pattern_byte(uint32_t object, size_t offset) {
+  return (unsigned char)((object * 131u + offset * 7u + offset / 4093u) & 0xff);
+}
+
+/* keeps up to two blocks, as an asynchronous writer would */
+int holding_sink(void *ctx, const PipeBuffer_t *buf) {
+  Holder_t *h = ctx;
+
+  h->blocks++;
+  if (h->count == 2) return 0;
+  h->held[h->count++] = buf;
+  if (h->count > h->most_held) h->most_held = h->count;
+
+  return PIPE_SINK_HELD;
+}
+
+int holding_flush(void *ctx) {
+  Holder_t *h = ctx;
+
+  h->flushes++;
+  while (h->count > 0) pipeline_recycle(h->pipe, h->held[--h->count]);
+
+  return 0;
+}
+
+int test_held_blocks(void) {
+  Pipeline_t *pipe = init_pipeline(4096, 3);
+  Holder_t holder = { pipe, { NULL, NULL }, 0, 0, 0, 0 };
+  PipeWriter_t writer;
+  unsigned char chunk[1000];
+  int failures = 0;
+
+  memset(chunk, 'h', sizeof(chunk));
+  pipeline_set_sink(pipe, holding_sink, &holder);
+  pipeline_set_sink_flush(pipe, holding_flush);
+  pipeline_start(pipe);
+  // far more blocks than buffers: only the flush hook gives held ones back
+  init_pipe_writer(&writer, pipe, 0);
+  for (int i = 0; i < 200; i++) pipe_writer_write(&writer, chunk, sizeof(chunk));
+  pipe_writer_close(&writer);
+
+  if (pipeline_finish(pipe, NULL) != PIPELINE_OK || pipe->bytes_out != 200 * sizeof(chunk)) {
+    printf("FAIL: pipeline with a holding sink did not complete\n");
+    failures++;
+  }
+  if (holder.blocks != 200 * sizeof(chunk) / 4096 + 1 || holder.most_held != 2 || holder.count != 0
+    || holder.flushes == 0) {
+    printf("FAIL: %zu blocks, %zu held at most, %zu still held, %zu flushes\n", holder.blocks, holder.most_held,
+      holder.count, holder.flushes);
+    failures++;
+  }
+  if (pipe->pool->count != pipe->buffer_count) {
+    printf("FAIL: %zu of %zu buffers back in the pool\n", pipe->pool->count, pipe->buffer_count);
+    failures++;
+  }
+  destroy_pipeline(&pipe);
+
+  return failures;
+}
+
+/* writes OBJECTS objects through the storage pipeline with @writer; returns the archive bytes */
+unsigned char *write_archive(const char *dir, const char *name, const char *writer, bool *used_uring, size_t *len) {
+  char path[BUF_LEN];
+  AppConfig_t *cfg;
+  StorageSink_t *sink;
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  Pipeline_t *pipe;
+  unsigned char *bytes = NULL, *chunk = malloc(65536);
+  struct stat st;
+  FILE *fh;
+
+  cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, 1),
+    init_storage_config(dir, "gzip", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 2, DEFAULT_RUNTIME_TMP_DIR));
+  strcpy(cfg->storage->writer, writer);
+  sink = init_storage_sink(cfg->storage, name, &storage_err);
+  pipe = sink ? init_storage_pipeline(cfg, sink, &pipe_err) : NULL;
+  if (!pipe || !chunk) {
+    printf("FAIL: storage pipeline (%s): %s\n", writer, storage_err ? storage_err->message
+      : pipe_err ? pipe_err->message : "?");
+    destroy_storage_error(&storage_err), destroy_pipeline_error(&pipe_err);
+    destroy_storage_sink(&sink);
+    destroy_app_config(&cfg);
+    free(chunk);
+
+    return NULL;
+  }
+  *used_uring = sink->uring != NULL;
+
+  for (uint32_t id = 0; id < OBJECTS; id++) {
+    PipeWriter_t pw;
+
+    init_pipe_writer(&pw, pipe, id);
+    for (size_t offset = 0; offset < OBJECT_BYTES; ) {
+      size_t n = OBJECT_BYTES - offset < 65536 ? OBJECT_BYTES - offset : 65536;
+
+      for (size_t i = 0; i < n; i++) chunk[i] = pattern_byte(id, offset + i);
+      pipe_writer_write(&pw, chunk, n);
+      offset += n;
+    }
+    pipe_writer_close(&pw);
+    storage_sink_name_object(sink, id, id == 0 ? "a" : id == 1 ? "b" : "c");
+  }
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  if (pipeline_finish(pipe, &pipe_err) == PIPELINE_OK && storage_sink_commit(sink, &storage_err) == STORAGE_OK) {
+    if (sink->uring && (sink->uring->completed == 0 || sink->uring->queued || sink->uring->inflight)) {
+      printf("FAIL: io_uring writer completed %llu writes, %u queued, %u in flight\n",
+        (unsigned long long)sink->uring->completed, sink->uring->queued, sink->uring->inflight);
+    } else if ((fh = fopen(path, "rb")) != NULL) {
+      if (fstat(fileno(fh), &st) == 0 && (bytes = malloc((size_t)st.st_size + 1))) {
+        *len = fread(bytes, 1, (size_t)st.st_size, fh);
+      }
+      fclose(fh);
+    }
+    unlink(path);
+  } else {
+    printf("FAIL: archive (%s) not completed: %s\n", writer, pipe_err ? pipe_err->message
+      : storage_err ? storage_err->message : "?");
+  }
+
+  destroy_storage_error(&storage_err), destroy_pipeline_error(&pipe_err);
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+  destroy_app_config(&cfg);
+  free(chunk);
+
+  return bytes;
+}
+
+int test_same_archive(void) {
+  char dir[] = "/tmp/dbeetle_uring_XXXXXX";
+  unsigned char *sync_bytes, *uring_bytes;
+  size_t sync_len = 0, uring_len = 0;
+  bool used_sync = true, used_uring = false;
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+  sync_bytes = write_archive(dir, "sync.dump", "sync", &used_sync, &sync_len);
+  uring_bytes = write_archive(dir, "auto.dump", "auto", &used_uring, &uring_len);
+  if (!sync_bytes || !uring_bytes || used_sync) {
+    printf("FAIL: archives missing, or the sync writer used io_uring\n");
+    failures++;
+  } else if (sync_len != uring_len || memcmp(sync_bytes, uring_bytes, sync_len) != 0) {
+    printf("FAIL: io_uring archive (%zu bytes) differs from the write(2) one (%zu bytes)\n", uring_len, sync_len);
+    failures++;
+  }
+  if (!used_uring) printf("note: io_uring is not available here, both archives used write(2)\n");
+  free(sync_bytes);
+  free(uring_bytes);
+  rmdir(dir);
+
+  return failures;
+}
+
+/* writes that fail still give every block back */
+int test_failed_writes(void) {
+  char path[] = "/tmp/dbeetle_uring_ro_XXXXXX";
+  Pipeline_t *pipe = init_pipeline(4096, 4);
+  PipeBuffer_t *buf;
+  UringWriter_t *writer;
+  char message[BUF_LEN_M];
+  int fd = mkstemp(path), ro, failures = 0;
+
+  ro = open(path, O_RDONLY);
+  writer = init_uring_writer(ro, pipe, message, sizeof(message));
+  if (!writer) {
+    printf("note: %s\n", message);
+  } else {
+    for (int i = 0; i < 3; i++) {
+      buf = pipeline_acquire(pipe);
+      memset(buf->data, 'x', 4096);
+      buf->len = 4096;
+      if (uring_writer_write(writer, buf, (uint64_t)i * 4096) != 0) {
+        printf("FAIL: write %d was not queued\n", i);
+        failures++;
+      }
+    }
+    errno = 0;
+    if (uring_writer_flush(writer) == 0 || errno != EBADF || writer->inflight || writer->queued) {
+      printf("FAIL: writes to a read-only file flushed with errno %d\n", errno);
+      failures++;
+    }
+    buf = pipeline_acquire(pipe);
+    if (uring_writer_write(writer, buf, 0) == 0) {
+      printf("FAIL: failed writer took another block\n");
+      failures++;
+    }
+    pipeline_recycle(pipe, buf);
+    if (pipe->pool->count != pipe->buffer_count) {
+      printf("FAIL: %zu of %zu buffers back in the pool\n", pipe->pool->count, pipe->buffer_count);
+      failures++;
+    }
+  }
+
+  destroy_uring_writer(&writer);
+  destroy_pipeline(&pipe);
+  close(ro);
+  close(fd);
+  unlink(path);
+
+  return failures;
+}
+
+int main(void) {
+  int failures = 0;
+
+  failures += test_held_blocks();
+  failures += test_same_archive();
+  failures += test_failed_writes();
+
+  if (failures) return 1;
+  printf("Uring test passed.\n");
+  return 0;
+}
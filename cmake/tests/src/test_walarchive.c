@@ -0,0 +1,320 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "include/archive.h"
+#include "include/config_parser.h"
+#include "include/walarchive.h"
+#include "pg_standin.h"
+
+#define SEGMENT (1u << 20)
+#define WAIT_MS (20000)
+
+/* runs the archiver in a thread of its own, as `dbeetle archive` runs it in the main one */
+typedef struct Runner {
+  WalArchive_t      *archive;
+  int               stop;
+  WalArchiveStatus_t status;
+  char              message[BUF_LEN_M];
+  pthread_t         thread;
+} Runner_t;
+
+void *runner_main(void *arg) {
+  Runner_t *r = arg;
+  WalArchiveError_t *err = NULL;
+
+  r->status = wal_archive_run(r->archive, &r->stop, &err);
+  if (err) snprintf(r->message, sizeof(r->message), "%s", err->message);
+  destroy_wal_archive_error(&err);
+
+  return NULL;
+}
+
+/* connects and starts archiving in the background; 0 on success */
+int start_runner(AppConfig_t *cfg, size_t batch_segments, Runner_t *r) {
+  WalArchiveError_t *err = NULL;
+
+  memset(r, 0, sizeof(*r));
+  r->archive = init_wal_archive(cfg, &err);
+  if (!r->archive) {
+    printf("FAIL: cannot start archiving: %s\n", err ? err->message : "?");
+    destroy_wal_archive_error(&err);
+
+    return 1;
+  }
+  r->archive->batch_segments = batch_segments;
+  if (pthread_create(&r->thread, NULL, runner_main, r) != 0) {
+    destroy_wal_archive(&r->archive);
+
+    return 1;
+  }
+
+  return 0;
+}
+
+/* stops archiving once everything up to @until is flushed; 0 when it was */
+int stop_runner(Runner_t *r, uint64_t until) {
+  int waited = 0, failures = 0;
+
+  while (wal_archive_flushed(r->archive) < until && waited < WAIT_MS) {
+    usleep(10000);
+    waited += 10;
+  }
+  __atomic_store_n(&r->stop, 1, __ATOMIC_RELAXED);
+  pthread_join(r->thread, NULL);
+  if (r->status != WAL_ARCHIVE_OK || wal_archive_flushed(r->archive) != until) {
+    printf("FAIL: archived up to %llx of %llx: %s\n", (unsigned long long)wal_archive_flushed(r->archive),
+      (unsigned long long)until, r->message);
+    failures++;
+  }
+  destroy_wal_archive(&r->archive);
+
+  return failures;
+}
+
+/* fetches segment @lsn of @timeline as restore_command would and checks every byte */
+int check_segment(AppConfig_t *cfg, PgStandin_t *s, const char *dir, uint32_t timeline, uint64_t lsn) {
+  WalArchiveError_t *err = NULL;
+  char name[WAL_SEGMENT_NAME_LEN + 1], path[BUF_LEN];
+  unsigned char *data = malloc(SEGMENT);
+  int fd, failures = 0;
+  ssize_t n = -1;
+
+  wal_segment_name(timeline, lsn, SEGMENT, name);
+  snprintf(path, sizeof(path), "%s/pg_wal_%s", dir, name);
+  if (wal_archive_fetch(cfg, name, path, &err) != WAL_ARCHIVE_OK) {
+    printf("FAIL: cannot fetch %s: %s\n", name, err ? err->message : "?");
+    destroy_wal_archive_error(&err);
+    free(data);
+
+    return 1;
+  }
+  fd = open(path, O_RDONLY);
+  if (fd >= 0 && data) n = read(fd, data, SEGMENT);
+  if (fd >= 0) close(fd);
+  if (n != (ssize_t)SEGMENT) failures++;
+  for (size_t i = 0; !failures && i < SEGMENT; i++) {
+    if (data[i] != pg_standin_wal_byte(s, timeline, lsn + i)) failures++;
+  }
+  if (failures) printf("FAIL: segment %s restored wrong\n", name);
+  unlink(path);
+  free(data);
+
+  return failures;
+}
+
+/* fetches the history file of timeline 2 as restore_command would; the next one is missing */
+int check_history(AppConfig_t *cfg, PgStandin_t *s, const char *dir) {
+  WalArchiveError_t *err = NULL;
+  char path[BUF_LEN], want[BUF_LEN_S], got[BUF_LEN_S] = "";
+  int fd, failures = 0;
+  ssize_t n = -1;
+
+  snprintf(path, sizeof(path), "%s/pg_wal_00000002.history", dir);
+  if (pg_standin_history(s, 2, want, sizeof(want)) != 0 || wal_archive_fetch(cfg, "00000002.history", path, &err)
+    != WAL_ARCHIVE_OK) {
+    printf("FAIL: cannot fetch 00000002.history: %s\n", err ? err->message : "?");
+    destroy_wal_archive_error(&err);
+
+    return 1;
+  }
+  if ((fd = open(path, O_RDONLY)) >= 0) n = read(fd, got, sizeof(got) - 1);
+  if (fd >= 0) close(fd);
+  if (n != (ssize_t)strlen(want) || memcmp(got, want, (size_t)n) != 0) {
+    printf("FAIL: 00000002.history restored as \"%s\"\n", got);
+    failures++;
+  }
+  unlink(path);
+  if (wal_archive_fetch(cfg, "00000003.history", path, &err) != WAL_ARCHIVE_NOT_FOUND || access(path, F_OK) == 0) {
+    printf("FAIL: 00000003.history was not reported missing\n");
+    failures++;
+  }
+  destroy_wal_archive_error(&err);
+
+  return failures;
+}
+
+/* the index holds exactly the segments of each timeline, and its searches find them */
+int check_index(AppConfig_t *cfg) {
+  WalArchiveError_t *err = NULL;
+  WalIndex_t *index = wal_index_open(cfg->storage->output_path, 0, &err);
+  WalIndexEntry_t entry, prev;
+  uint64_t first = 0, count = 0, pos = 0;
+  int failures = 0;
+
+  if (!index) {
+    printf("FAIL: cannot open the index: %s\n", err ? err->message : "?");
+    destroy_wal_archive_error(&err);
+
+    return 1;
+  }
+  // timeline 1 from segment 2 to 4, its segment 5 cut by the promotion; timeline 2 from 5 to 8
+  if (index->count != 7) {
+    printf("FAIL: %llu segments indexed\n", (unsigned long long)index->count);
+    failures++;
+  }
+  if (wal_index_range(index, 1, 0, 16 * SEGMENT, &first, &count) != WAL_ARCHIVE_OK || first != 0 || count != 3) {
+    printf("FAIL: timeline 1 range %llu+%llu\n", (unsigned long long)first, (unsigned long long)count);
+    failures++;
+  }
+  if (wal_index_range(index, 2, 6 * SEGMENT + 100, 8 * SEGMENT, &first, &count) != WAL_ARCHIVE_OK || first != 4
+    || count != 3) {
+    printf("FAIL: timeline 2 range %llu+%llu\n", (unsigned long long)first, (unsigned long long)count);
+    failures++;
+  }
+  if (wal_index_find(index, 1, 5 * SEGMENT + 10, &entry) != WAL_ARCHIVE_NOT_FOUND
+    || wal_index_find(index, 2, 1 * SEGMENT, &entry) != WAL_ARCHIVE_NOT_FOUND
+    || wal_index_find(index, 2, 7 * SEGMENT + 99, &entry) != WAL_ARCHIVE_OK || entry.start_lsn != 7 * SEGMENT
+    || entry.batch_lsn != 7 * SEGMENT || entry.timeline != 2) {
+    printf("FAIL: segment lookups\n");
+    failures++;
+  }
+  for (uint64_t i = 0; i < index->count; i++) {
+    if (wal_index_read(index, i, &entry) != 0 || (i > 0 && entry.end_time < prev.end_time)
+      || wal_index_find_time(index, entry.end_time, &pos) != WAL_ARCHIVE_OK || pos > i
+      || (wal_index_read(index, pos, &prev) == 0 && prev.end_time != entry.end_time)) {
+      printf("FAIL: time lookup of record %llu\n", (unsigned long long)i);
+      failures++;
+    }
+    wal_index_read(index, i, &prev);
+  }
+  if (wal_index_find_time(index, INT64_MAX, &pos) != WAL_ARCHIVE_OK || pos != index->count) failures++;
+  destroy_wal_index(&index);
+
+  return failures;
+}
+
+/* follows a promotion, then resumes where it stopped; every archived segment restores */
+int test_archive(AppConfig_t *cfg, PgStandin_t *s, const char *dir) {
+  WalArchiveError_t *err = NULL;
+  char name[WAL_SEGMENT_NAME_LEN + 1], path[BUF_LEN], partial[BUF_LEN_XS];
+  ArchiveReader_t *reader;
+  Runner_t r;
+  int failures = 0;
+
+  // a new archive starts at the segment the server is on
+  if (start_runner(cfg, 2, &r) != 0) return 1;
+  pg_standin_write_wal(s, 5 * SEGMENT + SEGMENT * 3 / 10);
+  pg_standin_promote(s);
+  pg_standin_write_wal(s, 9 * SEGMENT);
+  failures += stop_runner(&r, 9 * SEGMENT);
+  if (failures) return failures;
+  if (__atomic_load_n(&s->wal_streams, __ATOMIC_RELAXED) != 2) {
+    printf("FAIL: %zu streams for one timeline switch\n", __atomic_load_n(&s->wal_streams, __ATOMIC_RELAXED));
+    failures++;
+  }
+  for (int waited = 0; __atomic_load_n(&s->wal_flushed, __ATOMIC_RELAXED) != 9 * SEGMENT && waited < WAIT_MS; waited++) {
+    usleep(1000);
+  }
+  if (__atomic_load_n(&s->wal_flushed, __ATOMIC_RELAXED) != 9 * SEGMENT) {
+    printf("FAIL: the server was told %llx is flushed\n",
+      (unsigned long long)__atomic_load_n(&s->wal_flushed, __ATOMIC_RELAXED));
+    failures++;
+  }
+  // both streams went through the one persistent slot, which kept up with the archive
+  pthread_mutex_lock(&s->lock);
+  if (strcmp(s->physical[0].name, DEFAULT_DB_WAL_SLOT) != 0 || s->physical[0].owner || s->physical[1].name[0]
+    || s->physical[0].restart_lsn != 9 * SEGMENT || s->slot_streams != s->wal_streams) {
+    printf("FAIL: WAL was not streamed through slot %s\n", DEFAULT_DB_WAL_SLOT);
+    failures++;
+  }
+  pthread_mutex_unlock(&s->lock);
+  failures += check_index(cfg);
+  for (uint64_t seg = 2; seg < 5; seg++) failures += check_segment(cfg, s, dir, 1, seg * SEGMENT);
+  for (uint64_t seg = 5; seg < 9; seg++) failures += check_segment(cfg, s, dir, 2, seg * SEGMENT);
+
+  // the cut segment is kept in its batch, but not indexed
+  wal_segment_name(1, 5 * SEGMENT, SEGMENT, name);
+  snprintf(path, sizeof(path), "%s/pg_wal_%s", dir, name);
+  if (wal_archive_fetch(cfg, name, path, &err) != WAL_ARCHIVE_NOT_FOUND || access(path, F_OK) == 0) {
+    printf("FAIL: the segment cut by the promotion was restored\n");
+    failures++;
+  }
+  reader = init_archive_reader(cfg->storage, "000000010000000000000004.wal", NULL);
+  snprintf(partial, sizeof(partial), "%s%s", name, WAL_PARTIAL_SUFFIX);
+  if (!reader || !archive_find_object(reader, partial)) {
+    printf("FAIL: no %s in its batch\n", partial);
+    failures++;
+  }
+  destroy_archive_reader(&reader);
+  destroy_wal_archive_error(&err);
+  failures += check_history(cfg, s, dir);
+
+  // a new run carries on from the index, whatever the server's position
+  pg_standin_write_wal(s, 11 * SEGMENT);
+  if (start_runner(cfg, 2, &r) != 0) return failures + 1;
+  failures += stop_runner(&r, 11 * SEGMENT);
+  if (__atomic_load_n(&s->wal_start, __ATOMIC_RELAXED) != 9 * SEGMENT) {
+    printf("FAIL: resumed at %llx\n", (unsigned long long)__atomic_load_n(&s->wal_start, __ATOMIC_RELAXED));
+    failures++;
+  }
+  for (uint64_t seg = 9; seg < 11; seg++) failures += check_segment(cfg, s, dir, 2, seg * SEGMENT);
+
+  return failures;
+}
+
+/* with deduplication every segment is a manifest of its own */
+int test_dedup(AppConfig_t *cfg, PgStandin_t *s, const char *dir) {
+  char output[BUF_LEN_S];
+  Runner_t r;
+  int failures = 0;
+
+  snprintf(output, sizeof(output), "%s/dedup", dir);
+  snprintf(cfg->storage->output_path, sizeof(cfg->storage->output_path), "%s", output);
+  cfg->storage->dedup_enabled = 1;
+  if (start_runner(cfg, 1, &r) != 0) return 1;
+  pg_standin_write_wal(s, 13 * SEGMENT);
+  failures += stop_runner(&r, 13 * SEGMENT);
+  for (uint64_t seg = 11; !failures && seg < 13; seg++) failures += check_segment(cfg, s, dir, 2, seg * SEGMENT);
+  // a new archive of a promoted server starts with its history
+  if (!failures) failures += check_history(cfg, s, dir);
+
+  return failures;
+}
+
+int main(void) {
+  char dir[] = "/tmp/dbeetle_wal_XXXXXX", uri[BUF_LEN], cmd[BUF_LEN];
+  WalArchiveError_t *err = NULL;
+  AppConfig_t *cfg;
+  PgStandin_t *s;
+  int failures = 0;
+
+  if (!mkdtemp(dir)) return 1;
+  s = pg_standin_start(dir, PG_STANDIN_SCRAM, "dbeetle", "s3cret");
+  if (!s) {
+    printf("FAIL: cannot start the stand-in\n");
+
+    return 1;
+  }
+  pg_standin_set_wal(s, SEGMENT, 2 * SEGMENT + SEGMENT / 2);
+  snprintf(uri, sizeof(uri), "postgresql://dbeetle:s3cret@/shop?host=%s", dir);
+  cfg = init_app_config(init_db_config("postgres", uri, 10, 0),
+    init_storage_config(dir, "gzip:1", DEFAULT_STORAGE_ENC_KEY_PATH, DEFAULT_STORAGE_REMOTE),
+    init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, 2, DEFAULT_RUNTIME_TMP_DIR));
+
+  if (wal_parse_size("16MB") != 16 * SEGMENT || wal_parse_size("1024kB") != SEGMENT || wal_parse_size("3MB") != 0
+    || wal_parse_size("2GB") != 0) {
+    printf("FAIL: wal_segment_size values parsed wrong\n");
+    failures++;
+  }
+  if (wal_archive_fetch(cfg, "000000010000000000000002", "/nonexistent", &err) != WAL_ARCHIVE_NOT_FOUND) {
+    printf("FAIL: fetch without an archive: %s\n", err ? err->message : "succeeded");
+    failures++;
+  }
+  destroy_wal_archive_error(&err);
+  failures += test_archive(cfg, s, dir);
+  failures += test_dedup(cfg, s, dir);
+
+  pg_standin_stop(&s);
+  destroy_app_config(&cfg);
+  snprintf(cmd, sizeof(cmd), "rm -rf %s", dir);
+  if (system(cmd) != 0) failures++;
+
+  if (failures) return 1;
+  printf("WalArchive test passed.\n");
+  return 0;
+}
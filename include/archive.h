@@ -0,0 +1,239 @@
+#ifndef ___ARCHIVE_H___
+#define ___ARCHIVE_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "cipher.h"
+#include "codec.h"
+#include "config_parser.h"
+
+//macro defs
+#define ARCHIVE_INDEX_MAGIC ("DBINDEX")
+#define ARCHIVE_INDEX_VERSION (1)
+#define ARCHIVE_FRAME_RECORD_LEN (24)
+#define ARCHIVE_FOOTER_LEN (36)
+#define ARCHIVE_SKIPPABLE_MAGIC (0x184D2A5Eu)
+#define ARCHIVE_SKIPPABLE_HEADER_LEN (8)
+#define ARCHIVE_GZIP_PIECE_LEN (65531)
+#define ARCHIVE_GZIP_MEMBER_OVERHEAD (26)
+#define ARCHIVE_GZIP_TRAILER_LEN (10)
+#define ARCHIVE_MAX_INDEX_LEN (1u << 30)
+#define ARCHIVE_PASS_BUFFER (1u << 20)
+
+/*
+ * ==========================================================
+ * Seekable Archives
+ * ----------------------------------------------------------
+ * Every pipeline block lands in the archive as one frame that
+ * decodes on its own: a sync-flushed deflate block, a zstd or
+ * LZ4 frame, a sealed chunk (see cipher.h) or, uncompressed,
+ * the raw bytes. Blocks of the objects being dumped at once
+ * are interleaved, so the storage sink records every frame
+ * it writes (object, offset, stored and raw length) and
+ * appends the list as an index behind the data. Restoring
+ * one table then reads the index and preads that table's
+ * frames, not the whole archive.
+ *
+ * Index, all integers little endian:
+ *
+ *   objects       per object: id u32 | name len u16 | name
+ *   frames        per frame: object id u32 | flags u32
+ *                 | offset u64 | stored len u32 | raw len u32
+ *   footer        object count u32 | frame count u64 | codec u8
+ *                 | 3 reserved bytes | crc32 of all the bytes
+ *                 before it u32 | index length u64 (footer
+ *                 included) | "DBINDEX" | version u8
+ *
+ * The index is wrapped so stock tools keep reading the data:
+ *
+ *   gzip          empty gzip members after the data member,
+ *                 the index cut into ARCHIVE_GZIP_PIECE_LEN
+ *                 pieces carried in their FEXTRA fields
+ *                 (subfield "DB")
+ *   zstd, lz4     one skippable frame (ARCHIVE_SKIPPABLE_MAGIC)
+ *   none          appended as is
+ *   encrypted     a chunk flagged CIPHER_CHUNK_INDEX just before
+ *                 the end chunk, whose raw_len is the length of
+ *                 the index chunk
+ *
+ * so the footer is found from the end of the file in every
+ * case. Frame offsets are file offsets, except behind a
+ * dedup manifest (chunkstore.h), whose index is appended as
+ * is and whose frames are ranges of the stream the chunks
+ * make up, stored and raw length alike.
+ * The reader loads such a manifest's chunk list and puts the
+ * frames of an object back together from the chunks they
+ * cover, so tables restore from a dedup backup one by one
+ * like from any other archive.
+ * ==========================================================
+ */
+
+typedef enum {
+  ARCHIVE_OK = 0,
+  ARCHIVE_IO_ERROR,
+  ARCHIVE_MEMORY_ERROR,
+  ARCHIVE_FORMAT_ERROR,
+  ARCHIVE_KEY_ERROR,
+  ARCHIVE_NOT_FOUND
+} ArchiveStatus_t;
+
+typedef struct ArchiveError {
+  ArchiveStatus_t   code;
+  char              message[BUF_LEN_M];
+} ArchiveError_t;
+
+typedef struct ArchiveObject {
+  uint32_t          id;
+  char              name[BUF_LEN_S];
+  uint64_t          frames;         // filled in by the reader
+  uint64_t          raw_bytes;      // filled in by the reader
+} ArchiveObject_t;
+
+typedef struct ArchiveFrame {
+  uint32_t          object_id;
+  uint32_t          flags;          // PIPE_BUF_* flags of the block
+  uint64_t          offset;
+  uint32_t          stored_len;
+  uint32_t          raw_len;
+} ArchiveFrame_t;
+
+typedef struct ArchiveIndex {
+  ArchiveObject_t   *objects;
+  uint32_t          object_count;
+  uint32_t          object_capacity;
+  ArchiveFrame_t    *frames;
+  uint64_t          frame_count;
+  uint64_t          frame_capacity;
+  pthread_mutex_t   lock;           // objects are named from the dump workers
+} ArchiveIndex_t;
+
+typedef struct ArchiveReader {
+  int               fd;
+  char              path[BUF_LEN];
+  uint64_t          size;
+  CodecId_t         codec;
+  bool              encrypted;
+  unsigned char     file_header[CIPHER_FILE_HEADER_LEN];
+  unsigned char     key[CIPHER_KEY_LEN];  // the archive's data key
+  ArchiveIndex_t    *index;
+  uint64_t          bytes_read;     // frame bytes read so far, by all readers
+  bool              drop_behind;    // storage.direct_io: frames leave the page cache once read
+  bool              dedup;          // a chunk manifest, frames are read from the chunk store
+  char              store_path[BUF_LEN_S];  // `output_path`, above the chunk directory
+  unsigned char     *chunk_ids;     // the manifest's chunks, CHUNK_ID_LEN bytes each
+  uint64_t          *chunk_ends;    // stream offset where each chunk ends
+  uint64_t          chunk_count;
+} ArchiveReader_t;
+
+/* receives the decoded bytes of an object, in order; returns 0 to go on */
+typedef int (*ArchiveWriteFn_t)(void *ctx, const unsigned char *data, size_t len);
+
+
+ArchiveIndex_t *init_archive_index(void);
+/* names object @id; 0 on success, -1 on allocation failure */
+int archive_index_name_object(ArchiveIndex_t *index, uint32_t id, const char *name);
+/* records a frame written by the sink; 0 on success, -1 on allocation failure */
+int archive_index_add_frame(ArchiveIndex_t *index, const ArchiveFrame_t *frame);
+
+/**
+ * archive_index_encode - serialises @index with its footer
+ * @index: the index
+ * @codec: codec of the archive's frames
+ * @out: written malloc'd index, to be freed by the caller
+ * @out_len: written index length
+ *
+ * Return: 0 on success, -1 on allocation failure
+ **/
+int archive_index_encode(ArchiveIndex_t *index, CodecId_t codec, unsigned char **out, size_t *out_len);
+
+/* parses an index as written by archive_index_encode(); NULL if it is damaged */
+ArchiveIndex_t *archive_index_decode(const unsigned char *src, size_t len, CodecId_t *codec);
+
+/**
+ * archive_index_wrap - puts an encoded index in the container that
+ * stock tools skip for @codec (see above; not for encrypted archives)
+ * @codec: codec of the archive
+ * @index: the encoded index
+ * @len: its length
+ * @out: written malloc'd bytes to append to the archive
+ * @out_len: written length
+ *
+ * Return: 0 on success, -1 on allocation failure
+ **/
+int archive_index_wrap(CodecId_t codec, const unsigned char *index, size_t len, unsigned char **out, size_t *out_len);
+int archive_index_unwrap(const unsigned char *tail, size_t tail_len, size_t index_len, bool gzip, unsigned char *out);
+
+/**
+ * init_archive_reader - opens archive @backup_name and loads its index
+ * @cfg: storage section; `encryption_key_path` opens encrypted archives
+ * @backup_name: file name of the archive inside `output_path`
+ * @err: written error object on failure
+ *
+ * Only the end of the file is read.
+ * Return: the reader, or NULL on failure
+ **/
+ArchiveReader_t *init_archive_reader(const StorageConfig_t *cfg, const char *backup_name, ArchiveError_t **err);
+
+/* the object called @name, NULL when the archive has none */
+ArchiveObject_t *archive_find_object(const ArchiveReader_t *reader, const char *name);
+
+/*
+ * the object called @name after @prev (NULL for the first): a table
+ * dumped in ranges is stored as several objects of the same name,
+ * each a complete stream of its own rows
+ */
+ArchiveObject_t *archive_find_next_object(const ArchiveReader_t *reader, const char *name, const ArchiveObject_t *prev);
+
+/**
+ * archive_read_object - passes the dump stream of one object to @write
+ * @reader: the reader
+ * @obj: object of the reader's index
+ * @emit: called with every decoded frame, in order
+ * @ctx: opaque pointer passed to @emit
+ * @err: written error object on failure
+ *
+ * Only the object's own frames are read, each checked by its codec
+ * (and authenticated, for encrypted archives). Objects of the same
+ * reader can be read from several threads at once.
+ * Return: ArchiveStatus_t
+ **/
+ArchiveStatus_t archive_read_object(ArchiveReader_t *reader, const ArchiveObject_t *obj, ArchiveWriteFn_t emit,
+  void *ctx, ArchiveError_t **err);
+
+/* archive_read_object() for a dedup manifest: only the chunks under the object's frames are read */
+ArchiveStatus_t archive_read_dedup_object(ArchiveReader_t *reader, const ArchiveObject_t *obj, ArchiveWriteFn_t emit,
+  void *ctx, ArchiveError_t **err);
+
+/**
+ * archive_restore_object - archive_read_object() into file descriptor @fd
+ * @reader: the reader
+ * @obj: object of the reader's index
+ * @fd: where the stream goes
+ * @err: written error object on failure
+ *
+ * The frames of an uncompressed, unencrypted archive (other than a
+ * dedup manifest) are the stream
+ * itself: into a regular file or a pipe they are moved inside the
+ * kernel, with copy_file_range or splice, and never read into dbeetle.
+ * Return: ArchiveStatus_t
+ **/
+ArchiveStatus_t archive_restore_object(ArchiveReader_t *reader, const ArchiveObject_t *obj, int fd,
+  ArchiveError_t **err);
+
+/* little endian fields of the index */
+void archive_put_le(unsigned char *dst, uint64_t value, int bytes);
+uint64_t archive_get_le(const unsigned char *src, int bytes);
+
+ArchiveError_t *create_archive_error(ArchiveStatus_t code, const char *message);
+void destroy_archive_index(ArchiveIndex_t **index);
+void destroy_archive_reader(ArchiveReader_t **reader);
+void destroy_archive_error(ArchiveError_t **err);
+
+
+#endif /* ___ARCHIVE_H___ */
@@ -0,0 +1,226 @@
+#ifndef ___CDC_H___
+#define ___CDC_H___
+
+// standard library headers
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "archive.h"
+#include "config_parser.h"
+#include "pgwire.h"
+#include "uthash.h"
+
+//macro defs
+#define CDC_HEAD_FILE ("cdc.head")
+#define CDC_OUTPUT_PLUGIN ("test_decoding")
+#define CDC_META_OBJECT ("@cdc")
+#define CDC_CHANGES_OBJECT ("@changes")
+#define CDC_LSN_LEN (24)
+
+/*
+ * ==========================================================
+ * Logical Change Capture
+ * ----------------------------------------------------------
+ * The "logical" `db.incremental_strategy` of PostgreSQL.
+ * Block-level incrementals (incremental.h) still read every
+ * file that was touched; a table with a few hot rows over a
+ * huge cold body is rescanned whole. Here the server itself
+ * hands over the rows that changed, decoded from its WAL
+ * through a logical replication slot, `db.cdc_slot`.
+ *
+ * With `db.incremental_enabled` and this strategy, a backup
+ * is either:
+ *
+ *   full    when CDC_HEAD_FILE under `output_path` is missing
+ *           or names another slot. The slot is (re)created
+ *           on a replication=database connection with
+ *           CDC_OUTPUT_PLUGIN, exporting the snapshot it
+ *           starts decoding after, and the postgres driver
+ *           dumps that very snapshot (`db.snapshot`): no
+ *           change is both in the dump and in a batch, and
+ *           none is in neither. The slot of the chain it
+ *           replaces is dropped once the new head is written.
+ *   batch   otherwise: the changes committed since the head
+ *           up to the server's current WAL position, peeked
+ *           from the slot with a COPY into an archive of two
+ *           objects, CDC_META_OBJECT, a line
+ *
+ *             slot=<slot> full=<full backup> from=<LSN>
+ *             to=<LSN> seq=<n>
+ *
+ *           and CDC_CHANGES_OBJECT, the changes as SQL, one
+ *           statement per line, in commit order:
+ *
+ *             BEGIN;
+ *             UPDATE public.t SET id = 7, note = 'x' WHERE id = 7;
+ *             COMMIT;
+ *
+ * CDC_OUTPUT_PLUGIN prints every change as text, "table s.t:
+ * UPDATE: col[type]:value ...", with the values as SQL
+ * literals; cdc_change_sql() turns each into the statement
+ * that replays it as the batch is captured. UPDATE and DELETE
+ * find their row by the table's replica identity: the old
+ * key the plugin prints when the identity is FULL or the key
+ * changed, else the primary key or REPLICA IDENTITY index
+ * columns out of the new row. A change that cannot be
+ * replayed, such as an UPDATE of a table without a replica
+ * identity, fails the batch rather than going missing from
+ * it.
+ *
+ * The head is a line "<slot> <full backup> <LSN> <seq>",
+ * written through a .partial file renamed in place once the
+ * archive is committed; only then is the slot advanced, so
+ * the server keeps the WAL of every change not safely
+ * stored. A batch first moves the slot to the head, should
+ * the advance after the last one have been lost. A batch
+ * whose head could not be written is captured again by the
+ * next one.
+ *
+ * With `storage.dedup`, whose archives are one stream, a
+ * batch holds the change lines alone.
+ *
+ * `dbeetle restore --archive <batch>` loads the batch's full
+ * backup into `db.uri` (pgload.h), then cdc_replay() runs the
+ * statements of every batch of the chain up to it, in seq
+ * order, one transaction at a time. The batches are found by
+ * their CDC_META_OBJECT under `output_path`; of two with the
+ * same seq, left by a batch whose head was never written,
+ * the one the next batch starts from is taken. Without
+ * their meta, dedup batches are replayed by hand, in order,
+ * from `dbeetle restore --table @changes` with psql.
+ * ==========================================================
+ */
+
+typedef enum {
+  CDC_OK = 0,
+  CDC_CONFIG_ERROR,
+  CDC_CONNECT_ERROR,
+  CDC_QUERY_ERROR,
+  CDC_DUMP_ERROR,
+  CDC_STORAGE_ERROR,
+  CDC_MEMORY_ERROR,
+  CDC_CORRUPT_ERROR
+} CdcStatus_t;
+
+typedef struct CdcError {
+  CdcStatus_t       code;
+  char              message[BUF_LEN_M];
+} CdcError_t;
+
+/* where an incremental chain stands */
+typedef struct CdcHead {
+  char              slot[BUF_LEN_XS];
+  char              full[BUF_LEN_S];    // the full backup it starts from
+  uint64_t          lsn;                // changes up to here are stored
+  uint64_t          seq;                // batches taken since the full backup
+} CdcHead_t;
+
+/* the replica identity of a table, as test_decoding names it */
+typedef struct CdcKey {
+  char              table[BUF_LEN_S];   // schema.table, each part quoted where it needs to be
+  char              *columns;           // the quoted key columns, each NUL-terminated
+  size_t            count;
+  size_t            size;               // bytes used in columns
+  UT_hash_handle    hh;
+} CdcKey_t;
+
+/* a growable text buffer */
+typedef struct CdcText {
+  char              *data;
+  size_t            len;
+  size_t            capacity;
+} CdcText_t;
+
+/* a batch's CDC_META_OBJECT */
+typedef struct CdcMeta {
+  char              slot[BUF_LEN_XS];
+  char              full[BUF_LEN_S];
+  uint64_t          from_lsn;
+  uint64_t          to_lsn;
+  uint64_t          seq;
+} CdcMeta_t;
+
+typedef struct CdcStats {
+  bool              full;
+  uint64_t          from_lsn;
+  uint64_t          to_lsn;
+  uint64_t          bytes;              // of change lines captured
+  uint64_t          seq;
+} CdcStats_t;
+
+
+/* whether backups of @db take the logical strategy */
+bool cdc_selected(const DBConfig_t *db);
+
+/* reads the head under @output_path; 0 on success, 1 when there is none, -1 when it is damaged */
+int cdc_read_head(const char *output_path, CdcHead_t *head);
+/* replaces the head under @output_path; 0 on success */
+int cdc_write_head(const char *output_path, const CdcHead_t *head);
+/* writes @lsn as the server prints it, "16/B374D848" */
+void cdc_format_lsn(uint64_t lsn, char out[CDC_LSN_LEN]);
+
+/**
+ * cdc_backup - takes a full backup that starts a new chain, or the
+ * next batch of changes of the current one
+ * @cfg: application config, `db.snapshot` is set during a full backup
+ * @name: archive name
+ * @stats: written summary, may be NULL
+ * @err: written error object on failure
+ *
+ * The slot is dropped again when a full backup fails.
+ * Return: CdcStatus_t
+ **/
+CdcStatus_t cdc_backup(AppConfig_t *cfg, const char *name, CdcStats_t *stats, CdcError_t **err);
+
+/* a connection to `db.uri`; with @replication a replication=database one, NULL with @message written on failure */
+PgConn_t *cdc_connect(const AppConfig_t *cfg, bool replication, char *message, size_t len);
+
+/* reads the replica identity of every table through @conn into hash @keys; 0 on success */
+int cdc_load_keys(PgConn_t *conn, CdcKey_t **keys);
+
+/* appends @len bytes of @data to @text; 0 on success, -1 on allocation failure */
+int cdc_text_put(CdcText_t *text, const char *data, size_t len);
+
+/**
+ * cdc_change_sql - appends the statement replaying one change to @out
+ * @keys: replica identities, from cdc_load_keys()
+ * @change: a line of test_decoding output, "BEGIN 701", "table s.t:
+ * INSERT: ..." or "COMMIT 701"
+ * @out: where the statement goes, as one line; nothing for a line
+ * with nothing to replay, such as a logical message
+ * @message: written reason on failure
+ * @len: size of @message
+ *
+ * Return: 0 on success, -1 when the change cannot be replayed
+ **/
+int cdc_change_sql(const CdcKey_t *keys, const char *change, CdcText_t *out, char *message, size_t len);
+
+/* reads the CDC_META_OBJECT of @reader; 0 on success, 1 when it has none, -1 when it is damaged */
+int cdc_read_meta(ArchiveReader_t *reader, CdcMeta_t *meta);
+
+/**
+ * cdc_replay - runs the statements of every batch of a chain up to
+ * batch @name against `db.uri`
+ * @cfg: application config
+ * @name: the last batch to replay
+ * @batches: written number of batches replayed, may be NULL
+ * @statements: written number of statements run, may be NULL
+ * @err: written error object on failure
+ *
+ * The full backup of the chain must have been loaded first. A
+ * failed statement rolls back its transaction and ends the replay;
+ * the transactions before it stay.
+ *
+ * Return: CdcStatus_t
+ **/
+CdcStatus_t cdc_replay(AppConfig_t *cfg, const char *name, uint64_t *batches, uint64_t *statements, CdcError_t **err);
+
+CdcError_t *create_cdc_error(CdcStatus_t code, const char *message);
+void destroy_cdc_keys(CdcKey_t **keys);
+void destroy_cdc_error(CdcError_t **err);
+
+
+#endif /* ___CDC_H___ */
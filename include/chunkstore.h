@@ -0,0 +1,199 @@
+#ifndef ___CHUNKSTORE_H___
+#define ___CHUNKSTORE_H___
+
+// standard library headers
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+//internal library headers
+#include "globals.h"
+#include "codec.h"
+
+//macro defs
+#define CHUNK_MIN_SIZE (16 * 1024)
+#define CHUNK_AVG_BITS (16)
+#define CHUNK_AVG_SIZE (1 << CHUNK_AVG_BITS)
+#define CHUNK_MAX_SIZE (256 * 1024)
+#define CHUNK_NORMALIZATION (2)
+#define CHUNK_ID_LEN (32)
+#define CHUNK_GEAR_SEED (0x64626565746c6521ULL)
+#define CHUNKSTORE_DIR ("chunks")
+#define CHUNKSTORE_MAGIC ("DBCHUNK")
+#define CHUNKSTORE_MANIFEST_MAGIC ("DBDEDUP")
+#define CHUNKSTORE_FORMAT_VERSION (1)
+#define CHUNKSTORE_HEADER_LEN (16)
+#define CHUNKSTORE_ENTRY_LEN (CHUNK_ID_LEN + 4)
+#define CHUNKSTORE_TRAILER_LEN (16 + CHUNK_ID_LEN)
+
+/*
+ * ==========================================================
+ * Deduplicating Chunk Store
+ * ----------------------------------------------------------
+ * With `storage.dedup` set, `output_path` becomes a content
+ * addressed repository. The dump stream is cut into chunks by
+ * content (FastCDC: a gear rolling hash, normalized chunking
+ * around CHUNK_AVG_SIZE, cut points never closer than
+ * CHUNK_MIN_SIZE or further than CHUNK_MAX_SIZE), so an edit
+ * only moves the boundaries next to it and the rest of the
+ * stream still cuts into the chunks stored the day before.
+ *
+ * Each chunk is named by its SHA-256 and stored once, as
+ * `chunks/<2 hex>/<62 hex>`, compressed on its own with the
+ * configured codec. A backup writes only the chunks that are
+ * not stored yet; its archive under `output_path` becomes a
+ * manifest listing the chunks in order.
+ *
+ * Cut points depend on every byte before them, so chunking
+ * runs in the sink, in stream order. Chunks are written to a
+ * temporary name and renamed, and the file system is synced
+ * once before the manifest is published, so a crash leaves
+ * at worst unreferenced chunks, never a manifest pointing at
+ * missing ones.
+ *
+ * Layout, all integers little endian:
+ *
+ *   chunk file    "DBCHUNK" | version u8 | codec u8
+ *                 | 3 reserved bytes | raw_len u32
+ *                 | payload (codec block, or raw for codec 0)
+ *   manifest      "DBDEDUP" | version u8 | avg size u32
+ *                 | 4 reserved bytes
+ *                 | entries: chunk id[32] | raw_len u32
+ *                 | chunk count u64 | raw bytes u64
+ *                 | SHA-256 of the entries[32]
+ *                 | archive index (archive.h) of the
+ *                 objects' ranges of the stream
+ * ==========================================================
+ */
+
+typedef enum {
+  CHUNKSTORE_OK = 0,
+  CHUNKSTORE_CONFIG_ERROR,
+  CHUNKSTORE_IO_ERROR,
+  CHUNKSTORE_MEMORY_ERROR,
+  CHUNKSTORE_CORRUPT_ERROR
+} ChunkStoreStatus_t;
+
+typedef struct ChunkStoreError {
+  ChunkStoreStatus_t code;
+  char              message[BUF_LEN_M];
+} ChunkStoreError_t;
+
+/* FastCDC cursor, carried across the blocks of one stream */
+typedef struct Chunker {
+  uint64_t          hash;
+  size_t            pos;          // bytes of the current chunk seen so far
+  uint64_t          mask_s;       // stricter mask below the average size
+  uint64_t          mask_l;       // looser mask above it
+} Chunker_t;
+
+typedef struct ChunkSeen {
+  unsigned char     id[CHUNK_ID_LEN];
+  UT_hash_handle    hh;
+} ChunkSeen_t;
+
+typedef struct ChunkStore {
+  char              root[BUF_LEN];
+  int               dir_fd;
+  const Codec_t     *codec;
+  void              *codec_state;
+  unsigned char     *scratch;
+  size_t            scratch_len;
+  ChunkSeen_t       *seen;        // ids known to be stored, so each is only stat()ed once
+  uint64_t          tmp_seq;
+  uint64_t          chunks;
+  uint64_t          new_chunks;
+  uint64_t          bytes_in;
+  uint64_t          bytes_new;
+  uint64_t          bytes_stored;
+} ChunkStore_t;
+
+
+/* resets @ch to the start of a stream */
+void init_chunker(Chunker_t *ch);
+
+/**
+ * chunker_scan - looks for the next cut point in @data
+ * @ch: the stream's chunker
+ * @data: next bytes of the stream
+ * @len: bytes available
+ * @cut: set when the current chunk ends inside @data
+ *
+ * Return: bytes of @data belonging to the current chunk, all of @len
+ * unless @cut is set
+ **/
+size_t chunker_scan(Chunker_t *ch, const unsigned char *data, size_t len, bool *cut);
+
+/**
+ * init_chunk_store - opens (creating if needed) the chunk store
+ * below @output_path
+ * @output_path: `storage.output_path`
+ * @compression: `storage.compression`, the codec chunks are stored with
+ * @err: written error object on failure
+ *
+ * Return: the store, or NULL on failure
+ **/
+ChunkStore_t *init_chunk_store(const char *output_path, const char *compression, ChunkStoreError_t **err);
+
+/**
+ * chunk_store_put - stores one chunk unless it is already there
+ * @store: the store
+ * @data: the chunk
+ * @len: its length, at most CHUNK_MAX_SIZE
+ * @id: written chunk id
+ *
+ * Return: 1 if the chunk was written, 0 if it was already stored, -1 on error
+ **/
+int chunk_store_put(ChunkStore_t *store, const unsigned char *data, size_t len, unsigned char id[CHUNK_ID_LEN]);
+
+/* reads chunk @id into @dst and checks it against its id; returns its length or -1 */
+ssize_t chunk_store_get(ChunkStore_t *store, const unsigned char id[CHUNK_ID_LEN], unsigned char *dst, size_t cap);
+
+/* makes every chunk written so far durable; 0 on success */
+int chunk_store_sync(ChunkStore_t *store);
+
+void chunk_id_hex(const unsigned char id[CHUNK_ID_LEN], char hex[2 * CHUNK_ID_LEN + 1]);
+
+/* manifest framing, see above */
+size_t chunk_manifest_header(unsigned char *dst);
+void chunk_manifest_entry(unsigned char *dst, const unsigned char id[CHUNK_ID_LEN], uint32_t raw_len);
+void chunk_manifest_trailer(unsigned char *dst, uint64_t count, uint64_t raw_bytes,
+  const unsigned char digest[CHUNK_ID_LEN]);
+
+/* length of the manifest in @fd, @size bytes long, without the archive index behind it */
+uint64_t chunk_manifest_length(int fd, uint64_t size);
+
+/**
+ * chunk_manifest_load - reads the chunk list of a manifest, checked
+ * against its trailer
+ * @fd: the manifest
+ * @ids: written malloc'd chunk ids, CHUNK_ID_LEN bytes each, in order
+ * @ends: written malloc'd offsets in the stream where each chunk ends
+ * @count: written number of chunks
+ *
+ * Return: CHUNKSTORE_OK, CHUNKSTORE_CORRUPT_ERROR for anything but an
+ * intact manifest, or CHUNKSTORE_IO_ERROR / CHUNKSTORE_MEMORY_ERROR
+ **/
+ChunkStoreStatus_t chunk_manifest_load(int fd, unsigned char **ids, uint64_t **ends, uint64_t *count);
+
+/**
+ * chunk_store_restore - writes the stream described by a manifest
+ * @store: the store holding its chunks
+ * @manifest_path: the backup's manifest
+ * @fd: where the stream goes
+ * @err: written error object on failure
+ *
+ * Every chunk is checked against its id and the manifest against its
+ * trailer, so a damaged repository is reported rather than restored.
+ * Return: ChunkStoreStatus_t
+ **/
+ChunkStoreStatus_t chunk_store_restore(ChunkStore_t *store, const char *manifest_path, int fd,
+  ChunkStoreError_t **err);
+
+ChunkStoreError_t *create_chunk_store_error(ChunkStoreStatus_t code, const char *message);
+void destroy_chunk_store(ChunkStore_t **store);
+void destroy_chunk_store_error(ChunkStoreError_t **err);
+
+
+#endif /* ___CHUNKSTORE_H___ */
@@ -0,0 +1,197 @@
+#ifndef ___CIPHER_H___
+#define ___CIPHER_H___
+
+// external library headers
+#include <openssl/evp.h>
+
+// standard library headers
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "codec.h"
+#include "pipeline.h"
+
+//macro defs
+#define CIPHER_KEY_LEN (32)
+#define CIPHER_NONCE_LEN (12)
+#define CIPHER_TAG_LEN (16)
+#define CIPHER_MAGIC ("DBEETLE")
+#define CIPHER_FORMAT_VERSION (1)
+#define CIPHER_FILE_PREFIX_LEN (16)
+#define CIPHER_KEY_ID_LEN (8)
+#define CIPHER_FILE_HEADER_LEN (96)
+#define CIPHER_CHUNK_HEADER_LEN (32)
+#define CIPHER_CHUNK_OVERHEAD (CIPHER_CHUNK_HEADER_LEN + CIPHER_TAG_LEN)
+
+/*
+ * ==========================================================
+ * Archive Encryption
+ * ----------------------------------------------------------
+ * When `storage.encryption_key_path` is set the (compressed)
+ * block stream is sealed in independent AEAD chunks, one per
+ * pipeline block, by an "encrypt" stage running on every
+ * worker. AES-256-GCM is used on CPUs with AES instructions,
+ * ChaCha20-Poly1305 everywhere else; both come from libcrypto.
+ *
+ * Chunks are sealed with a random data key made for each
+ * backup. The key file (the master key) only wraps that data
+ * key in the file header, so rotating the master key rewrites
+ * those 96 bytes (cipher_rewrap_file) and nothing else.
+ *
+ * Layout, all integers little endian:
+ *
+ *   file header   "DBEETLE" | version u8 | cipher u8 | codec u8
+ *                 | 6 reserved bytes
+ *                 | master key id[8] | wrap nonce[12]
+ *                 | wrapped data key[32] | wrap tag[16]
+ *                 | 12 reserved bytes
+ *   chunk header  seq u64 | flags u32 | len u32 | raw_len u32
+ *                 | nonce[12]
+ *   chunk body    len bytes of ciphertext | tag[16]
+ *
+ * Each chunk authenticates the first 16 bytes of the file
+ * header and its own header, so it can be opened on its own
+ * and cannot be re-ordered. A zero-length chunk flagged
+ * CIPHER_CHUNK_END closes the archive; a missing one means
+ * the archive was truncated; its raw_len is the length of
+ * the CIPHER_CHUNK_INDEX chunk right before it (see
+ * archive.h). The data key is unique to the archive, so
+ * nonces are derived from `seq`.
+ *
+ * The master key id is a truncated SHA-256 of the master key,
+ * telling which key an archive needs without revealing it.
+ * The key file holds the 32-byte key, raw or as 64 hex
+ * digits.
+ * ==========================================================
+ */
+
+typedef enum {
+  CIPHER_NONE = 0,
+  CIPHER_AES_256_GCM,
+  CIPHER_CHACHA20_POLY1305
+} CipherId_t;
+
+typedef enum {
+  CIPHER_CHUNK_END = 1 << 16,   // authenticated end of archive, above the PIPE_BUF_* flags
+  CIPHER_CHUNK_INDEX = 1 << 17  // the archive's frame index, see archive.h
+} CipherChunkFlag_t;
+
+typedef struct CipherChunk {
+  uint64_t          seq;
+  uint32_t          flags;
+  uint32_t          len;          // plaintext (= ciphertext) bytes
+  uint32_t          raw_len;      // bytes before compression
+} CipherChunk_t;
+
+typedef struct CipherStage {
+  CipherId_t        id;
+  unsigned char     key[CIPHER_KEY_LEN];    // the backup's data key
+  unsigned char     file_header[CIPHER_FILE_HEADER_LEN];
+  EVP_CIPHER_CTX    **worker_ctx;
+  size_t            workers;      // stage workers, plus one slot for the sink
+} CipherStage_t;
+
+
+/* AES-256-GCM when the CPU has AES instructions, ChaCha20-Poly1305 otherwise */
+CipherId_t cipher_preferred(void);
+const char *cipher_name(CipherId_t id);
+const EVP_CIPHER *cipher_evp(CipherId_t id);
+
+/**
+ * cipher_load_key - reads the key file at `storage.encryption_key_path`
+ * @path: the key file
+ * @key: written key
+ * @message: written error message on failure
+ * @message_len: size of @message
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int cipher_load_key(const char *path, unsigned char key[CIPHER_KEY_LEN], char *message, size_t message_len);
+
+/**
+ * init_cipher_stage - draws a data key for a new archive, wraps it with
+ * the master key and sets up per-worker cipher contexts
+ * @id: the AEAD to seal with
+ * @key: the master key
+ * @codec: codec of the sealed blocks, recorded in the file header
+ * @workers: stage workers; one more context is kept for the sink
+ *
+ * Return: the stage, or NULL on failure
+ **/
+CipherStage_t *init_cipher_stage(CipherId_t id, const unsigned char key[CIPHER_KEY_LEN], CodecId_t codec, size_t workers);
+
+/* the id stored in file headers for @key */
+void cipher_key_id(const unsigned char key[CIPHER_KEY_LEN], unsigned char id[CIPHER_KEY_ID_LEN]);
+
+/**
+ * cipher_wrap_key - seals @data_key into the key fields of @file_header
+ * @master: the master key
+ * @data_key: the archive's data key
+ * @file_header: header with its first CIPHER_FILE_PREFIX_LEN bytes set
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int cipher_wrap_key(const unsigned char master[CIPHER_KEY_LEN], const unsigned char data_key[CIPHER_KEY_LEN],
+  unsigned char *file_header);
+
+/* recovers the data key of an archive, returns -1 for the wrong master key */
+int cipher_unwrap_key(const unsigned char master[CIPHER_KEY_LEN], const unsigned char *file_header,
+  unsigned char data_key[CIPHER_KEY_LEN]);
+
+/**
+ * cipher_rewrap_file - moves an archive to a new master key
+ * @path: the archive
+ * @old_master: the key it is wrapped with now
+ * @new_master: the key to wrap it with
+ * @message: written error message on failure
+ * @message_len: size of @message
+ *
+ * Only the file header is rewritten, in place, with one write.
+ * Return: 0 on success, -1 on failure
+ **/
+int cipher_rewrap_file(const char *path, const unsigned char old_master[CIPHER_KEY_LEN],
+  const unsigned char new_master[CIPHER_KEY_LEN], char *message, size_t message_len);
+
+/**
+ * cipher_seal_chunk - encrypts one block into a chunk
+ * @stage: the cipher stage
+ * @slot: context to use, a worker id or @stage->workers for the sink
+ * @chunk: seq, flags, len and raw_len of the chunk
+ * @src: @chunk->len plaintext bytes
+ * @dst: output area, CIPHER_CHUNK_OVERHEAD bytes larger than the plaintext
+ * @cap: output capacity
+ * @out_len: written chunk length
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int cipher_seal_chunk(CipherStage_t *stage, size_t slot, const CipherChunk_t *chunk,
+  const unsigned char *src, unsigned char *dst, size_t cap, size_t *out_len);
+
+/* validates a file header, returns 0 and its cipher and codec on success */
+int cipher_parse_file_header(const unsigned char *src, size_t len, CipherId_t *id, CodecId_t *codec);
+
+/**
+ * cipher_open_chunk - authenticates and decrypts the chunk at @src
+ * @key: the archive's data key, see cipher_unwrap_key()
+ * @file_header: the archive's file header
+ * @src: start of the chunk
+ * @len: bytes available at @src
+ * @dst: plaintext output
+ * @cap: output capacity
+ * @chunk: written chunk header
+ * @consumed: written length of the chunk at @src
+ *
+ * Return: 0 on success, -1 if the chunk is short, forged or corrupt
+ **/
+int cipher_open_chunk(const unsigned char key[CIPHER_KEY_LEN], const unsigned char *file_header,
+  const unsigned char *src, size_t len, unsigned char *dst, size_t cap,
+  CipherChunk_t *chunk, size_t *consumed);
+
+int cipher_stage_process(void *ctx, PipeBuffer_t *buf, size_t worker_id);
+void destroy_cipher_stage(CipherStage_t **stage);
+
+
+#endif /* ___CIPHER_H___ */
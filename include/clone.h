@@ -0,0 +1,173 @@
+#ifndef ___CLONE_H___
+#define ___CLONE_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <time.h>
+
+//internal library headers
+#include "globals.h"
+#include "config_parser.h"
+#include "engine.h"
+#include "treewalk.h"
+
+//macro defs
+#define CLONE_PARTIAL_SUFFIX (".partial")
+#define CLONE_RANGE_ALIGN (1 << 20)
+#define CLONE_BUFFER (1 << 20)
+
+/*
+ * ==========================================================
+ * Reflink Copies
+ * ----------------------------------------------------------
+ * A physical backup of a directory tree (a data directory,
+ * a snapshot mount, ...) kept as a plain copy of the tree:
+ * `output_path/<name>/`, built as `<name>.partial` and
+ * renamed once every byte is synced.
+ *
+ * Files are not read. Each one is cloned with FICLONE, so on
+ * a copy-on-write file system (XFS with reflink, Btrfs) with
+ * `output_path` on the same file system as the tree, the
+ * copy shares the source's extents: a multi-terabyte data
+ * directory is copied in the time its metadata takes, and
+ * pages only split when the database writes them again.
+ * Elsewhere the bytes are copied by the kernel with
+ * copy_file_range, and only where that is refused too (an
+ * old kernel across file systems) through a buffer of
+ * CLONE_BUFFER bytes. Each method is given up for the run
+ * the first time the file system refuses it.
+ *
+ * The tree is walked in parallel (treewalk.h) on the pool
+ * of the backup engine, and every file is submitted to
+ * that engine as soon as it is found, so a data directory of
+ * hundreds of thousands of segment files is listed and
+ * copied by `runtime.thread_count` workers at once. Files
+ * above `runtime.split_chunk_size` (rounded down to
+ * CLONE_RANGE_ALIGN) are cloned in ranges (FICLONERANGE),
+ * each range a task of its own like the ranges of a big
+ * table. Modes, times and, for root, owners follow the
+ * source; symbolic links are copied as links.
+ *
+ * The copy is taken file by file while the database may be
+ * writing: as with the block-level backups (incremental.h),
+ * a PostgreSQL data directory is only consistent together
+ * with the WAL archived meanwhile (walarchive.h). Clones are
+ * not compressed or encrypted, so `encryption_key_path` and
+ * `remote_target` cannot be used with them.
+ *
+ * `dbeetle clone` backs up `db.data_dir` this way, and
+ * `dbeetle restore` copies a backup back whole when its name
+ * is a directory under `output_path` (clone_backup_exists).
+ * ==========================================================
+ */
+
+typedef enum {
+  CLONE_OK = 0,
+  CLONE_CONFIG_ERROR,
+  CLONE_IO_ERROR,
+  CLONE_MEMORY_ERROR
+} CloneStatus_t;
+
+typedef struct CloneError {
+  CloneStatus_t     code;
+  char              message[BUF_LEN_M];
+} CloneError_t;
+
+typedef struct CloneStats {
+  uint64_t          files;
+  uint64_t          directories;
+  uint64_t          links;
+  uint64_t          bytes;
+  uint64_t          bytes_cloned;   // sharing the source's extents
+  uint64_t          bytes_copied;   // by copy_file_range
+  uint64_t          bytes_buffered; // read and written by dbeetle
+} CloneStats_t;
+
+typedef struct CloneFile {
+  char              *path;          // relative to the tree
+  mode_t            mode;
+  uid_t             uid;
+  gid_t             gid;
+  uint64_t          size;
+  struct timespec   mtime;
+  UT_hash_handle    hh;
+} CloneFile_t;
+
+typedef struct CloneRun {
+  AppConfig_t       *cfg;
+  const char        *from;
+  const char        *to;
+  BackupEngine_t    *engine;        // copies files, its pool walks the tree
+  CloneFile_t       *files;         // as found, a directory before its entries; under @lock
+  uint64_t          range;          // split_chunk_size aligned, 0 when files stay whole
+  bool              reflink;        // cleared once the file system refuses a clone
+  bool              kernel_copy;    // cleared once copy_file_range is refused
+  bool              failed;         // stops the walk and the copies left
+  CloneStats_t      stats;
+  pthread_mutex_t   lock;
+  char              message[BUF_LEN_M];  // the first failure
+} CloneRun_t;
+
+
+/**
+ * clone_range - copies [@offset, @offset + @len) of @src to the same
+ * place in @dst, by the cheapest method the file systems take
+ * @run: the run, its methods and counters
+ * @src: source file
+ * @dst: destination file
+ * @offset: start of the range
+ * @len: length of the range
+ * @whole: the range is the whole file, @dst is still empty
+ *
+ * Return: 0 on success, -1 with errno set
+ **/
+int clone_range(CloneRun_t *run, int src, int dst, uint64_t offset, uint64_t len, bool whole);
+
+/**
+ * clone_tree - copies the tree @from into directory @to
+ * @cfg: application config, `runtime` sizes the work
+ * @from: the tree
+ * @to: where it goes, created; must not exist yet
+ * @stats: written counters, may be NULL
+ * @err: written error object on failure
+ *
+ * Return: CloneStatus_t
+ **/
+CloneStatus_t clone_tree(AppConfig_t *cfg, const char *from, const char *to, CloneStats_t *stats, CloneError_t **err);
+
+/**
+ * clone_backup - backs up @source_dir as `output_path/<name>`
+ * @cfg: application config
+ * @source_dir: directory tree to back up
+ * @name: backup name, a plain file name
+ * @stats: written counters, may be NULL
+ * @err: written error object on failure
+ *
+ * Return: CloneStatus_t
+ **/
+CloneStatus_t clone_backup(AppConfig_t *cfg, const char *source_dir, const char *name, CloneStats_t *stats,
+  CloneError_t **err);
+
+/* true when `output_path/<@name>` is a cloned backup, a directory rather than an archive */
+bool clone_backup_exists(const StorageConfig_t *cfg, const char *name);
+/* copies backup @name back as @target_dir, which must not exist yet; cloned too where it can be */
+CloneStatus_t clone_restore(AppConfig_t *cfg, const char *name, const char *target_dir, CloneStats_t *stats,
+  CloneError_t **err);
+
+int init_clone_run(CloneRun_t *run, AppConfig_t *cfg, const char *from, const char *to);
+/* records file @path of the tree; NULL on allocation failure */
+CloneFile_t *clone_run_add_file(CloneRun_t *run, const char *path, const struct statx *stx);
+/* keeps the first failure, "@what @path: <@error>"; always returns -1 */
+int clone_run_fail(CloneRun_t *run, const char *what, const char *path, int error);
+void destroy_clone_run(CloneRun_t *run);
+
+CloneError_t *create_clone_error(CloneStatus_t code, const char *message);
+void destroy_clone_error(CloneError_t **err);
+
+
+#endif /* ___CLONE_H___ */
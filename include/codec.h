@@ -0,0 +1,120 @@
+#ifndef ___CODEC_H___
+#define ___CODEC_H___
+
+// standard library headers
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "pipeline.h"
+
+//macro defs
+#define CODEC_LEVEL_DEFAULT (-1)
+#define GZIP_DEFAULT_LEVEL (6)
+#define ZSTD_DEFAULT_LEVEL (3)
+#define ZSTD_LONG_WINDOW_LOG (27)
+#define ZSTD_LONG_BLOCK_SIZE (32 << 20)
+#define ZSTD_LONG_BUFFERS (4)
+#define LZ4_DEFAULT_ACCELERATION (1)
+#define LZ4_MAX_ACCELERATION (64)
+#define CODEC_ENTROPY_SAMPLE (64 * 1024)
+#define CODEC_RAW_ENTROPY_BITS (7.5)
+#define CODEC_MIN_GAIN_PERCENT (3)
+
+/*
+ * ==========================================================
+ * Compression Codecs
+ * ----------------------------------------------------------
+ * `storage.compression` is a codec spec of the form
+ * `<name>[:<level>][:long]`, e.g. "gzip", "gzip:9", "zstd:19"
+ * or "zstd:long". `long` (zstd only) turns on long-distance
+ * matching over a 128 MiB window. For "lz4" the level is the
+ * acceleration factor: higher is faster and compresses less.
+ *
+ * Every block is compressed on its own so that the compress
+ * stage can run on all workers at once. Codecs keep per-worker
+ * state (dictionaries, hash tables) between blocks to avoid
+ * re-allocating it for every block.
+ *
+ * Blocks that would not shrink (JPEGs in bytea, already
+ * compressed TOAST values, ...) are stored instead: the byte
+ * entropy of a sample is checked before compressing, and a
+ * trial that saves less than CODEC_MIN_GAIN_PERCENT is thrown
+ * away. Stored blocks use the codec's own uncompressed block
+ * type (deflate stored blocks, zstd raw blocks, LZ4
+ * uncompressed blocks) so the output stays readable by stock
+ * tools, and are flagged PIPE_BUF_RAW.
+ *
+ * In long mode blocks are widened to ZSTD_LONG_BLOCK_SIZE so
+ * matches have room to be found, and the parallelism moves
+ * into zstd: one stage worker, `workers` native zstd threads.
+ * ==========================================================
+ */
+
+typedef enum {
+  CODEC_NONE = 0,
+  CODEC_GZIP,
+  CODEC_ZSTD,
+  CODEC_LZ4
+} CodecId_t;
+
+typedef struct CodecSpec {
+  CodecId_t         id;
+  int               level;
+  bool              long_window;
+  size_t            workers;      // codec-native threads, 0 to compress in the caller
+} CodecSpec_t;
+
+typedef struct Codec {
+  const char        *name;
+  CodecId_t         id;
+  void              *(*create)(const CodecSpec_t *spec);
+  void              (*destroy)(void *state);
+  /* compresses @src into @dst, returns 0 on success */
+  int               (*compress)(void *state, const unsigned char *src, size_t len,
+                                unsigned char *dst, size_t cap, size_t *out_len);
+  /* wraps @src in the codec's uncompressed block type, returns 0 on success */
+  int               (*store)(void *state, const unsigned char *src, size_t len,
+                             unsigned char *dst, size_t cap, size_t *out_len);
+  /* decompresses one block produced by compress() or store(), returns 0 on success */
+  int               (*decompress)(const unsigned char *src, size_t len,
+                                  unsigned char *dst, size_t cap, size_t *out_len);
+} Codec_t;
+
+typedef struct CompressStage {
+  const Codec_t     *codec;
+  CodecSpec_t       spec;
+  void              **worker_state;
+  size_t            workers;
+  uint64_t          blocks;
+  uint64_t          raw_blocks;
+} CompressStage_t;
+
+
+/**
+ * codec_parse_spec - parses a `storage.compression` value
+ * @compression: the configured value
+ * @out: written parsed spec
+ *
+ * Return: 0 on success, -1 for an unknown codec or a bad level
+ **/
+int codec_parse_spec(const char *compression, CodecSpec_t *out);
+
+/* the codec implementation, NULL when it was not compiled in */
+const Codec_t *codec_lookup(CodecId_t id);
+double codec_sample_entropy(const unsigned char *data, size_t len);
+
+CompressStage_t *init_compress_stage(const CodecSpec_t *spec, size_t workers);
+int compress_stage_process(void *ctx, PipeBuffer_t *buf, size_t worker_id);
+void compress_stage_release(void *ctx);
+void destroy_compress_stage(CompressStage_t **stage);
+
+/* gzip stream framing around independently deflated blocks */
+size_t gzip_stream_header(unsigned char *dst, size_t cap);
+size_t gzip_stream_trailer(unsigned char *dst, size_t cap, uint32_t crc, uint64_t raw_len);
+uint32_t gzip_crc_combine(uint32_t crc, uint32_t block_crc, size_t block_len);
+
+
+#endif /* ___CODEC_H___ */
@@ -14,15 +14,24 @@
 #define DEFAULT_DB_URI ("default:db_uri")
 #define DEFAULT_DB_TYPE ("default:type")
 #define DEFAULT_DB_TIMEOUT (1000)
+#define DEFAULT_DB_DRIVER_PATH ("")
+#define DEFAULT_DB_INCREMENTAL_STRATEGY ("blocks")
+#define DEFAULT_DB_CDC_SLOT ("dbeetle")
+#define DEFAULT_DB_WAL_SLOT ("dbeetle_wal")
 
 #define DEFAULT_STORAGE_OUTPUT_PATH ("default:output_path")
 #define DEFAULT_STORAGE_COMPRESSION ("default:compression")
 #define DEFAULT_STORAGE_ENC_KEY_PATH ("default:encryption_key_path")
 #define DEFAULT_STORAGE_REMOTE ("default:remote")
+#define DEFAULT_STORAGE_REMOTE_CONNECTIONS (4)
+#define DEFAULT_STORAGE_DEDUP (0)
+#define DEFAULT_STORAGE_WRITER ("auto")
+#define DEFAULT_STORAGE_DIRECT_IO (0)
 
 #define DEFAULT_RUNTIME_LOG_LEVEL (1)
 #define DEFAULT_RUNTIME_THREAD_COUNT (1)
 #define DEFAULT_RUNTIME_TMP_DIR ("default:tmp_dir")
+#define DEFAULT_RUNTIME_SPLIT_CHUNK_SIZE (256 * 1024 * 1024)
 
 
 typedef struct DBConfig {
@@ -30,6 +39,12 @@ typedef struct DBConfig {
   char             uri[BUF_LEN_S];
   size_t           timeout_seconds;
   size_t           incremental_enabled;
+  char             driver_path[BUF_LEN_S];  // where driver plugins are looked up, "" for the loader's path
+  char             incremental_strategy[BUF_LEN_XS];  // "blocks" or "logical" (cdc.h)
+  char             cdc_slot[BUF_LEN_XS];    // logical replication slot of the "logical" strategy
+  char             wal_slot[BUF_LEN_XS];    // physical replication slot of `dbeetle archive` (walarchive.h)
+  char             snapshot[BUF_LEN_XS];    // exported snapshot a dump reads instead of its own, "" for none
+  char             data_dir[BUF_LEN_S];     // directory tree of physical backups (clone.h, incremental.h), "" for none
 } DBConfig_t;
 
 typedef enum {
@@ -45,16 +60,21 @@ typedef enum {
 } parse_phase_t;
 
 typedef struct storageConfig {
-  char          output_path[BUF_LEN_S];
+  char          output_path[BUF_LEN_S];  // a directory, or "-" for stdout (storage.h)
   char          compression[BUF_LEN_XS];
   char          encryption_key_path[BUF_LEN_S];
   char          remote_target[BUF_LEN_S];
+  size_t        remote_connections;
+  size_t        dedup_enabled;
+  char          writer[BUF_LEN_XS];   // "auto", "uring" or "sync" (uring.h)
+  size_t        direct_io;            // keep the page cache as found (pagecache.h)
 } StorageConfig_t;
 
 typedef struct RuntimeConfig {
   size_t          log_level;
   size_t          thread_count;
   char            temp_dir[BUF_LEN_S];
+  size_t          split_chunk_size;   // tables above this are dumped in ranges, 0 never
 } RuntimeConfig_t;
 
 typedef struct AppConfig {
@@ -0,0 +1,160 @@
+#ifndef ___DRIVER_H___
+#define ___DRIVER_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "config_parser.h"
+#include "engine.h"
+#include "pipeline.h"
+#include "storage.h"
+
+//macro defs
+#define DRIVER_ABI_VERSION (1)
+#define DRIVER_SYMBOL ("dbeetle_driver")
+#define DRIVER_PLUGIN_FORMAT ("libdbeetle_%s.so")
+
+/*
+ * ==========================================================
+ * Database Drivers
+ * ----------------------------------------------------------
+ * `db.type` picks the driver a backup reads the database
+ * with. A driver only knows its database: it opens a session,
+ * lists the objects to dump and streams one object (or one
+ * part of it) when asked. Everything else is shared: the
+ * engine orders the objects largest first on the work-stealing
+ * pool, and each stream goes through the same compress,
+ * encrypt and storage stages into one archive object.
+ *
+ * Streams hand out room inside the pipeline's blocks
+ * (reserve/commit), so a driver whose database has a native
+ * bulk export can read it straight into them; write() copies
+ * for the others. stream() is called from `runtime.thread_count`
+ * workers at once, worker_id telling which one; a driver keeps
+ * per-worker connections in its session.
+ *
+ * The built-in drivers are matched first (postgres, sqlite).
+ * Any other type is loaded as a plugin: DRIVER_PLUGIN_FORMAT
+ * ("libdbeetle_<type>.so") from `db.driver_path`, or from the
+ * dynamic loader's search path when that is empty, exporting
+ * a Driver_t named DRIVER_SYMBOL ("dbeetle_driver") built
+ * against this DRIVER_ABI_VERSION. Plugins only call back
+ * through the Driver* types below, so they need not link
+ * against dbeetle.
+ *
+ * Driver calls return 0 or a status code of the driver's own,
+ * with a message written to @message; the code is kept in
+ * DriverError_t.driver_code.
+ * ==========================================================
+ */
+
+typedef enum {
+  DRIVER_OK = 0,
+  DRIVER_CONFIG_ERROR,
+  DRIVER_LOAD_ERROR,
+  DRIVER_OPEN_ERROR,
+  DRIVER_MEMORY_ERROR,
+  DRIVER_DUMP_ERROR
+} DriverStatus_t;
+
+typedef struct DriverError {
+  DriverStatus_t    code;
+  int               driver_code;        // what the driver returned, 0 when it did not fail
+  char              message[BUF_LEN_M];
+} DriverError_t;
+
+/* where a stream goes: one archive object */
+typedef struct DriverStream {
+  void              *ctx;
+  /* room for at least one byte, its size in @room; NULL on failure */
+  unsigned char     *(*reserve)(void *ctx, size_t *room);
+  /* the first @len bytes of the last room are written, returns 0 on success */
+  int               (*commit)(void *ctx, size_t len);
+  /* copies @len bytes in, returns 0 on success */
+  int               (*write)(void *ctx, const void *data, size_t len);
+} DriverStream_t;
+
+/* adds object @name to the backup, dumped in @parts parts (1 when whole); returns 0 on success */
+typedef int (*DriverAddFn_t)(void *ctx, const char *name, uint32_t parts);
+
+typedef struct Driver {
+  uint32_t          abi_version;
+  const char        *name;
+  /* true when the driver reads @db, NULL to answer only to its name */
+  bool              (*supports)(const DBConfig_t *db);
+  /* connects or opens the database, for @workers concurrent streams */
+  int               (*open)(AppConfig_t *cfg, size_t workers, void **session, char *message, size_t len);
+  /* calls @add for every object to dump */
+  int               (*list)(void *session, DriverAddFn_t add, void *ctx, char *message, size_t len);
+  /* bytes object @name is expected to dump, 0 when unknown; may be NULL */
+  uint64_t          (*estimate)(void *session, const char *name);
+  /* dumps part @part of object @name into @out, on worker @worker_id */
+  int               (*stream)(void *session, const char *name, uint32_t part, size_t worker_id,
+                              const DriverStream_t *out, char *message, size_t len);
+  /* ends the session, whatever state it is in */
+  void              (*close)(void *session);
+} Driver_t;
+
+/* a driver resolved for `db.type` */
+typedef struct DriverHandle {
+  const Driver_t    *driver;
+  void              *library;           // dlopen() handle of a plugin, NULL for built-ins
+} DriverHandle_t;
+
+/* the state of driver_backup() while the engine runs */
+typedef struct DriverRun {
+  const Driver_t    *driver;
+  void              *session;
+  BackupEngine_t    *engine;
+  Pipeline_t        *pipe;
+  StorageSink_t     *sink;
+  uint32_t          next_object_id;
+  int               driver_code;        // of the first failed stream
+  char              first_error[BUF_LEN_M];
+  pthread_mutex_t   lock;
+} DriverRun_t;
+
+
+/**
+ * driver_find - resolves the driver of @db, loading its plugin when it
+ * is not built in
+ * @db: database config
+ * @handle: written resolved driver
+ * @err: written error object on failure
+ *
+ * Return: DriverStatus_t, DRIVER_LOAD_ERROR when no driver reads @db
+ **/
+DriverStatus_t driver_find(const DBConfig_t *db, DriverHandle_t *handle, DriverError_t **err);
+/* unloads the plugin of @handle, if any */
+void driver_release(DriverHandle_t *handle);
+
+/* a stream writing into @writer */
+void driver_pipe_stream(DriverStream_t *out, PipeWriter_t *writer);
+
+/**
+ * driver_backup - dumps everything @driver lists into archive
+ * @backup_name under `storage.output_path`
+ * @driver: the driver
+ * @cfg: application config
+ * @backup_name: archive file name
+ * @err: written error object on failure
+ *
+ * The archive is only committed when every object was dumped, and not
+ * created at all when the driver cannot open the database.
+ * Return: DriverStatus_t
+ **/
+DriverStatus_t driver_backup(const Driver_t *driver, AppConfig_t *cfg, const char *backup_name, DriverError_t **err);
+
+/* driver_find() then driver_backup() for `db.type` */
+DriverStatus_t driver_run_backup(AppConfig_t *cfg, const char *backup_name, DriverError_t **err);
+
+DriverError_t *create_driver_error(DriverStatus_t code, int driver_code, const char *message);
+void destroy_driver_error(DriverError_t **err);
+
+
+#endif /* ___DRIVER_H___ */
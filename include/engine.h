@@ -0,0 +1,111 @@
+#ifndef ___ENGINE_H___
+#define ___ENGINE_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+//internal library headers
+#include "globals.h"
+#include "config_parser.h"
+#include "scheduler.h"
+
+/*
+ * ==========================================================
+ * Backup Engine
+ * ----------------------------------------------------------
+ * Drives a backup run: collects the objects (tables, ...) to
+ * dump, orders them largest first and hands one task per
+ * object to a work-stealing pool of `runtime.thread_count`
+ * workers. Big objects start early, and whatever is left in
+ * a busy worker's deque is stolen by the ones that finished.
+ *
+ * An object too big for one worker is added as several parts
+ * (engine_add_part()), each dumped as a task of its own; the
+ * dump callback decides what range a part covers.
+ *
+ * Objects not known up front, the files of a tree still being
+ * walked, are submitted to a started run instead
+ * (engine_start(), engine_submit()): they run in the order
+ * they come, next to the tasks that found them.
+ * ==========================================================
+ */
+
+typedef struct DumpObject {
+  char              name[BUF_LEN_S];
+  size_t            estimated_bytes;
+  uint32_t          part;           // range of a split object, 0 of 1 when whole
+  uint32_t          parts;
+} DumpObject_t;
+
+/* dumps a single object; returns 0 on success */
+typedef int (*DumpObjectFn_t)(const DumpObject_t *obj, size_t worker_id, void *ctx);
+
+typedef enum {
+  ENGINE_OK = 0,
+  ENGINE_MEMORY_ERROR,
+  ENGINE_THREAD_ERROR,
+  ENGINE_DUMP_ERROR
+} EngineStatus_t;
+
+typedef struct EngineError {
+  EngineStatus_t    code;
+  char              message[BUF_LEN_M];
+} EngineError_t;
+
+typedef struct BackupEngine {
+  AppConfig_t       *cfg;
+  Scheduler_t       *sched;
+  DumpObject_t      *objects;
+  size_t            object_count;
+  size_t            object_capacity;
+  DumpObjectFn_t    dump;
+  void              *dump_ctx;
+  size_t            failed;
+  char              first_failure[BUF_LEN_S];
+  pthread_mutex_t   lock;
+} BackupEngine_t;
+
+
+BackupEngine_t *init_backup_engine(AppConfig_t *cfg);
+void engine_add_object(BackupEngine_t *engine, const char *name, size_t estimated_bytes);
+/* adds part @part of @parts of object @name, @estimated_bytes being the part's share */
+void engine_add_part(BackupEngine_t *engine, const char *name, size_t estimated_bytes, uint32_t part, uint32_t parts);
+
+/**
+ * engine_run - dumps every registered object on the worker pool
+ * @engine: the engine
+ * @dump: per-object dump callback, called concurrently from workers
+ * @ctx: opaque pointer passed to @dump
+ * @err: written error object on failure
+ *
+ * Return: EngineStatus_t
+ **/
+EngineStatus_t engine_run(BackupEngine_t *engine, DumpObjectFn_t dump, void *ctx, EngineError_t **err);
+
+/**
+ * engine_start - starts a run of objects submitted as they are found
+ * @engine: the engine
+ * @dump: per-object dump callback, called concurrently from workers
+ * @ctx: opaque pointer passed to @dump
+ * @err: written error object on failure
+ *
+ * Objects are then queued with engine_submit, from any thread, in no
+ * particular order; engine_wait ends the run. The pool is the one
+ * engine_run uses, other work can be submitted to @engine->sched.
+ * Return: EngineStatus_t
+ **/
+EngineStatus_t engine_start(BackupEngine_t *engine, DumpObjectFn_t dump, void *ctx, EngineError_t **err);
+/* queues part @part of @parts of object @name on a started run; from a worker, on that worker's deque */
+EngineStatus_t engine_submit(BackupEngine_t *engine, const char *name, size_t estimated_bytes, uint32_t part,
+  uint32_t parts);
+/* waits for every task on the pool, submitted objects and whatever else; the run's outcome */
+EngineStatus_t engine_wait(BackupEngine_t *engine, EngineError_t **err);
+
+EngineError_t *create_engine_error(EngineStatus_t code, const char *message);
+void destroy_backup_engine(BackupEngine_t **engine);
+void destroy_engine_error(EngineError_t **err);
+
+
+#endif /* ___ENGINE_H___ */
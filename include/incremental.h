@@ -0,0 +1,290 @@
+#ifndef ___INCREMENTAL_H___
+#define ___INCREMENTAL_H___
+
+// standard library headers
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "codec.h"
+#include "config_parser.h"
+#include "pgwire.h"
+
+//macro defs
+#define INCR_BLOCK_SIZE (64 * 1024)
+#define INCR_HASH_LEN (16)
+#define INCR_MAGIC ("DBINCRM")
+#define INCR_BLOCKS_MAGIC ("DBBLOCK")
+#define INCR_FORMAT_VERSION (1)
+#define INCR_HEADER_LEN (16)
+#define INCR_DIGEST_LEN (32)
+#define INCR_STORED_RAW (1u << 31)
+#define INCR_MANIFEST_SUFFIX (".manifest")
+#define INCR_BLOCKS_SUFFIX (".blocks")
+#define INCR_HEAD_FILE ("incremental.head")
+#define INCR_STAGE_SUFFIX (".stage")
+#define INCR_SLOT_PREFIX ("dbeetle_incr_")
+#define INCR_MIN_SERVER_VERSION (100000)
+
+/*
+ * ==========================================================
+ * Block-level Incrementals
+ * ----------------------------------------------------------
+ * A physical backup of a directory tree (a data directory,
+ * a snapshot mount, ...) split into INCR_BLOCK_SIZE blocks.
+ * Every backup writes two files under `output_path`:
+ *
+ *   <name>.blocks    the blocks this backup had to store, each
+ *                    compressed on its own with the configured
+ *                    codec (or raw, when that does not pay)
+ *   <name>.manifest  every file of the tree and, for each of
+ *                    its blocks, a hash and where the block
+ *                    lives: which backup of the chain, at what
+ *                    offset of that backup's .blocks file
+ *
+ * With `db.incremental_enabled` set, a backup starts from the
+ * manifest of the last one (named by `incremental.head`):
+ * files whose size and mtime did not change are not read at
+ * all, and changed files are read but only the blocks whose
+ * hash differs are stored. Write I/O follows the churn, read
+ * I/O the files that were touched. Without a parent, or with
+ * the option off, the backup is a full one and starts a new
+ * chain.
+ *
+ * Manifests are complete maps, so a restore reads each block
+ * straight from the backup that holds it instead of replaying
+ * the chain. The head is only moved once the new manifest is
+ * durable.
+ *
+ * The tree is walked in parallel (treewalk.h) on the pool of
+ * a backup engine, and each changed file is read, hashed and
+ * compressed there as soon as it is found, on
+ * `runtime.thread_count` workers; only appending a block to
+ * the .blocks file is serialised.
+ *
+ * `dbeetle backup` takes this strategy when `db.data_dir` is
+ * set, `db.incremental_enabled` is set and
+ * `db.incremental_strategy` is `blocks` (the defaults); without
+ * `db.data_dir` it dumps through the driver as before.
+ * `dbeetle restore` rebuilds a backup whose manifest it finds
+ * under `output_path`.
+ *
+ * A tree is copied as it is found, so it has to hold still:
+ * a stopped server's data directory or a snapshot mount.
+ * Without a PostgreSQL `db.uri`, a tree whose postmaster.pid
+ * names a server running in it is refused, and a file whose
+ * size changes under the copy fails the backup.
+ *
+ * With a PostgreSQL `db.uri` (10 or later), `db.data_dir` is
+ * taken to be that server's live data directory and the copy
+ * is taken in backup mode, as pg_basebackup does:
+ *
+ *   1. a replication connection creates a temporary physical
+ *      slot reserving WAL, so none of the copy window is
+ *      recycled before it is fetched
+ *   2. pg_backup_start() (pg_start_backup() before 15) on a
+ *      session of its own
+ *   3. the tree is copied, leaving out postmaster.pid, an old
+ *      backup_label and the contents of pg_wal, pg_replslot
+ *      and the other directories the server rebuilds; a file
+ *      is read up to the size it had when it was listed,
+ *      zero-filled if it shrank and left out if it vanished,
+ *      WAL replay puts those right
+ *   4. pg_backup_stop() returns backup_label and
+ *      tablespace_map, and the WAL from the segment backup
+ *      mode started in up to its stop point is streamed from
+ *      the slot, each segment zero-filled to full size
+ *
+ * and backup_label, tablespace_map and pg_wal/<segment> are
+ * stored in the backup like any other file, staged in
+ * `<name>.stage` under `runtime.tmp_dir` (or `output_path`)
+ * meanwhile. A restored tree then starts by replaying that
+ * WAL up to consistency, with no restore_command needed.
+ * Tablespaces outside the data directory are not copied.
+ *
+ * With `storage.direct_io` the blocks a backup reads leave
+ * the page cache as they found it and the .blocks file is
+ * evicted as it is written (see pagecache.h).
+ *
+ * Manifest layout, all integers little endian:
+ *
+ *   header        "DBINCRM" | version u8 | block size u32
+ *                 | chain length u32
+ *   chain         per backup, oldest first: name len u16 | name
+ *   files         path len u16 | path | mode u32 | size u64
+ *                 | mtime ns i64 | per block: hash[16]
+ *                 | generation u32 | stored len u32 | offset u64
+ *   trailer       0 u16 | file count u64 | SHA-256 of all
+ *                 the bytes before it[32]
+ *
+ * A block's generation is its backup's index in the chain;
+ * the top bit of the stored length marks a raw block.
+ * ==========================================================
+ */
+
+typedef enum {
+  INCR_OK = 0,
+  INCR_CONFIG_ERROR,
+  INCR_IO_ERROR,
+  INCR_MEMORY_ERROR,
+  INCR_CORRUPT_ERROR
+} IncrStatus_t;
+
+typedef struct IncrError {
+  IncrStatus_t      code;
+  char              message[BUF_LEN_M];
+} IncrError_t;
+
+typedef struct IncrBlock {
+  unsigned char     hash[INCR_HASH_LEN];
+  uint32_t          generation;
+  uint32_t          stored_len;     // INCR_STORED_RAW set for raw blocks
+  uint64_t          offset;
+} IncrBlock_t;
+
+typedef struct IncrFile {
+  char              *path;          // relative to the backed up directory
+  uint32_t          mode;
+  uint64_t          size;
+  int64_t           mtime_ns;
+  IncrBlock_t       *blocks;
+  uint64_t          block_count;
+  UT_hash_handle    hh;
+} IncrFile_t;
+
+typedef struct IncrManifest {
+  uint32_t          block_size;
+  char              (*chain)[BUF_LEN_S];  // backup names, the full backup first
+  uint32_t          chain_len;
+  IncrFile_t        *files;
+  uint64_t          file_count;
+} IncrManifest_t;
+
+/* a copy of a live data directory in backup mode */
+typedef struct IncrBracket {
+  PgConn_t          *conn;          // the session holding backup mode
+  PgConn_t          *wal;           // WAL sender owning the temporary slot
+  char              slot[BUF_LEN_XS];
+  uint32_t          timeline;
+  uint32_t          segment_size;
+  uint64_t          start_lsn;
+  uint64_t          stop_lsn;
+  char              *label;         // backup_label, from pg_backup_stop()
+  char              *tablespace_map;  // "" without tablespaces
+} IncrBracket_t;
+
+typedef struct IncrStats {
+  uint32_t          generation;     // 0 for a full backup
+  uint64_t          files;
+  uint64_t          files_unchanged;
+  uint64_t          blocks;
+  uint64_t          blocks_written;
+  uint64_t          bytes_read;
+  uint64_t          bytes_written;
+} IncrStats_t;
+
+
+IncrManifest_t *init_incr_manifest(uint32_t block_size);
+/* appends @name to the chain; returns its generation, or -1 */
+int incr_manifest_push_chain(IncrManifest_t *m, const char *name);
+/* adds a file record with room for its blocks; NULL on allocation failure */
+IncrFile_t *incr_manifest_add_file(IncrManifest_t *m, const char *path, uint32_t mode, uint64_t size, int64_t mtime_ns);
+
+/* takes @file out of @m and frees it */
+void incr_manifest_remove_file(IncrManifest_t *m, IncrFile_t *file);
+
+/**
+ * incr_manifest_save - writes @m to @path (through a .partial file,
+ * fsynced and renamed)
+ * @m: the manifest
+ * @path: where it goes
+ *
+ * Return: 0 on success, -1 with errno set
+ **/
+int incr_manifest_save(const IncrManifest_t *m, const char *path);
+
+/* reads a manifest, checking it against its trailer; NULL with @message written on failure */
+IncrManifest_t *incr_manifest_load(const char *path, char *message, size_t message_len);
+
+/**
+ * incremental_backup - backs up @source_dir as backup @name
+ * @cfg: application config; `db.incremental_enabled` picks the parent,
+ * `runtime.thread_count` walks the tree and reads the changed files,
+ * a PostgreSQL `db.uri` copies it in backup mode (see above)
+ * @source_dir: directory tree to back up
+ * @name: backup name, a plain file name
+ * @stats: written counters, may be NULL
+ * @err: written error object on failure
+ *
+ * Return: IncrStatus_t
+ **/
+IncrStatus_t incremental_backup(AppConfig_t *cfg, const char *source_dir, const char *name,
+  IncrStats_t *stats, IncrError_t **err);
+
+/**
+ * incremental_restore - rebuilds the tree of backup @name in @target_dir
+ * @cfg: storage section holding the backups
+ * @name: backup to restore, full or incremental
+ * @target_dir: where the tree is written, created if needed
+ * @err: written error object on failure
+ *
+ * Every block is checked against its hash before it is written.
+ * Return: IncrStatus_t
+ **/
+IncrStatus_t incremental_restore(const StorageConfig_t *cfg, const char *name, const char *target_dir,
+  IncrError_t **err);
+
+/**
+ * incr_bracket_start - puts the server at `db.uri` in backup mode
+ * @b: zeroed bracket, written
+ * @cfg: application config
+ * @name: backup name, the label
+ * @message: written reason on failure
+ * @len: size of @message
+ *
+ * Return: IncrStatus_t; incr_bracket_close() either way
+ **/
+IncrStatus_t incr_bracket_start(IncrBracket_t *b, const AppConfig_t *cfg, const char *name, char *message,
+  size_t len);
+
+/**
+ * incr_bracket_stop - ends backup mode and stages what the copy needs
+ * to be restorable
+ * @b: bracket of incr_bracket_start()
+ * @stage: existing empty directory, receives backup_label,
+ * tablespace_map and pg_wal/<segment> files
+ * @message: written reason on failure
+ * @len: size of @message
+ *
+ * Return: IncrStatus_t
+ **/
+IncrStatus_t incr_bracket_stop(IncrBracket_t *b, const char *stage, char *message, size_t len);
+
+/* closes the bracket's connections: backup mode, if still on, is aborted and the slot dropped */
+void incr_bracket_close(IncrBracket_t *b);
+/* whether a copy in backup mode leaves out file @path, relative to the data directory */
+bool incr_live_excluded(const char *path);
+/* whether a copy in backup mode keeps directory @path but none of its contents */
+bool incr_live_emptied(const char *path);
+/* the pid of a server running in data directory @root, as its postmaster.pid says; 0 for none */
+long incr_live_server(const char *root);
+/* removes a stage directory of incr_bracket_stop() */
+void incr_stage_remove(const char *stage);
+
+/* whether backups of @db take the block strategy: enabled, `blocks` and `db.data_dir` set */
+bool incremental_selected(const DBConfig_t *db);
+/* true when `output_path` holds the manifest of block-level backup @name */
+bool incremental_backup_exists(const StorageConfig_t *cfg, const char *name);
+
+/* the first INCR_HASH_LEN bytes of the block's SHA-256; 0 on success */
+int incr_block_hash(const unsigned char *data, size_t len, unsigned char hash[INCR_HASH_LEN]);
+int incr_write_all(int fd, const unsigned char *data, size_t len);
+
+IncrError_t *create_incr_error(IncrStatus_t code, const char *message);
+void destroy_incr_manifest(IncrManifest_t **m);
+void destroy_incr_error(IncrError_t **err);
+
+
+#endif /* ___INCREMENTAL_H___ */
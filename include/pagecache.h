@@ -0,0 +1,75 @@
+#ifndef ___PAGECACHE_H___
+#define ___PAGECACHE_H___
+
+// standard library headers
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+
+//macro defs
+#define PAGECACHE_WRITE_BEHIND (8 << 20)
+
+/*
+ * ==========================================================
+ * Page Cache Neutrality
+ * ----------------------------------------------------------
+ * With `storage.direct_io` a backup tries to leave the page
+ * cache of the database host as it found it: dbeetle reads
+ * every page of the database once and will not read it again
+ * soon, so whatever it brings into the cache only pushes out
+ * pages the database itself is about to need.
+ *
+ * Reads are bracketed: before a file is read,
+ * pagecache_probe notes with mincore(2) which of its pages
+ * are already cached; as ranges of it are consumed,
+ * pagecache_drop evicts those that were not with
+ * POSIX_FADV_DONTNEED. Pages that were cached before are the
+ * database's working set and stay where they are. The probe
+ * covers the whole file up front, as the read-ahead of one
+ * range would otherwise pass for cached in the next. Dropping
+ * from a mapping first takes the pages out of it
+ * (MADV_DONTNEED), as a page still mapped is not evicted.
+ *
+ * Writes that cannot bypass the cache with O_DIRECT are
+ * pushed out behind the writer every PAGECACHE_WRITE_BEHIND
+ * bytes (pagecache_write_behind), so the cache holds at most
+ * that much of a backup at any time.
+ * ==========================================================
+ */
+
+typedef struct PageCache {
+  unsigned char     *resident;          // one byte per page of the probed range, from mincore
+  size_t            capacity;
+  size_t            pages;              // of the probed range, 0 when nothing is probed
+  int               fd;
+  uint64_t          offset;             // file offset of the first page
+} PageCache_t;
+
+
+void init_page_cache(PageCache_t *cache);
+
+/**
+ * pagecache_probe - notes which pages of a range of a file are cached,
+ * before any of them is read
+ * @cache: the probe, replacing any earlier one
+ * @fd: the file
+ * @map: a mapping of @fd from offset 0, or NULL to map the range briefly
+ * @offset: start of the range in the file
+ * @len: length of the range
+ *
+ * Return: 0 on success, -1 when residency is unknown (nothing is dropped)
+ **/
+int pagecache_probe(PageCache_t *cache, int fd, const unsigned char *map, uint64_t offset, size_t len);
+/* evicts the pages of [@offset, @offset + @len) that were not cached at the probe; @map as current */
+void pagecache_drop(PageCache_t *cache, const unsigned char *map, uint64_t offset, size_t len);
+
+/* writes back and evicts [@from, @to) of @fd, pages written without O_DIRECT */
+void pagecache_write_behind(int fd, uint64_t from, uint64_t to);
+
+void destroy_page_cache(PageCache_t *cache);
+
+
+#endif /* ___PAGECACHE_H___ */
@@ -0,0 +1,192 @@
+#ifndef ___PGDUMP_H___
+#define ___PGDUMP_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "config_parser.h"
+#include "engine.h"
+#include "driver.h"
+#include "pgwire.h"
+#include "pipeline.h"
+#include "storage.h"
+#include "uthash.h"
+
+//macro defs
+#define PGDUMP_SNAPSHOT_LEN (BUF_LEN_XS)
+#define PGDUMP_LOCK_BATCH (256)
+#define PGDUMP_MAX_PARTS (1024)
+#define PGDUMP_MIN_CTID_VERSION (140000)
+#define PGDUMP_COPY_OPTIONS "(FORMAT binary)"
+#define PGDUMP_COPY_SIGNATURE ("PGCOPY\n\377\r\n")
+#define PGDUMP_COPY_HEADER_LEN (19)     // signature, flags, extension length
+#define PGDUMP_COPY_TRAILER_LEN (2)
+
+/*
+ * ==========================================================
+ * PostgreSQL Dump
+ * ----------------------------------------------------------
+ * Parallel workers only make a consistent backup if they all
+ * read the database as of one instant. Like `pg_dump -j`, a
+ * coordinator connection opens a REPEATABLE READ, READ ONLY
+ * transaction, exports its snapshot with
+ * pg_export_snapshot(), lists the tables and takes ACCESS
+ * SHARE locks on them so their definitions cannot change.
+ * Each of the `runtime.thread_count` worker connections then
+ * begins its own transaction with
+ *
+ *   SET TRANSACTION SNAPSHOT '<exported id>'
+ *
+ * and sees exactly the rows the coordinator sees, whatever
+ * commits in between. The coordinator's transaction stays
+ * open until the last table is dumped: an exported snapshot
+ * can only be imported while its exporter is alive. With
+ * `db.snapshot` set, the coordinator first imports that
+ * snapshot and re-exports it, so the dump reads the database
+ * as of the instant another session captured, such as the
+ * creation of the replication slot of an incremental chain
+ * (cdc.h).
+ *
+ * This is the postgres driver (see driver.h). Worker i dumps
+ * on connection i, so tables are streamed with
+ * `COPY ... TO STDOUT (FORMAT binary)` straight into the
+ * storage pipeline, one archive object per table named
+ * "schema.table". The binary format spares the server the
+ * text output functions and the stream is read off the
+ * socket into the pipeline's blocks (pg_copy_out_direct).
+ * It loads back with `COPY ... FROM STDIN (FORMAT binary)`
+ * into a server of the same major version. Index and
+ * constraint definitions go into the post-data object the
+ * restore engine replays last.
+ *
+ * A table bigger than `runtime.split_chunk_size` would keep
+ * one worker busy long after the others ran dry, so it is
+ * cut into that many ranges, up to PGDUMP_MAX_PARTS, each
+ * dumped by whichever worker is free:
+ *
+ *   key     an integer single-column primary key, its
+ *           [min, max] cut into equal spans
+ *   ctid    otherwise heap blocks, which PostgreSQL 14 and
+ *           later scan by range (TID Range Scan); older
+ *           servers would read the whole table per range,
+ *           so their tables without such a key stay whole
+ *
+ * Every range is a complete COPY stream stored as an object
+ * of the table's name, see archive_find_next_object(). All
+ * ranges read the same snapshot, so together they hold each
+ * row exactly once. PgDumpJoin_t glues them back into one
+ * stream, dropping the headers and trailers in between.
+ *
+ * Used when `db.type` is "postgres" or "postgresql", or left
+ * unset with a postgres:// `db.uri`.
+ * ==========================================================
+ */
+
+typedef enum {
+  PGDUMP_OK = 0,
+  PGDUMP_CONFIG_ERROR,
+  PGDUMP_CONNECT_ERROR,
+  PGDUMP_SNAPSHOT_ERROR,
+  PGDUMP_QUERY_ERROR,
+  PGDUMP_MEMORY_ERROR,
+  PGDUMP_DUMP_ERROR
+} PgDumpStatus_t;
+
+/* joins the binary COPY streams of a split table's parts into one */
+typedef struct PgDumpJoin {
+  PgCopyFn_t        emit;
+  void              *ctx;
+  bool              first;          // the current part keeps its header
+  bool              last;           // and its trailer
+  unsigned char     header[PGDUMP_COPY_HEADER_LEN];
+  size_t            header_len;
+  uint64_t          skip;           // header extension bytes still to drop
+  unsigned char     trailer[PGDUMP_COPY_TRAILER_LEN];
+  size_t            trailer_len;    // the part's last bytes, held back
+} PgDumpJoin_t;
+
+typedef struct PgDumpError {
+  PgDumpStatus_t    code;
+  char              message[BUF_LEN_M];
+} PgDumpError_t;
+
+typedef enum {
+  PGDUMP_SPLIT_NONE = 0,
+  PGDUMP_SPLIT_KEY,
+  PGDUMP_SPLIT_CTID
+} PgDumpSplit_t;
+
+typedef struct PgDumpTable {
+  char              name[BUF_LEN_S];    // schema.table, the archive object name
+  char              quoted[BUF_LEN_M];  // "schema"."table", for statements
+  size_t            estimated_bytes;
+  PgDumpSplit_t     split;
+  uint32_t          parts;
+  char              key[BUF_LEN_S];     // quoted key column, PGDUMP_SPLIT_KEY
+  int64_t           key_min;
+  uint64_t          span;               // keys from key_min, or heap blocks
+  char              *columns;           // select list of a split table
+  UT_hash_handle    hh;
+} PgDumpTable_t;
+
+typedef struct PgDumpSession {
+  AppConfig_t       *cfg;
+  PgConn_t          *coordinator;       // holds the exported snapshot open
+  PgConn_t          **workers;          // one per scheduler worker
+  size_t            worker_count;
+  char              snapshot[PGDUMP_SNAPSHOT_LEN];
+  PgDumpTable_t     *tables;            // hash by name
+  size_t            table_count;
+  uint64_t          bytes_dumped;
+} PgDumpSession_t;
+
+
+/* true when @db names a PostgreSQL database */
+bool pgdump_supported(const DBConfig_t *db);
+
+/**
+ * init_pgdump_session - exports a snapshot and opens the worker
+ * connections that import it
+ * @cfg: application config; `db.uri` and `runtime.thread_count`
+ * @err: written error object on failure
+ *
+ * Return: the session, with every table listed and locked, or NULL
+ **/
+PgDumpSession_t *init_pgdump_session(AppConfig_t *cfg, PgDumpError_t **err);
+
+/* the COPY statement dumping part @part of @table; malloc'ed, NULL on failure */
+char *pgdump_copy_sql(const PgDumpTable_t *table, uint32_t part);
+
+/* starts the next part of a joined stream going to @emit; the @first keeps its header, the @last its trailer */
+void pgdump_join_part(PgDumpJoin_t *join, PgCopyFn_t emit, void *ctx, bool first, bool last);
+/* PgCopyFn_t taking the bytes of the current part */
+int pgdump_join_write(void *ctx, const unsigned char *data, size_t len);
+/* ends the current part; 0 when it was a well-formed binary COPY stream */
+int pgdump_join_end(PgDumpJoin_t *join);
+
+/* streams the post-data statements into @out; a PgDumpStatus_t */
+int pgdump_post_data(PgDumpSession_t *session, const DriverStream_t *out, char *message, size_t len);
+
+/**
+ * pgdump_backup - takes a complete backup of `db.uri` into archive
+ * @backup_name under `storage.output_path`, driver_backup() with the
+ * postgres driver
+ * @cfg: application config
+ * @backup_name: archive file name
+ * @err: written error object on failure
+ *
+ * Return: PgDumpStatus_t, the status of the step that failed
+ **/
+PgDumpStatus_t pgdump_backup(AppConfig_t *cfg, const char *backup_name, PgDumpError_t **err);
+
+PgDumpError_t *create_pgdump_error(PgDumpStatus_t code, const char *message);
+void destroy_pgdump_session(PgDumpSession_t **session);
+void destroy_pgdump_error(PgDumpError_t **err);
+
+
+#endif /* ___PGDUMP_H___ */
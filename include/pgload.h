@@ -0,0 +1,84 @@
+#ifndef ___PGLOAD_H___
+#define ___PGLOAD_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+
+//internal library headers
+#include "globals.h"
+#include "archive.h"
+#include "config_parser.h"
+#include "pgwire.h"
+#include "restore.h"
+
+/*
+ * ==========================================================
+ * PostgreSQL Load
+ * ----------------------------------------------------------
+ * The restore engine's callbacks for the postgres driver:
+ * `dbeetle restore` without --table or --output loads the
+ * archive back into `db.uri`. Like the dump, worker i works
+ * on connection i of `runtime.thread_count`. Each archive
+ * object goes in with
+ *
+ *   COPY "schema"."table" FROM STDIN (FORMAT binary)
+ *
+ * its frames sent as CopyData as they are decoded, so a
+ * table never sits in memory whole; every range of a split
+ * table is a COPY of its own. The post-data statements then
+ * run on the same connections, phase by phase.
+ *
+ * As with `pg_restore --data-only`, the tables must exist
+ * and be empty, on a server of the dump's major version
+ * (the binary format is not portable across them). A COPY
+ * that fails, or whose object cannot be read, is aborted
+ * with CopyFail and leaves nothing behind.
+ * ==========================================================
+ */
+
+typedef enum {
+  PGLOAD_OK = 0,
+  PGLOAD_CONFIG_ERROR,
+  PGLOAD_CONNECT_ERROR,
+  PGLOAD_MEMORY_ERROR
+} PgLoadStatus_t;
+
+typedef struct PgLoadError {
+  PgLoadStatus_t    code;
+  char              message[BUF_LEN_M];
+} PgLoadError_t;
+
+typedef struct PgLoadSession {
+  AppConfig_t       *cfg;
+  PgConn_t          **workers;          // one per scheduler worker
+  size_t            worker_count;
+  uint64_t          bytes_loaded;
+  size_t            failed;
+  char              message[BUF_LEN_M]; // why the first load or statement failed
+  pthread_mutex_t   lock;
+} PgLoadSession_t;
+
+
+/**
+ * init_pgload_session - opens the worker connections a restore loads on
+ * @cfg: application config; `db.uri` and `runtime.thread_count`
+ * @err: written error object on failure
+ *
+ * Return: the session, or NULL on failure
+ **/
+PgLoadSession_t *init_pgload_session(AppConfig_t *cfg, PgLoadError_t **err);
+
+/* RestoreLoadFn_t copying object @obj into its table on the worker's connection; @ctx is the session */
+int pgload_table(ArchiveReader_t *reader, const ArchiveObject_t *obj, size_t worker_id, void *ctx);
+
+/* RestoreStepFn_t running a post-data statement on the worker's connection; @ctx is the session */
+int pgload_step(const RestoreStep_t *step, size_t worker_id, void *ctx);
+
+PgLoadError_t *create_pgload_error(PgLoadStatus_t code, const char *message);
+void destroy_pgload_session(PgLoadSession_t **session);
+void destroy_pgload_error(PgLoadError_t **err);
+
+
+#endif /* ___PGLOAD_H___ */
@@ -0,0 +1,187 @@
+#ifndef ___PIPELINE_H___
+#define ___PIPELINE_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+
+//macro defs
+#define PIPELINE_DEFAULT_BLOCK_SIZE (1 << 20)
+#define PIPELINE_BUFFERS_PER_WORKER (4)
+#define PIPELINE_MAX_STAGES (4)
+#define PIPELINE_BLOCK_HEADROOM(block_size) ((block_size) / 8 + 4096)
+#define PIPE_SINK_HELD (1)
+
+/*
+ * ==========================================================
+ * Streaming Pipeline
+ * ----------------------------------------------------------
+ * Producers fill fixed-size blocks taken from a bounded pool;
+ * each block then flows through the transform stages
+ * (compression, encryption, ...) over bounded rings and ends
+ * at a single sink which writes blocks back in submission
+ * order.
+ *
+ * Memory is fixed at init time: `buffer_count` blocks, each
+ * with a payload area and an equally sized scratch area that
+ * transforms write into before swapping the two. A producer
+ * blocks on an empty pool, which is what pushes back on the
+ * dump when the disk or the network is the slow side.
+ *
+ * A sink that writes asynchronously may keep a block past
+ * its call (PIPE_SINK_HELD) and hand it back to the pool
+ * with pipeline_recycle once done with it. Its flush hook
+ * runs whenever the sink is about to wait for blocks and
+ * once after the last one, and must give back every block
+ * it holds.
+ * ==========================================================
+ */
+
+typedef enum {
+  PIPE_BUF_LAST = 1 << 0,   // final block of its object
+  PIPE_BUF_RAW = 1 << 1     // stored uncompressed inside the codec's framing
+} PipeBufferFlag_t;
+
+typedef struct PipeBuffer {
+  unsigned char     *data;
+  unsigned char     *scratch;
+  size_t            len;
+  size_t            capacity;
+  size_t            raw_len;
+  uint64_t          seq;
+  uint32_t          object_id;
+  uint32_t          flags;
+  uint32_t          check;      // crc32 of the raw payload, when the codec needs one
+} PipeBuffer_t;
+
+typedef struct BufferRing {
+  PipeBuffer_t      **slots;
+  size_t            capacity;
+  size_t            head;
+  size_t            count;
+  bool              closed;
+  pthread_mutex_t   lock;
+  pthread_cond_t    not_empty;
+  pthread_cond_t    not_full;
+} BufferRing_t;
+
+/* transforms @buf in place (swap data/scratch to change size); returns 0 on success */
+typedef int (*PipeStageFn_t)(void *ctx, PipeBuffer_t *buf, size_t worker_id);
+/* frees a stage context when the pipeline is destroyed */
+typedef void (*PipeStageReleaseFn_t)(void *ctx);
+/* consumes blocks strictly in submission order; returns 0 on success, PIPE_SINK_HELD when it keeps @buf */
+typedef int (*PipeSinkFn_t)(void *ctx, const PipeBuffer_t *buf);
+/* completes whatever the sink holds; returns 0 on success */
+typedef int (*PipeSinkFlushFn_t)(void *ctx);
+
+typedef struct PipelineStage {
+  char              name[BUF_LEN_XS];
+  PipeStageFn_t     process;
+  PipeStageReleaseFn_t release;
+  void              *ctx;
+  size_t            workers;
+  size_t            registered;
+  pthread_t         *threads;
+  BufferRing_t      *in;
+  BufferRing_t      *out;
+  struct Pipeline   *pipe;
+} PipelineStage_t;
+
+typedef enum {
+  PIPELINE_OK = 0,
+  PIPELINE_MEMORY_ERROR,
+  PIPELINE_CONFIG_ERROR,
+  PIPELINE_THREAD_ERROR,
+  PIPELINE_STAGE_ERROR,
+  PIPELINE_IO_ERROR
+} PipelineStatus_t;
+
+typedef struct PipelineError {
+  PipelineStatus_t  code;
+  char              message[BUF_LEN_M];
+} PipelineError_t;
+
+typedef struct Pipeline {
+  PipeBuffer_t      *buffers;
+  size_t            buffer_count;
+  size_t            block_size;
+  BufferRing_t      *pool;
+  BufferRing_t      *rings[PIPELINE_MAX_STAGES + 1];
+  PipelineStage_t   stages[PIPELINE_MAX_STAGES];
+  size_t            stage_count;
+  PipeSinkFn_t      sink;
+  PipeSinkFlushFn_t sink_flush;
+  void              *sink_ctx;
+  pthread_t         sink_thread;
+  bool              started;
+  uint64_t          next_seq;
+  uint64_t          bytes_in;
+  uint64_t          bytes_out;
+  PipelineStatus_t  status;
+  char              message[BUF_LEN_M];
+  pthread_mutex_t   lock;
+} Pipeline_t;
+
+/* per-producer cursor filling blocks for one object */
+typedef struct PipeWriter {
+  Pipeline_t        *pipe;
+  PipeBuffer_t      *cur;
+  uint32_t          object_id;
+} PipeWriter_t;
+
+
+BufferRing_t *init_buffer_ring(size_t capacity);
+bool ring_push(BufferRing_t *ring, PipeBuffer_t *buf);
+PipeBuffer_t *ring_pop(BufferRing_t *ring);
+/* removes the oldest buffer without waiting; NULL when the ring is empty */
+PipeBuffer_t *ring_try_pop(BufferRing_t *ring);
+void ring_close(BufferRing_t *ring);
+void destroy_buffer_ring(BufferRing_t **ring);
+
+/**
+ * init_pipeline - allocates the fixed buffer pool of a pipeline
+ * @block_size: payload bytes per block before any transform
+ * @buffer_count: number of blocks in flight, bounds memory use
+ *
+ * Return: the pipeline, or NULL on allocation failure
+ **/
+Pipeline_t *init_pipeline(size_t block_size, size_t buffer_count);
+
+PipelineStatus_t pipeline_add_stage(Pipeline_t *pipe, const char *name, PipeStageFn_t process,
+  PipeStageReleaseFn_t release, void *ctx, size_t workers);
+void pipeline_set_sink(Pipeline_t *pipe, PipeSinkFn_t sink, void *ctx);
+void pipeline_set_sink_flush(Pipeline_t *pipe, PipeSinkFlushFn_t flush);
+/* returns a block held by the sink to the pool; called from the sink's thread */
+void pipeline_recycle(Pipeline_t *pipe, const PipeBuffer_t *buf);
+PipelineStatus_t pipeline_start(Pipeline_t *pipe);
+
+PipeBuffer_t *pipeline_acquire(Pipeline_t *pipe);
+PipelineStatus_t pipeline_submit(Pipeline_t *pipe, PipeBuffer_t *buf);
+void pipeline_fail(Pipeline_t *pipe, PipelineStatus_t code, const char *message);
+
+/**
+ * pipeline_finish - drains every stage and waits for the sink
+ * @pipe: the pipeline
+ * @err: written error object on failure
+ *
+ * Return: PipelineStatus_t, the first failure seen by any stage
+ **/
+PipelineStatus_t pipeline_finish(Pipeline_t *pipe, PipelineError_t **err);
+
+void init_pipe_writer(PipeWriter_t *writer, Pipeline_t *pipe, uint32_t object_id);
+PipelineStatus_t pipe_writer_write(PipeWriter_t *writer, const void *data, size_t len);
+unsigned char *pipe_writer_reserve(PipeWriter_t *writer, size_t *room);
+PipelineStatus_t pipe_writer_commit(PipeWriter_t *writer, size_t len);
+PipelineStatus_t pipe_writer_close(PipeWriter_t *writer);
+
+PipelineError_t *create_pipeline_error(PipelineStatus_t code, const char *message);
+void destroy_pipeline(Pipeline_t **pipe);
+void destroy_pipeline_error(PipelineError_t **err);
+
+
+#endif /* ___PIPELINE_H___ */
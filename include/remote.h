@@ -0,0 +1,163 @@
+#ifndef ___REMOTE_H___
+#define ___REMOTE_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "config_parser.h"
+#include "pipeline.h"
+
+//macro defs
+#define REMOTE_PART_SIZE (8 << 20)
+#define REMOTE_MAX_PART_SIZE (512 << 20)
+#define REMOTE_PARTS_PER_STEP (1000)
+#define REMOTE_MAX_PARTS (10000)
+#define REMOTE_MAX_ATTEMPTS (5)
+#define REMOTE_RETRY_BASE_MS (200)
+#define REMOTE_CONNECT_TIMEOUT (10)
+#define REMOTE_STALL_TIMEOUT (60)
+#define REMOTE_ETAG_LEN (BUF_LEN_XS + 8)
+#define REMOTE_URL_LEN (BUF_LEN + BUF_LEN_S + BUF_LEN_XS)
+#define REMOTE_MAX_FETCH_CONNECTIONS (64)
+
+/*
+ * ==========================================================
+ * Remote Upload
+ * ----------------------------------------------------------
+ * Streams an archive to `storage.remote_target` with the S3
+ * multipart protocol: `POST <url>?uploads` opens an upload,
+ * parts are PUT as `<url>?partNumber=N&uploadId=ID` and
+ * `POST <url>?uploadId=ID` stitches them together in order;
+ * a failed upload is aborted with a DELETE.
+ *
+ * The writer fills part buffers and hands them to
+ * `storage.remote_connections` uploader threads, each keeping
+ * one connection open. Buffers are recycled through a bounded
+ * ring, so memory stays at connections + 1 parts and a slow
+ * remote pushes back on the pipeline. Each part is retried on
+ * its own, with exponential backoff, on network errors, 408,
+ * 429 and 5xx.
+ *
+ * Parts start at REMOTE_PART_SIZE and double every
+ * REMOTE_PARTS_PER_STEP parts (up to REMOTE_MAX_PART_SIZE), so
+ * small backups go out in parallel while multi-terabyte ones
+ * still fit in REMOTE_MAX_PARTS parts.
+ *
+ * Archives come back the same way: remote_fetch() sizes the
+ * object with a HEAD and pulls REMOTE_PART_SIZE ranges over
+ * parallel connections, each written in place in the local
+ * copy and retried on its own.
+ * ==========================================================
+ */
+
+typedef enum {
+  REMOTE_OK = 0,
+  REMOTE_CONFIG_ERROR,
+  REMOTE_MEMORY_ERROR,
+  REMOTE_THREAD_ERROR,
+  REMOTE_HTTP_ERROR,
+  REMOTE_IO_ERROR
+} RemoteStatus_t;
+
+typedef struct RemoteError {
+  RemoteStatus_t    code;
+  char              message[BUF_LEN_M];
+} RemoteError_t;
+
+typedef struct RemoteUploader {
+  char              url[BUF_LEN];
+  char              upload_id[BUF_LEN_S];
+  size_t            connections;
+  size_t            part_size;      // size of the first parts, see above
+  PipeBuffer_t      *parts;
+  size_t            part_count;
+  BufferRing_t      *free_parts;
+  BufferRing_t      *queued;
+  PipeBuffer_t      *cur;
+  pthread_t         *threads;
+  size_t            started;
+  uint32_t          next_part;
+  char              (*etags)[REMOTE_ETAG_LEN];
+  size_t            etag_capacity;
+  uint64_t          bytes_sent;
+  uint64_t          retries;
+  bool              failed;
+  bool              completed;
+  char              message[BUF_LEN_M];
+  pthread_mutex_t   lock;
+} RemoteUploader_t;
+
+
+/* true when `storage.remote_target` names an upload target */
+bool remote_enabled(const StorageConfig_t *cfg);
+
+/**
+ * init_remote_uploader - opens a multipart upload and starts the
+ * connection threads
+ * @target: `storage.remote_target`, e.g. http://host:9000/bucket
+ * @name: object name under @target
+ * @connections: parallel connections
+ * @part_size: size of the first parts, 0 for REMOTE_PART_SIZE
+ * @err: written error object on failure
+ *
+ * Return: the uploader, or NULL on failure
+ **/
+RemoteUploader_t *init_remote_uploader(const char *target, const char *name, size_t connections,
+  size_t part_size, RemoteError_t **err);
+
+/* queues @len bytes, blocking while every part is in flight; -1 once the upload failed */
+int remote_uploader_write(RemoteUploader_t *up, const unsigned char *data, size_t len);
+
+/**
+ * remote_uploader_finish - sends the last part, waits for every part and
+ * completes the upload
+ * @up: the uploader
+ * @err: written error object on failure
+ *
+ * Return: RemoteStatus_t
+ **/
+RemoteStatus_t remote_uploader_finish(RemoteUploader_t *up, RemoteError_t **err);
+
+/**
+ * remote_fetch - downloads object @name under @target to @path
+ * @target: `storage.remote_target`
+ * @name: object name under @target
+ * @path: local file, replaced; removed again if the download fails
+ * @connections: parallel connections
+ * @size: written object size, may be NULL
+ * @err: written error object on failure
+ *
+ * Return: RemoteStatus_t
+ **/
+RemoteStatus_t remote_fetch(const char *target, const char *name, const char *path, size_t connections,
+  uint64_t *size, RemoteError_t **err);
+
+/* the part size used for part @number (1-based) */
+size_t remote_part_size(const RemoteUploader_t *up, uint32_t number);
+
+/* pulls the text between <@tag> and </@tag> out of an S3 XML response */
+int remote_xml_value(const char *xml, const char *tag, char *out, size_t out_len);
+
+/* one HTTP exchange, 0 once a response was received; the transport lives in 002_remote.c */
+int remote_http(void *curl, const char *method, const char *url, const unsigned char *body, size_t len,
+  long *status, char *etag, size_t etag_len, char *response, size_t response_len);
+/* HEAD of @url, the object size in @size */
+int remote_http_size(void *curl, const char *url, uint64_t *size, long *status);
+/* GETs @len bytes of @url from @offset, written at the same offset of @fd */
+int remote_http_get_range(void *curl, const char *url, uint64_t offset, size_t len, int fd, long *status,
+  size_t *received);
+void *remote_http_open(void);
+void remote_http_close(void *curl);
+void *remote_worker_main(void *arg);
+
+RemoteError_t *create_remote_error(RemoteStatus_t code, const char *message);
+void destroy_remote_uploader(RemoteUploader_t **up);
+void destroy_remote_error(RemoteError_t **err);
+
+
+#endif /* ___REMOTE_H___ */
@@ -0,0 +1,142 @@
+#ifndef ___RESTORE_H___
+#define ___RESTORE_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "archive.h"
+#include "config_parser.h"
+#include "scheduler.h"
+
+//macro defs
+#define RESTORE_POST_DATA_OBJECT ("@post-data")
+#define RESTORE_FETCH_SUFFIX (".restore")
+#define RESTORE_MAX_POST_DATA (64 << 20)
+
+/*
+ * ==========================================================
+ * Restore Engine
+ * ----------------------------------------------------------
+ * The mirror image of the backup engine: opens an archive
+ * from `storage.output_path`, or fetches it from
+ * `storage.remote_target` into `runtime.tmp_dir` first, and
+ * loads its tables concurrently on `runtime.thread_count`
+ * workers, largest first, each worker reading only its own
+ * table's frames through the archive index.
+ *
+ * Indexes and constraints are left out of the loads: bulk
+ * loading into bare tables is several times faster than
+ * maintaining every index row by row. They are kept as SQL
+ * statements, one per line ending in ';', in the archive
+ * object RESTORE_POST_DATA_OBJECT, and run once every table
+ * is loaded, in two parallel phases:
+ *
+ *   index         CREATE INDEX, primary keys, unique and check
+ *                 constraints, anything but the next phase
+ *   constraint    statements adding FOREIGN KEY constraints,
+ *                 validated against the keys built before
+ *
+ * A phase only starts once the previous one succeeded, so a
+ * failed load never leaves half-built indexes behind it.
+ * ==========================================================
+ */
+
+typedef enum {
+  RESTORE_STEP_INDEX = 0,
+  RESTORE_STEP_CONSTRAINT
+} RestoreStepKind_t;
+
+typedef struct RestoreStep {
+  RestoreStepKind_t kind;
+  char              *sql;           // one statement, with its ';'
+} RestoreStep_t;
+
+/* loads one table, reading it with archive_read_object(); returns 0 on success */
+typedef int (*RestoreLoadFn_t)(ArchiveReader_t *reader, const ArchiveObject_t *obj, size_t worker_id, void *ctx);
+/* runs one post-data statement; returns 0 on success */
+typedef int (*RestoreStepFn_t)(const RestoreStep_t *step, size_t worker_id, void *ctx);
+
+typedef enum {
+  RESTORE_OK = 0,
+  RESTORE_CONFIG_ERROR,
+  RESTORE_MEMORY_ERROR,
+  RESTORE_THREAD_ERROR,
+  RESTORE_FETCH_ERROR,
+  RESTORE_ARCHIVE_ERROR,
+  RESTORE_LOAD_ERROR,
+  RESTORE_STEP_ERROR
+} RestoreStatus_t;
+
+typedef struct RestoreError {
+  RestoreStatus_t   code;
+  char              message[BUF_LEN_M];
+} RestoreError_t;
+
+typedef struct RestoreEngine {
+  AppConfig_t       *cfg;
+  Scheduler_t       *sched;
+  ArchiveReader_t   *reader;
+  char              fetched_path[BUF_LEN];  // local copy of a remote archive, removed on destroy
+  RestoreStep_t     *steps;
+  size_t            step_count;
+  size_t            step_capacity;
+  RestoreLoadFn_t   load;
+  RestoreStepFn_t   run_step;
+  void              *ctx;
+  size_t            failed;
+  char              first_failure[BUF_LEN_S];
+  size_t            tables_loaded;
+  size_t            steps_run;
+  pthread_mutex_t   lock;
+} RestoreEngine_t;
+
+
+/**
+ * init_restore_engine - opens archive @backup_name for a restore
+ * @cfg: application config
+ * @backup_name: file name of the archive inside `output_path`, or
+ * object name under `remote_target` when there is no local copy
+ * @err: written error object on failure
+ *
+ * Return: the engine, or NULL on failure
+ **/
+RestoreEngine_t *init_restore_engine(AppConfig_t *cfg, const char *backup_name, RestoreError_t **err);
+
+/* queues @sql (one statement) for the post-data phase of @kind; 0 on success */
+int restore_add_step(RestoreEngine_t *engine, RestoreStepKind_t kind, const char *sql, size_t len);
+
+/* splits @text into statements (lines ending in ';') and queues each for its phase */
+int restore_parse_post_data(RestoreEngine_t *engine, const char *text, size_t len);
+
+/* where copies fetched from the remote go: `runtime.tmp_dir` when set, else `output_path` */
+const char *restore_fetch_dir(const AppConfig_t *cfg);
+
+/* the phase a post-data statement belongs to */
+RestoreStepKind_t restore_step_kind(const char *sql, size_t len);
+
+/**
+ * restore_run - loads every table of the archive, then runs the
+ * post-data phases
+ * @engine: the engine
+ * @load: per-table load callback, called concurrently from workers
+ * @run_step: per-statement callback, called concurrently from workers
+ * @ctx: opaque pointer passed to both
+ * @err: written error object on failure
+ *
+ * The statements of the archive's RESTORE_POST_DATA_OBJECT are
+ * queued after any added with restore_add_step().
+ * Return: RestoreStatus_t
+ **/
+RestoreStatus_t restore_run(RestoreEngine_t *engine, RestoreLoadFn_t load, RestoreStepFn_t run_step, void *ctx,
+  RestoreError_t **err);
+
+RestoreError_t *create_restore_error(RestoreStatus_t code, const char *message);
+void destroy_restore_engine(RestoreEngine_t **engine);
+void destroy_restore_error(RestoreError_t **err);
+
+
+#endif /* ___RESTORE_H___ */
@@ -0,0 +1,91 @@
+#ifndef ___SCHEDULER_H___
+#define ___SCHEDULER_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+
+//macro defs
+#define SCHED_DEQUE_INITIAL_CAP (64)
+#define SCHED_MAX_WORKERS (256)
+#define SCHED_NO_WORKER ((size_t)-1)
+
+/*
+ * ==========================================================
+ * Work-Stealing Scheduler
+ * ----------------------------------------------------------
+ * A fixed pool of worker threads, each owning a deque of
+ * tasks. A worker pushes and pops at the bottom of its own
+ * deque (LIFO, cache friendly for tasks it spawned itself)
+ * and, once empty, steals from the top of a sibling's deque
+ * (FIFO, so the oldest task moves: for work that splits
+ * itself, a directory tree say, the one with most left
+ * under it).
+ *
+ * Tasks submitted from outside the pool go to one shared
+ * queue that every worker takes from in submission order,
+ * after its own deque and before stealing. Submitted
+ * largest first, as the backup engine does, the largest
+ * task not started is always the next one taken, whichever
+ * worker frees up.
+ * ==========================================================
+ */
+
+typedef void (*SchedTaskFn_t)(void *arg, size_t worker_id);
+
+typedef struct SchedTask {
+  SchedTaskFn_t     run;
+  void              *arg;
+} SchedTask_t;
+
+typedef struct SchedDeque {
+  SchedTask_t       *tasks;
+  size_t            top;
+  size_t            bottom;
+  size_t            capacity;
+  pthread_mutex_t   lock;
+} SchedDeque_t;
+
+typedef struct Scheduler {
+  pthread_t         *threads;
+  SchedDeque_t      *deques;
+  SchedDeque_t      shared;         // submitted from outside the pool, taken in order
+  size_t            worker_count;
+  size_t            deque_count;
+  size_t            registered;
+  size_t            queued;
+  size_t            pending;
+  bool              shutdown;
+  pthread_key_t     worker_key;
+  pthread_mutex_t   lock;
+  pthread_cond_t    work_cv;
+  pthread_cond_t    idle_cv;
+} Scheduler_t;
+
+typedef enum {
+  SCHED_OK = 0,
+  SCHED_MEMORY_ERROR,
+  SCHED_THREAD_ERROR,
+  SCHED_SHUTDOWN
+} SchedulerStatus_t;
+
+
+/**
+ * init_scheduler - starts a pool of @worker_count threads
+ * @worker_count: number of workers, clamped to [1, SCHED_MAX_WORKERS]
+ *
+ * Return: the scheduler, or NULL if allocation or thread creation failed
+ **/
+Scheduler_t *init_scheduler(size_t worker_count);
+
+SchedulerStatus_t scheduler_submit(Scheduler_t *sched, SchedTaskFn_t run, void *arg);
+void scheduler_wait(Scheduler_t *sched);
+size_t scheduler_current_worker(Scheduler_t *sched);
+void destroy_scheduler(Scheduler_t **sched);
+
+
+#endif /* ___SCHEDULER_H___ */
@@ -0,0 +1,205 @@
+#ifndef ___SQLITEDUMP_H___
+#define ___SQLITEDUMP_H___
+
+// standard library headers
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "archive.h"
+#include "config_parser.h"
+#include "driver.h"
+#include "pagecache.h"
+
+//macro defs
+#define SQLITEDUMP_OBJECT ("main")
+#define SQLITEDUMP_MAGIC ("DBSQLIT1")
+#define SQLITEDUMP_MAGIC_LEN (8)
+#define SQLITEDUMP_CHUNK_PAGES (256)
+#define SQLITE_HEADER_LEN (100)
+#define SQLITE_PENDING_BYTE (0x40000000)
+#define SQLITE_RESERVED_BYTE (SQLITE_PENDING_BYTE + 1)
+#define SQLITE_SHARED_FIRST (SQLITE_PENDING_BYTE + 2)
+#define SQLITE_SHARED_SIZE (510)
+#define SQLITE_SHM_CKPT_LOCK (120 + 1)
+#define SQLITE_SHM_READ_LOCK1 (120 + 3 + 1)
+#define SQLITE_WAL_HEADER_LEN (32)
+#define SQLITE_WAL_FRAME_HEADER_LEN (24)
+#define SQLITE_WAL_MAGIC (0x377f0682)
+#define SQLITE_WAL_VERSION (3007000)
+
+/*
+ * ==========================================================
+ * SQLite Backup
+ * ----------------------------------------------------------
+ * `db.type: sqlite` backs up the database file at `db.uri`
+ * by copying its pages, without linking SQLite: the sqlite
+ * driver of driver.h, with one object. The file is
+ * mapped and read with MADV_SEQUENTIAL straight into the
+ * storage pipeline, and the locks are the ones SQLite's unix
+ * VFS takes (as open file description locks, so they hold
+ * against SQLite in this very process too):
+ *
+ *   rollback journal   the pages are read SQLITEDUMP_CHUNK_PAGES
+ *                      at a time, each chunk under a SHARED lock
+ *                      taken and dropped again, so a writer is
+ *                      held up for one chunk at most. Each chunk
+ *                      records the file change counter it was
+ *                      read at and a checksum per page. A last
+ *                      pass under one SHARED lock re-reads only
+ *                      the chunks read before the final counter
+ *                      and copies again just their pages whose
+ *                      checksum moved, plus any new ones.
+ *   WAL                checkpoints are held off with a shared
+ *                      lock on the -shm checkpoint and first
+ *                      read-mark locks, so the database file
+ *                      stays put while it is copied. The pages
+ *                      that changed are the ones in the WAL: its
+ *                      frames are checked (salts, checksums)
+ *                      up to the last commit and the newest copy
+ *                      of each page follows the file's.
+ *
+ * Writers are only ever blocked for a chunk or the final
+ * pass, never for the whole copy. A hot journal left by a
+ * crashed writer is refused: only SQLite can roll it back.
+ *
+ * With `storage.direct_io` each chunk of pages the copy
+ * brought into the page cache is evicted again once read
+ * (see pagecache.h); pages SQLite had cached stay.
+ *
+ * The archive holds one object, SQLITEDUMP_OBJECT:
+ *
+ *   header      SQLITEDUMP_MAGIC | page size u32
+ *   pages       page number u32 | the page
+ *   end         0 u32 | page count u32
+ *
+ * integers little endian. Pages may come more than once, the
+ * last copy wins; sqlitedump_restore() writes them out as a
+ * database file of the final page count.
+ * ==========================================================
+ */
+
+typedef enum {
+  SQLITEDUMP_OK = 0,
+  SQLITEDUMP_CONFIG_ERROR,
+  SQLITEDUMP_OPEN_ERROR,
+  SQLITEDUMP_FORMAT_ERROR,
+  SQLITEDUMP_BUSY_ERROR,
+  SQLITEDUMP_MEMORY_ERROR,
+  SQLITEDUMP_DUMP_ERROR
+} SqliteDumpStatus_t;
+
+typedef struct SqliteDumpError {
+  SqliteDumpStatus_t code;
+  char              message[BUF_LEN_M];
+} SqliteDumpError_t;
+
+typedef struct SqliteDump {
+  AppConfig_t       *cfg;
+  char              path[BUF_LEN];
+  int               fd;                 // the database file, locks are taken on it
+  int               shm_fd;             // its -shm in WAL mode, -1 otherwise
+  bool              wal;
+  bool              locked;             // SHARED held on fd
+  uint32_t          page_size;
+  uint32_t          page_count;         // as of the last header read
+  uint32_t          counter;            // file change counter, same
+  const unsigned char *map;
+  size_t            map_len;
+  uint64_t          *sums;              // per page copied, rollback journal mode
+  uint32_t          *chunk_counters;    // counter each chunk was read at
+  uint32_t          pages_read;         // pages of the first pass
+  const DriverStream_t *out;           // during sqlitedump_run()
+  uint64_t          pages_copied;
+  uint64_t          pages_recopied;     // again in the final pass, or from the WAL
+  PageCache_t       cache;              // residency of the pages being read, storage.direct_io
+} SqliteDump_t;
+
+/* the state of sqlitedump_restore() between two blocks of the object */
+typedef struct SqliteRestore {
+  int               fd;
+  unsigned char     head[SQLITEDUMP_MAGIC_LEN + 4];
+  size_t            head_len;
+  uint32_t          page_size;
+  uint32_t          page;               // being written, 0 between pages
+  uint32_t          page_pos;
+  unsigned char     number[4];          // of the next page, gathered
+  size_t            number_len;
+  bool              ending;             // the page count follows
+  bool              ended;
+  bool              invalid;            // not a page stream
+  uint32_t          page_count;
+} SqliteRestore_t;
+
+
+/* true when @db names a SQLite database file */
+bool sqlitedump_supported(const DBConfig_t *db);
+
+/**
+ * init_sqlitedump - opens the database file at `db.uri` and reads its
+ * header
+ * @cfg: application config
+ * @err: written error object on failure
+ *
+ * Return: the dump, or NULL
+ **/
+SqliteDump_t *init_sqlitedump(AppConfig_t *cfg, SqliteDumpError_t **err);
+
+/* takes a SHARED lock the way SQLite does, waiting out writers up to `db.timeout_seconds` */
+SqliteDumpStatus_t sqlitedump_lock(SqliteDump_t *dump, SqliteDumpError_t **err);
+void sqlitedump_unlock(SqliteDump_t *dump);
+/* holds off checkpoints and WAL restarts through the -shm locks */
+SqliteDumpStatus_t sqlitedump_hold_wal(SqliteDump_t *dump, SqliteDumpError_t **err);
+void sqlitedump_release_wal(SqliteDump_t *dump);
+/* reads the page size, page count and change counter; call under the lock */
+SqliteDumpStatus_t sqlitedump_read_header(SqliteDump_t *dump, SqliteDumpError_t **err);
+/* maps the first @len bytes of the file, replacing any earlier map */
+SqliteDumpStatus_t sqlitedump_map(SqliteDump_t *dump, size_t len, SqliteDumpError_t **err);
+
+/**
+ * sqlitedump_run - copies the database as object SQLITEDUMP_OBJECT
+ * @dump: the opened dump
+ * @out: the object's stream
+ * @err: written error object on failure
+ *
+ * Return: SqliteDumpStatus_t
+ **/
+SqliteDumpStatus_t sqlitedump_run(SqliteDump_t *dump, const DriverStream_t *out, SqliteDumpError_t **err);
+
+/**
+ * sqlitedump_backup - takes a consistent backup of the SQLite file at
+ * `db.uri` into archive @backup_name under `storage.output_path`,
+ * driver_backup() with the sqlite driver
+ * @cfg: application config
+ * @backup_name: archive file name
+ * @err: written error object on failure
+ *
+ * Return: SqliteDumpStatus_t, the status of the step that failed
+ **/
+SqliteDumpStatus_t sqlitedump_backup(AppConfig_t *cfg, const char *backup_name, SqliteDumpError_t **err);
+
+/**
+ * sqlitedump_restore - writes the database held by @obj to @fd
+ * @reader: the archive
+ * @obj: a SQLITEDUMP_OBJECT object
+ * @fd: a regular file, written at page offsets and cut to size
+ * @err: written error object on failure
+ *
+ * Return: ArchiveStatus_t, ARCHIVE_FORMAT_ERROR when @obj is not a
+ * SQLite page stream
+ **/
+ArchiveStatus_t sqlitedump_restore(ArchiveReader_t *reader, const ArchiveObject_t *obj, int fd, ArchiveError_t **err);
+
+/* big endian integer of the SQLite file format */
+uint32_t sqlitedump_be32(const unsigned char *p);
+/* checksum of a page, to spot the ones that changed under the copy */
+uint64_t sqlitedump_page_sum(const unsigned char *page, size_t len);
+
+SqliteDumpError_t *create_sqlitedump_error(SqliteDumpStatus_t code, const char *message);
+void destroy_sqlitedump(SqliteDump_t **dump);
+void destroy_sqlitedump_error(SqliteDumpError_t **err);
+
+
+#endif /* ___SQLITEDUMP_H___ */
@@ -0,0 +1,187 @@
+#ifndef ___STORAGE_H___
+#define ___STORAGE_H___
+
+// standard library headers
+#include <stdbool.h>
+#include <stdint.h>
+
+//internal library headers
+#include "globals.h"
+#include "archive.h"
+#include "chunkstore.h"
+#include "cipher.h"
+#include "config_parser.h"
+#include "pipeline.h"
+#include "pagecache.h"
+#include "remote.h"
+#include "uring.h"
+
+//macro defs
+#define STORAGE_PARTIAL_SUFFIX (".partial")
+#define STORAGE_STDOUT ("-")
+#define STORAGE_DIRECT_ALIGN (4096)
+#define STORAGE_DIRECT_STAGE (4 << 20)
+
+/*
+ * ==========================================================
+ * Storage Stage
+ * ----------------------------------------------------------
+ * Assembles the backup pipeline described by the `storage`
+ * section (compression, encryption, output) and provides the
+ * final sink writing blocks under `storage.output_path`.
+ *
+ * Unencrypted gzip archives are a single gzip member of data
+ * (the index follows in empty members); with
+ * `storage.encryption_key_path` set the archive is a sequence
+ * of sealed chunks (see cipher.h) around the codec's blocks.
+ *
+ * Every archive ends with an index of its frames (see
+ * archive.h), so one object can be restored without reading
+ * the rest. Behind a dedup manifest the frames are ranges of
+ * the chunked stream rather than of the file.
+ *
+ * With `storage.dedup` set the archive is a manifest of the
+ * content-defined chunks kept in `output_path/chunks` (see
+ * chunkstore.h); blocks reach the sink uncompressed and each
+ * new chunk is compressed on its own as it is stored.
+ *
+ * With `storage.remote_target` set, the same bytes are also
+ * streamed to the remote as a multipart upload (see remote.h)
+ * that is completed before the local archive is published.
+ *
+ * Blocks are written through io_uring (see uring.h) where
+ * the kernel allows it, `storage.writer: auto`; `uring`
+ * insists on it and `sync` keeps to blocking write(2). The
+ * bytes around the blocks (headers, framing, the index) are
+ * written in place at their offsets either way.
+ *
+ * With `storage.direct_io` every byte is gathered in an
+ * aligned stage of STORAGE_DIRECT_STAGE bytes written with
+ * O_DIRECT, so the archive never enters the page cache; the
+ * unaligned tail is written through the cache and dropped
+ * at commit. Where the file system refuses O_DIRECT the
+ * stage is written normally and evicted behind the writer
+ * (see pagecache.h). Staged blocks are written with
+ * write(2), not io_uring. Chunks of `storage.dedup` are
+ * written by the chunk store and stay cached. A restore
+ * with the setting drops each frame it has read.
+ *
+ * The archive is written to `<name>.partial` and renamed in
+ * place once complete, so a crashed run never leaves a file
+ * that looks like a finished backup.
+ *
+ * `storage.output_path: -` (STORAGE_STDOUT) streams the
+ * archive to stdout instead, for dbeetle to sit in a
+ * pipeline; the reader tells a complete archive by its index.
+ * Frame offsets count from the first byte written, so stdout
+ * must be a pipe or a file at offset 0. Nothing is written
+ * out of order there: io_uring and direct_io are not used,
+ * and dedup, which needs a chunk directory, is refused.
+ * ==========================================================
+ */
+
+typedef enum {
+  STORAGE_OK = 0,
+  STORAGE_CONFIG_ERROR,
+  STORAGE_IO_ERROR,
+  STORAGE_MEMORY_ERROR
+} StorageStatus_t;
+
+typedef struct StorageError {
+  StorageStatus_t   code;
+  char              message[BUF_LEN_M];
+} StorageError_t;
+
+typedef struct StorageSink {
+  int               fd;
+  char              path[BUF_LEN];
+  char              partial_path[BUF_LEN];
+  uint64_t          bytes_written;
+  bool              gzip_stream;    // wrap blocks in a single gzip member
+  bool              header_written;
+  uint32_t          crc;
+  uint64_t          raw_len;
+  CipherStage_t     *cipher;        // owned; seals the end chunk on commit
+  uint64_t          chunks;
+  RemoteUploader_t  *remote;
+  ChunkStore_t      *dedup;         // owned; the archive is a chunk manifest
+  Chunker_t         chunker;
+  unsigned char     *chunk;         // current chunk, up to CHUNK_MAX_SIZE
+  size_t            chunk_len;
+  EVP_MD_CTX        *manifest_md;
+  ArchiveIndex_t    *index;         // owned; offsets of a dedup manifest's frames count stream bytes
+  CodecId_t         codec;
+  UringWriter_t     *uring;         // owned; NULL writes blocks with write(2)
+  unsigned char     *stage;         // owned, STORAGE_DIRECT_ALIGN aligned; storage.direct_io only
+  size_t            stage_len;
+  uint64_t          stage_offset;   // of stage[0] in the file
+  bool              o_direct;       // fd bypasses the page cache
+  uint64_t          behind;         // evicted up to here, when written through the cache
+  bool              stream;         // fd is stdout, STORAGE_STDOUT; nothing to rename or unlink
+} StorageSink_t;
+
+
+/**
+ * init_storage_sink - opens the archive file for a new backup
+ * @cfg: storage section of the config
+ * @backup_name: file name of the archive inside `output_path`: not
+ * empty, without a '/' and not starting with '.'
+ * @err: written error object on failure
+ *
+ * Return: the sink, or NULL on failure
+ **/
+StorageSink_t *init_storage_sink(const StorageConfig_t *cfg, const char *backup_name, StorageError_t **err);
+
+int storage_sink_write(void *ctx, const PipeBuffer_t *buf);
+/* waits for the blocks still being written */
+int storage_sink_flush(void *ctx);
+/* appends @len bytes to the archive (and its upload) */
+int storage_sink_put(StorageSink_t *sink, const unsigned char *data, size_t len);
+StorageStatus_t storage_sink_commit(StorageSink_t *sink, StorageError_t **err);
+/* records @name for the blocks written with @object_id, so it can be restored alone */
+int storage_sink_name_object(StorageSink_t *sink, uint32_t object_id, const char *name);
+
+/**
+ * init_storage_pipeline - builds the dump -> compress -> encrypt -> write
+ * pipeline for @cfg, ending in @sink
+ * @cfg: application config
+ * @sink: the opened storage sink
+ * @err: written error object on failure
+ *
+ * Return: a started pipeline, or NULL on failure
+ **/
+Pipeline_t *init_storage_pipeline(AppConfig_t *cfg, StorageSink_t *sink, PipelineError_t **err);
+
+/**
+ * storage_rewrap_archives - moves every encrypted archive under
+ * `output_path` from the configured master key to a new one
+ * @cfg: storage section, `encryption_key_path` is the current key
+ * @new_key_path: key file of the new master key
+ * @count: written number of archives rewrapped
+ * @err: written error object on failure
+ *
+ * Unencrypted files and archives already under the new key are skipped,
+ * so an interrupted rotation can simply be run again. Only the local
+ * copies are rewrapped: archives already uploaded to `remote_target`
+ * keep the old wrapping and need the old key until replaced.
+ * Return: StorageStatus_t
+ **/
+StorageStatus_t storage_rewrap_archives(const StorageConfig_t *cfg, const char *new_key_path, size_t *count,
+  StorageError_t **err);
+
+/* feeds @len bytes through the chunker, storing every completed chunk */
+int storage_dedup_write(StorageSink_t *sink, const unsigned char *data, size_t len);
+/* stores the last chunk, syncs the chunk store and closes the manifest */
+int storage_dedup_finish(StorageSink_t *sink);
+
+/* true when `storage.encryption_key_path` names a key file */
+bool storage_encryption_enabled(const StorageConfig_t *cfg);
+/* true when `storage.output_path` is STORAGE_STDOUT, not a directory */
+bool storage_to_stdout(const StorageConfig_t *cfg);
+
+StorageError_t *create_storage_error(StorageStatus_t code, const char *message);
+void destroy_storage_sink(StorageSink_t **sink);
+void destroy_storage_error(StorageError_t **err);
+
+
+#endif /* ___STORAGE_H___ */
@@ -0,0 +1,115 @@
+#ifndef ___TREEWALK_H___
+#define ___TREEWALK_H___
+
+// standard library headers
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+
+//internal library headers
+#include "globals.h"
+#include "scheduler.h"
+
+//macro defs
+#define TREEWALK_BATCH (64 * 1024)
+#define TREEWALK_SKIP (1)
+
+/*
+ * ==========================================================
+ * Parallel Tree Walk
+ * ----------------------------------------------------------
+ * Walks a directory tree on a work-stealing scheduler
+ * (scheduler.h): each directory is one task, listed in
+ * getdents64(2) batches of TREEWALK_BATCH bytes, and each
+ * subdirectory it finds is submitted as a task of its own.
+ * Submitted from a worker, a subdirectory lands on that
+ * worker's deque, so a worker goes depth first through its
+ * part of the tree while idle siblings steal the oldest,
+ * shallowest directories, the largest subtrees left.
+ *
+ * Entries are looked at with statx(2) relative to the open
+ * directory, asking for the walk's mask and nothing more;
+ * with a mask of 0 and a file system that reports entry
+ * types, no entry is stat'ed at all. The type always comes
+ * back, the walk needs it to descend.
+ *
+ * The visitor runs on the workers, concurrently, for every
+ * entry but "." and "..": a directory is visited before any
+ * of its entries, which is all the order there is. It can
+ * submit tasks of its own to the same scheduler, a backup
+ * copying files while the walk goes on (clone.h). Whoever
+ * waits for the scheduler waits for the walk.
+ * ==========================================================
+ */
+
+typedef struct TreeEntry {
+  const char        *path;          // relative to the root
+  const char        *name;          // within @dir_fd
+  int               dir_fd;         // the open directory holding it, for *at calls
+  const struct statx *stx;          // the walk's mask, and the type in stx_mode
+} TreeEntry_t;
+
+/* 0 to go on (into a directory), TREEWALK_SKIP to leave a directory out, -1 to stop the walk */
+typedef int (*TreeVisitFn_t)(const TreeEntry_t *entry, size_t worker_id, void *ctx);
+
+typedef enum {
+  TREEWALK_OK = 0,
+  TREEWALK_IO_ERROR,
+  TREEWALK_MEMORY_ERROR,
+  TREEWALK_VISIT_ERROR
+} TreeWalkStatus_t;
+
+typedef struct TreeWalkError {
+  TreeWalkStatus_t  code;
+  char              message[BUF_LEN_M];
+} TreeWalkError_t;
+
+typedef struct TreeWalk {
+  int               root_fd;
+  unsigned int      mask;           // statx fields the visitor needs
+  TreeVisitFn_t     visit;
+  void              *ctx;
+  Scheduler_t       *sched;         // of tree_walk_submit
+  uint64_t          directories;    // listed
+  uint64_t          entries;        // visited
+  TreeWalkStatus_t  status;         // the first failure stops the walk
+  pthread_mutex_t   lock;
+  char              message[BUF_LEN_M];
+} TreeWalk_t;
+
+
+/**
+ * init_tree_walk - prepares a walk of the tree at @root
+ * @root: the directory to walk, itself not visited
+ * @mask: statx fields the visitor needs (STATX_SIZE, ...), 0 for the type only
+ * @visit: the visitor, called concurrently from workers
+ * @ctx: opaque pointer passed to @visit
+ * @err: written error object on failure
+ *
+ * Return: the walk, NULL on failure
+ **/
+TreeWalk_t *init_tree_walk(const char *root, unsigned int mask, TreeVisitFn_t visit, void *ctx,
+  TreeWalkError_t **err);
+
+/**
+ * tree_walk_submit - starts the walk on @sched
+ * @walk: the walk
+ * @sched: the scheduler its directories are spread over
+ *
+ * Returns once the root is queued; the walk is over when @sched is
+ * idle again (scheduler_wait), tree_walk_finish tells how it went.
+ * Return: TreeWalkStatus_t
+ **/
+TreeWalkStatus_t tree_walk_submit(TreeWalk_t *walk, Scheduler_t *sched);
+/* the walk's outcome once its scheduler is idle; writes @err on failure */
+TreeWalkStatus_t tree_walk_finish(TreeWalk_t *walk, TreeWalkError_t **err);
+/* stops a walk, keeping the first failure; callable from any thread */
+void tree_walk_fail(TreeWalk_t *walk, TreeWalkStatus_t code, const char *message);
+
+TreeWalkError_t *create_treewalk_error(TreeWalkStatus_t code, const char *message);
+void destroy_tree_walk(TreeWalk_t **walk);
+void destroy_treewalk_error(TreeWalkError_t **err);
+
+
+#endif /* ___TREEWALK_H___ */
@@ -0,0 +1,135 @@
+#ifndef ___URING_H___
+#define ___URING_H___
+
+// standard library headers
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "pipeline.h"
+
+//macro defs
+#define URING_MAX_ENTRIES (256)
+#define URING_SUBMIT_BATCH (8)
+
+/*
+ * ==========================================================
+ * io_uring Writer
+ * ----------------------------------------------------------
+ * Writes the blocks reaching the storage sink without
+ * blocking on each one: a block is queued as a write at its
+ * archive offset and held by the sink (PIPE_SINK_HELD) until
+ * its completion hands it back to the pipeline pool. Up to
+ * one write per pipeline buffer is in flight, which is what
+ * keeps an NVMe queue busy while the stages fill the next
+ * blocks.
+ *
+ * Writes are prepared in the submission ring and handed to
+ * the kernel URING_SUBMIT_BATCH at a time, or sooner when
+ * the sink runs out of blocks; the sink's flush hook then
+ * also waits for what is in flight, so a block never sits
+ * queued behind a producer waiting for the pool.
+ *
+ * The data and scratch areas of every pipeline buffer are
+ * registered with the ring once, so writes are
+ * IORING_OP_WRITE_FIXED and the kernel skips mapping their
+ * pages on each one. When registration is refused (a low
+ * RLIMIT_MEMLOCK) plain IORING_OP_WRITE is used instead.
+ *
+ * The rings are set up with the raw system calls; there is
+ * no liburing dependency. Where io_uring is missing or
+ * forbidden, init_uring_writer fails and the sink keeps to
+ * blocking write(2) (`storage.writer`).
+ * ==========================================================
+ */
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+typedef struct UringRing {
+  int               fd;
+  unsigned          entries;
+  unsigned          *sq_head;
+  unsigned          *sq_tail;
+  unsigned          *sq_mask;
+  unsigned          *sq_array;
+  unsigned          *cq_head;
+  unsigned          *cq_tail;
+  unsigned          *cq_mask;
+  struct io_uring_sqe *sqes;
+  struct io_uring_cqe *cqes;
+  void              *sq_map;
+  size_t            sq_map_len;
+  void              *cq_map;            // == sq_map with IORING_FEAT_SINGLE_MMAP
+  size_t            cq_map_len;
+  size_t            sqes_len;
+} UringRing_t;
+
+/* one pipeline buffer's write, indexed like pipe->buffers */
+typedef struct UringWrite {
+  const PipeBuffer_t *buf;              // NULL when the buffer is not in flight
+  uint64_t          offset;
+  size_t            done;               // bytes already written, after a short write
+} UringWrite_t;
+
+typedef struct UringWriter {
+  UringRing_t       ring;
+  int               fd;
+  Pipeline_t        *pipe;
+  bool              fixed;              // pipeline buffers are registered
+  unsigned char     **registered;       // data and scratch area of each buffer, as registered
+  UringWrite_t      *writes;
+  unsigned          queued;             // prepared, not yet submitted
+  unsigned          inflight;           // submitted, not yet completed
+  uint64_t          submits;            // io_uring_enter calls that submitted writes
+  uint64_t          completed;
+  int               error;              // errno of the first failed write
+} UringWriter_t;
+
+
+/* sets up a ring of at least @entries slots; 0 on success, -1 with errno set */
+int uring_ring_setup(UringRing_t *ring, unsigned entries);
+/* free submission slot, or NULL when the ring is full */
+struct io_uring_sqe *uring_ring_next_sqe(UringRing_t *ring);
+/* hands @to_submit prepared slots to the kernel, waiting for @min_complete completions */
+int uring_ring_enter(UringRing_t *ring, unsigned to_submit, unsigned min_complete);
+void uring_ring_teardown(UringRing_t *ring);
+
+/**
+ * init_uring_writer - sets up a ring writing @pipe's blocks to @fd
+ * @fd: the archive, written at explicit offsets
+ * @pipe: the pipeline whose buffers are registered
+ * @message: written reason on failure
+ * @len: size of @message
+ *
+ * Return: the writer, or NULL when io_uring cannot be used here
+ **/
+UringWriter_t *init_uring_writer(int fd, Pipeline_t *pipe, char *message, size_t len);
+
+/**
+ * uring_writer_write - queues @buf for writing at @offset; the buffer
+ * stays held until its write completes
+ * @writer: the writer
+ * @buf: a block of the writer's pipeline
+ * @offset: where @buf goes in the archive
+ *
+ * Return: 0 when @buf is queued, -1 once any write has failed (@buf
+ * is then not held)
+ **/
+int uring_writer_write(UringWriter_t *writer, const PipeBuffer_t *buf, uint64_t offset);
+
+/**
+ * uring_writer_flush - submits the queued writes and waits for every
+ * write in flight, recycling their buffers
+ * @writer: the writer
+ *
+ * Return: 0 on success, -1 with errno set once any write has failed
+ **/
+int uring_writer_flush(UringWriter_t *writer);
+
+void destroy_uring_writer(UringWriter_t **writer);
+
+
+#endif /* ___URING_H___ */
@@ -0,0 +1,289 @@
+#ifndef ___WALARCHIVE_H___
+#define ___WALARCHIVE_H___
+
+// standard library headers
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+
+//internal library headers
+#include "globals.h"
+#include "config_parser.h"
+#include "pgwire.h"
+#include "pipeline.h"
+#include "storage.h"
+
+//macro defs
+#define WAL_INDEX_FILE ("wal.index")
+#define WAL_INDEX_MAGIC ("DBWALIX")
+#define WAL_INDEX_VERSION (1)
+#define WAL_INDEX_HEADER_LEN (16)
+#define WAL_INDEX_RECORD_LEN (32)
+#define WAL_BATCH_SUFFIX (".wal")
+#define WAL_PARTIAL_SUFFIX (".partial")
+#define WAL_SEGMENT_NAME_LEN (24)
+#define WAL_HISTORY_SUFFIX (".history")
+#define WAL_HISTORY_NAME_LEN (16)
+#define WAL_MIN_SEGMENT_SIZE (1 << 20)
+#define WAL_MAX_SEGMENT_SIZE (1 << 30)
+#define WAL_ARCHIVE_BATCH_SEGMENTS (16)
+#define WAL_ARCHIVE_MAX_PENDING (2)
+#define WAL_ARCHIVE_POLL_MS (200)
+#define WAL_ARCHIVE_STATUS_SECONDS (10)
+#define PG_EPOCH_UNIX_SECONDS (946684800)
+
+/*
+ * ==========================================================
+ * WAL Archiving
+ * ----------------------------------------------------------
+ * `dbeetle archive` keeps a copy of the write-ahead log of
+ * the server at `db.uri` for point-in-time recovery. It
+ * connects as a streaming replica (replication=true) and
+ * receives the WAL as the server writes it, from where the
+ * archive left off, or from the segment the server is on
+ * when the archive is new. A timeline switch is followed
+ * to the new timeline.
+ *
+ * The stream goes through physical replication slot
+ * `db.wal_slot`, created on first use and left in place: the
+ * flush positions the archiver reports move it, so the
+ * server keeps every segment not yet archived, across
+ * restarts of the archiver as well. A slot that is no longer
+ * wanted has to be dropped on the server
+ * (pg_drop_replication_slot()), or WAL piles up there.
+ *
+ * Segments go through the same storage stages as backups.
+ * Each batch of up to `batch_segments` segments is one
+ * archive `<first segment>.wal` under `output_path`, holding
+ * one object per segment named after it, so the pipeline
+ * compresses and encrypts a batch on its workers and a
+ * remote target receives it as one parallel multipart
+ * upload. A batch is closed once full, when the stream
+ * stops and at a timeline switch; it is then finished and
+ * committed in the background, up to WAL_ARCHIVE_MAX_PENDING
+ * batches at once, while the next one is received. The
+ * segment cut short by a stop or a timeline switch is kept
+ * as object `<segment>.partial`, as the server would. With
+ * `storage.dedup`, whose archives are one stream, a batch is
+ * one segment and a cut segment is not kept.
+ *
+ * Once a batch is committed its segments are appended to
+ * WAL_INDEX_FILE, which is uploaded again after each batch
+ * when a remote is set, and the server is told they are
+ * flushed. A segment is in the index only when it is stored
+ * in full.
+ *
+ * The index is a sorted array of fixed-size records, so a
+ * restore finds the batch holding a segment, or the range of
+ * segments between two LSNs, with a binary search of a few
+ * reads, never listing the storage:
+ *
+ *   header     "DBWALIX" | version u8 | segment size u32
+ *              | 4 reserved bytes
+ *   records    segment start LSN u64 | batch start LSN u64
+ *              | server time the segment ended at i64
+ *              | timeline u32 | CRC-32 of the 28 bytes before
+ *
+ * integers little endian, times in microseconds since
+ * 2000-01-01 as the server sends them. Records are in
+ * (timeline, LSN) order; a record torn by a crash is cut off
+ * when the archive is next opened.
+ *
+ * The history file of every timeline the archiver finds the
+ * server on or follows it to, `<timeline>.history`, is read
+ * with TIMELINE_HISTORY on the same connection and stored
+ * as an archive of that name holding one object of that
+ * name, through the same stages, before any of its segments.
+ * A timeline the server went through while the archiver
+ * was down gets no history file of its own; the one of the
+ * newer timeline lists it all the same.
+ *
+ * `dbeetle wal-fetch` serves segments and history files
+ * back as the server's restore_command; a name that is not
+ * archived is reported missing, as a recovery probing for
+ * the next timeline expects.
+ * ==========================================================
+ */
+
+typedef enum {
+  WAL_ARCHIVE_OK = 0,
+  WAL_ARCHIVE_CONFIG_ERROR,
+  WAL_ARCHIVE_CONNECT_ERROR,
+  WAL_ARCHIVE_PROTOCOL_ERROR,
+  WAL_ARCHIVE_STORAGE_ERROR,
+  WAL_ARCHIVE_MEMORY_ERROR,
+  WAL_ARCHIVE_NOT_FOUND,
+  WAL_ARCHIVE_CORRUPT_ERROR
+} WalArchiveStatus_t;
+
+typedef struct WalArchiveError {
+  WalArchiveStatus_t code;
+  char              message[BUF_LEN_M];
+} WalArchiveError_t;
+
+typedef struct WalIndexEntry {
+  uint64_t          start_lsn;
+  uint64_t          batch_lsn;          // first segment of the batch archive holding it
+  int64_t           end_time;
+  uint32_t          timeline;
+} WalIndexEntry_t;
+
+typedef struct WalIndex {
+  int               fd;
+  char              path[BUF_LEN];
+  uint32_t          segment_size;
+  uint64_t          count;
+} WalIndex_t;
+
+/* segments received into one archive */
+typedef struct WalBatch {
+  StorageSink_t     *sink;
+  Pipeline_t        *pipe;
+  char              name[BUF_LEN_S];
+  uint32_t          timeline;
+  uint64_t          first_lsn;
+  WalIndexEntry_t   *entries;           // its complete segments
+  size_t            count;
+  struct WalBatch   *next;
+} WalBatch_t;
+
+typedef struct WalArchive {
+  AppConfig_t       *cfg;
+  PgConn_t          *conn;
+  WalIndex_t        *index;
+  uint32_t          segment_size;
+  uint32_t          timeline;           // being streamed
+  uint64_t          position;           // next WAL byte expected
+  size_t            batch_segments;
+  WalBatch_t        *batch;             // being received into, NULL between batches
+  PipeWriter_t      writer;             // of the segment being received
+  bool              in_segment;
+  uint64_t          reported;           // flush position last sent to the server
+  time_t            reported_at;
+  uint64_t          segments;           // archived in full
+  // batches waiting for the committer, oldest first
+  WalBatch_t        *queue;
+  size_t            pending;
+  uint64_t          flushed;            // end of the last indexed segment
+  bool              started;            // the committer runs
+  bool              stopping;
+  bool              failed;
+  char              message[BUF_LEN_M];
+  pthread_t         committer;
+  pthread_mutex_t   lock;
+  pthread_cond_t    cond;
+} WalArchive_t;
+
+
+/* the 24 hex digit file name of the segment holding @lsn */
+void wal_segment_name(uint32_t timeline, uint64_t lsn, uint32_t segment_size, char name[WAL_SEGMENT_NAME_LEN + 1]);
+/* parses a segment file name; 0 on success */
+int wal_parse_segment_name(const char *name, uint32_t segment_size, uint32_t *timeline, uint64_t *lsn);
+/* the name of the history file of @timeline, "00000002.history" */
+void wal_history_name(uint32_t timeline, char name[WAL_HISTORY_NAME_LEN + 1]);
+/* parses a history file name; 0 on success, -1 as well for timeline 1, which has none */
+int wal_parse_history_name(const char *name, uint32_t *timeline);
+/* parses an LSN as the server prints it, "16/B374D848"; 0 on success */
+int wal_parse_lsn(const char *text, uint64_t *lsn);
+/* parses a `SHOW wal_segment_size` value such as "16MB"; 0 when it is not a valid size */
+uint32_t wal_parse_size(const char *text);
+
+/**
+ * wal_index_open - opens the segment index under `output_path`
+ * @output_path: `storage.output_path`
+ * @segment_size: segment size of new indexes, 0 to only open an
+ * existing one
+ * @err: written error object on failure
+ *
+ * A record torn at the end is left out, and cut off when the index
+ * is opened for writing. Without @segment_size it is opened read-only.
+ * Return: the index, or NULL; WAL_ARCHIVE_NOT_FOUND when there is none
+ **/
+WalIndex_t *wal_index_open(const char *output_path, uint32_t segment_size, WalArchiveError_t **err);
+/* wal_index_open() of the index file at @path, such as a copy fetched from the remote */
+WalIndex_t *wal_index_open_file(const char *path, uint32_t segment_size, WalArchiveError_t **err);
+/* reads record @pos; 0 on success, -1 when it cannot be read or fails its CRC */
+int wal_index_read(const WalIndex_t *index, uint64_t pos, WalIndexEntry_t *entry);
+/* appends @count records and syncs them; 0 on success */
+int wal_index_append(WalIndex_t *index, const WalIndexEntry_t *entries, size_t count);
+
+/**
+ * wal_index_find - looks up the segment of @timeline holding @lsn
+ * @index: the index
+ * @timeline: timeline of the segment
+ * @lsn: any position inside the segment
+ * @entry: written record
+ *
+ * Return: WAL_ARCHIVE_OK, WAL_ARCHIVE_NOT_FOUND or WAL_ARCHIVE_CORRUPT_ERROR
+ **/
+WalArchiveStatus_t wal_index_find(const WalIndex_t *index, uint32_t timeline, uint64_t lsn, WalIndexEntry_t *entry);
+
+/**
+ * wal_index_range - the records of @timeline whose segments hold
+ * WAL between @from_lsn and @to_lsn
+ * @index: the index
+ * @timeline: the timeline
+ * @from_lsn: start of the range
+ * @to_lsn: end of the range, inclusive
+ * @first: written position of the first record
+ * @count: written number of records, 0 when none
+ *
+ * The range is complete when @count is the number of segments
+ * between the two positions.
+ * Return: WAL_ARCHIVE_OK or WAL_ARCHIVE_CORRUPT_ERROR
+ **/
+WalArchiveStatus_t wal_index_range(const WalIndex_t *index, uint32_t timeline, uint64_t from_lsn, uint64_t to_lsn,
+  uint64_t *first, uint64_t *count);
+
+/* the first record whose segment ended at or after @time, @index->count when none did */
+WalArchiveStatus_t wal_index_find_time(const WalIndex_t *index, int64_t time, uint64_t *pos);
+
+/**
+ * init_wal_archive - connects to `db.uri` as a streaming replica and
+ * opens the segment index
+ * @cfg: application config
+ * @err: written error object on failure
+ *
+ * Return: the archive, ready to run, or NULL on failure
+ **/
+WalArchive_t *init_wal_archive(AppConfig_t *cfg, WalArchiveError_t **err);
+
+/**
+ * wal_archive_run - streams and archives WAL until *@stop is set
+ * @archive: the archive
+ * @stop: polled every WAL_ARCHIVE_POLL_MS, may be set from a signal
+ * handler
+ * @err: written error object on failure
+ *
+ * Every batch received is committed and indexed before it returns.
+ * Return: WalArchiveStatus_t
+ **/
+WalArchiveStatus_t wal_archive_run(WalArchive_t *archive, const int *stop, WalArchiveError_t **err);
+
+/* end of the last segment committed and indexed */
+uint64_t wal_archive_flushed(WalArchive_t *archive);
+
+/**
+ * wal_archive_fetch - writes archived segment or history file @segment
+ * to @path, the `restore_command` of a point-in-time recovery
+ * @cfg: application config
+ * @segment: segment or history file name
+ * @path: file written, through a .partial file renamed in place
+ * @err: written error object on failure
+ *
+ * The index and the batch are fetched from `storage.remote_target`
+ * when there is no local copy.
+ * Return: WalArchiveStatus_t, WAL_ARCHIVE_NOT_FOUND when the file is
+ * not archived
+ **/
+WalArchiveStatus_t wal_archive_fetch(AppConfig_t *cfg, const char *segment, const char *path,
+  WalArchiveError_t **err);
+
+WalArchiveError_t *create_wal_archive_error(WalArchiveStatus_t code, const char *message);
+void destroy_wal_index(WalIndex_t **index);
+void destroy_wal_archive(WalArchive_t **archive);
+void destroy_wal_archive_error(WalArchiveError_t **err);
+
+
+#endif /* ___WALARCHIVE_H___ */
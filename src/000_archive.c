@@ -0,0 +1,116 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include "include/archive.h"
+
+
+ArchiveIndex_t *init_archive_index(void) {
+  ArchiveIndex_t *index = calloc(1, sizeof(ArchiveIndex_t));
+
+  if (!index) return NULL;
+  if (pthread_mutex_init(&index->lock, NULL) != 0) {
+    free(index);
+
+    return NULL;
+  }
+
+  return index;
+}
+
+int archive_index_name_object(ArchiveIndex_t *index, uint32_t id, const char *name) {
+  int status = 0;
+
+  pthread_mutex_lock(&index->lock);
+  if (index->object_count == index->object_capacity) {
+    uint32_t capacity = index->object_capacity ? index->object_capacity * 2 : 16;
+    ArchiveObject_t *objects = realloc(index->objects, capacity * sizeof(ArchiveObject_t));
+
+    if (objects) {
+      index->objects = objects;
+      index->object_capacity = capacity;
+    } else {
+      status = -1;
+    }
+  }
+  if (status == 0) {
+    ArchiveObject_t *obj = &index->objects[index->object_count++];
+
+    memset(obj, 0, sizeof(*obj));
+    obj->id = id;
+    snprintf(obj->name, sizeof(obj->name), "%s", name);
+  }
+  pthread_mutex_unlock(&index->lock);
+
+  return status;
+}
+
+int archive_index_add_frame(ArchiveIndex_t *index, const ArchiveFrame_t *frame) {
+  if (index->frame_count == index->frame_capacity) {
+    uint64_t capacity = index->frame_capacity ? index->frame_capacity * 2 : 1024;
+    ArchiveFrame_t *frames = realloc(index->frames, capacity * sizeof(ArchiveFrame_t));
+
+    if (!frames) return -1;
+    index->frames = frames;
+    index->frame_capacity = capacity;
+  }
+  index->frames[index->frame_count++] = *frame;
+
+  return 0;
+}
+
+ArchiveObject_t *archive_find_object(const ArchiveReader_t *reader, const char *name) {
+  return archive_find_next_object(reader, name, NULL);
+}
+
+ArchiveObject_t *archive_find_next_object(const ArchiveReader_t *reader, const char *name, const ArchiveObject_t *prev) {
+  uint32_t start = prev ? (uint32_t)(prev - reader->index->objects) + 1 : 0;
+
+  for (uint32_t i = start; i < reader->index->object_count; i++) {
+    if (strcmp(reader->index->objects[i].name, name) == 0) return &reader->index->objects[i];
+  }
+
+  return NULL;
+}
+
+ArchiveError_t *create_archive_error(ArchiveStatus_t code, const char *message) {
+  ArchiveError_t *err = malloc(sizeof(ArchiveError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+void destroy_archive_index(ArchiveIndex_t **index) {
+  if (!index || !*index) return;
+
+  pthread_mutex_destroy(&(*index)->lock);
+  free((*index)->objects);
+  free((*index)->frames);
+  free(*index);
+  *index = NULL;
+}
+
+void destroy_archive_reader(ArchiveReader_t **reader) {
+  if (!reader || !*reader) return;
+  ArchiveReader_t *r = *reader;
+
+  if (r->fd >= 0) close(r->fd);
+  destroy_archive_index(&r->index);
+  free(r->chunk_ids);
+  free(r->chunk_ends);
+  OPENSSL_cleanse(r->key, sizeof(r->key));
+  free(r);
+  *reader = NULL;
+}
+
+void destroy_archive_error(ArchiveError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
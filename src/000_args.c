@@ -67,6 +67,8 @@ ArgParserStatus_t parse_args(
       case ARG_TYPE_INT:
       {
         token = strtok(NULL, "=");
+        // "--flag value" as well as "--flag=value"
+        if (!token && i + 1 < argc && argv[i + 1][0] != '-') token = argv[++i];
 
         if (!token)
         {
@@ -101,6 +103,7 @@ ArgParserStatus_t parse_args(
       case ARG_TYPE_STRING:
       {
         token = strtok(NULL, "=");
+        if (!token && i + 1 < argc && argv[i + 1][0] != '-') token = argv[++i];
         if (!token)
         {
           if (err) {
@@ -0,0 +1,75 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/cdc.h"
+#include "include/pgdump.h"
+
+
+bool cdc_selected(const DBConfig_t *db) {
+  return db->incremental_enabled && strcmp(db->incremental_strategy, "logical") == 0 && pgdump_supported(db);
+}
+
+void cdc_format_lsn(uint64_t lsn, char out[CDC_LSN_LEN]) {
+  snprintf(out, CDC_LSN_LEN, "%" PRIX32 "/%" PRIX32, (uint32_t)(lsn >> 32), (uint32_t)lsn);
+}
+
+int cdc_read_head(const char *output_path, CdcHead_t *head) {
+  char path[BUF_LEN], line[BUF_LEN], extra;
+  unsigned int hi, lo;
+  unsigned long long seq;
+  FILE *fh;
+  int status = -1;
+
+  snprintf(path, sizeof(path), "%s/%s", output_path, CDC_HEAD_FILE);
+  fh = fopen(path, "r");
+  if (!fh) return errno == ENOENT ? 1 : -1;
+  if (fgets(line, sizeof(line), fh) && sscanf(line, "%63s %255s %X/%X %llu %c", head->slot, head->full, &hi, &lo,
+    &seq, &extra) == 5) {
+    head->lsn = (uint64_t)hi << 32 | lo;
+    head->seq = seq;
+    status = 0;
+  }
+  fclose(fh);
+
+  return status;
+}
+
+int cdc_write_head(const char *output_path, const CdcHead_t *head) {
+  char path[BUF_LEN], partial[BUF_LEN + 16], line[BUF_LEN], lsn[CDC_LSN_LEN];
+  int fd, len, status;
+
+  cdc_format_lsn(head->lsn, lsn);
+  len = snprintf(line, sizeof(line), "%s %s %s %" PRIu64 "\n", head->slot, head->full, lsn, head->seq);
+  snprintf(path, sizeof(path), "%s/%s", output_path, CDC_HEAD_FILE);
+  snprintf(partial, sizeof(partial), "%s.partial", path);
+  fd = open(partial, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+  if (fd < 0) return -1;
+  status = write(fd, line, (size_t)len) == len && fsync(fd) == 0 ? 0 : -1;
+  if (close(fd) != 0) status = -1;
+  if (status == 0 && rename(partial, path) != 0) status = -1;
+  if (status != 0) unlink(partial);
+
+  return status;
+}
+
+CdcError_t *create_cdc_error(CdcStatus_t code, const char *message) {
+  CdcError_t *err = malloc(sizeof(CdcError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+void destroy_cdc_error(CdcError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
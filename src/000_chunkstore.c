@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/chunkstore.h"
+
+uint64_t chunk_gear[256];
+static pthread_once_t chunk_gear_once = PTHREAD_ONCE_INIT;
+
+
+/* the table is part of the repository format: changing it changes every cut point */
+void chunk_gear_init(void) {
+  uint64_t state = CHUNK_GEAR_SEED;
+
+  for (size_t i = 0; i < 256; i++) {
+    uint64_t z = (state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    chunk_gear[i] = z ^ (z >> 31);
+  }
+}
+
+void init_chunker(Chunker_t *ch) {
+  pthread_once(&chunk_gear_once, chunk_gear_init);
+  ch->hash = 0;
+  ch->pos = 0;
+  // masks sit in the top bits, which the gear hash fills from the last 64 bytes
+  ch->mask_s = ~0ULL << (64 - (CHUNK_AVG_BITS + CHUNK_NORMALIZATION));
+  ch->mask_l = ~0ULL << (64 - (CHUNK_AVG_BITS - CHUNK_NORMALIZATION));
+}
+
+void chunk_id_hex(const unsigned char id[CHUNK_ID_LEN], char hex[2 * CHUNK_ID_LEN + 1]) {
+  static const char digits[] = "0123456789abcdef";
+
+  for (size_t i = 0; i < CHUNK_ID_LEN; i++) {
+    hex[2 * i] = digits[id[i] >> 4];
+    hex[2 * i + 1] = digits[id[i] & 0x0f];
+  }
+  hex[2 * CHUNK_ID_LEN] = '\0';
+}
+
+ChunkStore_t *init_chunk_store(const char *output_path, const char *compression, ChunkStoreError_t **err) {
+  ChunkStore_t *store = calloc(1, sizeof(ChunkStore_t));
+  char message[BUF_LEN_M];
+  CodecSpec_t spec;
+
+  if (!store) {
+    if (err) *err = create_chunk_store_error(CHUNKSTORE_MEMORY_ERROR, "Failed to allocate chunk store!");
+
+    return NULL;
+  }
+  store->dir_fd = -1;
+
+  if (codec_parse_spec(compression, &spec) != 0 || (spec.id != CODEC_NONE && !codec_lookup(spec.id))) {
+    snprintf(message, sizeof(message), "Unsupported storage compression: %s", compression);
+    if (err) *err = create_chunk_store_error(CHUNKSTORE_CONFIG_ERROR, message);
+    destroy_chunk_store(&store);
+
+    return NULL;
+  }
+  // chunks are far smaller than the long window, and compressed one at a time
+  spec.long_window = false;
+  spec.workers = 0;
+  if (spec.id != CODEC_NONE) {
+    store->codec = codec_lookup(spec.id);
+    store->codec_state = store->codec->create(&spec);
+  }
+  store->scratch_len = CHUNKSTORE_HEADER_LEN + CHUNK_MAX_SIZE + PIPELINE_BLOCK_HEADROOM(CHUNK_MAX_SIZE);
+  store->scratch = malloc(store->scratch_len);
+  if (!store->scratch || (store->codec && !store->codec_state)) {
+    if (err) *err = create_chunk_store_error(CHUNKSTORE_MEMORY_ERROR, "Failed to allocate chunk store!");
+    destroy_chunk_store(&store);
+
+    return NULL;
+  }
+
+  snprintf(store->root, sizeof(store->root), "%s/%s", output_path, CHUNKSTORE_DIR);
+  if ((mkdir(output_path, 0750) != 0 && errno != EEXIST) || (mkdir(store->root, 0750) != 0 && errno != EEXIST)
+    || (store->dir_fd = open(store->root, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0) {
+    snprintf(message, sizeof(message), "Cannot open chunk store %.400s: %s", store->root, strerror(errno));
+    if (err) *err = create_chunk_store_error(CHUNKSTORE_IO_ERROR, message);
+    destroy_chunk_store(&store);
+
+    return NULL;
+  }
+
+  return store;
+}
+
+ChunkStoreError_t *create_chunk_store_error(ChunkStoreStatus_t code, const char *message) {
+  ChunkStoreError_t *err = malloc(sizeof(ChunkStoreError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+void destroy_chunk_store(ChunkStore_t **store) {
+  if (!store || !*store) return;
+  ChunkStore_t *s = *store;
+  ChunkSeen_t *seen, *tmp;
+
+  HASH_ITER(hh, s->seen, seen, tmp) {
+    HASH_DEL(s->seen, seen);
+    free(seen);
+  }
+  if (s->codec_state) s->codec->destroy(s->codec_state);
+  if (s->dir_fd >= 0) close(s->dir_fd);
+  free(s->scratch);
+  free(s);
+  *store = NULL;
+}
+
+void destroy_chunk_store_error(ChunkStoreError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
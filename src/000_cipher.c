@@ -0,0 +1,136 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#if defined(__aarch64__)
+#include <sys/auxv.h>
+#endif
+#include "include/cipher.h"
+
+
+CipherId_t cipher_preferred(void) {
+#if defined(__x86_64__) || defined(__i386__)
+  if (__builtin_cpu_supports("aes") && __builtin_cpu_supports("pclmul")) return CIPHER_AES_256_GCM;
+#elif defined(__aarch64__) && defined(HWCAP_AES) && defined(HWCAP_PMULL)
+  unsigned long hwcap = getauxval(AT_HWCAP);
+
+  if ((hwcap & HWCAP_AES) && (hwcap & HWCAP_PMULL)) return CIPHER_AES_256_GCM;
+#endif
+  // table-based AES is slow and leaks timing; ChaCha20 is fast in plain C
+  return CIPHER_CHACHA20_POLY1305;
+}
+
+const char *cipher_name(CipherId_t id) {
+  switch (id) {
+    case CIPHER_AES_256_GCM: return "aes-256-gcm";
+    case CIPHER_CHACHA20_POLY1305: return "chacha20-poly1305";
+    default: return "none";
+  }
+}
+
+const EVP_CIPHER *cipher_evp(CipherId_t id) {
+  switch (id) {
+    case CIPHER_AES_256_GCM: return EVP_aes_256_gcm();
+    case CIPHER_CHACHA20_POLY1305: return EVP_chacha20_poly1305();
+    default: return NULL;
+  }
+}
+
+int cipher_hex_value(int c) {
+  if (c >= '0' && c <= '9') return c - '0';
+  c = tolower(c);
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+
+  return -1;
+}
+
+int cipher_load_key(const char *path, unsigned char key[CIPHER_KEY_LEN], char *message, size_t message_len) {
+  unsigned char buf[2 * CIPHER_KEY_LEN + 3];
+  FILE *fh = fopen(path, "rb");
+  size_t n;
+
+  if (!fh) {
+    snprintf(message, message_len, "Cannot read encryption key %s: %s", path, strerror(errno));
+
+    return -1;
+  }
+  n = fread(buf, 1, sizeof(buf), fh);
+  fclose(fh);
+
+  // a hex key may end in a newline, a raw key is taken byte for byte
+  while (n > 2 * CIPHER_KEY_LEN && n < sizeof(buf) && (buf[n - 1] == '\n' || buf[n - 1] == '\r')) n--;
+  if (n == CIPHER_KEY_LEN) {
+    memcpy(key, buf, CIPHER_KEY_LEN);
+    OPENSSL_cleanse(buf, sizeof(buf));
+
+    return 0;
+  }
+  if (n == 2 * CIPHER_KEY_LEN) {
+    for (size_t i = 0; i < CIPHER_KEY_LEN; i++) {
+      int hi = cipher_hex_value(buf[2 * i]), lo = cipher_hex_value(buf[2 * i + 1]);
+
+      if (hi < 0 || lo < 0) break;
+      key[i] = (unsigned char)(hi << 4 | lo);
+      if (i == CIPHER_KEY_LEN - 1) {
+        OPENSSL_cleanse(buf, sizeof(buf));
+
+        return 0;
+      }
+    }
+  }
+  OPENSSL_cleanse(buf, sizeof(buf));
+  OPENSSL_cleanse(key, CIPHER_KEY_LEN);
+  snprintf(message, message_len, "Encryption key %s must hold %d raw bytes or %d hex digits",
+    path, CIPHER_KEY_LEN, 2 * CIPHER_KEY_LEN);
+
+  return -1;
+}
+
+CipherStage_t *init_cipher_stage(CipherId_t id, const unsigned char key[CIPHER_KEY_LEN], CodecId_t codec, size_t workers) {
+  CipherStage_t *stage = calloc(1, sizeof(CipherStage_t));
+  const EVP_CIPHER *cipher = cipher_evp(id);
+
+  if (!stage) return NULL;
+  stage->id = id;
+  stage->workers = workers;
+  memcpy(stage->file_header, CIPHER_MAGIC, strlen(CIPHER_MAGIC));
+  stage->file_header[7] = CIPHER_FORMAT_VERSION;
+  stage->file_header[8] = (unsigned char)id;
+  stage->file_header[9] = (unsigned char)codec;
+
+  stage->worker_ctx = calloc(workers + 1, sizeof(EVP_CIPHER_CTX *));
+  if (!cipher || !stage->worker_ctx || RAND_bytes(stage->key, CIPHER_KEY_LEN) != 1
+    || cipher_wrap_key(key, stage->key, stage->file_header) != 0) {
+    destroy_cipher_stage(&stage);
+
+    return NULL;
+  }
+  // the key schedule is done once per context; chunks only change the nonce
+  for (size_t i = 0; i <= workers; i++) {
+    stage->worker_ctx[i] = EVP_CIPHER_CTX_new();
+    if (!stage->worker_ctx[i] || EVP_EncryptInit_ex(stage->worker_ctx[i], cipher, NULL, stage->key, NULL) != 1) {
+      destroy_cipher_stage(&stage);
+
+      return NULL;
+    }
+  }
+
+  return stage;
+}
+
+void destroy_cipher_stage(CipherStage_t **stage) {
+  if (!stage || !*stage) return;
+  CipherStage_t *s = *stage;
+
+  if (s->worker_ctx) {
+    for (size_t i = 0; i <= s->workers; i++) EVP_CIPHER_CTX_free(s->worker_ctx[i]);
+    free(s->worker_ctx);
+  }
+  OPENSSL_cleanse(s->key, sizeof(s->key));
+  free(s);
+  *stage = NULL;
+}
@@ -0,0 +1,83 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "include/clone.h"
+
+
+int init_clone_run(CloneRun_t *run, AppConfig_t *cfg, const char *from, const char *to) {
+  uint64_t range = cfg->runtime->split_chunk_size;
+
+  memset(run, 0, sizeof(*run));
+  run->cfg = cfg;
+  run->from = from;
+  run->to = to;
+  // ranges of a clone have to stay block aligned, whatever block size the file system has
+  run->range = range ? (range < CLONE_RANGE_ALIGN ? CLONE_RANGE_ALIGN : range - range % CLONE_RANGE_ALIGN) : 0;
+  run->reflink = true;
+  run->kernel_copy = true;
+  if (pthread_mutex_init(&run->lock, NULL) != 0) return -1;
+
+  return 0;
+}
+
+CloneFile_t *clone_run_add_file(CloneRun_t *run, const char *path, const struct statx *stx) {
+  CloneFile_t *file = calloc(1, sizeof(CloneFile_t));
+
+  if (!file) return NULL;
+  file->path = strdup(path);
+  if (!file->path) {
+    free(file);
+
+    return NULL;
+  }
+  file->mode = stx->stx_mode;
+  file->uid = stx->stx_uid;
+  file->gid = stx->stx_gid;
+  file->size = stx->stx_size;
+  file->mtime.tv_sec = stx->stx_mtime.tv_sec;
+  file->mtime.tv_nsec = stx->stx_mtime.tv_nsec;
+  pthread_mutex_lock(&run->lock);
+  HASH_ADD_KEYPTR(hh, run->files, file->path, strlen(file->path), file);
+  pthread_mutex_unlock(&run->lock);
+
+  return file;
+}
+
+int clone_run_fail(CloneRun_t *run, const char *what, const char *path, int error) {
+  __atomic_store_n(&run->failed, true, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&run->lock);
+  if (!run->message[0]) snprintf(run->message, sizeof(run->message), "%s %s: %s", what, path, strerror(error));
+  pthread_mutex_unlock(&run->lock);
+
+  return -1;
+}
+
+void destroy_clone_run(CloneRun_t *run) {
+  CloneFile_t *file, *tmp;
+
+  HASH_ITER(hh, run->files, file, tmp) {
+    HASH_DEL(run->files, file);
+    free(file->path);
+    free(file);
+  }
+  pthread_mutex_destroy(&run->lock);
+}
+
+CloneError_t *create_clone_error(CloneStatus_t code, const char *message) {
+  CloneError_t *err = malloc(sizeof(CloneError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+void destroy_clone_error(CloneError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
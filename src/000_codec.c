@@ -0,0 +1,202 @@
+#define _GNU_SOURCE
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "include/codec.h"
+#include "include/config_parser.h"
+
+typedef struct CodecName {
+  const char        *name;
+  CodecId_t         id;
+  int               max_level;
+  bool              has_long;
+} CodecName_t;
+
+extern const Codec_t gzip_codec;
+#ifdef DBEETLE_HAVE_ZSTD
+extern const Codec_t zstd_codec;
+#endif
+#ifdef DBEETLE_HAVE_LZ4
+extern const Codec_t lz4_codec;
+#endif
+
+static const Codec_t *const registered_codecs[] = {
+  &gzip_codec,
+#ifdef DBEETLE_HAVE_ZSTD
+  &zstd_codec,
+#endif
+#ifdef DBEETLE_HAVE_LZ4
+  &lz4_codec,
+#endif
+};
+
+// every spec we accept, whether or not its library was compiled in
+static const CodecName_t codec_names[] = {
+  { "gzip", CODEC_GZIP, 9, false },
+  { "zstd", CODEC_ZSTD, 22, true },
+  { "lz4", CODEC_LZ4, LZ4_MAX_ACCELERATION, false },
+};
+
+
+const Codec_t *codec_lookup(CodecId_t id) {
+  for (size_t i = 0; i < sizeof(registered_codecs) / sizeof(registered_codecs[0]); i++) {
+    if (registered_codecs[i]->id == id) return registered_codecs[i];
+  }
+
+  return NULL;
+}
+
+int codec_parse_spec(const char *compression, CodecSpec_t *out) {
+  char spec[BUF_LEN_XS];
+  char *token, *save = NULL, *end = NULL;
+  const CodecName_t *codec = NULL;
+  bool has_level = false;
+
+  out->id = CODEC_NONE;
+  out->level = CODEC_LEVEL_DEFAULT;
+  out->long_window = false;
+  out->workers = 0;
+
+  if (compression[0] == '\0' || strcmp(compression, DEFAULT_STORAGE_COMPRESSION) == 0) return 0;
+  if (strcmp(compression, "none") == 0) return 0;
+  if (strlen(compression) >= sizeof(spec)) return -1;
+  strcpy(spec, compression);
+
+  token = strtok_r(spec, ":", &save);
+  for (size_t i = 0; token && i < sizeof(codec_names) / sizeof(codec_names[0]); i++) {
+    if (strcmp(codec_names[i].name, token) == 0) codec = &codec_names[i];
+  }
+  if (!codec) return -1;
+  out->id = codec->id;
+
+  // an empty option ("gzip:") is as much a typo as an unknown one
+  if (compression[strlen(compression) - 1] == ':' || strstr(compression, "::")) return -1;
+
+  while ((token = strtok_r(NULL, ":", &save)) != NULL) {
+    if (strcmp(token, "long") == 0 && codec->has_long && !out->long_window) {
+      out->long_window = true;
+      continue;
+    }
+
+    long val = strtol(token, &end, 10);
+
+    if (has_level || end == token || *end != '\0' || val < 0 || val > codec->max_level) return -1;
+    out->level = (int)val;
+    has_level = true;
+  }
+
+  return 0;
+}
+
+CompressStage_t *init_compress_stage(const CodecSpec_t *spec, size_t workers) {
+  CompressStage_t *stage = calloc(1, sizeof(CompressStage_t));
+
+  if (!stage) return NULL;
+  stage->codec = codec_lookup(spec->id);
+  stage->spec = *spec;
+  stage->workers = workers;
+  stage->worker_state = calloc(workers, sizeof(void *));
+  if (!stage->codec || !stage->worker_state) {
+    destroy_compress_stage(&stage);
+
+    return NULL;
+  }
+
+  for (size_t i = 0; i < workers; i++) {
+    stage->worker_state[i] = stage->codec->create(spec);
+    if (!stage->worker_state[i]) {
+      destroy_compress_stage(&stage);
+
+      return NULL;
+    }
+  }
+
+  return stage;
+}
+
+/**
+ * codec_sample_entropy - Shannon entropy of a block's bytes
+ * @data: the block
+ * @len: block length
+ *
+ * Only about CODEC_ENTROPY_SAMPLE bytes, spread evenly over the block,
+ * are looked at.
+ * Return: entropy in bits per byte, from 0 to 8
+ **/
+double codec_sample_entropy(const unsigned char *data, size_t len) {
+  size_t counts[256] = {0};
+  size_t stride = len > CODEC_ENTROPY_SAMPLE ? len / CODEC_ENTROPY_SAMPLE : 1;
+  size_t samples = 0;
+  double entropy = 0.0;
+
+  for (size_t i = 0; i < len; i += stride) {
+    counts[data[i]]++;
+    samples++;
+  }
+  for (int b = 0; b < 256; b++) {
+    if (!counts[b]) continue;
+    double p = (double)counts[b] / (double)samples;
+    entropy -= p * log2(p);
+  }
+
+  return entropy;
+}
+
+/**
+ * compress_stage_process - pipeline stage compressing one block with the
+ * calling worker's codec state
+ * @ctx: the CompressStage_t
+ * @buf: the block, swapped to its compressed (or stored) form on success
+ * @worker_id: index of the stage worker
+ *
+ * Return: 0 on success, -1 on codec failure
+ **/
+int compress_stage_process(void *ctx, PipeBuffer_t *buf, size_t worker_id) {
+  CompressStage_t *stage = ctx;
+  void *state = stage->worker_state[worker_id];
+  unsigned char *tmp;
+  size_t out_len = 0;
+  bool store = buf->len >= CODEC_ENTROPY_SAMPLE
+    && codec_sample_entropy(buf->data, buf->len) >= CODEC_RAW_ENTROPY_BITS;
+
+  if (stage->spec.id == CODEC_GZIP) buf->check = (uint32_t)crc32(0L, buf->data, (uInt)buf->len);
+
+  if (!store) {
+    if (stage->codec->compress(state, buf->data, buf->len, buf->scratch, buf->capacity, &out_len) != 0) return -1;
+    // a trial that barely shrinks costs the restore side a decompress for nothing
+    store = out_len * 100 > buf->len * (100 - CODEC_MIN_GAIN_PERCENT);
+  }
+  if (store) {
+    if (stage->codec->store(state, buf->data, buf->len, buf->scratch, buf->capacity, &out_len) != 0) return -1;
+    buf->flags |= PIPE_BUF_RAW;
+    __atomic_add_fetch(&stage->raw_blocks, 1, __ATOMIC_RELAXED);
+  }
+  __atomic_add_fetch(&stage->blocks, 1, __ATOMIC_RELAXED);
+
+  tmp = buf->data, buf->data = buf->scratch, buf->scratch = tmp;
+  buf->len = out_len;
+
+  return 0;
+}
+
+void compress_stage_release(void *ctx) {
+  CompressStage_t *stage = ctx;
+
+  destroy_compress_stage(&stage);
+}
+
+void destroy_compress_stage(CompressStage_t **stage) {
+  if (!stage || !*stage) return;
+  CompressStage_t *s = *stage;
+
+  if (s->worker_state) {
+    for (size_t i = 0; i < s->workers; i++) {
+      if (s->worker_state[i]) s->codec->destroy(s->worker_state[i]);
+    }
+    free(s->worker_state);
+  }
+  free(s);
+  *stage = NULL;
+}
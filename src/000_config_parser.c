@@ -11,6 +11,12 @@ DBConfig_t *init_db_config(const char *type, const char *uri, size_t timeout_sec
   cfg->uri[sizeof(cfg->uri) - 1] = '\0';
   cfg->timeout_seconds = timeout_seconds;
   cfg->incremental_enabled = incremental_enabled;
+  strcpy(cfg->driver_path, DEFAULT_DB_DRIVER_PATH);
+  strcpy(cfg->incremental_strategy, DEFAULT_DB_INCREMENTAL_STRATEGY);
+  strcpy(cfg->cdc_slot, DEFAULT_DB_CDC_SLOT);
+  strcpy(cfg->wal_slot, DEFAULT_DB_WAL_SLOT);
+  cfg->snapshot[0] = '\0';
+  cfg->data_dir[0] = '\0';
 
   return cfg;
 }
@@ -27,6 +33,10 @@ StorageConfig_t *init_storage_config(const char *output_path, const char *compre
   cfg->encryption_key_path[sizeof(cfg->encryption_key_path) - 1] = '\0';
   strncpy(cfg->remote_target, remote_target, sizeof(cfg->remote_target) - 1);
   cfg->remote_target[sizeof(cfg->remote_target) - 1] = '\0';
+  cfg->remote_connections = DEFAULT_STORAGE_REMOTE_CONNECTIONS;
+  cfg->dedup_enabled = DEFAULT_STORAGE_DEDUP;
+  strcpy(cfg->writer, DEFAULT_STORAGE_WRITER);
+  cfg->direct_io = DEFAULT_STORAGE_DIRECT_IO;
 
   return cfg;
 }
@@ -39,6 +49,7 @@ RuntimeConfig_t *init_runtime_config(size_t log_level, size_t thread_count, cons
   cfg->thread_count = thread_count;
   strncpy(cfg->temp_dir, temp_dir, sizeof(cfg->temp_dir) - 1);
   cfg->temp_dir[sizeof(cfg->temp_dir) - 1] = '\0';
+  cfg->split_chunk_size = DEFAULT_RUNTIME_SPLIT_CHUNK_SIZE;
 
   return cfg;
 }
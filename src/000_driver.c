@@ -0,0 +1,123 @@
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/driver.h"
+
+extern const Driver_t pgdump_driver;
+extern const Driver_t sqlitedump_driver;
+
+static const Driver_t *const registered_drivers[] = {
+  &pgdump_driver,
+  &sqlitedump_driver,
+};
+
+
+/* a plugin name goes into a file name: letters, digits, '_' and '-' only */
+bool driver_valid_name(const char *type) {
+  if (type[0] == '\0') return false;
+  for (const char *c = type; *c; c++) {
+    if (!((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'Z') || (*c >= '0' && *c <= '9') || *c == '_' || *c == '-')) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+DriverStatus_t driver_find(const DBConfig_t *db, DriverHandle_t *handle, DriverError_t **err) {
+  char file[BUF_LEN_S], path[BUF_LEN + BUF_LEN_S], message[BUF_LEN_M];
+  const Driver_t *driver;
+  void *library;
+
+  handle->driver = NULL;
+  handle->library = NULL;
+  for (size_t i = 0; i < sizeof(registered_drivers) / sizeof(registered_drivers[0]); i++) {
+    if (registered_drivers[i]->supports(db)) {
+      handle->driver = registered_drivers[i];
+
+      return DRIVER_OK;
+    }
+  }
+  if (strcmp(db->type, DEFAULT_DB_TYPE) == 0 || !driver_valid_name(db->type)) {
+    snprintf(message, sizeof(message), "No driver reads db.type \"%s\"", db->type);
+    if (err) *err = create_driver_error(DRIVER_LOAD_ERROR, 0, message);
+
+    return DRIVER_LOAD_ERROR;
+  }
+
+  snprintf(file, sizeof(file), DRIVER_PLUGIN_FORMAT, db->type);
+  if (db->driver_path[0]) snprintf(path, sizeof(path), "%s/%s", db->driver_path, file);
+  else snprintf(path, sizeof(path), "%s", file);
+  library = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+  if (!library) {
+    snprintf(message, sizeof(message), "No driver for db.type %s: %s", db->type, dlerror());
+    if (err) *err = create_driver_error(DRIVER_LOAD_ERROR, 0, message);
+
+    return DRIVER_LOAD_ERROR;
+  }
+  driver = dlsym(library, DRIVER_SYMBOL);
+  if (!driver || driver->abi_version != DRIVER_ABI_VERSION || !driver->open || !driver->list || !driver->stream
+    || !driver->close) {
+    snprintf(message, sizeof(message), "%.400s is not a driver for ABI version %d", path, DRIVER_ABI_VERSION);
+    if (err) *err = create_driver_error(DRIVER_LOAD_ERROR, 0, message);
+    dlclose(library);
+
+    return DRIVER_LOAD_ERROR;
+  }
+  if (driver->supports && !driver->supports(db)) {
+    snprintf(message, sizeof(message), "Driver %s does not read %s", driver->name, db->uri);
+    if (err) *err = create_driver_error(DRIVER_CONFIG_ERROR, 0, message);
+    dlclose(library);
+
+    return DRIVER_CONFIG_ERROR;
+  }
+  handle->driver = driver;
+  handle->library = library;
+
+  return DRIVER_OK;
+}
+
+void driver_release(DriverHandle_t *handle) {
+  if (handle->library) dlclose(handle->library);
+  handle->library = NULL;
+  handle->driver = NULL;
+}
+
+unsigned char *driver_pipe_reserve(void *ctx, size_t *room) {
+  return pipe_writer_reserve(ctx, room);
+}
+
+int driver_pipe_commit(void *ctx, size_t len) {
+  return pipe_writer_commit(ctx, len) == PIPELINE_OK ? 0 : -1;
+}
+
+int driver_pipe_write(void *ctx, const void *data, size_t len) {
+  return pipe_writer_write(ctx, data, len) == PIPELINE_OK ? 0 : -1;
+}
+
+void driver_pipe_stream(DriverStream_t *out, PipeWriter_t *writer) {
+  out->ctx = writer;
+  out->reserve = driver_pipe_reserve;
+  out->commit = driver_pipe_commit;
+  out->write = driver_pipe_write;
+}
+
+DriverError_t *create_driver_error(DriverStatus_t code, int driver_code, const char *message) {
+  DriverError_t *err = malloc(sizeof(DriverError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  err->driver_code = driver_code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+void destroy_driver_error(DriverError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
@@ -0,0 +1,57 @@
+#include <stdlib.h>
+#include <string.h>
+#include "include/engine.h"
+#include "include/arguments.h"
+
+
+BackupEngine_t *init_backup_engine(AppConfig_t *cfg) {
+  BackupEngine_t *engine = calloc(1, sizeof(BackupEngine_t));
+
+  if (!engine) return NULL;
+  engine->cfg = cfg;
+  pthread_mutex_init(&engine->lock, NULL);
+
+  return engine;
+}
+
+void engine_add_object(BackupEngine_t *engine, const char *name, size_t estimated_bytes) {
+  engine_add_part(engine, name, estimated_bytes, 0, 1);
+}
+
+void engine_add_part(BackupEngine_t *engine, const char *name, size_t estimated_bytes, uint32_t part, uint32_t parts) {
+  DumpObject_t obj = {0};
+
+  strncpy(obj.name, name, sizeof(obj.name) - 1);
+  obj.estimated_bytes = estimated_bytes;
+  obj.part = part;
+  obj.parts = parts;
+  DYN_ARRAY_APPEND(engine->objects, engine->object_count, engine->object_capacity, obj);
+}
+
+EngineError_t *create_engine_error(EngineStatus_t code, const char *message) {
+  EngineError_t *err = malloc(sizeof(EngineError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+void destroy_backup_engine(BackupEngine_t **engine) {
+  if (!engine || !*engine) return;
+  BackupEngine_t *e = *engine;
+
+  destroy_scheduler(&e->sched);
+  if (e->objects) free(e->objects);
+  pthread_mutex_destroy(&e->lock);
+  free(e);
+  *engine = NULL;
+}
+
+void destroy_engine_error(EngineError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
@@ -0,0 +1,107 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "include/incremental.h"
+
+
+IncrManifest_t *init_incr_manifest(uint32_t block_size) {
+  IncrManifest_t *m = calloc(1, sizeof(IncrManifest_t));
+
+  if (!m) return NULL;
+  m->block_size = block_size ? block_size : INCR_BLOCK_SIZE;
+
+  return m;
+}
+
+int incr_manifest_push_chain(IncrManifest_t *m, const char *name) {
+  char (*chain)[BUF_LEN_S];
+
+  if (strlen(name) >= BUF_LEN_S) return -1;
+  chain = realloc(m->chain, (m->chain_len + 1) * sizeof(*chain));
+  if (!chain) return -1;
+  m->chain = chain;
+  snprintf(m->chain[m->chain_len], BUF_LEN_S, "%s", name);
+
+  return (int)m->chain_len++;
+}
+
+IncrFile_t *incr_manifest_add_file(IncrManifest_t *m, const char *path, uint32_t mode, uint64_t size, int64_t mtime_ns) {
+  IncrFile_t *file = calloc(1, sizeof(IncrFile_t));
+  uint64_t blocks = (size + m->block_size - 1) / m->block_size;
+
+  if (!file) return NULL;
+  file->path = strdup(path);
+  file->blocks = blocks ? calloc(blocks, sizeof(IncrBlock_t)) : NULL;
+  if (!file->path || (blocks && !file->blocks)) {
+    free(file->path);
+    free(file);
+
+    return NULL;
+  }
+  file->mode = mode;
+  file->size = size;
+  file->mtime_ns = mtime_ns;
+  file->block_count = blocks;
+  HASH_ADD_KEYPTR(hh, m->files, file->path, strlen(file->path), file);
+  m->file_count++;
+
+  return file;
+}
+
+void incr_manifest_remove_file(IncrManifest_t *m, IncrFile_t *file) {
+  HASH_DEL(m->files, file);
+  m->file_count--;
+  free(file->path);
+  free(file->blocks);
+  free(file);
+}
+
+bool incremental_selected(const DBConfig_t *db) {
+  // without a tree to back up, the driver's full dump stays the default
+  return db->incremental_enabled && strcmp(db->incremental_strategy, "blocks") == 0 && db->data_dir[0];
+}
+
+bool incremental_backup_exists(const StorageConfig_t *cfg, const char *name) {
+  char path[BUF_LEN];
+  struct stat st;
+
+  if (!name[0] || name[0] == '.' || strchr(name, '/')) return false;
+  snprintf(path, sizeof(path), "%s/%s%s", cfg->output_path, name, INCR_MANIFEST_SUFFIX);
+
+  return stat(path, &st) == 0 && S_ISREG(st.st_mode);
+}
+
+IncrError_t *create_incr_error(IncrStatus_t code, const char *message) {
+  IncrError_t *err = malloc(sizeof(IncrError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+void destroy_incr_manifest(IncrManifest_t **m) {
+  if (!m || !*m) return;
+  IncrManifest_t *manifest = *m;
+  IncrFile_t *file, *tmp;
+
+  HASH_ITER(hh, manifest->files, file, tmp) {
+    HASH_DEL(manifest->files, file);
+    free(file->path);
+    free(file->blocks);
+    free(file);
+  }
+  free(manifest->chain);
+  free(manifest);
+  *m = NULL;
+}
+
+void destroy_incr_error(IncrError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
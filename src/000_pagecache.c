@@ -0,0 +1,29 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/pagecache.h"
+
+
+void init_page_cache(PageCache_t *cache) {
+  memset(cache, 0, sizeof(*cache));
+  cache->fd = -1;
+}
+
+/* room for the residency of @pages pages; 0 on success */
+int pagecache_reserve(PageCache_t *cache, size_t pages) {
+  unsigned char *grown;
+
+  if (pages <= cache->capacity) return 0;
+  grown = realloc(cache->resident, pages);
+  if (!grown) return -1;
+  cache->resident = grown;
+  cache->capacity = pages;
+
+  return 0;
+}
+
+void destroy_page_cache(PageCache_t *cache) {
+  free(cache->resident);
+  init_page_cache(cache);
+}
@@ -0,0 +1,346 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/pgdump.h"
+#include "include/scheduler.h"
+
+#define PGDUMP_BEGIN_SQL ("BEGIN ISOLATION LEVEL REPEATABLE READ, READ ONLY")
+#define PGDUMP_LIST_TABLES_SQL \
+  ("SELECT n.nspname, c.relname, pg_catalog.pg_relation_size(c.oid) " \
+   "FROM pg_catalog.pg_class c JOIN pg_catalog.pg_namespace n ON n.oid = c.relnamespace " \
+   "WHERE c.relkind = 'r' AND n.nspname <> 'information_schema' AND n.nspname !~ '^pg_' " \
+   "ORDER BY 1, 2")
+
+
+bool pgdump_supported(const DBConfig_t *db) {
+  if (strcmp(db->type, "postgres") == 0 || strcmp(db->type, "postgresql") == 0) return true;
+
+  return (db->type[0] == '\0' || strcmp(db->type, DEFAULT_DB_TYPE) == 0)
+    && (strncmp(db->uri, "postgresql://", 13) == 0 || strncmp(db->uri, "postgres://", 11) == 0);
+}
+
+/* fails the session setup with what @conn last reported */
+PgDumpStatus_t pgdump_conn_fail(PgDumpStatus_t code, const char *what, const PgConn_t *conn, PgDumpError_t **err) {
+  char message[BUF_LEN_M];
+
+  if (conn->sqlstate[0]) {
+    snprintf(message, sizeof(message), "%.64s: %.400s (SQLSTATE %s)", what, conn->message, conn->sqlstate);
+  } else {
+    snprintf(message, sizeof(message), "%.64s: %.400s", what, conn->message);
+  }
+  if (err) *err = create_pgdump_error(code, message);
+
+  return code;
+}
+
+/* writes "schema"."name" to @dst; 0 on success */
+int pgdump_quote_table(char *dst, size_t dst_len, const char *schema, const char *name) {
+  dst[0] = '\0';
+  if (pg_quote(dst, dst_len, schema, '"') != 0 || strlen(dst) + 1 >= dst_len) return -1;
+  strcat(dst, ".");
+
+  return pg_quote(dst, dst_len, name, '"');
+}
+
+/* reads the table list out of the coordinator's snapshot */
+PgDumpStatus_t pgdump_list_tables(PgDumpSession_t *session, PgDumpError_t **err) {
+  PgResult_t *res = NULL;
+
+  if (pg_query(session->coordinator, PGDUMP_LIST_TABLES_SQL, &res) != PG_OK || !res || res->cols != 3) {
+    destroy_pg_result(&res);
+
+    return pgdump_conn_fail(PGDUMP_QUERY_ERROR, "Cannot list the tables", session->coordinator, err);
+  }
+  for (size_t i = 0; i < res->rows; i++) {
+    const char *schema = pg_result_value(res, i, 0), *name = pg_result_value(res, i, 1);
+    const char *size = pg_result_value(res, i, 2);
+    PgDumpTable_t *table = calloc(1, sizeof(PgDumpTable_t));
+
+    if (!table) {
+      destroy_pg_result(&res);
+      if (err) *err = create_pgdump_error(PGDUMP_MEMORY_ERROR, "Failed to allocate the table list!");
+
+      return PGDUMP_MEMORY_ERROR;
+    }
+    snprintf(table->name, sizeof(table->name), "%s.%s", schema ? schema : "", name ? name : "");
+    table->estimated_bytes = size ? (size_t)strtoull(size, NULL, 10) : 0;
+    table->parts = 1;
+    if (!schema || !name || pgdump_quote_table(table->quoted, sizeof(table->quoted), schema, name) != 0) {
+      free(table);
+      destroy_pg_result(&res);
+      if (err) *err = create_pgdump_error(PGDUMP_QUERY_ERROR, "Table list has a malformed row");
+
+      return PGDUMP_QUERY_ERROR;
+    }
+    HASH_ADD_STR(session->tables, name, table);
+    session->table_count++;
+  }
+  destroy_pg_result(&res);
+
+  return PGDUMP_OK;
+}
+
+/* takes ACCESS SHARE locks on every listed table, a batch per statement */
+PgDumpStatus_t pgdump_lock_tables(PgDumpSession_t *session, PgDumpError_t **err) {
+  size_t cap = PGDUMP_LOCK_BATCH * BUF_LEN_M + BUF_LEN_XS;
+  char *sql = malloc(cap);
+  PgDumpTable_t *table, *tmp;
+  size_t batch = 0, pos = 0;
+  PgDumpStatus_t status = PGDUMP_OK;
+
+  if (!sql) {
+    if (err) *err = create_pgdump_error(PGDUMP_MEMORY_ERROR, "Failed to allocate the lock statement!");
+
+    return PGDUMP_MEMORY_ERROR;
+  }
+  HASH_ITER(hh, session->tables, table, tmp) {
+    pos += (size_t)snprintf(sql + pos, cap - pos, "%s%s", batch ? ", " : "LOCK TABLE ", table->quoted);
+    if (++batch < PGDUMP_LOCK_BATCH && table->hh.next) continue;
+
+    snprintf(sql + pos, cap - pos, " IN ACCESS SHARE MODE");
+    if (pg_exec(session->coordinator, sql) != PG_OK) {
+      status = pgdump_conn_fail(PGDUMP_QUERY_ERROR, "Cannot lock the tables", session->coordinator, err);
+      break;
+    }
+    batch = pos = 0;
+  }
+  free(sql);
+
+  return status;
+}
+
+/* the single value of @sql, malloc'ed; NULL when there is none or on failure */
+char *pgdump_query_value(PgConn_t *conn, const char *sql) {
+  PgResult_t *res = NULL;
+  char *value = NULL;
+
+  if (pg_query(conn, sql, &res) == PG_OK && pg_result_value(res, 0, 0)) value = strdup(pg_result_value(res, 0, 0));
+  destroy_pg_result(&res);
+
+  return value;
+}
+
+/* finds the integer primary key of @table and the keys it spans; 0 when there is one */
+int pgdump_plan_key(PgDumpSession_t *session, PgDumpTable_t *table, const char *regclass) {
+  char sql[BUF_LEN * 2];
+  PgResult_t *res = NULL;
+  char *column;
+  int status = -1;
+
+  snprintf(sql, sizeof(sql), "SELECT a.attname FROM pg_catalog.pg_index i JOIN pg_catalog.pg_attribute a "
+    "ON a.attrelid = i.indrelid AND a.attnum = i.indkey[0] WHERE i.indrelid = %s::pg_catalog.regclass "
+    "AND i.indisprimary AND i.indnatts = 1 AND a.atttypid IN ('pg_catalog.int2'::pg_catalog.regtype, "
+    "'pg_catalog.int4'::pg_catalog.regtype, 'pg_catalog.int8'::pg_catalog.regtype)", regclass);
+  column = pgdump_query_value(session->coordinator, sql);
+  if (!column) return -1;
+  if (pg_quote(table->key, sizeof(table->key), column, '"') == 0) {
+    snprintf(sql, sizeof(sql), "SELECT pg_catalog.min(%s), pg_catalog.max(%s) FROM %s", table->key, table->key,
+      table->quoted);
+    if (pg_query(session->coordinator, sql, &res) == PG_OK && pg_result_value(res, 0, 0) && pg_result_value(res, 0, 1)) {
+      int64_t key_max = strtoll(pg_result_value(res, 0, 1), NULL, 10);
+
+      table->key_min = strtoll(pg_result_value(res, 0, 0), NULL, 10);
+      // wraps to 0 only for a key using the whole int8 range, which then stays whole
+      table->span = (uint64_t)key_max - (uint64_t)table->key_min + 1;
+      status = 0;
+    }
+  }
+  free(column);
+  destroy_pg_result(&res);
+
+  return status;
+}
+
+/* decides how @table is cut, leaving it whole when it cannot be */
+PgDumpStatus_t pgdump_plan_split(PgDumpSession_t *session, PgDumpTable_t *table, size_t block_size,
+  PgDumpError_t **err) {
+  size_t chunk = session->cfg->runtime->split_chunk_size;
+  char regclass[BUF_LEN] = "", sql[BUF_LEN * 2];
+  uint64_t parts;
+
+  table->split = PGDUMP_SPLIT_NONE;
+  table->parts = 1;
+  if (chunk == 0 || table->estimated_bytes <= chunk) return PGDUMP_OK;
+  parts = (table->estimated_bytes + chunk - 1) / chunk;
+  if (parts > PGDUMP_MAX_PARTS) parts = PGDUMP_MAX_PARTS;
+  if (pg_quote(regclass, sizeof(regclass), table->quoted, '\'') != 0) return PGDUMP_OK;
+
+  if (pgdump_plan_key(session, table, regclass) == 0) {
+    table->split = PGDUMP_SPLIT_KEY;
+  } else if (session->coordinator->server_version >= PGDUMP_MIN_CTID_VERSION && block_size) {
+    table->split = PGDUMP_SPLIT_CTID;
+    table->span = table->estimated_bytes / block_size + 1;
+  }
+  if (table->split != PGDUMP_SPLIT_NONE && table->span < parts) parts = table->span;
+  if (table->split == PGDUMP_SPLIT_NONE || parts < 2) {
+    table->split = PGDUMP_SPLIT_NONE;
+
+    return PGDUMP_OK;
+  }
+
+  // generated columns are left out, as COPY of the whole table does
+  snprintf(sql, sizeof(sql), "SELECT pg_catalog.string_agg(pg_catalog.quote_ident(attname), ', ' ORDER BY attnum) "
+    "FROM pg_catalog.pg_attribute WHERE attrelid = %s::pg_catalog.regclass AND attnum > 0 AND NOT attisdropped%s",
+    regclass, session->coordinator->server_version >= 120000 ? " AND attgenerated = ''" : "");
+  table->columns = pgdump_query_value(session->coordinator, sql);
+  if (!table->columns) {
+    return pgdump_conn_fail(PGDUMP_QUERY_ERROR, "Cannot list the columns of a split table", session->coordinator, err);
+  }
+  table->parts = (uint32_t)parts;
+
+  return PGDUMP_OK;
+}
+
+PgDumpStatus_t pgdump_plan_splits(PgDumpSession_t *session, PgDumpError_t **err) {
+  PgDumpTable_t *table, *tmp;
+  PgDumpStatus_t status = PGDUMP_OK;
+  size_t block_size = 0;
+  char *setting;
+
+  if (session->cfg->runtime->split_chunk_size == 0) return PGDUMP_OK;
+  setting = pgdump_query_value(session->coordinator, "SELECT pg_catalog.current_setting('block_size')");
+  if (setting) block_size = (size_t)strtoull(setting, NULL, 10);
+  free(setting);
+  HASH_ITER(hh, session->tables, table, tmp) {
+    status = pgdump_plan_split(session, table, block_size, err);
+    if (status != PGDUMP_OK) break;
+  }
+
+  return status;
+}
+
+/* opens worker connection @i and moves it onto the exported snapshot */
+PgDumpStatus_t pgdump_open_worker(PgDumpSession_t *session, size_t i, PgDumpError_t **err) {
+  char sql[BUF_LEN_S] = "SET TRANSACTION SNAPSHOT ";
+  char message[BUF_LEN_M];
+  PgError_t *pg_err = NULL;
+
+  session->workers[i] = pg_connect(session->cfg->db->uri, session->cfg->db->timeout_seconds, &pg_err);
+  if (!session->workers[i]) {
+    snprintf(message, sizeof(message), "Cannot open worker connection %zu: %.400s", i, pg_err ? pg_err->message : "?");
+    if (err) *err = create_pgdump_error(PGDUMP_CONNECT_ERROR, message);
+    destroy_pg_error(&pg_err);
+
+    return PGDUMP_CONNECT_ERROR;
+  }
+  pg_quote(sql, sizeof(sql), session->snapshot, '\'');
+  if (pg_exec(session->workers[i], PGDUMP_BEGIN_SQL) != PG_OK || pg_exec(session->workers[i], sql) != PG_OK) {
+    snprintf(message, sizeof(message), "Worker %zu cannot import snapshot %s", i, session->snapshot);
+
+    return pgdump_conn_fail(PGDUMP_SNAPSHOT_ERROR, message, session->workers[i], err);
+  }
+
+  return PGDUMP_OK;
+}
+
+/* moves the coordinator onto `db.snapshot`, exported by another session such as a new replication slot */
+PgDumpStatus_t pgdump_import_snapshot(PgDumpSession_t *session, PgDumpError_t **err) {
+  char sql[BUF_LEN_S] = "SET TRANSACTION SNAPSHOT ";
+  char message[BUF_LEN_M];
+
+  pg_quote(sql, sizeof(sql), session->cfg->db->snapshot, '\'');
+  if (pg_exec(session->coordinator, sql) == PG_OK) return PGDUMP_OK;
+  snprintf(message, sizeof(message), "Cannot import snapshot %s", session->cfg->db->snapshot);
+
+  return pgdump_conn_fail(PGDUMP_SNAPSHOT_ERROR, message, session->coordinator, err);
+}
+
+PgDumpSession_t *init_pgdump_session(AppConfig_t *cfg, PgDumpError_t **err) {
+  PgDumpSession_t *session;
+  PgResult_t *res = NULL;
+  PgError_t *pg_err = NULL;
+  PgDumpStatus_t status = PGDUMP_OK;
+  char message[BUF_LEN_M];
+
+  if (!pgdump_supported(cfg->db)) {
+    snprintf(message, sizeof(message), "db.type %s has no snapshot-consistent dump", cfg->db->type);
+    if (err) *err = create_pgdump_error(PGDUMP_CONFIG_ERROR, message);
+
+    return NULL;
+  }
+  session = calloc(1, sizeof(PgDumpSession_t));
+  if (!session) {
+    if (err) *err = create_pgdump_error(PGDUMP_MEMORY_ERROR, "Failed to allocate dump session!");
+
+    return NULL;
+  }
+  session->cfg = cfg;
+  // as many connections as init_scheduler() will start workers
+  session->worker_count = cfg->runtime->thread_count ? cfg->runtime->thread_count : 1;
+  if (session->worker_count > SCHED_MAX_WORKERS) session->worker_count = SCHED_MAX_WORKERS;
+  session->workers = calloc(session->worker_count, sizeof(PgConn_t *));
+
+  if (!session->workers) {
+    status = PGDUMP_MEMORY_ERROR;
+    if (err) *err = create_pgdump_error(status, "Failed to allocate worker connections!");
+  } else if (!(session->coordinator = pg_connect(cfg->db->uri, cfg->db->timeout_seconds, &pg_err))) {
+    status = PGDUMP_CONNECT_ERROR;
+    snprintf(message, sizeof(message), "Cannot connect to the database: %.400s", pg_err ? pg_err->message : "?");
+    if (err) *err = create_pgdump_error(status, message);
+  } else if (session->coordinator->server_version < 90200) {
+    status = PGDUMP_SNAPSHOT_ERROR;
+    snprintf(message, sizeof(message), "Server version %d cannot export snapshots",
+      session->coordinator->server_version);
+    if (err) *err = create_pgdump_error(status, message);
+  } else if (pg_exec(session->coordinator, "SELECT pg_catalog.set_config('search_path', '', false)") != PG_OK
+    || pg_exec(session->coordinator, PGDUMP_BEGIN_SQL) != PG_OK) {
+    status = pgdump_conn_fail(PGDUMP_QUERY_ERROR, "Cannot start the dump transaction", session->coordinator, err);
+  } else if (cfg->db->snapshot[0] && pgdump_import_snapshot(session, err) != PGDUMP_OK) {
+    status = PGDUMP_SNAPSHOT_ERROR;
+  } else if (pg_query(session->coordinator, "SELECT pg_catalog.pg_export_snapshot()", &res) != PG_OK
+    || !pg_result_value(res, 0, 0)) {
+    status = pgdump_conn_fail(PGDUMP_SNAPSHOT_ERROR, "Cannot export a snapshot", session->coordinator, err);
+  } else {
+    snprintf(session->snapshot, sizeof(session->snapshot), "%s", pg_result_value(res, 0, 0));
+    status = pgdump_list_tables(session, err);
+    if (status == PGDUMP_OK) status = pgdump_lock_tables(session, err);
+    if (status == PGDUMP_OK) status = pgdump_plan_splits(session, err);
+  }
+  destroy_pg_result(&res);
+  destroy_pg_error(&pg_err);
+
+  for (size_t i = 0; status == PGDUMP_OK && i < session->worker_count; i++) status = pgdump_open_worker(session, i, err);
+  if (status != PGDUMP_OK) destroy_pgdump_session(&session);
+
+  return session;
+}
+
+PgDumpError_t *create_pgdump_error(PgDumpStatus_t code, const char *message) {
+  PgDumpError_t *err = malloc(sizeof(PgDumpError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+/**
+ * destroy_pgdump_session - closes every connection, which ends the
+ * transactions and releases the exported snapshot and table locks
+ * @session: the session
+ **/
+void destroy_pgdump_session(PgDumpSession_t **session) {
+  if (!session || !*session) return;
+  PgDumpSession_t *s = *session;
+  PgDumpTable_t *table, *tmp;
+
+  for (size_t i = 0; s->workers && i < s->worker_count; i++) destroy_pg_conn(&s->workers[i]);
+  free(s->workers);
+  destroy_pg_conn(&s->coordinator);
+  HASH_ITER(hh, s->tables, table, tmp) {
+    HASH_DEL(s->tables, table);
+    free(table->columns);
+    free(table);
+  }
+  free(s);
+  *session = NULL;
+}
+
+void destroy_pgdump_error(PgDumpError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
@@ -0,0 +1,87 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/pgload.h"
+#include "include/pgdump.h"
+#include "include/scheduler.h"
+
+
+PgLoadSession_t *init_pgload_session(AppConfig_t *cfg, PgLoadError_t **err) {
+  PgLoadSession_t *session;
+  PgError_t *pg_err = NULL;
+  char message[BUF_LEN_M];
+
+  if (!pgdump_supported(cfg->db)) {
+    snprintf(message, sizeof(message), "db.type %s cannot be loaded into; restore with --output", cfg->db->type);
+    if (err) *err = create_pgload_error(PGLOAD_CONFIG_ERROR, message);
+
+    return NULL;
+  }
+  session = calloc(1, sizeof(PgLoadSession_t));
+  if (!session) {
+    if (err) *err = create_pgload_error(PGLOAD_MEMORY_ERROR, "Failed to allocate load session!");
+
+    return NULL;
+  }
+  session->cfg = cfg;
+  pthread_mutex_init(&session->lock, NULL);
+  // as many connections as init_scheduler() will start workers
+  session->worker_count = cfg->runtime->thread_count ? cfg->runtime->thread_count : 1;
+  if (session->worker_count > SCHED_MAX_WORKERS) session->worker_count = SCHED_MAX_WORKERS;
+  session->workers = calloc(session->worker_count, sizeof(PgConn_t *));
+  if (!session->workers) {
+    if (err) *err = create_pgload_error(PGLOAD_MEMORY_ERROR, "Failed to allocate worker connections!");
+    destroy_pgload_session(&session);
+
+    return NULL;
+  }
+
+  for (size_t i = 0; i < session->worker_count; i++) {
+    session->workers[i] = pg_connect(cfg->db->uri, cfg->db->timeout_seconds, &pg_err);
+    if (!session->workers[i]) {
+      snprintf(message, sizeof(message), "Cannot open worker connection %zu: %.400s", i,
+        pg_err ? pg_err->message : "?");
+      if (err) *err = create_pgload_error(PGLOAD_CONNECT_ERROR, message);
+      destroy_pg_error(&pg_err);
+      destroy_pgload_session(&session);
+
+      return NULL;
+    }
+  }
+
+  return session;
+}
+
+PgLoadError_t *create_pgload_error(PgLoadStatus_t code, const char *message) {
+  PgLoadError_t *err = malloc(sizeof(PgLoadError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+/**
+ * destroy_pgload_session - closes every connection; a COPY cut short
+ * by it is rolled back by the server
+ * @session: the session
+ **/
+void destroy_pgload_session(PgLoadSession_t **session) {
+  if (!session || !*session) return;
+  PgLoadSession_t *s = *session;
+
+  for (size_t i = 0; s->workers && i < s->worker_count; i++) destroy_pg_conn(&s->workers[i]);
+  free(s->workers);
+  pthread_mutex_destroy(&s->lock);
+  free(s);
+  *session = NULL;
+}
+
+void destroy_pgload_error(PgLoadError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
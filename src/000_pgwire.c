@@ -0,0 +1,346 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <openssl/crypto.h>
+#include "include/pgwire.h"
+
+
+/* copies @n bytes of a URI component, %XX escapes decoded; 0 on success */
+int pg_uri_copy(char *dst, size_t dst_len, const char *src, size_t n) {
+  size_t out = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    char c = src[i];
+
+    if (c == '%' && i + 2 < n && isxdigit((unsigned char)src[i + 1]) && isxdigit((unsigned char)src[i + 2])) {
+      char hex[3] = { src[i + 1], src[i + 2], '\0' };
+
+      c = (char)strtol(hex, NULL, 16);
+      i += 2;
+    }
+    if (out + 1 >= dst_len) return -1;
+    dst[out++] = c;
+  }
+  dst[out] = '\0';
+
+  return 0;
+}
+
+int pg_uri_param(PgUri_t *out, const char *key, size_t key_len, const char *value, size_t value_len) {
+  char port[BUF_LEN_XS];
+
+  if (key_len == 4 && strncmp(key, "host", 4) == 0) return pg_uri_copy(out->host, sizeof(out->host), value, value_len);
+  if (key_len == 4 && strncmp(key, "user", 4) == 0) return pg_uri_copy(out->user, sizeof(out->user), value, value_len);
+  if (key_len == 8 && strncmp(key, "password", 8) == 0) {
+    return pg_uri_copy(out->password, sizeof(out->password), value, value_len);
+  }
+  if (key_len == 6 && strncmp(key, "dbname", 6) == 0) {
+    return pg_uri_copy(out->dbname, sizeof(out->dbname), value, value_len);
+  }
+  if (key_len == 7 && strncmp(key, "sslmode", 7) == 0) {
+    return pg_uri_copy(out->sslmode, sizeof(out->sslmode), value, value_len);
+  }
+  if (key_len == 11 && strncmp(key, "replication", 11) == 0) {
+    return pg_uri_copy(out->replication, sizeof(out->replication), value, value_len);
+  }
+  if (key_len == 4 && strncmp(key, "port", 4) == 0) {
+    if (pg_uri_copy(port, sizeof(port), value, value_len) != 0 || atoi(port) <= 0 || atoi(port) > 65535) return -1;
+    out->port = (uint16_t)atoi(port);
+  }
+
+  // anything else (application_name, connect_timeout, ...) is left to the server defaults
+  return 0;
+}
+
+int pg_parse_uri(const char *uri, PgUri_t *out, char *message, size_t len) {
+  const char *p, *end, *at, *colon, *query;
+  const char *env;
+
+  memset(out, 0, sizeof(*out));
+  out->port = PG_DEFAULT_PORT;
+  snprintf(out->sslmode, sizeof(out->sslmode), "prefer");
+  if (strncmp(uri, "postgresql://", 13) == 0) p = uri + 13;
+  else if (strncmp(uri, "postgres://", 11) == 0) p = uri + 11;
+  else {
+    snprintf(message, len, "db.uri must start with postgresql://");
+
+    return -1;
+  }
+
+  // [user[:password]@][host][:port]
+  end = p + strcspn(p, "/?");
+  at = NULL;
+  for (const char *c = p; c < end; c++) {
+    if (*c == '@') at = c;
+  }
+  if (at) {
+    colon = memchr(p, ':', (size_t)(at - p));
+    if (pg_uri_copy(out->user, sizeof(out->user), p, (size_t)((colon ? colon : at) - p)) != 0
+      || (colon && pg_uri_copy(out->password, sizeof(out->password), colon + 1, (size_t)(at - colon - 1)) != 0)) {
+      snprintf(message, len, "db.uri has an over-long user or password");
+
+      return -1;
+    }
+    p = at + 1;
+  }
+  colon = memchr(p, ':', (size_t)(end - p));
+  if (pg_uri_copy(out->host, sizeof(out->host), p, (size_t)((colon ? colon : end) - p)) != 0
+    || (colon && pg_uri_param(out, "port", 4, colon + 1, (size_t)(end - colon - 1)) != 0)) {
+    snprintf(message, len, "db.uri has an invalid host or port");
+
+    return -1;
+  }
+
+  // [/dbname][?key=value&...]
+  query = strchr(end, '?');
+  if (*end == '/' && pg_uri_copy(out->dbname, sizeof(out->dbname), end + 1,
+    (size_t)((query ? query : end + strlen(end)) - end - 1)) != 0) {
+    snprintf(message, len, "db.uri has an over-long database name");
+
+    return -1;
+  }
+  for (p = query ? query + 1 : NULL; p && *p; p = strchr(p, '&') ? strchr(p, '&') + 1 : NULL) {
+    size_t pair_len = strcspn(p, "&");
+    const char *eq = memchr(p, '=', pair_len);
+
+    if (!eq || pg_uri_param(out, p, (size_t)(eq - p), eq + 1, pair_len - (size_t)(eq - p) - 1) != 0) {
+      snprintf(message, len, "db.uri has an invalid parameter: %.*s", (int)pair_len, p);
+
+      return -1;
+    }
+  }
+
+  if (out->user[0] == '\0' && ((env = getenv("PGUSER")) != NULL || (env = getenv("USER")) != NULL)) {
+    snprintf(out->user, sizeof(out->user), "%s", env);
+  }
+  if (out->password[0] == '\0' && (env = getenv("PGPASSWORD")) != NULL) {
+    snprintf(out->password, sizeof(out->password), "%s", env);
+  }
+  if (out->dbname[0] == '\0') snprintf(out->dbname, sizeof(out->dbname), "%s", out->user);
+  if (out->host[0] == '\0') snprintf(out->host, sizeof(out->host), "%s", PG_DEFAULT_SOCKET_DIR);
+  if (out->user[0] == '\0') {
+    snprintf(message, len, "db.uri names no user");
+
+    return -1;
+  }
+  if (strcmp(out->sslmode, "require") == 0 || strncmp(out->sslmode, "verify-", 7) == 0) {
+    snprintf(message, len, "sslmode=%s: TLS connections are not supported", out->sslmode);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/* connects to the server's unix socket or TCP port; the descriptor, or -1 */
+int pg_open_socket(const PgUri_t *uri, char *message, size_t len) {
+  struct addrinfo hints, *addrs = NULL, *ai;
+  char port[BUF_LEN_XS];
+  int fd = -1, rc, one = 1;
+
+  if (uri->host[0] == '/') {
+    struct sockaddr_un addr;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if ((size_t)snprintf(addr.sun_path, sizeof(addr.sun_path), "%s/.s.PGSQL.%u", uri->host, uri->port)
+      >= sizeof(addr.sun_path)) {
+      snprintf(message, len, "socket path under %s is too long", uri->host);
+
+      return -1;
+    }
+    fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fd >= 0 && connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+      snprintf(message, len, "Cannot connect to %s: %s", addr.sun_path, strerror(errno));
+      close(fd);
+      fd = -1;
+    }
+
+    return fd;
+  }
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  snprintf(port, sizeof(port), "%u", uri->port);
+  rc = getaddrinfo(uri->host, port, &hints, &addrs);
+  if (rc != 0) {
+    snprintf(message, len, "Cannot resolve %s: %s", uri->host, gai_strerror(rc));
+
+    return -1;
+  }
+  snprintf(message, len, "Cannot connect to %s:%u", uri->host, uri->port);
+  for (ai = addrs; ai && fd < 0; ai = ai->ai_next) {
+    fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+    if (fd >= 0 && connect(fd, ai->ai_addr, ai->ai_addrlen) != 0) {
+      snprintf(message, len, "Cannot connect to %s:%u: %s", uri->host, uri->port, strerror(errno));
+      close(fd);
+      fd = -1;
+    }
+  }
+  freeaddrinfo(addrs);
+  // queries are single small messages, never worth delaying
+  if (fd >= 0) setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+  return fd;
+}
+
+int pg_send_startup(PgConn_t *conn, const PgUri_t *uri) {
+  unsigned char message[BUF_LEN];
+  size_t pos = 8;
+  const char *pairs[][2] = {
+    { "user", uri->user },
+    { "database", uri->dbname },
+    { "application_name", "dbeetle" },
+    { "client_encoding", "UTF8" },
+    { "replication", uri->replication }
+  };
+
+  for (size_t i = 0; i < sizeof(pairs) / sizeof(pairs[0]); i++) {
+    if (pairs[i][1][0] == '\0') continue;
+    pos += (size_t)snprintf((char *)message + pos, sizeof(message) - pos, "%s", pairs[i][0]) + 1;
+    pos += (size_t)snprintf((char *)message + pos, sizeof(message) - pos, "%s", pairs[i][1]) + 1;
+  }
+  message[pos++] = '\0';
+  pg_put_be(message, pos, 4);
+  pg_put_be(message + 4, PG_PROTOCOL_VERSION, 4);
+
+  return pg_send_all(conn->fd, message, pos);
+}
+
+/* reads the parameters and key data the server sends after authentication */
+int pg_await_ready(PgConn_t *conn) {
+  const unsigned char *payload;
+  char type;
+  size_t len;
+
+  for (;;) {
+    if (pg_read_message(conn, &type, &payload, &len) != 0) return -1;
+    if (type == 'Z' && len >= 1) {
+      conn->txn_status = (char)payload[0];
+
+      return 0;
+    }
+    if (type == 'E') {
+      pg_take_error(conn, PG_CONNECT_ERROR, payload, len);
+
+      return -1;
+    }
+    if (type == 'K' && len >= 8) conn->backend_pid = (uint32_t)pg_get_be(payload, 4);
+    if (type == 'S' && len > 15 && strncmp((const char *)payload, "server_version", 15) == 0) {
+      const char *version = (const char *)payload + 15;
+      int major = 0, minor = 0;
+
+      // "16.2" -> 160002, "9.6.24" -> 90600
+      if (memchr(version, '\0', len - 15) && sscanf(version, "%d.%d", &major, &minor) >= 1) {
+        conn->server_version = major >= 10 ? major * 10000 + minor : major * 10000 + minor * 100;
+      }
+    }
+  }
+}
+
+PgConn_t *pg_connect(const char *uri, size_t timeout_seconds, PgError_t **err) {
+  PgConn_t *conn = calloc(1, sizeof(PgConn_t));
+  PgUri_t parsed;
+  char message[BUF_LEN_M];
+
+  if (!conn || !(conn->buf = malloc(PG_RECV_BUFFER_LEN))) {
+    free(conn);
+    if (err) *err = create_pg_error(PG_MEMORY_ERROR, "Failed to allocate connection!");
+
+    return NULL;
+  }
+  conn->buf_cap = PG_RECV_BUFFER_LEN;
+  conn->fd = -1;
+  if (pg_parse_uri(uri, &parsed, message, sizeof(message)) != 0) {
+    if (err) *err = create_pg_error(PG_CONFIG_ERROR, message);
+    destroy_pg_conn(&conn);
+
+    return NULL;
+  }
+
+  conn->fd = pg_open_socket(&parsed, message, sizeof(message));
+  if (conn->fd < 0) {
+    if (err) *err = create_pg_error(PG_CONNECT_ERROR, message);
+    OPENSSL_cleanse(&parsed, sizeof(parsed));
+    destroy_pg_conn(&conn);
+
+    return NULL;
+  }
+  if (timeout_seconds) {
+    struct timeval tv = { (time_t)timeout_seconds, 0 };
+
+    setsockopt(conn->fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(conn->fd, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+  }
+
+  if (pg_send_startup(conn, &parsed) != 0) pg_fail(conn, PG_CONNECT_ERROR, "Cannot send the startup message");
+  else if (pg_authenticate(conn, &parsed) == 0 && pg_await_ready(conn) == 0) conn->status = PG_OK;
+  else if (conn->status == PG_OK) conn->status = PG_PROTOCOL_ERROR;
+  OPENSSL_cleanse(&parsed, sizeof(parsed));
+  if (conn->status != PG_OK) {
+    if (err) {
+      *err = create_pg_error(conn->status, conn->message);
+      if (*err) snprintf((*err)->sqlstate, sizeof((*err)->sqlstate), "%s", conn->sqlstate);
+    }
+    destroy_pg_conn(&conn);
+
+    return NULL;
+  }
+
+  return conn;
+}
+
+PgError_t *create_pg_error(PgStatus_t code, const char *message) {
+  PgError_t *err = calloc(1, sizeof(PgError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+void destroy_pg_result(PgResult_t **res) {
+  if (!res || !*res) return;
+  PgResult_t *r = *res;
+
+  for (size_t i = 0; r->values && i < r->rows * r->cols; i++) free(r->values[i]);
+  free(r->values);
+  free(r);
+  *res = NULL;
+}
+
+/**
+ * destroy_pg_conn - says goodbye to the server and closes the connection
+ * @conn: the connection
+ **/
+void destroy_pg_conn(PgConn_t **conn) {
+  if (!conn || !*conn) return;
+  PgConn_t *c = *conn;
+
+  if (c->fd >= 0) {
+    if (c->status == PG_OK) pg_send_message(c, 'X', NULL, 0);
+    close(c->fd);
+  }
+  free(c->buf);
+  free(c);
+  *conn = NULL;
+}
+
+void destroy_pg_error(PgError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
@@ -0,0 +1,179 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/pipeline.h"
+
+
+BufferRing_t *init_buffer_ring(size_t capacity) {
+  BufferRing_t *ring = calloc(1, sizeof(BufferRing_t));
+
+  if (!ring) return NULL;
+  ring->slots = calloc(capacity, sizeof(PipeBuffer_t *));
+  if (!ring->slots) {
+    free(ring);
+
+    return NULL;
+  }
+  ring->capacity = capacity;
+  pthread_mutex_init(&ring->lock, NULL);
+  pthread_cond_init(&ring->not_empty, NULL);
+  pthread_cond_init(&ring->not_full, NULL);
+
+  return ring;
+}
+
+/**
+ * ring_push - appends a buffer, blocking while the ring is full
+ * @ring: the ring
+ * @buf: the buffer
+ *
+ * Return: false if the ring was closed and @buf was not queued
+ **/
+bool ring_push(BufferRing_t *ring, PipeBuffer_t *buf) {
+  pthread_mutex_lock(&ring->lock);
+  while (ring->count == ring->capacity && !ring->closed) pthread_cond_wait(&ring->not_full, &ring->lock);
+  if (ring->closed) {
+    pthread_mutex_unlock(&ring->lock);
+
+    return false;
+  }
+  ring->slots[(ring->head + ring->count) % ring->capacity] = buf;
+  ring->count++;
+  pthread_cond_signal(&ring->not_empty);
+  pthread_mutex_unlock(&ring->lock);
+
+  return true;
+}
+
+/**
+ * ring_pop - removes the oldest buffer, blocking while the ring is empty
+ * @ring: the ring
+ *
+ * Return: the buffer, or NULL once the ring is closed and drained
+ **/
+PipeBuffer_t *ring_pop(BufferRing_t *ring) {
+  PipeBuffer_t *buf = NULL;
+
+  pthread_mutex_lock(&ring->lock);
+  while (ring->count == 0 && !ring->closed) pthread_cond_wait(&ring->not_empty, &ring->lock);
+  if (ring->count > 0) {
+    buf = ring->slots[ring->head];
+    ring->head = (ring->head + 1) % ring->capacity;
+    ring->count--;
+    pthread_cond_signal(&ring->not_full);
+  }
+  pthread_mutex_unlock(&ring->lock);
+
+  return buf;
+}
+
+PipeBuffer_t *ring_try_pop(BufferRing_t *ring) {
+  PipeBuffer_t *buf = NULL;
+
+  pthread_mutex_lock(&ring->lock);
+  if (ring->count > 0) {
+    buf = ring->slots[ring->head];
+    ring->head = (ring->head + 1) % ring->capacity;
+    ring->count--;
+    pthread_cond_signal(&ring->not_full);
+  }
+  pthread_mutex_unlock(&ring->lock);
+
+  return buf;
+}
+
+void ring_close(BufferRing_t *ring) {
+  pthread_mutex_lock(&ring->lock);
+  ring->closed = true;
+  pthread_cond_broadcast(&ring->not_empty);
+  pthread_cond_broadcast(&ring->not_full);
+  pthread_mutex_unlock(&ring->lock);
+}
+
+void destroy_buffer_ring(BufferRing_t **ring) {
+  if (!ring || !*ring) return;
+
+  pthread_mutex_destroy(&(*ring)->lock);
+  pthread_cond_destroy(&(*ring)->not_empty);
+  pthread_cond_destroy(&(*ring)->not_full);
+  free((*ring)->slots);
+  free(*ring);
+  *ring = NULL;
+}
+
+Pipeline_t *init_pipeline(size_t block_size, size_t buffer_count) {
+  Pipeline_t *pipe = calloc(1, sizeof(Pipeline_t));
+  size_t capacity = block_size + PIPELINE_BLOCK_HEADROOM(block_size);
+
+  if (!pipe) return NULL;
+  if (buffer_count < 2) buffer_count = 2;
+  pipe->block_size = block_size;
+  pipe->buffer_count = buffer_count;
+  pipe->status = PIPELINE_OK;
+  pthread_mutex_init(&pipe->lock, NULL);
+
+  pipe->buffers = calloc(buffer_count, sizeof(PipeBuffer_t));
+  pipe->pool = init_buffer_ring(buffer_count);
+  pipe->rings[0] = init_buffer_ring(buffer_count);
+  if (!pipe->buffers || !pipe->pool || !pipe->rings[0]) {
+    destroy_pipeline(&pipe);
+
+    return NULL;
+  }
+
+  for (size_t i = 0; i < buffer_count; i++) {
+    PipeBuffer_t *buf = &pipe->buffers[i];
+
+    buf->data = malloc(capacity);
+    buf->scratch = malloc(capacity);
+    buf->capacity = capacity;
+    if (!buf->data || !buf->scratch) {
+      destroy_pipeline(&pipe);
+
+      return NULL;
+    }
+    ring_push(pipe->pool, buf);
+  }
+
+  return pipe;
+}
+
+PipelineError_t *create_pipeline_error(PipelineStatus_t code, const char *message) {
+  PipelineError_t *err = malloc(sizeof(PipelineError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+void destroy_pipeline(Pipeline_t **pipe) {
+  if (!pipe || !*pipe) return;
+  Pipeline_t *p = *pipe;
+
+  // a started pipeline must have been drained by pipeline_finish
+  for (size_t i = 0; i < p->stage_count; i++) {
+    if (p->stages[i].threads) free(p->stages[i].threads);
+    if (p->stages[i].release) p->stages[i].release(p->stages[i].ctx);
+  }
+  for (size_t i = 0; i <= PIPELINE_MAX_STAGES; i++) destroy_buffer_ring(&p->rings[i]);
+  destroy_buffer_ring(&p->pool);
+  if (p->buffers) {
+    for (size_t i = 0; i < p->buffer_count; i++) {
+      if (p->buffers[i].data) free(p->buffers[i].data);
+      if (p->buffers[i].scratch) free(p->buffers[i].scratch);
+    }
+    free(p->buffers);
+  }
+  pthread_mutex_destroy(&p->lock);
+  free(p);
+  *pipe = NULL;
+}
+
+void destroy_pipeline_error(PipelineError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
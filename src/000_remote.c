@@ -0,0 +1,162 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/remote.h"
+
+
+bool remote_enabled(const StorageConfig_t *cfg) {
+  return cfg->remote_target[0] != '\0' && strcmp(cfg->remote_target, DEFAULT_STORAGE_REMOTE) != 0;
+}
+
+size_t remote_part_size(const RemoteUploader_t *up, uint32_t number) {
+  size_t size = up->part_size;
+
+  for (uint32_t step = REMOTE_PARTS_PER_STEP; number > step && size < REMOTE_MAX_PART_SIZE; step += REMOTE_PARTS_PER_STEP) {
+    size *= 2;
+  }
+
+  return size < REMOTE_MAX_PART_SIZE ? size : REMOTE_MAX_PART_SIZE;
+}
+
+int remote_xml_value(const char *xml, const char *tag, char *out, size_t out_len) {
+  char open_tag[BUF_LEN_XS], close_tag[BUF_LEN_XS];
+  const char *start, *end;
+
+  snprintf(open_tag, sizeof(open_tag), "<%s>", tag);
+  snprintf(close_tag, sizeof(close_tag), "</%s>", tag);
+  start = strstr(xml, open_tag);
+  if (!start) return -1;
+  start += strlen(open_tag);
+  end = strstr(start, close_tag);
+  if (!end || (size_t)(end - start) >= out_len || end == start) return -1;
+  memcpy(out, start, (size_t)(end - start));
+  out[end - start] = '\0';
+
+  return 0;
+}
+
+RemoteUploader_t *init_remote_uploader(const char *target, const char *name, size_t connections,
+  size_t part_size, RemoteError_t **err) {
+  RemoteUploader_t *up = calloc(1, sizeof(RemoteUploader_t));
+  char url[BUF_LEN + 16], response[BUF_LEN], message[BUF_LEN_M];
+  void *curl = NULL;
+  long status = 0;
+
+  if (!up) {
+    if (err) *err = create_remote_error(REMOTE_MEMORY_ERROR, "Failed to allocate remote uploader!");
+
+    return NULL;
+  }
+  pthread_mutex_init(&up->lock, NULL);
+  snprintf(up->url, sizeof(up->url), "%s%s%s", target, target[strlen(target) - 1] == '/' ? "" : "/", name);
+  up->connections = connections ? connections : 1;
+  up->part_size = part_size ? part_size : REMOTE_PART_SIZE;
+  up->next_part = 1;
+
+  curl = remote_http_open();
+  if (!curl) {
+    if (err) *err = create_remote_error(REMOTE_CONFIG_ERROR, "Remote uploads are not available in this build");
+    destroy_remote_uploader(&up);
+
+    return NULL;
+  }
+  snprintf(url, sizeof(url), "%s?uploads", up->url);
+  if (remote_http(curl, "POST", url, NULL, 0, &status, NULL, 0, response, sizeof(response)) != 0
+    || status != 200 || remote_xml_value(response, "UploadId", up->upload_id, sizeof(up->upload_id)) != 0) {
+    snprintf(message, sizeof(message), "Cannot start upload to %.400s (HTTP %ld)", up->url, status);
+    if (err) *err = create_remote_error(REMOTE_HTTP_ERROR, message);
+    remote_http_close(curl);
+    up->upload_id[0] = '\0';
+    destroy_remote_uploader(&up);
+
+    return NULL;
+  }
+  remote_http_close(curl);
+
+  // one part being filled, one in flight per connection
+  up->part_count = up->connections + 1;
+  up->parts = calloc(up->part_count, sizeof(PipeBuffer_t));
+  up->free_parts = init_buffer_ring(up->part_count);
+  up->queued = init_buffer_ring(up->part_count);
+  up->threads = calloc(up->connections, sizeof(pthread_t));
+  if (!up->parts || !up->free_parts || !up->queued || !up->threads) {
+    if (err) *err = create_remote_error(REMOTE_MEMORY_ERROR, "Failed to allocate upload parts!");
+    destroy_remote_uploader(&up);
+
+    return NULL;
+  }
+  for (size_t i = 0; i < up->part_count; i++) {
+    up->parts[i].data = malloc(up->part_size);
+    up->parts[i].capacity = up->part_size;
+    if (!up->parts[i].data) {
+      if (err) *err = create_remote_error(REMOTE_MEMORY_ERROR, "Failed to allocate upload parts!");
+      destroy_remote_uploader(&up);
+
+      return NULL;
+    }
+    if (i > 0) ring_push(up->free_parts, &up->parts[i]);
+  }
+  up->cur = &up->parts[0];
+
+  for (; up->started < up->connections; up->started++) {
+    if (pthread_create(&up->threads[up->started], NULL, remote_worker_main, up) != 0) {
+      if (err) *err = create_remote_error(REMOTE_THREAD_ERROR, "Failed to start upload threads!");
+      destroy_remote_uploader(&up);
+
+      return NULL;
+    }
+  }
+
+  return up;
+}
+
+RemoteError_t *create_remote_error(RemoteStatus_t code, const char *message) {
+  RemoteError_t *err = malloc(sizeof(RemoteError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+/**
+ * destroy_remote_uploader - stops the upload threads; an upload that was
+ * not completed is aborted on the remote
+ * @up: the uploader
+ **/
+void destroy_remote_uploader(RemoteUploader_t **up) {
+  if (!up || !*up) return;
+  RemoteUploader_t *u = *up;
+  char url[REMOTE_URL_LEN];
+  void *curl;
+  long status = 0;
+
+  if (u->queued) ring_close(u->queued);
+  for (size_t i = 0; i < u->started; i++) pthread_join(u->threads[i], NULL);
+
+  if (u->upload_id[0] != '\0' && !u->completed && (curl = remote_http_open()) != NULL) {
+    snprintf(url, sizeof(url), "%s?uploadId=%s", u->url, u->upload_id);
+    remote_http(curl, "DELETE", url, NULL, 0, &status, NULL, 0, NULL, 0);
+    remote_http_close(curl);
+  }
+
+  if (u->parts) {
+    for (size_t i = 0; i < u->part_count; i++) free(u->parts[i].data);
+  }
+  free(u->parts);
+  free(u->threads);
+  free(u->etags);
+  destroy_buffer_ring(&u->free_parts);
+  destroy_buffer_ring(&u->queued);
+  pthread_mutex_destroy(&u->lock);
+  free(u);
+  *up = NULL;
+}
+
+void destroy_remote_error(RemoteError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
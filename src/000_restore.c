@@ -0,0 +1,184 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include "include/restore.h"
+#include "include/arguments.h"
+#include "include/remote.h"
+
+
+/* `runtime.tmp_dir` when it is set, the archive's own directory otherwise */
+const char *restore_fetch_dir(const AppConfig_t *cfg) {
+  const char *dir = cfg->runtime->temp_dir;
+
+  return dir[0] != '\0' && strcmp(dir, DEFAULT_RUNTIME_TMP_DIR) != 0 ? dir : cfg->storage->output_path;
+}
+
+/**
+ * restore_fetch_archive - downloads @backup_name from the remote and
+ * opens the local copy
+ * @engine: the engine
+ * @backup_name: object name under `remote_target`
+ * @message: written error message on failure
+ * @len: size of @message
+ *
+ * Return: RestoreStatus_t
+ **/
+RestoreStatus_t restore_fetch_archive(RestoreEngine_t *engine, const char *backup_name, char *message, size_t len) {
+  StorageConfig_t local = *engine->cfg->storage;
+  const char *dir = restore_fetch_dir(engine->cfg);
+  char name[BUF_LEN_S];
+  RemoteError_t *remote_err = NULL;
+  ArchiveError_t *archive_err = NULL;
+
+  snprintf(name, sizeof(name), "%s%s", backup_name, RESTORE_FETCH_SUFFIX);
+  snprintf(engine->fetched_path, sizeof(engine->fetched_path), "%s/%s", dir, name);
+  if (remote_fetch(local.remote_target, backup_name, engine->fetched_path, local.remote_connections, NULL,
+    &remote_err) != REMOTE_OK) {
+    snprintf(message, len, "%s", remote_err ? remote_err->message : "Download failed");
+    destroy_remote_error(&remote_err);
+    engine->fetched_path[0] = '\0';
+
+    return RESTORE_FETCH_ERROR;
+  }
+
+  snprintf(local.output_path, sizeof(local.output_path), "%s", dir);
+  engine->reader = init_archive_reader(&local, name, &archive_err);
+  if (!engine->reader) {
+    snprintf(message, len, "%s", archive_err ? archive_err->message : "Cannot open the archive");
+    destroy_archive_error(&archive_err);
+
+    return RESTORE_ARCHIVE_ERROR;
+  }
+
+  return RESTORE_OK;
+}
+
+RestoreEngine_t *init_restore_engine(AppConfig_t *cfg, const char *backup_name, RestoreError_t **err) {
+  RestoreEngine_t *engine = calloc(1, sizeof(RestoreEngine_t));
+  ArchiveError_t *archive_err = NULL;
+  RestoreStatus_t status = RESTORE_OK;
+  char message[BUF_LEN_M] = "";
+
+  if (!engine) {
+    if (err) *err = create_restore_error(RESTORE_MEMORY_ERROR, "Failed to allocate restore engine!");
+
+    return NULL;
+  }
+  engine->cfg = cfg;
+  pthread_mutex_init(&engine->lock, NULL);
+
+  // a local archive wins; the remote copy is only fetched when there is none
+  engine->reader = init_archive_reader(cfg->storage, backup_name, &archive_err);
+  if (!engine->reader && archive_err && archive_err->code == ARCHIVE_NOT_FOUND && remote_enabled(cfg->storage)) {
+    status = restore_fetch_archive(engine, backup_name, message, sizeof(message));
+  } else if (!engine->reader) {
+    snprintf(message, sizeof(message), "%s", archive_err ? archive_err->message : "Cannot open the archive");
+    status = RESTORE_ARCHIVE_ERROR;
+  }
+  destroy_archive_error(&archive_err);
+
+  if (status != RESTORE_OK) {
+    if (err) *err = create_restore_error(status, message);
+    destroy_restore_engine(&engine);
+
+    return NULL;
+  }
+
+  return engine;
+}
+
+RestoreStepKind_t restore_step_kind(const char *sql, size_t len) {
+  static const char *const markers[] = { "FOREIGN KEY", "VALIDATE CONSTRAINT" };
+
+  for (size_t i = 0; i < sizeof(markers) / sizeof(markers[0]); i++) {
+    size_t marker_len = strlen(markers[i]);
+
+    for (size_t pos = 0; pos + marker_len <= len; pos++) {
+      if (strncasecmp(sql + pos, markers[i], marker_len) == 0) return RESTORE_STEP_CONSTRAINT;
+    }
+  }
+
+  return RESTORE_STEP_INDEX;
+}
+
+int restore_add_step(RestoreEngine_t *engine, RestoreStepKind_t kind, const char *sql, size_t len) {
+  RestoreStep_t step;
+
+  step.kind = kind;
+  step.sql = strndup(sql, len);
+  if (!step.sql) return -1;
+  DYN_ARRAY_APPEND(engine->steps, engine->step_count, engine->step_capacity, step);
+
+  return 0;
+}
+
+int restore_parse_post_data(RestoreEngine_t *engine, const char *text, size_t len) {
+  size_t start = 0, pos = 0;
+  bool open = false;
+
+  while (pos < len) {
+    size_t eol = pos, first = pos, end;
+
+    while (eol < len && text[eol] != '\n') eol++;
+    end = eol;
+    while (first < end && isspace((unsigned char)text[first])) first++;
+    while (end > first && isspace((unsigned char)text[end - 1])) end--;
+    pos = eol + 1;
+
+    // blank and comment lines between statements are dropped
+    if (!open && (first == end || (end - first >= 2 && text[first] == '-' && text[first + 1] == '-'))) continue;
+    if (!open) {
+      start = first;
+      open = true;
+    }
+    if (text[end - 1] == ';') {
+      if (restore_add_step(engine, restore_step_kind(text + start, end - start), text + start, end - start) != 0) {
+        return -1;
+      }
+      open = false;
+    }
+  }
+
+  // a last statement without its ';' was cut short
+  return open ? -1 : 0;
+}
+
+RestoreError_t *create_restore_error(RestoreStatus_t code, const char *message) {
+  RestoreError_t *err = malloc(sizeof(RestoreError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+/**
+ * destroy_restore_engine - stops the workers and closes the archive; a
+ * copy fetched from the remote is removed
+ * @engine: the engine
+ **/
+void destroy_restore_engine(RestoreEngine_t **engine) {
+  if (!engine || !*engine) return;
+  RestoreEngine_t *e = *engine;
+
+  destroy_scheduler(&e->sched);
+  destroy_archive_reader(&e->reader);
+  if (e->fetched_path[0] != '\0') unlink(e->fetched_path);
+  for (size_t i = 0; i < e->step_count; i++) free(e->steps[i].sql);
+  free(e->steps);
+  pthread_mutex_destroy(&e->lock);
+  free(e);
+  *engine = NULL;
+}
+
+void destroy_restore_error(RestoreError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
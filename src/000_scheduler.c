@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include "include/scheduler.h"
+
+void *scheduler_worker_main(void *arg);
+
+
+int init_sched_deque(SchedDeque_t *dq) {
+  dq->tasks = malloc(sizeof(SchedTask_t) * SCHED_DEQUE_INITIAL_CAP);
+  if (!dq->tasks) return -1;
+  dq->capacity = SCHED_DEQUE_INITIAL_CAP;
+  dq->top = 0;
+  dq->bottom = 0;
+  pthread_mutex_init(&dq->lock, NULL);
+
+  return 0;
+}
+
+void destroy_sched_deque(SchedDeque_t *dq) {
+  if (!dq) return;
+  if (dq->tasks) free(dq->tasks);
+  dq->tasks = NULL;
+  pthread_mutex_destroy(&dq->lock);
+}
+
+/**
+ * sched_deque_push - pushes a task at the bottom of a deque
+ * @dq: the deque
+ * @task: the task to push
+ *
+ * The deque is a ring indexed by ever-growing top/bottom counters;
+ * it doubles (and unwraps) when full.
+ * Return: 0 on success, -1 if the deque could not grow
+ **/
+int sched_deque_push(SchedDeque_t *dq, SchedTask_t task) {
+  pthread_mutex_lock(&dq->lock);
+  if (dq->bottom - dq->top >= dq->capacity) {
+    size_t new_cap = dq->capacity * 2;
+    SchedTask_t *grown = malloc(sizeof(SchedTask_t) * new_cap);
+
+    if (!grown) {
+      pthread_mutex_unlock(&dq->lock);
+
+      return -1;
+    }
+    for (size_t i = dq->top; i < dq->bottom; i++) {
+      grown[i - dq->top] = dq->tasks[i % dq->capacity];
+    }
+    dq->bottom -= dq->top;
+    dq->top = 0;
+    free(dq->tasks);
+    dq->tasks = grown;
+    dq->capacity = new_cap;
+  }
+  dq->tasks[dq->bottom % dq->capacity] = task;
+  dq->bottom++;
+  pthread_mutex_unlock(&dq->lock);
+
+  return 0;
+}
+
+bool sched_deque_pop(SchedDeque_t *dq, SchedTask_t *out) {
+  bool found = false;
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->bottom > dq->top) {
+    dq->bottom--;
+    *out = dq->tasks[dq->bottom % dq->capacity];
+    found = true;
+  }
+  pthread_mutex_unlock(&dq->lock);
+
+  return found;
+}
+
+bool sched_deque_steal(SchedDeque_t *dq, SchedTask_t *out) {
+  bool found = false;
+
+  pthread_mutex_lock(&dq->lock);
+  if (dq->bottom > dq->top) {
+    *out = dq->tasks[dq->top % dq->capacity];
+    dq->top++;
+    found = true;
+  }
+  pthread_mutex_unlock(&dq->lock);
+
+  return found;
+}
+
+Scheduler_t *init_scheduler(size_t worker_count) {
+  Scheduler_t *sched = calloc(1, sizeof(Scheduler_t));
+  size_t started = 0;
+
+  if (!sched) return NULL;
+  if (worker_count == 0) worker_count = 1;
+  if (worker_count > SCHED_MAX_WORKERS) worker_count = SCHED_MAX_WORKERS;
+
+  sched->worker_count = worker_count;
+  sched->deque_count = worker_count;
+  sched->threads = calloc(worker_count, sizeof(pthread_t));
+  sched->deques = calloc(worker_count, sizeof(SchedDeque_t));
+  if (!sched->threads || !sched->deques) {
+    if (sched->threads) free(sched->threads);
+    if (sched->deques) free(sched->deques);
+    free(sched);
+
+    return NULL;
+  }
+
+  for (size_t i = 0; i <= worker_count; i++) {
+    if (init_sched_deque(i < worker_count ? &sched->deques[i] : &sched->shared) != 0) {
+      for (size_t j = 0; j < i; j++) destroy_sched_deque(&sched->deques[j]);
+      free(sched->threads);
+      free(sched->deques);
+      free(sched);
+
+      return NULL;
+    }
+  }
+
+  pthread_key_create(&sched->worker_key, NULL);
+  pthread_mutex_init(&sched->lock, NULL);
+  pthread_cond_init(&sched->work_cv, NULL);
+  pthread_cond_init(&sched->idle_cv, NULL);
+
+  for (; started < worker_count; started++) {
+    if (pthread_create(&sched->threads[started], NULL, scheduler_worker_main, sched) != 0) break;
+  }
+
+  if (started < worker_count) {
+    // run with the workers we managed to start rather than not at all
+    sched->worker_count = started;
+    if (started == 0) {
+      destroy_scheduler(&sched);
+
+      return NULL;
+    }
+  }
+
+  return sched;
+}
+
+void destroy_scheduler(Scheduler_t **sched) {
+  if (!sched || !*sched) return;
+  Scheduler_t *s = *sched;
+
+  pthread_mutex_lock(&s->lock);
+  s->shutdown = true;
+  pthread_cond_broadcast(&s->work_cv);
+  pthread_mutex_unlock(&s->lock);
+
+  for (size_t i = 0; i < s->worker_count; i++) pthread_join(s->threads[i], NULL);
+  for (size_t i = 0; i < s->deque_count; i++) destroy_sched_deque(&s->deques[i]);
+  destroy_sched_deque(&s->shared);
+
+  pthread_key_delete(s->worker_key);
+  pthread_mutex_destroy(&s->lock);
+  pthread_cond_destroy(&s->work_cv);
+  pthread_cond_destroy(&s->idle_cv);
+  free(s->threads);
+  free(s->deques);
+  free(s);
+  *sched = NULL;
+}
@@ -0,0 +1,303 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "include/sqlitedump.h"
+
+
+bool sqlitedump_supported(const DBConfig_t *db) {
+  return strcmp(db->type, "sqlite") == 0 || strcmp(db->type, "sqlite3") == 0;
+}
+
+uint32_t sqlitedump_be32(const unsigned char *p) {
+  return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+uint64_t sqlitedump_page_sum(const unsigned char *page, size_t len) {
+  uint64_t crc = crc32(0L, page, (uInt)len);
+
+  return crc << 32 | adler32(1L, page, (uInt)len);
+}
+
+/* one open file description lock on [@start, @start + @len) of @fd; 0 on success */
+int sqlitedump_range(int fd, short type, off_t start, off_t len) {
+  struct flock lock = { .l_type = type, .l_whence = SEEK_SET, .l_start = start, .l_len = len, .l_pid = 0 };
+
+  return fcntl(fd, F_OFD_SETLK, &lock);
+}
+
+/* SHARED as SQLite takes it: through PENDING, so a writer waiting for EXCLUSIVE goes first */
+int sqlitedump_try_shared(SqliteDump_t *dump) {
+  int status, saved;
+
+  if (sqlitedump_range(dump->fd, F_RDLCK, SQLITE_PENDING_BYTE, 1) != 0) return -1;
+  status = sqlitedump_range(dump->fd, F_RDLCK, SQLITE_SHARED_FIRST, SQLITE_SHARED_SIZE);
+  saved = errno;
+  sqlitedump_range(dump->fd, F_UNLCK, SQLITE_PENDING_BYTE, 1);
+  errno = saved;
+
+  return status;
+}
+
+int sqlitedump_try_wal(SqliteDump_t *dump) {
+  int saved;
+
+  if (sqlitedump_range(dump->shm_fd, F_RDLCK, SQLITE_SHM_CKPT_LOCK, 1) != 0) return -1;
+  if (sqlitedump_range(dump->shm_fd, F_RDLCK, SQLITE_SHM_READ_LOCK1, 1) != 0) {
+    saved = errno;
+    sqlitedump_range(dump->shm_fd, F_UNLCK, SQLITE_SHM_CKPT_LOCK, 1);
+    errno = saved;
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/* retries @attempt while the locks are taken elsewhere, for `db.timeout_seconds` at most */
+SqliteDumpStatus_t sqlitedump_wait(SqliteDump_t *dump, int (*attempt)(SqliteDump_t *), const char *what,
+  SqliteDumpError_t **err) {
+  struct timespec start, now;
+  long backoff_us = 1000;
+  char message[BUF_LEN_M];
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  while (attempt(dump) != 0) {
+    if (errno != EAGAIN && errno != EACCES) {
+      snprintf(message, sizeof(message), "Cannot lock %.400s for %s: %s", dump->path, what, strerror(errno));
+      if (err) *err = create_sqlitedump_error(SQLITEDUMP_OPEN_ERROR, message);
+
+      return SQLITEDUMP_OPEN_ERROR;
+    }
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    if ((size_t)(now.tv_sec - start.tv_sec) >= dump->cfg->db->timeout_seconds) {
+      snprintf(message, sizeof(message), "%.400s stayed locked for %s over %zu seconds", dump->path, what,
+        dump->cfg->db->timeout_seconds);
+      if (err) *err = create_sqlitedump_error(SQLITEDUMP_BUSY_ERROR, message);
+
+      return SQLITEDUMP_BUSY_ERROR;
+    }
+    usleep((useconds_t)backoff_us);
+    if (backoff_us < 64000) backoff_us *= 2;
+  }
+
+  return SQLITEDUMP_OK;
+}
+
+void sqlitedump_unlock(SqliteDump_t *dump) {
+  if (!dump->locked) return;
+  sqlitedump_range(dump->fd, F_UNLCK, SQLITE_SHARED_FIRST, SQLITE_SHARED_SIZE);
+  dump->locked = false;
+}
+
+/* a rollback journal no writer holds RESERVED for is hot: the file is mid-transaction */
+bool sqlitedump_hot_journal(const SqliteDump_t *dump) {
+  struct flock reserved = { .l_type = F_WRLCK, .l_whence = SEEK_SET, .l_start = SQLITE_RESERVED_BYTE, .l_len = 1,
+    .l_pid = 0 };
+  char path[BUF_LEN + 16];
+  unsigned char first = 0;
+  struct stat st;
+  int fd;
+
+  snprintf(path, sizeof(path), "%s-journal", dump->path);
+  if (stat(path, &st) != 0 || st.st_size == 0) return false;
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return false;
+  // a persisted or truncated journal starts with zeroes
+  if (read(fd, &first, 1) != 1) first = 0;
+  close(fd);
+  if (first == 0) return false;
+
+  return fcntl(dump->fd, F_OFD_GETLK, &reserved) == 0 && reserved.l_type == F_UNLCK;
+}
+
+SqliteDumpStatus_t sqlitedump_lock(SqliteDump_t *dump, SqliteDumpError_t **err) {
+  SqliteDumpStatus_t status = sqlitedump_wait(dump, sqlitedump_try_shared, "reading", err);
+  char message[BUF_LEN_M];
+
+  dump->locked = status == SQLITEDUMP_OK;
+  if (dump->locked && !dump->wal && sqlitedump_hot_journal(dump)) {
+    sqlitedump_unlock(dump);
+    snprintf(message, sizeof(message), "%.400s has a hot journal, open it with SQLite once to roll it back",
+      dump->path);
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_FORMAT_ERROR, message);
+
+    return SQLITEDUMP_FORMAT_ERROR;
+  }
+
+  return status;
+}
+
+SqliteDumpStatus_t sqlitedump_hold_wal(SqliteDump_t *dump, SqliteDumpError_t **err) {
+  return sqlitedump_wait(dump, sqlitedump_try_wal, "checkpoints", err);
+}
+
+void sqlitedump_release_wal(SqliteDump_t *dump) {
+  sqlitedump_range(dump->shm_fd, F_UNLCK, SQLITE_SHM_CKPT_LOCK, 1);
+  sqlitedump_range(dump->shm_fd, F_UNLCK, SQLITE_SHM_READ_LOCK1, 1);
+}
+
+SqliteDumpStatus_t sqlitedump_read_header(SqliteDump_t *dump, SqliteDumpError_t **err) {
+  unsigned char header[SQLITE_HEADER_LEN];
+  char message[BUF_LEN_M];
+  uint32_t page_size, in_header, file_pages;
+  struct stat st;
+
+  if (fstat(dump->fd, &st) != 0) {
+    snprintf(message, sizeof(message), "Cannot stat %.400s: %s", dump->path, strerror(errno));
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_OPEN_ERROR, message);
+
+    return SQLITEDUMP_OPEN_ERROR;
+  }
+  // an empty file is an empty database
+  if (st.st_size == 0) {
+    if (!dump->page_size) dump->page_size = 4096;
+    dump->page_count = 0;
+
+    return SQLITEDUMP_OK;
+  }
+  if (pread(dump->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)
+    || memcmp(header, "SQLite format 3", 16) != 0) {
+    snprintf(message, sizeof(message), "%.400s is not a SQLite 3 database", dump->path);
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_FORMAT_ERROR, message);
+
+    return SQLITEDUMP_FORMAT_ERROR;
+  }
+  page_size = (uint32_t)header[16] << 8 | header[17];
+  if (page_size == 1) page_size = 65536;
+  if (page_size < 512 || (page_size & (page_size - 1)) != 0 || (header[18] != 1 && header[18] != 2)) {
+    snprintf(message, sizeof(message), "%.400s has an unsupported page size or file format", dump->path);
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_FORMAT_ERROR, message);
+
+    return SQLITEDUMP_FORMAT_ERROR;
+  }
+  dump->page_size = page_size;
+  dump->wal = header[18] == 2;
+  dump->counter = sqlitedump_be32(header + 24);
+  // the size in the header only counts when written by the same transaction as the counter
+  in_header = sqlitedump_be32(header + 28);
+  file_pages = (uint32_t)((uint64_t)st.st_size / page_size);
+  dump->page_count = in_header && dump->counter == sqlitedump_be32(header + 92) && in_header <= file_pages
+    ? in_header : file_pages;
+
+  return SQLITEDUMP_OK;
+}
+
+SqliteDumpStatus_t sqlitedump_map(SqliteDump_t *dump, size_t len, SqliteDumpError_t **err) {
+  char message[BUF_LEN_M];
+  void *map;
+
+  if (dump->map) munmap((void *)dump->map, dump->map_len);
+  dump->map = NULL;
+  dump->map_len = 0;
+  if (len == 0) return SQLITEDUMP_OK;
+  map = mmap(NULL, len, PROT_READ, MAP_SHARED, dump->fd, 0);
+  if (map == MAP_FAILED) {
+    snprintf(message, sizeof(message), "Cannot map %.400s: %s", dump->path, strerror(errno));
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_OPEN_ERROR, message);
+
+    return SQLITEDUMP_OPEN_ERROR;
+  }
+  // read once, front to back: let the kernel read ahead and drop behind
+  madvise(map, len, MADV_SEQUENTIAL);
+  dump->map = map;
+  dump->map_len = len;
+
+  return SQLITEDUMP_OK;
+}
+
+/* opens the -shm file WAL mode locks live in, as SQLite would create it */
+SqliteDumpStatus_t sqlitedump_open_shm(SqliteDump_t *dump, SqliteDumpError_t **err) {
+  char path[BUF_LEN + 16], message[BUF_LEN_M];
+  struct stat st;
+
+  snprintf(path, sizeof(path), "%s-shm", dump->path);
+  if (fstat(dump->fd, &st) != 0) st.st_mode = 0644;
+  dump->shm_fd = open(path, O_RDONLY | O_CREAT | O_CLOEXEC, st.st_mode & 0777);
+  if (dump->shm_fd < 0) {
+    snprintf(message, sizeof(message), "Cannot open %.400s: %s", path, strerror(errno));
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_OPEN_ERROR, message);
+
+    return SQLITEDUMP_OPEN_ERROR;
+  }
+
+  return SQLITEDUMP_OK;
+}
+
+SqliteDump_t *init_sqlitedump(AppConfig_t *cfg, SqliteDumpError_t **err) {
+  SqliteDump_t *dump;
+  SqliteDumpStatus_t status;
+  char message[BUF_LEN_M];
+
+  if (!sqlitedump_supported(cfg->db)) {
+    snprintf(message, sizeof(message), "db.type %s is not a SQLite database", cfg->db->type);
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_CONFIG_ERROR, message);
+
+    return NULL;
+  }
+  dump = calloc(1, sizeof(SqliteDump_t));
+  if (!dump) {
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_MEMORY_ERROR, "Failed to allocate the dump!");
+
+    return NULL;
+  }
+  dump->cfg = cfg;
+  dump->shm_fd = -1;
+  init_page_cache(&dump->cache);
+  snprintf(dump->path, sizeof(dump->path), "%s", cfg->db->uri);
+  dump->fd = open(dump->path, O_RDONLY | O_CLOEXEC);
+  if (dump->fd < 0) {
+    snprintf(message, sizeof(message), "Cannot open %.400s: %s", dump->path, strerror(errno));
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_OPEN_ERROR, message);
+    destroy_sqlitedump(&dump);
+
+    return NULL;
+  }
+
+  status = sqlitedump_lock(dump, err);
+  if (status == SQLITEDUMP_OK) status = sqlitedump_read_header(dump, err);
+  sqlitedump_unlock(dump);
+  if (status == SQLITEDUMP_OK && dump->wal) status = sqlitedump_open_shm(dump, err);
+  if (status != SQLITEDUMP_OK) destroy_sqlitedump(&dump);
+
+  return dump;
+}
+
+SqliteDumpError_t *create_sqlitedump_error(SqliteDumpStatus_t code, const char *message) {
+  SqliteDumpError_t *err = malloc(sizeof(SqliteDumpError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+/* unmaps and closes the files, which drops every lock still held */
+void destroy_sqlitedump(SqliteDump_t **dump) {
+  if (!dump || !*dump) return;
+  SqliteDump_t *d = *dump;
+
+  if (d->map) munmap((void *)d->map, d->map_len);
+  if (d->shm_fd >= 0) close(d->shm_fd);
+  if (d->fd >= 0) close(d->fd);
+  free(d->sums);
+  free(d->chunk_counters);
+  destroy_page_cache(&d->cache);
+  free(d);
+  *dump = NULL;
+}
+
+void destroy_sqlitedump_error(SqliteDumpError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
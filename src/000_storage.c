@@ -0,0 +1,188 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/storage.h"
+
+
+StorageSink_t *init_storage_sink(const StorageConfig_t *cfg, const char *backup_name, StorageError_t **err) {
+  StorageSink_t *sink = calloc(1, sizeof(StorageSink_t));
+  char message[BUF_LEN_M];
+
+  if (!sink) {
+    if (err) *err = create_storage_error(STORAGE_MEMORY_ERROR, "Failed to allocate storage sink!");
+
+    return NULL;
+  }
+  sink->fd = -1;
+
+  if (storage_to_stdout(cfg)) {
+    if (cfg->dedup_enabled) {
+      if (err) *err = create_storage_error(STORAGE_CONFIG_ERROR, "storage.dedup needs a directory as output_path, not -");
+      free(sink);
+
+      return NULL;
+    }
+    // a descriptor of our own: closing it at commit leaves stdout to the rest of the process
+    sink->fd = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (sink->fd < 0) {
+      snprintf(message, sizeof(message), "Cannot write to stdout: %s", strerror(errno));
+      if (err) *err = create_storage_error(STORAGE_IO_ERROR, message);
+      free(sink);
+
+      return NULL;
+    }
+    sink->stream = true;
+    snprintf(sink->path, sizeof(sink->path), "%s", STORAGE_STDOUT);
+  } else if (!backup_name[0] || backup_name[0] == '.' || strchr(backup_name, '/')) {
+    // a name like "../x" would put the archive outside output_path
+    snprintf(message, sizeof(message), "Invalid backup name: %.400s", backup_name);
+    if (err) *err = create_storage_error(STORAGE_CONFIG_ERROR, message);
+    free(sink);
+
+    return NULL;
+  } else if (mkdir(cfg->output_path, 0750) != 0 && errno != EEXIST) {
+    snprintf(message, sizeof(message), "Cannot create output_path %s: %s", cfg->output_path, strerror(errno));
+    if (err) *err = create_storage_error(STORAGE_IO_ERROR, message);
+    free(sink);
+
+    return NULL;
+  } else {
+    // a cut path would write somewhere else than asked
+    if ((size_t)snprintf(sink->path, sizeof(sink->path), "%s/%s", cfg->output_path, backup_name) >= sizeof(sink->path)
+      || (size_t)snprintf(sink->partial_path, sizeof(sink->partial_path), "%s%s", sink->path, STORAGE_PARTIAL_SUFFIX)
+      >= sizeof(sink->partial_path)) {
+      snprintf(message, sizeof(message), "Archive path too long: %.200s/%.200s", cfg->output_path, backup_name);
+      if (err) *err = create_storage_error(STORAGE_CONFIG_ERROR, message);
+      free(sink);
+
+      return NULL;
+    }
+    sink->fd = open(sink->partial_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (sink->fd < 0) {
+      snprintf(message, sizeof(message), "Cannot open %.400s: %s", sink->partial_path, strerror(errno));
+      if (err) *err = create_storage_error(STORAGE_IO_ERROR, message);
+      free(sink);
+
+      return NULL;
+    }
+  }
+
+  // the file status flags of stdout are shared with whoever opened it
+  if (cfg->direct_io && !sink->stream) {
+    int flags = fcntl(sink->fd, F_GETFL);
+    void *stage = NULL;
+
+    if (posix_memalign(&stage, STORAGE_DIRECT_ALIGN, STORAGE_DIRECT_STAGE) != 0) {
+      if (err) *err = create_storage_error(STORAGE_MEMORY_ERROR, "Failed to allocate direct I/O stage!");
+      destroy_storage_sink(&sink);
+
+      return NULL;
+    }
+    sink->stage = stage;
+    // tmpfs and a few others refuse O_DIRECT; the stage is then evicted after writing
+    sink->o_direct = flags >= 0 && fcntl(sink->fd, F_SETFL, flags | O_DIRECT) == 0;
+  }
+
+  if (cfg->dedup_enabled) {
+    ChunkStoreError_t *chunk_err = NULL;
+
+    // chunks are shared between backups, so a per-backup data key or upload cannot cover them
+    if (storage_encryption_enabled(cfg) || remote_enabled(cfg)) {
+      if (err) *err = create_storage_error(STORAGE_CONFIG_ERROR,
+        "storage.dedup cannot be combined with encryption_key_path or remote_target");
+      destroy_storage_sink(&sink);
+
+      return NULL;
+    }
+    sink->dedup = init_chunk_store(cfg->output_path, cfg->compression, &chunk_err);
+    sink->chunk = malloc(CHUNK_MAX_SIZE);
+    sink->manifest_md = EVP_MD_CTX_new();
+    if (!sink->dedup || !sink->chunk || !sink->manifest_md
+      || EVP_DigestInit_ex(sink->manifest_md, EVP_sha256(), NULL) != 1) {
+      if (err) *err = create_storage_error(chunk_err && chunk_err->code == CHUNKSTORE_CONFIG_ERROR
+        ? STORAGE_CONFIG_ERROR : STORAGE_IO_ERROR, chunk_err ? chunk_err->message : "Failed to set up chunk store!");
+      destroy_chunk_store_error(&chunk_err);
+      destroy_storage_sink(&sink);
+
+      return NULL;
+    }
+    init_chunker(&sink->chunker);
+  }
+  if (!(sink->index = init_archive_index())) {
+    if (err) *err = create_storage_error(STORAGE_MEMORY_ERROR, "Failed to allocate archive index!");
+    destroy_storage_sink(&sink);
+
+    return NULL;
+  }
+
+  if (remote_enabled(cfg)) {
+    RemoteError_t *remote_err = NULL;
+
+    sink->remote = init_remote_uploader(cfg->remote_target, backup_name, cfg->remote_connections, 0, &remote_err);
+    if (!sink->remote) {
+      if (err) *err = create_storage_error(STORAGE_IO_ERROR, remote_err ? remote_err->message : "Cannot start upload");
+      destroy_remote_error(&remote_err);
+      destroy_storage_sink(&sink);
+
+      return NULL;
+    }
+  }
+
+  return sink;
+}
+
+bool storage_encryption_enabled(const StorageConfig_t *cfg) {
+  return cfg->encryption_key_path[0] != '\0' && strcmp(cfg->encryption_key_path, DEFAULT_STORAGE_ENC_KEY_PATH) != 0;
+}
+
+bool storage_to_stdout(const StorageConfig_t *cfg) {
+  return strcmp(cfg->output_path, STORAGE_STDOUT) == 0;
+}
+
+StorageError_t *create_storage_error(StorageStatus_t code, const char *message) {
+  StorageError_t *err = malloc(sizeof(StorageError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+/**
+ * destroy_storage_sink - closes the sink; an uncommitted archive is removed
+ * and its upload aborted
+ * @sink: the sink
+ **/
+void destroy_storage_sink(StorageSink_t **sink) {
+  if (!sink || !*sink) return;
+  StorageSink_t *s = *sink;
+
+  // before the file goes, as tearing the ring down waits for its writes
+  destroy_uring_writer(&s->uring);
+  if (s->fd >= 0) {
+    close(s->fd);
+    if (!s->stream) unlink(s->partial_path);
+  }
+  destroy_cipher_stage(&s->cipher);
+  destroy_remote_uploader(&s->remote);
+  destroy_chunk_store(&s->dedup);
+  destroy_archive_index(&s->index);
+  EVP_MD_CTX_free(s->manifest_md);
+  free(s->chunk);
+  free(s->stage);
+  free(s);
+  *sink = NULL;
+}
+
+void destroy_storage_error(StorageError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
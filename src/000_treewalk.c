@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/treewalk.h"
+
+
+TreeWalk_t *init_tree_walk(const char *root, unsigned int mask, TreeVisitFn_t visit, void *ctx,
+  TreeWalkError_t **err) {
+  TreeWalk_t *walk = calloc(1, sizeof(TreeWalk_t));
+  char message[BUF_LEN_M];
+
+  if (!walk) {
+    if (err) *err = create_treewalk_error(TREEWALK_MEMORY_ERROR, "Failed to allocate tree walk!");
+
+    return NULL;
+  }
+  walk->root_fd = open(root, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+  if (walk->root_fd < 0) {
+    snprintf(message, sizeof(message), "Cannot open %.400s: %s", root, strerror(errno));
+    if (err) *err = create_treewalk_error(TREEWALK_IO_ERROR, message);
+    free(walk);
+
+    return NULL;
+  }
+  walk->mask = mask;
+  walk->visit = visit;
+  walk->ctx = ctx;
+  pthread_mutex_init(&walk->lock, NULL);
+
+  return walk;
+}
+
+void tree_walk_fail(TreeWalk_t *walk, TreeWalkStatus_t code, const char *message) {
+  pthread_mutex_lock(&walk->lock);
+  if (walk->status == TREEWALK_OK) {
+    snprintf(walk->message, sizeof(walk->message), "%s", message);
+    __atomic_store_n(&walk->status, code, __ATOMIC_RELEASE);
+  }
+  pthread_mutex_unlock(&walk->lock);
+}
+
+TreeWalkStatus_t tree_walk_finish(TreeWalk_t *walk, TreeWalkError_t **err) {
+  TreeWalkStatus_t status = __atomic_load_n(&walk->status, __ATOMIC_ACQUIRE);
+
+  if (status != TREEWALK_OK && err) *err = create_treewalk_error(status, walk->message);
+
+  return status;
+}
+
+TreeWalkError_t *create_treewalk_error(TreeWalkStatus_t code, const char *message) {
+  TreeWalkError_t *err = malloc(sizeof(TreeWalkError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+void destroy_tree_walk(TreeWalk_t **walk) {
+  if (!walk || !*walk) return;
+  TreeWalk_t *w = *walk;
+
+  close(w->root_fd);
+  pthread_mutex_destroy(&w->lock);
+  free(w);
+  *walk = NULL;
+}
+
+void destroy_treewalk_error(TreeWalkError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include "include/uring.h"
+
+
+/**
+ * uring_ring_setup - creates a ring and maps its submission queue,
+ * completion queue and submission entries
+ * @ring: written ring
+ * @entries: wanted submission slots, rounded up by the kernel
+ *
+ * Return: 0 on success, -1 with errno set (ENOSYS without io_uring)
+ **/
+int uring_ring_setup(UringRing_t *ring, unsigned entries) {
+  struct io_uring_params params;
+  unsigned char *sq, *cq;
+
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+#ifdef __NR_io_uring_setup
+  memset(&params, 0, sizeof(params));
+  ring->fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+#else
+  (void)entries;
+  errno = ENOSYS;
+#endif
+  if (ring->fd < 0) return -1;
+
+  ring->entries = params.sq_entries;
+  ring->sq_map_len = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_map_len = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_map_len > ring->sq_map_len) ring->sq_map_len = ring->cq_map_len;
+    ring->cq_map_len = ring->sq_map_len;
+  }
+
+  ring->sq_map = mmap(NULL, ring->sq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+    IORING_OFF_SQ_RING);
+  if (ring->sq_map == MAP_FAILED) {
+    ring->sq_map = NULL;
+    uring_ring_teardown(ring);
+
+    return -1;
+  }
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    ring->cq_map = ring->sq_map;
+  } else {
+    ring->cq_map = mmap(NULL, ring->cq_map_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+      IORING_OFF_CQ_RING);
+    if (ring->cq_map == MAP_FAILED) {
+      ring->cq_map = NULL;
+      uring_ring_teardown(ring);
+
+      return -1;
+    }
+  }
+  ring->sqes_len = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring->fd,
+    IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    uring_ring_teardown(ring);
+
+    return -1;
+  }
+
+  sq = ring->sq_map;
+  cq = ring->cq_map;
+  ring->sq_head = (unsigned *)(sq + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq + params.sq_off.ring_mask);
+  ring->sq_array = (unsigned *)(sq + params.sq_off.array);
+  ring->cq_head = (unsigned *)(cq + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+
+  return 0;
+}
+
+/* closing the ring waits for the requests still in flight */
+void uring_ring_teardown(UringRing_t *ring) {
+  int saved_errno = errno;
+
+  if (ring->sqes) munmap(ring->sqes, ring->sqes_len);
+  if (ring->cq_map && ring->cq_map != ring->sq_map) munmap(ring->cq_map, ring->cq_map_len);
+  if (ring->sq_map) munmap(ring->sq_map, ring->sq_map_len);
+  if (ring->fd >= 0) close(ring->fd);
+  memset(ring, 0, sizeof(*ring));
+  ring->fd = -1;
+  errno = saved_errno;
+}
+
+UringWriter_t *init_uring_writer(int fd, Pipeline_t *pipe, char *message, size_t len) {
+  UringWriter_t *writer = calloc(1, sizeof(UringWriter_t));
+  unsigned entries = URING_SUBMIT_BATCH;
+  struct iovec *iov;
+
+  if (!writer) {
+    snprintf(message, len, "Failed to allocate io_uring writer!");
+
+    return NULL;
+  }
+  writer->ring.fd = -1;
+  writer->fd = fd;
+  writer->pipe = pipe;
+  writer->writes = calloc(pipe->buffer_count, sizeof(UringWrite_t));
+  writer->registered = calloc(pipe->buffer_count * 2, sizeof(unsigned char *));
+  if (!writer->writes || !writer->registered) {
+    snprintf(message, len, "Failed to allocate io_uring writer!");
+    destroy_uring_writer(&writer);
+
+    return NULL;
+  }
+
+  // one slot per block that can be in flight
+  while (entries < pipe->buffer_count && entries < URING_MAX_ENTRIES) entries <<= 1;
+  if (uring_ring_setup(&writer->ring, entries) != 0) {
+    snprintf(message, len, "io_uring is not available: %s", strerror(errno));
+    destroy_uring_writer(&writer);
+
+    return NULL;
+  }
+
+  iov = calloc(pipe->buffer_count * 2, sizeof(struct iovec));
+  if (iov) {
+    for (size_t i = 0; i < pipe->buffer_count; i++) {
+      writer->registered[2 * i] = pipe->buffers[i].data;
+      writer->registered[2 * i + 1] = pipe->buffers[i].scratch;
+      iov[2 * i].iov_base = pipe->buffers[i].data;
+      iov[2 * i].iov_len = pipe->buffers[i].capacity;
+      iov[2 * i + 1].iov_base = pipe->buffers[i].scratch;
+      iov[2 * i + 1].iov_len = pipe->buffers[i].capacity;
+    }
+    // registering pins the pages, which RLIMIT_MEMLOCK may not allow; plain writes then
+#ifdef __NR_io_uring_register
+    writer->fixed = syscall(__NR_io_uring_register, writer->ring.fd, IORING_REGISTER_BUFFERS, iov,
+      (unsigned)(pipe->buffer_count * 2)) == 0;
+#endif
+    free(iov);
+  }
+
+  return writer;
+}
+
+/**
+ * destroy_uring_writer - tears the ring down; a writer that was not
+ * flushed drops its queued writes
+ * @writer: the writer
+ **/
+void destroy_uring_writer(UringWriter_t **writer) {
+  if (!writer || !*writer) return;
+  UringWriter_t *w = *writer;
+
+  uring_ring_teardown(&w->ring);
+  free(w->registered);
+  free(w->writes);
+  free(w);
+  *writer = NULL;
+}
@@ -0,0 +1,315 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include "include/walarchive.h"
+#include "include/archive.h"
+
+
+void wal_segment_name(uint32_t timeline, uint64_t lsn, uint32_t segment_size, char name[WAL_SEGMENT_NAME_LEN + 1]) {
+  uint64_t per_id = 0x100000000ULL / segment_size, segno = lsn / segment_size;
+
+  snprintf(name, WAL_SEGMENT_NAME_LEN + 1, "%08X%08X%08X", timeline, (uint32_t)(segno / per_id),
+    (uint32_t)(segno % per_id));
+}
+
+int wal_parse_segment_name(const char *name, uint32_t segment_size, uint32_t *timeline, uint64_t *lsn) {
+  uint64_t per_id = 0x100000000ULL / segment_size;
+  char part[9];
+  uint32_t fields[3];
+
+  if (strlen(name) != WAL_SEGMENT_NAME_LEN || strspn(name, "0123456789ABCDEF") != WAL_SEGMENT_NAME_LEN) return -1;
+  for (int i = 0; i < 3; i++) {
+    memcpy(part, name + 8 * i, 8);
+    part[8] = '\0';
+    fields[i] = (uint32_t)strtoul(part, NULL, 16);
+  }
+  if (fields[0] == 0 || fields[2] >= per_id) return -1;
+  *timeline = fields[0];
+  *lsn = ((uint64_t)fields[1] * per_id + fields[2]) * segment_size;
+
+  return 0;
+}
+
+void wal_history_name(uint32_t timeline, char name[WAL_HISTORY_NAME_LEN + 1]) {
+  snprintf(name, WAL_HISTORY_NAME_LEN + 1, "%08X%s", timeline, WAL_HISTORY_SUFFIX);
+}
+
+int wal_parse_history_name(const char *name, uint32_t *timeline) {
+  if (strlen(name) != WAL_HISTORY_NAME_LEN || strspn(name, "0123456789ABCDEF") != 8
+    || strcmp(name + 8, WAL_HISTORY_SUFFIX) != 0) return -1;
+  *timeline = (uint32_t)strtoul(name, NULL, 16);
+
+  return *timeline > 1 ? 0 : -1;
+}
+
+int wal_parse_lsn(const char *text, uint64_t *lsn) {
+  unsigned int hi, lo;
+  int used = 0;
+
+  if (sscanf(text, "%X/%X%n", &hi, &lo, &used) != 2 || text[used] != '\0') return -1;
+  *lsn = ((uint64_t)hi << 32) | lo;
+
+  return 0;
+}
+
+uint32_t wal_parse_size(const char *text) {
+  char *unit;
+  unsigned long long value = strtoull(text, &unit, 10);
+
+  if (strcasecmp(unit, "kB") == 0) value <<= 10;
+  else if (strcmp(unit, "MB") == 0) value <<= 20;
+  else if (strcmp(unit, "GB") == 0) value <<= 30;
+  else if (*unit != '\0' && strcmp(unit, "B") != 0) return 0;
+  // the server only allows powers of two between 1MB and 1GB
+  if (value < WAL_MIN_SEGMENT_SIZE || value > WAL_MAX_SEGMENT_SIZE || (value & (value - 1)) != 0) return 0;
+
+  return (uint32_t)value;
+}
+
+void wal_index_encode(const WalIndexEntry_t *entry, unsigned char record[WAL_INDEX_RECORD_LEN]) {
+  archive_put_le(record, entry->start_lsn, 8);
+  archive_put_le(record + 8, entry->batch_lsn, 8);
+  archive_put_le(record + 16, (uint64_t)entry->end_time, 8);
+  archive_put_le(record + 24, entry->timeline, 4);
+  archive_put_le(record + 28, crc32(0L, record, 28), 4);
+}
+
+/* 0 when @record holds a valid entry */
+int wal_index_decode(const unsigned char record[WAL_INDEX_RECORD_LEN], WalIndexEntry_t *entry) {
+  if (archive_get_le(record + 28, 4) != crc32(0L, record, 28)) return -1;
+  entry->start_lsn = archive_get_le(record, 8);
+  entry->batch_lsn = archive_get_le(record + 8, 8);
+  entry->end_time = (int64_t)archive_get_le(record + 16, 8);
+  entry->timeline = (uint32_t)archive_get_le(record + 24, 4);
+
+  return 0;
+}
+
+/* writes the header of a new index; 0 on success */
+int wal_index_create(WalIndex_t *index) {
+  unsigned char header[WAL_INDEX_HEADER_LEN];
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, WAL_INDEX_MAGIC, 7);
+  header[7] = WAL_INDEX_VERSION;
+  archive_put_le(header + 8, index->segment_size, 4);
+
+  return pwrite(index->fd, header, sizeof(header), 0) == (ssize_t)sizeof(header) && fsync(index->fd) == 0 ? 0 : -1;
+}
+
+/* checks the header of an existing index and leaves out a torn last record, cut off when @writable; 0 on success */
+int wal_index_load(WalIndex_t *index, off_t size, bool writable, char *message, size_t len) {
+  unsigned char header[WAL_INDEX_HEADER_LEN];
+  WalIndexEntry_t last;
+
+  if (size < WAL_INDEX_HEADER_LEN || pread(index->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)
+    || memcmp(header, WAL_INDEX_MAGIC, 7) != 0 || header[7] != WAL_INDEX_VERSION) {
+    snprintf(message, len, "%s is not a WAL segment index", index->path);
+
+    return -1;
+  }
+  index->segment_size = (uint32_t)archive_get_le(header + 8, 4);
+  if (index->segment_size < WAL_MIN_SEGMENT_SIZE || index->segment_size > WAL_MAX_SEGMENT_SIZE
+    || (index->segment_size & (index->segment_size - 1)) != 0) {
+    snprintf(message, len, "%s has an invalid segment size", index->path);
+
+    return -1;
+  }
+  index->count = (uint64_t)(size - WAL_INDEX_HEADER_LEN) / WAL_INDEX_RECORD_LEN;
+  // appends are one write each, so only the last record can be torn
+  if (index->count > 0 && wal_index_read(index, index->count - 1, &last) != 0) index->count--;
+  // a reader leaves it to the archiver, whose append may still be under way
+  if (writable && (uint64_t)size != WAL_INDEX_HEADER_LEN + index->count * WAL_INDEX_RECORD_LEN
+    && ftruncate(index->fd, (off_t)(WAL_INDEX_HEADER_LEN + index->count * WAL_INDEX_RECORD_LEN)) != 0) {
+    snprintf(message, len, "Cannot cut the torn end of %s: %s", index->path, strerror(errno));
+
+    return -1;
+  }
+
+  return 0;
+}
+
+WalIndex_t *wal_index_open(const char *output_path, uint32_t segment_size, WalArchiveError_t **err) {
+  char path[BUF_LEN];
+
+  // a new archive may come before any backup made output_path; open() reports a failure
+  if (segment_size) mkdir(output_path, 0750);
+  snprintf(path, sizeof(path), "%s/%s", output_path, WAL_INDEX_FILE);
+
+  return wal_index_open_file(path, segment_size, err);
+}
+
+WalIndex_t *wal_index_open_file(const char *path, uint32_t segment_size, WalArchiveError_t **err) {
+  WalIndex_t *index = calloc(1, sizeof(WalIndex_t));
+  char message[BUF_LEN_M];
+  struct stat st;
+  int saved;
+
+  if (!index) {
+    if (err) *err = create_wal_archive_error(WAL_ARCHIVE_MEMORY_ERROR, "Failed to allocate the WAL index!");
+
+    return NULL;
+  }
+  snprintf(index->path, sizeof(index->path), "%s", path);
+  index->fd = open(index->path, (segment_size ? O_RDWR | O_CREAT : O_RDONLY) | O_CLOEXEC, 0640);
+  if (index->fd < 0 || fstat(index->fd, &st) != 0) {
+    saved = errno;
+    snprintf(message, sizeof(message), "Cannot open %.400s: %s", index->path, strerror(saved));
+    if (err) *err = create_wal_archive_error(saved == ENOENT ? WAL_ARCHIVE_NOT_FOUND : WAL_ARCHIVE_STORAGE_ERROR,
+      message);
+    destroy_wal_index(&index);
+
+    return NULL;
+  }
+
+  if (st.st_size == 0 && segment_size) {
+    index->segment_size = segment_size;
+    if (wal_index_create(index) != 0) {
+      snprintf(message, sizeof(message), "Cannot write %.400s: %s", index->path, strerror(errno));
+      if (err) *err = create_wal_archive_error(WAL_ARCHIVE_STORAGE_ERROR, message);
+      destroy_wal_index(&index);
+    }
+
+    return index;
+  }
+  if (wal_index_load(index, st.st_size, segment_size != 0, message, sizeof(message)) != 0) {
+    if (err) *err = create_wal_archive_error(WAL_ARCHIVE_CORRUPT_ERROR, message);
+    destroy_wal_index(&index);
+
+    return NULL;
+  }
+  if (segment_size && segment_size != index->segment_size) {
+    snprintf(message, sizeof(message), "%.400s holds %u byte segments, the server writes %u", index->path,
+      index->segment_size, segment_size);
+    if (err) *err = create_wal_archive_error(WAL_ARCHIVE_CONFIG_ERROR, message);
+    destroy_wal_index(&index);
+  }
+
+  return index;
+}
+
+int wal_index_read(const WalIndex_t *index, uint64_t pos, WalIndexEntry_t *entry) {
+  unsigned char record[WAL_INDEX_RECORD_LEN];
+  off_t at = (off_t)(WAL_INDEX_HEADER_LEN + pos * WAL_INDEX_RECORD_LEN);
+
+  if (pread(index->fd, record, sizeof(record), at) != (ssize_t)sizeof(record)) return -1;
+
+  return wal_index_decode(record, entry);
+}
+
+int wal_index_append(WalIndex_t *index, const WalIndexEntry_t *entries, size_t count) {
+  unsigned char *records = malloc(count * WAL_INDEX_RECORD_LEN);
+  off_t at = (off_t)(WAL_INDEX_HEADER_LEN + index->count * WAL_INDEX_RECORD_LEN);
+  size_t len = count * WAL_INDEX_RECORD_LEN;
+  int status = -1;
+
+  if (!records) return -1;
+  for (size_t i = 0; i < count; i++) wal_index_encode(&entries[i], records + i * WAL_INDEX_RECORD_LEN);
+  if (pwrite(index->fd, records, len, at) == (ssize_t)len && fdatasync(index->fd) == 0) {
+    index->count += count;
+    status = 0;
+  }
+  free(records);
+
+  return status;
+}
+
+/**
+ * wal_index_bound - binary search on (timeline, start LSN)
+ * @index: the index
+ * @timeline: timeline of the key
+ * @lsn: LSN of the key
+ * @upper: find the first record after the key rather than at or after it
+ * @pos: written position found, @index->count when there is none
+ *
+ * Return: WAL_ARCHIVE_OK, or WAL_ARCHIVE_CORRUPT_ERROR on a bad record
+ **/
+WalArchiveStatus_t wal_index_bound(const WalIndex_t *index, uint32_t timeline, uint64_t lsn, bool upper,
+  uint64_t *pos) {
+  uint64_t lo = 0, hi = index->count;
+  WalIndexEntry_t entry;
+
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+    bool before;
+
+    if (wal_index_read(index, mid, &entry) != 0) return WAL_ARCHIVE_CORRUPT_ERROR;
+    before = entry.timeline < timeline || (entry.timeline == timeline && entry.start_lsn < lsn);
+    if (upper) before = before || (entry.timeline == timeline && entry.start_lsn == lsn);
+    if (before) lo = mid + 1;
+    else hi = mid;
+  }
+  *pos = lo;
+
+  return WAL_ARCHIVE_OK;
+}
+
+WalArchiveStatus_t wal_index_find(const WalIndex_t *index, uint32_t timeline, uint64_t lsn, WalIndexEntry_t *entry) {
+  uint64_t start = lsn - lsn % index->segment_size, pos;
+  WalArchiveStatus_t status = wal_index_bound(index, timeline, start, false, &pos);
+
+  if (status != WAL_ARCHIVE_OK) return status;
+  if (pos == index->count) return WAL_ARCHIVE_NOT_FOUND;
+  if (wal_index_read(index, pos, entry) != 0) return WAL_ARCHIVE_CORRUPT_ERROR;
+
+  return entry->timeline == timeline && entry->start_lsn == start ? WAL_ARCHIVE_OK : WAL_ARCHIVE_NOT_FOUND;
+}
+
+WalArchiveStatus_t wal_index_range(const WalIndex_t *index, uint32_t timeline, uint64_t from_lsn, uint64_t to_lsn,
+  uint64_t *first, uint64_t *count) {
+  uint64_t end;
+  WalArchiveStatus_t status = wal_index_bound(index, timeline, from_lsn - from_lsn % index->segment_size, false, first);
+
+  if (status == WAL_ARCHIVE_OK) status = wal_index_bound(index, timeline, to_lsn, true, &end);
+  *count = status == WAL_ARCHIVE_OK && end > *first ? end - *first : 0;
+
+  return status;
+}
+
+WalArchiveStatus_t wal_index_find_time(const WalIndex_t *index, int64_t time, uint64_t *pos) {
+  uint64_t lo = 0, hi = index->count;
+  WalIndexEntry_t entry;
+
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+
+    if (wal_index_read(index, mid, &entry) != 0) return WAL_ARCHIVE_CORRUPT_ERROR;
+    if (entry.end_time < time) lo = mid + 1;
+    else hi = mid;
+  }
+  *pos = lo;
+
+  return WAL_ARCHIVE_OK;
+}
+
+WalArchiveError_t *create_wal_archive_error(WalArchiveStatus_t code, const char *message) {
+  WalArchiveError_t *err = malloc(sizeof(WalArchiveError_t));
+
+  if (!err) return NULL;
+  err->code = code;
+  snprintf(err->message, sizeof(err->message), "%s", message);
+
+  return err;
+}
+
+void destroy_wal_index(WalIndex_t **index) {
+  if (!index || !*index) return;
+
+  if ((*index)->fd >= 0) close((*index)->fd);
+  free(*index);
+  *index = NULL;
+}
+
+void destroy_wal_archive_error(WalArchiveError_t **err) {
+  if (!err || !*err) return;
+
+  free(*err);
+  *err = NULL;
+}
@@ -0,0 +1,212 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "include/archive.h"
+
+#define ARCHIVE_FOOTER_CRC_AT (16)
+
+
+void archive_put_le(unsigned char *dst, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) dst[i] = (unsigned char)(value >> (8 * i));
+}
+
+uint64_t archive_get_le(const unsigned char *src, int bytes) {
+  uint64_t value = 0;
+
+  for (int i = 0; i < bytes; i++) value |= (uint64_t)src[i] << (8 * i);
+
+  return value;
+}
+
+int archive_index_encode(ArchiveIndex_t *index, CodecId_t codec, unsigned char **out, size_t *out_len) {
+  size_t len = ARCHIVE_FOOTER_LEN, pos = 0;
+  unsigned char *buf, *footer;
+
+  pthread_mutex_lock(&index->lock);
+  for (uint32_t i = 0; i < index->object_count; i++) len += 6 + strlen(index->objects[i].name);
+  len += index->frame_count * ARCHIVE_FRAME_RECORD_LEN;
+  buf = malloc(len);
+  if (!buf) {
+    pthread_mutex_unlock(&index->lock);
+
+    return -1;
+  }
+
+  for (uint32_t i = 0; i < index->object_count; i++) {
+    size_t name_len = strlen(index->objects[i].name);
+
+    archive_put_le(buf + pos, index->objects[i].id, 4);
+    archive_put_le(buf + pos + 4, name_len, 2);
+    memcpy(buf + pos + 6, index->objects[i].name, name_len);
+    pos += 6 + name_len;
+  }
+  for (uint64_t i = 0; i < index->frame_count; i++) {
+    const ArchiveFrame_t *frame = &index->frames[i];
+
+    archive_put_le(buf + pos, frame->object_id, 4);
+    archive_put_le(buf + pos + 4, frame->flags, 4);
+    archive_put_le(buf + pos + 8, frame->offset, 8);
+    archive_put_le(buf + pos + 16, frame->stored_len, 4);
+    archive_put_le(buf + pos + 20, frame->raw_len, 4);
+    pos += ARCHIVE_FRAME_RECORD_LEN;
+  }
+
+  footer = buf + pos;
+  memset(footer, 0, ARCHIVE_FOOTER_LEN);
+  archive_put_le(footer, index->object_count, 4);
+  archive_put_le(footer + 4, index->frame_count, 8);
+  footer[12] = (unsigned char)codec;
+  pthread_mutex_unlock(&index->lock);
+  archive_put_le(footer + ARCHIVE_FOOTER_CRC_AT, crc32(0L, buf, (uInt)(pos + ARCHIVE_FOOTER_CRC_AT)), 4);
+  archive_put_le(footer + 20, len, 8);
+  memcpy(footer + 28, ARCHIVE_INDEX_MAGIC, strlen(ARCHIVE_INDEX_MAGIC));
+  footer[35] = ARCHIVE_INDEX_VERSION;
+  *out = buf;
+  *out_len = len;
+
+  return 0;
+}
+
+ArchiveIndex_t *archive_index_decode(const unsigned char *src, size_t len, CodecId_t *codec) {
+  const unsigned char *footer = src + len - ARCHIVE_FOOTER_LEN;
+  ArchiveIndex_t *index;
+  uint64_t objects, frames;
+  size_t pos = 0, frames_at;
+
+  if (len < ARCHIVE_FOOTER_LEN || memcmp(footer + 28, ARCHIVE_INDEX_MAGIC, strlen(ARCHIVE_INDEX_MAGIC)) != 0
+    || footer[35] != ARCHIVE_INDEX_VERSION || archive_get_le(footer + 20, 8) != len
+    || archive_get_le(footer + ARCHIVE_FOOTER_CRC_AT, 4)
+      != crc32(0L, src, (uInt)(len - ARCHIVE_FOOTER_LEN + ARCHIVE_FOOTER_CRC_AT))) {
+    return NULL;
+  }
+  objects = archive_get_le(footer, 4);
+  frames = archive_get_le(footer + 4, 8);
+  if (frames > (len - ARCHIVE_FOOTER_LEN) / ARCHIVE_FRAME_RECORD_LEN) return NULL;
+  frames_at = len - ARCHIVE_FOOTER_LEN - frames * ARCHIVE_FRAME_RECORD_LEN;
+  *codec = (CodecId_t)footer[12];
+
+  index = init_archive_index();
+  if (!index) return NULL;
+  for (uint64_t i = 0; i < objects; i++) {
+    size_t name_len = pos + 6 <= frames_at ? (size_t)archive_get_le(src + pos + 4, 2) : BUF_LEN_S;
+    char name[BUF_LEN_S];
+
+    if (name_len >= BUF_LEN_S || pos + 6 + name_len > frames_at) {
+      destroy_archive_index(&index);
+
+      return NULL;
+    }
+    memcpy(name, src + pos + 6, name_len);
+    name[name_len] = '\0';
+    if (archive_index_name_object(index, (uint32_t)archive_get_le(src + pos, 4), name) != 0) {
+      destroy_archive_index(&index);
+
+      return NULL;
+    }
+    pos += 6 + name_len;
+  }
+  // the objects have to end exactly where the frames start
+  if (pos != frames_at) {
+    destroy_archive_index(&index);
+
+    return NULL;
+  }
+
+  for (uint64_t i = 0; i < frames; i++, pos += ARCHIVE_FRAME_RECORD_LEN) {
+    ArchiveFrame_t frame = {
+      (uint32_t)archive_get_le(src + pos, 4), (uint32_t)archive_get_le(src + pos + 4, 4),
+      archive_get_le(src + pos + 8, 8), (uint32_t)archive_get_le(src + pos + 16, 4),
+      (uint32_t)archive_get_le(src + pos + 20, 4)
+    };
+
+    if (archive_index_add_frame(index, &frame) != 0) {
+      destroy_archive_index(&index);
+
+      return NULL;
+    }
+  }
+
+  return index;
+}
+
+int archive_index_wrap(CodecId_t codec, const unsigned char *index, size_t len, unsigned char **out, size_t *out_len) {
+  size_t pieces = (len + ARCHIVE_GZIP_PIECE_LEN - 1) / ARCHIVE_GZIP_PIECE_LEN, pos = 0;
+  unsigned char *buf;
+
+  if (codec == CODEC_GZIP) {
+    *out_len = len + pieces * ARCHIVE_GZIP_MEMBER_OVERHEAD;
+  } else if (codec == CODEC_ZSTD || codec == CODEC_LZ4) {
+    *out_len = len + ARCHIVE_SKIPPABLE_HEADER_LEN;
+  } else {
+    *out_len = len;
+  }
+  buf = malloc(*out_len);
+  if (!buf) return -1;
+
+  if (codec == CODEC_GZIP) {
+    // empty members: gzip and zcat skip them, their FEXTRA fields carry the index
+    for (size_t off = 0; off < len; off += ARCHIVE_GZIP_PIECE_LEN) {
+      size_t n = len - off < ARCHIVE_GZIP_PIECE_LEN ? len - off : ARCHIVE_GZIP_PIECE_LEN;
+      static const unsigned char header[10] = { 0x1f, 0x8b, 0x08, 0x04, 0, 0, 0, 0, 0, 0xff };
+
+      memcpy(buf + pos, header, sizeof(header));
+      archive_put_le(buf + pos + 10, n + 4, 2);
+      buf[pos + 12] = 'D';
+      buf[pos + 13] = 'B';
+      archive_put_le(buf + pos + 14, n, 2);
+      memcpy(buf + pos + 16, index + off, n);
+      pos += 16 + n;
+      // an empty final block, then crc32 and isize of nothing
+      memset(buf + pos, 0, ARCHIVE_GZIP_TRAILER_LEN);
+      buf[pos] = 0x03;
+      pos += ARCHIVE_GZIP_TRAILER_LEN;
+    }
+  } else {
+    if (codec == CODEC_ZSTD || codec == CODEC_LZ4) {
+      archive_put_le(buf, ARCHIVE_SKIPPABLE_MAGIC, 4);
+      archive_put_le(buf + 4, len, 4);
+      pos = ARCHIVE_SKIPPABLE_HEADER_LEN;
+    }
+    memcpy(buf + pos, index, len);
+  }
+  *out = buf;
+
+  return 0;
+}
+
+/**
+ * archive_index_unwrap - recovers the encoded index from the bytes that
+ * end a plain archive
+ * @tail: the last @tail_len bytes of the archive
+ * @tail_len: their length, at least the wrapped index
+ * @index_len: length of the encoded index, from its footer
+ * @gzip: true when the index was cut into gzip members
+ * @out: written encoded index, @index_len bytes
+ *
+ * Return: 0 on success, -1 if the wrapping is damaged
+ **/
+int archive_index_unwrap(const unsigned char *tail, size_t tail_len, size_t index_len, bool gzip, unsigned char *out) {
+  size_t pieces = (index_len + ARCHIVE_GZIP_PIECE_LEN - 1) / ARCHIVE_GZIP_PIECE_LEN;
+  const unsigned char *src;
+
+  if (!gzip) {
+    if (tail_len < index_len) return -1;
+    memcpy(out, tail + tail_len - index_len, index_len);
+
+    return 0;
+  }
+
+  if (tail_len < index_len + pieces * ARCHIVE_GZIP_MEMBER_OVERHEAD) return -1;
+  src = tail + tail_len - index_len - pieces * ARCHIVE_GZIP_MEMBER_OVERHEAD;
+  for (size_t off = 0; off < index_len; off += ARCHIVE_GZIP_PIECE_LEN) {
+    size_t n = index_len - off < ARCHIVE_GZIP_PIECE_LEN ? index_len - off : ARCHIVE_GZIP_PIECE_LEN;
+
+    if (src[0] != 0x1f || src[1] != 0x8b || src[3] != 0x04 || archive_get_le(src + 10, 2) != n + 4
+      || src[12] != 'D' || src[13] != 'B' || archive_get_le(src + 14, 2) != n) return -1;
+    memcpy(out + off, src + 16, n);
+    src += n + ARCHIVE_GZIP_MEMBER_OVERHEAD;
+  }
+
+  return 0;
+}
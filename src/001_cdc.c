@@ -0,0 +1,372 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/cdc.h"
+#include "include/driver.h"
+#include "include/pgwire.h"
+#include "include/pipeline.h"
+#include "include/storage.h"
+#include "include/walarchive.h"
+
+
+/* a connection to `db.uri`; with @replication a replication=database one, which also runs slot commands */
+PgConn_t *cdc_connect(const AppConfig_t *cfg, bool replication, char *message, size_t len) {
+  PgError_t *pg_err = NULL;
+  PgConn_t *conn;
+  char uri[BUF_LEN];
+
+  if (!replication) snprintf(uri, sizeof(uri), "%s", cfg->db->uri);
+  else snprintf(uri, sizeof(uri), "%s%creplication=database", cfg->db->uri, strchr(cfg->db->uri, '?') ? '&' : '?');
+  conn = pg_connect(uri, cfg->db->timeout_seconds, &pg_err);
+  if (!conn) snprintf(message, len, "Cannot connect to the database: %s", pg_err ? pg_err->message : "?");
+  destroy_pg_error(&pg_err);
+
+  return conn;
+}
+
+/* runs replication command @command on slot @slot, "<command> "slot"<tail>" */
+PgStatus_t cdc_slot_command(PgConn_t *conn, const char *command, const char *slot, const char *tail, PgResult_t **res) {
+  char sql[BUF_LEN_S];
+
+  snprintf(sql, sizeof(sql), "%s ", command);
+  if (pg_quote(sql, sizeof(sql), slot, '"') != 0 || strlen(sql) + strlen(tail) >= sizeof(sql)) return PG_CONFIG_ERROR;
+  strcat(sql, tail);
+
+  return res ? pg_query(conn, sql, res) : pg_exec(conn, sql);
+}
+
+/* a new slot and a full backup of the snapshot it starts decoding after; @retired is the slot of the chain replaced */
+CdcStatus_t cdc_full(AppConfig_t *cfg, const char *name, const char *retired, CdcStats_t *stats, char *message,
+  size_t len) {
+  PgConn_t *conn = cdc_connect(cfg, true, message, len);
+  PgResult_t *res = NULL;
+  DriverError_t *driver_err = NULL;
+  CdcHead_t head = { .seq = 0 };
+  CdcStatus_t status = CDC_OK;
+  const char *snapshot;
+  char tail[BUF_LEN_XS];
+
+  if (!conn) return CDC_CONNECT_ERROR;
+  // a slot left by a chain that was given up would decode from where that chain stopped
+  cdc_slot_command(conn, "DROP_REPLICATION_SLOT", cfg->db->cdc_slot, "", NULL);
+  snprintf(tail, sizeof(tail), " LOGICAL %s EXPORT_SNAPSHOT", CDC_OUTPUT_PLUGIN);
+  if (cdc_slot_command(conn, "CREATE_REPLICATION_SLOT", cfg->db->cdc_slot, tail, &res) != PG_OK || !res
+    || res->rows != 1 || !pg_result_value(res, 0, 1) || !(snapshot = pg_result_value(res, 0, 2))
+    || wal_parse_lsn(pg_result_value(res, 0, 1), &head.lsn) != 0) {
+    snprintf(message, len, "Cannot create replication slot %s: %s", cfg->db->cdc_slot,
+      conn->message[0] ? conn->message : "no consistent point");
+    destroy_pg_result(&res);
+    destroy_pg_conn(&conn);
+
+    return CDC_QUERY_ERROR;
+  }
+
+  // the snapshot lives as long as @conn stays idle, that is until the dump is done
+  snprintf(cfg->db->snapshot, sizeof(cfg->db->snapshot), "%s", snapshot);
+  destroy_pg_result(&res);
+  if (driver_run_backup(cfg, name, &driver_err) != DRIVER_OK) {
+    snprintf(message, len, "%s", driver_err ? driver_err->message : "The full backup failed");
+    status = CDC_DUMP_ERROR;
+  }
+  cfg->db->snapshot[0] = '\0';
+  destroy_driver_error(&driver_err);
+
+  snprintf(head.slot, sizeof(head.slot), "%s", cfg->db->cdc_slot);
+  snprintf(head.full, sizeof(head.full), "%s", name);
+  if (status == CDC_OK && cdc_write_head(cfg->storage->output_path, &head) != 0) {
+    snprintf(message, len, "Cannot update %s: %s", CDC_HEAD_FILE, strerror(errno));
+    status = CDC_STORAGE_ERROR;
+  }
+  // without a head nothing would ever consume the slot, and the server would keep its WAL
+  if (status != CDC_OK) cdc_slot_command(conn, "DROP_REPLICATION_SLOT", cfg->db->cdc_slot, "", NULL);
+  else if (retired) cdc_slot_command(conn, "DROP_REPLICATION_SLOT", retired, "", NULL);
+  destroy_pg_conn(&conn);
+  if (status == CDC_OK && stats) {
+    stats->full = true;
+    stats->from_lsn = stats->to_lsn = head.lsn;
+  }
+
+  return status;
+}
+
+/* moves slot @slot to @lsn; 0 on success */
+int cdc_advance(PgConn_t *conn, const char *slot, uint64_t lsn) {
+  char sql[BUF_LEN_S] = "SELECT pg_catalog.pg_replication_slot_advance(", text[CDC_LSN_LEN];
+
+  cdc_format_lsn(lsn, text);
+  if (pg_quote(sql, sizeof(sql), slot, '\'') != 0 || strlen(sql) + strlen(text) + 6 >= sizeof(sql)) return -1;
+  strcat(sql, ", '");
+  strcat(sql, text);
+  strcat(sql, "')");
+
+  return pg_exec(conn, sql) == PG_OK ? 0 : -1;
+}
+
+/* the peeked rows on their way into CDC_CHANGES_OBJECT as statements */
+typedef struct CdcCapture {
+  PipeWriter_t      writer;
+  const CdcKey_t    *keys;
+  CdcText_t         row;            // COPY text of the row being read
+  CdcText_t         sql;
+  char              message[BUF_LEN_M];
+} CdcCapture_t;
+
+/* undoes the COPY text escapes of @text in place */
+void cdc_unescape(char *text) {
+  static const char from[] = "btnvfr", to[] = "\b\t\n\v\f\r";
+  char *out = text;
+  const char *hit;
+
+  for (; *text; text++) {
+    if (*text != '\\' || !text[1]) {
+      *out++ = *text;
+    } else if ((hit = strchr(from, text[1]))) {
+      *out++ = to[hit - from];
+      text++;
+    } else if (text[1] >= '0' && text[1] <= '7') {
+      int value = 0;
+
+      for (int digits = 0; digits < 3 && text[1] >= '0' && text[1] <= '7'; digits++) value = value * 8 + *++text - '0';
+      *out++ = (char)value;
+    } else if (text[1] == 'x' && isxdigit((unsigned char)text[2])) {
+      int value = 0;
+
+      text++;
+      for (int digits = 0; digits < 2 && isxdigit((unsigned char)text[1]); digits++) {
+        char c = (char)tolower((unsigned char)*++text);
+
+        value = value * 16 + (isdigit((unsigned char)c) ? c - '0' : c - 'a' + 10);
+      }
+      *out++ = (char)value;
+    } else {
+      *out++ = *++text;
+    }
+  }
+  *out = '\0';
+}
+
+/* "<lsn>\t<xid>\t<data>": the statement replaying data */
+int cdc_capture_row(CdcCapture_t *capture) {
+  char *data = capture->row.data, *tab = strchr(data, '\t');
+
+  if (!tab || !(tab = strchr(tab + 1, '\t'))) {
+    snprintf(capture->message, sizeof(capture->message), "Malformed change row \"%.200s\"", data);
+
+    return -1;
+  }
+  cdc_unescape(++tab);
+  capture->sql.len = 0;
+  if (cdc_change_sql(capture->keys, tab, &capture->sql, capture->message, sizeof(capture->message)) != 0) return -1;
+  if (capture->sql.len && pipe_writer_write(&capture->writer, capture->sql.data, capture->sql.len) != PIPELINE_OK) {
+    snprintf(capture->message, sizeof(capture->message), "Cannot write %s", CDC_CHANGES_OBJECT);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/* PgCopyFn_t: rows may come cut anywhere */
+int cdc_emit(void *ctx, const unsigned char *data, size_t len) {
+  CdcCapture_t *capture = ctx;
+  const unsigned char *end = data + len;
+
+  while (data < end) {
+    const unsigned char *nl = memchr(data, '\n', (size_t)(end - data));
+
+    if (cdc_text_put(&capture->row, (const char *)data, (size_t)((nl ? nl : end) - data)) != 0) return -1;
+    if (!nl) break;
+    if (cdc_capture_row(capture) != 0) return -1;
+    capture->row.len = 0;
+    data = nl + 1;
+  }
+
+  return 0;
+}
+
+/* writes @len bytes of @data as object @id named @name */
+int cdc_put_object(Pipeline_t *pipe, StorageSink_t *sink, uint32_t id, const char *name, const void *data,
+  size_t len) {
+  PipeWriter_t writer;
+
+  init_pipe_writer(&writer, pipe, id);
+  if (pipe_writer_write(&writer, data, len) != PIPELINE_OK) {
+    pipe_writer_close(&writer);
+
+    return -1;
+  }
+
+  return pipe_writer_close(&writer) == PIPELINE_OK && storage_sink_name_object(sink, id, name) == 0 ? 0 : -1;
+}
+
+/* peeks the changes committed after the head up to @upto into archive @name, as statements */
+CdcStatus_t cdc_capture(AppConfig_t *cfg, PgConn_t *conn, const char *name, const CdcHead_t *head, uint64_t upto,
+  const CdcKey_t *keys, uint64_t *bytes, char *message, size_t len) {
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  StorageSink_t *sink = init_storage_sink(cfg->storage, name, &storage_err);
+  Pipeline_t *pipe = sink ? init_storage_pipeline(cfg, sink, &pipe_err) : NULL;
+  CdcCapture_t capture = { .keys = keys };
+  CdcStatus_t status = CDC_OK;
+  char sql[BUF_LEN] = "COPY (SELECT lsn, xid, data FROM pg_catalog.pg_logical_slot_peek_changes(";
+  char meta[BUF_LEN], from[CDC_LSN_LEN], to[CDC_LSN_LEN];
+  uint32_t id = 1;
+  int meta_len;
+
+  if (!pipe) {
+    snprintf(message, len, "Cannot open %s: %s", name,
+      storage_err ? storage_err->message : pipe_err ? pipe_err->message : "out of memory");
+    destroy_storage_error(&storage_err);
+    destroy_pipeline_error(&pipe_err);
+    destroy_storage_sink(&sink);
+
+    return CDC_STORAGE_ERROR;
+  }
+  cdc_format_lsn(head->lsn, from);
+  cdc_format_lsn(upto, to);
+  meta_len = snprintf(meta, sizeof(meta), "slot=%s full=%s from=%s to=%s seq=%" PRIu64 "\n", head->slot, head->full,
+    from, to, head->seq + 1);
+  pg_quote(sql, sizeof(sql), head->slot, '\'');
+  snprintf(sql + strlen(sql), sizeof(sql) - strlen(sql), ", '%s', NULL)) TO STDOUT", to);
+
+  // a dedup archive is a single stream, which the change lines alone make up
+  if (!cfg->storage->dedup_enabled && cdc_put_object(pipe, sink, id++, CDC_META_OBJECT, meta, (size_t)meta_len) != 0) {
+    snprintf(message, len, "Cannot write %s to %s", CDC_META_OBJECT, name);
+    status = CDC_STORAGE_ERROR;
+  } else {
+    init_pipe_writer(&capture.writer, pipe, id);
+    if (pg_copy_out(conn, sql, cdc_emit, &capture, bytes) != PG_OK
+      || (capture.row.len && cdc_capture_row(&capture) != 0)) {
+      snprintf(message, len, "Cannot read the changes of slot %s: %s", head->slot,
+        capture.message[0] ? capture.message : conn->message);
+      status = CDC_QUERY_ERROR;
+    }
+    if ((pipe_writer_close(&capture.writer) != PIPELINE_OK
+      || storage_sink_name_object(sink, id, CDC_CHANGES_OBJECT) != 0) && status == CDC_OK) {
+      snprintf(message, len, "Cannot write %s to %s", CDC_CHANGES_OBJECT, name);
+      status = CDC_STORAGE_ERROR;
+    }
+  }
+
+  // the pipeline is drained even after a failure, its workers hold the blocks
+  if (pipeline_finish(pipe, &pipe_err) != PIPELINE_OK && status == CDC_OK) {
+    snprintf(message, len, "Cannot write %s: %s", name, pipe_err ? pipe_err->message : "?");
+    status = CDC_STORAGE_ERROR;
+  }
+  if (status == CDC_OK && storage_sink_commit(sink, &storage_err) != STORAGE_OK) {
+    snprintf(message, len, "Cannot commit %s: %s", name, storage_err ? storage_err->message : "?");
+    status = CDC_STORAGE_ERROR;
+  }
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+  destroy_pipeline_error(&pipe_err);
+  destroy_storage_error(&storage_err);
+  free(capture.row.data);
+  free(capture.sql.data);
+
+  return status;
+}
+
+/* the changes since @head as the next batch of its chain */
+CdcStatus_t cdc_batch(AppConfig_t *cfg, const char *name, CdcHead_t *head, CdcStats_t *stats, char *message,
+  size_t len) {
+  PgConn_t *conn = cdc_connect(cfg, false, message, len);
+  PgResult_t *res = NULL;
+  CdcKey_t *keys = NULL;
+  CdcStatus_t status;
+  uint64_t upto = 0, bytes = 0;
+
+  if (!conn) return CDC_CONNECT_ERROR;
+  // catches up an advance lost after the last batch, so its changes are not peeked again
+  if (cdc_advance(conn, head->slot, head->lsn) != 0) {
+    snprintf(message, len, "Cannot move replication slot %s to the head: %s", head->slot, conn->message);
+    destroy_pg_conn(&conn);
+
+    return CDC_QUERY_ERROR;
+  }
+  if (pg_query(conn, "SELECT pg_catalog.pg_current_wal_lsn()", &res) != PG_OK || !res || res->rows != 1
+    || !pg_result_value(res, 0, 0) || wal_parse_lsn(pg_result_value(res, 0, 0), &upto) != 0) {
+    snprintf(message, len, "Cannot read the WAL position: %s", conn->message[0] ? conn->message : "no row");
+    destroy_pg_result(&res);
+    destroy_pg_conn(&conn);
+
+    return CDC_QUERY_ERROR;
+  }
+  destroy_pg_result(&res);
+  if (upto < head->lsn) upto = head->lsn;
+  // UPDATEs name the row they change by these
+  if (cdc_load_keys(conn, &keys) != 0) {
+    snprintf(message, len, "Cannot read the replica identities: %s", conn->message);
+    destroy_cdc_keys(&keys);
+    destroy_pg_conn(&conn);
+
+    return CDC_QUERY_ERROR;
+  }
+
+  status = cdc_capture(cfg, conn, name, head, upto, keys, &bytes, message, len);
+  destroy_cdc_keys(&keys);
+  if (status == CDC_OK && stats) {
+    stats->from_lsn = head->lsn;
+    stats->to_lsn = upto;
+    stats->bytes = bytes;
+    stats->seq = head->seq + 1;
+  }
+  if (status == CDC_OK) {
+    head->lsn = upto;
+    head->seq++;
+    if (cdc_write_head(cfg->storage->output_path, head) != 0) {
+      snprintf(message, len, "%s is stored but %s cannot be updated: %s", name, CDC_HEAD_FILE, strerror(errno));
+      status = CDC_STORAGE_ERROR;
+    }
+  }
+  // only now may the server recycle the WAL of the changes stored
+  if (status == CDC_OK && cdc_advance(conn, head->slot, upto) != 0) {
+    snprintf(message, len, "%s is stored but replication slot %s was not advanced: %s", name, head->slot,
+      conn->message);
+    status = CDC_QUERY_ERROR;
+  }
+  destroy_pg_conn(&conn);
+
+  return status;
+}
+
+CdcStatus_t cdc_backup(AppConfig_t *cfg, const char *name, CdcStats_t *stats, CdcError_t **err) {
+  CdcHead_t head;
+  CdcStatus_t status;
+  char message[BUF_LEN_M];
+  int found;
+
+  if (stats) memset(stats, 0, sizeof(CdcStats_t));
+  if (!cdc_selected(cfg->db)) {
+    if (err) *err = create_cdc_error(CDC_CONFIG_ERROR, "The logical strategy needs a PostgreSQL db.uri "
+      "and db.incremental_enabled");
+
+    return CDC_CONFIG_ERROR;
+  }
+  if (storage_to_stdout(cfg->storage)) {
+    if (err) *err = create_cdc_error(CDC_CONFIG_ERROR, "The logical strategy keeps its chain in a directory, "
+      "storage.output_path cannot be -");
+
+    return CDC_CONFIG_ERROR;
+  }
+  found = cdc_read_head(cfg->storage->output_path, &head);
+  if (found < 0) {
+    snprintf(message, sizeof(message), "%s/%s is damaged", cfg->storage->output_path, CDC_HEAD_FILE);
+    if (err) *err = create_cdc_error(CDC_CORRUPT_ERROR, message);
+
+    return CDC_CORRUPT_ERROR;
+  }
+  // a chain belongs to one slot; another slot starts a new chain
+  if (found == 0 && strcmp(head.slot, cfg->db->cdc_slot) == 0) {
+    status = cdc_batch(cfg, name, &head, stats, message, sizeof(message));
+  } else {
+    status = cdc_full(cfg, name, found == 0 ? head.slot : NULL, stats, message, sizeof(message));
+  }
+  if (status != CDC_OK && err) *err = create_cdc_error(status, message);
+
+  return status;
+}
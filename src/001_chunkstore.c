@@ -0,0 +1,171 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include "include/chunkstore.h"
+
+extern uint64_t chunk_gear[256];
+
+
+size_t chunker_scan(Chunker_t *ch, const unsigned char *data, size_t len, bool *cut) {
+  size_t i = 0;
+
+  *cut = false;
+  // no cut point is allowed before CHUNK_MIN_SIZE, so those bytes are not even hashed
+  if (ch->pos < CHUNK_MIN_SIZE) {
+    i = CHUNK_MIN_SIZE - ch->pos < len ? CHUNK_MIN_SIZE - ch->pos : len;
+    ch->pos += i;
+  }
+  for (; i < len; i++) {
+    ch->hash = (ch->hash << 1) + chunk_gear[data[i]];
+    ch->pos++;
+    if (!(ch->hash & (ch->pos < CHUNK_AVG_SIZE ? ch->mask_s : ch->mask_l)) || ch->pos >= CHUNK_MAX_SIZE) {
+      *cut = true;
+      ch->hash = 0;
+      ch->pos = 0;
+
+      return i + 1;
+    }
+  }
+
+  return len;
+}
+
+void chunk_store_remember(ChunkStore_t *store, const unsigned char id[CHUNK_ID_LEN]) {
+  ChunkSeen_t *seen = malloc(sizeof(ChunkSeen_t));
+
+  // only a cache: a chunk missing from it is stat()ed again
+  if (!seen) return;
+  memcpy(seen->id, id, CHUNK_ID_LEN);
+  HASH_ADD(hh, store->seen, id, CHUNK_ID_LEN, seen);
+}
+
+/* builds the chunk file for @data in store->scratch; returns its length */
+size_t chunk_store_encode(ChunkStore_t *store, const unsigned char *data, size_t len) {
+  unsigned char *out = store->scratch;
+  size_t payload = 0;
+  CodecId_t codec = CODEC_NONE;
+
+  // same rules as the compress stage: skip noise, and keep only real gains
+  if (store->codec && !(len >= CODEC_ENTROPY_SAMPLE && codec_sample_entropy(data, len) >= CODEC_RAW_ENTROPY_BITS)
+    && store->codec->compress(store->codec_state, data, len, out + CHUNKSTORE_HEADER_LEN,
+      store->scratch_len - CHUNKSTORE_HEADER_LEN, &payload) == 0
+    && payload * 100 < len * (100 - CODEC_MIN_GAIN_PERCENT)) {
+    codec = store->codec->id;
+  } else {
+    memcpy(out + CHUNKSTORE_HEADER_LEN, data, len);
+    payload = len;
+  }
+
+  memset(out, 0, CHUNKSTORE_HEADER_LEN);
+  memcpy(out, CHUNKSTORE_MAGIC, strlen(CHUNKSTORE_MAGIC));
+  out[7] = CHUNKSTORE_FORMAT_VERSION;
+  out[8] = (unsigned char)codec;
+  for (int i = 0; i < 4; i++) out[12 + i] = (unsigned char)(len >> (8 * i));
+
+  return CHUNKSTORE_HEADER_LEN + payload;
+}
+
+int chunk_store_write_file(int dir_fd, const char *name, const unsigned char *data, size_t len) {
+  int fd = openat(dir_fd, name, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0640);
+  int status = fd < 0 ? -1 : 0;
+
+  while (status == 0 && len > 0) {
+    ssize_t n = write(fd, data, len);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) status = -1;
+    else data += n, len -= (size_t)n;
+  }
+  if (fd >= 0 && close(fd) != 0) status = -1;
+
+  return status;
+}
+
+int chunk_store_put(ChunkStore_t *store, const unsigned char *data, size_t len, unsigned char id[CHUNK_ID_LEN]) {
+  char hex[2 * CHUNK_ID_LEN + 1], name[BUF_LEN_S], tmp[BUF_LEN_S];
+  ChunkSeen_t *seen = NULL;
+  struct stat st;
+  size_t encoded;
+
+  if (len > CHUNK_MAX_SIZE || EVP_Digest(data, len, id, NULL, EVP_sha256(), NULL) != 1) return -1;
+  store->chunks++;
+  store->bytes_in += len;
+
+  HASH_FIND(hh, store->seen, id, CHUNK_ID_LEN, seen);
+  if (seen) return 0;
+  chunk_id_hex(id, hex);
+  snprintf(name, sizeof(name), "%.2s/%s", hex, hex + 2);
+  if (fstatat(store->dir_fd, name, &st, 0) == 0) {
+    chunk_store_remember(store, id);
+
+    return 0;
+  }
+
+  encoded = chunk_store_encode(store, data, len);
+  snprintf(tmp, sizeof(tmp), "%.2s", hex);
+  if (mkdirat(store->dir_fd, tmp, 0750) != 0 && errno != EEXIST) return -1;
+  // a concurrent backup may be storing the same chunk; the temporary name is ours alone
+  snprintf(tmp, sizeof(tmp), "%.2s/.%s.%ld.%lu", hex, hex + 2, (long)getpid(), (unsigned long)store->tmp_seq++);
+  if (chunk_store_write_file(store->dir_fd, tmp, store->scratch, encoded) != 0
+    || renameat(store->dir_fd, tmp, store->dir_fd, name) != 0) {
+    unlinkat(store->dir_fd, tmp, 0);
+
+    return -1;
+  }
+  chunk_store_remember(store, id);
+  store->new_chunks++;
+  store->bytes_new += len;
+  store->bytes_stored += encoded;
+
+  return 1;
+}
+
+ssize_t chunk_store_get(ChunkStore_t *store, const unsigned char id[CHUNK_ID_LEN], unsigned char *dst, size_t cap) {
+  char hex[2 * CHUNK_ID_LEN + 1], name[BUF_LEN_S];
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  const unsigned char *in = store->scratch;
+  const Codec_t *codec;
+  size_t have = 0, raw_len = 0, out_len = 0;
+  int fd;
+
+  chunk_id_hex(id, hex);
+  snprintf(name, sizeof(name), "%.2s/%s", hex, hex + 2);
+  fd = openat(store->dir_fd, name, O_RDONLY | O_CLOEXEC);
+  if (fd < 0) return -1;
+  for (;;) {
+    ssize_t n = read(fd, store->scratch + have, store->scratch_len - have);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0 || (have += (size_t)n) == store->scratch_len) break;
+  }
+  close(fd);
+
+  if (have < CHUNKSTORE_HEADER_LEN || memcmp(in, CHUNKSTORE_MAGIC, strlen(CHUNKSTORE_MAGIC)) != 0
+    || in[7] != CHUNKSTORE_FORMAT_VERSION) return -1;
+  for (int i = 0; i < 4; i++) raw_len |= (size_t)in[12 + i] << (8 * i);
+  if (raw_len > cap || raw_len > CHUNK_MAX_SIZE) return -1;
+
+  if (in[8] == CODEC_NONE) {
+    if (have - CHUNKSTORE_HEADER_LEN != raw_len) return -1;
+    memcpy(dst, in + CHUNKSTORE_HEADER_LEN, raw_len);
+    out_len = raw_len;
+  } else if (!(codec = codec_lookup((CodecId_t)in[8]))
+    || codec->decompress(in + CHUNKSTORE_HEADER_LEN, have - CHUNKSTORE_HEADER_LEN, dst, cap, &out_len) != 0) {
+    return -1;
+  }
+  if (out_len != raw_len || EVP_Digest(dst, out_len, digest, NULL, EVP_sha256(), NULL) != 1
+    || memcmp(digest, id, CHUNK_ID_LEN) != 0) return -1;
+
+  return (ssize_t)out_len;
+}
+
+int chunk_store_sync(ChunkStore_t *store) {
+  // one syncfs instead of an fsync per chunk and per fan-out directory
+  return syncfs(store->dir_fd);
+}
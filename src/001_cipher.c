@@ -0,0 +1,116 @@
+#include <string.h>
+#include "include/cipher.h"
+
+
+void cipher_put_le(unsigned char *dst, uint64_t v, size_t bytes) {
+  for (size_t i = 0; i < bytes; i++) dst[i] = (unsigned char)(v >> (8 * i));
+}
+
+uint64_t cipher_get_le(const unsigned char *src, size_t bytes) {
+  uint64_t v = 0;
+
+  for (size_t i = 0; i < bytes; i++) v |= (uint64_t)src[i] << (8 * i);
+
+  return v;
+}
+
+void cipher_put_chunk_header(unsigned char *dst, const CipherChunk_t *chunk) {
+  cipher_put_le(dst, chunk->seq, 8);
+  cipher_put_le(dst + 8, chunk->flags, 4);
+  cipher_put_le(dst + 12, chunk->len, 4);
+  cipher_put_le(dst + 16, chunk->raw_len, 4);
+}
+
+int cipher_seal_chunk(CipherStage_t *stage, size_t slot, const CipherChunk_t *chunk,
+  const unsigned char *src, unsigned char *dst, size_t cap, size_t *out_len) {
+  EVP_CIPHER_CTX *ctx = stage->worker_ctx[slot];
+  unsigned char *body = dst + CIPHER_CHUNK_HEADER_LEN;
+  int n = 0, final = 0;
+
+  if (cap < (size_t)chunk->len + CIPHER_CHUNK_OVERHEAD) return -1;
+  cipher_put_chunk_header(dst, chunk);
+  // the data key never outlives this archive, and seq never repeats within it
+  memset(dst + 20, 0, CIPHER_NONCE_LEN);
+  cipher_put_le(dst + 20, chunk->seq, 8);
+
+  if (EVP_EncryptInit_ex(ctx, NULL, NULL, NULL, dst + 20) != 1
+    || EVP_EncryptUpdate(ctx, NULL, &n, stage->file_header, CIPHER_FILE_PREFIX_LEN) != 1
+    || EVP_EncryptUpdate(ctx, NULL, &n, dst, CIPHER_CHUNK_HEADER_LEN) != 1
+    || (chunk->len && EVP_EncryptUpdate(ctx, body, &n, src, (int)chunk->len) != 1)
+    || EVP_EncryptFinal_ex(ctx, body + n, &final) != 1
+    || EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, CIPHER_TAG_LEN, body + chunk->len) != 1) return -1;
+  *out_len = (size_t)chunk->len + CIPHER_CHUNK_OVERHEAD;
+
+  return 0;
+}
+
+int cipher_parse_file_header(const unsigned char *src, size_t len, CipherId_t *id, CodecId_t *codec) {
+  if (len < CIPHER_FILE_HEADER_LEN || memcmp(src, CIPHER_MAGIC, strlen(CIPHER_MAGIC)) != 0) return -1;
+  if (src[7] != CIPHER_FORMAT_VERSION) return -1;
+  if (src[8] != CIPHER_AES_256_GCM && src[8] != CIPHER_CHACHA20_POLY1305) return -1;
+  if (src[9] > CODEC_LZ4) return -1;
+  *id = (CipherId_t)src[8];
+  *codec = (CodecId_t)src[9];
+
+  return 0;
+}
+
+int cipher_open_chunk(const unsigned char key[CIPHER_KEY_LEN], const unsigned char *file_header,
+  const unsigned char *src, size_t len, unsigned char *dst, size_t cap,
+  CipherChunk_t *chunk, size_t *consumed) {
+  CipherId_t id;
+  CodecId_t codec;
+  EVP_CIPHER_CTX *ctx;
+  const unsigned char *body = src + CIPHER_CHUNK_HEADER_LEN;
+  int n = 0, final = 0, ok;
+
+  if (cipher_parse_file_header(file_header, CIPHER_FILE_HEADER_LEN, &id, &codec) != 0) return -1;
+  if (len < CIPHER_CHUNK_OVERHEAD) return -1;
+  chunk->seq = cipher_get_le(src, 8);
+  chunk->flags = (uint32_t)cipher_get_le(src + 8, 4);
+  chunk->len = (uint32_t)cipher_get_le(src + 12, 4);
+  chunk->raw_len = (uint32_t)cipher_get_le(src + 16, 4);
+  if (len - CIPHER_CHUNK_OVERHEAD < chunk->len || cap < chunk->len) return -1;
+
+  ctx = EVP_CIPHER_CTX_new();
+  if (!ctx) return -1;
+  ok = EVP_DecryptInit_ex(ctx, cipher_evp(id), NULL, key, src + 20) == 1
+    && EVP_DecryptUpdate(ctx, NULL, &n, file_header, CIPHER_FILE_PREFIX_LEN) == 1
+    && EVP_DecryptUpdate(ctx, NULL, &n, src, CIPHER_CHUNK_HEADER_LEN) == 1
+    && (!chunk->len || EVP_DecryptUpdate(ctx, dst, &n, body, (int)chunk->len) == 1)
+    && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, CIPHER_TAG_LEN, (void *)(body + chunk->len)) == 1
+    && EVP_DecryptFinal_ex(ctx, dst + n, &final) == 1;
+  EVP_CIPHER_CTX_free(ctx);
+  if (!ok) {
+    // never hand out plaintext that failed authentication
+    memset(dst, 0, chunk->len);
+
+    return -1;
+  }
+  *consumed = (size_t)chunk->len + CIPHER_CHUNK_OVERHEAD;
+
+  return 0;
+}
+
+/**
+ * cipher_stage_process - pipeline stage sealing one block with the
+ * calling worker's cipher context
+ * @ctx: the CipherStage_t
+ * @buf: the block, swapped to its sealed chunk on success
+ * @worker_id: index of the stage worker
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int cipher_stage_process(void *ctx, PipeBuffer_t *buf, size_t worker_id) {
+  CipherStage_t *stage = ctx;
+  CipherChunk_t chunk = { buf->seq, buf->flags, (uint32_t)buf->len, (uint32_t)buf->raw_len };
+  unsigned char *tmp;
+  size_t out_len = 0;
+
+  if (cipher_seal_chunk(stage, worker_id, &chunk, buf->data, buf->scratch, buf->capacity, &out_len) != 0) return -1;
+
+  tmp = buf->data, buf->data = buf->scratch, buf->scratch = tmp;
+  buf->len = out_len;
+
+  return 0;
+}
@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <linux/fs.h>
+#include "include/clone.h"
+
+
+/* the file systems will never take this method, as opposed to refusing one range */
+bool clone_refused(int error) {
+  return error == EOPNOTSUPP || error == EXDEV || error == ENOTTY || error == ENOSYS;
+}
+
+/* last resort: copies the range through a buffer; stops early only at end of file */
+int clone_buffered(CloneRun_t *run, int src, int dst, uint64_t offset, uint64_t len) {
+  unsigned char *buf = malloc(CLONE_BUFFER);
+  uint64_t done = 0;
+  int status = 0;
+
+  if (!buf) {
+    errno = ENOMEM;
+
+    return -1;
+  }
+  while (status == 0 && done < len) {
+    size_t want = len - done < CLONE_BUFFER ? (size_t)(len - done) : CLONE_BUFFER;
+    ssize_t n = pread(src, buf, want, (off_t)(offset + done)), written = 0;
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) status = -1;
+    if (n <= 0) break;
+    while (status == 0 && written < n) {
+      ssize_t w = pwrite(dst, buf + written, (size_t)(n - written), (off_t)(offset + done + (uint64_t)written));
+
+      if (w < 0 && errno == EINTR) continue;
+      if (w <= 0) status = -1;
+      else written += w;
+    }
+    done += (uint64_t)written;
+  }
+  free(buf);
+  __atomic_add_fetch(&run->stats.bytes_buffered, done, __ATOMIC_RELAXED);
+
+  return status;
+}
+
+int clone_range(CloneRun_t *run, int src, int dst, uint64_t offset, uint64_t len, bool whole) {
+  loff_t in = (loff_t)offset, out = (loff_t)offset;
+  uint64_t done = 0;
+  ssize_t n = -1;
+
+  if (len == 0) return 0;
+  if (__atomic_load_n(&run->reflink, __ATOMIC_RELAXED)) {
+    struct file_clone_range range = { .src_fd = src, .src_offset = offset, .src_length = len, .dest_offset = offset };
+
+    if ((whole ? ioctl(dst, FICLONE, src) : ioctl(dst, FICLONERANGE, &range)) == 0) {
+      __atomic_add_fetch(&run->stats.bytes_cloned, len, __ATOMIC_RELAXED);
+
+      return 0;
+    }
+    // EINVAL: this range is not clonable (inline extents, a file grown since), the next one may be
+    if (clone_refused(errno)) __atomic_store_n(&run->reflink, false, __ATOMIC_RELAXED);
+    else if (errno != EINVAL) return -1;
+  }
+
+  while (done < len && __atomic_load_n(&run->kernel_copy, __ATOMIC_RELAXED)) {
+    n = copy_file_range(src, &in, dst, &out, (size_t)(len - done), 0);
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0 && clone_refused(errno)) __atomic_store_n(&run->kernel_copy, false, __ATOMIC_RELAXED);
+    else if (n < 0 && errno != EINVAL) return -1;
+    if (n <= 0) break;
+    done += (uint64_t)n;
+  }
+  __atomic_add_fetch(&run->stats.bytes_copied, done, __ATOMIC_RELAXED);
+  // the file shrank while it was copied; the copy keeps what was there
+  if (n == 0 || done == len) return 0;
+
+  return clone_buffered(run, src, dst, offset + done, len - done);
+}
+
+/* engine callback: copies one file, or one range of a file split across workers */
+int clone_object(const DumpObject_t *obj, size_t worker_id, void *ctx) {
+  CloneRun_t *run = ctx;
+  CloneFile_t *file;
+  char src_path[BUF_LEN], dst_path[BUF_LEN];
+  uint64_t offset, len;
+  int src, dst, status = -1;
+
+  (void)worker_id;
+  if (__atomic_load_n(&run->failed, __ATOMIC_ACQUIRE)) return -1;
+  // the walk is still adding files
+  pthread_mutex_lock(&run->lock);
+  HASH_FIND_STR(run->files, obj->name, file);
+  pthread_mutex_unlock(&run->lock);
+  if (!file) return clone_run_fail(run, "Cannot copy", obj->name, ENOENT);
+  offset = (uint64_t)obj->part * run->range;
+  len = obj->parts > 1 ? (file->size - offset < run->range ? file->size - offset : run->range) : file->size;
+  snprintf(src_path, sizeof(src_path), "%s/%s", run->from, file->path);
+  snprintf(dst_path, sizeof(dst_path), "%s/%s", run->to, file->path);
+
+  src = open(src_path, O_RDONLY | O_CLOEXEC);
+  dst = src < 0 ? -1 : open(dst_path, O_WRONLY | O_CLOEXEC | (obj->parts > 1 ? 0 : O_CREAT | O_EXCL), 0600);
+  if (src >= 0 && dst >= 0) status = clone_range(run, src, dst, offset, len, obj->parts <= 1);
+  if (status != 0) clone_run_fail(run, "Cannot copy", src_path, errno);
+  if (dst >= 0) close(dst);
+  if (src >= 0) close(src);
+
+  return status;
+}
+
+/* walk visitor: creates directories and links as they are found, queues files on the engine */
+int clone_visit(const TreeEntry_t *entry, size_t worker_id, void *ctx) {
+  CloneRun_t *run = ctx;
+  const struct statx *stx = entry->stx;
+  char dst[BUF_LEN], target[BUF_LEN];
+  uint64_t size = stx->stx_size;
+  uint32_t parts = 1;
+  ssize_t n;
+  int fd, error;
+
+  (void)worker_id;
+  // a failed copy stops the walk as well
+  if (__atomic_load_n(&run->failed, __ATOMIC_ACQUIRE)) return -1;
+  // sockets, fifos and devices are not data, they are left out
+  if (!S_ISDIR(stx->stx_mode) && !S_ISLNK(stx->stx_mode) && !S_ISREG(stx->stx_mode)) return 0;
+  // engine objects are named by path
+  if (strlen(entry->path) >= BUF_LEN_S) return clone_run_fail(run, "Cannot copy", entry->path, ENAMETOOLONG);
+  if (!clone_run_add_file(run, entry->path, stx)) return clone_run_fail(run, "Cannot copy", entry->path, ENOMEM);
+  snprintf(dst, sizeof(dst), "%s/%s", run->to, entry->path);
+
+  if (S_ISDIR(stx->stx_mode)) {
+    __atomic_add_fetch(&run->stats.directories, 1, __ATOMIC_RELAXED);
+    // writable until the fix-up, whatever the source's mode
+    if (mkdir(dst, 0700) != 0) return clone_run_fail(run, "Cannot create", dst, errno);
+
+    return 0;
+  }
+  if (S_ISLNK(stx->stx_mode)) {
+    __atomic_add_fetch(&run->stats.links, 1, __ATOMIC_RELAXED);
+    n = readlinkat(entry->dir_fd, entry->name, target, sizeof(target) - 1);
+    if (n < 0) return clone_run_fail(run, "Cannot read link", entry->path, errno);
+    target[n] = '\0';
+    if (symlink(target, dst) != 0) return clone_run_fail(run, "Cannot create", dst, errno);
+
+    return 0;
+  }
+
+  __atomic_add_fetch(&run->stats.files, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&run->stats.bytes, size, __ATOMIC_RELAXED);
+  if (run->range && size > run->range) {
+    // created at its size here, its ranges land in place from any worker
+    parts = (uint32_t)((size + run->range - 1) / run->range);
+    fd = open(dst, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd < 0 || ftruncate(fd, (off_t)size) != 0) {
+      error = errno;
+      if (fd >= 0) close(fd);
+
+      return clone_run_fail(run, "Cannot create", dst, error);
+    }
+    close(fd);
+  }
+  for (uint32_t part = 0; part < parts; part++) {
+    if (engine_submit(run->engine, entry->path, (size_t)(size / parts), part, parts) != ENGINE_OK) {
+      return clone_run_fail(run, "Cannot copy", entry->path, ENOMEM);
+    }
+  }
+
+  return 0;
+}
+
+int clone_remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+  (void)st, (void)ftw;
+  if (flag == FTW_DP) rmdir(path);
+  else unlink(path);
+
+  return 0;
+}
+
+/* removes what a failed clone left of @path; directories were made writable by the walk */
+void clone_remove_tree(const char *path) {
+  nftw(path, clone_remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+/* gives copied entries the owner, mode and time of their source; directories last, as entries touch them */
+int clone_fixup(CloneRun_t *run) {
+  char path[BUF_LEN];
+  CloneFile_t *file, *tmp;
+  bool root = geteuid() == 0;
+
+  for (int pass = 0; pass < 2; pass++) {
+    HASH_ITER(hh, run->files, file, tmp) {
+      struct timespec times[2] = { { 0, UTIME_OMIT }, file->mtime };
+
+      if (S_ISDIR(file->mode) != (pass == 1)) continue;
+      snprintf(path, sizeof(path), "%s/%s", run->to, file->path);
+      // chown clears set-id bits, so it comes before chmod
+      if ((root && lchown(path, file->uid, file->gid) != 0)
+        || (!S_ISLNK(file->mode) && chmod(path, file->mode & 07777) != 0)
+        || utimensat(AT_FDCWD, path, times, AT_SYMLINK_NOFOLLOW) != 0) {
+        return clone_run_fail(run, "Cannot set attributes of", path, errno);
+      }
+    }
+  }
+
+  return 0;
+}
+
+CloneStatus_t clone_tree(AppConfig_t *cfg, const char *from, const char *to, CloneStats_t *stats, CloneError_t **err) {
+  EngineError_t *engine_err = NULL;
+  TreeWalkError_t *walk_err = NULL;
+  TreeWalk_t *walk = NULL;
+  CloneStatus_t status = CLONE_OK;
+  EngineStatus_t engine_status;
+  TreeWalkStatus_t walk_status;
+  CloneRun_t run;
+  struct statx stx;
+  // what the fix-up puts back, and the size; owners only for root
+  unsigned int mask = STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME | (geteuid() == 0 ? STATX_UID | STATX_GID : 0);
+  bool created = false;
+  int fd;
+
+  if (init_clone_run(&run, cfg, from, to) != 0) {
+    if (err) *err = create_clone_error(CLONE_MEMORY_ERROR, "Failed to allocate clone!");
+
+    return CLONE_MEMORY_ERROR;
+  }
+  if (strlen(from) >= BUF_LEN_M || strlen(to) >= BUF_LEN_M) {
+    snprintf(run.message, sizeof(run.message), "Path too long: %.200s", strlen(from) >= BUF_LEN_M ? from : to);
+    status = CLONE_CONFIG_ERROR;
+  } else if (statx(AT_FDCWD, from, 0, mask, &stx) != 0 || !S_ISDIR(stx.stx_mode)) {
+    snprintf(run.message, sizeof(run.message), "Not a directory: %s", from);
+    status = CLONE_CONFIG_ERROR;
+  } else if (mkdir(to, 0700) != 0) {
+    snprintf(run.message, sizeof(run.message), "Cannot create %s: %s", to, strerror(errno));
+    status = CLONE_IO_ERROR;
+  }
+  created = status == CLONE_OK;
+  if (status == CLONE_OK && (!clone_run_add_file(&run, ".", &stx) || !(run.engine = init_backup_engine(cfg)))) {
+    snprintf(run.message, sizeof(run.message), "Failed to allocate clone!");
+    status = CLONE_MEMORY_ERROR;
+  }
+
+  if (status == CLONE_OK && engine_start(run.engine, clone_object, &run, &engine_err) != ENGINE_OK) {
+    snprintf(run.message, sizeof(run.message), "%s", engine_err ? engine_err->message : "?");
+    status = CLONE_IO_ERROR;
+  } else if (status == CLONE_OK && (!(walk = init_tree_walk(from, mask, clone_visit, &run, &walk_err))
+    || tree_walk_submit(walk, run.engine->sched) != TREEWALK_OK)) {
+    snprintf(run.message, sizeof(run.message), "%s", walk_err ? walk_err->message : "Failed to start the walk!");
+    status = walk ? CLONE_MEMORY_ERROR : CLONE_IO_ERROR;
+  } else if (status == CLONE_OK) {
+    // directories and copies share the pool: the engine is done when the walk is
+    engine_status = engine_wait(run.engine, &engine_err);
+    walk_status = tree_walk_finish(walk, &walk_err);
+    if (engine_status != ENGINE_OK || walk_status != TREEWALK_OK) {
+      // the visitor's or the callback's reason is more use than the walk's or engine's summary
+      if (!run.message[0]) {
+        snprintf(run.message, sizeof(run.message), "%s",
+          walk_err ? walk_err->message : engine_err ? engine_err->message : "?");
+      }
+      status = walk_status == TREEWALK_MEMORY_ERROR ? CLONE_MEMORY_ERROR : CLONE_IO_ERROR;
+    }
+  }
+  if (status == CLONE_OK && clone_fixup(&run) != 0) status = CLONE_IO_ERROR;
+  if (status == CLONE_OK) {
+    // clones are metadata, copies may still be dirty: either way nothing is a backup before it is on disk
+    fd = open(to, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0 || syncfs(fd) != 0) {
+      snprintf(run.message, sizeof(run.message), "Cannot sync %s: %s", to, strerror(errno));
+      status = CLONE_IO_ERROR;
+    }
+    if (fd >= 0) close(fd);
+  }
+
+  if (status != CLONE_OK && err) *err = create_clone_error(status, run.message);
+  if (status != CLONE_OK && created) clone_remove_tree(to);
+  if (stats) *stats = run.stats;
+  destroy_engine_error(&engine_err);
+  destroy_treewalk_error(&walk_err);
+  destroy_tree_walk(&walk);
+  destroy_backup_engine(&run.engine);
+  destroy_clone_run(&run);
+
+  return status;
+}
@@ -0,0 +1,164 @@
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+#include "include/codec.h"
+
+#define GZIP_HEADER_LEN (10)
+#define GZIP_TRAILER_LEN (10)
+#define DEFLATE_STORED_MAX (65535)
+
+
+void *gzip_create(const CodecSpec_t *spec) {
+  z_stream *strm = calloc(1, sizeof(z_stream));
+  int level = spec->level == CODEC_LEVEL_DEFAULT ? GZIP_DEFAULT_LEVEL : spec->level;
+
+  if (!strm) return NULL;
+  if (level > 9) level = 9;
+  // raw deflate: the gzip header and trailer are written once around the whole stream
+  if (deflateInit2(strm, level, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+    free(strm);
+
+    return NULL;
+  }
+
+  return strm;
+}
+
+void gzip_destroy(void *state) {
+  deflateEnd(state);
+  free(state);
+}
+
+/**
+ * gzip_compress - deflates one block independently of its neighbours
+ * @state: the worker's z_stream
+ * @src: raw block
+ * @len: raw length
+ * @dst: output area
+ * @cap: output capacity
+ * @out_len: written compressed length
+ *
+ * The block ends on a sync flush, i.e. on a byte boundary and without the
+ * final-block bit, so blocks can be concatenated into one deflate stream
+ * the way pigz does it.
+ * Return: 0 on success, -1 on failure
+ **/
+int gzip_compress(void *state, const unsigned char *src, size_t len,
+  unsigned char *dst, size_t cap, size_t *out_len) {
+  z_stream *strm = state;
+
+  if (deflateReset(strm) != Z_OK) return -1;
+  strm->next_in = (Bytef *)src;
+  strm->avail_in = (uInt)len;
+  strm->next_out = dst;
+  strm->avail_out = (uInt)cap;
+
+  if (deflate(strm, Z_SYNC_FLUSH) != Z_OK || strm->avail_in != 0 || strm->avail_out == 0) return -1;
+  *out_len = cap - strm->avail_out;
+
+  return 0;
+}
+
+/**
+ * gzip_store - wraps one block in deflate stored blocks
+ * @state: unused, stored blocks need no deflate state
+ * @src: raw block
+ * @len: raw length
+ * @dst: output area
+ * @cap: output capacity
+ * @out_len: written length
+ *
+ * Stored blocks are byte aligned and not final, so they splice into the
+ * stream exactly like a sync-flushed compressed block. An empty block is
+ * still emitted for @len 0, it is the sync-flush marker.
+ * Return: 0 on success, -1 if @cap is too small
+ **/
+int gzip_store(void *state, const unsigned char *src, size_t len,
+  unsigned char *dst, size_t cap, size_t *out_len) {
+  size_t pos = 0, off = 0;
+
+  (void)state;
+  do {
+    size_t n = len - off > DEFLATE_STORED_MAX ? DEFLATE_STORED_MAX : len - off;
+
+    if (cap - pos < n + 5) return -1;
+    // BFINAL 0, BTYPE 00, then LEN and its one's complement
+    dst[pos] = 0x00;
+    dst[pos + 1] = (unsigned char)n;
+    dst[pos + 2] = (unsigned char)(n >> 8);
+    dst[pos + 3] = (unsigned char)~n;
+    dst[pos + 4] = (unsigned char)(~n >> 8);
+    memcpy(dst + pos + 5, src + off, n);
+    pos += n + 5;
+    off += n;
+  } while (off < len);
+  *out_len = pos;
+
+  return 0;
+}
+
+int gzip_decompress(const unsigned char *src, size_t len,
+  unsigned char *dst, size_t cap, size_t *out_len) {
+  z_stream strm;
+  int ret;
+
+  memset(&strm, 0, sizeof(strm));
+  if (inflateInit2(&strm, -15) != Z_OK) return -1;
+  strm.next_in = (Bytef *)src;
+  strm.avail_in = (uInt)len;
+  strm.next_out = dst;
+  strm.avail_out = (uInt)cap;
+
+  ret = inflate(&strm, Z_SYNC_FLUSH);
+  *out_len = cap - strm.avail_out;
+  inflateEnd(&strm);
+
+  return ((ret == Z_OK || ret == Z_STREAM_END) && strm.avail_in == 0) ? 0 : -1;
+}
+
+size_t gzip_stream_header(unsigned char *dst, size_t cap) {
+  static const unsigned char header[GZIP_HEADER_LEN] = {
+    0x1f, 0x8b, 0x08, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00, 0x03
+  };
+
+  if (cap < GZIP_HEADER_LEN) return 0;
+  memcpy(dst, header, GZIP_HEADER_LEN);
+
+  return GZIP_HEADER_LEN;
+}
+
+/**
+ * gzip_stream_trailer - closes a stream of sync-flushed blocks
+ * @dst: output area
+ * @cap: output capacity
+ * @crc: crc32 of all raw bytes
+ * @raw_len: total raw bytes
+ *
+ * Writes an empty final fixed-Huffman block followed by the gzip trailer.
+ * Return: bytes written, 0 if @cap is too small
+ **/
+size_t gzip_stream_trailer(unsigned char *dst, size_t cap, uint32_t crc, uint64_t raw_len) {
+  if (cap < GZIP_TRAILER_LEN) return 0;
+  dst[0] = 0x03;
+  dst[1] = 0x00;
+  for (int i = 0; i < 4; i++) {
+    dst[2 + i] = (unsigned char)(crc >> (8 * i));
+    dst[6 + i] = (unsigned char)(raw_len >> (8 * i));
+  }
+
+  return GZIP_TRAILER_LEN;
+}
+
+uint32_t gzip_crc_combine(uint32_t crc, uint32_t block_crc, size_t block_len) {
+  return (uint32_t)crc32_combine(crc, block_crc, (z_off_t)block_len);
+}
+
+const Codec_t gzip_codec = {
+  .name = "gzip",
+  .id = CODEC_GZIP,
+  .create = gzip_create,
+  .destroy = gzip_destroy,
+  .compress = gzip_compress,
+  .store = gzip_store,
+  .decompress = gzip_decompress
+};
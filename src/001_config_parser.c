@@ -1,5 +1,8 @@
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <yaml.h>
 #include "include/config_parser.h"
 #include "include/arguments.h"
@@ -8,6 +11,43 @@ size_t min(size_t a, size_t b) {
   return (a > b) * a + (a <= b) * b;
 }
 
+/* YAML 1.1 style booleans; 0 on success */
+int config_parse_bool(const char *value, size_t *out) {
+  static const char *const truthy[] = { "true", "yes", "on", "1" };
+  static const char *const falsy[] = { "false", "no", "off", "0" };
+
+  for (size_t i = 0; i < sizeof(truthy) / sizeof(truthy[0]); i++) {
+    if (strcasecmp(value, truthy[i]) == 0 || strcasecmp(value, falsy[i]) == 0) {
+      *out = (size_t)(strcasecmp(value, truthy[i]) == 0);
+
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+/* a byte count with an optional K, M or G suffix (KB, MB, GB alike); 0 on success */
+int config_parse_size(const char *value, size_t *out) {
+  char *end;
+  unsigned long long val = strtoull(value, &end, 10);
+  unsigned shift = 0;
+
+  if (end == value || *value == '-') return -1;
+  switch (*end) {
+    case 'k': case 'K': shift = 10; break;
+    case 'm': case 'M': shift = 20; break;
+    case 'g': case 'G': shift = 30; break;
+    case '\0': break;
+    default: return -1;
+  }
+  if (shift && *++end && strcasecmp(end, "b") != 0) return -1;
+  if (val > (SIZE_MAX >> shift)) return -1;
+  *out = (size_t)val << shift;
+
+  return 0;
+}
+
 void print_app_config(AppConfig_t *cfg) {
   if (!cfg) return;
   puts("db:");
@@ -15,17 +55,27 @@ void print_app_config(AppConfig_t *cfg) {
   printf("\t timeout_seconds: %li\n", cfg->db->timeout_seconds);
   printf("\t type: %s\n", cfg->db->type);
   printf("\t uri: %s\n", cfg->db->uri);
+  printf("\t driver_path: %s\n", cfg->db->driver_path);
+  printf("\t incremental_strategy: %s\n", cfg->db->incremental_strategy);
+  printf("\t cdc_slot: %s\n", cfg->db->cdc_slot);
+  printf("\t wal_slot: %s\n", cfg->db->wal_slot);
+  printf("\t data_dir: %s\n", cfg->db->data_dir);
 
   puts("runtime:");
   printf("\t log_level: %li\n", cfg->runtime->log_level);
   printf("\t tmp_dir: %s\n", cfg->runtime->temp_dir);
   printf("\t thread_count: %li\n", cfg->runtime->thread_count);
+  printf("\t split_chunk_size: %zu\n", cfg->runtime->split_chunk_size);
 
   puts("storage:");
   printf("\t compression: %s\n", cfg->storage->compression);
   printf("\t key_path: %s\n", cfg->storage->encryption_key_path);
   printf("\t output_path: %s\n", cfg->storage->output_path);
   printf("\t remote_target: %s\n", cfg->storage->remote_target);
+  printf("\t remote_connections: %li\n", cfg->storage->remote_connections);
+  printf("\t dedup: %li\n", cfg->storage->dedup_enabled);
+  printf("\t writer: %s\n", cfg->storage->writer);
+  printf("\t direct_io: %li\n", cfg->storage->direct_io);
 }
 
 int assign_value(config_section_t section, const char *key,
@@ -35,6 +85,7 @@ int assign_value(config_section_t section, const char *key,
   if (section == SECTION_DB) {
     if (strcmp(key, "type") == 0) strncpy(cfg->db->type, value, BUF_LEN_XS);
     else if (strcmp(key, "uri") == 0) strncpy(cfg->db->uri, value, BUF_LEN_S);
+    else if (strcmp(key, "driver_path") == 0) strncpy(cfg->db->driver_path, value, BUF_LEN_S);
     else if (strcmp(key, "timeout_seconds") == 0) {
       val = strtol(value, NULL, 10);
 
@@ -46,6 +97,42 @@ int assign_value(config_section_t section, const char *key,
       }
 
       cfg->db->timeout_seconds = (int)val;
+    } else if (strcmp(key, "incremental_enabled") == 0) {
+      if (config_parse_bool(value, &cfg->db->incremental_enabled) != 0) {
+        err->code = CONFIG_VALIDATION_ERROR;
+        snprintf(err->message, sizeof(err->message), "db->incremental_enabled must be true or false");
+
+        return -1;
+      }
+    } else if (strcmp(key, "incremental_strategy") == 0) {
+      if (strcmp(value, "blocks") != 0 && strcmp(value, "logical") != 0) {
+        err->code = CONFIG_VALIDATION_ERROR;
+        snprintf(err->message, sizeof(err->message), "db->incremental_strategy must be blocks or logical");
+
+        return -1;
+      }
+      strcpy(cfg->db->incremental_strategy, value);
+    } else if (strcmp(key, "data_dir") == 0) {
+      // a path cut short would name another directory
+      if (strlen(value) >= sizeof(cfg->db->data_dir)) {
+        err->code = CONFIG_VALIDATION_ERROR;
+        snprintf(err->message, sizeof(err->message), "db->data_dir is longer than %d bytes", BUF_LEN_S - 1);
+
+        return -1;
+      }
+      strcpy(cfg->db->data_dir, value);
+    } else if (strcmp(key, "cdc_slot") == 0 || strcmp(key, "wal_slot") == 0) {
+      // slot names are lower case letters, digits and underscores, as the server wants them
+      char *slot = key[0] == 'c' ? cfg->db->cdc_slot : cfg->db->wal_slot;
+      size_t len = strspn(value, "abcdefghijklmnopqrstuvwxyz0123456789_");
+
+      if (len == 0 || value[len] != '\0' || len >= sizeof(cfg->db->cdc_slot)) {
+        err->code = CONFIG_VALIDATION_ERROR;
+        snprintf(err->message, sizeof(err->message), "db->%s must be lower case letters, digits or _", key);
+
+        return -1;
+      }
+      strcpy(slot, value);
     } else {
       err->code = CONFIG_VALIDATION_ERROR;
       snprintf(err->message, sizeof(err->message), "Unknown db key: %s", key);
@@ -57,7 +144,40 @@ int assign_value(config_section_t section, const char *key,
     else if (strcmp(key, "compression") == 0) strncpy(cfg->storage->compression, value, BUF_LEN_XS);
     else if (strcmp(key, "remote_target") == 0) strncpy(cfg->storage->remote_target, value, BUF_LEN_XS);
     else if (strcmp(key, "encryption_key_path") == 0) strncpy(cfg->storage->encryption_key_path, value, BUF_LEN_S);
-    else {
+    else if (strcmp(key, "remote_connections") == 0) {
+      val = strtol(value, NULL, 10);
+
+      if (val <= 0) {
+        err->code = CONFIG_VALIDATION_ERROR;
+        snprintf(err->message, sizeof(err->message), "storage->remote_connections must be > 0");
+
+        return -1;
+      }
+
+      cfg->storage->remote_connections = (size_t)val;
+    } else if (strcmp(key, "dedup") == 0) {
+      if (config_parse_bool(value, &cfg->storage->dedup_enabled) != 0) {
+        err->code = CONFIG_VALIDATION_ERROR;
+        snprintf(err->message, sizeof(err->message), "storage->dedup must be true or false");
+
+        return -1;
+      }
+    } else if (strcmp(key, "writer") == 0) {
+      if (strcmp(value, "auto") != 0 && strcmp(value, "uring") != 0 && strcmp(value, "sync") != 0) {
+        err->code = CONFIG_VALIDATION_ERROR;
+        snprintf(err->message, sizeof(err->message), "storage->writer must be auto, uring or sync");
+
+        return -1;
+      }
+      strcpy(cfg->storage->writer, value);
+    } else if (strcmp(key, "direct_io") == 0) {
+      if (config_parse_bool(value, &cfg->storage->direct_io) != 0) {
+        err->code = CONFIG_VALIDATION_ERROR;
+        snprintf(err->message, sizeof(err->message), "storage->direct_io must be true or false");
+
+        return -1;
+      }
+    } else {
       err->code = CONFIG_VALIDATION_ERROR;
       snprintf(err->message, sizeof(err->message), "Unknown storage key: %s", key);
 
@@ -72,6 +192,13 @@ int assign_value(config_section_t section, const char *key,
       cfg->runtime->thread_count = (int)val;
     } else if (strcmp(key, "tmp_dir") == 0) {
       strncpy(cfg->runtime->temp_dir, value, BUF_LEN_S);
+    } else if (strcmp(key, "split_chunk_size") == 0) {
+      if (config_parse_size(value, &cfg->runtime->split_chunk_size) != 0) {
+        err->code = CONFIG_VALIDATION_ERROR;
+        snprintf(err->message, sizeof(err->message), "runtime->split_chunk_size must be a size like 256MB, 0 to disable");
+
+        return -1;
+      }
     } else {
       err->code = CONFIG_VALIDATION_ERROR;
       snprintf(err->message, sizeof(err->message), "Unknown runtime key: %s", key);
@@ -241,9 +368,12 @@ AppConfig_t *merge_configs(int argc, char **argv) {
   add_flag(&schema, CFG_DB_PREFIX(type), ARG_TYPE_STRING);
   add_flag(&schema, CFG_DB_PREFIX(uri), ARG_TYPE_STRING);
   add_flag(&schema, CFG_DB_PREFIX(timeout_seconds), ARG_TYPE_INT);
+  add_flag(&schema, CFG_DB_PREFIX(driver_path), ARG_TYPE_STRING);
   add_flag(&schema, CFG_STORAGE_PREFIX(compression), ARG_TYPE_STRING);
   add_flag(&schema, CFG_STORAGE_PREFIX(remote_target), ARG_TYPE_STRING);
+  add_flag(&schema, CFG_STORAGE_PREFIX(remote_connections), ARG_TYPE_INT);
   add_flag(&schema, CFG_RUNTIME_PREFIX(log_level), ARG_TYPE_INT);
+  add_flag(&schema, CFG_RUNTIME_PREFIX(split_chunk_size), ARG_TYPE_INT);
   add_flag(&schema, CFG_PATH, ARG_TYPE_STRING);
   parser_status = parse_args(schema, &parsed_args, &arg_err, argc, argv);
 
@@ -298,6 +428,10 @@ AppConfig_t *merge_configs(int argc, char **argv) {
           cfg->runtime->log_level = (*(size_t *)(current->value));
         } else if (strcmp(current->key, CFG_RUNTIME_PREFIX(thread_count)) == 0) {
           cfg->runtime->thread_count = (*(size_t *)(current->value));
+        } else if (strcmp(current->key, CFG_RUNTIME_PREFIX(split_chunk_size)) == 0) {
+          cfg->runtime->split_chunk_size = (*(size_t *)(current->value));
+        } else if (strcmp(current->key, CFG_STORAGE_PREFIX(remote_connections)) == 0 && *(size_t *)(current->value) > 0) {
+          cfg->storage->remote_connections = (*(size_t *)(current->value));
         }
         break;
       case ARG_TYPE_STRING:
@@ -305,6 +439,8 @@ AppConfig_t *merge_configs(int argc, char **argv) {
           strcpy(cfg->db->type, (char *)current->value);
         } else if (strcmp(current->key, CFG_DB_PREFIX(uri)) == 0) {
           strcpy(cfg->db->uri, (char *)current->value);
+        } else if (strcmp(current->key, CFG_DB_PREFIX(driver_path)) == 0) {
+          strcpy(cfg->db->driver_path, (char *)current->value);
         } else if (strcmp(current->key, CFG_STORAGE_PREFIX(compression)) == 0) {
           strcpy(cfg->storage->compression, (char *)current->value);
         } else if (strcmp(current->key, CFG_STORAGE_PREFIX(remote_target)) == 0) {
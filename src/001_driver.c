@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/driver.h"
+
+
+/* DriverAddFn_t registering the object with the engine, part by part */
+int driver_add_object(void *ctx, const char *name, uint32_t parts) {
+  DriverRun_t *run = ctx;
+  uint64_t estimated = run->driver->estimate ? run->driver->estimate(run->session, name) : 0;
+  size_t count = run->engine->object_count;
+
+  if (strlen(name) >= BUF_LEN_S || parts == 0) return -1;
+  for (uint32_t part = 0; part < parts; part++) engine_add_part(run->engine, name, estimated / parts, part, parts);
+
+  // engine_add_part() drops what it cannot allocate
+  return run->engine->object_count == count + parts ? 0 : -1;
+}
+
+/* records the first failed stream, the engine only keeps the object name */
+void driver_note_failure(DriverRun_t *run, const char *name, int driver_code, const char *message) {
+  pthread_mutex_lock(&run->lock);
+  if (run->first_error[0] == '\0') {
+    snprintf(run->first_error, sizeof(run->first_error), "%s: %s", name, message[0] ? message : "pipeline failed");
+    run->driver_code = driver_code;
+  }
+  pthread_mutex_unlock(&run->lock);
+}
+
+/* DumpObjectFn_t: one archive object per part, streamed by the driver */
+int driver_dump_object(const DumpObject_t *obj, size_t worker_id, void *ctx) {
+  DriverRun_t *run = ctx;
+  PipeWriter_t writer;
+  DriverStream_t out;
+  uint32_t object_id = __atomic_add_fetch(&run->next_object_id, 1, __ATOMIC_RELAXED);
+  char message[BUF_LEN_M] = "";
+  int status;
+
+  if (storage_sink_name_object(run->sink, object_id, obj->name) != 0) {
+    driver_note_failure(run, obj->name, 0, "out of memory");
+
+    return -1;
+  }
+  init_pipe_writer(&writer, run->pipe, object_id);
+  driver_pipe_stream(&out, &writer);
+  status = run->driver->stream(run->session, obj->name, obj->part, worker_id, &out, message, sizeof(message));
+  // close even a failed object so its last block is flagged, the backup fails anyway
+  if (pipe_writer_close(&writer) != PIPELINE_OK || status != 0) {
+    driver_note_failure(run, obj->name, status, message);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+/* lists the objects and runs them on the engine */
+DriverStatus_t driver_dump(DriverRun_t *run, DriverError_t **err) {
+  EngineError_t *engine_err = NULL;
+  char message[BUF_LEN_M] = "", failure[BUF_LEN + BUF_LEN_XS];
+  int code = run->driver->list(run->session, driver_add_object, run, message, sizeof(message));
+
+  if (code != 0) {
+    snprintf(failure, sizeof(failure), "Cannot list the objects to dump: %s", message[0] ? message : "?");
+    if (err) *err = create_driver_error(DRIVER_DUMP_ERROR, code, failure);
+
+    return DRIVER_DUMP_ERROR;
+  }
+  if (engine_run(run->engine, driver_dump_object, run, &engine_err) != ENGINE_OK) {
+    snprintf(failure, sizeof(failure), "%s%s%s", engine_err ? engine_err->message : "dump failed",
+      run->first_error[0] ? " - " : "", run->first_error);
+    if (err) *err = create_driver_error(DRIVER_DUMP_ERROR, run->driver_code, failure);
+    destroy_engine_error(&engine_err);
+
+    return DRIVER_DUMP_ERROR;
+  }
+
+  return DRIVER_OK;
+}
+
+DriverStatus_t driver_backup(const Driver_t *driver, AppConfig_t *cfg, const char *backup_name, DriverError_t **err) {
+  DriverRun_t run = { .driver = driver, .lock = PTHREAD_MUTEX_INITIALIZER };
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  DriverStatus_t status = DRIVER_OK;
+  char message[BUF_LEN_M] = "", failure[BUF_LEN + BUF_LEN_XS];
+  // as many streams as init_scheduler() will start workers
+  size_t workers = cfg->runtime->thread_count ? cfg->runtime->thread_count : 1;
+  int code;
+
+  if (workers > SCHED_MAX_WORKERS) workers = SCHED_MAX_WORKERS;
+  code = driver->open(cfg, workers, &run.session, message, sizeof(message));
+  if (code != 0) {
+    snprintf(failure, sizeof(failure), "%s", message[0] ? message : "Cannot open the database");
+    if (err) *err = create_driver_error(DRIVER_OPEN_ERROR, code, failure);
+
+    return DRIVER_OPEN_ERROR;
+  }
+
+  run.sink = init_storage_sink(cfg->storage, backup_name, &storage_err);
+  run.pipe = run.sink ? init_storage_pipeline(cfg, run.sink, &pipe_err) : NULL;
+  run.engine = run.pipe ? init_backup_engine(cfg) : NULL;
+  if (!run.engine) {
+    snprintf(failure, sizeof(failure), "Cannot open the archive: %s",
+      storage_err ? storage_err->message : pipe_err ? pipe_err->message : "out of memory");
+    if (err) *err = create_driver_error(DRIVER_DUMP_ERROR, 0, failure);
+    status = DRIVER_DUMP_ERROR;
+  } else {
+    status = driver_dump(&run, err);
+  }
+
+  // the pipeline is drained even after a failure, its workers hold the blocks
+  if (run.pipe && pipeline_finish(run.pipe, &pipe_err) != PIPELINE_OK && status == DRIVER_OK) {
+    snprintf(failure, sizeof(failure), "Cannot write the archive: %s", pipe_err ? pipe_err->message : "?");
+    if (err) *err = create_driver_error(DRIVER_DUMP_ERROR, 0, failure);
+    status = DRIVER_DUMP_ERROR;
+  }
+  if (status == DRIVER_OK && storage_sink_commit(run.sink, &storage_err) != STORAGE_OK) {
+    snprintf(failure, sizeof(failure), "Cannot commit the archive: %s", storage_err ? storage_err->message : "?");
+    if (err) *err = create_driver_error(DRIVER_DUMP_ERROR, 0, failure);
+    status = DRIVER_DUMP_ERROR;
+  }
+
+  destroy_backup_engine(&run.engine);
+  destroy_pipeline(&run.pipe);
+  destroy_storage_sink(&run.sink);
+  destroy_storage_error(&storage_err);
+  destroy_pipeline_error(&pipe_err);
+  driver->close(run.session);
+  pthread_mutex_destroy(&run.lock);
+
+  return status;
+}
+
+DriverStatus_t driver_run_backup(AppConfig_t *cfg, const char *backup_name, DriverError_t **err) {
+  DriverHandle_t handle;
+  DriverStatus_t status = driver_find(cfg->db, &handle, err);
+
+  if (status != DRIVER_OK) return status;
+  status = driver_backup(handle.driver, cfg, backup_name, err);
+  driver_release(&handle);
+
+  return status;
+}
@@ -0,0 +1,127 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/engine.h"
+
+typedef struct DumpTaskArg {
+  BackupEngine_t    *engine;
+  DumpObject_t      *obj;
+  DumpObject_t      submitted;      // of engine_submit, @obj points here and the task frees itself
+} DumpTaskArg_t;
+
+
+/* largest first */
+int compare_objects_by_size(const void *a, const void *b) {
+  const DumpObject_t *lhs = a, *rhs = b;
+
+  return (lhs->estimated_bytes < rhs->estimated_bytes) - (lhs->estimated_bytes > rhs->estimated_bytes);
+}
+
+void engine_dump_task(void *arg, size_t worker_id) {
+  DumpTaskArg_t *task = arg;
+  BackupEngine_t *engine = task->engine;
+
+  if (engine->dump(task->obj, worker_id, engine->dump_ctx) != 0) {
+    pthread_mutex_lock(&engine->lock);
+    if (engine->failed++ == 0 && task->obj->parts > 1) {
+      snprintf(engine->first_failure, sizeof(engine->first_failure), "%.200s (part %u of %u)", task->obj->name,
+        task->obj->part + 1, task->obj->parts);
+    } else if (engine->failed == 1) {
+      strncpy(engine->first_failure, task->obj->name, sizeof(engine->first_failure) - 1);
+    }
+    pthread_mutex_unlock(&engine->lock);
+  }
+}
+
+void engine_submitted_task(void *arg, size_t worker_id) {
+  engine_dump_task(arg, worker_id);
+  free(arg);
+}
+
+EngineStatus_t engine_start(BackupEngine_t *engine, DumpObjectFn_t dump, void *ctx, EngineError_t **err) {
+  if (!engine->sched) engine->sched = init_scheduler(engine->cfg->runtime->thread_count);
+  if (!engine->sched) {
+    if (err) *err = create_engine_error(ENGINE_THREAD_ERROR, "Failed to start worker pool!");
+
+    return ENGINE_THREAD_ERROR;
+  }
+  engine->dump = dump;
+  engine->dump_ctx = ctx;
+  engine->failed = 0;
+
+  return ENGINE_OK;
+}
+
+EngineStatus_t engine_submit(BackupEngine_t *engine, const char *name, size_t estimated_bytes, uint32_t part,
+  uint32_t parts) {
+  DumpTaskArg_t *task = calloc(1, sizeof(DumpTaskArg_t));
+
+  if (!task) return ENGINE_MEMORY_ERROR;
+  strncpy(task->submitted.name, name, sizeof(task->submitted.name) - 1);
+  task->submitted.estimated_bytes = estimated_bytes;
+  task->submitted.part = part;
+  task->submitted.parts = parts;
+  task->obj = &task->submitted;
+  task->engine = engine;
+  if (scheduler_submit(engine->sched, engine_submitted_task, task) != SCHED_OK) {
+    free(task);
+
+    return ENGINE_MEMORY_ERROR;
+  }
+
+  return ENGINE_OK;
+}
+
+EngineStatus_t engine_wait(BackupEngine_t *engine, EngineError_t **err) {
+  char message[BUF_LEN_M];
+
+  scheduler_wait(engine->sched);
+  if (engine->failed > 0) {
+    snprintf(message, sizeof(message), "%zu object(s) failed to dump, first: %s",
+      engine->failed, engine->first_failure);
+    if (err) *err = create_engine_error(ENGINE_DUMP_ERROR, message);
+
+    return ENGINE_DUMP_ERROR;
+  }
+
+  return ENGINE_OK;
+}
+
+EngineStatus_t engine_run(BackupEngine_t *engine, DumpObjectFn_t dump, void *ctx, EngineError_t **err) {
+  DumpTaskArg_t *tasks = NULL;
+  EngineStatus_t status = engine_start(engine, dump, ctx, err);
+
+  if (status != ENGINE_OK || engine->object_count == 0) return status;
+
+  tasks = malloc(sizeof(DumpTaskArg_t) * engine->object_count);
+  if (!tasks) {
+    if (err) *err = create_engine_error(ENGINE_MEMORY_ERROR, "Failed to allocate dump tasks!");
+
+    return ENGINE_MEMORY_ERROR;
+  }
+
+  /*
+   * Queue largest first: the shared queue is taken from in order, so a
+   * worker that frees up always starts the largest object left and the
+   * longest dump never starts last.
+   */
+  qsort(engine->objects, engine->object_count, sizeof(DumpObject_t), compare_objects_by_size);
+
+  for (size_t i = 0; i < engine->object_count; i++) {
+    tasks[i].engine = engine;
+    tasks[i].obj = &engine->objects[i];
+    if (scheduler_submit(engine->sched, engine_dump_task, &tasks[i]) != SCHED_OK) {
+      // already queued tasks still reference @tasks, drain them first
+      scheduler_wait(engine->sched);
+      free(tasks);
+      if (err) *err = create_engine_error(ENGINE_MEMORY_ERROR, "Failed to queue dump task!");
+
+      return ENGINE_MEMORY_ERROR;
+    }
+  }
+
+  status = engine_wait(engine, err);
+  free(tasks);
+
+  return status;
+}
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include "include/incremental.h"
+
+#define INCR_BLOCK_RECORD_LEN (INCR_HASH_LEN + 16)
+
+/* a manifest stream and the running digest of everything through it */
+typedef struct IncrStream {
+  FILE              *fh;
+  EVP_MD_CTX        *md;
+  bool              failed;
+} IncrStream_t;
+
+
+void incr_put_le(unsigned char *dst, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) dst[i] = (unsigned char)(value >> (8 * i));
+}
+
+uint64_t incr_get_le(const unsigned char *src, int bytes) {
+  uint64_t value = 0;
+
+  for (int i = 0; i < bytes; i++) value |= (uint64_t)src[i] << (8 * i);
+
+  return value;
+}
+
+void incr_emit(IncrStream_t *s, const void *data, size_t len) {
+  if (s->failed) return;
+  if (fwrite(data, 1, len, s->fh) != len || EVP_DigestUpdate(s->md, data, len) != 1) s->failed = true;
+}
+
+void incr_emit_le(IncrStream_t *s, uint64_t value, int bytes) {
+  unsigned char buf[8];
+
+  incr_put_le(buf, value, bytes);
+  incr_emit(s, buf, (size_t)bytes);
+}
+
+int incr_take(IncrStream_t *s, void *dst, size_t len) {
+  if (s->failed || fread(dst, 1, len, s->fh) != len || EVP_DigestUpdate(s->md, dst, len) != 1) {
+    s->failed = true;
+
+    return -1;
+  }
+
+  return 0;
+}
+
+uint64_t incr_take_le(IncrStream_t *s, int bytes) {
+  unsigned char buf[8] = { 0 };
+
+  incr_take(s, buf, (size_t)bytes);
+
+  return incr_get_le(buf, bytes);
+}
+
+int incr_manifest_save(const IncrManifest_t *m, const char *path) {
+  char partial[BUF_LEN + 16];
+  unsigned char header[INCR_HEADER_LEN] = { 0 }, digest[EVP_MAX_MD_SIZE], record[INCR_BLOCK_RECORD_LEN];
+  IncrStream_t s = { NULL, EVP_MD_CTX_new(), false };
+  const IncrFile_t *file;
+  int saved_errno = 0;
+
+  snprintf(partial, sizeof(partial), "%s.partial", path);
+  s.fh = fopen(partial, "wb");
+  if (!s.fh || !s.md || EVP_DigestInit_ex(s.md, EVP_sha256(), NULL) != 1) {
+    saved_errno = errno;
+    if (s.fh) {
+      fclose(s.fh);
+      unlink(partial);
+    }
+    EVP_MD_CTX_free(s.md);
+    errno = saved_errno;
+
+    return -1;
+  }
+
+  memcpy(header, INCR_MAGIC, strlen(INCR_MAGIC));
+  header[7] = INCR_FORMAT_VERSION;
+  incr_put_le(header + 8, m->block_size, 4);
+  incr_put_le(header + 12, m->chain_len, 4);
+  incr_emit(&s, header, sizeof(header));
+  for (uint32_t i = 0; i < m->chain_len; i++) {
+    incr_emit_le(&s, strlen(m->chain[i]), 2);
+    incr_emit(&s, m->chain[i], strlen(m->chain[i]));
+  }
+
+  for (file = m->files; file; file = file->hh.next) {
+    incr_emit_le(&s, strlen(file->path), 2);
+    incr_emit(&s, file->path, strlen(file->path));
+    incr_emit_le(&s, file->mode, 4);
+    incr_emit_le(&s, file->size, 8);
+    incr_emit_le(&s, (uint64_t)file->mtime_ns, 8);
+    for (uint64_t i = 0; i < file->block_count; i++) {
+      memcpy(record, file->blocks[i].hash, INCR_HASH_LEN);
+      incr_put_le(record + INCR_HASH_LEN, file->blocks[i].generation, 4);
+      incr_put_le(record + INCR_HASH_LEN + 4, file->blocks[i].stored_len, 4);
+      incr_put_le(record + INCR_HASH_LEN + 8, file->blocks[i].offset, 8);
+      incr_emit(&s, record, sizeof(record));
+    }
+  }
+  incr_emit_le(&s, 0, 2);
+  incr_emit_le(&s, m->file_count, 8);
+  if (!s.failed && EVP_DigestFinal_ex(s.md, digest, NULL) == 1) {
+    if (fwrite(digest, 1, INCR_DIGEST_LEN, s.fh) != INCR_DIGEST_LEN) s.failed = true;
+  } else {
+    s.failed = true;
+  }
+
+  if (!s.failed && (fflush(s.fh) != 0 || fsync(fileno(s.fh)) != 0)) s.failed = true;
+  if (s.failed) saved_errno = errno ? errno : EIO;
+  if (fclose(s.fh) != 0 && !s.failed) {
+    s.failed = true;
+    saved_errno = errno;
+  }
+  EVP_MD_CTX_free(s.md);
+  if (!s.failed && rename(partial, path) != 0) {
+    s.failed = true;
+    saved_errno = errno;
+  }
+  if (s.failed) {
+    unlink(partial);
+    errno = saved_errno;
+
+    return -1;
+  }
+
+  return 0;
+}
+
+IncrManifest_t *incr_manifest_load(const char *path, char *message, size_t message_len) {
+  unsigned char header[INCR_HEADER_LEN], digest[EVP_MAX_MD_SIZE], stored[INCR_DIGEST_LEN];
+  unsigned char record[INCR_BLOCK_RECORD_LEN];
+  IncrStream_t s = { fopen(path, "rb"), EVP_MD_CTX_new(), false };
+  IncrManifest_t *m = NULL;
+  char name[BUF_LEN];
+  uint32_t chain_len = 0;
+  uint64_t files = 0;
+
+  if (!s.fh || !s.md || EVP_DigestInit_ex(s.md, EVP_sha256(), NULL) != 1) {
+    snprintf(message, message_len, "Cannot open manifest %s: %s", path, strerror(errno));
+    if (s.fh) fclose(s.fh);
+    EVP_MD_CTX_free(s.md);
+
+    return NULL;
+  }
+  if (incr_take(&s, header, sizeof(header)) == 0 && memcmp(header, INCR_MAGIC, strlen(INCR_MAGIC)) == 0
+    && header[7] == INCR_FORMAT_VERSION && incr_get_le(header + 8, 4) > 0) {
+    m = init_incr_manifest((uint32_t)incr_get_le(header + 8, 4));
+    chain_len = (uint32_t)incr_get_le(header + 12, 4);
+  } else {
+    s.failed = true;
+  }
+
+  for (uint32_t i = 0; m && !s.failed && i < chain_len; i++) {
+    size_t len = (size_t)incr_take_le(&s, 2);
+
+    if (len >= BUF_LEN_S || incr_take(&s, name, len) != 0) {
+      s.failed = true;
+      break;
+    }
+    name[len] = '\0';
+    if (incr_manifest_push_chain(m, name) < 0) s.failed = true;
+  }
+
+  while (m && !s.failed) {
+    size_t len = (size_t)incr_take_le(&s, 2);
+    uint32_t mode;
+    uint64_t size;
+    int64_t mtime_ns;
+    IncrFile_t *file;
+
+    if (s.failed || len == 0) break;
+    if (len >= sizeof(name) || incr_take(&s, name, len) != 0) {
+      s.failed = true;
+      break;
+    }
+    name[len] = '\0';
+    mode = (uint32_t)incr_take_le(&s, 4);
+    size = incr_take_le(&s, 8);
+    mtime_ns = (int64_t)incr_take_le(&s, 8);
+    file = s.failed ? NULL : incr_manifest_add_file(m, name, mode, size, mtime_ns);
+    if (!file) {
+      s.failed = true;
+      break;
+    }
+    for (uint64_t i = 0; i < file->block_count && !s.failed; i++) {
+      if (incr_take(&s, record, sizeof(record)) != 0) break;
+      memcpy(file->blocks[i].hash, record, INCR_HASH_LEN);
+      file->blocks[i].generation = (uint32_t)incr_get_le(record + INCR_HASH_LEN, 4);
+      file->blocks[i].stored_len = (uint32_t)incr_get_le(record + INCR_HASH_LEN + 4, 4);
+      file->blocks[i].offset = incr_get_le(record + INCR_HASH_LEN + 8, 8);
+      if (file->blocks[i].generation >= m->chain_len) s.failed = true;
+    }
+  }
+
+  if (m && !s.failed) files = incr_take_le(&s, 8);
+  // the digest covers everything before it, so it is taken before reading the stored one
+  if (!m || s.failed || EVP_DigestFinal_ex(s.md, digest, NULL) != 1
+    || fread(stored, 1, sizeof(stored), s.fh) != sizeof(stored) || memcmp(stored, digest, sizeof(stored)) != 0
+    || files != m->file_count || m->chain_len == 0) {
+    snprintf(message, message_len, "Manifest %s is damaged", path);
+    destroy_incr_manifest(&m);
+  }
+  fclose(s.fh);
+  EVP_MD_CTX_free(s.md);
+
+  return m;
+}
@@ -0,0 +1,64 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <stdint.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include "include/pagecache.h"
+
+
+int pagecache_reserve(PageCache_t *cache, size_t pages);
+
+int pagecache_probe(PageCache_t *cache, int fd, const unsigned char *map, uint64_t offset, size_t len) {
+  uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE), start = offset - offset % page;
+  size_t span = len + (size_t)(offset - start), pages = (span + (size_t)page - 1) / (size_t)page;
+  void *probed = map ? (void *)(uintptr_t)(map + start) : NULL;
+  int status;
+
+  cache->pages = 0;
+  if (pages == 0 || pagecache_reserve(cache, pages) != 0) return -1;
+  // a mapping that is not touched faults nothing in; mincore only reads the cache
+  if (!map) probed = mmap(NULL, span, PROT_READ, MAP_SHARED, fd, (off_t)start);
+  if (probed == MAP_FAILED) return -1;
+  status = mincore(probed, span, cache->resident);
+  if (!map) munmap(probed, span);
+  if (status != 0) return -1;
+  cache->pages = pages;
+  cache->fd = fd;
+  cache->offset = start;
+
+  return 0;
+}
+
+void pagecache_drop(PageCache_t *cache, const unsigned char *map, uint64_t offset, size_t len) {
+  uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE), end = offset + len;
+  size_t first, last;
+
+  if (cache->pages == 0 || end <= cache->offset) return;
+  first = offset > cache->offset ? (size_t)((offset - cache->offset) / page) : 0;
+  last = (size_t)((end - cache->offset + page - 1) / page);
+  if (last > cache->pages) last = cache->pages;
+
+  for (size_t i = first; i < last; ) {
+    size_t run = 0;
+    uint64_t at;
+
+    // bit 0 of each byte: the page was resident
+    if (cache->resident[i] & 1) {
+      i++;
+      continue;
+    }
+    while (i + run < last && !(cache->resident[i + run] & 1)) run++;
+    at = cache->offset + i * page;
+    if (map) madvise((void *)(uintptr_t)(map + at), run * page, MADV_DONTNEED);
+    posix_fadvise(cache->fd, (off_t)at, (off_t)(run * page), POSIX_FADV_DONTNEED);
+    i += run;
+  }
+}
+
+void pagecache_write_behind(int fd, uint64_t from, uint64_t to) {
+  if (to <= from) return;
+  // dirty pages are only written back by DONTNEED, not dropped: wait for them first
+  sync_file_range(fd, (off_t)from, (off_t)(to - from),
+    SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+  posix_fadvise(fd, (off_t)from, (off_t)(to - from), POSIX_FADV_DONTNEED);
+}
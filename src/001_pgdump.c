@@ -0,0 +1,269 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/pgdump.h"
+#include "include/restore.h"
+
+/*
+ * Indexes not owned by a constraint, then primary key, unique,
+ * exclusion and foreign key constraints. With the coordinator's
+ * empty search_path every name comes out schema-qualified.
+ */
+#define PGDUMP_POST_DATA_SQL \
+  ("SELECT pg_catalog.pg_get_indexdef(i.indexrelid) || ';' " \
+   "FROM pg_catalog.pg_index i JOIN pg_catalog.pg_class c ON c.oid = i.indrelid " \
+   "JOIN pg_catalog.pg_namespace n ON n.oid = c.relnamespace " \
+   "WHERE c.relkind = 'r' AND n.nspname <> 'information_schema' AND n.nspname !~ '^pg_' " \
+   "AND NOT EXISTS (SELECT 1 FROM pg_catalog.pg_constraint k " \
+   "WHERE k.conindid = i.indexrelid AND k.contype IN ('p', 'u', 'x')) " \
+   "UNION ALL " \
+   "SELECT pg_catalog.format('ALTER TABLE ONLY %s ADD CONSTRAINT %I %s;', k.conrelid::pg_catalog.regclass, " \
+   "k.conname, pg_catalog.pg_get_constraintdef(k.oid)) " \
+   "FROM pg_catalog.pg_constraint k JOIN pg_catalog.pg_class c ON c.oid = k.conrelid " \
+   "JOIN pg_catalog.pg_namespace n ON n.oid = c.relnamespace " \
+   "WHERE c.relkind = 'r' AND n.nspname <> 'information_schema' AND n.nspname !~ '^pg_' " \
+   "AND k.contype IN ('p', 'u', 'x', 'f')")
+
+
+/* the first key or block of part @part: the spans are cut evenly, remainders spread */
+uint64_t pgdump_part_bound(const PgDumpTable_t *table, uint32_t part) {
+  return table->span / table->parts * part + table->span % table->parts * part / table->parts;
+}
+
+char *pgdump_copy_sql(const PgDumpTable_t *table, uint32_t part) {
+  char lower[BUF_LEN_S + BUF_LEN_XS] = "", upper[BUF_LEN_S + BUF_LEN_XS] = "";
+  uint64_t lo, hi;
+  size_t len;
+  char *sql;
+
+  if (table->split == PGDUMP_SPLIT_NONE || table->parts < 2 || !table->columns) {
+    len = strlen(table->quoted) + BUF_LEN_XS;
+    sql = malloc(len);
+    if (sql) snprintf(sql, len, "COPY %s TO STDOUT " PGDUMP_COPY_OPTIONS, table->quoted);
+
+    return sql;
+  }
+
+  // the outer ranges are open, nothing past the planned ends is missed
+  lo = pgdump_part_bound(table, part);
+  hi = pgdump_part_bound(table, part + 1);
+  if (table->split == PGDUMP_SPLIT_KEY) {
+    if (part > 0) {
+      snprintf(lower, sizeof(lower), "%s >= %lld", table->key, (long long)((uint64_t)table->key_min + lo));
+    }
+    if (part + 1 < table->parts) {
+      snprintf(upper, sizeof(upper), "%s < %lld", table->key, (long long)((uint64_t)table->key_min + hi));
+    }
+  } else {
+    if (part > 0) snprintf(lower, sizeof(lower), "ctid >= '(%llu,0)'::pg_catalog.tid", (unsigned long long)lo);
+    if (part + 1 < table->parts) {
+      snprintf(upper, sizeof(upper), "ctid < '(%llu,0)'::pg_catalog.tid", (unsigned long long)hi);
+    }
+  }
+
+  len = strlen(table->columns) + strlen(table->quoted) + sizeof(lower) + sizeof(upper) + BUF_LEN_XS;
+  sql = malloc(len);
+  if (sql) {
+    snprintf(sql, len, "COPY (SELECT %s FROM ONLY %s WHERE %s%s%s) TO STDOUT " PGDUMP_COPY_OPTIONS, table->columns,
+      table->quoted, lower, lower[0] && upper[0] ? " AND " : "", upper);
+  }
+
+  return sql;
+}
+
+void pgdump_join_part(PgDumpJoin_t *join, PgCopyFn_t emit, void *ctx, bool first, bool last) {
+  join->emit = emit;
+  join->ctx = ctx;
+  join->first = first;
+  join->last = last;
+  join->header_len = first ? PGDUMP_COPY_HEADER_LEN : 0;
+  join->skip = 0;
+  join->trailer_len = 0;
+}
+
+int pgdump_join_write(void *ctx, const unsigned char *data, size_t len) {
+  PgDumpJoin_t *join = ctx;
+  size_t take, flush;
+
+  // the header of a later part: signature, flags and an extension area to drop
+  if (join->header_len < PGDUMP_COPY_HEADER_LEN && len) {
+    take = PGDUMP_COPY_HEADER_LEN - join->header_len;
+    if (take > len) take = len;
+    memcpy(join->header + join->header_len, data, take);
+    join->header_len += take;
+    data += take;
+    len -= take;
+    if (join->header_len < PGDUMP_COPY_HEADER_LEN) return 0;
+    if (memcmp(join->header, PGDUMP_COPY_SIGNATURE, sizeof(PGDUMP_COPY_SIGNATURE) - 1) != 0) return -1;
+    join->skip = pg_get_be(join->header + 15, 4);
+  }
+  take = join->skip < len ? (size_t)join->skip : len;
+  join->skip -= take;
+  data += take;
+  len -= take;
+
+  // everything but the last PGDUMP_COPY_TRAILER_LEN bytes seen goes out
+  if (join->trailer_len + len <= PGDUMP_COPY_TRAILER_LEN) {
+    memcpy(join->trailer + join->trailer_len, data, len);
+    join->trailer_len += len;
+
+    return 0;
+  }
+  flush = join->trailer_len + len - PGDUMP_COPY_TRAILER_LEN;
+  take = flush < join->trailer_len ? flush : join->trailer_len;
+  if (take && join->emit(join->ctx, join->trailer, take) != 0) return -1;
+  memmove(join->trailer, join->trailer + take, join->trailer_len - take);
+  join->trailer_len -= take;
+  if (flush > take && join->emit(join->ctx, data, flush - take) != 0) return -1;
+  memcpy(join->trailer + join->trailer_len, data + flush - take, len - (flush - take));
+  join->trailer_len += len - (flush - take);
+
+  return 0;
+}
+
+int pgdump_join_end(PgDumpJoin_t *join) {
+  // a complete stream ends with a field count of -1
+  if (join->header_len < PGDUMP_COPY_HEADER_LEN || join->skip || join->trailer_len != PGDUMP_COPY_TRAILER_LEN
+    || join->trailer[0] != 0xff || join->trailer[1] != 0xff) {
+    return -1;
+  }
+
+  return join->last ? join->emit(join->ctx, join->trailer, join->trailer_len) : 0;
+}
+
+/* streams the index and constraint statements, the post-data object */
+int pgdump_post_data(PgDumpSession_t *session, const DriverStream_t *out, char *message, size_t len) {
+  PgResult_t *res = NULL;
+  int status = 0;
+
+  if (pg_query(session->coordinator, PGDUMP_POST_DATA_SQL, &res) != PG_OK) {
+    snprintf(message, len, "Cannot read the index definitions: %s", session->coordinator->message);
+
+    return PGDUMP_QUERY_ERROR;
+  }
+  for (size_t i = 0; res && status == 0 && i < res->rows; i++) {
+    const char *statement = pg_result_value(res, i, 0);
+
+    if (!statement) continue;
+    status = out->write(out->ctx, statement, strlen(statement));
+    if (status == 0) status = out->write(out->ctx, "\n", 1);
+  }
+  destroy_pg_result(&res);
+  if (status != 0) {
+    snprintf(message, len, "Cannot write the post-data statements");
+
+    return PGDUMP_DUMP_ERROR;
+  }
+
+  return PGDUMP_OK;
+}
+
+int pgdump_driver_open(AppConfig_t *cfg, size_t workers, void **session, char *message, size_t len) {
+  PgDumpError_t *err = NULL;
+  int status = PGDUMP_OK;
+
+  // init_pgdump_session() opens one connection per scheduler worker already
+  (void)workers;
+  *session = init_pgdump_session(cfg, &err);
+  if (!*session) {
+    status = err ? (int)err->code : PGDUMP_MEMORY_ERROR;
+    snprintf(message, len, "%s", err ? err->message : "Failed to allocate dump session!");
+  }
+  destroy_pgdump_error(&err);
+
+  return status;
+}
+
+/* the post-data object, then every table, split ones as one part per range */
+int pgdump_driver_list(void *ctx, DriverAddFn_t add, void *add_ctx, char *message, size_t len) {
+  PgDumpSession_t *session = ctx;
+  PgDumpTable_t *table, *tmp;
+
+  if (add(add_ctx, RESTORE_POST_DATA_OBJECT, 1) != 0) {
+    snprintf(message, len, "Cannot add the post-data object");
+
+    return PGDUMP_MEMORY_ERROR;
+  }
+  HASH_ITER(hh, session->tables, table, tmp) {
+    if (add(add_ctx, table->name, table->parts) != 0) {
+      snprintf(message, len, "Cannot add table %s", table->name);
+
+      return PGDUMP_MEMORY_ERROR;
+    }
+  }
+
+  return PGDUMP_OK;
+}
+
+uint64_t pgdump_driver_estimate(void *ctx, const char *name) {
+  PgDumpSession_t *session = ctx;
+  PgDumpTable_t *table = NULL;
+
+  HASH_FIND_STR(session->tables, name, table);
+
+  return table ? table->estimated_bytes : 0;
+}
+
+/* one table or range through worker @worker_id's connection, read off the socket into @out's room */
+int pgdump_driver_stream(void *ctx, const char *name, uint32_t part, size_t worker_id, const DriverStream_t *out,
+  char *message, size_t len) {
+  PgDumpSession_t *session = ctx;
+  PgDumpTable_t *table = NULL;
+  uint64_t bytes = 0;
+  PgStatus_t status;
+  char *sql;
+
+  if (strcmp(name, RESTORE_POST_DATA_OBJECT) == 0) return pgdump_post_data(session, out, message, len);
+  HASH_FIND_STR(session->tables, name, table);
+  if (!table || worker_id >= session->worker_count) {
+    snprintf(message, len, "No table or connection to dump it on");
+
+    return PGDUMP_CONFIG_ERROR;
+  }
+  sql = pgdump_copy_sql(table, part);
+  if (!sql) {
+    snprintf(message, len, "Failed to allocate the COPY statement!");
+
+    return PGDUMP_MEMORY_ERROR;
+  }
+  status = pg_copy_out_direct(session->workers[worker_id], sql, out->reserve, out->commit, out->ctx, &bytes);
+  free(sql);
+  if (status != PG_OK) {
+    snprintf(message, len, "%s", session->workers[worker_id]->message);
+
+    return PGDUMP_DUMP_ERROR;
+  }
+  __atomic_add_fetch(&session->bytes_dumped, bytes, __ATOMIC_RELAXED);
+
+  return PGDUMP_OK;
+}
+
+void pgdump_driver_close(void *ctx) {
+  PgDumpSession_t *session = ctx;
+
+  destroy_pgdump_session(&session);
+}
+
+const Driver_t pgdump_driver = {
+  .abi_version = DRIVER_ABI_VERSION,
+  .name = "postgres",
+  .supports = pgdump_supported,
+  .open = pgdump_driver_open,
+  .list = pgdump_driver_list,
+  .estimate = pgdump_driver_estimate,
+  .stream = pgdump_driver_stream,
+  .close = pgdump_driver_close
+};
+
+PgDumpStatus_t pgdump_backup(AppConfig_t *cfg, const char *backup_name, PgDumpError_t **err) {
+  DriverError_t *driver_err = NULL;
+  PgDumpStatus_t status = PGDUMP_OK;
+
+  if (driver_backup(&pgdump_driver, cfg, backup_name, &driver_err) != DRIVER_OK) {
+    status = driver_err && driver_err->driver_code ? (PgDumpStatus_t)driver_err->driver_code : PGDUMP_DUMP_ERROR;
+    if (err) *err = create_pgdump_error(status, driver_err ? driver_err->message : "backup failed");
+  }
+  destroy_driver_error(&driver_err);
+
+  return status;
+}
@@ -0,0 +1,82 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/pgload.h"
+#include "include/pgdump.h"
+
+
+/* keeps the reason of the first failure for the caller's report */
+int pgload_fail(PgLoadSession_t *session, const char *message) {
+  pthread_mutex_lock(&session->lock);
+  if (!session->failed++) snprintf(session->message, sizeof(session->message), "%s", message);
+  pthread_mutex_unlock(&session->lock);
+
+  return -1;
+}
+
+/* writes COPY "schema"."table" FROM STDIN for object "schema.table"; 0 on success */
+int pgload_copy_sql(char *dst, size_t dst_len, const char *name) {
+  char schema[BUF_LEN_S];
+  const char *dot = strchr(name, '.');
+
+  if (!dot || (size_t)(dot - name) >= sizeof(schema)) return -1;
+  memcpy(schema, name, (size_t)(dot - name));
+  schema[dot - name] = '\0';
+  snprintf(dst, dst_len, "COPY ");
+  if (pg_quote(dst, dst_len, schema, '"') != 0 || strlen(dst) + 1 >= dst_len) return -1;
+  strcat(dst, ".");
+  if (pg_quote(dst, dst_len, dot + 1, '"') != 0) return -1;
+
+  return (size_t)snprintf(dst + strlen(dst), dst_len - strlen(dst), " FROM STDIN %s", PGDUMP_COPY_OPTIONS)
+    < dst_len - strlen(dst) ? 0 : -1;
+}
+
+int pgload_table(ArchiveReader_t *reader, const ArchiveObject_t *obj, size_t worker_id, void *ctx) {
+  PgLoadSession_t *session = ctx;
+  PgConn_t *conn = worker_id < session->worker_count ? session->workers[worker_id] : NULL;
+  ArchiveError_t *archive_err = NULL;
+  ArchiveStatus_t read_status;
+  char sql[BUF_LEN], message[BUF_LEN_M];
+
+  if (!conn) {
+    snprintf(message, sizeof(message), "%s: no connection for worker %zu", obj->name, worker_id);
+
+    return pgload_fail(session, message);
+  }
+  if (pgload_copy_sql(sql, sizeof(sql), obj->name) != 0) {
+    snprintf(message, sizeof(message), "%s is not a schema.table name", obj->name);
+
+    return pgload_fail(session, message);
+  }
+  if (pg_copy_in_start(conn, sql) != PG_OK) {
+    snprintf(message, sizeof(message), "%.100s: %.380s", obj->name, conn->message);
+
+    return pgload_fail(session, message);
+  }
+
+  // the frames go out as they are decoded, a table is never held whole
+  read_status = archive_read_object(reader, obj, pg_copy_in_write, conn, &archive_err);
+  if (pg_copy_in_end(conn, read_status == ARCHIVE_OK ? NULL : "the archive could not be read") != PG_OK
+    || read_status != ARCHIVE_OK) {
+    snprintf(message, sizeof(message), "%.100s: %.380s", obj->name,
+      read_status != ARCHIVE_OK && archive_err ? archive_err->message : conn->message);
+    destroy_archive_error(&archive_err);
+
+    return pgload_fail(session, message);
+  }
+  __atomic_add_fetch(&session->bytes_loaded, obj->raw_bytes, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+int pgload_step(const RestoreStep_t *step, size_t worker_id, void *ctx) {
+  PgLoadSession_t *session = ctx;
+  PgConn_t *conn = worker_id < session->worker_count ? session->workers[worker_id] : NULL;
+  char message[BUF_LEN_M];
+
+  if (conn && pg_exec(conn, step->sql) == PG_OK) return 0;
+  snprintf(message, sizeof(message), "%.200s: %.280s", step->sql, conn ? conn->message : "no connection");
+
+  return pgload_fail(session, message);
+}
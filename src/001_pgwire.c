@@ -0,0 +1,391 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <openssl/sha.h>
+#include "include/pgwire.h"
+
+typedef struct PgScram {
+  char              nonce[BUF_LEN_XS];
+  char              client_first_bare[BUF_LEN_S];
+  unsigned char     server_signature[SHA256_DIGEST_LENGTH];
+  bool              verified;
+} PgScram_t;
+
+
+void pg_put_be(unsigned char *dst, uint64_t value, int bytes) {
+  for (int i = bytes - 1; i >= 0; i--) {
+    dst[i] = (unsigned char)(value & 0xff);
+    value >>= 8;
+  }
+}
+
+uint64_t pg_get_be(const unsigned char *src, int bytes) {
+  uint64_t value = 0;
+
+  for (int i = 0; i < bytes; i++) value = (value << 8) | src[i];
+
+  return value;
+}
+
+void pg_fail(PgConn_t *conn, PgStatus_t code, const char *message) {
+  conn->status = code;
+  conn->sqlstate[0] = '\0';
+  snprintf(conn->message, sizeof(conn->message), "%s", message);
+}
+
+int pg_send_all(int fd, const void *data, size_t len) {
+  const unsigned char *p = data;
+
+  while (len > 0) {
+    ssize_t n = send(fd, p, len, MSG_NOSIGNAL);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    p += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+int pg_send_message(PgConn_t *conn, char type, const void *payload, size_t len) {
+  unsigned char small[BUF_LEN];
+  unsigned char header[5];
+  int status;
+
+  header[0] = (unsigned char)type;
+  pg_put_be(header + 1, len + 4, 4);
+  // short messages go out in one segment
+  if (len + sizeof(header) <= sizeof(small)) {
+    memcpy(small, header, sizeof(header));
+    if (len) memcpy(small + sizeof(header), payload, len);
+    status = pg_send_all(conn->fd, small, len + sizeof(header));
+  } else {
+    status = pg_send_all(conn->fd, header, sizeof(header));
+    if (status == 0) status = pg_send_all(conn->fd, payload, len);
+  }
+  if (status != 0) pg_fail(conn, PG_CONNECT_ERROR, errno ? strerror(errno) : "server closed the connection");
+
+  return status;
+}
+
+/* one recv of at most @len bytes; the byte count, or -1 with the connection failed */
+ssize_t pg_recv(PgConn_t *conn, void *dst, size_t len) {
+  for (;;) {
+    ssize_t n = recv(conn->fd, dst, len, 0);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) {
+      pg_fail(conn, PG_CONNECT_ERROR, n == 0 ? "server closed the connection"
+        : errno == EAGAIN || errno == EWOULDBLOCK ? "timed out waiting for the server" : strerror(errno));
+
+      return -1;
+    }
+
+    return n;
+  }
+}
+
+/* grows the receive buffer to hold @need bytes from buf_start, moving them to its front when short */
+int pg_make_room(PgConn_t *conn, size_t need) {
+  if (need > conn->buf_cap) {
+    size_t cap = conn->buf_cap;
+    unsigned char *grown;
+
+    while (cap < need) cap *= 2;
+    grown = realloc(conn->buf, cap);
+    if (!grown) {
+      pg_fail(conn, PG_MEMORY_ERROR, "Failed to grow the receive buffer!");
+
+      return -1;
+    }
+    conn->buf = grown;
+    conn->buf_cap = cap;
+  }
+  if (conn->buf_start + need > conn->buf_cap) {
+    memmove(conn->buf, conn->buf + conn->buf_start, conn->buf_end - conn->buf_start);
+    conn->buf_end -= conn->buf_start;
+    conn->buf_start = 0;
+  }
+
+  return 0;
+}
+
+/* makes sure @need bytes from buf_start are in the receive buffer */
+int pg_fill(PgConn_t *conn, size_t need) {
+  if (conn->buf_end - conn->buf_start >= need) return 0;
+  if (pg_make_room(conn, need) != 0) return -1;
+  while (conn->buf_end - conn->buf_start < need) {
+    ssize_t n = pg_recv(conn, conn->buf + conn->buf_end, conn->buf_cap - conn->buf_end);
+
+    if (n < 0) return -1;
+    conn->buf_end += (size_t)n;
+  }
+
+  return 0;
+}
+
+/* puts @len bytes read past a direct COPY back in front of the receive buffer */
+int pg_unread(PgConn_t *conn, const unsigned char *data, size_t len) {
+  size_t held = conn->buf_end - conn->buf_start;
+
+  if (len == 0) return 0;
+  if (conn->buf_start < len) {
+    if (pg_make_room(conn, held + len) != 0) return -1;
+    memmove(conn->buf + len, conn->buf + conn->buf_start, held);
+    conn->buf_start = len;
+    conn->buf_end = len + held;
+  }
+  conn->buf_start -= len;
+  memcpy(conn->buf + conn->buf_start, data, len);
+
+  return 0;
+}
+
+int pg_read_message(PgConn_t *conn, char *type, const unsigned char **payload, size_t *len) {
+  uint64_t message_len;
+
+  if (pg_fill(conn, 5) != 0) return -1;
+  message_len = pg_get_be(conn->buf + conn->buf_start + 1, 4);
+  if (message_len < 4 || message_len > PG_MAX_MESSAGE_LEN) {
+    pg_fail(conn, PG_PROTOCOL_ERROR, "invalid message length from the server");
+
+    return -1;
+  }
+  if (pg_fill(conn, 1 + (size_t)message_len) != 0) return -1;
+  *type = (char)conn->buf[conn->buf_start];
+  *payload = conn->buf + conn->buf_start + 5;
+  *len = (size_t)message_len - 4;
+  conn->buf_start += 1 + (size_t)message_len;
+  if (conn->buf_start == conn->buf_end) conn->buf_start = conn->buf_end = 0;
+
+  return 0;
+}
+
+/* takes the SQLSTATE and message out of an ErrorResponse */
+void pg_take_error(PgConn_t *conn, PgStatus_t code, const unsigned char *payload, size_t len) {
+  const char *p = (const char *)payload, *end = (const char *)payload + len;
+  const char *text = "unknown server error";
+
+  conn->status = code;
+  conn->sqlstate[0] = '\0';
+  while (p < end && *p) {
+    char field = *p++;
+    size_t n = strnlen(p, (size_t)(end - p));
+
+    if (n == (size_t)(end - p)) break;
+    if (field == 'M') text = p;
+    if (field == 'C') snprintf(conn->sqlstate, sizeof(conn->sqlstate), "%s", p);
+    p += n + 1;
+  }
+  snprintf(conn->message, sizeof(conn->message), "%s", text);
+}
+
+/* lowercase hex MD5 of @a followed by @b, as the server's "md5" method wants */
+void pg_md5_hex(const void *a, size_t a_len, const void *b, size_t b_len, char *hex) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int digest_len = 0;
+  EVP_MD_CTX *md = EVP_MD_CTX_new();
+
+  if (md) {
+    EVP_DigestInit_ex(md, EVP_md5(), NULL);
+    EVP_DigestUpdate(md, a, a_len);
+    EVP_DigestUpdate(md, b, b_len);
+    EVP_DigestFinal_ex(md, digest, &digest_len);
+    EVP_MD_CTX_free(md);
+  }
+  for (unsigned int i = 0; i < digest_len; i++) snprintf(hex + 2 * i, 3, "%02x", digest[i]);
+  hex[2 * digest_len] = '\0';
+}
+
+int pg_auth_md5(PgConn_t *conn, const PgUri_t *uri, const unsigned char *salt) {
+  char inner[2 * EVP_MAX_MD_SIZE + 1], outer[3 + 2 * EVP_MAX_MD_SIZE + 1];
+
+  pg_md5_hex(uri->password, strlen(uri->password), uri->user, strlen(uri->user), inner);
+  memcpy(outer, "md5", 3);
+  pg_md5_hex(inner, strlen(inner), salt, 4, outer + 3);
+
+  return pg_send_message(conn, 'p', outer, strlen(outer) + 1);
+}
+
+int pg_scram_first(PgConn_t *conn, PgScram_t *scram, const unsigned char *mechanisms, size_t len) {
+  unsigned char raw[PG_SCRAM_NONCE_LEN], message[BUF_LEN];
+  const char *p = (const char *)mechanisms, *end = (const char *)mechanisms + len;
+  bool offered = false;
+  size_t first_len, pos;
+
+  while (p < end && *p && !offered) {
+    offered = strncmp(p, "SCRAM-SHA-256", (size_t)(end - p)) == 0;
+    p += strnlen(p, (size_t)(end - p)) + 1;
+  }
+  if (!offered) {
+    pg_fail(conn, PG_AUTH_ERROR, "server offers no SASL mechanism this client supports");
+
+    return -1;
+  }
+  if (RAND_bytes(raw, sizeof(raw)) != 1) {
+    pg_fail(conn, PG_AUTH_ERROR, "no randomness for the SCRAM nonce");
+
+    return -1;
+  }
+  EVP_EncodeBlock((unsigned char *)scram->nonce, raw, sizeof(raw));
+  // the user name travels in the startup message, the server ignores this one
+  snprintf(scram->client_first_bare, sizeof(scram->client_first_bare), "n=,r=%s", scram->nonce);
+
+  pos = (size_t)snprintf((char *)message, sizeof(message), "SCRAM-SHA-256") + 1;
+  first_len = (size_t)snprintf((char *)message + pos + 4, sizeof(message) - pos - 4, "n,,%s", scram->client_first_bare);
+  pg_put_be(message + pos, first_len, 4);
+
+  return pg_send_message(conn, 'p', message, pos + 4 + first_len);
+}
+
+/* answers the server-first-message with the client proof */
+int pg_scram_final(PgConn_t *conn, PgScram_t *scram, const PgUri_t *uri, const unsigned char *payload, size_t len) {
+  char server_first[BUF_LEN], without_proof[BUF_LEN], auth_message[BUF_LEN * 3], final[BUF_LEN * 2];
+  char proof_b64[BUF_LEN_XS];
+  unsigned char salt[BUF_LEN_S], salted[SHA256_DIGEST_LENGTH], client_key[SHA256_DIGEST_LENGTH];
+  unsigned char stored_key[SHA256_DIGEST_LENGTH], signature[SHA256_DIGEST_LENGTH], server_key[SHA256_DIGEST_LENGTH];
+  unsigned int md_len = 0;
+  const char *nonce, *salt_b64, *iter;
+  size_t nonce_len, salt_b64_len;
+  int salt_len, iterations, status = -1;
+
+  if (len >= sizeof(server_first)) {
+    pg_fail(conn, PG_AUTH_ERROR, "SCRAM server-first-message too long");
+
+    return -1;
+  }
+  memcpy(server_first, payload, len);
+  server_first[len] = '\0';
+  nonce = strstr(server_first, "r=");
+  salt_b64 = strstr(server_first, ",s=");
+  iter = strstr(server_first, ",i=");
+  if (nonce != server_first || !salt_b64 || !iter || iter < salt_b64) {
+    pg_fail(conn, PG_AUTH_ERROR, "malformed SCRAM server-first-message");
+
+    return -1;
+  }
+  nonce += 2;
+  nonce_len = (size_t)(salt_b64 - nonce);
+  salt_b64 += 3;
+  salt_b64_len = (size_t)(iter - salt_b64);
+  iterations = atoi(iter + 3);
+  if (strncmp(nonce, scram->nonce, strlen(scram->nonce)) != 0 || nonce_len <= strlen(scram->nonce)
+    || salt_b64_len == 0 || salt_b64_len % 4 != 0 || salt_b64_len / 4 * 3 > sizeof(salt) || iterations <= 0) {
+    pg_fail(conn, PG_AUTH_ERROR, "SCRAM server-first-message does not match this client");
+
+    return -1;
+  }
+  salt_len = EVP_DecodeBlock(salt, (const unsigned char *)salt_b64, (int)salt_b64_len);
+  for (size_t i = salt_b64_len; salt_len > 0 && i > 0 && salt_b64[i - 1] == '='; i--) salt_len--;
+  if (salt_len <= 0) {
+    pg_fail(conn, PG_AUTH_ERROR, "SCRAM salt is not base64");
+
+    return -1;
+  }
+
+  snprintf(without_proof, sizeof(without_proof), "c=biws,r=%.*s", (int)nonce_len, nonce);
+  snprintf(auth_message, sizeof(auth_message), "%s,%s,%s", scram->client_first_bare, server_first, without_proof);
+
+  if (PKCS5_PBKDF2_HMAC(uri->password, (int)strlen(uri->password), salt, salt_len, iterations, EVP_sha256(),
+    sizeof(salted), salted) == 1
+    && HMAC(EVP_sha256(), salted, sizeof(salted), (const unsigned char *)"Client Key", 10, client_key, &md_len)
+    && SHA256(client_key, sizeof(client_key), stored_key)
+    && HMAC(EVP_sha256(), stored_key, sizeof(stored_key), (const unsigned char *)auth_message, strlen(auth_message),
+      signature, &md_len)
+    && HMAC(EVP_sha256(), salted, sizeof(salted), (const unsigned char *)"Server Key", 10, server_key, &md_len)
+    && HMAC(EVP_sha256(), server_key, sizeof(server_key), (const unsigned char *)auth_message, strlen(auth_message),
+      scram->server_signature, &md_len)) {
+    for (size_t i = 0; i < sizeof(client_key); i++) client_key[i] ^= signature[i];
+    EVP_EncodeBlock((unsigned char *)proof_b64, client_key, sizeof(client_key));
+    snprintf(final, sizeof(final), "%s,p=%s", without_proof, proof_b64);
+    status = pg_send_message(conn, 'p', final, strlen(final));
+  } else {
+    pg_fail(conn, PG_AUTH_ERROR, "SCRAM key derivation failed");
+  }
+
+  OPENSSL_cleanse(salted, sizeof(salted));
+  OPENSSL_cleanse(client_key, sizeof(client_key));
+  OPENSSL_cleanse(server_key, sizeof(server_key));
+
+  return status;
+}
+
+int pg_scram_verify(PgConn_t *conn, PgScram_t *scram, const unsigned char *payload, size_t len) {
+  char expected[BUF_LEN_XS];
+
+  EVP_EncodeBlock((unsigned char *)expected + 2, scram->server_signature, sizeof(scram->server_signature));
+  memcpy(expected, "v=", 2);
+  if (len < strlen(expected) || CRYPTO_memcmp(payload, expected, strlen(expected)) != 0) {
+    pg_fail(conn, PG_AUTH_ERROR, "server failed to prove it knows the password");
+
+    return -1;
+  }
+  scram->verified = true;
+
+  return 0;
+}
+
+/**
+ * pg_authenticate - answers the server's authentication requests
+ * @conn: connection after the startup message
+ * @uri: user and password
+ *
+ * Return: 0 once the server sent AuthenticationOk, -1 otherwise
+ **/
+int pg_authenticate(PgConn_t *conn, const PgUri_t *uri) {
+  PgScram_t scram;
+  const unsigned char *payload;
+  char type, message[BUF_LEN_S];
+  size_t len;
+  int status = 0;
+
+  memset(&scram, 0, sizeof(scram));
+  while (status == 0) {
+    uint64_t code;
+
+    if (pg_read_message(conn, &type, &payload, &len) != 0) return -1;
+    if (type == 'E') {
+      pg_take_error(conn, PG_AUTH_ERROR, payload, len);
+
+      return -1;
+    }
+    if (type != 'R' || len < 4) {
+      pg_fail(conn, PG_PROTOCOL_ERROR, "unexpected message during authentication");
+
+      return -1;
+    }
+    code = pg_get_be(payload, 4);
+    // a server that skips the SCRAM final message never proved it knows the password
+    if (code == 0 && scram.nonce[0] && !scram.verified) {
+      pg_fail(conn, PG_AUTH_ERROR, "server ended SCRAM authentication early");
+
+      return -1;
+    }
+    if (code == 0) break;
+    if ((code == 3 || code == 5 || code == 10) && uri->password[0] == '\0') {
+      pg_fail(conn, PG_AUTH_ERROR, "server asks for a password and none is set");
+
+      return -1;
+    }
+    if (code == 3) status = pg_send_message(conn, 'p', uri->password, strlen(uri->password) + 1);
+    else if (code == 5 && len >= 8) status = pg_auth_md5(conn, uri, payload + 4);
+    else if (code == 10) status = pg_scram_first(conn, &scram, payload + 4, len - 4);
+    else if (code == 11 && scram.nonce[0]) status = pg_scram_final(conn, &scram, uri, payload + 4, len - 4);
+    else if (code == 12 && scram.nonce[0]) status = pg_scram_verify(conn, &scram, payload + 4, len - 4);
+    else {
+      snprintf(message, sizeof(message), "unsupported authentication request %lu", (unsigned long)code);
+      pg_fail(conn, PG_AUTH_ERROR, message);
+      status = -1;
+    }
+  }
+
+  return status;
+}
@@ -0,0 +1,339 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/pipeline.h"
+
+
+/**
+ * pipeline_fail - records the first failure of a pipeline
+ * @pipe: the pipeline
+ * @code: failure status
+ * @message: human readable reason
+ *
+ * Later blocks still flow to the sink so that every stage drains,
+ * but they are no longer transformed nor written.
+ **/
+void pipeline_fail(Pipeline_t *pipe, PipelineStatus_t code, const char *message) {
+  pthread_mutex_lock(&pipe->lock);
+  if (pipe->status == PIPELINE_OK) {
+    pipe->status = code;
+    snprintf(pipe->message, sizeof(pipe->message), "%s", message);
+  }
+  pthread_mutex_unlock(&pipe->lock);
+}
+
+bool pipeline_failed(Pipeline_t *pipe) {
+  bool failed;
+
+  pthread_mutex_lock(&pipe->lock);
+  failed = pipe->status != PIPELINE_OK;
+  pthread_mutex_unlock(&pipe->lock);
+
+  return failed;
+}
+
+PipelineStatus_t pipeline_add_stage(Pipeline_t *pipe, const char *name, PipeStageFn_t process,
+  PipeStageReleaseFn_t release, void *ctx, size_t workers) {
+  PipelineStage_t *stage;
+
+  if (pipe->started || pipe->stage_count >= PIPELINE_MAX_STAGES) return PIPELINE_CONFIG_ERROR;
+  pipe->rings[pipe->stage_count + 1] = init_buffer_ring(pipe->buffer_count);
+  if (!pipe->rings[pipe->stage_count + 1]) return PIPELINE_MEMORY_ERROR;
+
+  stage = &pipe->stages[pipe->stage_count];
+  snprintf(stage->name, sizeof(stage->name), "%s", name);
+  stage->process = process;
+  stage->release = release;
+  stage->ctx = ctx;
+  stage->workers = workers ? workers : 1;
+  stage->in = pipe->rings[pipe->stage_count];
+  stage->out = pipe->rings[pipe->stage_count + 1];
+  stage->pipe = pipe;
+  pipe->stage_count++;
+
+  return PIPELINE_OK;
+}
+
+void pipeline_set_sink(Pipeline_t *pipe, PipeSinkFn_t sink, void *ctx) {
+  pipe->sink = sink;
+  pipe->sink_ctx = ctx;
+}
+
+void pipeline_set_sink_flush(Pipeline_t *pipe, PipeSinkFlushFn_t flush) {
+  pipe->sink_flush = flush;
+}
+
+void pipeline_recycle(Pipeline_t *pipe, const PipeBuffer_t *buf) {
+  ring_push(pipe->pool, &pipe->buffers[buf - pipe->buffers]);
+}
+
+/* runs even after a failure, the sink may still hold blocks */
+void pipeline_sink_flush(Pipeline_t *pipe) {
+  if (pipe->sink_flush && pipe->sink_flush(pipe->sink_ctx) != 0) {
+    pipeline_fail(pipe, PIPELINE_IO_ERROR, "Failed to write block to storage!");
+  }
+}
+
+void *pipeline_stage_main(void *arg) {
+  PipelineStage_t *stage = arg;
+  Pipeline_t *pipe = stage->pipe;
+  PipeBuffer_t *buf;
+  size_t self;
+  char message[BUF_LEN_M];
+
+  pthread_mutex_lock(&pipe->lock);
+  self = stage->registered++;
+  pthread_mutex_unlock(&pipe->lock);
+
+  while ((buf = ring_pop(stage->in)) != NULL) {
+    if (!pipeline_failed(pipe) && stage->process(stage->ctx, buf, self) != 0) {
+      snprintf(message, sizeof(message), "%s stage failed on block %llu",
+        stage->name, (unsigned long long)buf->seq);
+      pipeline_fail(pipe, PIPELINE_STAGE_ERROR, message);
+    }
+    ring_push(stage->out, buf);
+  }
+
+  return NULL;
+}
+
+void *pipeline_sink_main(void *arg) {
+  Pipeline_t *pipe = arg;
+  BufferRing_t *in = pipe->rings[pipe->stage_count];
+  PipeBuffer_t **pending = calloc(pipe->buffer_count, sizeof(PipeBuffer_t *));
+  PipeBuffer_t *buf, *ready;
+  uint64_t next = 0;
+  int status;
+
+  if (!pending) {
+    pipeline_fail(pipe, PIPELINE_MEMORY_ERROR, "Failed to allocate sink reorder window!");
+    // still recycle blocks so producers don't wait forever on the pool
+    while ((buf = ring_pop(in)) != NULL) ring_push(pipe->pool, buf);
+
+    return NULL;
+  }
+
+  /*
+   * At most buffer_count blocks are in flight and every block below
+   * `next` has been written, so in-flight sequence numbers are unique
+   * modulo buffer_count.
+   */
+  for (;;) {
+    // the sink pushes out what it holds before sleeping on its input, so also after the last block
+    if ((buf = ring_try_pop(in)) == NULL) {
+      pipeline_sink_flush(pipe);
+      if ((buf = ring_pop(in)) == NULL) break;
+    }
+    pending[buf->seq % pipe->buffer_count] = buf;
+
+    while ((ready = pending[next % pipe->buffer_count]) != NULL && ready->seq == next) {
+      pending[next % pipe->buffer_count] = NULL;
+      status = 0;
+      if (!pipeline_failed(pipe)) {
+        status = pipe->sink ? pipe->sink(pipe->sink_ctx, ready) : 0;
+        if (status != 0 && status != PIPE_SINK_HELD) {
+          pipeline_fail(pipe, PIPELINE_IO_ERROR, "Failed to write block to storage!");
+        } else {
+          pthread_mutex_lock(&pipe->lock);
+          pipe->bytes_out += ready->len;
+          pthread_mutex_unlock(&pipe->lock);
+        }
+      }
+      next++;
+      if (status != PIPE_SINK_HELD) ring_push(pipe->pool, ready);
+    }
+  }
+
+  free(pending);
+
+  return NULL;
+}
+
+PipelineStatus_t pipeline_start(Pipeline_t *pipe) {
+  size_t i, w;
+
+  if (pipe->started) return PIPELINE_CONFIG_ERROR;
+
+  for (i = 0; i < pipe->stage_count; i++) {
+    PipelineStage_t *stage = &pipe->stages[i];
+
+    stage->threads = calloc(stage->workers, sizeof(pthread_t));
+    if (!stage->threads) {
+      pipeline_fail(pipe, PIPELINE_MEMORY_ERROR, "Failed to allocate pipeline stage threads!");
+      break;
+    }
+    for (w = 0; w < stage->workers; w++) {
+      if (pthread_create(&stage->threads[w], NULL, pipeline_stage_main, stage) != 0) break;
+    }
+    // keep whatever started; a stage with zero workers would stall the pipeline
+    stage->workers = w;
+    if (w == 0) {
+      pipeline_fail(pipe, PIPELINE_THREAD_ERROR, "Failed to start pipeline stage!");
+      break;
+    }
+  }
+
+  if (i == pipe->stage_count && pthread_create(&pipe->sink_thread, NULL, pipeline_sink_main, pipe) != 0) {
+    pipeline_fail(pipe, PIPELINE_THREAD_ERROR, "Failed to start pipeline sink!");
+  }
+
+  if (pipeline_failed(pipe)) {
+    // unwind the stages that did start
+    for (size_t s = 0; s < i; s++) {
+      ring_close(pipe->stages[s].in);
+      for (w = 0; w < pipe->stages[s].workers; w++) pthread_join(pipe->stages[s].threads[w], NULL);
+    }
+
+    return pipe->status;
+  }
+
+  pipe->started = true;
+
+  return PIPELINE_OK;
+}
+
+/**
+ * pipeline_acquire - takes a free block from the pool, blocking until
+ * the sink recycles one
+ * @pipe: the pipeline
+ *
+ * Return: an empty block
+ **/
+PipeBuffer_t *pipeline_acquire(Pipeline_t *pipe) {
+  PipeBuffer_t *buf = ring_pop(pipe->pool);
+
+  if (!buf) return NULL;
+  buf->len = 0;
+  buf->raw_len = 0;
+  buf->flags = 0;
+  buf->object_id = 0;
+  buf->check = 0;
+
+  return buf;
+}
+
+PipelineStatus_t pipeline_submit(Pipeline_t *pipe, PipeBuffer_t *buf) {
+  PipelineStatus_t status;
+
+  pthread_mutex_lock(&pipe->lock);
+  buf->seq = pipe->next_seq++;
+  buf->raw_len = buf->len;
+  pipe->bytes_in += buf->len;
+  status = pipe->status;
+  pthread_mutex_unlock(&pipe->lock);
+
+  // a sequence number was taken, so the block must reach the sink even on failure
+  ring_push(pipe->rings[0], buf);
+
+  return status;
+}
+
+PipelineStatus_t pipeline_finish(Pipeline_t *pipe, PipelineError_t **err) {
+  if (pipe->started) {
+    ring_close(pipe->rings[0]);
+    for (size_t i = 0; i < pipe->stage_count; i++) {
+      for (size_t w = 0; w < pipe->stages[i].workers; w++) pthread_join(pipe->stages[i].threads[w], NULL);
+      ring_close(pipe->rings[i + 1]);
+    }
+    pthread_join(pipe->sink_thread, NULL);
+    pipe->started = false;
+  }
+
+  if (pipe->status != PIPELINE_OK && err) *err = create_pipeline_error(pipe->status, pipe->message);
+
+  return pipe->status;
+}
+
+void init_pipe_writer(PipeWriter_t *writer, Pipeline_t *pipe, uint32_t object_id) {
+  writer->pipe = pipe;
+  writer->cur = NULL;
+  writer->object_id = object_id;
+}
+
+/**
+ * pipe_writer_write - appends bytes to the object's current block,
+ * submitting every block that fills up
+ * @writer: the writer
+ * @data: bytes to append
+ * @len: number of bytes
+ *
+ * Return: PipelineStatus_t, non-OK once the pipeline has failed
+ **/
+PipelineStatus_t pipe_writer_write(PipeWriter_t *writer, const void *data, size_t len) {
+  Pipeline_t *pipe = writer->pipe;
+  const unsigned char *src = data;
+  PipelineStatus_t status = PIPELINE_OK;
+
+  while (len > 0) {
+    if (!writer->cur) {
+      writer->cur = pipeline_acquire(pipe);
+      if (!writer->cur) return PIPELINE_MEMORY_ERROR;
+      writer->cur->object_id = writer->object_id;
+    }
+
+    size_t room = pipe->block_size - writer->cur->len;
+    size_t take = len < room ? len : room;
+
+    memcpy(writer->cur->data + writer->cur->len, src, take);
+    writer->cur->len += take;
+    src += take;
+    len -= take;
+
+    if (writer->cur->len == pipe->block_size) {
+      status = pipeline_submit(pipe, writer->cur);
+      writer->cur = NULL;
+      if (status != PIPELINE_OK) return status;
+    }
+  }
+
+  return status;
+}
+
+/**
+ * pipe_writer_reserve - hands out the free tail of the object's current
+ * block, for a producer that reads into it rather than copying
+ * @writer: the writer
+ * @room: written number of free bytes, at least one
+ *
+ * Return: where the next bytes of the object go, NULL once the pipeline
+ * has failed
+ **/
+unsigned char *pipe_writer_reserve(PipeWriter_t *writer, size_t *room) {
+  if (!writer->cur) {
+    writer->cur = pipeline_acquire(writer->pipe);
+    if (!writer->cur) return NULL;
+    writer->cur->object_id = writer->object_id;
+  }
+  *room = writer->pipe->block_size - writer->cur->len;
+
+  return writer->cur->data + writer->cur->len;
+}
+
+/* takes @len bytes written into the reserved tail, submitting the block once it is full */
+PipelineStatus_t pipe_writer_commit(PipeWriter_t *writer, size_t len) {
+  PipelineStatus_t status = PIPELINE_OK;
+
+  if (!writer->cur || len > writer->pipe->block_size - writer->cur->len) return PIPELINE_CONFIG_ERROR;
+  writer->cur->len += len;
+  if (writer->cur->len == writer->pipe->block_size) {
+    status = pipeline_submit(writer->pipe, writer->cur);
+    writer->cur = NULL;
+  }
+
+  return status;
+}
+
+PipelineStatus_t pipe_writer_close(PipeWriter_t *writer) {
+  PipelineStatus_t status;
+
+  if (!writer->cur) {
+    writer->cur = pipeline_acquire(writer->pipe);
+    if (!writer->cur) return PIPELINE_MEMORY_ERROR;
+    writer->cur->object_id = writer->object_id;
+  }
+  writer->cur->flags |= PIPE_BUF_LAST;
+  status = pipeline_submit(writer->pipe, writer->cur);
+  writer->cur = NULL;
+
+  return status;
+}
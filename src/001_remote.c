@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "include/remote.h"
+
+
+bool remote_failed(RemoteUploader_t *up) {
+  bool failed;
+
+  pthread_mutex_lock(&up->lock);
+  failed = up->failed;
+  pthread_mutex_unlock(&up->lock);
+
+  return failed;
+}
+
+void remote_fail(RemoteUploader_t *up, const char *message) {
+  pthread_mutex_lock(&up->lock);
+  if (!up->failed) {
+    up->failed = true;
+    snprintf(up->message, sizeof(up->message), "%s", message);
+  }
+  pthread_mutex_unlock(&up->lock);
+}
+
+int remote_record_etag(RemoteUploader_t *up, uint32_t number, const char *etag) {
+  int status = 0;
+
+  pthread_mutex_lock(&up->lock);
+  if (number > up->etag_capacity) {
+    size_t capacity = up->etag_capacity ? up->etag_capacity : 64;
+    char (*etags)[REMOTE_ETAG_LEN];
+
+    while (capacity < number) capacity *= 2;
+    etags = realloc(up->etags, capacity * sizeof(*etags));
+    if (etags) {
+      memset(etags + up->etag_capacity, 0, (capacity - up->etag_capacity) * sizeof(*etags));
+      up->etags = etags;
+      up->etag_capacity = capacity;
+    }
+  }
+  if (number <= up->etag_capacity) snprintf(up->etags[number - 1], REMOTE_ETAG_LEN, "%s", etag);
+  else status = -1;
+  pthread_mutex_unlock(&up->lock);
+
+  return status;
+}
+
+/**
+ * remote_upload_part - PUTs one part, retrying transient failures
+ * @up: the uploader
+ * @curl: the calling thread's connection
+ * @part: the part, its seq is the part number
+ *
+ * Return: 0 on success, -1 once the part is given up on
+ **/
+int remote_upload_part(RemoteUploader_t *up, void *curl, const PipeBuffer_t *part) {
+  char url[REMOTE_URL_LEN], etag[REMOTE_ETAG_LEN], message[BUF_LEN_M];
+  long status = 0;
+  int rc = -1;
+
+  snprintf(url, sizeof(url), "%s?partNumber=%lu&uploadId=%s", up->url, (unsigned long)part->seq, up->upload_id);
+  for (int attempt = 0; attempt < REMOTE_MAX_ATTEMPTS; attempt++) {
+    if (attempt > 0) {
+      long delay_ms = REMOTE_RETRY_BASE_MS << (attempt - 1);
+      struct timespec delay = { delay_ms / 1000, (delay_ms % 1000) * 1000000L };
+
+      nanosleep(&delay, NULL);
+      __atomic_add_fetch(&up->retries, 1, __ATOMIC_RELAXED);
+    }
+
+    etag[0] = '\0';
+    rc = remote_http(curl, "PUT", url, part->data, part->len, &status, etag, sizeof(etag), NULL, 0);
+    if (rc == 0 && status == 200 && etag[0] != '\0') {
+      __atomic_add_fetch(&up->bytes_sent, part->len, __ATOMIC_RELAXED);
+
+      return remote_record_etag(up, (uint32_t)part->seq, etag);
+    }
+    // anything but a timeout, throttling or a server error will fail the same way again
+    if (rc == 0 && status != 408 && status != 429 && status < 500) break;
+  }
+
+  if (rc != 0) snprintf(message, sizeof(message), "Upload of part %lu to %.400s failed after %d attempts",
+    (unsigned long)part->seq, up->url, REMOTE_MAX_ATTEMPTS);
+  else snprintf(message, sizeof(message), "Upload of part %lu to %.400s failed (HTTP %ld)",
+    (unsigned long)part->seq, up->url, status);
+  remote_fail(up, message);
+
+  return -1;
+}
+
+void *remote_worker_main(void *arg) {
+  RemoteUploader_t *up = arg;
+  void *curl = remote_http_open();
+  PipeBuffer_t *part;
+
+  if (!curl) remote_fail(up, "Failed to open an upload connection!");
+  while ((part = ring_pop(up->queued)) != NULL) {
+    // after a failure, parts are only recycled so the writer never blocks
+    if (curl && !remote_failed(up)) remote_upload_part(up, curl, part);
+    ring_push(up->free_parts, part);
+  }
+  if (curl) remote_http_close(curl);
+
+  return NULL;
+}
+
+/* hands the filled part to the connections and takes a free one */
+int remote_submit_part(RemoteUploader_t *up) {
+  char message[BUF_LEN_M];
+  size_t size;
+
+  if (up->next_part > REMOTE_MAX_PARTS) {
+    snprintf(message, sizeof(message), "Archive needs more than %d upload parts", REMOTE_MAX_PARTS);
+    remote_fail(up, message);
+
+    return -1;
+  }
+  up->cur->seq = up->next_part++;
+  if (!ring_push(up->queued, up->cur)) return -1;
+  up->cur = ring_pop(up->free_parts);
+  if (!up->cur) return -1;
+  up->cur->len = 0;
+
+  size = remote_part_size(up, up->next_part);
+  if (up->cur->capacity < size) {
+    unsigned char *data = realloc(up->cur->data, size);
+
+    if (!data) {
+      remote_fail(up, "Failed to grow upload part!");
+
+      return -1;
+    }
+    up->cur->data = data;
+    up->cur->capacity = size;
+  }
+
+  return 0;
+}
+
+int remote_uploader_write(RemoteUploader_t *up, const unsigned char *data, size_t len) {
+  while (len > 0) {
+    size_t size = remote_part_size(up, up->next_part);
+    size_t n = size - up->cur->len < len ? size - up->cur->len : len;
+
+    if (remote_failed(up)) return -1;
+    memcpy(up->cur->data + up->cur->len, data, n);
+    up->cur->len += n;
+    data += n;
+    len -= n;
+    if (up->cur->len == size && remote_submit_part(up) != 0) return -1;
+  }
+
+  return remote_failed(up) ? -1 : 0;
+}
+
+RemoteStatus_t remote_uploader_finish(RemoteUploader_t *up, RemoteError_t **err) {
+  char url[REMOTE_URL_LEN], response[BUF_LEN], message[BUF_LEN_M];
+  char *body = NULL;
+  size_t body_len = 0, parts;
+  long status = 0;
+  void *curl;
+
+  // S3 wants at least one part, even for an empty archive
+  if (!remote_failed(up) && (up->cur->len > 0 || up->next_part == 1)) remote_submit_part(up);
+  ring_close(up->queued);
+  for (size_t i = 0; i < up->started; i++) pthread_join(up->threads[i], NULL);
+  up->started = 0;
+  if (up->failed) {
+    if (err) *err = create_remote_error(REMOTE_HTTP_ERROR, up->message);
+
+    return REMOTE_HTTP_ERROR;
+  }
+
+  parts = up->next_part - 1;
+  body = malloc(64 + parts * (REMOTE_ETAG_LEN + 64));
+  if (!body) {
+    if (err) *err = create_remote_error(REMOTE_MEMORY_ERROR, "Failed to allocate upload manifest!");
+
+    return REMOTE_MEMORY_ERROR;
+  }
+  body_len = (size_t)sprintf(body, "<CompleteMultipartUpload>");
+  for (size_t i = 0; i < parts; i++) {
+    body_len += (size_t)sprintf(body + body_len, "<Part><PartNumber>%zu</PartNumber><ETag>%s</ETag></Part>",
+      i + 1, up->etags[i]);
+  }
+  body_len += (size_t)sprintf(body + body_len, "</CompleteMultipartUpload>");
+
+  snprintf(url, sizeof(url), "%s?uploadId=%s", up->url, up->upload_id);
+  curl = remote_http_open();
+  response[0] = '\0';
+  // S3 can report a failed completion inside a 200 response
+  if (!curl || remote_http(curl, "POST", url, (unsigned char *)body, body_len, &status, NULL, 0,
+    response, sizeof(response)) != 0 || status != 200 || strstr(response, "<Error>")) {
+    snprintf(message, sizeof(message), "Cannot complete upload to %.400s (HTTP %ld)", up->url, status);
+    if (err) *err = create_remote_error(REMOTE_HTTP_ERROR, message);
+    if (curl) remote_http_close(curl);
+    free(body);
+
+    return REMOTE_HTTP_ERROR;
+  }
+  remote_http_close(curl);
+  free(body);
+  up->completed = true;
+
+  return REMOTE_OK;
+}
@@ -0,0 +1,204 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/restore.h"
+
+typedef struct RestoreTaskArg {
+  RestoreEngine_t   *engine;
+  ArchiveObject_t   *obj;
+  RestoreStep_t     *step;
+} RestoreTaskArg_t;
+
+typedef struct RestoreText {
+  char              *data;
+  size_t            len;
+  size_t            capacity;
+} RestoreText_t;
+
+
+/* largest first */
+int compare_restore_objects(const void *a, const void *b) {
+  const ArchiveObject_t *lhs = *(ArchiveObject_t *const *)a, *rhs = *(ArchiveObject_t *const *)b;
+
+  return (lhs->raw_bytes < rhs->raw_bytes) - (lhs->raw_bytes > rhs->raw_bytes);
+}
+
+void restore_record_failure(RestoreEngine_t *engine, const char *what) {
+  pthread_mutex_lock(&engine->lock);
+  if (engine->failed++ == 0) snprintf(engine->first_failure, sizeof(engine->first_failure), "%s", what);
+  pthread_mutex_unlock(&engine->lock);
+}
+
+void restore_load_task(void *arg, size_t worker_id) {
+  RestoreTaskArg_t *task = arg;
+  RestoreEngine_t *engine = task->engine;
+
+  if (engine->load(engine->reader, task->obj, worker_id, engine->ctx) != 0) {
+    restore_record_failure(engine, task->obj->name);
+
+    return;
+  }
+  pthread_mutex_lock(&engine->lock);
+  engine->tables_loaded++;
+  pthread_mutex_unlock(&engine->lock);
+}
+
+void restore_step_task(void *arg, size_t worker_id) {
+  RestoreTaskArg_t *task = arg;
+  RestoreEngine_t *engine = task->engine;
+
+  if (engine->run_step(task->step, worker_id, engine->ctx) != 0) {
+    restore_record_failure(engine, task->step->sql);
+
+    return;
+  }
+  pthread_mutex_lock(&engine->lock);
+  engine->steps_run++;
+  pthread_mutex_unlock(&engine->lock);
+}
+
+int restore_text_append(void *ctx, const unsigned char *data, size_t len) {
+  RestoreText_t *text = ctx;
+
+  if (text->len + len > RESTORE_MAX_POST_DATA) return -1;
+  if (text->len + len > text->capacity) {
+    size_t capacity = text->capacity ? text->capacity : BUF_LEN;
+    char *grown;
+
+    while (capacity < text->len + len) capacity *= 2;
+    grown = realloc(text->data, capacity);
+    if (!grown) return -1;
+    text->data = grown;
+    text->capacity = capacity;
+  }
+  memcpy(text->data + text->len, data, len);
+  text->len += len;
+
+  return 0;
+}
+
+/* queues the statements stored in the archive's post-data object, if it has one */
+RestoreStatus_t restore_load_post_data(RestoreEngine_t *engine, char *message, size_t len) {
+  ArchiveObject_t *obj = archive_find_object(engine->reader, RESTORE_POST_DATA_OBJECT);
+  ArchiveError_t *archive_err = NULL;
+  RestoreText_t text = { NULL, 0, 0 };
+  RestoreStatus_t status = RESTORE_OK;
+
+  if (!obj) return RESTORE_OK;
+  if (archive_read_object(engine->reader, obj, restore_text_append, &text, &archive_err) != ARCHIVE_OK) {
+    snprintf(message, len, "Cannot read the post-data statements: %s", archive_err ? archive_err->message : "?");
+    status = RESTORE_ARCHIVE_ERROR;
+  } else if (restore_parse_post_data(engine, text.data ? text.data : "", text.len) != 0) {
+    snprintf(message, len, "The post-data statements of %s are cut short", engine->reader->path);
+    status = RESTORE_ARCHIVE_ERROR;
+  }
+  destroy_archive_error(&archive_err);
+  free(text.data);
+
+  return status;
+}
+
+/**
+ * restore_run_tasks - runs @count tasks on the pool and waits for all of
+ * them
+ * @engine: the engine
+ * @run: task function
+ * @tasks: the tasks, queued in order
+ * @count: number of tasks
+ *
+ * Return: 0 once every task ran, -1 if one could not be queued
+ **/
+int restore_run_tasks(RestoreEngine_t *engine, SchedTaskFn_t run, RestoreTaskArg_t *tasks, size_t count) {
+  int status = 0;
+
+  for (size_t i = 0; i < count && status == 0; i++) {
+    if (scheduler_submit(engine->sched, run, &tasks[i]) != SCHED_OK) status = -1;
+  }
+  // queued tasks still reference @tasks, even after a failed submit
+  scheduler_wait(engine->sched);
+
+  return status;
+}
+
+RestoreStatus_t restore_run(RestoreEngine_t *engine, RestoreLoadFn_t load, RestoreStepFn_t run_step, void *ctx,
+  RestoreError_t **err) {
+  static const char *const phase_names[] = { "index", "constraint" };
+  ArchiveIndex_t *index = engine->reader->index;
+  ArchiveObject_t **order = NULL;
+  RestoreTaskArg_t *tasks = NULL;
+  RestoreStatus_t status = RESTORE_OK;
+  char message[BUF_LEN_M] = "";
+  size_t table_count = 0, count;
+
+  if (!engine->sched) engine->sched = init_scheduler(engine->cfg->runtime->thread_count);
+  if (!engine->sched) {
+    if (err) *err = create_restore_error(RESTORE_THREAD_ERROR, "Failed to start worker pool!");
+
+    return RESTORE_THREAD_ERROR;
+  }
+  status = restore_load_post_data(engine, message, sizeof(message));
+  if (status != RESTORE_OK) {
+    if (err) *err = create_restore_error(status, message);
+
+    return status;
+  }
+
+  order = malloc(sizeof(ArchiveObject_t *) * (index->object_count + 1));
+  tasks = malloc(sizeof(RestoreTaskArg_t) * (index->object_count + engine->step_count + 1));
+  if (!order || !tasks) {
+    free(order);
+    free(tasks);
+    if (err) *err = create_restore_error(RESTORE_MEMORY_ERROR, "Failed to allocate restore tasks!");
+
+    return RESTORE_MEMORY_ERROR;
+  }
+  engine->load = load;
+  engine->run_step = run_step;
+  engine->ctx = ctx;
+  engine->failed = 0;
+  engine->tables_loaded = 0;
+  engine->steps_run = 0;
+
+  // largest first, as in engine_run(): the shared queue is taken from in order
+  for (uint32_t i = 0; i < index->object_count; i++) {
+    if (strcmp(index->objects[i].name, RESTORE_POST_DATA_OBJECT) != 0) order[table_count++] = &index->objects[i];
+  }
+  qsort(order, table_count, sizeof(ArchiveObject_t *), compare_restore_objects);
+  for (size_t i = 0; i < table_count; i++) {
+    tasks[i].engine = engine;
+    tasks[i].obj = order[i];
+    tasks[i].step = NULL;
+  }
+  if (restore_run_tasks(engine, restore_load_task, tasks, table_count) != 0) {
+    snprintf(message, sizeof(message), "Failed to queue restore task!");
+    status = RESTORE_MEMORY_ERROR;
+  } else if (engine->failed > 0) {
+    snprintf(message, sizeof(message), "%zu table(s) failed to load, first: %s", engine->failed, engine->first_failure);
+    status = RESTORE_LOAD_ERROR;
+  }
+
+  // indexes over the loaded data, then the foreign keys checked against them
+  for (int phase = RESTORE_STEP_INDEX; status == RESTORE_OK && phase <= RESTORE_STEP_CONSTRAINT; phase++) {
+    count = 0;
+    for (size_t i = 0; i < engine->step_count; i++) {
+      if (engine->steps[i].kind != (RestoreStepKind_t)phase) continue;
+      tasks[count].engine = engine;
+      tasks[count].obj = NULL;
+      tasks[count++].step = &engine->steps[i];
+    }
+    if (restore_run_tasks(engine, restore_step_task, tasks, count) != 0) {
+      snprintf(message, sizeof(message), "Failed to queue restore task!");
+      status = RESTORE_MEMORY_ERROR;
+    } else if (engine->failed > 0) {
+      snprintf(message, sizeof(message), "%zu %s statement(s) failed, first: %s", engine->failed,
+        phase_names[phase], engine->first_failure);
+      status = RESTORE_STEP_ERROR;
+    }
+  }
+
+  free(order);
+  free(tasks);
+  if (status != RESTORE_OK && err) *err = create_restore_error(status, message);
+
+  return status;
+}
@@ -0,0 +1,128 @@
+#include <sched.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include "include/scheduler.h"
+
+int sched_deque_push(SchedDeque_t *dq, SchedTask_t task);
+bool sched_deque_pop(SchedDeque_t *dq, SchedTask_t *out);
+bool sched_deque_steal(SchedDeque_t *dq, SchedTask_t *out);
+
+
+/**
+ * scheduler_current_worker - index of the calling worker thread
+ * @sched: the scheduler
+ *
+ * Return: the worker index, or SCHED_NO_WORKER when called from a thread
+ * that does not belong to @sched
+ **/
+size_t scheduler_current_worker(Scheduler_t *sched) {
+  void *slot = pthread_getspecific(sched->worker_key);
+
+  if (!slot) return SCHED_NO_WORKER;
+
+  return (size_t)(uintptr_t)slot - 1;
+}
+
+bool scheduler_take(Scheduler_t *sched, size_t self, SchedTask_t *task) {
+  size_t n = sched->worker_count;
+
+  if (sched_deque_pop(&sched->deques[self], task)) return true;
+  if (sched_deque_steal(&sched->shared, task)) return true;
+  // start stealing at our right-hand neighbour so thieves fan out
+  for (size_t k = 1; k < n; k++) {
+    if (sched_deque_steal(&sched->deques[(self + k) % n], task)) return true;
+  }
+
+  return false;
+}
+
+void *scheduler_worker_main(void *arg) {
+  Scheduler_t *sched = arg;
+  SchedTask_t task;
+  size_t self;
+
+  pthread_mutex_lock(&sched->lock);
+  self = sched->registered++;
+  pthread_mutex_unlock(&sched->lock);
+  pthread_setspecific(sched->worker_key, (void *)(uintptr_t)(self + 1));
+
+  for (;;) {
+    pthread_mutex_lock(&sched->lock);
+    while (sched->queued == 0 && !sched->shutdown) pthread_cond_wait(&sched->work_cv, &sched->lock);
+    if (sched->queued == 0 && sched->shutdown) {
+      pthread_mutex_unlock(&sched->lock);
+      break;
+    }
+    pthread_mutex_unlock(&sched->lock);
+
+    if (!scheduler_take(sched, self, &task)) {
+      // counted but not in a deque yet, or taken by a sibling that has not counted it off
+      sched_yield();
+      continue;
+    }
+
+    pthread_mutex_lock(&sched->lock);
+    sched->queued--;
+    pthread_mutex_unlock(&sched->lock);
+
+    task.run(task.arg, self);
+
+    pthread_mutex_lock(&sched->lock);
+    sched->pending--;
+    if (sched->pending == 0) pthread_cond_broadcast(&sched->idle_cv);
+    pthread_mutex_unlock(&sched->lock);
+  }
+
+  return NULL;
+}
+
+/**
+ * scheduler_submit - queues a task on the pool
+ * @sched: the scheduler
+ * @run: task body, invoked with @arg and the executing worker index
+ * @arg: opaque task argument, owned by the caller
+ *
+ * Called from a worker, the task goes to that worker's own deque;
+ * otherwise to the shared queue, taken from in submission order.
+ * Return: SchedulerStatus_t
+ **/
+SchedulerStatus_t scheduler_submit(Scheduler_t *sched, SchedTaskFn_t run, void *arg) {
+  SchedTask_t task = { .run = run, .arg = arg };
+  size_t target = scheduler_current_worker(sched);
+
+  pthread_mutex_lock(&sched->lock);
+  if (sched->shutdown) {
+    pthread_mutex_unlock(&sched->lock);
+
+    return SCHED_SHUTDOWN;
+  }
+  sched->pending++;
+  pthread_mutex_unlock(&sched->lock);
+
+  if (sched_deque_push(target == SCHED_NO_WORKER ? &sched->shared : &sched->deques[target], task) != 0) {
+    pthread_mutex_lock(&sched->lock);
+    sched->pending--;
+    if (sched->pending == 0) pthread_cond_broadcast(&sched->idle_cv);
+    pthread_mutex_unlock(&sched->lock);
+
+    return SCHED_MEMORY_ERROR;
+  }
+
+  pthread_mutex_lock(&sched->lock);
+  sched->queued++;
+  pthread_cond_signal(&sched->work_cv);
+  pthread_mutex_unlock(&sched->lock);
+
+  return SCHED_OK;
+}
+
+/**
+ * scheduler_wait - blocks until every submitted task, including the
+ * ones spawned by running tasks, has completed
+ * @sched: the scheduler
+ **/
+void scheduler_wait(Scheduler_t *sched) {
+  pthread_mutex_lock(&sched->lock);
+  while (sched->pending > 0) pthread_cond_wait(&sched->idle_cv, &sched->lock);
+  pthread_mutex_unlock(&sched->lock);
+}
@@ -0,0 +1,409 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "include/sqlitedump.h"
+
+
+/* one page record: its number, then the page; 0 on success */
+int sqlitedump_emit(SqliteDump_t *dump, uint32_t pgno, const unsigned char *page) {
+  unsigned char number[4];
+
+  archive_put_le(number, pgno, 4);
+  if (dump->out->write(dump->out->ctx, number, sizeof(number)) != 0
+    || dump->out->write(dump->out->ctx, page, dump->page_size) != 0) {
+    return -1;
+  }
+  dump->pages_copied++;
+
+  return 0;
+}
+
+SqliteDumpStatus_t sqlitedump_write_error(SqliteDumpError_t **err) {
+  if (err) *err = create_sqlitedump_error(SQLITEDUMP_DUMP_ERROR, "Cannot write the database pages");
+
+  return SQLITEDUMP_DUMP_ERROR;
+}
+
+/* re-reads the header under the lock, the copy cannot follow a new page size */
+SqliteDumpStatus_t sqlitedump_refresh(SqliteDump_t *dump, SqliteDumpError_t **err) {
+  uint32_t page_size = dump->page_size;
+  SqliteDumpStatus_t status = sqlitedump_read_header(dump, err);
+  char message[BUF_LEN_M];
+
+  if (status != SQLITEDUMP_OK || dump->page_size == page_size) return status;
+  snprintf(message, sizeof(message), "The page size of %.400s changed during the backup", dump->path);
+  if (err) *err = create_sqlitedump_error(SQLITEDUMP_DUMP_ERROR, message);
+
+  return SQLITEDUMP_DUMP_ERROR;
+}
+
+/* maps at least the first @pages pages, the file holds them while the lock is held */
+SqliteDumpStatus_t sqlitedump_cover(SqliteDump_t *dump, uint32_t pages, SqliteDumpError_t **err) {
+  size_t len = (size_t)pages * dump->page_size;
+
+  if (dump->map_len >= len) return SQLITEDUMP_OK;
+
+  return sqlitedump_map(dump, (size_t)dump->page_count * dump->page_size, err);
+}
+
+SqliteDumpStatus_t sqlitedump_grow(SqliteDump_t *dump, uint32_t pages, SqliteDumpError_t **err) {
+  uint64_t *sums = realloc(dump->sums, (size_t)pages * sizeof(uint64_t));
+  uint32_t *counters;
+
+  if (sums) dump->sums = sums;
+  counters = sums ? realloc(dump->chunk_counters, (pages / SQLITEDUMP_CHUNK_PAGES + 1) * sizeof(uint32_t)) : NULL;
+  if (!counters) {
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_MEMORY_ERROR, "Failed to allocate the page checksums!");
+
+    return SQLITEDUMP_MEMORY_ERROR;
+  }
+  dump->chunk_counters = counters;
+
+  return SQLITEDUMP_OK;
+}
+
+/* with storage.direct_io, notes which pages of the file are cached before the copy reads any */
+void sqlitedump_probe(SqliteDump_t *dump) {
+  struct stat st;
+
+  if (!dump->cfg->storage || !dump->cfg->storage->direct_io || fstat(dump->fd, &st) != 0) return;
+  pagecache_probe(&dump->cache, dump->fd, NULL, 0, (size_t)st.st_size);
+}
+
+/* evicts pages [@first, @end) again, unless they were cached at the probe */
+void sqlitedump_drop(SqliteDump_t *dump, uint32_t first, uint32_t end) {
+  if (end > first) {
+    pagecache_drop(&dump->cache, dump->map, (uint64_t)first * dump->page_size, (size_t)(end - first) * dump->page_size);
+  }
+}
+
+/* copies SQLITEDUMP_CHUNK_PAGES pages at most from @pgno (0 based), under one SHARED lock */
+SqliteDumpStatus_t sqlitedump_copy_chunk(SqliteDump_t *dump, uint32_t *pgno, bool *done, SqliteDumpError_t **err) {
+  SqliteDumpStatus_t status = sqlitedump_lock(dump, err);
+  uint32_t first, end;
+
+  if (status == SQLITEDUMP_OK) status = sqlitedump_refresh(dump, err);
+  if (status == SQLITEDUMP_OK && *pgno >= dump->page_count) *done = true;
+  if (status != SQLITEDUMP_OK || *done) {
+    sqlitedump_unlock(dump);
+
+    return status;
+  }
+
+  // chunks stay aligned, so a chunk left short at the end is completed at the counter it started at
+  end = *pgno - *pgno % SQLITEDUMP_CHUNK_PAGES + SQLITEDUMP_CHUNK_PAGES;
+  if (end > dump->page_count) end = dump->page_count;
+  status = sqlitedump_grow(dump, end, err);
+  if (status == SQLITEDUMP_OK) status = sqlitedump_cover(dump, end, err);
+  if (status == SQLITEDUMP_OK && *pgno % SQLITEDUMP_CHUNK_PAGES == 0) {
+    dump->chunk_counters[*pgno / SQLITEDUMP_CHUNK_PAGES] = dump->counter;
+  }
+  first = *pgno;
+  for (; status == SQLITEDUMP_OK && *pgno < end; (*pgno)++) {
+    const unsigned char *page = dump->map + (size_t)*pgno * dump->page_size;
+
+    dump->sums[*pgno] = sqlitedump_page_sum(page, dump->page_size);
+    if (sqlitedump_emit(dump, *pgno + 1, page) != 0) status = sqlitedump_write_error(err);
+  }
+  sqlitedump_drop(dump, first, *pgno);
+  sqlitedump_unlock(dump);
+
+  return status;
+}
+
+/**
+ * sqlitedump_copy_rollback - copies a rollback journal mode database
+ * chunk by chunk, then once more whatever changed in between
+ * @dump: the dump, its stream set
+ * @err: written error object on failure
+ *
+ * Return: SqliteDumpStatus_t
+ **/
+SqliteDumpStatus_t sqlitedump_copy_rollback(SqliteDump_t *dump, SqliteDumpError_t **err) {
+  SqliteDumpStatus_t status = SQLITEDUMP_OK;
+  unsigned char end_record[8];
+  uint32_t pgno = 0, stale;
+  bool done = false;
+
+  sqlitedump_probe(dump);
+  while (status == SQLITEDUMP_OK && !done) status = sqlitedump_copy_chunk(dump, &pgno, &done, err);
+  if (status != SQLITEDUMP_OK) return status;
+  dump->pages_read = pgno;
+
+  // the final pass: nothing commits until the end record is out
+  status = sqlitedump_lock(dump, err);
+  if (status == SQLITEDUMP_OK) status = sqlitedump_refresh(dump, err);
+  if (status == SQLITEDUMP_OK) status = sqlitedump_cover(dump, dump->page_count, err);
+  stale = dump->pages_read < dump->page_count ? dump->pages_read : dump->page_count;
+  for (pgno = 0; status == SQLITEDUMP_OK && pgno < dump->page_count; pgno++) {
+    const unsigned char *page = dump->map + (size_t)pgno * dump->page_size;
+
+    if (pgno < stale) {
+      // a chunk read at the final counter saw no commit since
+      if (dump->chunk_counters[pgno / SQLITEDUMP_CHUNK_PAGES] == dump->counter) {
+        pgno |= SQLITEDUMP_CHUNK_PAGES - 1;
+        if (pgno >= stale) pgno = stale - 1;
+        continue;
+      }
+      if (sqlitedump_page_sum(page, dump->page_size) == dump->sums[pgno]) continue;
+    }
+    if (sqlitedump_emit(dump, pgno + 1, page) != 0) status = sqlitedump_write_error(err);
+    else dump->pages_recopied++;
+  }
+  archive_put_le(end_record, 0, 4);
+  archive_put_le(end_record + 4, dump->page_count, 4);
+  if (status == SQLITEDUMP_OK && dump->out->write(dump->out->ctx, end_record, sizeof(end_record)) != 0) {
+    status = sqlitedump_write_error(err);
+  }
+  sqlitedump_drop(dump, 0, dump->page_count);
+  sqlitedump_unlock(dump);
+
+  return status;
+}
+
+/* cumulative WAL checksum of @len bytes (a multiple of 8) from @s */
+void sqlitedump_wal_sum(const unsigned char *data, size_t len, bool big_endian, uint32_t s[2]) {
+  for (size_t i = 0; i < len; i += 8) {
+    uint32_t x0 = big_endian ? sqlitedump_be32(data + i) : (uint32_t)archive_get_le(data + i, 4);
+    uint32_t x1 = big_endian ? sqlitedump_be32(data + i + 4) : (uint32_t)archive_get_le(data + i + 4, 4);
+
+    s[0] += x0 + s[1];
+    s[1] += x1 + s[0];
+  }
+}
+
+/**
+ * sqlitedump_wal_frames - finds the committed frames of a WAL file
+ * @dump: the dump
+ * @wal: the mapped WAL file
+ * @len: its length
+ * @frames: written, per page number, the offset of its newest
+ * committed frame (0 for none); the caller frees it
+ * @max_pgno: written, the length of @frames less one
+ *
+ * Frames count from the WAL header up to the first one whose salts
+ * or checksum do not follow, as SQLite's recovery reads them. A WAL
+ * that does not belong to the database is no WAL at all.
+ * Return: the database size in pages after the last commit, 0 when
+ * no frame is committed, UINT32_MAX when out of memory
+ **/
+uint32_t sqlitedump_wal_frames(const SqliteDump_t *dump, const unsigned char *wal, size_t len, size_t **frames,
+  uint32_t *max_pgno) {
+  size_t frame_len = SQLITE_WAL_FRAME_HEADER_LEN + (size_t)dump->page_size;
+  size_t committed = SQLITE_WAL_HEADER_LEN;
+  uint32_t s[2] = { 0, 0 }, magic, db_size = 0;
+  bool big_endian;
+
+  *frames = NULL;
+  *max_pgno = 0;
+  if (len < SQLITE_WAL_HEADER_LEN) return 0;
+  magic = sqlitedump_be32(wal);
+  big_endian = magic & 1;
+  if ((magic & ~1u) != SQLITE_WAL_MAGIC || sqlitedump_be32(wal + 4) != SQLITE_WAL_VERSION
+    || sqlitedump_be32(wal + 8) != dump->page_size) {
+    return 0;
+  }
+  sqlitedump_wal_sum(wal, 24, big_endian, s);
+  if (s[0] != sqlitedump_be32(wal + 24) || s[1] != sqlitedump_be32(wal + 28)) return 0;
+
+  // first pass: how far the valid frames reach, and the largest page number up to the last commit
+  for (size_t off = SQLITE_WAL_HEADER_LEN; off + frame_len <= len; off += frame_len) {
+    const unsigned char *frame = wal + off;
+    uint32_t pgno = sqlitedump_be32(frame);
+
+    if (pgno == 0 || memcmp(frame + 8, wal + 16, 8) != 0) break;
+    sqlitedump_wal_sum(frame, 8, big_endian, s);
+    sqlitedump_wal_sum(frame + SQLITE_WAL_FRAME_HEADER_LEN, dump->page_size, big_endian, s);
+    if (s[0] != sqlitedump_be32(frame + 16) || s[1] != sqlitedump_be32(frame + 20)) break;
+    if (pgno > *max_pgno) *max_pgno = pgno;
+    if (sqlitedump_be32(frame + 4) != 0) {
+      db_size = sqlitedump_be32(frame + 4);
+      committed = off + frame_len;
+      if (*max_pgno < db_size) *max_pgno = db_size;
+    }
+  }
+  if (committed == SQLITE_WAL_HEADER_LEN) return 0;
+
+  *frames = calloc((size_t)*max_pgno + 1, sizeof(size_t));
+  if (!*frames) return UINT32_MAX;
+  for (size_t off = SQLITE_WAL_HEADER_LEN; off < committed; off += frame_len) (*frames)[sqlitedump_be32(wal + off)] = off;
+
+  return db_size;
+}
+
+/**
+ * sqlitedump_copy_wal - copies a WAL mode database: the file, then
+ * the pages its WAL holds newer copies of
+ * @dump: the dump, its stream set
+ * @err: written error object on failure
+ *
+ * Return: SqliteDumpStatus_t
+ **/
+SqliteDumpStatus_t sqlitedump_copy_wal(SqliteDump_t *dump, SqliteDumpError_t **err) {
+  SqliteDumpStatus_t status = sqlitedump_lock(dump, err);
+  char path[BUF_LEN + 16], message[BUF_LEN_M];
+  const unsigned char *wal = NULL;
+  unsigned char end_record[8];
+  size_t *frames = NULL, wal_len = 0;
+  uint32_t max_pgno = 0, db_size = 0;
+  struct stat st;
+  int wal_fd = -1;
+
+  sqlitedump_probe(dump);
+  if (status == SQLITEDUMP_OK) status = sqlitedump_hold_wal(dump, err);
+  if (status == SQLITEDUMP_OK) status = sqlitedump_refresh(dump, err);
+  if (status == SQLITEDUMP_OK) status = sqlitedump_cover(dump, dump->page_count, err);
+  for (uint32_t pgno = 0; status == SQLITEDUMP_OK && pgno < dump->page_count; pgno++) {
+    if (sqlitedump_emit(dump, pgno + 1, dump->map + (size_t)pgno * dump->page_size) != 0) {
+      status = sqlitedump_write_error(err);
+    }
+    if ((pgno + 1) % SQLITEDUMP_CHUNK_PAGES == 0) sqlitedump_drop(dump, pgno + 1 - SQLITEDUMP_CHUNK_PAGES, pgno + 1);
+  }
+  sqlitedump_drop(dump, dump->page_count - dump->page_count % SQLITEDUMP_CHUNK_PAGES, dump->page_count);
+  dump->pages_read = dump->page_count;
+
+  // no checkpoint and no restart can run, the WAL only grows until the locks go
+  snprintf(path, sizeof(path), "%s-wal", dump->path);
+  if (status == SQLITEDUMP_OK) wal_fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (status == SQLITEDUMP_OK && wal_fd < 0 && errno != ENOENT) {
+    snprintf(message, sizeof(message), "Cannot open %.400s: %s", path, strerror(errno));
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_OPEN_ERROR, message);
+    status = SQLITEDUMP_OPEN_ERROR;
+  }
+  if (wal_fd >= 0 && fstat(wal_fd, &st) == 0 && st.st_size >= SQLITE_WAL_HEADER_LEN) {
+    void *map = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, wal_fd, 0);
+
+    if (map != MAP_FAILED) {
+      wal = map;
+      wal_len = (size_t)st.st_size;
+      madvise(map, wal_len, MADV_SEQUENTIAL);
+      if (dump->cfg->storage && dump->cfg->storage->direct_io) {
+        pagecache_probe(&dump->cache, wal_fd, NULL, 0, wal_len);
+      }
+    } else {
+      snprintf(message, sizeof(message), "Cannot map %.400s: %s", path, strerror(errno));
+      if (err) *err = create_sqlitedump_error(SQLITEDUMP_OPEN_ERROR, message);
+      status = SQLITEDUMP_OPEN_ERROR;
+    }
+  }
+  if (wal) db_size = sqlitedump_wal_frames(dump, wal, wal_len, &frames, &max_pgno);
+  if (db_size == UINT32_MAX) {
+    if (err) *err = create_sqlitedump_error(SQLITEDUMP_MEMORY_ERROR, "Failed to allocate the WAL frame index!");
+    status = SQLITEDUMP_MEMORY_ERROR;
+  }
+  if (db_size == 0) db_size = dump->page_count;
+  for (uint32_t pgno = 1; status == SQLITEDUMP_OK && frames && pgno <= max_pgno && pgno <= db_size; pgno++) {
+    if (!frames[pgno]) continue;
+    if (sqlitedump_emit(dump, pgno, wal + frames[pgno] + SQLITE_WAL_FRAME_HEADER_LEN) != 0) {
+      status = sqlitedump_write_error(err);
+    } else {
+      dump->pages_recopied++;
+    }
+  }
+  archive_put_le(end_record, 0, 4);
+  archive_put_le(end_record + 4, db_size, 4);
+  if (status == SQLITEDUMP_OK && dump->out->write(dump->out->ctx, end_record, sizeof(end_record)) != 0) {
+    status = sqlitedump_write_error(err);
+  }
+
+  free(frames);
+  if (wal) pagecache_drop(&dump->cache, wal, 0, wal_len);
+  if (wal) munmap((void *)wal, wal_len);
+  if (wal_fd >= 0) close(wal_fd);
+  sqlitedump_release_wal(dump);
+  sqlitedump_unlock(dump);
+
+  return status;
+}
+
+SqliteDumpStatus_t sqlitedump_run(SqliteDump_t *dump, const DriverStream_t *out, SqliteDumpError_t **err) {
+  unsigned char header[SQLITEDUMP_MAGIC_LEN + 4];
+
+  dump->out = out;
+  memcpy(header, SQLITEDUMP_MAGIC, SQLITEDUMP_MAGIC_LEN);
+  archive_put_le(header + SQLITEDUMP_MAGIC_LEN, dump->page_size, 4);
+  if (out->write(out->ctx, header, sizeof(header)) != 0) return sqlitedump_write_error(err);
+
+  return dump->wal ? sqlitedump_copy_wal(dump, err) : sqlitedump_copy_rollback(dump, err);
+}
+
+int sqlitedump_driver_open(AppConfig_t *cfg, size_t workers, void **session, char *message, size_t len) {
+  SqliteDumpError_t *err = NULL;
+  int status = SQLITEDUMP_OK;
+
+  // one file, one stream
+  (void)workers;
+  *session = init_sqlitedump(cfg, &err);
+  if (!*session) {
+    status = err ? (int)err->code : SQLITEDUMP_MEMORY_ERROR;
+    snprintf(message, len, "%s", err ? err->message : "Failed to allocate the dump!");
+  }
+  destroy_sqlitedump_error(&err);
+
+  return status;
+}
+
+int sqlitedump_driver_list(void *session, DriverAddFn_t add, void *ctx, char *message, size_t len) {
+  (void)session;
+  if (add(ctx, SQLITEDUMP_OBJECT, 1) == 0) return SQLITEDUMP_OK;
+  snprintf(message, len, "Cannot add the database object");
+
+  return SQLITEDUMP_MEMORY_ERROR;
+}
+
+uint64_t sqlitedump_driver_estimate(void *session, const char *name) {
+  const SqliteDump_t *dump = session;
+
+  (void)name;
+
+  return (uint64_t)dump->page_count * dump->page_size;
+}
+
+int sqlitedump_driver_stream(void *session, const char *name, uint32_t part, size_t worker_id,
+  const DriverStream_t *out, char *message, size_t len) {
+  SqliteDumpError_t *err = NULL;
+  SqliteDumpStatus_t status;
+
+  (void)name, (void)part, (void)worker_id;
+  status = sqlitedump_run(session, out, &err);
+  if (status != SQLITEDUMP_OK) snprintf(message, len, "%s", err ? err->message : "copy failed");
+  destroy_sqlitedump_error(&err);
+
+  return (int)status;
+}
+
+void sqlitedump_driver_close(void *session) {
+  SqliteDump_t *dump = session;
+
+  destroy_sqlitedump(&dump);
+}
+
+const Driver_t sqlitedump_driver = {
+  .abi_version = DRIVER_ABI_VERSION,
+  .name = "sqlite",
+  .supports = sqlitedump_supported,
+  .open = sqlitedump_driver_open,
+  .list = sqlitedump_driver_list,
+  .estimate = sqlitedump_driver_estimate,
+  .stream = sqlitedump_driver_stream,
+  .close = sqlitedump_driver_close
+};
+
+SqliteDumpStatus_t sqlitedump_backup(AppConfig_t *cfg, const char *backup_name, SqliteDumpError_t **err) {
+  DriverError_t *driver_err = NULL;
+  SqliteDumpStatus_t status = SQLITEDUMP_OK;
+
+  if (driver_backup(&sqlitedump_driver, cfg, backup_name, &driver_err) != DRIVER_OK) {
+    status = driver_err && driver_err->driver_code ? (SqliteDumpStatus_t)driver_err->driver_code : SQLITEDUMP_DUMP_ERROR;
+    if (err) *err = create_sqlitedump_error(status, driver_err ? driver_err->message : "backup failed");
+  }
+  destroy_driver_error(&driver_err);
+
+  return status;
+}
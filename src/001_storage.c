@@ -0,0 +1,400 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include "include/codec.h"
+#include "include/storage.h"
+
+
+int storage_write_all(int fd, const unsigned char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+
+    if (n < 0) {
+      if (errno == EINTR) continue;
+
+      return -1;
+    }
+    data += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+int storage_pwrite_all(int fd, const unsigned char *data, size_t len, uint64_t offset) {
+  while (len > 0) {
+    ssize_t n = pwrite(fd, data, len, (off_t)offset);
+
+    if (n < 0) {
+      if (errno == EINTR) continue;
+
+      return -1;
+    }
+    data += n;
+    len -= (size_t)n;
+    offset += (uint64_t)n;
+  }
+
+  return 0;
+}
+
+/**
+ * storage_stage_flush - writes out the direct I/O stage
+ * @sink: the sink
+ * @final: the archive is complete, write the unaligned tail too
+ *
+ * With O_DIRECT only whole STORAGE_DIRECT_ALIGN blocks are written;
+ * the rest moves to the front of the stage.
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int storage_stage_flush(StorageSink_t *sink, bool final) {
+  size_t len = sink->o_direct ? sink->stage_len - sink->stage_len % STORAGE_DIRECT_ALIGN : sink->stage_len;
+  int flags;
+
+  if (len > 0 && storage_pwrite_all(sink->fd, sink->stage, len, sink->stage_offset) != 0) return -1;
+  sink->stage_offset += len;
+  sink->stage_len -= len;
+  memmove(sink->stage, sink->stage + len, sink->stage_len);
+
+  if (final && sink->stage_len > 0) {
+    flags = fcntl(sink->fd, F_GETFL);
+    if (flags < 0 || fcntl(sink->fd, F_SETFL, flags & ~O_DIRECT) != 0) return -1;
+    sink->o_direct = false;
+    sink->behind = sink->stage_offset;
+    if (storage_pwrite_all(sink->fd, sink->stage, sink->stage_len, sink->stage_offset) != 0) return -1;
+    sink->stage_offset += sink->stage_len;
+    sink->stage_len = 0;
+  }
+  if (!sink->o_direct && (final || sink->stage_offset - sink->behind >= PAGECACHE_WRITE_BEHIND)) {
+    pagecache_write_behind(sink->fd, sink->behind, sink->stage_offset);
+    sink->behind = sink->stage_offset;
+  }
+
+  return 0;
+}
+
+int storage_stage_put(StorageSink_t *sink, const unsigned char *data, size_t len) {
+  while (len > 0) {
+    size_t n = STORAGE_DIRECT_STAGE - sink->stage_len < len ? STORAGE_DIRECT_STAGE - sink->stage_len : len;
+
+    memcpy(sink->stage + sink->stage_len, data, n);
+    sink->stage_len += n;
+    data += n;
+    len -= n;
+    if (sink->stage_len == STORAGE_DIRECT_STAGE && storage_stage_flush(sink, false) != 0) return -1;
+  }
+
+  return 0;
+}
+
+int storage_sink_put(StorageSink_t *sink, const unsigned char *data, size_t len) {
+  int status;
+
+  // with blocks in flight the file position means nothing, every byte goes at its offset
+  if (sink->stage) status = storage_stage_put(sink, data, len);
+  else if (sink->uring) status = storage_pwrite_all(sink->fd, data, len, sink->bytes_written);
+  else status = storage_write_all(sink->fd, data, len);
+  if (status != 0) return -1;
+  if (sink->remote && remote_uploader_write(sink->remote, data, len) != 0) return -1;
+  sink->bytes_written += len;
+
+  return 0;
+}
+
+int storage_sink_name_object(StorageSink_t *sink, uint32_t object_id, const char *name) {
+  return sink->index ? archive_index_name_object(sink->index, object_id, name) : 0;
+}
+
+int storage_sink_write(void *ctx, const PipeBuffer_t *buf) {
+  StorageSink_t *sink = ctx;
+  unsigned char header[BUF_LEN_XS];
+  ArchiveFrame_t frame;
+
+  if (sink->dedup) {
+    // blocks reach the chunker as they are: a frame is a range of the stream, whichever chunks hold it
+    frame.object_id = buf->object_id;
+    frame.flags = buf->flags;
+    frame.offset = sink->raw_len + sink->chunk_len;
+    frame.stored_len = (uint32_t)buf->len;
+    frame.raw_len = (uint32_t)buf->len;
+    if (archive_index_add_frame(sink->index, &frame) != 0) return -1;
+
+    return storage_dedup_write(sink, buf->data, buf->len);
+  }
+  if (sink->cipher) {
+    if (!sink->header_written) {
+      if (storage_sink_put(sink, sink->cipher->file_header, CIPHER_FILE_HEADER_LEN) != 0) return -1;
+      sink->header_written = true;
+    }
+    sink->chunks++;
+  } else if (sink->gzip_stream) {
+    if (!sink->header_written) {
+      if (storage_sink_put(sink, header, gzip_stream_header(header, sizeof(header))) != 0) return -1;
+      sink->header_written = true;
+    }
+    sink->crc = gzip_crc_combine(sink->crc, buf->check, buf->raw_len);
+    sink->raw_len += buf->raw_len;
+  }
+
+  frame.object_id = buf->object_id;
+  frame.flags = buf->flags;
+  frame.offset = sink->bytes_written;
+  frame.stored_len = (uint32_t)buf->len;
+  frame.raw_len = (uint32_t)buf->raw_len;
+  if (archive_index_add_frame(sink->index, &frame) != 0) return -1;
+
+  if (sink->uring && buf->len > 0) {
+    if (sink->remote && remote_uploader_write(sink->remote, buf->data, buf->len) != 0) return -1;
+    if (uring_writer_write(sink->uring, buf, sink->bytes_written) != 0) return -1;
+    sink->bytes_written += buf->len;
+
+    return PIPE_SINK_HELD;
+  }
+
+  return storage_sink_put(sink, buf->data, buf->len);
+}
+
+int storage_sink_flush(void *ctx) {
+  StorageSink_t *sink = ctx;
+
+  return uring_writer_flush(sink->uring);
+}
+
+/**
+ * storage_sink_put_index - appends the frame index, wrapped for the
+ * archive's codec, or sealed in its own chunk
+ * @sink: the sink, after the last block and, for gzip, the data trailer
+ * @chunk_len: written length of the index chunk, for encrypted archives
+ *
+ * Return: 0 on success, -1 on failure
+ **/
+int storage_sink_put_index(StorageSink_t *sink, size_t *chunk_len) {
+  unsigned char *index = NULL, *out = NULL;
+  size_t index_len = 0, out_len = 0;
+  int status = -1;
+
+  if (archive_index_encode(sink->index, sink->codec, &index, &index_len) != 0) return -1;
+  if (index_len > ARCHIVE_MAX_INDEX_LEN) {
+    free(index);
+
+    return -1;
+  }
+  if (sink->cipher) {
+    CipherChunk_t chunk = { sink->chunks, CIPHER_CHUNK_INDEX, (uint32_t)index_len, 0 };
+
+    out = malloc(index_len + CIPHER_CHUNK_OVERHEAD);
+    if (out && cipher_seal_chunk(sink->cipher, sink->cipher->workers, &chunk, index, out,
+      index_len + CIPHER_CHUNK_OVERHEAD, &out_len) == 0) {
+      status = storage_sink_put(sink, out, out_len);
+    }
+    sink->chunks++;
+    *chunk_len = out_len;
+  } else if (archive_index_wrap(sink->codec, index, index_len, &out, &out_len) == 0) {
+    status = storage_sink_put(sink, out, out_len);
+  }
+  free(index);
+  free(out);
+
+  return status;
+}
+
+/**
+ * storage_sink_commit - flushes the archive to disk and publishes it
+ * under its final name
+ * @sink: the sink
+ * @err: written error object on failure
+ *
+ * Return: StorageStatus_t
+ **/
+StorageStatus_t storage_sink_commit(StorageSink_t *sink, StorageError_t **err) {
+  char message[BUF_LEN_M];
+  unsigned char framing[BUF_LEN_XS];
+  int status = 0, saved_errno = 0;
+
+  // a finished pipeline has flushed already; this only catches the error
+  if (sink->uring && uring_writer_flush(sink->uring) != 0) {
+    status = -1;
+    saved_errno = errno;
+  } else if (sink->dedup) {
+    status = storage_dedup_finish(sink);
+    if (status == 0) status = storage_sink_put_index(sink, NULL);
+  } else if (sink->cipher) {
+    CipherChunk_t end = { 0, CIPHER_CHUNK_END, 0, 0 };
+    size_t len = 0, index_len = 0;
+
+    if (!sink->header_written) status = storage_sink_put(sink, sink->cipher->file_header, CIPHER_FILE_HEADER_LEN);
+    sink->header_written = true;
+    if (status == 0) status = storage_sink_put_index(sink, &index_len);
+    // the end chunk tells how far back the index chunk starts
+    end.seq = sink->chunks;
+    end.raw_len = (uint32_t)index_len;
+    if (status == 0) status = cipher_seal_chunk(sink->cipher, sink->cipher->workers, &end, NULL, framing, sizeof(framing), &len);
+    if (status == 0) status = storage_sink_put(sink, framing, len);
+  } else {
+    if (sink->gzip_stream) {
+      if (!sink->header_written) status = storage_sink_put(sink, framing, gzip_stream_header(framing, sizeof(framing)));
+      sink->header_written = true;
+      if (status == 0) {
+        status = storage_sink_put(sink, framing, gzip_stream_trailer(framing, sizeof(framing), sink->crc, sink->raw_len));
+      }
+    }
+    if (status == 0) status = storage_sink_put_index(sink, NULL);
+  }
+
+  if (status == 0 && sink->stage) status = storage_stage_flush(sink, true);
+  if (status == 0 && sink->remote) {
+    RemoteError_t *remote_err = NULL;
+
+    if (remote_uploader_finish(sink->remote, &remote_err) != REMOTE_OK) {
+      snprintf(message, sizeof(message), "%s", remote_err ? remote_err->message : "Upload failed");
+      destroy_remote_error(&remote_err);
+      close(sink->fd);
+      sink->fd = -1;
+      if (!sink->stream) unlink(sink->partial_path);
+      if (err) *err = create_storage_error(STORAGE_IO_ERROR, message);
+
+      return STORAGE_IO_ERROR;
+    }
+  }
+
+  if (status == 0) status = fsync(sink->fd);
+  // a pipe or a terminal has nothing to sync
+  if (status != 0 && sink->stream && errno == EINVAL && !saved_errno) status = 0;
+  if (status != 0 && !saved_errno) saved_errno = errno;
+  if (close(sink->fd) != 0 && status == 0) status = -1, saved_errno = errno;
+  sink->fd = -1;
+  if (status != 0) {
+    snprintf(message, sizeof(message), "Cannot flush %.400s: %s", sink->stream ? "stdout" : sink->partial_path,
+      saved_errno ? strerror(saved_errno) : "failed to seal the archive");
+    if (!sink->stream) unlink(sink->partial_path);
+    if (err) *err = create_storage_error(STORAGE_IO_ERROR, message);
+
+    return STORAGE_IO_ERROR;
+  }
+  if (sink->stream) return STORAGE_OK;
+
+  if (rename(sink->partial_path, sink->path) != 0) {
+    snprintf(message, sizeof(message), "Cannot publish %.400s: %s", sink->path, strerror(errno));
+    unlink(sink->partial_path);
+    if (err) *err = create_storage_error(STORAGE_IO_ERROR, message);
+
+    return STORAGE_IO_ERROR;
+  }
+
+  return STORAGE_OK;
+}
+
+Pipeline_t *init_storage_pipeline(AppConfig_t *cfg, StorageSink_t *sink, PipelineError_t **err) {
+  size_t workers = cfg->runtime->thread_count ? cfg->runtime->thread_count : 1;
+  size_t block_size = PIPELINE_DEFAULT_BLOCK_SIZE;
+  size_t buffers = workers * PIPELINE_BUFFERS_PER_WORKER;
+  size_t stage_workers = workers;
+  Pipeline_t *pipe = NULL;
+  CompressStage_t *compress = NULL;
+  CodecSpec_t spec;
+  unsigned char key[CIPHER_KEY_LEN];
+  char message[BUF_LEN_M];
+
+  if (codec_parse_spec(cfg->storage->compression, &spec) != 0) {
+    snprintf(message, sizeof(message), "Unsupported storage compression: %s", cfg->storage->compression);
+    if (err) *err = create_pipeline_error(PIPELINE_CONFIG_ERROR, message);
+
+    return NULL;
+  }
+  if (spec.id != CODEC_NONE && !codec_lookup(spec.id)) {
+    snprintf(message, sizeof(message), "Storage compression %s is not available in this build", cfg->storage->compression);
+    if (err) *err = create_pipeline_error(PIPELINE_CONFIG_ERROR, message);
+
+    return NULL;
+  }
+
+  // chunks are compressed one by one by the chunk store, after deduplication
+  if (sink->dedup) {
+    spec.id = CODEC_NONE;
+    spec.long_window = false;
+  }
+
+  if (spec.long_window) {
+    // a few wide frames at a time, each split across zstd's own workers
+    block_size = ZSTD_LONG_BLOCK_SIZE;
+    buffers = ZSTD_LONG_BUFFERS;
+    stage_workers = 1;
+    spec.workers = workers;
+  }
+
+  pipe = init_pipeline(block_size, buffers);
+  if (!pipe) {
+    if (err) *err = create_pipeline_error(PIPELINE_MEMORY_ERROR, "Failed to allocate pipeline buffers!");
+
+    return NULL;
+  }
+
+  if (spec.id != CODEC_NONE) {
+    compress = init_compress_stage(&spec, stage_workers);
+    if (!compress || pipeline_add_stage(pipe, "compress", compress_stage_process,
+      compress_stage_release, compress, stage_workers) != PIPELINE_OK) {
+      destroy_compress_stage(&compress);
+      if (err) *err = create_pipeline_error(PIPELINE_MEMORY_ERROR, "Failed to set up compression stage!");
+      destroy_pipeline(&pipe);
+
+      return NULL;
+    }
+  }
+
+  if (storage_encryption_enabled(cfg->storage)) {
+    if (cipher_load_key(cfg->storage->encryption_key_path, key, message, sizeof(message)) != 0) {
+      if (err) *err = create_pipeline_error(PIPELINE_CONFIG_ERROR, message);
+      destroy_pipeline(&pipe);
+
+      return NULL;
+    }
+    // every worker seals, even in zstd long mode where compression is a single stage worker
+    sink->cipher = init_cipher_stage(cipher_preferred(), key, spec.id, workers);
+    OPENSSL_cleanse(key, sizeof(key));
+    if (!sink->cipher || pipeline_add_stage(pipe, "encrypt", cipher_stage_process,
+      NULL, sink->cipher, workers) != PIPELINE_OK) {
+      if (err) *err = create_pipeline_error(PIPELINE_MEMORY_ERROR, "Failed to set up encryption stage!");
+      destroy_pipeline(&pipe);
+
+      return NULL;
+    }
+  }
+  // sealed chunks carry the bare deflate blocks; the gzip member framing is for plain archives
+  sink->gzip_stream = spec.id == CODEC_GZIP && !sink->cipher;
+  sink->codec = spec.id;
+
+  if ((sink->stage || sink->stream) && strcmp(cfg->storage->writer, "uring") == 0) {
+    if (err) *err = create_pipeline_error(PIPELINE_CONFIG_ERROR, sink->stream
+      ? "storage.writer uring cannot write to stdout" : "storage.writer uring cannot be combined with direct_io");
+    destroy_pipeline(&pipe);
+
+    return NULL;
+  }
+  // dedup copies blocks into chunks and direct I/O into the stage; stdout may be a pipe, which has no offsets
+  if (!sink->dedup && !sink->stage && !sink->stream && strcmp(cfg->storage->writer, "sync") != 0) {
+    sink->uring = init_uring_writer(sink->fd, pipe, message, sizeof(message));
+    if (!sink->uring && strcmp(cfg->storage->writer, "uring") == 0) {
+      if (err) *err = create_pipeline_error(PIPELINE_CONFIG_ERROR, message);
+      destroy_pipeline(&pipe);
+
+      return NULL;
+    }
+  }
+
+  pipeline_set_sink(pipe, storage_sink_write, sink);
+  if (sink->uring) pipeline_set_sink_flush(pipe, storage_sink_flush);
+  if (pipeline_start(pipe) != PIPELINE_OK) {
+    if (err) *err = create_pipeline_error(pipe->status, pipe->message);
+    destroy_pipeline(&pipe);
+
+    return NULL;
+  }
+
+  return pipe;
+}
@@ -0,0 +1,121 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/treewalk.h"
+
+typedef struct TreeDir {
+  TreeWalk_t        *walk;
+  char              *path;          // relative to the root, "" for the root
+} TreeDir_t;
+
+
+void tree_walk_directory(void *arg, size_t worker_id);
+
+/* queues directory @path; 0 on success, the walk failed otherwise */
+int tree_walk_queue(TreeWalk_t *walk, const char *path) {
+  TreeDir_t *dir = malloc(sizeof(TreeDir_t));
+
+  if (dir && (dir->path = strdup(path)) != NULL) {
+    dir->walk = walk;
+    if (scheduler_submit(walk->sched, tree_walk_directory, dir) == SCHED_OK) return 0;
+    free(dir->path);
+  }
+  free(dir);
+  tree_walk_fail(walk, TREEWALK_MEMORY_ERROR, "Failed to queue a directory of the walk!");
+
+  return -1;
+}
+
+/* visits the entries of one batch of getdents64 output; -1 once the walk failed */
+int tree_walk_batch(TreeWalk_t *walk, TreeDir_t *dir, int fd, const char *batch, size_t len, size_t worker_id) {
+  char path[BUF_LEN], message[BUF_LEN_M];
+  struct statx stx;
+  TreeEntry_t entry = { .path = path, .dir_fd = fd, .stx = &stx };
+
+  for (size_t pos = 0; pos < len; ) {
+    const struct dirent64 *ent = (const struct dirent64 *)(const void *)(batch + pos);
+    int visited;
+
+    pos += ent->d_reclen;
+    if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) continue;
+    if (__atomic_load_n(&walk->status, __ATOMIC_ACQUIRE) != TREEWALK_OK) return -1;
+    if ((size_t)snprintf(path, sizeof(path), "%s%s%s", dir->path, dir->path[0] ? "/" : "", ent->d_name)
+      >= sizeof(path)) {
+      snprintf(message, sizeof(message), "Path too long: %.200s/%.200s", dir->path, ent->d_name);
+      tree_walk_fail(walk, TREEWALK_IO_ERROR, message);
+
+      return -1;
+    }
+    // the type alone is in the listing, whatever else is asked for costs a statx
+    if (walk->mask == 0 && ent->d_type != DT_UNKNOWN) {
+      stx.stx_mask = STATX_TYPE;
+      stx.stx_mode = (uint16_t)DTTOIF(ent->d_type);
+    } else if (statx(fd, ent->d_name, AT_SYMLINK_NOFOLLOW | AT_STATX_DONT_SYNC, walk->mask | STATX_TYPE, &stx) != 0) {
+      // dropped since it was listed
+      if (errno == ENOENT) continue;
+      snprintf(message, sizeof(message), "Cannot stat %.400s: %s", path, strerror(errno));
+      tree_walk_fail(walk, TREEWALK_IO_ERROR, message);
+
+      return -1;
+    }
+
+    entry.name = ent->d_name;
+    __atomic_add_fetch(&walk->entries, 1, __ATOMIC_RELAXED);
+    visited = walk->visit(&entry, worker_id, walk->ctx);
+    if (visited < 0) {
+      snprintf(message, sizeof(message), "Walk stopped at %.400s", path);
+      tree_walk_fail(walk, TREEWALK_VISIT_ERROR, message);
+
+      return -1;
+    }
+    if (S_ISDIR(stx.stx_mode) && visited != TREEWALK_SKIP && tree_walk_queue(walk, path) != 0) return -1;
+  }
+
+  return 0;
+}
+
+/* scheduler task: lists one directory, queueing its subdirectories on the calling worker */
+void tree_walk_directory(void *arg, size_t worker_id) {
+  TreeDir_t *dir = arg;
+  TreeWalk_t *walk = dir->walk;
+  char *batch = NULL, message[BUF_LEN_M];
+  ssize_t len = 0;
+  int fd = -1;
+
+  if (__atomic_load_n(&walk->status, __ATOMIC_ACQUIRE) == TREEWALK_OK) {
+    // by path from the root: queued directories hold no descriptors, only running ones do
+    fd = openat(walk->root_fd, dir->path[0] ? dir->path : ".", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    batch = fd >= 0 ? malloc(TREEWALK_BATCH) : NULL;
+    if (fd < 0 && errno != ENOENT) {
+      snprintf(message, sizeof(message), "Cannot open %.400s: %s", dir->path, strerror(errno));
+      tree_walk_fail(walk, TREEWALK_IO_ERROR, message);
+    } else if (fd >= 0 && !batch) {
+      tree_walk_fail(walk, TREEWALK_MEMORY_ERROR, "Failed to allocate a directory batch!");
+    }
+  }
+  while (batch && (len = getdents64(fd, batch, TREEWALK_BATCH)) > 0) {
+    if (tree_walk_batch(walk, dir, fd, batch, (size_t)len, worker_id) != 0) break;
+  }
+  if (batch && len < 0) {
+    snprintf(message, sizeof(message), "Cannot list %.400s: %s", dir->path, strerror(errno));
+    tree_walk_fail(walk, TREEWALK_IO_ERROR, message);
+  }
+  if (batch) __atomic_add_fetch(&walk->directories, 1, __ATOMIC_RELAXED);
+
+  if (fd >= 0) close(fd);
+  free(batch);
+  free(dir->path);
+  free(dir);
+}
+
+TreeWalkStatus_t tree_walk_submit(TreeWalk_t *walk, Scheduler_t *sched) {
+  walk->sched = sched;
+  if (tree_walk_queue(walk, "") != 0) return TREEWALK_MEMORY_ERROR;
+
+  return TREEWALK_OK;
+}
@@ -0,0 +1,190 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include "include/uring.h"
+
+
+/*
+ * Without IORING_SETUP_SQPOLL the kernel only reads the submission
+ * ring inside io_uring_enter, so the tail may be published before the
+ * entry is filled in.
+ */
+struct io_uring_sqe *uring_ring_next_sqe(UringRing_t *ring) {
+  unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+  unsigned tail = *ring->sq_tail;
+  unsigned index = tail & *ring->sq_mask;
+
+  if (tail - head >= ring->entries) return NULL;
+  ring->sq_array[index] = index;
+  memset(&ring->sqes[index], 0, sizeof(struct io_uring_sqe));
+  __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+  return &ring->sqes[index];
+}
+
+int uring_ring_enter(UringRing_t *ring, unsigned to_submit, unsigned min_complete) {
+#ifdef __NR_io_uring_enter
+  for (;;) {
+    long n = syscall(__NR_io_uring_enter, ring->fd, to_submit, min_complete,
+      min_complete ? IORING_ENTER_GETEVENTS : 0, NULL, 0);
+
+    // nothing was submitted when the wait is interrupted
+    if (n >= 0 || errno != EINTR) return (int)n;
+  }
+#else
+  (void)ring, (void)to_submit, (void)min_complete;
+  errno = ENOSYS;
+
+  return -1;
+#endif
+}
+
+/* index of the registered area @buf's payload lies in, -1 when it is none of them */
+int uring_writer_registered(UringWriter_t *writer, const PipeBuffer_t *buf) {
+  size_t i = (size_t)(buf - writer->pipe->buffers);
+
+  if (!writer->fixed) return -1;
+  if (buf->data == writer->registered[2 * i]) return (int)(2 * i);
+  if (buf->data == writer->registered[2 * i + 1]) return (int)(2 * i + 1);
+
+  return -1;
+}
+
+/* prepares the (rest of the) write of buffer @i; the caller made room in the ring */
+void uring_writer_prepare(UringWriter_t *writer, size_t i) {
+  struct io_uring_sqe *sqe = uring_ring_next_sqe(&writer->ring);
+  UringWrite_t *write = &writer->writes[i];
+  int index = uring_writer_registered(writer, write->buf);
+
+  // stages swap data and scratch, so a block is written from either registered area
+  sqe->opcode = index >= 0 ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  sqe->buf_index = index >= 0 ? (uint16_t)index : 0;
+  sqe->fd = writer->fd;
+  sqe->off = write->offset + write->done;
+  sqe->addr = (uint64_t)(uintptr_t)(write->buf->data + write->done);
+  sqe->len = (uint32_t)(write->buf->len - write->done);
+  sqe->user_data = i;
+  writer->queued++;
+}
+
+void uring_writer_release(UringWriter_t *writer, size_t i) {
+  pipeline_recycle(writer->pipe, writer->writes[i].buf);
+  writer->writes[i].buf = NULL;
+}
+
+/**
+ * uring_writer_abandon - gives every held block back after the ring
+ * itself failed; the archive is lost by then
+ * @writer: the writer
+ *
+ * Unsubmitted entries are taken off the ring again. Writes still in
+ * flight are waited for when the ring is torn down.
+ **/
+void uring_writer_abandon(UringWriter_t *writer, int error) {
+  if (!writer->error) writer->error = error;
+  __atomic_store_n(writer->ring.sq_tail, *writer->ring.sq_tail - writer->queued, __ATOMIC_RELEASE);
+  writer->queued = 0;
+  writer->inflight = 0;
+  for (size_t i = 0; i < writer->pipe->buffer_count; i++) {
+    if (writer->writes[i].buf) uring_writer_release(writer, i);
+  }
+}
+
+/* takes every available completion; returns how many */
+unsigned uring_writer_reap(UringWriter_t *writer) {
+  UringRing_t *ring = &writer->ring;
+  unsigned head = *ring->cq_head, tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE), reaped = 0;
+
+  for (; head != tail; head++, reaped++) {
+    struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+    size_t i = (size_t)cqe->user_data;
+    UringWrite_t *write = &writer->writes[i];
+
+    writer->inflight--;
+    if (cqe->res <= 0) {
+      if (!writer->error) writer->error = cqe->res < 0 ? -cqe->res : EIO;
+    } else {
+      write->done += (size_t)cqe->res;
+      // a short write goes on from where it stopped
+      if (write->done < write->buf->len && !writer->error) {
+        uring_writer_prepare(writer, i);
+        continue;
+      }
+    }
+    writer->completed++;
+    uring_writer_release(writer, i);
+  }
+  __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+
+  return reaped;
+}
+
+int uring_writer_submit(UringWriter_t *writer) {
+  while (writer->queued > 0) {
+    int n = uring_ring_enter(&writer->ring, writer->queued, 0);
+
+    if (n < 0) {
+      uring_writer_abandon(writer, errno);
+
+      return -1;
+    }
+    writer->submits++;
+    writer->queued -= (unsigned)n;
+    writer->inflight += (unsigned)n;
+  }
+
+  return 0;
+}
+
+/* waits for at least one completion */
+int uring_writer_wait(UringWriter_t *writer) {
+  if (uring_writer_reap(writer) > 0) return 0;
+  if (uring_ring_enter(&writer->ring, 0, 1) < 0) {
+    uring_writer_abandon(writer, errno);
+
+    return -1;
+  }
+  uring_writer_reap(writer);
+
+  return 0;
+}
+
+int uring_writer_write(UringWriter_t *writer, const PipeBuffer_t *buf, uint64_t offset) {
+  size_t i = (size_t)(buf - writer->pipe->buffers);
+
+  // every write in flight or queued has a completion slot, the ring holds twice as many
+  while (!writer->error && writer->queued + writer->inflight >= writer->ring.entries) {
+    if (writer->queued > 0 ? uring_writer_submit(writer) : uring_writer_wait(writer)) break;
+  }
+  if (writer->error) {
+    errno = writer->error;
+
+    return -1;
+  }
+
+  writer->writes[i].buf = buf;
+  writer->writes[i].offset = offset;
+  writer->writes[i].done = 0;
+  uring_writer_prepare(writer, i);
+  // once queued the block is held, even if this batch then fails
+  if (writer->queued >= URING_SUBMIT_BATCH) uring_writer_submit(writer);
+
+  return 0;
+}
+
+int uring_writer_flush(UringWriter_t *writer) {
+  while (writer->queued > 0 || writer->inflight > 0) {
+    if (writer->queued > 0 ? uring_writer_submit(writer) : uring_writer_wait(writer)) break;
+  }
+  if (writer->error) {
+    errno = writer->error;
+
+    return -1;
+  }
+
+  return 0;
+}
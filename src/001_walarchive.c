@@ -0,0 +1,691 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "include/walarchive.h"
+
+
+/* the server's clock format, microseconds since 2000-01-01 */
+int64_t wal_now(void) {
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+
+  return ((int64_t)ts.tv_sec - PG_EPOCH_UNIX_SECONDS) * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* records the first failure, the stream stops at the next message */
+void wal_archive_fail(WalArchive_t *archive, const char *message) {
+  pthread_mutex_lock(&archive->lock);
+  if (!archive->failed) snprintf(archive->message, sizeof(archive->message), "%s", message);
+  archive->failed = true;
+  pthread_cond_broadcast(&archive->cond);
+  pthread_mutex_unlock(&archive->lock);
+}
+
+bool wal_archive_failed(WalArchive_t *archive) {
+  bool failed;
+
+  pthread_mutex_lock(&archive->lock);
+  failed = archive->failed;
+  pthread_mutex_unlock(&archive->lock);
+
+  return failed;
+}
+
+uint64_t wal_archive_flushed(WalArchive_t *archive) {
+  return __atomic_load_n(&archive->flushed, __ATOMIC_RELAXED);
+}
+
+/* drains a batch that is not kept; its .partial archive goes with the sink */
+void wal_batch_abandon(WalBatch_t **batch) {
+  if (!batch || !*batch) return;
+  WalBatch_t *b = *batch;
+  PipelineError_t *pipe_err = NULL;
+
+  if (b->pipe) pipeline_finish(b->pipe, &pipe_err);
+  destroy_pipeline_error(&pipe_err);
+  destroy_pipeline(&b->pipe);
+  destroy_storage_sink(&b->sink);
+  free(b->entries);
+  free(b);
+  *batch = NULL;
+}
+
+/* sends the whole index to the remote again, it is small next to the batches */
+int wal_index_upload(WalArchive_t *archive, char *message, size_t len) {
+  StorageConfig_t *storage = archive->cfg->storage;
+  RemoteError_t *remote_err = NULL;
+  RemoteUploader_t *up = init_remote_uploader(storage->remote_target, WAL_INDEX_FILE, 1, 0, &remote_err);
+  unsigned char buf[BUF_LEN * 8];
+  off_t at = 0;
+  ssize_t n = 0;
+
+  while (up && (n = pread(archive->index->fd, buf, sizeof(buf), at)) > 0) {
+    if (remote_uploader_write(up, buf, (size_t)n) != 0) break;
+    at += n;
+  }
+  if (up && n == 0 && remote_uploader_finish(up, &remote_err) == REMOTE_OK) {
+    destroy_remote_uploader(&up);
+
+    return 0;
+  }
+  snprintf(message, len, "Cannot upload %s: %s", WAL_INDEX_FILE,
+    remote_err ? remote_err->message : up && up->message[0] ? up->message : "read failed");
+  destroy_remote_error(&remote_err);
+  destroy_remote_uploader(&up);
+
+  return -1;
+}
+
+/* finishes and commits one batch, then indexes its segments; 0 on success */
+int wal_batch_commit(WalArchive_t *archive, WalBatch_t *batch, char *message, size_t len) {
+  PipelineError_t *pipe_err = NULL;
+  StorageError_t *storage_err = NULL;
+  int status = -1;
+
+  if (pipeline_finish(batch->pipe, &pipe_err) != PIPELINE_OK) {
+    snprintf(message, len, "Cannot write %s: %s", batch->name, pipe_err ? pipe_err->message : "?");
+  } else if (storage_sink_commit(batch->sink, &storage_err) != STORAGE_OK) {
+    snprintf(message, len, "Cannot commit %s: %s", batch->name, storage_err ? storage_err->message : "?");
+  } else if (batch->count && wal_index_append(archive->index, batch->entries, batch->count) != 0) {
+    snprintf(message, len, "Cannot append to %s", archive->index->path);
+  } else if (batch->count && remote_enabled(archive->cfg->storage) && wal_index_upload(archive, message, len) != 0) {
+    // the batch is stored, the remote index only lags behind until the next one
+  } else {
+    status = 0;
+  }
+  destroy_pipeline_error(&pipe_err);
+  destroy_storage_error(&storage_err);
+
+  return status;
+}
+
+/* commits queued batches in order, so the index only ever grows at its end */
+void *wal_committer_main(void *arg) {
+  WalArchive_t *archive = arg;
+  char message[BUF_LEN_M];
+
+  pthread_mutex_lock(&archive->lock);
+  for (;;) {
+    WalBatch_t *batch;
+    bool failed;
+
+    while (!archive->queue && !archive->stopping) pthread_cond_wait(&archive->cond, &archive->lock);
+    if (!archive->queue) break;
+    batch = archive->queue;
+    archive->queue = batch->next;
+    failed = archive->failed;
+    pthread_mutex_unlock(&archive->lock);
+
+    // after a failure nothing more is indexed, the next run starts from the gap
+    if (failed) {
+      wal_batch_abandon(&batch);
+    } else if (wal_batch_commit(archive, batch, message, sizeof(message)) != 0) {
+      wal_archive_fail(archive, message);
+      wal_batch_abandon(&batch);
+    } else {
+      if (batch->count) {
+        const WalIndexEntry_t *last = &batch->entries[batch->count - 1];
+
+        __atomic_store_n(&archive->flushed, last->start_lsn + archive->segment_size, __ATOMIC_RELAXED);
+      }
+      destroy_pipeline(&batch->pipe);
+      destroy_storage_sink(&batch->sink);
+      free(batch->entries);
+      free(batch);
+    }
+
+    pthread_mutex_lock(&archive->lock);
+    archive->pending--;
+    pthread_cond_broadcast(&archive->cond);
+  }
+  pthread_mutex_unlock(&archive->lock);
+
+  return NULL;
+}
+
+/* hands the current batch to the committer, waiting while too many are in flight; 0 on success */
+int wal_archive_queue(WalArchive_t *archive) {
+  WalBatch_t *batch = archive->batch, **tail;
+
+  archive->batch = NULL;
+  pthread_mutex_lock(&archive->lock);
+  while (archive->pending >= WAL_ARCHIVE_MAX_PENDING && !archive->failed) {
+    pthread_cond_wait(&archive->cond, &archive->lock);
+  }
+  if (archive->failed) {
+    pthread_mutex_unlock(&archive->lock);
+    wal_batch_abandon(&batch);
+
+    return -1;
+  }
+  for (tail = &archive->queue; *tail; tail = &(*tail)->next);
+  *tail = batch;
+  archive->pending++;
+  pthread_cond_broadcast(&archive->cond);
+  pthread_mutex_unlock(&archive->lock);
+
+  return 0;
+}
+
+/* opens the archive of a new batch, starting at the current position */
+int wal_batch_open(WalArchive_t *archive) {
+  WalBatch_t *batch = calloc(1, sizeof(WalBatch_t));
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  char segment[WAL_SEGMENT_NAME_LEN + 1], message[BUF_LEN_M];
+
+  if (!batch || !(batch->entries = calloc(archive->batch_segments, sizeof(WalIndexEntry_t)))) {
+    free(batch);
+    wal_archive_fail(archive, "Failed to allocate a WAL batch!");
+
+    return -1;
+  }
+  wal_segment_name(archive->timeline, archive->position, archive->segment_size, segment);
+  snprintf(batch->name, sizeof(batch->name), "%s%s", segment, WAL_BATCH_SUFFIX);
+  batch->timeline = archive->timeline;
+  batch->first_lsn = archive->position;
+  batch->sink = init_storage_sink(archive->cfg->storage, batch->name, &storage_err);
+  batch->pipe = batch->sink ? init_storage_pipeline(archive->cfg, batch->sink, &pipe_err) : NULL;
+  if (!batch->pipe) {
+    snprintf(message, sizeof(message), "Cannot open %s: %.200s", batch->name,
+      storage_err ? storage_err->message : pipe_err ? pipe_err->message : "out of memory");
+    wal_archive_fail(archive, message);
+    wal_batch_abandon(&batch);
+  }
+  destroy_storage_error(&storage_err);
+  destroy_pipeline_error(&pipe_err);
+  archive->batch = batch;
+
+  return batch ? 0 : -1;
+}
+
+/* the segment at the current position was received in full */
+int wal_segment_end(WalArchive_t *archive, int64_t time) {
+  WalBatch_t *batch = archive->batch;
+  WalIndexEntry_t *entry = &batch->entries[batch->count];
+  char segment[WAL_SEGMENT_NAME_LEN + 1];
+
+  archive->in_segment = false;
+  entry->start_lsn = archive->position - archive->segment_size;
+  entry->batch_lsn = batch->first_lsn;
+  entry->end_time = time;
+  entry->timeline = archive->timeline;
+  wal_segment_name(entry->timeline, entry->start_lsn, archive->segment_size, segment);
+  if (pipe_writer_close(&archive->writer) != PIPELINE_OK
+    || storage_sink_name_object(batch->sink, (uint32_t)batch->count + 1, segment) != 0) {
+    wal_archive_fail(archive, "Cannot write a WAL segment to its batch");
+
+    return -1;
+  }
+  batch->count++;
+  archive->segments++;
+
+  return batch->count == archive->batch_segments ? wal_archive_queue(archive) : 0;
+}
+
+/**
+ * wal_archive_take - adds WAL received at the current position
+ * @archive: the archive
+ * @data: the WAL
+ * @len: its length
+ * @time: server clock it was sent at
+ *
+ * Return: 0 on success, -1 with the archive failed
+ **/
+int wal_archive_take(WalArchive_t *archive, const unsigned char *data, size_t len, int64_t time) {
+  while (len > 0) {
+    size_t room = archive->segment_size - archive->position % archive->segment_size;
+    size_t take = len < room ? len : room;
+
+    if (!archive->in_segment) {
+      if (!archive->batch && wal_batch_open(archive) != 0) return -1;
+      init_pipe_writer(&archive->writer, archive->batch->pipe, (uint32_t)archive->batch->count + 1);
+      archive->in_segment = true;
+    }
+    if (pipe_writer_write(&archive->writer, data, take) != PIPELINE_OK) {
+      wal_archive_fail(archive, "Cannot write a WAL segment to its batch");
+
+      return -1;
+    }
+    archive->position += take;
+    data += take;
+    len -= take;
+    if (archive->position % archive->segment_size == 0 && wal_segment_end(archive, time) != 0) return -1;
+  }
+
+  return 0;
+}
+
+/* queues the batch being received; a cut segment is kept as <segment>.partial */
+int wal_archive_close_batch(WalArchive_t *archive) {
+  WalBatch_t *batch = archive->batch;
+  char segment[WAL_SEGMENT_NAME_LEN + 1], name[BUF_LEN_XS];
+  bool keep = batch && batch->count > 0;
+
+  if (!batch) return 0;
+  if (archive->in_segment) {
+    archive->in_segment = false;
+    wal_segment_name(archive->timeline, archive->position, archive->segment_size, segment);
+    snprintf(name, sizeof(name), "%s%s", segment, WAL_PARTIAL_SUFFIX);
+    // a dedup archive is a single stream, a cut segment would be restored as part of the whole
+    keep = !archive->cfg->storage->dedup_enabled;
+    if (pipe_writer_close(&archive->writer) != PIPELINE_OK
+      || (keep && storage_sink_name_object(batch->sink, (uint32_t)batch->count + 1, name) != 0)) {
+      wal_archive_fail(archive, "Cannot write a WAL segment to its batch");
+      keep = false;
+    }
+  }
+  if (!keep) {
+    archive->batch = NULL;
+    wal_batch_abandon(&batch);
+
+    return wal_archive_failed(archive) ? -1 : 0;
+  }
+
+  return wal_archive_queue(archive);
+}
+
+/* tells the server what is received and what is archived, when it changed or is asked for; 0 on success */
+int wal_archive_report(WalArchive_t *archive, bool force) {
+  unsigned char message[34];
+  uint64_t flushed = wal_archive_flushed(archive);
+  time_t now = time(NULL);
+
+  if (!force && flushed == archive->reported && now - archive->reported_at < WAL_ARCHIVE_STATUS_SECONDS) return 0;
+  message[0] = 'r';
+  pg_put_be(message + 1, archive->position, 8);
+  pg_put_be(message + 9, flushed, 8);
+  pg_put_be(message + 17, flushed, 8);
+  pg_put_be(message + 25, (uint64_t)wal_now(), 8);
+  message[33] = 0;
+  archive->reported = flushed;
+  archive->reported_at = now;
+
+  return pg_send_message(archive->conn, 'd', message, sizeof(message));
+}
+
+/* sends START_REPLICATION for the current timeline and position; 0 once the server streams */
+int wal_archive_start(WalArchive_t *archive) {
+  const unsigned char *payload;
+  char sql[BUF_LEN_S], type;
+  size_t len;
+
+  snprintf(sql, sizeof(sql), "START_REPLICATION SLOT \"%s\" PHYSICAL %X/%X TIMELINE %u", archive->cfg->db->wal_slot,
+    (unsigned int)(archive->position >> 32), (unsigned int)archive->position, archive->timeline);
+  if (pg_send_message(archive->conn, 'Q', sql, strlen(sql) + 1) != 0) return -1;
+  for (;;) {
+    if (pg_read_message(archive->conn, &type, &payload, &len) != 0) return -1;
+    if (type == 'W') return 0;
+    if (type == 'E') {
+      pg_take_error(archive->conn, PG_QUERY_ERROR, payload, len);
+
+      return -1;
+    }
+  }
+}
+
+/* the text of column @col of a DataRow; 0 on success */
+int wal_row_value(const unsigned char *payload, size_t len, uint16_t col, char *out, size_t out_len) {
+  size_t pos = 2;
+
+  if (len < 2 || col >= pg_get_be(payload, 2)) return -1;
+  for (uint16_t i = 0; pos + 4 <= len; i++) {
+    uint32_t n = (uint32_t)pg_get_be(payload + pos, 4);
+
+    pos += 4;
+    if (n == 0xffffffff) n = 0;
+    if (pos + n > len) return -1;
+    if (i == col) {
+      if (n >= out_len) return -1;
+      memcpy(out, payload + pos, n);
+      out[n] = '\0';
+
+      return 0;
+    }
+    pos += n;
+  }
+
+  return -1;
+}
+
+/**
+ * wal_archive_next_timeline - ends a stream the server finished with
+ * CopyDone and reads where the next timeline starts
+ * @archive: the archive
+ * @timeline: written next timeline, 0 when the server named none
+ * @start: written position it starts at
+ *
+ * Return: 0 on success, -1 with the connection failed
+ **/
+int wal_archive_next_timeline(WalArchive_t *archive, uint32_t *timeline, uint64_t *start) {
+  const unsigned char *payload;
+  char type, text[BUF_LEN_XS];
+  size_t len;
+
+  *timeline = 0;
+  if (pg_send_message(archive->conn, 'c', NULL, 0) != 0) return -1;
+  for (;;) {
+    if (pg_read_message(archive->conn, &type, &payload, &len) != 0) return -1;
+    if (type == 'Z') return 0;
+    if (type == 'E') {
+      pg_take_error(archive->conn, PG_QUERY_ERROR, payload, len);
+
+      return -1;
+    }
+    if (type == 'D' && wal_row_value(payload, len, 0, text, sizeof(text)) == 0) {
+      *timeline = (uint32_t)strtoul(text, NULL, 10);
+      if (wal_row_value(payload, len, 1, text, sizeof(text)) != 0 || wal_parse_lsn(text, start) != 0) *timeline = 0;
+    }
+  }
+}
+
+/**
+ * wal_archive_message - handles one message of the replication stream
+ * @archive: the archive
+ * @type: message type
+ * @payload: message payload
+ * @len: payload length
+ *
+ * Return: 0 to go on, 1 when the timeline ended, -1 on failure
+ **/
+int wal_archive_message(WalArchive_t *archive, char type, const unsigned char *payload, size_t len) {
+  char message[BUF_LEN_M];
+
+  if (type == 'c') return 1;
+  if (type == 'E') {
+    pg_take_error(archive->conn, PG_QUERY_ERROR, payload, len);
+    snprintf(message, sizeof(message), "WAL stream failed: %.400s", archive->conn->message);
+    wal_archive_fail(archive, message);
+
+    return -1;
+  }
+  if (type != 'd' || len < 1) return 0;
+  if (payload[0] == 'k' && len >= 18) return payload[17] && wal_archive_report(archive, true) != 0 ? -1 : 0;
+  if (payload[0] != 'w' || len < 25) return 0;
+  if (pg_get_be(payload + 1, 8) != archive->position) {
+    snprintf(message, sizeof(message), "WAL stream jumped from %X/%X to %X/%X", (unsigned int)(archive->position >> 32),
+      (unsigned int)archive->position, (unsigned int)(pg_get_be(payload + 1, 8) >> 32),
+      (unsigned int)pg_get_be(payload + 1, 8));
+    wal_archive_fail(archive, message);
+
+    return -1;
+  }
+
+  return wal_archive_take(archive, payload + 25, len - 25, (int64_t)pg_get_be(payload + 17, 8));
+}
+
+/* streams until a stop, a failure or the end of a timeline; 1 for the latter */
+int wal_archive_stream(WalArchive_t *archive, const int *stop) {
+  const unsigned char *payload;
+  struct pollfd pfd = { .fd = archive->conn->fd, .events = POLLIN };
+  char type;
+  size_t len;
+
+  while (!__atomic_load_n(stop, __ATOMIC_RELAXED) && !wal_archive_failed(archive)) {
+    int status;
+
+    if (wal_archive_report(archive, false) != 0) return -1;
+    // a whole message may already wait in the receive buffer
+    if (archive->conn->buf_end == archive->conn->buf_start) {
+      status = poll(&pfd, 1, WAL_ARCHIVE_POLL_MS);
+      if (status == 0 || (status < 0 && errno == EINTR)) continue;
+    }
+    if (pg_read_message(archive->conn, &type, &payload, &len) != 0) return -1;
+    status = wal_archive_message(archive, type, payload, len);
+    if (status != 0) return status;
+  }
+
+  return 0;
+}
+
+/* stores the history file of @timeline as an archive of its own, unless it already is; 0 on success */
+int wal_archive_history(WalArchive_t *archive, uint32_t timeline, char *message, size_t len) {
+  StorageConfig_t *storage = archive->cfg->storage;
+  StorageError_t *storage_err = NULL;
+  PipelineError_t *pipe_err = NULL;
+  StorageSink_t *sink = NULL;
+  Pipeline_t *pipe = NULL;
+  PgResult_t *res = NULL;
+  PipeWriter_t writer;
+  const char *content;
+  char name[WAL_HISTORY_NAME_LEN + 1], sql[BUF_LEN_XS], path[BUF_LEN];
+  bool written;
+  int status = -1;
+
+  wal_history_name(timeline, name);
+  snprintf(path, sizeof(path), "%s/%s", storage->output_path, name);
+  if (timeline < 2 || access(path, F_OK) == 0) return 0;
+  snprintf(sql, sizeof(sql), "TIMELINE_HISTORY %u", timeline);
+  if (pg_query(archive->conn, sql, &res) != PG_OK || !res || res->rows != 1
+    || !(content = pg_result_value(res, 0, 1))) {
+    snprintf(message, len, "%s failed: %.400s", sql, archive->conn->message[0] ? archive->conn->message : "no row");
+  } else if (!(sink = init_storage_sink(storage, name, &storage_err))
+    || !(pipe = init_storage_pipeline(archive->cfg, sink, &pipe_err))) {
+    snprintf(message, len, "Cannot open %s: %.200s", name,
+      storage_err ? storage_err->message : pipe_err ? pipe_err->message : "out of memory");
+  } else {
+    init_pipe_writer(&writer, pipe, 1);
+    written = pipe_writer_write(&writer, content, strlen(content)) == PIPELINE_OK;
+    written = pipe_writer_close(&writer) == PIPELINE_OK && written && storage_sink_name_object(sink, 1, name) == 0;
+    if (pipeline_finish(pipe, &pipe_err) != PIPELINE_OK || !written) {
+      snprintf(message, len, "Cannot write %s: %.200s", name, pipe_err ? pipe_err->message : "?");
+    } else if (storage_sink_commit(sink, &storage_err) != STORAGE_OK) {
+      snprintf(message, len, "Cannot commit %s: %.200s", name, storage_err ? storage_err->message : "?");
+    } else {
+      status = 0;
+    }
+  }
+  destroy_pipeline(&pipe);
+  destroy_storage_sink(&sink);
+  destroy_pipeline_error(&pipe_err);
+  destroy_storage_error(&storage_err);
+  destroy_pg_result(&res);
+
+  return status;
+}
+
+WalArchiveStatus_t wal_archive_run(WalArchive_t *archive, const int *stop, WalArchiveError_t **err) {
+  WalArchiveStatus_t status = WAL_ARCHIVE_OK;
+  char message[BUF_LEN_M] = "";
+  int streamed;
+
+  for (;;) {
+    uint32_t timeline;
+    uint64_t start;
+
+    streamed = wal_archive_start(archive) == 0 ? wal_archive_stream(archive, stop) : -1;
+    if (streamed != 1) break;
+
+    // the server switched timelines: carry on from the segment the new one forked in
+    if (wal_archive_next_timeline(archive, &timeline, &start) != 0) {
+      streamed = -1;
+      break;
+    }
+    if (timeline <= archive->timeline) {
+      snprintf(message, sizeof(message), "The server ended timeline %u without naming the next",
+        archive->timeline);
+      status = WAL_ARCHIVE_PROTOCOL_ERROR;
+      break;
+    }
+    if (wal_archive_close_batch(archive) != 0) break;
+    // a recovery reads the history before any segment of the timeline
+    if (wal_archive_history(archive, timeline, message, sizeof(message)) != 0) {
+      status = WAL_ARCHIVE_STORAGE_ERROR;
+      break;
+    }
+    archive->timeline = timeline;
+    archive->position = start - start % archive->segment_size;
+  }
+  if (streamed == -1 && !wal_archive_failed(archive)) {
+    snprintf(message, sizeof(message), "WAL stream failed: %.400s", archive->conn->message);
+    status = WAL_ARCHIVE_CONNECT_ERROR;
+  }
+
+  // whatever was received in full is kept, and waited for
+  wal_archive_close_batch(archive);
+  pthread_mutex_lock(&archive->lock);
+  while (archive->pending > 0) pthread_cond_wait(&archive->cond, &archive->lock);
+  if (archive->failed) {
+    snprintf(message, sizeof(message), "%s", archive->message);
+    status = WAL_ARCHIVE_STORAGE_ERROR;
+  }
+  pthread_mutex_unlock(&archive->lock);
+  if (streamed != -1) wal_archive_report(archive, true);
+
+  if (status != WAL_ARCHIVE_OK && err) *err = create_wal_archive_error(status, message);
+
+  return status;
+}
+
+/* the rows of one replication command, @sql, in @res */
+int wal_archive_show(WalArchive_t *archive, const char *sql, PgResult_t **res, char *message, size_t len) {
+  if (pg_query(archive->conn, sql, res) == PG_OK && *res && (*res)->rows == 1) return 0;
+  snprintf(message, len, "%s failed: %s", sql, archive->conn->message[0] ? archive->conn->message : "no row");
+  destroy_pg_result(res);
+
+  return -1;
+}
+
+/* asks the server for its timeline, position and segment size, and picks where to start from */
+WalArchiveStatus_t wal_archive_identify(WalArchive_t *archive, char *message, size_t len) {
+  PgResult_t *res = NULL;
+  WalArchiveError_t *index_err = NULL;
+  WalIndexEntry_t last;
+  const char *value;
+  char sql[BUF_LEN_S];
+  uint64_t server_lsn = 0;
+  uint32_t server_timeline = 0;
+
+  if (wal_archive_show(archive, "IDENTIFY_SYSTEM", &res, message, len) != 0) return WAL_ARCHIVE_PROTOCOL_ERROR;
+  if ((value = pg_result_value(res, 0, 1)) != NULL) server_timeline = (uint32_t)strtoul(value, NULL, 10);
+  if ((value = pg_result_value(res, 0, 2)) == NULL || wal_parse_lsn(value, &server_lsn) != 0 || !server_timeline) {
+    snprintf(message, len, "IDENTIFY_SYSTEM returned no timeline or position");
+    destroy_pg_result(&res);
+
+    return WAL_ARCHIVE_PROTOCOL_ERROR;
+  }
+  destroy_pg_result(&res);
+  if (wal_archive_show(archive, "SHOW wal_segment_size", &res, message, len) != 0) return WAL_ARCHIVE_PROTOCOL_ERROR;
+  archive->segment_size = (value = pg_result_value(res, 0, 0)) != NULL ? wal_parse_size(value) : 0;
+  destroy_pg_result(&res);
+  if (!archive->segment_size) {
+    snprintf(message, len, "The server reports no valid wal_segment_size");
+
+    return WAL_ARCHIVE_PROTOCOL_ERROR;
+  }
+  // the slot outlives the connection: while the archiver is down the server keeps what it did not flush
+  snprintf(sql, sizeof(sql), "CREATE_REPLICATION_SLOT \"%s\" PHYSICAL RESERVE_WAL", archive->cfg->db->wal_slot);
+  if (pg_query(archive->conn, sql, NULL) != PG_OK && strcmp(archive->conn->sqlstate, "42710") != 0) {
+    snprintf(message, len, "Cannot create slot %s: %.400s", archive->cfg->db->wal_slot, archive->conn->message);
+
+    return WAL_ARCHIVE_PROTOCOL_ERROR;
+  }
+
+  archive->index = wal_index_open(archive->cfg->storage->output_path, archive->segment_size, &index_err);
+  if (!archive->index) {
+    WalArchiveStatus_t code = index_err ? index_err->code : WAL_ARCHIVE_MEMORY_ERROR;
+
+    snprintf(message, len, "%s", index_err ? index_err->message : "Cannot open the WAL index");
+    destroy_wal_archive_error(&index_err);
+
+    return code;
+  }
+  // an archive carries on after its last segment, a new one from the segment the server is on
+  if (archive->index->count == 0) {
+    archive->timeline = server_timeline;
+    archive->position = server_lsn - server_lsn % archive->segment_size;
+  } else if (wal_index_read(archive->index, archive->index->count - 1, &last) == 0) {
+    archive->timeline = last.timeline;
+    archive->position = last.start_lsn + archive->segment_size;
+  } else {
+    snprintf(message, len, "Cannot read the end of %s", archive->index->path);
+
+    return WAL_ARCHIVE_CORRUPT_ERROR;
+  }
+  archive->flushed = archive->position;
+  if (wal_archive_history(archive, server_timeline, message, len) != 0) return WAL_ARCHIVE_STORAGE_ERROR;
+
+  return WAL_ARCHIVE_OK;
+}
+
+WalArchive_t *init_wal_archive(AppConfig_t *cfg, WalArchiveError_t **err) {
+  WalArchive_t *archive = calloc(1, sizeof(WalArchive_t));
+  WalArchiveStatus_t status;
+  PgError_t *pg_err = NULL;
+  char uri[BUF_LEN], message[BUF_LEN_M];
+
+  if (!archive) {
+    if (err) *err = create_wal_archive_error(WAL_ARCHIVE_MEMORY_ERROR, "Failed to allocate the WAL archive!");
+
+    return NULL;
+  }
+  archive->cfg = cfg;
+  archive->batch_segments = cfg->storage->dedup_enabled ? 1 : WAL_ARCHIVE_BATCH_SEGMENTS;
+  pthread_mutex_init(&archive->lock, NULL);
+  pthread_cond_init(&archive->cond, NULL);
+
+  if (storage_to_stdout(cfg->storage)) {
+    if (err) *err = create_wal_archive_error(WAL_ARCHIVE_CONFIG_ERROR, "The WAL archive keeps its batches and index "
+      "in a directory, storage.output_path cannot be -");
+    destroy_wal_archive(&archive);
+
+    return NULL;
+  }
+  // a WAL sender rather than a normal backend, unless the URI already asks for one
+  if (strstr(cfg->db->uri, "replication=")) snprintf(uri, sizeof(uri), "%s", cfg->db->uri);
+  else snprintf(uri, sizeof(uri), "%s%creplication=true", cfg->db->uri, strchr(cfg->db->uri, '?') ? '&' : '?');
+  archive->conn = pg_connect(uri, cfg->db->timeout_seconds, &pg_err);
+  if (!archive->conn) {
+    snprintf(message, sizeof(message), "%s", pg_err ? pg_err->message : "Cannot connect");
+    status = pg_err && pg_err->code == PG_CONFIG_ERROR ? WAL_ARCHIVE_CONFIG_ERROR : WAL_ARCHIVE_CONNECT_ERROR;
+    destroy_pg_error(&pg_err);
+  } else {
+    status = wal_archive_identify(archive, message, sizeof(message));
+  }
+  if (status == WAL_ARCHIVE_OK && pthread_create(&archive->committer, NULL, wal_committer_main, archive) != 0) {
+    snprintf(message, sizeof(message), "Cannot start the WAL committer");
+    status = WAL_ARCHIVE_MEMORY_ERROR;
+  }
+  if (status != WAL_ARCHIVE_OK) {
+    if (err) *err = create_wal_archive_error(status, message);
+    destroy_wal_archive(&archive);
+
+    return NULL;
+  }
+  archive->started = true;
+
+  return archive;
+}
+
+void destroy_wal_archive(WalArchive_t **archive) {
+  if (!archive || !*archive) return;
+  WalArchive_t *a = *archive;
+
+  if (a->started) {
+    pthread_mutex_lock(&a->lock);
+    a->stopping = true;
+    pthread_cond_broadcast(&a->cond);
+    pthread_mutex_unlock(&a->lock);
+    pthread_join(a->committer, NULL);
+  }
+  if (a->in_segment) pipe_writer_close(&a->writer);
+  wal_batch_abandon(&a->batch);
+  while (a->queue) {
+    WalBatch_t *batch = a->queue;
+
+    a->queue = batch->next;
+    wal_batch_abandon(&batch);
+  }
+  destroy_wal_index(&a->index);
+  destroy_pg_conn(&a->conn);
+  pthread_cond_destroy(&a->cond);
+  pthread_mutex_destroy(&a->lock);
+  free(a);
+  *archive = NULL;
+}
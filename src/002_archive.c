@@ -0,0 +1,427 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include "include/archive.h"
+#include "include/chunkstore.h"
+#include "include/storage.h"
+
+
+int archive_pread_full(int fd, unsigned char *dst, size_t len, uint64_t offset) {
+  size_t have = 0;
+
+  while (have < len) {
+    ssize_t n = pread(fd, dst + have, len - have, (off_t)(offset + have));
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    have += (size_t)n;
+  }
+
+  return 0;
+}
+
+int archive_write_full(int fd, const unsigned char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    data += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+/* finds the index of an unencrypted archive from its last bytes; returns where the data ends */
+ArchiveStatus_t archive_load_plain_index(ArchiveReader_t *r, uint64_t *data_end, char *message, size_t len) {
+  unsigned char tail[ARCHIVE_FOOTER_LEN + ARCHIVE_GZIP_TRAILER_LEN], *wrapped = NULL, *index = NULL;
+  size_t tail_len = r->size < sizeof(tail) ? (size_t)r->size : sizeof(tail);
+  size_t magic_len = strlen(ARCHIVE_INDEX_MAGIC), index_len = 0, wrapped_len = 0, pieces;
+  const unsigned char *footer = NULL;
+  bool gzip = false;
+
+  if (archive_pread_full(r->fd, tail, tail_len, r->size - tail_len) != 0) {
+    snprintf(message, len, "Cannot read %s: %s", r->path, strerror(errno));
+
+    return ARCHIVE_IO_ERROR;
+  }
+  // the footer ends the file, or the last empty gzip member carrying it
+  if (tail_len >= ARCHIVE_FOOTER_LEN
+    && memcmp(tail + tail_len - 1 - magic_len, ARCHIVE_INDEX_MAGIC, magic_len) == 0) {
+    footer = tail + tail_len - ARCHIVE_FOOTER_LEN;
+  } else if (tail_len == sizeof(tail)
+    && memcmp(tail + ARCHIVE_FOOTER_LEN - 1 - magic_len, ARCHIVE_INDEX_MAGIC, magic_len) == 0) {
+    footer = tail;
+    gzip = true;
+  }
+  if (footer) index_len = (size_t)archive_get_le(footer + 20, 8);
+  pieces = (index_len + ARCHIVE_GZIP_PIECE_LEN - 1) / ARCHIVE_GZIP_PIECE_LEN;
+  wrapped_len = gzip ? index_len + pieces * ARCHIVE_GZIP_MEMBER_OVERHEAD : index_len;
+  if (!footer || index_len < ARCHIVE_FOOTER_LEN || index_len > ARCHIVE_MAX_INDEX_LEN || wrapped_len > r->size) {
+    snprintf(message, len, "%s has no archive index", r->path);
+
+    return ARCHIVE_FORMAT_ERROR;
+  }
+
+  wrapped = malloc(wrapped_len);
+  index = malloc(index_len);
+  if (!wrapped || !index) {
+    free(wrapped);
+    free(index);
+    snprintf(message, len, "Failed to allocate archive index!");
+
+    return ARCHIVE_MEMORY_ERROR;
+  }
+  if (archive_pread_full(r->fd, wrapped, wrapped_len, r->size - wrapped_len) == 0
+    && archive_index_unwrap(wrapped, wrapped_len, index_len, gzip, index) == 0) {
+    r->index = archive_index_decode(index, index_len, &r->codec);
+  }
+  *data_end = r->size - wrapped_len;
+  free(wrapped);
+  free(index);
+  if (r->index && (r->codec == CODEC_ZSTD || r->codec == CODEC_LZ4)) {
+    unsigned char skippable[ARCHIVE_SKIPPABLE_HEADER_LEN];
+
+    if (*data_end < sizeof(skippable)
+      || archive_pread_full(r->fd, skippable, sizeof(skippable), *data_end - sizeof(skippable)) != 0
+      || archive_get_le(skippable, 4) != ARCHIVE_SKIPPABLE_MAGIC || archive_get_le(skippable + 4, 4) != index_len) {
+      destroy_archive_index(&r->index);
+    }
+    *data_end -= sizeof(skippable);
+  }
+  if (!r->index || gzip != (r->codec == CODEC_GZIP)) {
+    snprintf(message, len, "The index of %s is damaged", r->path);
+
+    return ARCHIVE_FORMAT_ERROR;
+  }
+
+  return ARCHIVE_OK;
+}
+
+/* unwraps the data key of an encrypted archive and opens its index chunk, named by the end chunk */
+ArchiveStatus_t archive_load_sealed_index(ArchiveReader_t *r, const StorageConfig_t *cfg, uint64_t *data_end,
+  char *message, size_t len) {
+  unsigned char master[CIPHER_KEY_LEN], end[CIPHER_CHUNK_OVERHEAD], empty[1], *sealed = NULL, *index = NULL;
+  CipherChunk_t end_chunk, index_chunk;
+  CipherId_t id;
+  CodecId_t codec;
+  size_t consumed = 0, sealed_len;
+
+  if (cipher_parse_file_header(r->file_header, CIPHER_FILE_HEADER_LEN, &id, &r->codec) != 0) {
+    snprintf(message, len, "%s has an unknown file header", r->path);
+
+    return ARCHIVE_FORMAT_ERROR;
+  }
+  if (!storage_encryption_enabled(cfg)) {
+    snprintf(message, len, "%s is encrypted, storage.encryption_key_path is needed", r->path);
+
+    return ARCHIVE_KEY_ERROR;
+  }
+  if (cipher_load_key(cfg->encryption_key_path, master, message, len) != 0) return ARCHIVE_KEY_ERROR;
+  if (cipher_unwrap_key(master, r->file_header, r->key) != 0) {
+    OPENSSL_cleanse(master, sizeof(master));
+    snprintf(message, len, "%s is not encrypted with the configured key", r->path);
+
+    return ARCHIVE_KEY_ERROR;
+  }
+  OPENSSL_cleanse(master, sizeof(master));
+
+  if (r->size < CIPHER_FILE_HEADER_LEN + 2 * CIPHER_CHUNK_OVERHEAD
+    || archive_pread_full(r->fd, end, sizeof(end), r->size - sizeof(end)) != 0
+    || cipher_open_chunk(r->key, r->file_header, end, sizeof(end), empty, 0, &end_chunk, &consumed) != 0
+    || !(end_chunk.flags & CIPHER_CHUNK_END) || end_chunk.raw_len < CIPHER_CHUNK_OVERHEAD
+    || end_chunk.raw_len > r->size - CIPHER_FILE_HEADER_LEN - sizeof(end)) {
+    snprintf(message, len, "%s is truncated or has no archive index", r->path);
+
+    return ARCHIVE_FORMAT_ERROR;
+  }
+  sealed_len = end_chunk.raw_len;
+  *data_end = r->size - sizeof(end) - sealed_len;
+  sealed = malloc(sealed_len);
+  index = malloc(sealed_len);
+  if (sealed && index && archive_pread_full(r->fd, sealed, sealed_len, *data_end) == 0
+    && cipher_open_chunk(r->key, r->file_header, sealed, sealed_len, index, sealed_len, &index_chunk, &consumed) == 0
+    && consumed == sealed_len && (index_chunk.flags & CIPHER_CHUNK_INDEX) && index_chunk.seq + 1 == end_chunk.seq) {
+    r->index = archive_index_decode(index, index_chunk.len, &codec);
+    if (r->index && codec != r->codec) destroy_archive_index(&r->index);
+  }
+  free(sealed);
+  if (index) OPENSSL_cleanse(index, sealed_len);
+  free(index);
+  if (!r->index) {
+    snprintf(message, len, "The index of %s is damaged", r->path);
+
+    return ARCHIVE_FORMAT_ERROR;
+  }
+
+  return ARCHIVE_OK;
+}
+
+ArchiveReader_t *init_archive_reader(const StorageConfig_t *cfg, const char *backup_name, ArchiveError_t **err) {
+  ArchiveReader_t *r = calloc(1, sizeof(ArchiveReader_t));
+  ArchiveStatus_t status = ARCHIVE_OK;
+  char message[BUF_LEN_M] = "";
+  uint64_t data_end = 0;
+  struct stat st;
+
+  if (!r) {
+    if (err) *err = create_archive_error(ARCHIVE_MEMORY_ERROR, "Failed to allocate archive reader!");
+
+    return NULL;
+  }
+  snprintf(r->path, sizeof(r->path), "%s/%s", cfg->output_path, backup_name);
+  r->fd = open(r->path, O_RDONLY | O_CLOEXEC);
+  if (r->fd < 0 || fstat(r->fd, &st) != 0) {
+    snprintf(message, sizeof(message), "Cannot open %.400s: %s", r->path, strerror(errno));
+    status = errno == ENOENT ? ARCHIVE_NOT_FOUND : ARCHIVE_IO_ERROR;
+  } else {
+    r->size = (uint64_t)st.st_size;
+    r->drop_behind = cfg->direct_io;
+    r->encrypted = r->size >= CIPHER_FILE_HEADER_LEN
+      && archive_pread_full(r->fd, r->file_header, CIPHER_FILE_HEADER_LEN, 0) == 0
+      && memcmp(r->file_header, CIPHER_MAGIC, strlen(CIPHER_MAGIC)) == 0;
+    status = r->encrypted ? archive_load_sealed_index(r, cfg, &data_end, message, sizeof(message))
+      : archive_load_plain_index(r, &data_end, message, sizeof(message));
+  }
+  // behind a dedup manifest the frames are ranges of the stream its chunks make up
+  if (status == ARCHIVE_OK && !r->encrypted && r->size >= CIPHER_FILE_HEADER_LEN
+    && memcmp(r->file_header, CHUNKSTORE_MANIFEST_MAGIC, strlen(CHUNKSTORE_MANIFEST_MAGIC)) == 0) {
+    r->dedup = true;
+    snprintf(r->store_path, sizeof(r->store_path), "%s", cfg->output_path);
+    if (chunk_manifest_load(r->fd, &r->chunk_ids, &r->chunk_ends, &r->chunk_count) != CHUNKSTORE_OK) {
+      snprintf(message, sizeof(message), "The dedup manifest %.400s is damaged", r->path);
+      status = ARCHIVE_FORMAT_ERROR;
+    }
+    data_end = r->chunk_count ? r->chunk_ends[r->chunk_count - 1] : 0;
+  }
+
+  // every frame has to lie in the data part, before the index
+  for (uint64_t i = 0; status == ARCHIVE_OK && i < r->index->frame_count; i++) {
+    const ArchiveFrame_t *frame = &r->index->frames[i];
+    ArchiveObject_t *obj = NULL;
+
+    if (frame->offset > data_end || frame->stored_len > data_end - frame->offset
+      || (r->dedup && frame->raw_len != frame->stored_len)) {
+      snprintf(message, sizeof(message), "The index of %.400s points past its data", r->path);
+      status = ARCHIVE_FORMAT_ERROR;
+      break;
+    }
+    for (uint32_t j = 0; j < r->index->object_count && !obj; j++) {
+      if (r->index->objects[j].id == frame->object_id) obj = &r->index->objects[j];
+    }
+    if (obj) {
+      obj->frames++;
+      obj->raw_bytes += frame->raw_len;
+    }
+  }
+
+  if (status != ARCHIVE_OK) {
+    if (err) *err = create_archive_error(status, message);
+    destroy_archive_reader(&r);
+
+    return NULL;
+  }
+
+  return r;
+}
+
+/* accounts for @frame once it is read, and with storage.direct_io evicts it */
+void archive_frame_read(ArchiveReader_t *reader, const ArchiveFrame_t *frame) {
+  __atomic_add_fetch(&reader->bytes_read, frame->stored_len, __ATOMIC_RELAXED);
+  if (reader->drop_behind) {
+    // the pages a frame shares with its neighbours go too, they are read again if needed
+    uint64_t page = (uint64_t)sysconf(_SC_PAGESIZE), from = frame->offset - frame->offset % page;
+
+    posix_fadvise(reader->fd, (off_t)from, (off_t)(frame->offset + frame->stored_len - from + page - 1) / (off_t)page
+      * (off_t)page, POSIX_FADV_DONTNEED);
+  }
+}
+
+ArchiveStatus_t archive_read_object(ArchiveReader_t *reader, const ArchiveObject_t *obj, ArchiveWriteFn_t emit,
+  void *ctx, ArchiveError_t **err) {
+  const Codec_t *codec = reader->codec == CODEC_NONE ? NULL : codec_lookup(reader->codec);
+  unsigned char *stored = NULL, *plain = NULL, *raw = NULL;
+  size_t stored_cap = 0, raw_cap = 0;
+  ArchiveStatus_t status = ARCHIVE_OK;
+  char message[BUF_LEN_M] = "";
+  bool complete = obj->frames == 0;
+
+  if (reader->dedup) return archive_read_dedup_object(reader, obj, emit, ctx, err);
+  if (reader->codec != CODEC_NONE && !codec) {
+    snprintf(message, sizeof(message), "The codec of %.400s is not available in this build", reader->path);
+    if (err) *err = create_archive_error(ARCHIVE_FORMAT_ERROR, message);
+
+    return ARCHIVE_FORMAT_ERROR;
+  }
+  for (uint64_t i = 0; i < reader->index->frame_count; i++) {
+    const ArchiveFrame_t *frame = &reader->index->frames[i];
+
+    if (frame->object_id != obj->id) continue;
+    if (frame->stored_len > stored_cap) stored_cap = frame->stored_len;
+    if (frame->raw_len > raw_cap) raw_cap = frame->raw_len;
+  }
+  stored = malloc(stored_cap + 1);
+  plain = reader->encrypted ? malloc(stored_cap + 1) : NULL;
+  raw = malloc(raw_cap + 1);
+  if (!stored || !raw || (reader->encrypted && !plain)) {
+    snprintf(message, sizeof(message), "Failed to allocate restore buffers!");
+    status = ARCHIVE_MEMORY_ERROR;
+  }
+
+  for (uint64_t i = 0; status == ARCHIVE_OK && i < reader->index->frame_count; i++) {
+    const ArchiveFrame_t *frame = &reader->index->frames[i];
+    const unsigned char *data = stored, *out;
+    size_t data_len = frame->stored_len, out_len = 0, consumed = 0;
+    CipherChunk_t chunk;
+
+    if (frame->object_id != obj->id) continue;
+    if (archive_pread_full(reader->fd, stored, frame->stored_len, frame->offset) != 0) {
+      snprintf(message, sizeof(message), "Cannot read %.400s: %s", reader->path,
+        errno ? strerror(errno) : "short read");
+      status = ARCHIVE_IO_ERROR;
+      break;
+    }
+    archive_frame_read(reader, frame);
+    if (reader->encrypted) {
+      if (cipher_open_chunk(reader->key, reader->file_header, stored, frame->stored_len, plain, stored_cap,
+        &chunk, &consumed) != 0 || consumed != frame->stored_len) {
+        snprintf(message, sizeof(message), "Chunk at offset %lu of %.400s does not authenticate",
+          (unsigned long)frame->offset, reader->path);
+        status = ARCHIVE_FORMAT_ERROR;
+        break;
+      }
+      data = plain;
+      data_len = chunk.len;
+    }
+
+    if (codec) {
+      if (codec->decompress(data, data_len, raw, raw_cap, &out_len) != 0 || out_len != frame->raw_len) {
+        snprintf(message, sizeof(message), "Frame at offset %lu of %.400s is damaged", (unsigned long)frame->offset,
+          reader->path);
+        status = ARCHIVE_FORMAT_ERROR;
+        break;
+      }
+      out = raw;
+    } else {
+      out = data;
+      out_len = data_len;
+    }
+    errno = 0;
+    if (emit(ctx, out, out_len) != 0) {
+      snprintf(message, sizeof(message), "Cannot write %s: %s", obj->name, errno ? strerror(errno) : "rejected");
+      status = ARCHIVE_IO_ERROR;
+    }
+    complete = (frame->flags & PIPE_BUF_LAST) != 0;
+  }
+  if (status == ARCHIVE_OK && !complete) {
+    snprintf(message, sizeof(message), "%s in %.200s was cut short", obj->name, reader->path);
+    status = ARCHIVE_FORMAT_ERROR;
+  }
+
+  free(stored);
+  if (plain) OPENSSL_cleanse(plain, stored_cap + 1);
+  free(plain);
+  free(raw);
+  if (status != ARCHIVE_OK && err) *err = create_archive_error(status, message);
+
+  return status;
+}
+
+int archive_fd_write(void *ctx, const unsigned char *data, size_t len) {
+  return archive_write_full(*(int *)ctx, data, len);
+}
+
+/* moves up to @len bytes at @offset of @in to @out inside the kernel; the count, or -1 with errno */
+ssize_t archive_kernel_copy(int in, uint64_t offset, int out, size_t len, bool to_pipe) {
+  loff_t off = (loff_t)offset;
+
+  return to_pipe ? splice(in, &off, out, NULL, len, SPLICE_F_MOVE) : copy_file_range(in, &off, out, NULL, len, 0);
+}
+
+/**
+ * archive_pass_object - moves the frames of @obj from an uncompressed,
+ * unencrypted archive to @fd without copying them through user space
+ * @reader: the reader, its codec CODEC_NONE
+ * @obj: object of the reader's index
+ * @fd: a regular file (copy_file_range) or a pipe (splice)
+ * @to_pipe: @fd is a pipe
+ * @err: written error object on failure
+ *
+ * Where the kernel refuses the pair of files (EXDEV before Linux 5.19,
+ * file systems without copy_file_range, O_APPEND), the rest goes
+ * through a buffer of ARCHIVE_PASS_BUFFER bytes.
+ * Return: ArchiveStatus_t
+ **/
+ArchiveStatus_t archive_pass_object(ArchiveReader_t *reader, const ArchiveObject_t *obj, int fd, bool to_pipe,
+  ArchiveError_t **err) {
+  unsigned char *bounce = NULL;
+  ArchiveStatus_t status = ARCHIVE_OK;
+  char message[BUF_LEN_M] = "";
+  bool complete = obj->frames == 0, kernel = true;
+
+  for (uint64_t i = 0; status == ARCHIVE_OK && i < reader->index->frame_count; i++) {
+    const ArchiveFrame_t *frame = &reader->index->frames[i];
+
+    if (frame->object_id != obj->id) continue;
+    for (size_t done = 0; status == ARCHIVE_OK && done < frame->stored_len; ) {
+      size_t rest = frame->stored_len - done;
+      ssize_t n = kernel ? archive_kernel_copy(reader->fd, frame->offset + done, fd, rest, to_pipe) : -1;
+
+      if (n < 0 && errno == EINTR) continue;
+      if (n < 0 && kernel && (errno == EXDEV || errno == EINVAL || errno == EOPNOTSUPP || errno == ENOSYS
+        || errno == EBADF)) {
+        kernel = false;
+        continue;
+      }
+      if (!kernel) {
+        errno = 0;
+        if (!bounce && !(bounce = malloc(ARCHIVE_PASS_BUFFER))) {
+          snprintf(message, sizeof(message), "Failed to allocate restore buffers!");
+          status = ARCHIVE_MEMORY_ERROR;
+          break;
+        }
+        if (rest > ARCHIVE_PASS_BUFFER) rest = ARCHIVE_PASS_BUFFER;
+        n = archive_pread_full(reader->fd, bounce, rest, frame->offset + done) == 0
+          && archive_write_full(fd, bounce, rest) == 0 ? (ssize_t)rest : -1;
+      }
+      // nothing moved: the archive ended early, or @fd took no more
+      if (n <= 0) {
+        snprintf(message, sizeof(message), "Cannot write %s: %s", obj->name, errno ? strerror(errno) : "short read");
+        status = ARCHIVE_IO_ERROR;
+        break;
+      }
+      done += (size_t)n;
+    }
+    if (status == ARCHIVE_OK) archive_frame_read(reader, frame);
+    complete = (frame->flags & PIPE_BUF_LAST) != 0;
+  }
+  if (status == ARCHIVE_OK && !complete) {
+    snprintf(message, sizeof(message), "%s in %.200s was cut short", obj->name, reader->path);
+    status = ARCHIVE_FORMAT_ERROR;
+  }
+
+  free(bounce);
+  if (status != ARCHIVE_OK && err) *err = create_archive_error(status, message);
+
+  return status;
+}
+
+ArchiveStatus_t archive_restore_object(ArchiveReader_t *reader, const ArchiveObject_t *obj, int fd,
+  ArchiveError_t **err) {
+  struct stat st;
+
+  // stored frames are the dump stream itself: they need no trip through user space
+  if (reader->codec == CODEC_NONE && !reader->encrypted && !reader->dedup && fstat(fd, &st) == 0
+    && (S_ISREG(st.st_mode) || S_ISFIFO(st.st_mode))) {
+    return archive_pass_object(reader, obj, fd, S_ISFIFO(st.st_mode), err);
+  }
+
+  return archive_read_object(reader, obj, archive_fd_write, &fd, err);
+}
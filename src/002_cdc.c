@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/cdc.h"
+
+#define CDC_KEYS_SQL \
+  ("SELECT pg_catalog.format('%I.%I', n.nspname, c.relname), pg_catalog.quote_ident(a.attname) " \
+   "FROM pg_catalog.pg_index i JOIN pg_catalog.pg_class c ON c.oid = i.indrelid " \
+   "JOIN pg_catalog.pg_namespace n ON n.oid = c.relnamespace " \
+   "JOIN pg_catalog.pg_attribute a ON a.attrelid = i.indrelid AND a.attnum OPERATOR(pg_catalog.=) ANY (i.indkey) " \
+   "WHERE CASE c.relreplident WHEN 'i' THEN i.indisreplident WHEN 'd' THEN i.indisprimary ELSE false END")
+#define CDC_UNCHANGED_TOAST ("unchanged-toast-datum")
+#define CDC_NO_TUPLE ("(no-tuple-data)")
+
+/* one column of a tuple as test_decoding prints it, name[type]:value */
+typedef struct CdcColumn {
+  const char        *name;
+  size_t            name_len;
+  const char        *value;         // an SQL literal, NULL for an unchanged TOAST value
+  size_t            value_len;
+} CdcColumn_t;
+
+typedef struct CdcTuple {
+  CdcColumn_t       *columns;
+  size_t            count;
+  size_t            capacity;
+} CdcTuple_t;
+
+
+int cdc_text_put(CdcText_t *text, const char *data, size_t len) {
+  if (text->len + len + 1 > text->capacity) {
+    size_t capacity = text->capacity ? text->capacity : BUF_LEN;
+    char *grown;
+
+    while (capacity < text->len + len + 1) capacity *= 2;
+    if (!(grown = realloc(text->data, capacity))) return -1;
+    text->data = grown;
+    text->capacity = capacity;
+  }
+  memcpy(text->data + text->len, data, len);
+  text->len += len;
+  text->data[text->len] = '\0';
+
+  return 0;
+}
+
+int cdc_text_puts(CdcText_t *text, const char *data) {
+  return cdc_text_put(text, data, strlen(data));
+}
+
+int cdc_load_keys(PgConn_t *conn, CdcKey_t **keys) {
+  PgResult_t *res = NULL;
+  CdcKey_t *key;
+
+  if (pg_query(conn, CDC_KEYS_SQL, &res) != PG_OK || !res || res->cols != 2) {
+    destroy_pg_result(&res);
+
+    return -1;
+  }
+  for (size_t i = 0; i < res->rows; i++) {
+    const char *table = pg_result_value(res, i, 0), *column = pg_result_value(res, i, 1);
+    size_t column_len = column ? strlen(column) + 1 : 0;
+    char *grown;
+
+    if (!table || !column) continue;
+    HASH_FIND_STR(*keys, table, key);
+    if (!key) {
+      if (!(key = calloc(1, sizeof(CdcKey_t)))) break;
+      snprintf(key->table, sizeof(key->table), "%s", table);
+      HASH_ADD_STR(*keys, table, key);
+    }
+    if (!(grown = realloc(key->columns, key->size + column_len))) break;
+    key->columns = grown;
+    memcpy(key->columns + key->size, column, column_len);
+    key->size += column_len;
+    key->count++;
+  }
+  destroy_pg_result(&res);
+
+  return 0;
+}
+
+/* the end of the identifier at @p as quote_identifier() prints it, NULL when there is none */
+const char *cdc_ident_end(const char *p) {
+  const char *start = p;
+
+  if (*p == '"') {
+    for (p++; *p; p++) {
+      if (*p != '"') continue;
+      if (p[1] != '"') return p + 1;
+      p++;
+    }
+
+    return NULL;
+  }
+  while (isalnum((unsigned char)*p) || *p == '_' || *p == '$' || (unsigned char)*p >= 0x80) p++;
+
+  return p > start ? p : NULL;
+}
+
+/* the end of the literal at @p, '' doubled inside quotes; NULL when it is not closed */
+const char *cdc_literal_end(const char *p) {
+  if (*p == '\'' || ((*p == 'B' || *p == 'X') && p[1] == '\'')) {
+    for (p += *p == '\'' ? 1 : 2; *p; p++) {
+      if (*p != '\'') continue;
+      if (p[1] != '\'') return p + 1;
+      p++;
+    }
+
+    return NULL;
+  }
+
+  return p + strcspn(p, " ");
+}
+
+/* parses name[type]:value columns at @p into @tuple, up to the end or "new-tuple: "; the position after them */
+const char *cdc_parse_tuple(const char *p, CdcTuple_t *tuple) {
+  tuple->count = 0;
+  while (*p && strncmp(p, "new-tuple: ", 11) != 0) {
+    const char *name = p, *name_end = cdc_ident_end(p), *value, *end;
+    CdcColumn_t *column;
+
+    // the type may hold brackets of its own, "integer[]"
+    if (!name_end || *name_end != '[' || !(value = strstr(name_end, "]:"))) return NULL;
+    value += 2;
+    if (strncmp(value, CDC_UNCHANGED_TOAST, strlen(CDC_UNCHANGED_TOAST)) == 0) {
+      end = value + strlen(CDC_UNCHANGED_TOAST);
+    } else if (!(end = cdc_literal_end(value)) || end == value) {
+      return NULL;
+    }
+    if (*end && *end != ' ') return NULL;
+
+    if (tuple->count == tuple->capacity) {
+      size_t capacity = tuple->capacity ? tuple->capacity * 2 : 16;
+      CdcColumn_t *grown = realloc(tuple->columns, capacity * sizeof(CdcColumn_t));
+
+      if (!grown) return NULL;
+      tuple->columns = grown;
+      tuple->capacity = capacity;
+    }
+    column = &tuple->columns[tuple->count++];
+    column->name = name;
+    column->name_len = (size_t)(name_end - name);
+    column->value = strncmp(value, CDC_UNCHANGED_TOAST, strlen(CDC_UNCHANGED_TOAST)) == 0 ? NULL : value;
+    column->value_len = (size_t)(end - value);
+    p = *end ? end + 1 : end;
+  }
+
+  return p;
+}
+
+/* the column of @tuple called @name, NULL when it has none */
+const CdcColumn_t *cdc_find_column(const CdcTuple_t *tuple, const char *name) {
+  for (size_t i = 0; i < tuple->count; i++) {
+    const CdcColumn_t *column = &tuple->columns[i];
+
+    if (column->name_len == strlen(name) && memcmp(column->name, name, column->name_len) == 0) return column;
+  }
+
+  return NULL;
+}
+
+/*
+ * writes a value as a literal the statement can hold on one line: text
+ * spanning lines becomes an E'' string, and the NaN and Infinity that
+ * float and numeric columns print bare are quoted
+ */
+int cdc_put_value(CdcText_t *out, const CdcColumn_t *column) {
+  const char *v = column->value;
+  size_t len = column->value_len, sign = v[0] == '-' || v[0] == '+';
+  bool bare = v[0] != '\'' && v[1] != '\'';   // not 'text', B'bits' or X'hex'
+  int status = 0;
+
+  if (len == 4 && strncmp(v, "null", 4) == 0) return cdc_text_puts(out, "NULL");
+  if (v[0] == '\'' && (memchr(v, '\n', len) || memchr(v, '\r', len))) {
+    status = cdc_text_puts(out, "E'");
+    for (size_t i = 1; status == 0 && i + 1 < len; i++) {
+      if (v[i] == '\\') status = cdc_text_puts(out, "\\\\");
+      else if (v[i] == '\n') status = cdc_text_puts(out, "\\n");
+      else if (v[i] == '\r') status = cdc_text_puts(out, "\\r");
+      else status = cdc_text_put(out, v + i, 1);
+    }
+
+    return status == 0 ? cdc_text_puts(out, "'") : -1;
+  }
+  if (bare && !isdigit((unsigned char)v[sign]) && v[sign] != '.' && !(len == 4 && strncmp(v, "true", 4) == 0)
+    && !(len == 5 && strncmp(v, "false", 5) == 0)) {
+    if (cdc_text_puts(out, "'") != 0 || cdc_text_put(out, v, len) != 0) return -1;
+
+    return cdc_text_puts(out, "'");
+  }
+
+  return cdc_text_put(out, v, len);
+}
+
+/* " WHERE a = 1 AND b IS NULL" out of @tuple's columns named by @key, or out of all of them without one */
+int cdc_put_where(CdcText_t *out, const CdcTuple_t *tuple, const CdcKey_t *key) {
+  size_t count = key ? key->count : tuple->count;
+  const char *name = key ? key->columns : NULL;
+  int status = cdc_text_puts(out, " WHERE ");
+
+  for (size_t i = 0; status == 0 && i < count; i++) {
+    const CdcColumn_t *column = key ? cdc_find_column(tuple, name) : &tuple->columns[i];
+
+    if (!column || !column->value) return -1;
+    if (i) status = cdc_text_puts(out, " AND ");
+    if (status == 0) status = cdc_text_put(out, column->name, column->name_len);
+    if (status == 0 && column->value_len == 4 && strncmp(column->value, "null", 4) == 0) {
+      status = cdc_text_puts(out, " IS NULL");
+    } else if (status == 0 && (status = cdc_text_puts(out, " = ")) == 0) {
+      status = cdc_put_value(out, column);
+    }
+    if (name) name += strlen(name) + 1;
+  }
+
+  return status;
+}
+
+int cdc_insert_sql(CdcText_t *out, const char *table, const CdcTuple_t *tuple) {
+  int status = cdc_text_puts(out, "INSERT INTO ");
+
+  if (status == 0) status = cdc_text_puts(out, table);
+  for (size_t i = 0; status == 0 && i < tuple->count; i++) {
+    if ((status = cdc_text_puts(out, i ? ", " : " (")) == 0) {
+      status = cdc_text_put(out, tuple->columns[i].name, tuple->columns[i].name_len);
+    }
+  }
+  if (status == 0) status = cdc_text_puts(out, ") VALUES");
+  for (size_t i = 0; status == 0 && i < tuple->count; i++) {
+    if (!tuple->columns[i].value) return -1;
+    if ((status = cdc_text_puts(out, i ? ", " : " (")) == 0) status = cdc_put_value(out, &tuple->columns[i]);
+  }
+
+  return status == 0 ? cdc_text_puts(out, ");\n") : -1;
+}
+
+/* SET every column but the unchanged TOAST ones; nothing at all when none is left */
+int cdc_update_sql(CdcText_t *out, const char *table, const CdcTuple_t *old_key, const CdcTuple_t *tuple,
+  const CdcKey_t *key) {
+  size_t start = out->len, set = 0;
+  int status = cdc_text_puts(out, "UPDATE ");
+
+  if (status == 0) status = cdc_text_puts(out, table);
+  for (size_t i = 0; status == 0 && i < tuple->count; i++) {
+    if (!tuple->columns[i].value) continue;
+    if ((status = cdc_text_puts(out, set++ ? ", " : " SET ")) == 0
+      && (status = cdc_text_put(out, tuple->columns[i].name, tuple->columns[i].name_len)) == 0
+      && (status = cdc_text_puts(out, " = ")) == 0) {
+      status = cdc_put_value(out, &tuple->columns[i]);
+    }
+  }
+  if (status == 0 && !set) {
+    out->len = start;
+    out->data[start] = '\0';
+
+    return 0;
+  }
+  if (status == 0) status = old_key->count ? cdc_put_where(out, old_key, NULL) : cdc_put_where(out, tuple, key);
+
+  return status == 0 ? cdc_text_puts(out, ";\n") : -1;
+}
+
+int cdc_change_sql(const CdcKey_t *keys, const char *change, CdcText_t *out, char *message, size_t len) {
+  CdcTuple_t old_key = { NULL, 0, 0 }, tuple = { NULL, 0, 0 };
+  char table[BUF_LEN_S];
+  const char *p = change + 6, *end, *action;
+  const CdcKey_t *key = NULL;
+  size_t start = out->len;
+  int status = 0;
+
+  message[0] = '\0';
+  if (strncmp(change, "BEGIN ", 6) == 0 || strcmp(change, "BEGIN") == 0) return cdc_text_puts(out, "BEGIN;\n");
+  if (strncmp(change, "COMMIT ", 7) == 0 || strcmp(change, "COMMIT") == 0) return cdc_text_puts(out, "COMMIT;\n");
+  // logical messages carry nothing to replay
+  if (strncmp(change, "message: ", 9) == 0) return 0;
+
+  // table <schema>.<name>: <action>: <columns>
+  if (strncmp(change, "table ", 6) != 0 || !(end = cdc_ident_end(p)) || *end != '.' || !(end = cdc_ident_end(end + 1))
+    || strncmp(end, ": ", 2) != 0 || (size_t)(end - p) >= sizeof(table)) {
+    snprintf(message, len, "Cannot replay change \"%.200s\"", change);
+
+    return -1;
+  }
+  memcpy(table, p, (size_t)(end - p));
+  table[end - p] = '\0';
+  action = end + 2;
+  HASH_FIND_STR(keys, table, key);
+
+  if (strncmp(action, "INSERT: ", 8) == 0) {
+    p = cdc_parse_tuple(action + 8, &tuple);
+    status = p && !*p && tuple.count ? cdc_insert_sql(out, table, &tuple) : -1;
+  } else if (strncmp(action, "UPDATE: ", 8) == 0) {
+    p = action + 8;
+    // the old key comes first when the identity is FULL or the key changed
+    if (strncmp(p, "old-key: ", 9) == 0) {
+      p = cdc_parse_tuple(p + 9, &old_key);
+      p = p && strncmp(p, "new-tuple: ", 11) == 0 ? p + 11 : NULL;
+    }
+    if (p) p = cdc_parse_tuple(p, &tuple);
+    if (!p || *p || !tuple.count) {
+      status = -1;
+    } else if (!old_key.count && !key) {
+      snprintf(message, len, "Cannot replay an UPDATE of %s, which has no replica identity", table);
+      status = -1;
+    } else {
+      status = cdc_update_sql(out, table, &old_key, &tuple, key);
+    }
+  } else if (strncmp(action, "DELETE: ", 8) == 0) {
+    // the plugin prints the replica identity columns of the row that went
+    if (strcmp(action + 8, CDC_NO_TUPLE) == 0) {
+      snprintf(message, len, "Cannot replay a DELETE from %s, which has no replica identity", table);
+      status = -1;
+    } else if (!(p = cdc_parse_tuple(action + 8, &tuple)) || *p || !tuple.count) {
+      status = -1;
+    } else if ((status = cdc_text_puts(out, "DELETE FROM ")) == 0 && (status = cdc_text_puts(out, table)) == 0
+      && (status = cdc_put_where(out, &tuple, NULL)) == 0) {
+      status = cdc_text_puts(out, ";\n");
+    }
+  } else if (strncmp(action, "TRUNCATE: ", 10) == 0) {
+    if ((status = cdc_text_puts(out, "TRUNCATE ")) == 0 && (status = cdc_text_puts(out, table)) == 0
+      && strstr(action, "restart_seqs")) {
+      status = cdc_text_puts(out, " RESTART IDENTITY");
+    }
+    if (status == 0 && strstr(action, "cascade")) status = cdc_text_puts(out, " CASCADE");
+    if (status == 0) status = cdc_text_puts(out, ";\n");
+  } else {
+    status = -1;
+  }
+  free(old_key.columns);
+  free(tuple.columns);
+  if (status != 0 && out->data) {
+    out->len = start;
+    out->data[start] = '\0';
+  }
+  if (status != 0 && !message[0]) snprintf(message, len, "Cannot replay change \"%.200s\"", change);
+
+  return status == 0 ? 0 : -1;
+}
+
+void destroy_cdc_keys(CdcKey_t **keys) {
+  CdcKey_t *key, *tmp;
+
+  if (!keys) return;
+  HASH_ITER(hh, *keys, key, tmp) {
+    HASH_DEL(*keys, key);
+    free(key->columns);
+    free(key);
+  }
+}
@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include "include/archive.h"
+#include "include/chunkstore.h"
+
+#define CHUNK_MANIFEST_BATCH (1024)
+
+
+void chunk_put_le(unsigned char *dst, uint64_t value, int bytes) {
+  for (int i = 0; i < bytes; i++) dst[i] = (unsigned char)(value >> (8 * i));
+}
+
+uint64_t chunk_get_le(const unsigned char *src, int bytes) {
+  uint64_t value = 0;
+
+  for (int i = 0; i < bytes; i++) value |= (uint64_t)src[i] << (8 * i);
+
+  return value;
+}
+
+size_t chunk_manifest_header(unsigned char *dst) {
+  memset(dst, 0, CHUNKSTORE_HEADER_LEN);
+  memcpy(dst, CHUNKSTORE_MANIFEST_MAGIC, strlen(CHUNKSTORE_MANIFEST_MAGIC));
+  dst[7] = CHUNKSTORE_FORMAT_VERSION;
+  chunk_put_le(dst + 8, CHUNK_AVG_SIZE, 4);
+
+  return CHUNKSTORE_HEADER_LEN;
+}
+
+void chunk_manifest_entry(unsigned char *dst, const unsigned char id[CHUNK_ID_LEN], uint32_t raw_len) {
+  memcpy(dst, id, CHUNK_ID_LEN);
+  chunk_put_le(dst + CHUNK_ID_LEN, raw_len, 4);
+}
+
+void chunk_manifest_trailer(unsigned char *dst, uint64_t count, uint64_t raw_bytes,
+  const unsigned char digest[CHUNK_ID_LEN]) {
+  chunk_put_le(dst, count, 8);
+  chunk_put_le(dst + 8, raw_bytes, 8);
+  memcpy(dst + 16, digest, CHUNK_ID_LEN);
+}
+
+int chunk_read_full(int fd, unsigned char *dst, size_t len) {
+  while (len > 0) {
+    ssize_t n = read(fd, dst, len);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    dst += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+int chunk_write_full(int fd, const unsigned char *src, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, src, len);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    src += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+uint64_t chunk_manifest_length(int fd, uint64_t size) {
+  unsigned char footer[ARCHIVE_FOOTER_LEN];
+  size_t magic_len = strlen(ARCHIVE_INDEX_MAGIC);
+  uint64_t index_len;
+
+  // manifests written before the index are the whole file
+  if (size < CHUNKSTORE_HEADER_LEN + CHUNKSTORE_TRAILER_LEN + ARCHIVE_FOOTER_LEN
+    || pread(fd, footer, sizeof(footer), (off_t)(size - sizeof(footer))) != (ssize_t)sizeof(footer)
+    || memcmp(footer + ARCHIVE_FOOTER_LEN - 1 - magic_len, ARCHIVE_INDEX_MAGIC, magic_len) != 0) return size;
+  index_len = chunk_get_le(footer + 20, 8);
+
+  return index_len <= size - CHUNKSTORE_HEADER_LEN - CHUNKSTORE_TRAILER_LEN ? size - index_len : size;
+}
+
+ChunkStoreStatus_t chunk_manifest_load(int fd, unsigned char **ids, uint64_t **ends, uint64_t *count) {
+  unsigned char header[CHUNKSTORE_HEADER_LEN], trailer[CHUNKSTORE_TRAILER_LEN], digest[EVP_MAX_MD_SIZE];
+  unsigned char *entries = NULL;
+  uint64_t size = 0, total = 0, raw_bytes = 0;
+  ChunkStoreStatus_t status = CHUNKSTORE_OK;
+  struct stat st;
+
+  *ids = NULL;
+  *ends = NULL;
+  *count = 0;
+  if (fstat(fd, &st) != 0) return CHUNKSTORE_IO_ERROR;
+  size = chunk_manifest_length(fd, (uint64_t)st.st_size);
+  if (size < CHUNKSTORE_HEADER_LEN + CHUNKSTORE_TRAILER_LEN
+    || (size - CHUNKSTORE_HEADER_LEN - CHUNKSTORE_TRAILER_LEN) % CHUNKSTORE_ENTRY_LEN != 0
+    || pread(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)
+    || memcmp(header, CHUNKSTORE_MANIFEST_MAGIC, strlen(CHUNKSTORE_MANIFEST_MAGIC)) != 0
+    || header[7] != CHUNKSTORE_FORMAT_VERSION) return CHUNKSTORE_CORRUPT_ERROR;
+
+  total = (size - CHUNKSTORE_HEADER_LEN - CHUNKSTORE_TRAILER_LEN) / CHUNKSTORE_ENTRY_LEN;
+  entries = malloc(total * CHUNKSTORE_ENTRY_LEN + sizeof(trailer));
+  *ids = malloc(total * CHUNK_ID_LEN + 1);
+  *ends = malloc(total * sizeof(uint64_t) + 1);
+  if (!entries || !*ids || !*ends) {
+    status = CHUNKSTORE_MEMORY_ERROR;
+  } else if (pread(fd, entries, total * CHUNKSTORE_ENTRY_LEN + sizeof(trailer), CHUNKSTORE_HEADER_LEN)
+    != (ssize_t)(total * CHUNKSTORE_ENTRY_LEN + sizeof(trailer))) {
+    status = CHUNKSTORE_IO_ERROR;
+  }
+  for (uint64_t i = 0; status == CHUNKSTORE_OK && i < total; i++) {
+    memcpy(*ids + i * CHUNK_ID_LEN, entries + i * CHUNKSTORE_ENTRY_LEN, CHUNK_ID_LEN);
+    raw_bytes += chunk_get_le(entries + i * CHUNKSTORE_ENTRY_LEN + CHUNK_ID_LEN, 4);
+    (*ends)[i] = raw_bytes;
+  }
+  // the trailer catches a manifest that lost or reordered entries
+  if (status == CHUNKSTORE_OK) {
+    memcpy(trailer, entries + total * CHUNKSTORE_ENTRY_LEN, sizeof(trailer));
+    if (EVP_Digest(entries, total * CHUNKSTORE_ENTRY_LEN, digest, NULL, EVP_sha256(), NULL) != 1
+      || chunk_get_le(trailer, 8) != total || chunk_get_le(trailer + 8, 8) != raw_bytes
+      || memcmp(trailer + 16, digest, CHUNK_ID_LEN) != 0) status = CHUNKSTORE_CORRUPT_ERROR;
+  }
+
+  free(entries);
+  if (status != CHUNKSTORE_OK) {
+    free(*ids);
+    free(*ends);
+    *ids = NULL;
+    *ends = NULL;
+
+    return status;
+  }
+  *count = total;
+
+  return CHUNKSTORE_OK;
+}
+
+ChunkStoreStatus_t chunk_store_restore(ChunkStore_t *store, const char *manifest_path, int fd,
+  ChunkStoreError_t **err) {
+  unsigned char header[CHUNKSTORE_HEADER_LEN], trailer[CHUNKSTORE_TRAILER_LEN], digest[EVP_MAX_MD_SIZE];
+  unsigned char *entries = malloc(CHUNK_MANIFEST_BATCH * CHUNKSTORE_ENTRY_LEN), *chunk = malloc(CHUNK_MAX_SIZE);
+  EVP_MD_CTX *md = EVP_MD_CTX_new();
+  ChunkStoreStatus_t status = CHUNKSTORE_OK;
+  char message[BUF_LEN_M] = "";
+  uint64_t count = 0, raw_bytes = 0, total, size = 0;
+  struct stat st;
+  int in = open(manifest_path, O_RDONLY | O_CLOEXEC);
+
+  if (!entries || !chunk || !md) {
+    status = CHUNKSTORE_MEMORY_ERROR;
+    snprintf(message, sizeof(message), "Failed to allocate restore buffers!");
+  } else if (in < 0 || fstat(in, &st) != 0) {
+    status = CHUNKSTORE_IO_ERROR;
+    snprintf(message, sizeof(message), "Cannot open manifest %s: %s", manifest_path, strerror(errno));
+  } else if ((size = chunk_manifest_length(in, (uint64_t)st.st_size)) < CHUNKSTORE_HEADER_LEN + CHUNKSTORE_TRAILER_LEN
+    || (size - CHUNKSTORE_HEADER_LEN - CHUNKSTORE_TRAILER_LEN) % CHUNKSTORE_ENTRY_LEN != 0
+    || chunk_read_full(in, header, sizeof(header)) != 0
+    || memcmp(header, CHUNKSTORE_MANIFEST_MAGIC, strlen(CHUNKSTORE_MANIFEST_MAGIC)) != 0
+    || header[7] != CHUNKSTORE_FORMAT_VERSION) {
+    status = CHUNKSTORE_CORRUPT_ERROR;
+    snprintf(message, sizeof(message), "%s is not a dedup manifest", manifest_path);
+  }
+
+  total = status == CHUNKSTORE_OK
+    ? (size - CHUNKSTORE_HEADER_LEN - CHUNKSTORE_TRAILER_LEN) / CHUNKSTORE_ENTRY_LEN : 0;
+  if (status == CHUNKSTORE_OK) EVP_DigestInit_ex(md, EVP_sha256(), NULL);
+  while (status == CHUNKSTORE_OK && count < total) {
+    size_t batch = total - count < CHUNK_MANIFEST_BATCH ? (size_t)(total - count) : CHUNK_MANIFEST_BATCH;
+
+    if (chunk_read_full(in, entries, batch * CHUNKSTORE_ENTRY_LEN) != 0) {
+      status = CHUNKSTORE_IO_ERROR;
+      snprintf(message, sizeof(message), "Cannot read manifest %s", manifest_path);
+      break;
+    }
+    EVP_DigestUpdate(md, entries, batch * CHUNKSTORE_ENTRY_LEN);
+    for (size_t i = 0; i < batch && status == CHUNKSTORE_OK; i++, count++) {
+      const unsigned char *entry = entries + i * CHUNKSTORE_ENTRY_LEN;
+      ssize_t len = chunk_store_get(store, entry, chunk, CHUNK_MAX_SIZE);
+      char hex[2 * CHUNK_ID_LEN + 1];
+
+      if (len < 0 || (uint64_t)len != chunk_get_le(entry + CHUNK_ID_LEN, 4)) {
+        chunk_id_hex(entry, hex);
+        status = CHUNKSTORE_CORRUPT_ERROR;
+        snprintf(message, sizeof(message), "Chunk %s is missing or damaged", hex);
+      } else if (chunk_write_full(fd, chunk, (size_t)len) != 0) {
+        status = CHUNKSTORE_IO_ERROR;
+        snprintf(message, sizeof(message), "Cannot write restored data: %s", strerror(errno));
+      }
+      raw_bytes += len > 0 ? (uint64_t)len : 0;
+    }
+  }
+
+  // the trailer catches a manifest that lost or reordered entries
+  if (status == CHUNKSTORE_OK && (chunk_read_full(in, trailer, sizeof(trailer)) != 0
+    || EVP_DigestFinal_ex(md, digest, NULL) != 1 || chunk_get_le(trailer, 8) != count
+    || chunk_get_le(trailer + 8, 8) != raw_bytes || memcmp(trailer + 16, digest, CHUNK_ID_LEN) != 0)) {
+    status = CHUNKSTORE_CORRUPT_ERROR;
+    snprintf(message, sizeof(message), "Manifest %s does not match its trailer", manifest_path);
+  }
+
+  if (in >= 0) close(in);
+  EVP_MD_CTX_free(md);
+  free(entries);
+  free(chunk);
+  if (status != CHUNKSTORE_OK && err) *err = create_chunk_store_error(status, message);
+
+  return status;
+}
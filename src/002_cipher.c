@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include <openssl/rand.h>
+#include "include/cipher.h"
+
+#define CIPHER_KEY_ID_OFFSET (CIPHER_FILE_PREFIX_LEN)
+#define CIPHER_WRAP_NONCE_OFFSET (CIPHER_KEY_ID_OFFSET + CIPHER_KEY_ID_LEN)
+#define CIPHER_WRAP_KEY_OFFSET (CIPHER_WRAP_NONCE_OFFSET + CIPHER_NONCE_LEN)
+#define CIPHER_WRAP_TAG_OFFSET (CIPHER_WRAP_KEY_OFFSET + CIPHER_KEY_LEN)
+
+
+void cipher_key_id(const unsigned char key[CIPHER_KEY_LEN], unsigned char id[CIPHER_KEY_ID_LEN]) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+  unsigned int len = 0;
+
+  EVP_Digest(key, CIPHER_KEY_LEN, digest, &len, EVP_sha256(), NULL);
+  memcpy(id, digest, CIPHER_KEY_ID_LEN);
+}
+
+int cipher_wrap_key(const unsigned char master[CIPHER_KEY_LEN], const unsigned char data_key[CIPHER_KEY_LEN],
+  unsigned char *file_header) {
+  EVP_CIPHER_CTX *ctx = EVP_CIPHER_CTX_new();
+  unsigned char *nonce = file_header + CIPHER_WRAP_NONCE_OFFSET;
+  int n = 0, ok;
+
+  if (!ctx) return -1;
+  cipher_key_id(master, file_header + CIPHER_KEY_ID_OFFSET);
+  // the header prefix and key id are bound to the wrapped key, so neither can be swapped
+  ok = RAND_bytes(nonce, CIPHER_NONCE_LEN) == 1
+    && EVP_EncryptInit_ex(ctx, cipher_evp((CipherId_t)file_header[8]), NULL, master, nonce) == 1
+    && EVP_EncryptUpdate(ctx, NULL, &n, file_header, CIPHER_WRAP_NONCE_OFFSET) == 1
+    && EVP_EncryptUpdate(ctx, file_header + CIPHER_WRAP_KEY_OFFSET, &n, data_key, CIPHER_KEY_LEN) == 1
+    && EVP_EncryptFinal_ex(ctx, file_header + CIPHER_WRAP_KEY_OFFSET + n, &n) == 1
+    && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_GET_TAG, CIPHER_TAG_LEN, file_header + CIPHER_WRAP_TAG_OFFSET) == 1;
+  EVP_CIPHER_CTX_free(ctx);
+
+  return ok ? 0 : -1;
+}
+
+int cipher_unwrap_key(const unsigned char master[CIPHER_KEY_LEN], const unsigned char *file_header,
+  unsigned char data_key[CIPHER_KEY_LEN]) {
+  CipherId_t id;
+  CodecId_t codec;
+  EVP_CIPHER_CTX *ctx;
+  int n = 0, ok;
+
+  if (cipher_parse_file_header(file_header, CIPHER_FILE_HEADER_LEN, &id, &codec) != 0) return -1;
+  ctx = EVP_CIPHER_CTX_new();
+  if (!ctx) return -1;
+  ok = EVP_DecryptInit_ex(ctx, cipher_evp(id), NULL, master, file_header + CIPHER_WRAP_NONCE_OFFSET) == 1
+    && EVP_DecryptUpdate(ctx, NULL, &n, file_header, CIPHER_WRAP_NONCE_OFFSET) == 1
+    && EVP_DecryptUpdate(ctx, data_key, &n, file_header + CIPHER_WRAP_KEY_OFFSET, CIPHER_KEY_LEN) == 1
+    && EVP_CIPHER_CTX_ctrl(ctx, EVP_CTRL_AEAD_SET_TAG, CIPHER_TAG_LEN,
+      (void *)(file_header + CIPHER_WRAP_TAG_OFFSET)) == 1
+    && EVP_DecryptFinal_ex(ctx, data_key + n, &n) == 1;
+  EVP_CIPHER_CTX_free(ctx);
+  if (!ok) OPENSSL_cleanse(data_key, CIPHER_KEY_LEN);
+
+  return ok ? 0 : -1;
+}
+
+int cipher_rewrap_file(const char *path, const unsigned char old_master[CIPHER_KEY_LEN],
+  const unsigned char new_master[CIPHER_KEY_LEN], char *message, size_t message_len) {
+  unsigned char header[CIPHER_FILE_HEADER_LEN], key_id[CIPHER_KEY_ID_LEN], data_key[CIPHER_KEY_LEN];
+  CipherId_t id;
+  CodecId_t codec;
+  int fd = open(path, O_RDWR | O_CLOEXEC);
+  int status = -1;
+
+  if (fd < 0) {
+    snprintf(message, message_len, "Cannot open %s: %s", path, strerror(errno));
+
+    return -1;
+  }
+
+  cipher_key_id(old_master, key_id);
+  if (pread(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)
+    || cipher_parse_file_header(header, sizeof(header), &id, &codec) != 0) {
+    snprintf(message, message_len, "%s is not an encrypted archive", path);
+  } else if (memcmp(header + CIPHER_KEY_ID_OFFSET, key_id, CIPHER_KEY_ID_LEN) != 0
+    || cipher_unwrap_key(old_master, header, data_key) != 0) {
+    snprintf(message, message_len, "%s is not wrapped with the given master key", path);
+  } else if (cipher_wrap_key(new_master, data_key, header) != 0) {
+    snprintf(message, message_len, "Cannot wrap the data key of %s", path);
+  } else if (pwrite(fd, header, sizeof(header), 0) != (ssize_t)sizeof(header) || fsync(fd) != 0) {
+    snprintf(message, message_len, "Cannot rewrite %s: %s", path, strerror(errno));
+  } else {
+    status = 0;
+  }
+
+  OPENSSL_cleanse(data_key, sizeof(data_key));
+  close(fd);
+
+  return status;
+}
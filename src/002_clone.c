@@ -0,0 +1,91 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/clone.h"
+#include "include/remote.h"
+#include "include/storage.h"
+
+
+void clone_remove_tree(const char *path);
+
+CloneStatus_t clone_backup(AppConfig_t *cfg, const char *source_dir, const char *name, CloneStats_t *stats,
+  CloneError_t **err) {
+  char path[BUF_LEN], partial[BUF_LEN + 16], message[BUF_LEN_M];
+  CloneStatus_t status = CLONE_OK;
+  struct stat st;
+  int fd;
+
+  message[0] = '\0';
+  if (!name[0] || name[0] == '.' || strchr(name, '/') || strlen(name) >= BUF_LEN_S) {
+    snprintf(message, sizeof(message), "Invalid backup name: %s", name);
+    status = CLONE_CONFIG_ERROR;
+  } else if (storage_to_stdout(cfg->storage)) {
+    snprintf(message, sizeof(message), "A clone is a directory tree, storage.output_path cannot be -");
+    status = CLONE_CONFIG_ERROR;
+  } else if (storage_encryption_enabled(cfg->storage) || remote_enabled(cfg->storage)) {
+    // the copy shares the source's extents, there is nothing to seal or upload
+    snprintf(message, sizeof(message), "Clones cannot be combined with encryption_key_path or remote_target");
+    status = CLONE_CONFIG_ERROR;
+  }
+
+  snprintf(path, sizeof(path), "%s/%s", cfg->storage->output_path, name);
+  snprintf(partial, sizeof(partial), "%s%s", path, CLONE_PARTIAL_SUFFIX);
+  if (status == CLONE_OK && lstat(path, &st) == 0) {
+    snprintf(message, sizeof(message), "Backup %s already exists", name);
+    status = CLONE_CONFIG_ERROR;
+  } else if (status == CLONE_OK && mkdir(cfg->storage->output_path, 0750) != 0 && errno != EEXIST) {
+    snprintf(message, sizeof(message), "Cannot create %s: %s", cfg->storage->output_path, strerror(errno));
+    status = CLONE_IO_ERROR;
+  }
+  if (status != CLONE_OK) {
+    if (err) *err = create_clone_error(status, message);
+
+    return status;
+  }
+
+  // only dbeetle writes <name>.partial, a crashed run leaves it behind
+  clone_remove_tree(partial);
+  status = clone_tree(cfg, source_dir, partial, stats, err);
+  if (status == CLONE_OK && rename(partial, path) != 0) {
+    snprintf(message, sizeof(message), "Cannot complete %.400s: %s", path, strerror(errno));
+    status = CLONE_IO_ERROR;
+    if (err) *err = create_clone_error(status, message);
+  }
+  if (status == CLONE_OK && (fd = open(cfg->storage->output_path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)) >= 0) {
+    fsync(fd);
+    close(fd);
+  } else if (status != CLONE_OK) {
+    clone_remove_tree(partial);
+  }
+
+  return status;
+}
+
+bool clone_backup_exists(const StorageConfig_t *cfg, const char *name) {
+  char path[BUF_LEN];
+  struct stat st;
+
+  if (!name[0] || name[0] == '.' || strchr(name, '/') || storage_to_stdout(cfg)) return false;
+  snprintf(path, sizeof(path), "%s/%s", cfg->output_path, name);
+
+  return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+CloneStatus_t clone_restore(AppConfig_t *cfg, const char *name, const char *target_dir, CloneStats_t *stats,
+  CloneError_t **err) {
+  char path[BUF_LEN], message[BUF_LEN_M];
+
+  snprintf(path, sizeof(path), "%s/%s", cfg->storage->output_path, name);
+  if (!clone_backup_exists(cfg->storage, name)) {
+    snprintf(message, sizeof(message), "No cloned backup %.200s in %.200s", name, cfg->storage->output_path);
+    if (err) *err = create_clone_error(CLONE_CONFIG_ERROR, message);
+
+    return CLONE_CONFIG_ERROR;
+  }
+
+  return clone_tree(cfg, path, target_dir, stats, err);
+}
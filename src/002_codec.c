@@ -0,0 +1,124 @@
+#include "include/codec.h"
+
+#ifdef DBEETLE_HAVE_ZSTD
+#include <stdlib.h>
+#include <string.h>
+#include <zstd.h>
+
+#define ZSTD_FRAME_MAGIC (0xFD2FB528u)
+#define ZSTD_RAW_BLOCK_MAX (128 * 1024)
+
+
+void *zstd_create(const CodecSpec_t *spec) {
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  int level = spec->level == CODEC_LEVEL_DEFAULT ? ZSTD_DEFAULT_LEVEL : spec->level;
+
+  if (!cctx) return NULL;
+  if (ZSTD_isError(ZSTD_CCtx_setParameter(cctx, ZSTD_c_compressionLevel, level))) {
+    ZSTD_freeCCtx(cctx);
+
+    return NULL;
+  }
+  if (spec->long_window) {
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_enableLongDistanceMatching, 1);
+    ZSTD_CCtx_setParameter(cctx, ZSTD_c_windowLog, ZSTD_LONG_WINDOW_LOG);
+  }
+  // fails on a libzstd built without ZSTD_MULTITHREAD; we then compress in the caller
+  if (spec->workers > 1) ZSTD_CCtx_setParameter(cctx, ZSTD_c_nbWorkers, (int)spec->workers);
+
+  return cctx;
+}
+
+void zstd_destroy(void *state) {
+  ZSTD_freeCCtx(state);
+}
+
+/**
+ * zstd_compress - compresses one block into a self-contained zstd frame
+ * @state: the worker's ZSTD_CCtx, parameters are kept between frames
+ * @src: raw block
+ * @len: raw length
+ * @dst: output area
+ * @cap: output capacity
+ * @out_len: written compressed length
+ *
+ * Concatenated frames form a valid zstd stream.
+ * Return: 0 on success, -1 on failure
+ **/
+int zstd_compress(void *state, const unsigned char *src, size_t len,
+  unsigned char *dst, size_t cap, size_t *out_len) {
+  size_t ret = ZSTD_compress2(state, dst, cap, src, len);
+
+  if (ZSTD_isError(ret)) return -1;
+  *out_len = ret;
+
+  return 0;
+}
+
+/**
+ * zstd_store - wraps one block in a zstd frame made of raw blocks
+ * @state: unused, the frame is built by hand
+ * @src: raw block
+ * @len: raw length
+ * @dst: output area
+ * @cap: output capacity
+ * @out_len: written length
+ *
+ * The frame is single-segment with an 8-byte content size, which caps
+ * its raw blocks at ZSTD_RAW_BLOCK_MAX each.
+ * Return: 0 on success, -1 if @cap is too small
+ **/
+int zstd_store(void *state, const unsigned char *src, size_t len,
+  unsigned char *dst, size_t cap, size_t *out_len) {
+  size_t pos = 13, off = 0;
+
+  (void)state;
+  if (cap < pos) return -1;
+  for (int i = 0; i < 4; i++) dst[i] = (unsigned char)(ZSTD_FRAME_MAGIC >> (8 * i));
+  // Frame_Content_Size_flag 3 (8 bytes), Single_Segment_flag set, no checksum or dictionary
+  dst[4] = 0xE0;
+  for (int i = 0; i < 8; i++) dst[5 + i] = (unsigned char)((uint64_t)len >> (8 * i));
+
+  do {
+    size_t n = len - off > ZSTD_RAW_BLOCK_MAX ? ZSTD_RAW_BLOCK_MAX : len - off;
+    // Last_Block bit, Block_Type 0 (raw), Block_Size
+    uint32_t header = (uint32_t)(n << 3) | (off + n == len ? 1u : 0u);
+
+    if (cap - pos < n + 3) return -1;
+    dst[pos] = (unsigned char)header;
+    dst[pos + 1] = (unsigned char)(header >> 8);
+    dst[pos + 2] = (unsigned char)(header >> 16);
+    memcpy(dst + pos + 3, src + off, n);
+    pos += n + 3;
+    off += n;
+  } while (off < len);
+  *out_len = pos;
+
+  return 0;
+}
+
+int zstd_decompress(const unsigned char *src, size_t len,
+  unsigned char *dst, size_t cap, size_t *out_len) {
+  size_t ret = ZSTD_decompress(dst, cap, src, len);
+
+  if (ZSTD_isError(ret)) return -1;
+  *out_len = ret;
+
+  return 0;
+}
+
+const Codec_t zstd_codec = {
+  .name = "zstd",
+  .id = CODEC_ZSTD,
+  .create = zstd_create,
+  .destroy = zstd_destroy,
+  .compress = zstd_compress,
+  .store = zstd_store,
+  .decompress = zstd_decompress
+};
+
+#else
+
+typedef int zstd_codec_unavailable_t;
+
+#endif /* DBEETLE_HAVE_ZSTD */
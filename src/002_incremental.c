@@ -0,0 +1,486 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <openssl/evp.h>
+#include "include/engine.h"
+#include "include/incremental.h"
+#include "include/pagecache.h"
+#include "include/pgdump.h"
+#include "include/restore.h"
+#include "include/storage.h"
+#include "include/treewalk.h"
+
+typedef struct IncrWorker {
+  void              *codec_state;
+  unsigned char     *buf;           // one block as read
+  unsigned char     *out;           // one block compressed
+  PageCache_t       cache;
+} IncrWorker_t;
+
+typedef struct IncrRun {
+  const IncrManifest_t *parent;
+  IncrManifest_t    *m;             // under @lock while the walk adds to it
+  const char        *root;
+  uint32_t          generation;
+  BackupEngine_t    *engine;        // reads changed files, its pool walks the tree
+  IncrWorker_t      *workers;       // SCHED_MAX_WORKERS, set up on first use
+  int               blocks_fd;
+  uint64_t          blocks_off;     // under @lock
+  const Codec_t     *codec;
+  CodecSpec_t       spec;
+  size_t            out_cap;
+  IncrStats_t       stats;
+  bool              direct_io;
+  bool              live;           // a data directory in backup mode: what the server rebuilds is left out
+  bool              failed;         // stops the walk and the reads left
+  uint64_t          behind;         // of the .blocks file, evicted up to here; under @lock
+  pthread_mutex_t   lock;
+  char              message[BUF_LEN_M];  // the first failure
+} IncrRun_t;
+
+
+int incr_write_all(int fd, const unsigned char *data, size_t len) {
+  while (len > 0) {
+    ssize_t n = write(fd, data, len);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n <= 0) return -1;
+    data += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+/* reads up to @len bytes, stopping early only at end of file */
+ssize_t incr_read_full(int fd, unsigned char *dst, size_t len) {
+  size_t have = 0;
+
+  while (have < len) {
+    ssize_t n = read(fd, dst + have, len - have);
+
+    if (n < 0 && errno == EINTR) continue;
+    if (n < 0) return -1;
+    if (n == 0) break;
+    have += (size_t)n;
+  }
+
+  return (ssize_t)have;
+}
+
+int incr_block_hash(const unsigned char *data, size_t len, unsigned char hash[INCR_HASH_LEN]) {
+  unsigned char digest[EVP_MAX_MD_SIZE];
+
+  if (EVP_Digest(data, len, digest, NULL, EVP_sha256(), NULL) != 1) return -1;
+  memcpy(hash, digest, INCR_HASH_LEN);
+
+  return 0;
+}
+
+/* keeps the first failure, "@what @path: <@error>", or "@what @path" for @error 0; always returns -1 */
+int incr_run_fail(IncrRun_t *run, const char *what, const char *path, int error) {
+  __atomic_store_n(&run->failed, true, __ATOMIC_RELEASE);
+  pthread_mutex_lock(&run->lock);
+  if (!run->message[0] && error) {
+    snprintf(run->message, sizeof(run->message), "%s %.400s: %s", what, path, strerror(error));
+  } else if (!run->message[0]) {
+    snprintf(run->message, sizeof(run->message), "%s %.400s", what, path);
+  }
+  pthread_mutex_unlock(&run->lock);
+
+  return -1;
+}
+
+/* the buffers and codec state of @worker, allocated the first time it reads a file; 0 on success */
+int incr_worker_ready(IncrRun_t *run, IncrWorker_t *worker) {
+  if (worker->buf) return 0;
+  worker->out = malloc(run->out_cap);
+  worker->codec_state = run->codec ? run->codec->create(&run->spec) : NULL;
+  if (!worker->out || (run->codec && !worker->codec_state)) return -1;
+  worker->buf = malloc(INCR_BLOCK_SIZE);
+
+  return worker->buf ? 0 : -1;
+}
+
+/* compresses one block on the calling worker, appends it to the .blocks file and points @block at it */
+int incr_store_block(IncrRun_t *run, IncrWorker_t *worker, const unsigned char *data, size_t len,
+  IncrBlock_t *block) {
+  const unsigned char *stored = worker->out;
+  size_t stored_len = 0;
+  uint32_t raw = 0;
+  int status = 0;
+
+  // same rules as the compress stage: skip noise, and keep only real gains
+  if (!run->codec || (len >= CODEC_ENTROPY_SAMPLE && codec_sample_entropy(data, len) >= CODEC_RAW_ENTROPY_BITS)
+    || run->codec->compress(worker->codec_state, data, len, worker->out, run->out_cap, &stored_len) != 0
+    || stored_len * 100 >= len * (100 - CODEC_MIN_GAIN_PERCENT)) {
+    stored = data;
+    stored_len = len;
+    raw = INCR_STORED_RAW;
+  }
+  // the file grows by whole blocks, in whatever order the workers finish them
+  pthread_mutex_lock(&run->lock);
+  if (incr_write_all(run->blocks_fd, stored, stored_len) != 0) {
+    status = -1;
+  } else {
+    block->generation = run->generation;
+    block->stored_len = (uint32_t)stored_len | raw;
+    block->offset = run->blocks_off;
+    run->blocks_off += stored_len;
+    if (run->direct_io && run->blocks_off - run->behind >= PAGECACHE_WRITE_BEHIND) {
+      pagecache_write_behind(run->blocks_fd, run->behind, run->blocks_off);
+      run->behind = run->blocks_off;
+    }
+  }
+  pthread_mutex_unlock(&run->lock);
+  if (status != 0) return -1;
+  __atomic_add_fetch(&run->stats.blocks_written, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&run->stats.bytes_written, stored_len, __ATOMIC_RELAXED);
+
+  return 0;
+}
+
+/* engine callback: reads one changed file, storing the blocks whose hash is not the parent's */
+int incr_backup_object(const DumpObject_t *obj, size_t worker_id, void *ctx) {
+  IncrRun_t *run = ctx;
+  IncrWorker_t *worker = &run->workers[worker_id];
+  IncrFile_t *prev = NULL, *file;
+  uint32_t block_size = run->m->block_size;
+  char path[BUF_LEN];
+  int fd, status = 0;
+
+  if (__atomic_load_n(&run->failed, __ATOMIC_ACQUIRE)) return -1;
+  // the walk is still adding files
+  pthread_mutex_lock(&run->lock);
+  HASH_FIND_STR(run->m->files, obj->name, file);
+  pthread_mutex_unlock(&run->lock);
+  if (!file) return incr_run_fail(run, "Cannot back up", obj->name, ENOENT);
+  if (run->parent) HASH_FIND_STR(run->parent->files, obj->name, prev);
+  if (incr_worker_ready(run, worker) != 0) return incr_run_fail(run, "Cannot back up", obj->name, ENOMEM);
+
+  snprintf(path, sizeof(path), "%s/%s", run->root, file->path);
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd < 0 && errno == ENOENT && run->live) {
+    // dropped since it was listed; replaying the backup's WAL drops it too
+    __atomic_sub_fetch(&run->stats.files, 1, __ATOMIC_RELAXED);
+    __atomic_sub_fetch(&run->stats.blocks, file->block_count, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&run->lock);
+    incr_manifest_remove_file(run->m, file);
+    pthread_mutex_unlock(&run->lock);
+
+    return 0;
+  }
+  if (fd < 0) return incr_run_fail(run, "Cannot open", path, errno);
+  posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+  if (run->direct_io) pagecache_probe(&worker->cache, fd, NULL, 0, (size_t)file->size);
+  for (uint64_t i = 0; status == 0 && i < file->block_count; i++) {
+    size_t want = file->size - i * block_size < block_size ? (size_t)(file->size - i * block_size) : block_size;
+    IncrBlock_t *block = &file->blocks[i];
+    ssize_t n = incr_read_full(fd, worker->buf, want);
+
+    pagecache_drop(&worker->cache, NULL, i * block_size, want);
+    // in backup mode a file is copied at the size it was listed with, WAL replay puts the rest right
+    if (n >= 0 && n < (ssize_t)want && run->live) memset(worker->buf + n, 0, want - (size_t)n);
+    if (n < 0) {
+      status = incr_run_fail(run, "Cannot read", path, errno);
+    } else if (n != (ssize_t)want && !run->live) {
+      status = incr_run_fail(run, "Changed size during the backup, the tree is in use:", path, 0);
+    } else if (incr_block_hash(worker->buf, want, block->hash) != 0) {
+      status = incr_run_fail(run, "Cannot hash a block of", path, EIO);
+    } else if (prev && i < prev->block_count && memcmp(prev->blocks[i].hash, block->hash, INCR_HASH_LEN) == 0) {
+      *block = prev->blocks[i];
+    } else if (incr_store_block(run, worker, worker->buf, want, block) != 0) {
+      status = incr_run_fail(run, "Cannot write blocks of", file->path, errno);
+    }
+    if (n > 0) __atomic_add_fetch(&run->stats.bytes_read, (uint64_t)n, __ATOMIC_RELAXED);
+    if (status == 0 && __atomic_load_n(&run->failed, __ATOMIC_ACQUIRE)) status = -1;
+  }
+  close(fd);
+
+  return status;
+}
+
+/* walk visitor: records every directory and file, queues the files that changed on the engine */
+int incr_visit(const TreeEntry_t *entry, size_t worker_id, void *ctx) {
+  IncrRun_t *run = ctx;
+  const struct statx *stx = entry->stx;
+  int64_t mtime_ns = (int64_t)stx->stx_mtime.tv_sec * 1000000000LL + stx->stx_mtime.tv_nsec;
+  bool dir = S_ISDIR(stx->stx_mode);
+  IncrFile_t *prev = NULL, *file = NULL;
+
+  (void)worker_id;
+  // a failed read stops the walk as well
+  if (__atomic_load_n(&run->failed, __ATOMIC_ACQUIRE)) return -1;
+  // links, sockets, fifos and devices are not data, they are left out
+  if (!dir && !S_ISREG(stx->stx_mode)) return 0;
+  if (run->live && !dir && incr_live_excluded(entry->path)) return 0;
+  // engine objects are named by path
+  if (strlen(entry->path) >= BUF_LEN_S) return incr_run_fail(run, "Cannot back up", entry->path, ENAMETOOLONG);
+  // directories are recorded too, empty ones have to come back on restore
+  pthread_mutex_lock(&run->lock);
+  // the files staged by backup mode go into directories the tree already had
+  if (dir) HASH_FIND_STR(run->m->files, entry->path, file);
+  if (!file) file = incr_manifest_add_file(run->m, entry->path, stx->stx_mode, dir ? 0 : stx->stx_size,
+    dir ? 0 : mtime_ns);
+  pthread_mutex_unlock(&run->lock);
+  if (!file) return incr_run_fail(run, "Cannot record", entry->path, ENOMEM);
+  if (dir) return run->live && incr_live_emptied(entry->path) ? TREEWALK_SKIP : 0;
+  __atomic_add_fetch(&run->stats.files, 1, __ATOMIC_RELAXED);
+  __atomic_add_fetch(&run->stats.blocks, file->block_count, __ATOMIC_RELAXED);
+
+  // size and mtime unchanged: the file is not even opened
+  if (run->parent) HASH_FIND_STR(run->parent->files, entry->path, prev);
+  if (prev && prev->size == file->size && prev->mtime_ns == mtime_ns && prev->block_count == file->block_count) {
+    if (file->block_count) memcpy(file->blocks, prev->blocks, file->block_count * sizeof(IncrBlock_t));
+    __atomic_add_fetch(&run->stats.files_unchanged, 1, __ATOMIC_RELAXED);
+
+    return 0;
+  }
+  if (engine_submit(run->engine, entry->path, (size_t)file->size, 0, 1) != ENGINE_OK) {
+    return incr_run_fail(run, "Cannot back up", entry->path, ENOMEM);
+  }
+
+  return 0;
+}
+
+/**
+ * incr_walk - backs up the tree @root, listed in parallel on the pool
+ * of the run's engine while the changed files are read on it
+ * @run: the run, its .blocks file open
+ * @cfg: application config, `runtime` sizes the work
+ * @root: the tree
+ *
+ * Return: IncrStatus_t, the reason in @run->message
+ **/
+IncrStatus_t incr_walk(IncrRun_t *run, AppConfig_t *cfg, const char *root) {
+  EngineError_t *engine_err = NULL;
+  TreeWalkError_t *walk_err = NULL;
+  TreeWalk_t *walk = NULL;
+  IncrStatus_t status = INCR_OK;
+  EngineStatus_t engine_status;
+  TreeWalkStatus_t walk_status;
+
+  run->root = root;
+  if (!(run->engine = init_backup_engine(cfg))) {
+    snprintf(run->message, sizeof(run->message), "Failed to allocate incremental backup!");
+    status = INCR_MEMORY_ERROR;
+  } else if (engine_start(run->engine, incr_backup_object, run, &engine_err) != ENGINE_OK) {
+    snprintf(run->message, sizeof(run->message), "%s", engine_err ? engine_err->message : "?");
+    status = INCR_IO_ERROR;
+  } else if (!(walk = init_tree_walk(root, STATX_TYPE | STATX_MODE | STATX_SIZE | STATX_MTIME, incr_visit, run,
+    &walk_err)) || tree_walk_submit(walk, run->engine->sched) != TREEWALK_OK) {
+    snprintf(run->message, sizeof(run->message), "%s", walk_err ? walk_err->message : "Failed to start the walk!");
+    status = walk ? INCR_MEMORY_ERROR : INCR_IO_ERROR;
+  } else {
+    // directories and reads share the pool: the engine is done when the walk is
+    engine_status = engine_wait(run->engine, &engine_err);
+    walk_status = tree_walk_finish(walk, &walk_err);
+    if (engine_status != ENGINE_OK || walk_status != TREEWALK_OK) {
+      // the visitor's or the callback's reason is more use than the walk's or engine's summary
+      if (!run->message[0]) {
+        snprintf(run->message, sizeof(run->message), "%s",
+          walk_err ? walk_err->message : engine_err ? engine_err->message : "?");
+      }
+      status = walk_status == TREEWALK_MEMORY_ERROR ? INCR_MEMORY_ERROR : INCR_IO_ERROR;
+    }
+  }
+
+  destroy_engine_error(&engine_err);
+  destroy_treewalk_error(&walk_err);
+  destroy_tree_walk(&walk);
+  destroy_backup_engine(&run->engine);
+
+  return status;
+}
+
+/* reads the name of the last backup from the head file; 0 if there is one */
+int incr_read_head(const StorageConfig_t *cfg, char *name, size_t name_len) {
+  char path[BUF_LEN];
+  FILE *fh;
+  int status = -1;
+
+  snprintf(path, sizeof(path), "%s/%s", cfg->output_path, INCR_HEAD_FILE);
+  fh = fopen(path, "r");
+  if (fh && fgets(name, (int)name_len, fh)) {
+    name[strcspn(name, "\r\n")] = '\0';
+    status = name[0] ? 0 : -1;
+  }
+  if (fh) fclose(fh);
+
+  return status;
+}
+
+int incr_write_head(const StorageConfig_t *cfg, const char *name) {
+  char path[BUF_LEN], partial[BUF_LEN + 16];
+  int fd, status;
+
+  snprintf(path, sizeof(path), "%s/%s", cfg->output_path, INCR_HEAD_FILE);
+  snprintf(partial, sizeof(partial), "%s.partial", path);
+  fd = open(partial, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+  if (fd < 0) return -1;
+  status = incr_write_all(fd, (const unsigned char *)name, strlen(name)) == 0
+    && incr_write_all(fd, (const unsigned char *)"\n", 1) == 0 && fsync(fd) == 0 ? 0 : -1;
+  if (close(fd) != 0) status = -1;
+  if (status == 0 && rename(partial, path) != 0) status = -1;
+  if (status != 0) unlink(partial);
+
+  return status;
+}
+
+/* picks the parent and chain of the new backup */
+IncrStatus_t incr_prepare(const AppConfig_t *cfg, const char *name, IncrManifest_t **parent, IncrRun_t *run) {
+  char head[BUF_LEN_S], path[BUF_LEN];
+
+  if (cfg->db->incremental_enabled && incr_read_head(cfg->storage, head, sizeof(head)) == 0) {
+    snprintf(path, sizeof(path), "%s/%s%s", cfg->storage->output_path, head, INCR_MANIFEST_SUFFIX);
+    *parent = incr_manifest_load(path, run->message, sizeof(run->message));
+    if (!*parent) return INCR_CORRUPT_ERROR;
+  }
+  // a parent cut into other block sizes cannot be compared block by block
+  if (*parent && (*parent)->block_size == INCR_BLOCK_SIZE) {
+    for (uint32_t i = 0; i < (*parent)->chain_len; i++) {
+      if (incr_manifest_push_chain(run->m, (*parent)->chain[i]) < 0) return INCR_MEMORY_ERROR;
+    }
+    run->parent = *parent;
+  }
+  if (incr_manifest_push_chain(run->m, name) < 0) return INCR_MEMORY_ERROR;
+  run->generation = run->m->chain_len - 1;
+
+  return INCR_OK;
+}
+
+IncrStatus_t incremental_backup(AppConfig_t *cfg, const char *source_dir, const char *name,
+  IncrStats_t *stats, IncrError_t **err) {
+  char blocks_path[BUF_LEN], partial[BUF_LEN + 16], manifest_path[BUF_LEN];
+  unsigned char header[INCR_HEADER_LEN] = { 0 };
+  char stage[BUF_LEN];
+  IncrManifest_t *parent = NULL;
+  IncrBracket_t bracket = { 0 };
+  IncrRun_t run;
+  IncrStatus_t status = INCR_OK;
+  CodecSpec_t spec;
+  struct stat st;
+  long server;
+
+  memset(&run, 0, sizeof(run));
+  run.blocks_fd = -1;
+  run.direct_io = cfg->storage->direct_io;
+  pthread_mutex_init(&run.lock, NULL);
+  if (!name[0] || name[0] == '.' || strchr(name, '/') || strlen(name) >= BUF_LEN_S) {
+    snprintf(run.message, sizeof(run.message), "Invalid backup name: %s", name);
+    status = INCR_CONFIG_ERROR;
+  } else if (storage_to_stdout(cfg->storage)) {
+    snprintf(run.message, sizeof(run.message), "db.incremental_enabled keeps its chain in a directory, "
+      "storage.output_path cannot be -");
+    status = INCR_CONFIG_ERROR;
+  } else if (storage_encryption_enabled(cfg->storage) || remote_enabled(cfg->storage)) {
+    // blocks are shared along the chain, not sealed or uploaded per backup
+    snprintf(run.message, sizeof(run.message),
+      "db.incremental_enabled cannot be combined with encryption_key_path or remote_target");
+    status = INCR_CONFIG_ERROR;
+  } else if (codec_parse_spec(cfg->storage->compression, &spec) != 0
+    || (spec.id != CODEC_NONE && !codec_lookup(spec.id))) {
+    snprintf(run.message, sizeof(run.message), "Unsupported storage compression: %s", cfg->storage->compression);
+    status = INCR_CONFIG_ERROR;
+  }
+
+  snprintf(manifest_path, sizeof(manifest_path), "%s/%s%s", cfg->storage->output_path, name, INCR_MANIFEST_SUFFIX);
+  snprintf(blocks_path, sizeof(blocks_path), "%s/%s%s", cfg->storage->output_path, name, INCR_BLOCKS_SUFFIX);
+  snprintf(partial, sizeof(partial), "%s.partial", blocks_path);
+  if (status == INCR_OK && stat(manifest_path, &st) == 0) {
+    snprintf(run.message, sizeof(run.message), "Backup %s already exists", name);
+    status = INCR_CONFIG_ERROR;
+  }
+  // without a server to put in backup mode the tree has to hold still
+  run.live = pgdump_supported(cfg->db);
+  if (status == INCR_OK && !run.live && (server = incr_live_server(source_dir)) > 0) {
+    snprintf(run.message, sizeof(run.message), "A PostgreSQL server (pid %ld) runs in %.300s: set db.uri to it "
+      "to copy it in backup mode, or back up a stopped or snapshot-mounted copy", server, source_dir);
+    status = INCR_CONFIG_ERROR;
+  }
+  snprintf(stage, sizeof(stage), "%s/%s%s", restore_fetch_dir(cfg), name, INCR_STAGE_SUFFIX);
+
+  if (status == INCR_OK) {
+    spec.long_window = false;
+    spec.workers = 0;
+    run.spec = spec;
+    run.codec = spec.id != CODEC_NONE ? codec_lookup(spec.id) : NULL;
+    run.m = init_incr_manifest(INCR_BLOCK_SIZE);
+    run.out_cap = INCR_BLOCK_SIZE + PIPELINE_BLOCK_HEADROOM(INCR_BLOCK_SIZE);
+    run.workers = calloc(SCHED_MAX_WORKERS, sizeof(IncrWorker_t));
+    for (size_t i = 0; run.workers && i < SCHED_MAX_WORKERS; i++) init_page_cache(&run.workers[i].cache);
+    if (!run.m || !run.workers) {
+      snprintf(run.message, sizeof(run.message), "Failed to allocate incremental backup!");
+      status = INCR_MEMORY_ERROR;
+    }
+  }
+  if (status == INCR_OK) status = incr_prepare(cfg, name, &parent, &run);
+
+  if (status == INCR_OK) {
+    memcpy(header, INCR_BLOCKS_MAGIC, strlen(INCR_BLOCKS_MAGIC));
+    header[7] = INCR_FORMAT_VERSION;
+    header[8] = (unsigned char)spec.id;
+    if ((mkdir(cfg->storage->output_path, 0750) != 0 && errno != EEXIST)
+      || (run.blocks_fd = open(partial, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640)) < 0
+      || incr_write_all(run.blocks_fd, header, sizeof(header)) != 0) {
+      snprintf(run.message, sizeof(run.message), "Cannot create %.400s: %s", partial, strerror(errno));
+      status = INCR_IO_ERROR;
+    }
+    run.blocks_off = sizeof(header);
+  }
+  if (status == INCR_OK && run.live) status = incr_bracket_start(&bracket, cfg, name, run.message, sizeof(run.message));
+  if (status == INCR_OK) status = incr_walk(&run, cfg, source_dir);
+  // what makes the copy restorable is backed up from the stage, next to the tree's own files
+  if (status == INCR_OK && run.live) {
+    // left over by a run that did not get to clean up
+    incr_stage_remove(stage);
+    if (mkdir(stage, 0700) != 0) {
+      snprintf(run.message, sizeof(run.message), "Cannot create %.400s: %s", stage, strerror(errno));
+      status = INCR_IO_ERROR;
+    } else if ((status = incr_bracket_stop(&bracket, stage, run.message, sizeof(run.message))) == INCR_OK) {
+      run.live = false;
+      status = incr_walk(&run, cfg, stage);
+    }
+    incr_stage_remove(stage);
+  }
+  incr_bracket_close(&bracket);
+
+  // blocks first, then the manifest naming them, then the head pointing at it
+  if (status == INCR_OK && (fsync(run.blocks_fd) != 0 || rename(partial, blocks_path) != 0)) {
+    snprintf(run.message, sizeof(run.message), "Cannot flush %.400s: %s", blocks_path, strerror(errno));
+    status = INCR_IO_ERROR;
+  }
+  if (status == INCR_OK && run.direct_io) pagecache_write_behind(run.blocks_fd, run.behind, run.blocks_off);
+  if (status == INCR_OK && incr_manifest_save(run.m, manifest_path) != 0) {
+    snprintf(run.message, sizeof(run.message), "Cannot write %.400s: %s", manifest_path, strerror(errno));
+    unlink(blocks_path);
+    status = INCR_IO_ERROR;
+  }
+  if (status == INCR_OK && incr_write_head(cfg->storage, name) != 0) {
+    snprintf(run.message, sizeof(run.message), "Cannot update %s: %s", INCR_HEAD_FILE, strerror(errno));
+    status = INCR_IO_ERROR;
+  }
+
+  if (run.blocks_fd >= 0) close(run.blocks_fd);
+  if (status != INCR_OK) unlink(partial);
+  run.stats.generation = run.generation;
+  if (stats) *stats = run.stats;
+  for (size_t i = 0; run.workers && i < SCHED_MAX_WORKERS; i++) {
+    if (run.workers[i].codec_state) run.codec->destroy(run.workers[i].codec_state);
+    destroy_page_cache(&run.workers[i].cache);
+    free(run.workers[i].buf);
+    free(run.workers[i].out);
+  }
+  free(run.workers);
+  destroy_incr_manifest(&run.m);
+  destroy_incr_manifest(&parent);
+  pthread_mutex_destroy(&run.lock);
+  if (status != INCR_OK && err) *err = create_incr_error(status, run.message);
+
+  return status;
+}
@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/pgwire.h"
+
+
+/* appends one DataRow to @res, growing its value array as needed */
+int pg_result_append(PgResult_t *res, size_t *cap, const unsigned char *payload, size_t len) {
+  size_t pos = 2;
+  size_t base = res->rows * res->cols;
+
+  if (len < 2 || pg_get_be(payload, 2) != res->cols) return -1;
+  if (base + res->cols > *cap) {
+    size_t grown_cap = *cap ? *cap * 2 : res->cols * 64;
+    char **grown;
+
+    while (grown_cap < base + res->cols) grown_cap *= 2;
+    grown = realloc(res->values, grown_cap * sizeof(char *));
+    if (!grown) return -1;
+    res->values = grown;
+    *cap = grown_cap;
+  }
+  for (size_t i = 0; i < res->cols; i++) res->values[base + i] = NULL;
+  res->rows++;
+
+  for (size_t i = 0; i < res->cols; i++) {
+    uint64_t field_len;
+
+    if (pos + 4 > len) return -1;
+    field_len = pg_get_be(payload + pos, 4);
+    pos += 4;
+    if (field_len == 0xffffffffu) continue;
+    if (field_len > len - pos) return -1;
+    res->values[base + i] = malloc((size_t)field_len + 1);
+    if (!res->values[base + i]) return -1;
+    memcpy(res->values[base + i], payload + pos, (size_t)field_len);
+    res->values[base + i][field_len] = '\0';
+    pos += (size_t)field_len;
+  }
+
+  return 0;
+}
+
+PgStatus_t pg_query(PgConn_t *conn, const char *sql, PgResult_t **out) {
+  PgResult_t *res = NULL;
+  const unsigned char *payload;
+  size_t len, cap = 0;
+  char type;
+
+  if (out) *out = NULL;
+  conn->status = PG_OK;
+  if (pg_send_message(conn, 'Q', sql, strlen(sql) + 1) != 0) return conn->status;
+
+  // an error still runs to ReadyForQuery, so the connection stays usable
+  for (;;) {
+    if (pg_read_message(conn, &type, &payload, &len) != 0) break;
+    if (type == 'Z') {
+      conn->txn_status = len ? (char)payload[0] : 'E';
+      break;
+    }
+    if (type == 'E') pg_take_error(conn, PG_QUERY_ERROR, payload, len);
+    if (conn->status != PG_OK || !out) continue;
+
+    if (type == 'T') {
+      destroy_pg_result(&res);
+      cap = 0;
+      res = calloc(1, sizeof(PgResult_t));
+      if (!res || len < 2) pg_fail(conn, res ? PG_PROTOCOL_ERROR : PG_MEMORY_ERROR, "Failed to read a row description");
+      else res->cols = (size_t)pg_get_be(payload, 2);
+    } else if (type == 'D' && res) {
+      if (pg_result_append(res, &cap, payload, len) != 0) pg_fail(conn, PG_PROTOCOL_ERROR, "Failed to read a data row");
+    } else if (type == 'C' && res) {
+      snprintf(res->command, sizeof(res->command), "%.*s", (int)strnlen((const char *)payload, len), payload);
+    }
+  }
+
+  if (conn->status != PG_OK) destroy_pg_result(&res);
+  if (out) *out = res;
+
+  return conn->status;
+}
+
+PgStatus_t pg_exec(PgConn_t *conn, const char *sql) {
+  return pg_query(conn, sql, NULL);
+}
+
+/**
+ * pg_copy_out - runs a COPY ... TO STDOUT and streams its data
+ * @conn: the connection
+ * @sql: the COPY statement
+ * @emit: called with each CopyData message, in place in the buffer
+ * @ctx: opaque pointer passed to @emit
+ * @bytes: written number of data bytes received, may be NULL
+ *
+ * There is no way to stop a COPY short of cancelling it from a second
+ * connection, so when @emit fails the connection is abandoned: the
+ * call returns at once and the connection is only good for destroying.
+ *
+ * Return: PgStatus_t; on failure conn->message tells why
+ **/
+PgStatus_t pg_copy_out(PgConn_t *conn, const char *sql, PgCopyFn_t emit, void *ctx, uint64_t *bytes) {
+  const unsigned char *payload;
+  size_t len;
+  uint64_t total = 0;
+  bool copying = false;
+  char type;
+
+  conn->status = PG_OK;
+  if (pg_send_message(conn, 'Q', sql, strlen(sql) + 1) != 0) return conn->status;
+
+  for (;;) {
+    if (pg_read_message(conn, &type, &payload, &len) != 0) break;
+    if (type == 'Z') {
+      conn->txn_status = len ? (char)payload[0] : 'E';
+      if (conn->status == PG_OK && !copying) pg_fail(conn, PG_QUERY_ERROR, "statement is not a COPY ... TO STDOUT");
+      break;
+    }
+    if (type == 'E') pg_take_error(conn, PG_QUERY_ERROR, payload, len);
+    else if (type == 'H') copying = true;
+    else if (type == 'd' && copying && conn->status == PG_OK) {
+      if (emit(ctx, payload, len) != 0) {
+        pg_fail(conn, PG_QUERY_ERROR, "COPY consumer failed");
+        break;
+      }
+      total += len;
+    }
+  }
+  if (bytes) *bytes = total;
+
+  return conn->status;
+}
+
+size_t pg_copy_strip(PgCopyStrip_t *strip, const unsigned char *in, size_t len, unsigned char *out, size_t room,
+  size_t *produced) {
+  size_t pos = 0, made = 0, take;
+  uint64_t message_len;
+
+  while (pos < len && !strip->other) {
+    if (strip->pending == 0) {
+      // a header may be cut by the end of a read, it is gathered across calls
+      take = PG_HEADER_LEN - strip->header_len;
+      if (take > len - pos) take = len - pos;
+      memcpy(strip->header + strip->header_len, in + pos, take);
+      strip->header_len += take;
+      pos += take;
+      if (strip->header_len < PG_HEADER_LEN) break;
+      strip->header_len = 0;
+      message_len = pg_get_be(strip->header + 1, 4);
+      // a bad length is left for pg_read_message to report
+      if (strip->header[0] != 'd' || message_len < 4 || message_len > PG_MAX_MESSAGE_LEN) strip->other = true;
+      else strip->pending = message_len - 4;
+      continue;
+    }
+    take = len - pos;
+    if (take > strip->pending) take = (size_t)strip->pending;
+    if (take > room - made) take = room - made;
+    if (take == 0) break;
+    if (out + made != in + pos) memmove(out + made, in + pos, take);
+    made += take;
+    pos += take;
+    strip->pending -= take;
+  }
+  *produced = made;
+
+  return pos;
+}
+
+/* one read of COPY data into the consumer's room, from what is buffered or else off the socket */
+int pg_copy_read(PgConn_t *conn, PgCopyStrip_t *strip, PgCopyReserveFn_t reserve, void *ctx, size_t *produced) {
+  size_t room, used;
+  unsigned char *out = reserve(ctx, &room);
+  ssize_t n;
+
+  if (!out || room == 0) {
+    pg_fail(conn, PG_QUERY_ERROR, "COPY consumer failed");
+
+    return -1;
+  }
+  if (conn->buf_end > conn->buf_start) {
+    used = pg_copy_strip(strip, conn->buf + conn->buf_start, conn->buf_end - conn->buf_start, out, room, produced);
+    conn->buf_start += used;
+    if (conn->buf_start == conn->buf_end) conn->buf_start = conn->buf_end = 0;
+  } else {
+    n = pg_recv(conn, out, room);
+    if (n < 0) return -1;
+    used = pg_copy_strip(strip, out, (size_t)n, out, room, produced);
+    // whatever follows the CopyData goes back to the receive buffer
+    if (pg_unread(conn, out + used, (size_t)n - used) != 0) return -1;
+  }
+  if (strip->other && pg_unread(conn, strip->header, PG_HEADER_LEN) != 0) return -1;
+
+  return 0;
+}
+
+PgStatus_t pg_copy_out_direct(PgConn_t *conn, const char *sql, PgCopyReserveFn_t reserve, PgCopyCommitFn_t commit,
+  void *ctx, uint64_t *bytes) {
+  PgCopyStrip_t strip = { .header_len = 0 };
+  const unsigned char *payload;
+  size_t len, produced;
+  uint64_t total = 0;
+  bool copying = false, copied = false;
+  char type;
+
+  conn->status = PG_OK;
+  if (pg_send_message(conn, 'Q', sql, strlen(sql) + 1) != 0) return conn->status;
+
+  for (;;) {
+    if (copying && !strip.other && conn->status == PG_OK) {
+      if (pg_copy_read(conn, &strip, reserve, ctx, &produced) != 0) break;
+      if (produced && commit(ctx, produced) != 0) {
+        pg_fail(conn, PG_QUERY_ERROR, "COPY consumer failed");
+        break;
+      }
+      total += produced;
+      continue;
+    }
+    // the messages around the data, and any notice in its midst
+    if (pg_read_message(conn, &type, &payload, &len) != 0) break;
+    strip.other = false;
+    if (type == 'Z') {
+      conn->txn_status = len ? (char)payload[0] : 'E';
+      if (conn->status == PG_OK && !copied) pg_fail(conn, PG_QUERY_ERROR, "statement is not a COPY ... TO STDOUT");
+      break;
+    }
+    if (type == 'E') pg_take_error(conn, PG_QUERY_ERROR, payload, len);
+    else if (type == 'H') copying = copied = true;
+    else if (type == 'c') copying = false;
+  }
+  if (bytes) *bytes = total;
+
+  return conn->status;
+}
+
+PgStatus_t pg_copy_in_start(PgConn_t *conn, const char *sql) {
+  const unsigned char *payload;
+  size_t len;
+  char type;
+
+  conn->status = PG_OK;
+  if (pg_send_message(conn, 'Q', sql, strlen(sql) + 1) != 0) return conn->status;
+
+  for (;;) {
+    if (pg_read_message(conn, &type, &payload, &len) != 0) break;
+    if (type == 'G') return PG_OK;
+    if (type == 'Z') {
+      conn->txn_status = len ? (char)payload[0] : 'E';
+      if (conn->status == PG_OK) pg_fail(conn, PG_QUERY_ERROR, "statement is not a COPY ... FROM STDIN");
+      break;
+    }
+    if (type == 'E') pg_take_error(conn, PG_QUERY_ERROR, payload, len);
+  }
+
+  return conn->status;
+}
+
+int pg_copy_in_write(void *ctx, const unsigned char *data, size_t len) {
+  return pg_send_message(ctx, 'd', data, len);
+}
+
+PgStatus_t pg_copy_in_end(PgConn_t *conn, const char *failure) {
+  const unsigned char *payload;
+  size_t len;
+  char type;
+
+  conn->status = PG_OK;
+  if (failure ? pg_send_message(conn, 'f', failure, strlen(failure) + 1) : pg_send_message(conn, 'c', NULL, 0)) {
+    return conn->status;
+  }
+
+  // a server that failed the COPY early has ignored the data since, and says why here
+  for (;;) {
+    if (pg_read_message(conn, &type, &payload, &len) != 0) break;
+    if (type == 'Z') {
+      conn->txn_status = len ? (char)payload[0] : 'E';
+      break;
+    }
+    if (type == 'E') pg_take_error(conn, PG_QUERY_ERROR, payload, len);
+  }
+
+  return conn->status;
+}
+
+const char *pg_result_value(const PgResult_t *res, size_t row, size_t col) {
+  if (!res || row >= res->rows || col >= res->cols) return NULL;
+
+  return res->values[row * res->cols + col];
+}
+
+int pg_quote(char *dst, size_t dst_len, const char *text, char quote) {
+  size_t pos = strnlen(dst, dst_len);
+
+  if (pos + 3 > dst_len) return -1;
+  dst[pos++] = quote;
+  for (const char *p = text; *p; p++) {
+    if (pos + 3 >= dst_len) return -1;
+    if (*p == quote) dst[pos++] = quote;
+    dst[pos++] = *p;
+  }
+  dst[pos++] = quote;
+  dst[pos] = '\0';
+
+  return 0;
+}
@@ -0,0 +1,240 @@
+#define _GNU_SOURCE
+#include "include/remote.h"
+
+#ifdef DBEETLE_HAVE_CURL
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <curl/curl.h>
+
+typedef struct RemoteBody {
+  const unsigned char *data;
+  size_t            len;
+  size_t            pos;
+} RemoteBody_t;
+
+typedef struct RemoteReply {
+  char              *etag;
+  size_t            etag_len;
+  char              *response;
+  size_t            response_len;
+  size_t            response_pos;
+} RemoteReply_t;
+
+typedef struct RemoteRange {
+  int               fd;
+  uint64_t          offset;
+  size_t            len;
+  size_t            pos;
+} RemoteRange_t;
+
+static pthread_once_t remote_curl_once = PTHREAD_ONCE_INIT;
+
+
+void remote_curl_init(void) {
+  curl_global_init(CURL_GLOBAL_DEFAULT);
+}
+
+void *remote_http_open(void) {
+  CURL *curl;
+
+  // curl_global_init is not thread-safe on older libcurl
+  pthread_once(&remote_curl_once, remote_curl_init);
+  curl = curl_easy_init();
+
+  return curl;
+}
+
+void remote_http_close(void *curl) {
+  curl_easy_cleanup(curl);
+}
+
+size_t remote_read_body(char *dst, size_t size, size_t nmemb, void *ctx) {
+  RemoteBody_t *body = ctx;
+  size_t n = body->len - body->pos < size * nmemb ? body->len - body->pos : size * nmemb;
+
+  memcpy(dst, body->data + body->pos, n);
+  body->pos += n;
+
+  return n;
+}
+
+size_t remote_write_response(char *src, size_t size, size_t nmemb, void *ctx) {
+  RemoteReply_t *reply = ctx;
+  size_t n = size * nmemb;
+
+  // only the head of a response is kept; S3 replies we parse are small
+  if (reply->response && reply->response_pos + 1 < reply->response_len) {
+    size_t keep = reply->response_len - reply->response_pos - 1 < n ? reply->response_len - reply->response_pos - 1 : n;
+
+    memcpy(reply->response + reply->response_pos, src, keep);
+    reply->response_pos += keep;
+    reply->response[reply->response_pos] = '\0';
+  }
+
+  return n;
+}
+
+size_t remote_read_header(char *line, size_t size, size_t nmemb, void *ctx) {
+  RemoteReply_t *reply = ctx;
+  size_t n = size * nmemb, len;
+
+  if (!reply->etag || n < 5 || strncasecmp(line, "ETag:", 5) != 0) return n;
+  line += 5, len = n - 5;
+  while (len > 0 && isspace((unsigned char)*line)) line++, len--;
+  while (len > 0 && isspace((unsigned char)line[len - 1])) len--;
+  if (len < reply->etag_len) {
+    memcpy(reply->etag, line, len);
+    reply->etag[len] = '\0';
+  }
+
+  return n;
+}
+
+void remote_http_prepare(void *curl, const char *url) {
+  // a reset handle keeps its open connection to the remote
+  curl_easy_reset(curl);
+  curl_easy_setopt(curl, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(curl, CURLOPT_CONNECTTIMEOUT, (long)REMOTE_CONNECT_TIMEOUT);
+  // a stalled transfer is a failed attempt, not a hung backup
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_LIMIT, 1L);
+  curl_easy_setopt(curl, CURLOPT_LOW_SPEED_TIME, (long)REMOTE_STALL_TIMEOUT);
+  curl_easy_setopt(curl, CURLOPT_URL, url);
+}
+
+size_t remote_write_range(char *src, size_t size, size_t nmemb, void *ctx) {
+  RemoteRange_t *range = ctx;
+  size_t n = size * nmemb, done = 0;
+
+  // more than was asked for: the remote ignored the Range header
+  if (n > range->len - range->pos) return 0;
+  while (done < n) {
+    ssize_t w = pwrite(range->fd, src + done, n - done, (off_t)(range->offset + range->pos + done));
+
+    if (w < 0 && errno == EINTR) continue;
+    if (w <= 0) return 0;
+    done += (size_t)w;
+  }
+  range->pos += n;
+
+  return n;
+}
+
+int remote_http(void *curl, const char *method, const char *url, const unsigned char *body, size_t len,
+  long *status, char *etag, size_t etag_len, char *response, size_t response_len) {
+  RemoteBody_t upload = { body, len, 0 };
+  RemoteReply_t reply = { etag, etag_len, response, response_len, 0 };
+  struct curl_slist *headers = NULL;
+  CURLcode rc;
+
+  remote_http_prepare(curl, url);
+  if (response) response[0] = '\0';
+
+  // no 100-continue round trip per part
+  headers = curl_slist_append(headers, "Expect:");
+  headers = curl_slist_append(headers, "Content-Type: application/octet-stream");
+  curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+
+  if (strcmp(method, "PUT") == 0) {
+    curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+    curl_easy_setopt(curl, CURLOPT_READFUNCTION, remote_read_body);
+    curl_easy_setopt(curl, CURLOPT_READDATA, &upload);
+    curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)len);
+  } else if (strcmp(method, "POST") == 0) {
+    curl_easy_setopt(curl, CURLOPT_POST, 1L);
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDS, body ? (const char *)body : "");
+    curl_easy_setopt(curl, CURLOPT_POSTFIELDSIZE_LARGE, (curl_off_t)len);
+  } else {
+    curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, method);
+  }
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, remote_write_response);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &reply);
+  curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, remote_read_header);
+  curl_easy_setopt(curl, CURLOPT_HEADERDATA, &reply);
+
+  rc = curl_easy_perform(curl);
+  curl_slist_free_all(headers);
+  *status = 0;
+  if (rc != CURLE_OK) return -1;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, status);
+
+  return 0;
+}
+
+int remote_http_size(void *curl, const char *url, uint64_t *size, long *status) {
+  curl_off_t length = -1;
+  CURLcode rc;
+
+  remote_http_prepare(curl, url);
+  curl_easy_setopt(curl, CURLOPT_NOBODY, 1L);
+  rc = curl_easy_perform(curl);
+  *status = 0;
+  if (rc != CURLE_OK) return -1;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, status);
+  curl_easy_getinfo(curl, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length);
+  *size = length > 0 ? (uint64_t)length : 0;
+
+  return 0;
+}
+
+int remote_http_get_range(void *curl, const char *url, uint64_t offset, size_t len, int fd, long *status,
+  size_t *received) {
+  RemoteRange_t range = { fd, offset, len, 0 };
+  char bytes[BUF_LEN_XS];
+  CURLcode rc;
+
+  remote_http_prepare(curl, url);
+  snprintf(bytes, sizeof(bytes), "%lu-%lu", (unsigned long)offset, (unsigned long)(offset + len - 1));
+  curl_easy_setopt(curl, CURLOPT_RANGE, bytes);
+  curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, remote_write_range);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, &range);
+
+  rc = curl_easy_perform(curl);
+  *status = 0;
+  *received = range.pos;
+  if (rc != CURLE_OK) return -1;
+  curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, status);
+
+  return 0;
+}
+
+#else
+
+void *remote_http_open(void) {
+  return NULL;
+}
+
+void remote_http_close(void *curl) {
+  (void)curl;
+}
+
+int remote_http(void *curl, const char *method, const char *url, const unsigned char *body, size_t len,
+  long *status, char *etag, size_t etag_len, char *response, size_t response_len) {
+  (void)curl, (void)method, (void)url, (void)body, (void)len;
+  (void)etag, (void)etag_len, (void)response, (void)response_len;
+  *status = 0;
+
+  return -1;
+}
+
+int remote_http_size(void *curl, const char *url, uint64_t *size, long *status) {
+  (void)curl, (void)url;
+  *size = 0;
+  *status = 0;
+
+  return -1;
+}
+
+int remote_http_get_range(void *curl, const char *url, uint64_t offset, size_t len, int fd, long *status,
+  size_t *received) {
+  (void)curl, (void)url, (void)offset, (void)len, (void)fd;
+  *status = 0;
+  *received = 0;
+
+  return -1;
+}
+
+#endif /* DBEETLE_HAVE_CURL */
@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/sqlitedump.h"
+
+
+int sqlitedump_pwrite_full(int fd, const unsigned char *data, size_t len, off_t offset) {
+  while (len) {
+    ssize_t written = pwrite(fd, data, len, offset);
+
+    if (written < 0 && errno == EINTR) continue;
+    if (written <= 0) return -1;
+    data += written;
+    len -= (size_t)written;
+    offset += written;
+  }
+
+  return 0;
+}
+
+/* takes the object apart as it is decoded: header, page records, end record */
+int sqlitedump_restore_write(void *ctx, const unsigned char *data, size_t len) {
+  SqliteRestore_t *restore = ctx;
+  size_t take;
+
+  while (len) {
+    if (restore->ended) {
+      restore->invalid = true;
+
+      return -1;
+    }
+    if (restore->head_len < sizeof(restore->head)) {
+      take = sizeof(restore->head) - restore->head_len;
+      if (take > len) take = len;
+      memcpy(restore->head + restore->head_len, data, take);
+      restore->head_len += take;
+      if (restore->head_len == sizeof(restore->head)) {
+        restore->page_size = (uint32_t)archive_get_le(restore->head + SQLITEDUMP_MAGIC_LEN, 4);
+        if (memcmp(restore->head, SQLITEDUMP_MAGIC, SQLITEDUMP_MAGIC_LEN) != 0 || restore->page_size < 512
+          || restore->page_size > 65536 || (restore->page_size & (restore->page_size - 1)) != 0) {
+          restore->invalid = true;
+
+          return -1;
+        }
+      }
+    } else if (restore->page) {
+      take = restore->page_size - restore->page_pos;
+      if (take > len) take = len;
+      if (sqlitedump_pwrite_full(restore->fd, data, take,
+          (off_t)(restore->page - 1) * restore->page_size + restore->page_pos) != 0) {
+        return -1;
+      }
+      restore->page_pos += (uint32_t)take;
+      if (restore->page_pos == restore->page_size) restore->page = 0;
+    } else {
+      take = sizeof(restore->number) - restore->number_len;
+      if (take > len) take = len;
+      memcpy(restore->number + restore->number_len, data, take);
+      restore->number_len += take;
+      if (restore->number_len == sizeof(restore->number)) {
+        uint32_t value = (uint32_t)archive_get_le(restore->number, 4);
+
+        restore->number_len = 0;
+        if (restore->ending) {
+          restore->page_count = value;
+          restore->ended = true;
+        } else if (value == 0) {
+          restore->ending = true;
+        } else {
+          restore->page = value;
+          restore->page_pos = 0;
+        }
+      }
+    }
+    data += take;
+    len -= take;
+  }
+
+  return 0;
+}
+
+ArchiveStatus_t sqlitedump_restore(ArchiveReader_t *reader, const ArchiveObject_t *obj, int fd, ArchiveError_t **err) {
+  SqliteRestore_t restore;
+  ArchiveStatus_t status;
+  char message[BUF_LEN_M];
+
+  memset(&restore, 0, sizeof(restore));
+  restore.fd = fd;
+  status = archive_read_object(reader, obj, sqlitedump_restore_write, &restore, err);
+  if (restore.invalid || (status == ARCHIVE_OK && !restore.ended)) {
+    if (err) {
+      destroy_archive_error(err);
+      snprintf(message, sizeof(message), "%s is not a complete SQLite page stream", obj->name);
+      *err = create_archive_error(ARCHIVE_FORMAT_ERROR, message);
+    }
+
+    return ARCHIVE_FORMAT_ERROR;
+  }
+  if (status != ARCHIVE_OK) return status;
+
+  // pages past the final count were copied before the database shrank
+  if (ftruncate(fd, (off_t)restore.page_count * restore.page_size) != 0) {
+    snprintf(message, sizeof(message), "Cannot size the restored %s: %s", obj->name, strerror(errno));
+    if (err) *err = create_archive_error(ARCHIVE_IO_ERROR, message);
+
+    return ARCHIVE_IO_ERROR;
+  }
+
+  return ARCHIVE_OK;
+}
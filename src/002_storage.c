@@ -0,0 +1,76 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <openssl/crypto.h>
+#include "include/storage.h"
+
+
+/* reads the file header of @path; 0 if it is an encrypted archive */
+int storage_read_cipher_header(const char *path, unsigned char header[CIPHER_FILE_HEADER_LEN]) {
+  int fd = open(path, O_RDONLY | O_CLOEXEC);
+  CipherId_t id;
+  CodecId_t codec;
+  ssize_t n;
+
+  if (fd < 0) return -1;
+  n = pread(fd, header, CIPHER_FILE_HEADER_LEN, 0);
+  close(fd);
+
+  return n == CIPHER_FILE_HEADER_LEN && cipher_parse_file_header(header, CIPHER_FILE_HEADER_LEN, &id, &codec) == 0 ? 0 : -1;
+}
+
+StorageStatus_t storage_rewrap_archives(const StorageConfig_t *cfg, const char *new_key_path, size_t *count,
+  StorageError_t **err) {
+  unsigned char old_key[CIPHER_KEY_LEN], new_key[CIPHER_KEY_LEN], new_id[CIPHER_KEY_ID_LEN];
+  unsigned char header[CIPHER_FILE_HEADER_LEN];
+  char message[BUF_LEN_M], path[BUF_LEN];
+  StorageStatus_t status = STORAGE_OK;
+  struct dirent *entry;
+  DIR *dir;
+
+  *count = 0;
+  if (!storage_encryption_enabled(cfg)) {
+    if (err) *err = create_storage_error(STORAGE_CONFIG_ERROR, "storage.encryption_key_path is not set");
+
+    return STORAGE_CONFIG_ERROR;
+  }
+  if (cipher_load_key(cfg->encryption_key_path, old_key, message, sizeof(message)) != 0
+    || cipher_load_key(new_key_path, new_key, message, sizeof(message)) != 0) {
+    OPENSSL_cleanse(old_key, sizeof(old_key));
+    if (err) *err = create_storage_error(STORAGE_CONFIG_ERROR, message);
+
+    return STORAGE_CONFIG_ERROR;
+  }
+  cipher_key_id(new_key, new_id);
+
+  dir = opendir(cfg->output_path);
+  if (!dir) {
+    snprintf(message, sizeof(message), "Cannot open output_path %s", cfg->output_path);
+    status = STORAGE_IO_ERROR;
+  }
+  while (dir && status == STORAGE_OK && (entry = readdir(dir)) != NULL) {
+    size_t name_len = strlen(entry->d_name);
+
+    // a .partial archive belongs to a running backup, which has its own data key in memory
+    if (entry->d_name[0] == '.' || (name_len > strlen(STORAGE_PARTIAL_SUFFIX)
+      && strcmp(entry->d_name + name_len - strlen(STORAGE_PARTIAL_SUFFIX), STORAGE_PARTIAL_SUFFIX) == 0)) continue;
+    snprintf(path, sizeof(path), "%s/%s", cfg->output_path, entry->d_name);
+    if (storage_read_cipher_header(path, header) != 0) continue;
+    if (memcmp(header + CIPHER_FILE_PREFIX_LEN, new_id, CIPHER_KEY_ID_LEN) == 0) continue;
+
+    if (cipher_rewrap_file(path, old_key, new_key, message, sizeof(message)) != 0) {
+      status = STORAGE_IO_ERROR;
+    } else {
+      (*count)++;
+    }
+  }
+  if (dir) closedir(dir);
+  OPENSSL_cleanse(old_key, sizeof(old_key));
+  OPENSSL_cleanse(new_key, sizeof(new_key));
+  if (status != STORAGE_OK && err) *err = create_storage_error(status, message);
+
+  return status;
+}
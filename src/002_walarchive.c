@@ -0,0 +1,175 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "include/walarchive.h"
+#include "include/restore.h"
+
+
+/* opens the local index, or the remote copy fetched to @fetched (written, "" when none was) */
+WalIndex_t *wal_fetch_index(AppConfig_t *cfg, char *fetched, size_t fetched_len, WalArchiveError_t **err) {
+  WalIndex_t *index = wal_index_open(cfg->storage->output_path, 0, err);
+  RemoteError_t *remote_err = NULL;
+  char name[BUF_LEN_S];
+
+  fetched[0] = '\0';
+  if (index || !*err || (*err)->code != WAL_ARCHIVE_NOT_FOUND || !remote_enabled(cfg->storage)) return index;
+  destroy_wal_archive_error(err);
+  snprintf(name, sizeof(name), "%s%s", WAL_INDEX_FILE, RESTORE_FETCH_SUFFIX);
+  snprintf(fetched, fetched_len, "%s/%s", restore_fetch_dir(cfg), name);
+  if (remote_fetch(cfg->storage->remote_target, WAL_INDEX_FILE, fetched, 1, NULL, &remote_err) != REMOTE_OK) {
+    *err = create_wal_archive_error(WAL_ARCHIVE_STORAGE_ERROR, remote_err ? remote_err->message : "Download failed");
+    destroy_remote_error(&remote_err);
+    fetched[0] = '\0';
+
+    return NULL;
+  }
+
+  return wal_index_open_file(fetched, 0, err);
+}
+
+/* copies object @segment of batch @batch_name to @fd, fetching the batch when it is not local */
+WalArchiveStatus_t wal_fetch_object(AppConfig_t *cfg, const char *batch_name, const char *segment, int fd,
+  char *message, size_t len) {
+  StorageConfig_t local = *cfg->storage;
+  ArchiveError_t *archive_err = NULL;
+  RemoteError_t *remote_err = NULL;
+  ArchiveReader_t *reader = init_archive_reader(&local, batch_name, &archive_err);
+  ArchiveObject_t *obj;
+  WalArchiveStatus_t status = WAL_ARCHIVE_OK;
+  char fetched[BUF_LEN] = "", name[BUF_LEN_S];
+
+  if (!reader && archive_err && archive_err->code == ARCHIVE_NOT_FOUND && remote_enabled(cfg->storage)) {
+    destroy_archive_error(&archive_err);
+    snprintf(name, sizeof(name), "%s%s", batch_name, RESTORE_FETCH_SUFFIX);
+    snprintf(fetched, sizeof(fetched), "%s/%s", restore_fetch_dir(cfg), name);
+    snprintf(local.output_path, sizeof(local.output_path), "%s", restore_fetch_dir(cfg));
+    if (remote_fetch(local.remote_target, batch_name, fetched, local.remote_connections, NULL, &remote_err)
+      == REMOTE_OK) {
+      reader = init_archive_reader(&local, name, &archive_err);
+    } else {
+      snprintf(message, len, "%s", remote_err ? remote_err->message : "Download failed");
+      destroy_remote_error(&remote_err);
+
+      return WAL_ARCHIVE_STORAGE_ERROR;
+    }
+  }
+  if (!reader) {
+    snprintf(message, len, "%s", archive_err ? archive_err->message : "Cannot open the batch");
+    status = WAL_ARCHIVE_STORAGE_ERROR;
+  } else if (!(obj = archive_find_object(reader, segment))) {
+    snprintf(message, len, "%s holds no segment %s", batch_name, segment);
+    status = WAL_ARCHIVE_CORRUPT_ERROR;
+  } else if (archive_restore_object(reader, obj, fd, &archive_err) != ARCHIVE_OK) {
+    snprintf(message, len, "%s", archive_err ? archive_err->message : "Cannot read the segment");
+    status = WAL_ARCHIVE_STORAGE_ERROR;
+  }
+  destroy_archive_error(&archive_err);
+  destroy_archive_reader(&reader);
+  if (fetched[0] != '\0') unlink(fetched);
+
+  return status;
+}
+
+/* a dedup batch is the manifest of its one segment */
+WalArchiveStatus_t wal_fetch_manifest(AppConfig_t *cfg, const char *batch_name, int fd, char *message, size_t len) {
+  ChunkStoreError_t *chunk_err = NULL;
+  ChunkStore_t *store = init_chunk_store(cfg->storage->output_path, cfg->storage->compression, &chunk_err);
+  WalArchiveStatus_t status = WAL_ARCHIVE_OK;
+  char manifest[BUF_LEN];
+
+  snprintf(manifest, sizeof(manifest), "%s/%s", cfg->storage->output_path, batch_name);
+  if (!store || chunk_store_restore(store, manifest, fd, &chunk_err) != CHUNKSTORE_OK) {
+    snprintf(message, len, "%s", chunk_err ? chunk_err->message : "Cannot open the chunk store");
+    status = WAL_ARCHIVE_STORAGE_ERROR;
+  }
+  destroy_chunk_store_error(&chunk_err);
+  destroy_chunk_store(&store);
+
+  return status;
+}
+
+/* the archive holding @segment: its batch through the index, or for a history file the archive of that name */
+WalArchiveStatus_t wal_fetch_source(AppConfig_t *cfg, const char *segment, char *batch_name, size_t batch_len,
+  WalArchiveError_t **err) {
+  WalArchiveError_t *index_err = NULL;
+  WalIndex_t *index;
+  WalIndexEntry_t entry;
+  WalArchiveStatus_t status;
+  char fetched[BUF_LEN], batch[WAL_SEGMENT_NAME_LEN + 1], message[BUF_LEN_M];
+  uint32_t timeline;
+  uint64_t lsn;
+
+  if (wal_parse_history_name(segment, &timeline) == 0) {
+    snprintf(fetched, sizeof(fetched), "%s/%s", cfg->storage->output_path, segment);
+    snprintf(batch_name, batch_len, "%s", segment);
+    // only the remote can tell, and a name it does not hold fails the download
+    if (remote_enabled(cfg->storage) || access(fetched, F_OK) == 0) return WAL_ARCHIVE_OK;
+    snprintf(message, sizeof(message), "History file %s is not archived", segment);
+    if (err) *err = create_wal_archive_error(WAL_ARCHIVE_NOT_FOUND, message);
+
+    return WAL_ARCHIVE_NOT_FOUND;
+  }
+
+  index = wal_fetch_index(cfg, fetched, sizeof(fetched), &index_err);
+  if (!index) {
+    status = index_err ? index_err->code : WAL_ARCHIVE_MEMORY_ERROR;
+    if (err) *err = index_err;
+    else destroy_wal_archive_error(&index_err);
+
+    return status;
+  }
+  status = wal_parse_segment_name(segment, index->segment_size, &timeline, &lsn) != 0 ? WAL_ARCHIVE_NOT_FOUND
+    : wal_index_find(index, timeline, lsn, &entry);
+  if (status == WAL_ARCHIVE_OK) wal_segment_name(timeline, entry.batch_lsn, index->segment_size, batch);
+  destroy_wal_index(&index);
+  if (fetched[0] != '\0') unlink(fetched);
+  if (status != WAL_ARCHIVE_OK) {
+    snprintf(message, sizeof(message), status == WAL_ARCHIVE_NOT_FOUND ? "Segment %s is not archived"
+      : "The WAL index is damaged around segment %s", segment);
+    if (err) *err = create_wal_archive_error(status, message);
+
+    return status;
+  }
+  snprintf(batch_name, batch_len, "%s%s", batch, WAL_BATCH_SUFFIX);
+
+  return WAL_ARCHIVE_OK;
+}
+
+WalArchiveStatus_t wal_archive_fetch(AppConfig_t *cfg, const char *segment, const char *path,
+  WalArchiveError_t **err) {
+  WalArchiveStatus_t status;
+  char batch_name[BUF_LEN_S], partial[BUF_LEN + 16], message[BUF_LEN_M];
+  int fd;
+
+  status = wal_fetch_source(cfg, segment, batch_name, sizeof(batch_name), err);
+  if (status != WAL_ARCHIVE_OK) return status;
+
+  // the server only ever sees a whole segment under @path
+  snprintf(partial, sizeof(partial), "%s%s", path, WAL_PARTIAL_SUFFIX);
+  fd = open(partial, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) {
+    snprintf(message, sizeof(message), "Cannot open %.400s: %s", partial, strerror(errno));
+    status = WAL_ARCHIVE_STORAGE_ERROR;
+  } else {
+    status = cfg->storage->dedup_enabled ? wal_fetch_manifest(cfg, batch_name, fd, message, sizeof(message))
+      : wal_fetch_object(cfg, batch_name, segment, fd, message, sizeof(message));
+    if (status == WAL_ARCHIVE_OK && fsync(fd) != 0) {
+      snprintf(message, sizeof(message), "Cannot sync %.400s: %s", partial, strerror(errno));
+      status = WAL_ARCHIVE_STORAGE_ERROR;
+    }
+    close(fd);
+  }
+  if (status == WAL_ARCHIVE_OK && rename(partial, path) != 0) {
+    snprintf(message, sizeof(message), "Cannot rename %.400s: %s", partial, strerror(errno));
+    status = WAL_ARCHIVE_STORAGE_ERROR;
+  }
+  if (status != WAL_ARCHIVE_OK) {
+    if (fd >= 0) unlink(partial);
+    if (err) *err = create_wal_archive_error(status, message);
+  }
+
+  return status;
+}
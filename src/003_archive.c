@@ -0,0 +1,97 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/archive.h"
+#include "include/chunkstore.h"
+#include "include/pipeline.h"
+
+
+/* the chunk holding stream offset @pos, which lies before the end of the last one */
+uint64_t archive_chunk_at(const ArchiveReader_t *reader, uint64_t pos) {
+  uint64_t lo = 0, hi = reader->chunk_count - 1;
+
+  while (lo < hi) {
+    uint64_t mid = lo + (hi - lo) / 2;
+
+    if (reader->chunk_ends[mid] > pos) hi = mid;
+    else lo = mid + 1;
+  }
+
+  return lo;
+}
+
+ArchiveStatus_t archive_read_dedup_object(ArchiveReader_t *reader, const ArchiveObject_t *obj, ArchiveWriteFn_t emit,
+  void *ctx, ArchiveError_t **err) {
+  // a store of its own: chunk_store_get() reads through the store's scratch buffer
+  ChunkStore_t *store = init_chunk_store(reader->store_path, "none", NULL);
+  unsigned char *chunk = malloc(CHUNK_MAX_SIZE), *raw = NULL;
+  uint64_t held = reader->chunk_count;
+  size_t raw_cap = 0;
+  ArchiveStatus_t status = ARCHIVE_OK;
+  char message[BUF_LEN_M] = "", hex[2 * CHUNK_ID_LEN + 1];
+  bool complete = obj->frames == 0;
+
+  for (uint64_t i = 0; i < reader->index->frame_count; i++) {
+    const ArchiveFrame_t *frame = &reader->index->frames[i];
+
+    if (frame->object_id == obj->id && frame->raw_len > raw_cap) raw_cap = frame->raw_len;
+  }
+  raw = malloc(raw_cap + 1);
+  if (!store) {
+    snprintf(message, sizeof(message), "Cannot open the chunk store of %.400s", reader->path);
+    status = ARCHIVE_IO_ERROR;
+  } else if (!chunk || !raw) {
+    snprintf(message, sizeof(message), "Failed to allocate restore buffers!");
+    status = ARCHIVE_MEMORY_ERROR;
+  }
+
+  for (uint64_t i = 0; status == ARCHIVE_OK && i < reader->index->frame_count; i++) {
+    const ArchiveFrame_t *frame = &reader->index->frames[i];
+    uint64_t pos = frame->offset, end = frame->offset + frame->raw_len;
+    size_t filled = 0;
+
+    if (frame->object_id != obj->id) continue;
+    // frames and chunks are cut independently: a frame spans chunks, a chunk holds frames of several objects
+    while (status == ARCHIVE_OK && pos < end) {
+      uint64_t k = archive_chunk_at(reader, pos), start = k ? reader->chunk_ends[k - 1] : 0;
+      uint64_t stop = end < reader->chunk_ends[k] ? end : reader->chunk_ends[k];
+
+      if (k != held) {
+        ssize_t len = chunk_store_get(store, reader->chunk_ids + k * CHUNK_ID_LEN, chunk, CHUNK_MAX_SIZE);
+
+        if (len < 0 || (uint64_t)len != reader->chunk_ends[k] - start) {
+          chunk_id_hex(reader->chunk_ids + k * CHUNK_ID_LEN, hex);
+          snprintf(message, sizeof(message), "Chunk %s of %.400s is missing or damaged", hex, reader->path);
+          status = ARCHIVE_FORMAT_ERROR;
+          break;
+        }
+        held = k;
+      }
+      memcpy(raw + filled, chunk + (pos - start), (size_t)(stop - pos));
+      filled += (size_t)(stop - pos);
+      pos = stop;
+    }
+    if (status != ARCHIVE_OK) break;
+    __atomic_add_fetch(&reader->bytes_read, frame->raw_len, __ATOMIC_RELAXED);
+
+    errno = 0;
+    if (emit(ctx, raw, filled) != 0) {
+      snprintf(message, sizeof(message), "Cannot write %s: %s", obj->name, errno ? strerror(errno) : "rejected");
+      status = ARCHIVE_IO_ERROR;
+    }
+    complete = (frame->flags & PIPE_BUF_LAST) != 0;
+  }
+  if (status == ARCHIVE_OK && !complete) {
+    snprintf(message, sizeof(message), "%s in %.200s was cut short", obj->name, reader->path);
+    status = ARCHIVE_FORMAT_ERROR;
+  }
+
+  destroy_chunk_store(&store);
+  free(chunk);
+  free(raw);
+  if (status != ARCHIVE_OK && err) *err = create_archive_error(status, message);
+
+  return status;
+}
@@ -0,0 +1,205 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "include/cdc.h"
+#include "include/storage.h"
+#include "include/walarchive.h"
+
+/* a batch of the chain being replayed */
+typedef struct CdcBatch {
+  char              name[BUF_LEN_S];
+  CdcMeta_t         meta;
+} CdcBatch_t;
+
+/* runs the statements of a CDC_CHANGES_OBJECT as they are read */
+typedef struct CdcReplay {
+  PgConn_t          *conn;
+  CdcText_t         line;
+  uint64_t          statements;
+  char              message[BUF_LEN_M];
+} CdcReplay_t;
+
+
+int cdc_collect_meta(void *ctx, const unsigned char *data, size_t len) {
+  return cdc_text_put(ctx, (const char *)data, len);
+}
+
+int cdc_read_meta(ArchiveReader_t *reader, CdcMeta_t *meta) {
+  ArchiveObject_t *obj = archive_find_object(reader, CDC_META_OBJECT);
+  CdcText_t text = { NULL, 0, 0 };
+  char from[CDC_LSN_LEN], to[CDC_LSN_LEN], extra;
+  int status = -1;
+
+  if (!obj) return 1;
+  if (archive_read_object(reader, obj, cdc_collect_meta, &text, NULL) == ARCHIVE_OK && text.data
+    && sscanf(text.data, "slot=%63s full=%255s from=%23s to=%23s seq=%" SCNu64 " %c", meta->slot, meta->full, from,
+      to, &meta->seq, &extra) == 5
+    && wal_parse_lsn(from, &meta->from_lsn) == 0 && wal_parse_lsn(to, &meta->to_lsn) == 0 && meta->seq > 0) {
+    status = 0;
+  }
+  free(text.data);
+
+  return status;
+}
+
+/* the batches of @last's chain before it under `output_path` into malloc'ed @found; 0 on success */
+int cdc_list_batches(const StorageConfig_t *cfg, const CdcBatch_t *last, CdcBatch_t **found, size_t *count) {
+  DIR *dir = opendir(cfg->output_path);
+  CdcBatch_t *grown;
+  struct dirent *entry;
+  size_t capacity = 0;
+  int status = 0;
+
+  *found = NULL;
+  *count = 0;
+  while (dir && (entry = readdir(dir))) {
+    size_t name_len = strlen(entry->d_name);
+    ArchiveReader_t *reader;
+    CdcMeta_t meta;
+
+    if (entry->d_name[0] == '.' || name_len >= sizeof(last->name) || strcmp(entry->d_name, last->name) == 0
+      || (name_len > strlen(STORAGE_PARTIAL_SUFFIX)
+        && strcmp(entry->d_name + name_len - strlen(STORAGE_PARTIAL_SUFFIX), STORAGE_PARTIAL_SUFFIX) == 0)) {
+      continue;
+    }
+    // anything that does not open as an archive is not a batch
+    if (!(reader = init_archive_reader(cfg, entry->d_name, NULL))) continue;
+    if (cdc_read_meta(reader, &meta) == 0 && meta.seq < last->meta.seq && strcmp(meta.slot, last->meta.slot) == 0
+      && strcmp(meta.full, last->meta.full) == 0) {
+      if (*count == capacity) {
+        capacity = capacity ? capacity * 2 : 16;
+        if (!(grown = realloc(*found, capacity * sizeof(CdcBatch_t)))) {
+          destroy_archive_reader(&reader);
+          status = -1;
+          break;
+        }
+        *found = grown;
+      }
+      snprintf((*found)[*count].name, sizeof((*found)[*count].name), "%s", entry->d_name);
+      (*found)[(*count)++].meta = meta;
+    }
+    destroy_archive_reader(&reader);
+  }
+  if (dir) closedir(dir);
+
+  return status;
+}
+
+/* runs one complete line */
+int cdc_replay_line(CdcReplay_t *replay) {
+  if (!replay->line.len) return 0;
+  if (pg_exec(replay->conn, replay->line.data) != PG_OK) {
+    snprintf(replay->message, sizeof(replay->message), "%.200s: %.280s", replay->line.data, replay->conn->message);
+    // what the failed transaction did so far goes with it
+    if (replay->conn->txn_status != 'I') pg_exec(replay->conn, "ROLLBACK");
+
+    return -1;
+  }
+  replay->statements++;
+  replay->line.len = 0;
+
+  return 0;
+}
+
+/* ArchiveWriteFn_t: statements may come cut anywhere */
+int cdc_replay_write(void *ctx, const unsigned char *data, size_t len) {
+  CdcReplay_t *replay = ctx;
+  const unsigned char *end = data + len;
+
+  while (data < end) {
+    const unsigned char *nl = memchr(data, '\n', (size_t)(end - data));
+
+    if (cdc_text_put(&replay->line, (const char *)data, (size_t)((nl ? nl : end) - data)) != 0) return -1;
+    if (!nl) break;
+    if (cdc_replay_line(replay) != 0) return -1;
+    data = nl + 1;
+  }
+
+  return 0;
+}
+
+/* runs the CDC_CHANGES_OBJECT of batch @name on @replay's connection */
+CdcStatus_t cdc_replay_batch(AppConfig_t *cfg, const char *name, CdcReplay_t *replay, char *message, size_t len) {
+  ArchiveError_t *archive_err = NULL;
+  ArchiveReader_t *reader = init_archive_reader(cfg->storage, name, &archive_err);
+  ArchiveObject_t *obj = reader ? archive_find_object(reader, CDC_CHANGES_OBJECT) : NULL;
+  CdcStatus_t status = CDC_OK;
+
+  replay->message[0] = '\0';
+  replay->line.len = 0;
+  if (!obj) {
+    snprintf(message, len, "Cannot read %s of batch %s: %s", CDC_CHANGES_OBJECT, name,
+      archive_err ? archive_err->message : "no such object");
+    status = CDC_CORRUPT_ERROR;
+  } else if (archive_read_object(reader, obj, cdc_replay_write, replay, &archive_err) != ARCHIVE_OK
+    || cdc_replay_line(replay) != 0) {
+    snprintf(message, len, "Cannot replay batch %s: %s", name,
+      replay->message[0] ? replay->message : archive_err ? archive_err->message : "?");
+    status = replay->message[0] ? CDC_QUERY_ERROR : CDC_CORRUPT_ERROR;
+  }
+  destroy_archive_error(&archive_err);
+  destroy_archive_reader(&reader);
+
+  return status;
+}
+
+CdcStatus_t cdc_replay(AppConfig_t *cfg, const char *name, uint64_t *batches, uint64_t *statements, CdcError_t **err) {
+  ArchiveError_t *archive_err = NULL;
+  ArchiveReader_t *reader = init_archive_reader(cfg->storage, name, &archive_err);
+  CdcReplay_t replay = { .conn = NULL };
+  CdcBatch_t last = { .meta.seq = 0 }, *found = NULL, **chain = NULL;
+  CdcStatus_t status = CDC_OK;
+  char message[BUF_LEN_M];
+  size_t count = 0;
+
+  if (batches) *batches = 0;
+  if (statements) *statements = 0;
+  snprintf(last.name, sizeof(last.name), "%s", name);
+  if (!reader) {
+    snprintf(message, sizeof(message), "%s", archive_err ? archive_err->message : "Cannot open the batch");
+    status = CDC_STORAGE_ERROR;
+  } else if (cdc_read_meta(reader, &last.meta) != 0) {
+    snprintf(message, sizeof(message), "%s is not a batch of a logical chain", name);
+    status = CDC_CONFIG_ERROR;
+  } else if (cdc_list_batches(cfg->storage, &last, &found, &count) != 0
+    || !(chain = calloc(last.meta.seq + 1, sizeof(CdcBatch_t *)))) {
+    snprintf(message, sizeof(message), "Failed to allocate the batch list!");
+    status = CDC_MEMORY_ERROR;
+  }
+  destroy_archive_error(&archive_err);
+  destroy_archive_reader(&reader);
+
+  // back from the last batch: a batch captured again after its head was lost leaves two of one seq
+  if (chain) chain[last.meta.seq] = &last;
+  for (uint64_t seq = last.meta.seq - 1; status == CDC_OK && seq > 0; seq--) {
+    for (size_t i = 0; !chain[seq] && i < count; i++) {
+      if (found[i].meta.seq == seq && found[i].meta.to_lsn == chain[seq + 1]->meta.from_lsn) chain[seq] = &found[i];
+    }
+    if (!chain[seq]) {
+      snprintf(message, sizeof(message), "Batch %" PRIu64 " of the chain of %.200s is missing from %.200s",
+        seq, last.meta.full, cfg->storage->output_path);
+      status = CDC_CORRUPT_ERROR;
+    }
+  }
+
+  if (status == CDC_OK) {
+    replay.conn = cdc_connect(cfg, false, message, sizeof(message));
+    if (!replay.conn) status = CDC_CONNECT_ERROR;
+  }
+  for (uint64_t seq = 1; status == CDC_OK && seq <= last.meta.seq; seq++) {
+    status = cdc_replay_batch(cfg, chain[seq]->name, &replay, message, sizeof(message));
+    if (status == CDC_OK && batches) (*batches)++;
+  }
+  if (statements) *statements = replay.statements;
+
+  destroy_pg_conn(&replay.conn);
+  free(replay.line.data);
+  free(chain);
+  free(found);
+  if (status != CDC_OK && err) *err = create_cdc_error(status, message);
+
+  return status;
+}
@@ -0,0 +1,156 @@
+#include "include/codec.h"
+
+#ifdef DBEETLE_HAVE_LZ4
+#include <stdlib.h>
+#include <string.h>
+#include <lz4frame.h>
+
+#define LZ4_BLOCK_MAX (4 << 20)
+#define LZ4_BLOCK_UNCOMPRESSED (0x80000000u)
+
+typedef struct Lz4State {
+  LZ4F_cctx         *cctx;
+  LZ4F_preferences_t prefs;
+} Lz4State_t;
+
+
+void *lz4_create(const CodecSpec_t *spec) {
+  Lz4State_t *state = calloc(1, sizeof(Lz4State_t));
+  int acceleration = spec->level == CODEC_LEVEL_DEFAULT || spec->level == 0
+    ? LZ4_DEFAULT_ACCELERATION : spec->level;
+
+  if (!state) return NULL;
+  // the context (and its hash table) is reused for every block the worker compresses
+  if (LZ4F_isError(LZ4F_createCompressionContext(&state->cctx, LZ4F_VERSION))) {
+    free(state);
+
+    return NULL;
+  }
+  state->prefs.frameInfo.blockSizeID = LZ4F_max4MB;
+  state->prefs.frameInfo.blockMode = LZ4F_blockIndependent;
+  // negative levels select the fast compressor with that acceleration
+  state->prefs.compressionLevel = -acceleration;
+  state->prefs.autoFlush = 1;
+
+  return state;
+}
+
+void lz4_destroy(void *state) {
+  LZ4F_freeCompressionContext(((Lz4State_t *)state)->cctx);
+  free(state);
+}
+
+/**
+ * lz4_compress - compresses one block into a self-contained LZ4 frame
+ * @state: the worker's Lz4State_t
+ * @src: raw block
+ * @len: raw length
+ * @dst: output area
+ * @cap: output capacity
+ * @out_len: written compressed length
+ *
+ * The frame records its content size, and concatenated frames are read
+ * back by stock `lz4 -d`.
+ * Return: 0 on success, -1 on failure
+ **/
+int lz4_compress(void *state, const unsigned char *src, size_t len,
+  unsigned char *dst, size_t cap, size_t *out_len) {
+  Lz4State_t *lz4 = state;
+  size_t pos, ret;
+
+  lz4->prefs.frameInfo.contentSize = len;
+  ret = LZ4F_compressBegin(lz4->cctx, dst, cap, &lz4->prefs);
+  if (LZ4F_isError(ret)) return -1;
+  pos = ret;
+
+  ret = LZ4F_compressUpdate(lz4->cctx, dst + pos, cap - pos, src, len, NULL);
+  if (LZ4F_isError(ret)) return -1;
+  pos += ret;
+
+  ret = LZ4F_compressEnd(lz4->cctx, dst + pos, cap - pos, NULL);
+  if (LZ4F_isError(ret)) return -1;
+  *out_len = pos + ret;
+
+  return 0;
+}
+
+void lz4_put_le32(unsigned char *dst, uint32_t v) {
+  for (int i = 0; i < 4; i++) dst[i] = (unsigned char)(v >> (8 * i));
+}
+
+/**
+ * lz4_store - wraps one block in an LZ4 frame of uncompressed blocks
+ * @state: the worker's Lz4State_t, only used to write the frame header
+ * @src: raw block
+ * @len: raw length
+ * @dst: output area
+ * @cap: output capacity
+ * @out_len: written length
+ *
+ * LZ4F_compressBegin() writes the header (and its checksum) without
+ * touching any data; the blocks themselves are copied with the
+ * uncompressed bit set in their size field.
+ * Return: 0 on success, -1 if @cap is too small
+ **/
+int lz4_store(void *state, const unsigned char *src, size_t len,
+  unsigned char *dst, size_t cap, size_t *out_len) {
+  Lz4State_t *lz4 = state;
+  size_t pos, off = 0;
+
+  lz4->prefs.frameInfo.contentSize = len;
+  pos = LZ4F_compressBegin(lz4->cctx, dst, cap, &lz4->prefs);
+  if (LZ4F_isError(pos)) return -1;
+
+  while (off < len) {
+    size_t n = len - off > LZ4_BLOCK_MAX ? LZ4_BLOCK_MAX : len - off;
+
+    if (cap - pos < n + 4) return -1;
+    lz4_put_le32(dst + pos, (uint32_t)n | LZ4_BLOCK_UNCOMPRESSED);
+    memcpy(dst + pos + 4, src + off, n);
+    pos += n + 4;
+    off += n;
+  }
+  // end mark
+  if (cap - pos < 4) return -1;
+  lz4_put_le32(dst + pos, 0);
+  *out_len = pos + 4;
+
+  return 0;
+}
+
+int lz4_decompress(const unsigned char *src, size_t len,
+  unsigned char *dst, size_t cap, size_t *out_len) {
+  LZ4F_dctx *dctx = NULL;
+  size_t in_pos = 0, out_pos = 0, ret = 1;
+
+  if (LZ4F_isError(LZ4F_createDecompressionContext(&dctx, LZ4F_VERSION))) return -1;
+  while (in_pos < len && ret != 0) {
+    size_t src_size = len - in_pos, dst_size = cap - out_pos;
+
+    ret = LZ4F_decompress(dctx, dst + out_pos, &dst_size, src + in_pos, &src_size, NULL);
+    if (LZ4F_isError(ret) || (src_size == 0 && dst_size == 0)) break;
+    in_pos += src_size;
+    out_pos += dst_size;
+  }
+  LZ4F_freeDecompressionContext(dctx);
+  if (ret != 0 || in_pos != len) return -1;
+  *out_len = out_pos;
+
+  return 0;
+}
+
+const Codec_t lz4_codec = {
+  .name = "lz4",
+  .id = CODEC_LZ4,
+  .create = lz4_create,
+  .destroy = lz4_destroy,
+  .compress = lz4_compress,
+  .store = lz4_store,
+  .decompress = lz4_decompress
+};
+
+#else
+
+typedef int lz4_codec_unavailable_t;
+
+#endif /* DBEETLE_HAVE_LZ4 */
@@ -0,0 +1,148 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "include/incremental.h"
+
+typedef struct IncrSource {
+  int               fd;
+  CodecId_t         codec;
+} IncrSource_t;
+
+
+/* opens the .blocks file of chain member @generation on first use */
+int incr_open_source(const StorageConfig_t *cfg, const IncrManifest_t *m, IncrSource_t *sources,
+  uint32_t generation) {
+  unsigned char header[INCR_HEADER_LEN];
+  char path[BUF_LEN];
+  IncrSource_t *src = &sources[generation];
+
+  if (src->fd >= 0) return 0;
+  snprintf(path, sizeof(path), "%s/%s%s", cfg->output_path, m->chain[generation], INCR_BLOCKS_SUFFIX);
+  src->fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (src->fd < 0 || pread(src->fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)
+    || memcmp(header, INCR_BLOCKS_MAGIC, strlen(INCR_BLOCKS_MAGIC)) != 0 || header[7] != INCR_FORMAT_VERSION) {
+    return -1;
+  }
+  src->codec = (CodecId_t)header[8];
+
+  return 0;
+}
+
+/* reads, decodes and checks one block; 0 on success */
+int incr_load_block(const IncrSource_t *src, const IncrBlock_t *block, size_t raw_len,
+  unsigned char *stored, unsigned char *dst) {
+  size_t stored_len = block->stored_len & ~INCR_STORED_RAW, out_len = 0;
+  unsigned char hash[INCR_HASH_LEN];
+  const Codec_t *codec;
+
+  if (stored_len > INCR_BLOCK_SIZE + PIPELINE_BLOCK_HEADROOM(INCR_BLOCK_SIZE)
+    || pread(src->fd, stored, stored_len, (off_t)block->offset) != (ssize_t)stored_len) return -1;
+  if (block->stored_len & INCR_STORED_RAW) {
+    if (stored_len != raw_len) return -1;
+    memcpy(dst, stored, raw_len);
+  } else if (!(codec = codec_lookup(src->codec))
+    || codec->decompress(stored, stored_len, dst, raw_len, &out_len) != 0 || out_len != raw_len) {
+    return -1;
+  }
+
+  return incr_block_hash(dst, raw_len, hash) == 0 && memcmp(hash, block->hash, INCR_HASH_LEN) == 0 ? 0 : -1;
+}
+
+IncrStatus_t incr_restore_file(const StorageConfig_t *cfg, const IncrManifest_t *m, IncrSource_t *sources,
+  const IncrFile_t *file, const char *path, unsigned char *stored, unsigned char *raw, char *message, size_t len) {
+  struct timespec times[2];
+  int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+  if (fd < 0) {
+    snprintf(message, len, "Cannot create %s: %s", path, strerror(errno));
+
+    return INCR_IO_ERROR;
+  }
+  for (uint64_t i = 0; i < file->block_count; i++) {
+    const IncrBlock_t *block = &file->blocks[i];
+    size_t want = file->size - i * m->block_size < m->block_size
+      ? (size_t)(file->size - i * m->block_size) : m->block_size;
+
+    if (incr_open_source(cfg, m, sources, block->generation) != 0
+      || incr_load_block(&sources[block->generation], block, want, stored, raw) != 0) {
+      snprintf(message, len, "Block %lu of %s in backup %s is missing or damaged", (unsigned long)i, file->path,
+        m->chain[block->generation]);
+      close(fd);
+
+      return INCR_CORRUPT_ERROR;
+    }
+    if (incr_write_all(fd, raw, want) != 0) {
+      snprintf(message, len, "Cannot write %s: %s", path, strerror(errno));
+      close(fd);
+
+      return INCR_IO_ERROR;
+    }
+  }
+
+  times[0].tv_sec = times[1].tv_sec = (time_t)(file->mtime_ns / 1000000000LL);
+  times[0].tv_nsec = times[1].tv_nsec = (long)(file->mtime_ns % 1000000000LL);
+  fchmod(fd, file->mode & 07777);
+  futimens(fd, times);
+  if (close(fd) != 0) {
+    snprintf(message, len, "Cannot write %s: %s", path, strerror(errno));
+
+    return INCR_IO_ERROR;
+  }
+
+  return INCR_OK;
+}
+
+IncrStatus_t incremental_restore(const StorageConfig_t *cfg, const char *name, const char *target_dir,
+  IncrError_t **err) {
+  char path[BUF_LEN], message[BUF_LEN_M] = "";
+  unsigned char *stored = malloc(INCR_BLOCK_SIZE + PIPELINE_BLOCK_HEADROOM(INCR_BLOCK_SIZE));
+  unsigned char *raw = malloc(INCR_BLOCK_SIZE);
+  IncrSource_t *sources = NULL;
+  IncrManifest_t *m = NULL;
+  IncrStatus_t status = INCR_OK;
+  const IncrFile_t *file;
+
+  snprintf(path, sizeof(path), "%s/%s%s", cfg->output_path, name, INCR_MANIFEST_SUFFIX);
+  if (!stored || !raw) {
+    snprintf(message, sizeof(message), "Failed to allocate restore buffers!");
+    status = INCR_MEMORY_ERROR;
+  } else if (!(m = incr_manifest_load(path, message, sizeof(message)))) {
+    status = INCR_CORRUPT_ERROR;
+  } else if (m->block_size > INCR_BLOCK_SIZE || !(sources = malloc(m->chain_len * sizeof(IncrSource_t)))) {
+    snprintf(message, sizeof(message), "Cannot restore %s with this build", name);
+    status = INCR_CONFIG_ERROR;
+  } else if (mkdir(target_dir, 0750) != 0 && errno != EEXIST) {
+    snprintf(message, sizeof(message), "Cannot create %s: %s", target_dir, strerror(errno));
+    status = INCR_IO_ERROR;
+  }
+  for (uint32_t i = 0; sources && i < m->chain_len; i++) sources[i].fd = -1;
+
+  // directories were recorded before their contents
+  for (file = m && status == INCR_OK ? m->files : NULL; file && status == INCR_OK; file = file->hh.next) {
+    snprintf(path, sizeof(path), "%s/%s", target_dir, file->path);
+    if (S_ISDIR(file->mode)) {
+      if (mkdir(path, file->mode & 07777) != 0 && errno != EEXIST) {
+        snprintf(message, sizeof(message), "Cannot create %.400s: %s", path, strerror(errno));
+        status = INCR_IO_ERROR;
+      }
+    } else {
+      status = incr_restore_file(cfg, m, sources, file, path, stored, raw, message, sizeof(message));
+    }
+  }
+
+  for (uint32_t i = 0; sources && i < m->chain_len; i++) {
+    if (sources[i].fd >= 0) close(sources[i].fd);
+  }
+  free(sources);
+  free(stored);
+  free(raw);
+  destroy_incr_manifest(&m);
+  if (status != INCR_OK && err) *err = create_incr_error(status, message);
+
+  return status;
+}
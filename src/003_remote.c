@@ -0,0 +1,162 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "include/remote.h"
+
+typedef struct RemoteFetch {
+  char              url[BUF_LEN];
+  int               fd;
+  uint64_t          size;
+  uint64_t          next;           // start of the first range no connection took yet
+  size_t            range_size;
+  uint64_t          bytes_received;
+  bool              failed;
+  char              message[BUF_LEN_M];
+  pthread_mutex_t   lock;
+} RemoteFetch_t;
+
+
+/* hands the next range to a connection; false once everything is taken or the fetch failed */
+bool remote_fetch_claim(RemoteFetch_t *f, uint64_t *offset, size_t *len) {
+  bool claimed;
+
+  pthread_mutex_lock(&f->lock);
+  claimed = !f->failed && f->next < f->size;
+  if (claimed) {
+    *offset = f->next;
+    *len = f->size - f->next < f->range_size ? (size_t)(f->size - f->next) : f->range_size;
+    f->next += *len;
+  }
+  pthread_mutex_unlock(&f->lock);
+
+  return claimed;
+}
+
+void remote_fetch_fail(RemoteFetch_t *f, const char *message) {
+  pthread_mutex_lock(&f->lock);
+  if (!f->failed) {
+    f->failed = true;
+    snprintf(f->message, sizeof(f->message), "%s", message);
+  }
+  pthread_mutex_unlock(&f->lock);
+}
+
+/**
+ * remote_fetch_range - GETs one range into the local copy, retrying
+ * transient failures like remote_upload_part()
+ * @f: the fetch
+ * @curl: the calling thread's connection
+ * @offset: first byte of the range
+ * @len: length of the range
+ *
+ * Return: 0 on success, -1 once the range is given up on
+ **/
+int remote_fetch_range(RemoteFetch_t *f, void *curl, uint64_t offset, size_t len) {
+  char message[BUF_LEN_M];
+  long status = 0;
+  size_t received = 0;
+  int rc = -1;
+
+  for (int attempt = 0; attempt < REMOTE_MAX_ATTEMPTS; attempt++) {
+    if (attempt > 0) {
+      long delay_ms = REMOTE_RETRY_BASE_MS << (attempt - 1);
+      struct timespec delay = { delay_ms / 1000, (delay_ms % 1000) * 1000000L };
+
+      nanosleep(&delay, NULL);
+    }
+
+    rc = remote_http_get_range(curl, f->url, offset, len, f->fd, &status, &received);
+    if (rc == 0 && status == 206 && received == len) {
+      __atomic_add_fetch(&f->bytes_received, len, __ATOMIC_RELAXED);
+
+      return 0;
+    }
+    if (rc == 0 && status != 408 && status != 429 && status < 500) break;
+  }
+
+  if (rc != 0) snprintf(message, sizeof(message), "Download of %.400s at offset %lu failed after %d attempts",
+    f->url, (unsigned long)offset, REMOTE_MAX_ATTEMPTS);
+  else snprintf(message, sizeof(message), "Download of %.400s at offset %lu failed (HTTP %ld)", f->url,
+    (unsigned long)offset, status);
+  remote_fetch_fail(f, message);
+
+  return -1;
+}
+
+void *remote_fetch_main(void *arg) {
+  RemoteFetch_t *f = arg;
+  void *curl = remote_http_open();
+  uint64_t offset = 0;
+  size_t len = 0;
+
+  if (!curl) remote_fetch_fail(f, "Failed to open a download connection!");
+  while (curl && remote_fetch_claim(f, &offset, &len)) remote_fetch_range(f, curl, offset, len);
+  if (curl) remote_http_close(curl);
+
+  return NULL;
+}
+
+RemoteStatus_t remote_fetch(const char *target, const char *name, const char *path, size_t connections,
+  uint64_t *size, RemoteError_t **err) {
+  RemoteFetch_t f;
+  pthread_t threads[REMOTE_MAX_FETCH_CONNECTIONS];
+  size_t started = 0, wanted;
+  char message[BUF_LEN_M];
+  RemoteStatus_t code = REMOTE_OK;
+  long status = 0;
+  void *curl;
+
+  memset(&f, 0, sizeof(f));
+  pthread_mutex_init(&f.lock, NULL);
+  snprintf(f.url, sizeof(f.url), "%s%s%s", target, target[strlen(target) - 1] == '/' ? "" : "/", name);
+  f.range_size = REMOTE_PART_SIZE;
+  f.fd = -1;
+
+  curl = remote_http_open();
+  if (!curl) {
+    snprintf(message, sizeof(message), "Remote downloads are not available in this build");
+    code = REMOTE_CONFIG_ERROR;
+  } else if (remote_http_size(curl, f.url, &f.size, &status) != 0 || status != 200) {
+    snprintf(message, sizeof(message), "Cannot find %.400s on the remote (HTTP %ld)", f.url, status);
+    code = REMOTE_HTTP_ERROR;
+  } else if ((f.fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640)) < 0
+    || ftruncate(f.fd, (off_t)f.size) != 0) {
+    snprintf(message, sizeof(message), "Cannot create %s: %s", path, strerror(errno));
+    code = REMOTE_IO_ERROR;
+  }
+  if (curl) remote_http_close(curl);
+
+  // one connection per range at most, each pulling ranges until none are left
+  wanted = connections ? connections : 1;
+  if (wanted > (f.size + f.range_size - 1) / f.range_size) wanted = (size_t)((f.size + f.range_size - 1) / f.range_size);
+  if (wanted > REMOTE_MAX_FETCH_CONNECTIONS) wanted = REMOTE_MAX_FETCH_CONNECTIONS;
+  for (; code == REMOTE_OK && started < wanted; started++) {
+    if (pthread_create(&threads[started], NULL, remote_fetch_main, &f) != 0) {
+      remote_fetch_fail(&f, "Failed to start download threads!");
+      code = REMOTE_THREAD_ERROR;
+    }
+  }
+  for (size_t i = 0; i < started; i++) pthread_join(threads[i], NULL);
+  if (code == REMOTE_OK && f.failed) {
+    snprintf(message, sizeof(message), "%s", f.message);
+    code = REMOTE_HTTP_ERROR;
+  } else if (code == REMOTE_THREAD_ERROR) {
+    snprintf(message, sizeof(message), "%s", f.message);
+  }
+
+  if (f.fd >= 0 && close(f.fd) != 0 && code == REMOTE_OK) {
+    snprintf(message, sizeof(message), "Cannot write %s: %s", path, strerror(errno));
+    code = REMOTE_IO_ERROR;
+  }
+  if (code != REMOTE_OK && f.fd >= 0) unlink(path);
+  pthread_mutex_destroy(&f.lock);
+  if (code != REMOTE_OK && err) *err = create_remote_error(code, message);
+  if (size) *size = f.size;
+
+  return code;
+}
@@ -0,0 +1,57 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include "include/storage.h"
+
+
+int storage_dedup_header(StorageSink_t *sink) {
+  unsigned char header[CHUNKSTORE_HEADER_LEN];
+
+  if (sink->header_written) return 0;
+  sink->header_written = true;
+
+  return storage_sink_put(sink, header, chunk_manifest_header(header));
+}
+
+/* stores the current chunk and appends it to the manifest */
+int storage_dedup_flush(StorageSink_t *sink) {
+  unsigned char id[CHUNK_ID_LEN], entry[CHUNKSTORE_ENTRY_LEN];
+
+  if (storage_dedup_header(sink) != 0 || chunk_store_put(sink->dedup, sink->chunk, sink->chunk_len, id) < 0) return -1;
+  chunk_manifest_entry(entry, id, (uint32_t)sink->chunk_len);
+  if (EVP_DigestUpdate(sink->manifest_md, entry, sizeof(entry)) != 1
+    || storage_sink_put(sink, entry, sizeof(entry)) != 0) return -1;
+  sink->chunks++;
+  sink->raw_len += sink->chunk_len;
+  sink->chunk_len = 0;
+
+  return 0;
+}
+
+int storage_dedup_write(StorageSink_t *sink, const unsigned char *data, size_t len) {
+  while (len > 0) {
+    bool cut = false;
+    size_t n = chunker_scan(&sink->chunker, data, len, &cut);
+
+    // the chunker never lets a chunk grow past CHUNK_MAX_SIZE
+    memcpy(sink->chunk + sink->chunk_len, data, n);
+    sink->chunk_len += n;
+    data += n;
+    len -= n;
+    if (cut && storage_dedup_flush(sink) != 0) return -1;
+  }
+
+  return 0;
+}
+
+int storage_dedup_finish(StorageSink_t *sink) {
+  unsigned char digest[EVP_MAX_MD_SIZE], trailer[CHUNKSTORE_TRAILER_LEN];
+
+  if (sink->chunk_len > 0 && storage_dedup_flush(sink) != 0) return -1;
+  if (storage_dedup_header(sink) != 0 || EVP_DigestFinal_ex(sink->manifest_md, digest, NULL) != 1) return -1;
+  // chunks must be on disk before a manifest naming them is
+  if (chunk_store_sync(sink->dedup) != 0) return -1;
+  chunk_manifest_trailer(trailer, sink->chunks, sink->raw_len, digest);
+
+  return storage_sink_put(sink, trailer, sizeof(trailer));
+}
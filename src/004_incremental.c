@@ -0,0 +1,340 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+#include "include/incremental.h"
+#include "include/walarchive.h"
+
+
+/* top-level files a copy in backup mode leaves out, the server writes them for itself */
+static const char *const live_excluded_files[] = {
+  "postmaster.pid", "postmaster.opts", "backup_label", "tablespace_map", "backup_manifest", "current_logfiles", NULL
+};
+
+/* directories recreated or rebuilt by the server: kept, but empty */
+static const char *const live_emptied_dirs[] = {
+  "pg_wal", "pg_replslot", "pg_stat_tmp", "pg_dynshmem", "pg_notify", "pg_serial", "pg_snapshots", "pg_subtrans", NULL
+};
+
+bool incr_live_excluded(const char *path) {
+  const char *base = strrchr(path, '/');
+
+  // relation cache init files are rebuilt at startup, wherever they are
+  if (strcmp(base ? base + 1 : path, "pg_internal.init") == 0) return true;
+  for (size_t i = 0; live_excluded_files[i]; i++) {
+    if (strcmp(path, live_excluded_files[i]) == 0) return true;
+  }
+
+  return false;
+}
+
+bool incr_live_emptied(const char *path) {
+  for (size_t i = 0; live_emptied_dirs[i]; i++) {
+    if (strcmp(path, live_emptied_dirs[i]) == 0) return true;
+  }
+
+  return false;
+}
+
+long incr_live_server(const char *root) {
+  char path[BUF_LEN], line[BUF_LEN_XS];
+  struct stat tree, cwd;
+  FILE *fh;
+  long pid = 0;
+
+  snprintf(path, sizeof(path), "%s/postmaster.pid", root);
+  if (!(fh = fopen(path, "r"))) return 0;
+  if (fgets(line, sizeof(line), fh)) pid = strtol(line, NULL, 10);
+  fclose(fh);
+  if (pid <= 0 || (kill((pid_t)pid, 0) != 0 && errno != EPERM)) return 0;
+  // a stale pid may now belong to anything; the postmaster's working directory is its data directory
+  snprintf(path, sizeof(path), "/proc/%ld/cwd", pid);
+  if (stat(root, &tree) == 0 && stat(path, &cwd) == 0 && (tree.st_dev != cwd.st_dev || tree.st_ino != cwd.st_ino)) {
+    return 0;
+  }
+
+  return pid;
+}
+
+/* the one row of @sql, a query or a replication command, in @res; 0 on success */
+int incr_bracket_query(PgConn_t *conn, const char *sql, PgResult_t **res, char *message, size_t len) {
+  if (pg_query(conn, sql, res) == PG_OK && *res && (*res)->rows == 1) return 0;
+  snprintf(message, len, "%.64s failed: %.400s", sql, conn->message[0] ? conn->message : "no row");
+  destroy_pg_result(res);
+
+  return -1;
+}
+
+IncrStatus_t incr_bracket_start(IncrBracket_t *b, const AppConfig_t *cfg, const char *name, char *message,
+  size_t len) {
+  PgError_t *pg_err = NULL;
+  PgResult_t *res = NULL;
+  const char *value;
+  char uri[BUF_LEN], sql[BUF_LEN_M], label[BUF_LEN_S];
+
+  snprintf(uri, sizeof(uri), "%s%creplication=true", cfg->db->uri, strchr(cfg->db->uri, '?') ? '&' : '?');
+  if (!(b->wal = pg_connect(uri, cfg->db->timeout_seconds, &pg_err))
+    || !(b->conn = pg_connect(cfg->db->uri, cfg->db->timeout_seconds, &pg_err))) {
+    snprintf(message, len, "Cannot connect to the database: %.400s", pg_err ? pg_err->message : "?");
+    destroy_pg_error(&pg_err);
+
+    return INCR_IO_ERROR;
+  }
+  if (b->conn->server_version < INCR_MIN_SERVER_VERSION) {
+    snprintf(message, len, "Backup mode of a live data directory needs PostgreSQL 10 or later, the server is %d",
+      b->conn->server_version);
+
+    return INCR_CONFIG_ERROR;
+  }
+
+  if (incr_bracket_query(b->wal, "IDENTIFY_SYSTEM", &res, message, len) != 0) return INCR_IO_ERROR;
+  b->timeline = (value = pg_result_value(res, 0, 1)) != NULL ? (uint32_t)strtoul(value, NULL, 10) : 0;
+  destroy_pg_result(&res);
+  if (incr_bracket_query(b->wal, "SHOW wal_segment_size", &res, message, len) != 0) return INCR_IO_ERROR;
+  b->segment_size = (value = pg_result_value(res, 0, 0)) != NULL ? wal_parse_size(value) : 0;
+  destroy_pg_result(&res);
+  if (!b->timeline || !b->segment_size) {
+    snprintf(message, len, "The server reports no timeline or no valid wal_segment_size");
+
+    return INCR_IO_ERROR;
+  }
+
+  // reserved before backup mode starts, so the WAL of the whole copy window stays on the server
+  snprintf(b->slot, sizeof(b->slot), "%s%u", INCR_SLOT_PREFIX, (unsigned int)b->wal->backend_pid);
+  snprintf(sql, sizeof(sql), "CREATE_REPLICATION_SLOT \"%s\" TEMPORARY PHYSICAL RESERVE_WAL", b->slot);
+  if (incr_bracket_query(b->wal, sql, &res, message, len) != 0) return INCR_IO_ERROR;
+  destroy_pg_result(&res);
+
+  snprintf(label, sizeof(label), "dbeetle %s", name);
+  snprintf(sql, sizeof(sql), "SELECT pg_catalog.%s(", b->conn->server_version >= 150000 ? "pg_backup_start"
+    : "pg_start_backup");
+  if (pg_quote(sql, sizeof(sql), label, '\'') != 0) {
+    snprintf(message, len, "Backup name too long for a label: %.400s", name);
+
+    return INCR_CONFIG_ERROR;
+  }
+  // a fast checkpoint, and pg_start_backup()'s non-exclusive mode, which ends with the session
+  snprintf(sql + strlen(sql), sizeof(sql) - strlen(sql), b->conn->server_version >= 150000 ? ", true)"
+    : ", true, false)");
+  if (incr_bracket_query(b->conn, sql, &res, message, len) != 0) return INCR_IO_ERROR;
+  if (!(value = pg_result_value(res, 0, 0)) || wal_parse_lsn(value, &b->start_lsn) != 0) {
+    snprintf(message, len, "Backup mode started at no valid position");
+    destroy_pg_result(&res);
+
+    return INCR_IO_ERROR;
+  }
+  destroy_pg_result(&res);
+
+  return INCR_OK;
+}
+
+/* writes @text as file @name of @dir; 0 on success */
+int incr_stage_file(const char *dir, const char *name, const char *text) {
+  char path[BUF_LEN];
+  int fd, status;
+
+  snprintf(path, sizeof(path), "%s/%s", dir, name);
+  fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+  if (fd < 0) return -1;
+  status = incr_write_all(fd, (const unsigned char *)text, strlen(text));
+  if (close(fd) != 0) status = -1;
+
+  return status;
+}
+
+/* answers a keepalive that asks for a reply, telling the server @pos is received */
+int incr_bracket_report(IncrBracket_t *b, uint64_t pos) {
+  unsigned char reply[34];
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  reply[0] = 'r';
+  pg_put_be(reply + 1, pos, 8);
+  pg_put_be(reply + 9, pos, 8);
+  pg_put_be(reply + 17, pos, 8);
+  pg_put_be(reply + 25, (uint64_t)(((int64_t)ts.tv_sec - PG_EPOCH_UNIX_SECONDS) * 1000000 + ts.tv_nsec / 1000), 8);
+  reply[33] = 0;
+
+  return pg_send_message(b->wal, 'd', reply, sizeof(reply));
+}
+
+/**
+ * incr_bracket_wal - streams the WAL of the copy window from the slot
+ * into segment files of @dir
+ * @b: bracket, stopped
+ * @dir: the stage's pg_wal
+ * @message: written reason on failure
+ * @len: size of @message
+ *
+ * From the segment start_lsn is in up to the one stop_lsn ends in,
+ * the last one zero-filled past what was streamed.
+ * Return: 0 on success, -1 on failure
+ **/
+int incr_bracket_wal(IncrBracket_t *b, const char *dir, char *message, size_t len) {
+  uint64_t pos = b->start_lsn - b->start_lsn % b->segment_size;
+  uint64_t last = (b->stop_lsn - 1) - (b->stop_lsn - 1) % b->segment_size, limit = last + b->segment_size;
+  const unsigned char *payload;
+  char sql[BUF_LEN_S], type = '\0', segment[WAL_SEGMENT_NAME_LEN + 1], path[BUF_LEN] = "";
+  size_t n;
+  int fd = -1, status = 0;
+
+  snprintf(sql, sizeof(sql), "START_REPLICATION SLOT \"%s\" PHYSICAL %X/%X TIMELINE %u", b->slot,
+    (unsigned int)(pos >> 32), (unsigned int)pos, b->timeline);
+  if (pg_send_message(b->wal, 'Q', sql, strlen(sql) + 1) != 0) status = -1;
+  while (status == 0 && pg_read_message(b->wal, &type, &payload, &n) == 0 && type != 'W') {
+    if (type == 'E') {
+      pg_take_error(b->wal, PG_QUERY_ERROR, payload, n);
+      status = -1;
+    }
+  }
+  if (status != 0 || type != 'W') {
+    snprintf(message, len, "Cannot stream the WAL of the backup: %.400s", b->wal->message);
+
+    return -1;
+  }
+
+  while (status == 0 && pos < b->stop_lsn) {
+    if (pg_read_message(b->wal, &type, &payload, &n) != 0) {
+      snprintf(message, len, "WAL stream of the backup failed: %.400s", b->wal->message);
+      status = -1;
+    } else if (type == 'E') {
+      pg_take_error(b->wal, PG_QUERY_ERROR, payload, n);
+      snprintf(message, len, "WAL stream of the backup failed: %.400s", b->wal->message);
+      status = -1;
+    } else if (type == 'c') {
+      snprintf(message, len, "The server left timeline %u before the backup's stop point", b->timeline);
+      status = -1;
+    } else if (type == 'd' && n >= 18 && payload[0] == 'k') {
+      if (payload[17] && incr_bracket_report(b, pos) != 0) status = -1;
+    } else if (type == 'd' && n >= 25 && payload[0] == 'w') {
+      const unsigned char *data = payload + 25;
+
+      if (pg_get_be(payload + 1, 8) != pos) {
+        snprintf(message, len, "WAL stream of the backup jumped away from %X/%X", (unsigned int)(pos >> 32),
+          (unsigned int)pos);
+        status = -1;
+      }
+      for (n -= 25; status == 0 && n > 0 && pos < limit;) {
+        size_t room = b->segment_size - pos % b->segment_size, take = n < room ? n : room;
+
+        if (fd < 0) {
+          wal_segment_name(b->timeline, pos, b->segment_size, segment);
+          snprintf(path, sizeof(path), "%s/%s", dir, segment);
+          fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        }
+        if (fd < 0 || incr_write_all(fd, data, take) != 0) {
+          snprintf(message, len, "Cannot stage %.400s: %s", path, strerror(errno));
+          status = -1;
+          break;
+        }
+        pos += take;
+        data += take;
+        n -= take;
+        if (pos % b->segment_size == 0) {
+          close(fd);
+          fd = -1;
+        }
+      }
+    }
+  }
+  // the server only ever reads whole segments
+  if (fd >= 0) {
+    if (status == 0 && ftruncate(fd, b->segment_size) != 0) {
+      snprintf(message, len, "Cannot stage %.400s: %s", path, strerror(errno));
+      status = -1;
+    }
+    close(fd);
+  }
+  if (status != 0) return -1;
+
+  // CopyDone both ways; the rest of the stream is of no use
+  if (pg_send_message(b->wal, 'c', NULL, 0) != 0) status = -1;
+  while (status == 0 && pg_read_message(b->wal, &type, &payload, &n) == 0 && type != 'Z') {
+    if (type == 'E') {
+      pg_take_error(b->wal, PG_QUERY_ERROR, payload, n);
+      status = -1;
+    }
+  }
+  if (status != 0 || type != 'Z') {
+    snprintf(message, len, "WAL stream of the backup did not end: %.400s", b->wal->message);
+
+    return -1;
+  }
+
+  return 0;
+}
+
+IncrStatus_t incr_bracket_stop(IncrBracket_t *b, const char *stage, char *message, size_t len) {
+  PgResult_t *res = NULL;
+  const char *lsn, *label, *map;
+  char wal_dir[BUF_LEN];
+
+  if (incr_bracket_query(b->conn, b->conn->server_version >= 150000
+    ? "SELECT lsn, labelfile, spcmapfile FROM pg_catalog.pg_backup_stop(false)"
+    : "SELECT lsn, labelfile, spcmapfile FROM pg_catalog.pg_stop_backup(false, false)", &res, message, len) != 0) {
+    return INCR_IO_ERROR;
+  }
+  lsn = pg_result_value(res, 0, 0);
+  label = pg_result_value(res, 0, 1);
+  map = pg_result_value(res, 0, 2);
+  if (!lsn || wal_parse_lsn(lsn, &b->stop_lsn) != 0 || b->stop_lsn <= b->start_lsn || !label) {
+    snprintf(message, len, "Backup mode stopped without a valid stop point or label");
+    destroy_pg_result(&res);
+
+    return INCR_IO_ERROR;
+  }
+  b->label = strdup(label);
+  b->tablespace_map = strdup(map ? map : "");
+  destroy_pg_result(&res);
+  if (!b->label || !b->tablespace_map) {
+    snprintf(message, len, "Failed to allocate backup label!");
+
+    return INCR_MEMORY_ERROR;
+  }
+
+  snprintf(wal_dir, sizeof(wal_dir), "%s/pg_wal", stage);
+  if (incr_stage_file(stage, "backup_label", b->label) != 0
+    || (b->tablespace_map[0] && incr_stage_file(stage, "tablespace_map", b->tablespace_map) != 0)
+    || mkdir(wal_dir, 0700) != 0) {
+    snprintf(message, len, "Cannot stage %.400s: %s", stage, strerror(errno));
+
+    return INCR_IO_ERROR;
+  }
+
+  return incr_bracket_wal(b, wal_dir, message, len) == 0 ? INCR_OK : INCR_IO_ERROR;
+}
+
+void incr_bracket_close(IncrBracket_t *b) {
+  destroy_pg_conn(&b->conn);
+  destroy_pg_conn(&b->wal);
+  free(b->label);
+  free(b->tablespace_map);
+  b->label = b->tablespace_map = NULL;
+}
+
+void incr_stage_remove(const char *stage) {
+  char path[BUF_LEN];
+  struct dirent *entry;
+  DIR *dir;
+
+  snprintf(path, sizeof(path), "%s/pg_wal", stage);
+  if ((dir = opendir(path)) != NULL) {
+    while ((entry = readdir(dir)) != NULL) {
+      if (entry->d_name[0] != '.') unlinkat(dirfd(dir), entry->d_name, 0);
+    }
+    closedir(dir);
+    rmdir(path);
+  }
+  snprintf(path, sizeof(path), "%s/backup_label", stage);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/tablespace_map", stage);
+  unlink(path);
+  rmdir(stage);
+}
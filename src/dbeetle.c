@@ -1,12 +1,752 @@
+#define _GNU_SOURCE
 #include "include/arguments.h"
+#include "include/archive.h"
+#include "include/cdc.h"
+#include "include/clone.h"
+#include "include/config_parser.h"
+#include "include/driver.h"
+#include "include/incremental.h"
+#include "include/pgdump.h"
+#include "include/pgload.h"
+#include "include/restore.h"
+#include "include/sqlitedump.h"
+#include "include/walarchive.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+const char *restore_arg(Argument_t *parsed, const char *key)
+{
+    Argument_t *entry = NULL;
+
+    HASH_FIND_STR(parsed, key, entry);
+    return entry ? (const char *)entry->value : NULL;
+}
+
+/* releases what load_subcommand_config() wrote */
+void unload_subcommand_config(AppConfig_t **cfg, Argument_t **parsed)
+{
+    destroy_parsed_argument(*parsed);
+    *parsed = NULL;
+    destroy_app_config(cfg);
+}
+
+/**
+ * load_subcommand_config - parses the flags of a subcommand and loads
+ * the config file its --config_path names over the defaults
+ * @argc: argument count, from the subcommand word on
+ * @argv: argument vector
+ * @required: its string flags besides --config_path that must be given, NULL-terminated
+ * @optional: its string flags that may be left out, NULL-terminated, or NULL
+ * @usage: printed when --config_path or a @required flag is missing
+ * @cfg: written loaded config
+ * @parsed: written flags, read with restore_arg()
+ *
+ * Prints why it failed, with nothing left to release.
+ * Return: 0 on success, -1 on failure
+ */
+int load_subcommand_config(int argc, char **argv, const char **required, const char **optional, const char *usage,
+    AppConfig_t **cfg, Argument_t **parsed)
+{
+    FlagSchemaEntry_t *schema = NULL;
+    ArgParserError_t *arg_err = NULL;
+    ConfigParserError_t *cfg_err = NULL;
+    const char *config_path = NULL;
+    bool missing = false;
+    int status = -1;
+
+    *parsed = NULL;
+    *cfg = init_app_config(init_db_config(DEFAULT_DB_TYPE, DEFAULT_DB_URI, DEFAULT_DB_TIMEOUT, true),
+        init_storage_config(DEFAULT_STORAGE_OUTPUT_PATH, DEFAULT_STORAGE_COMPRESSION, DEFAULT_STORAGE_ENC_KEY_PATH,
+            DEFAULT_STORAGE_REMOTE),
+        init_runtime_config(DEFAULT_RUNTIME_LOG_LEVEL, DEFAULT_RUNTIME_THREAD_COUNT, DEFAULT_RUNTIME_TMP_DIR));
+    add_flag(&schema, CFG_PATH, ARG_TYPE_STRING);
+    for (size_t i = 0; required[i]; i++)
+        add_flag(&schema, required[i], ARG_TYPE_STRING);
+    for (size_t i = 0; optional && optional[i]; i++)
+        add_flag(&schema, optional[i], ARG_TYPE_STRING);
+
+    if (parse_args(schema, parsed, &arg_err, argc, argv) != ARG_SUCCESS)
+        fprintf(stderr, "Error: %s\n", arg_err ? arg_err->message : "invalid arguments");
+    else
+    {
+        for (size_t i = 0; required[i]; i++)
+            missing = missing || !restore_arg(*parsed, required[i]);
+        if (missing || !(config_path = restore_arg(*parsed, CFG_PATH)))
+            fprintf(stderr, "%s", usage);
+        else if (config_load_file(config_path, *cfg, &cfg_err) != CONFIG_OK)
+            fprintf(stderr, "Error: %s\n", cfg_err ? cfg_err->message : "cannot load the config");
+        else
+            status = 0;
+    }
+
+    if (cfg_err)
+        destroy_parser_error(&cfg_err);
+    free(arg_err);
+    destroy_flag_schema(schema);
+    if (status != 0)
+        unload_subcommand_config(cfg, parsed);
+    return status;
+}
+
+typedef struct RestoreDir
+{
+    const char *path;
+    FILE *post_data;
+    pthread_mutex_t lock;
+} RestoreDir_t;
+
+/*
+ * writes each table to DIR/<table>.copy, the later parts of a split one to DIR/<table>.<part>.copy,
+ * and a SQLite database to DIR/main.db
+ */
+int restore_to_file(ArchiveReader_t *reader, const ArchiveObject_t *obj, size_t worker_id, void *ctx)
+{
+    RestoreDir_t *dir = ctx;
+    ArchiveError_t *err = NULL;
+    ArchiveObject_t *prev = NULL;
+    char path[BUF_LEN + BUF_LEN_S];
+    size_t part = 0;
+    int fd, status = -1;
+
+    (void)worker_id;
+    if (strcmp(obj->name, SQLITEDUMP_OBJECT) == 0)
+    {
+        snprintf(path, sizeof(path), "%s/%s.db", dir->path, obj->name);
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+        if (fd >= 0 && sqlitedump_restore(reader, obj, fd, &err) == ARCHIVE_OK)
+            status = 0;
+        else
+            fprintf(stderr, "Error: %s: %s\n", obj->name, err ? err->message : "cannot create the file");
+
+        if (fd >= 0 && close(fd) != 0)
+            status = -1;
+        destroy_archive_error(&err);
+        return status;
+    }
+    while ((prev = archive_find_next_object(reader, obj->name, prev)) && prev != obj)
+        part++;
+    if (part)
+        snprintf(path, sizeof(path), "%s/%s.%zu.copy", dir->path, obj->name, part);
+    else
+        snprintf(path, sizeof(path), "%s/%s.copy", dir->path, obj->name);
+    fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+    if (fd >= 0 && archive_restore_object(reader, obj, fd, &err) == ARCHIVE_OK)
+        status = 0;
+    else
+        fprintf(stderr, "Error: %s: %s\n", obj->name, err ? err->message : "cannot create the file");
+
+    if (fd >= 0 && close(fd) != 0)
+        status = -1;
+    destroy_archive_error(&err);
+    return status;
+}
+
+/* appends the statements to DIR/post-data.sql, phase by phase */
+int restore_step_to_file(const RestoreStep_t *step, size_t worker_id, void *ctx)
+{
+    RestoreDir_t *dir = ctx;
+    int status;
+
+    (void)worker_id;
+    pthread_mutex_lock(&dir->lock);
+    status = fprintf(dir->post_data, "%s\n", step->sql) < 0 ? -1 : 0;
+    pthread_mutex_unlock(&dir->lock);
+    return status;
+}
+
+/* every table of the archive into directory @output, in parallel */
+int restore_all_tables(RestoreEngine_t *engine, const char *output)
+{
+    RestoreDir_t dir = { output, NULL, PTHREAD_MUTEX_INITIALIZER };
+    RestoreError_t *err = NULL;
+    char path[BUF_LEN];
+    int status = EXIT_FAILURE;
+
+    snprintf(path, sizeof(path), "%s/post-data.sql", output);
+    if (mkdir(output, 0750) != 0 && errno != EEXIST)
+        fprintf(stderr, "Error: cannot create %s: %s\n", output, strerror(errno));
+    else if (!(dir.post_data = fopen(path, "w")))
+        fprintf(stderr, "Error: cannot create %s: %s\n", path, strerror(errno));
+    else if (restore_run(engine, restore_to_file, restore_step_to_file, &dir, &err) != RESTORE_OK)
+        fprintf(stderr, "Error: %s\n", err ? err->message : "restore failed");
+    else
+    {
+        printf("restored %zu table(s) and %zu statement(s) to %s\n", engine->tables_loaded, engine->steps_run,
+               output);
+        status = EXIT_SUCCESS;
+    }
+
+    if (dir.post_data && fclose(dir.post_data) != 0)
+        status = EXIT_FAILURE;
+    destroy_restore_error(&err);
+    return status;
+}
+
+/* every table of the archive loaded back into `db.uri`, then its post-data statements run there */
+int restore_into_database(RestoreEngine_t *engine)
+{
+    PgLoadSession_t *session = NULL;
+    PgLoadError_t *load_err = NULL;
+    RestoreError_t *err = NULL;
+    int status = EXIT_FAILURE;
+
+    if (!(session = init_pgload_session(engine->cfg, &load_err)))
+        fprintf(stderr, "Error: %s\n", load_err ? load_err->message : "cannot connect to the database");
+    else if (restore_run(engine, pgload_table, pgload_step, session, &err) != RESTORE_OK)
+    {
+        fprintf(stderr, "Error: %s\n", err ? err->message : "restore failed");
+        if (session->failed)
+            fprintf(stderr, "Error: %s\n", session->message);
+    }
+    else
+    {
+        printf("restored %zu table(s) and %zu statement(s) into db.uri\n", engine->tables_loaded, engine->steps_run);
+        status = EXIT_SUCCESS;
+    }
+
+    destroy_pgload_session(&session);
+    destroy_pgload_error(&load_err);
+    destroy_restore_error(&err);
+    return status;
+}
+
+/* batch @name of a logical chain: the chain's full backup loaded into `db.uri`, then every batch up to it replayed */
+int restore_chain(AppConfig_t *cfg, const char *name, const CdcMeta_t *meta)
+{
+    RestoreEngine_t *engine = NULL;
+    RestoreError_t *err = NULL;
+    CdcError_t *cdc_err = NULL;
+    uint64_t batches = 0, statements = 0;
+    int status = EXIT_FAILURE;
+
+    if (!(engine = init_restore_engine(cfg, meta->full, &err)))
+        fprintf(stderr, "Error: full backup %s: %s\n", meta->full, err ? err->message : "cannot open the archive");
+    else if (restore_into_database(engine) == EXIT_SUCCESS)
+    {
+        if (cdc_replay(cfg, name, &batches, &statements, &cdc_err) != CDC_OK)
+            fprintf(stderr, "Error: %s\n", cdc_err ? cdc_err->message : "replay failed");
+        else
+        {
+            printf("replayed %llu batch(es) and %llu statement(s) of %s into db.uri\n", (unsigned long long)batches,
+                (unsigned long long)statements, meta->full);
+            status = EXIT_SUCCESS;
+        }
+    }
+
+    destroy_restore_engine(&engine);
+    destroy_restore_error(&err);
+    destroy_cdc_error(&cdc_err);
+    return status;
+}
+
+/* PgCopyFn_t writing to the descriptor at @ctx */
+int restore_write_fd(void *ctx, const unsigned char *data, size_t len)
+{
+    int fd = *(int *)ctx;
+
+    while (len > 0)
+    {
+        ssize_t n = write(fd, data, len);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return -1;
+        data += n;
+        len -= (size_t)n;
+    }
+    return 0;
+}
+
+/* writes @obj, all the parts of a split table joined into one COPY stream, or a SQLite database file */
+int restore_table_stream(ArchiveReader_t *reader, ArchiveObject_t *obj, int fd, ArchiveError_t **err)
+{
+    ArchiveObject_t *next = archive_find_next_object(reader, obj->name, obj);
+    PgDumpJoin_t join;
+    bool first = true;
+
+    if (strcmp(obj->name, SQLITEDUMP_OBJECT) == 0)
+        return sqlitedump_restore(reader, obj, fd, err) == ARCHIVE_OK ? 0 : -1;
+    if (!next)
+        return archive_restore_object(reader, obj, fd, err) == ARCHIVE_OK ? 0 : -1;
+    for (; obj; obj = next, first = false)
+    {
+        next = archive_find_next_object(reader, obj->name, obj);
+        pgdump_join_part(&join, restore_write_fd, &fd, first, !next);
+        if (archive_read_object(reader, obj, pgdump_join_write, &join, err) != ARCHIVE_OK)
+            return -1;
+        if (pgdump_join_end(&join) != 0)
+        {
+            if (err && !*err)
+                *err = create_archive_error(ARCHIVE_FORMAT_ERROR, "a part is not a binary COPY stream");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* one table of the archive to file @output, or stdout */
+int restore_one_table(RestoreEngine_t *engine, const char *table, const char *output)
+{
+    ArchiveError_t *err = NULL;
+    ArchiveObject_t *obj = archive_find_object(engine->reader, table);
+    int fd = STDOUT_FILENO, status = EXIT_FAILURE;
+
+    if (!obj)
+        fprintf(stderr, "Error: %s has no table %s\n", engine->reader->path, table);
+    else if (!output && strcmp(obj->name, SQLITEDUMP_OBJECT) == 0)
+        fprintf(stderr, "Error: a SQLite database is restored to a file, give --output\n");
+    else if (output && (fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640)) < 0)
+        fprintf(stderr, "Error: cannot create %s\n", output);
+    else if (restore_table_stream(engine->reader, obj, fd, &err) != 0)
+    {
+        fprintf(stderr, "Error: %s\n", err ? err->message : "restore failed");
+        if (output)
+            unlink(output);
+    }
+    else
+        status = EXIT_SUCCESS;
+
+    if (output && fd >= 0)
+        close(fd);
+    destroy_archive_error(&err);
+    return status;
+}
+
+/* cloned backup @name copied back as directory @output */
+int restore_clone(AppConfig_t *cfg, const char *name, const char *table, const char *output)
+{
+    CloneError_t *err = NULL;
+    CloneStats_t stats;
+    int status = EXIT_FAILURE;
+
+    if (table || !output)
+        fprintf(stderr, "Error: %s is a cloned directory tree, restore it whole with --output DIR\n", name);
+    else if (clone_restore(cfg, name, output, &stats, &err) != CLONE_OK)
+        fprintf(stderr, "Error: %s\n", err ? err->message : "restore failed");
+    else
+    {
+        printf("restored %s to %s: %llu files, %llu bytes\n", name, output, (unsigned long long)stats.files,
+            (unsigned long long)stats.bytes);
+        status = EXIT_SUCCESS;
+    }
+
+    destroy_clone_error(&err);
+    return status;
+}
+
+/* block-level backup @name rebuilt in directory @output */
+int restore_blocks(AppConfig_t *cfg, const char *name, const char *table, const char *output)
+{
+    IncrError_t *err = NULL;
+    int status = EXIT_FAILURE;
+
+    if (table || !output)
+        fprintf(stderr, "Error: %s is a block-level backup of a directory tree, restore it whole with --output "
+                        "DIR\n", name);
+    else if (incremental_restore(cfg->storage, name, output, &err) != INCR_OK)
+        fprintf(stderr, "Error: %s\n", err ? err->message : "restore failed");
+    else
+    {
+        printf("restored %s to %s\n", name, output);
+        status = EXIT_SUCCESS;
+    }
+
+    destroy_incr_error(&err);
+    return status;
+}
+
+/**
+ * run_restore - `dbeetle restore --config_path FILE --archive NAME
+ * [--table X] [--output PATH]`
+ * @argc: argument count, from the `restore` word on
+ * @argv: argument vector
+ *
+ * The archive is read from `storage.output_path`, or fetched from
+ * `storage.remote_target` when there is no local copy. With neither
+ * --table nor --output, a PostgreSQL backup is loaded back into `db.uri`
+ * on `runtime.thread_count` connections and its post-data statements
+ * run there (pgload.h); its tables must exist and be empty. A batch
+ * of a logical chain (cdc.h) is restored likewise as its full backup,
+ * then the statements of every batch up to it are replayed. With
+ * --table, the dump stream of table X goes to file PATH or to stdout.
+ * With --output alone, every table is restored into directory PATH on
+ * `runtime.thread_count` workers, followed by the post-data statements
+ * in post-data.sql. A table dumped in ranges is one stream with --table,
+ * and one file per range without, <table>.copy then <table>.1.copy,
+ * <table>.2.copy... PostgreSQL streams are in COPY binary format: load
+ * each with `COPY table FROM STDIN (FORMAT binary)`. A SQLite backup
+ * holds the one table SQLITEDUMP_OBJECT, restored as database file
+ * main.db, or to PATH with --table main. A backup taken with `dbeetle clone` is
+ * copied back whole into directory PATH, which must not exist yet, and
+ * a block-level backup (`db.incremental_strategy: blocks`) is rebuilt
+ * whole in directory PATH from the backups of its chain.
+ * Return: process exit status
+ */
+int run_restore(int argc, char **argv)
+{
+    const char *required[] = {"archive", NULL}, *optional[] = {"table", "output", NULL};
+    AppConfig_t *cfg = NULL;
+    Argument_t *parsed = NULL;
+    RestoreError_t *err = NULL;
+    RestoreEngine_t *engine = NULL;
+    CdcMeta_t meta;
+    const char *archive, *table, *output;
+    int status = EXIT_FAILURE;
+
+    if (load_subcommand_config(argc, argv, required, optional,
+            "Usage: dbeetle restore --config_path FILE --archive NAME --table TABLE [--output FILE]\n"
+            "       dbeetle restore --config_path FILE --archive NAME [--output DIR]\n",
+            &cfg, &parsed) != 0)
+        return EXIT_FAILURE;
+    archive = restore_arg(parsed, "archive");
+    table = restore_arg(parsed, "table");
+    output = restore_arg(parsed, "output");
+
+    if (clone_backup_exists(cfg->storage, archive))
+        status = restore_clone(cfg, archive, table, output);
+    else if (incremental_backup_exists(cfg->storage, archive))
+        status = restore_blocks(cfg, archive, table, output);
+    else if (!(engine = init_restore_engine(cfg, archive, &err)))
+        fprintf(stderr, "Error: %s\n", err ? err->message : "cannot open the archive");
+    else if (table)
+        status = restore_one_table(engine, table, output);
+    else if (output)
+        status = restore_all_tables(engine, output);
+    else if (cdc_read_meta(engine->reader, &meta) == 0)
+        status = restore_chain(cfg, archive, &meta);
+    else
+        status = restore_into_database(engine);
+
+    destroy_restore_engine(&engine);
+    destroy_restore_error(&err);
+    unload_subcommand_config(&cfg, &parsed);
+    return status;
+}
+
+/**
+ * backup_logical - the "logical" incremental strategy of run_backup (cdc.h)
+ * @cfg: application config
+ * @archive: archive name
+ *
+ * Return: process exit status
+ */
+int backup_logical(AppConfig_t *cfg, const char *archive)
+{
+    CdcError_t *err = NULL;
+    CdcStats_t stats;
+    char from[CDC_LSN_LEN], to[CDC_LSN_LEN];
+
+    if (cdc_backup(cfg, archive, &stats, &err) != CDC_OK)
+    {
+        fprintf(stderr, "Error: %s\n", err ? err->message : "backup failed");
+        destroy_cdc_error(&err);
+        return EXIT_FAILURE;
+    }
+    cdc_format_lsn(stats.from_lsn, from);
+    cdc_format_lsn(stats.to_lsn, to);
+    if (stats.full)
+        printf("backed up %s to %s/%s, changes from %s on go to slot %s\n", cfg->db->type,
+            cfg->storage->output_path, archive, to, cfg->db->cdc_slot);
+    else
+        printf("stored %llu bytes of changes %s..%s to %s/%s (batch %llu)\n", (unsigned long long)stats.bytes, from, to,
+            cfg->storage->output_path, archive, (unsigned long long)stats.seq);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * backup_blocks - the block strategy of `dbeetle backup`
+ * @cfg: loaded config
+ * @archive: backup name
+ *
+ * Return: process exit status
+ */
+int backup_blocks(AppConfig_t *cfg, const char *archive)
+{
+    IncrError_t *err = NULL;
+    IncrStats_t stats;
+
+    if (incremental_backup(cfg, cfg->db->data_dir, archive, &stats, &err) != INCR_OK)
+    {
+        fprintf(stderr, "Error: %s\n", err ? err->message : "backup failed");
+        destroy_incr_error(&err);
+        return EXIT_FAILURE;
+    }
+    printf("backed up %s to %s/%s (generation %u): %llu of %llu blocks stored, %llu of %llu files unchanged\n",
+        cfg->db->data_dir, cfg->storage->output_path, archive, stats.generation,
+        (unsigned long long)stats.blocks_written, (unsigned long long)stats.blocks,
+        (unsigned long long)stats.files_unchanged, (unsigned long long)stats.files);
+    return EXIT_SUCCESS;
+}
+
+/**
+ * run_backup - `dbeetle backup --config_path FILE --archive NAME`
+ * @argc: argument count, from the `backup` word on
+ * @argv: argument vector
+ *
+ * Dumps the database at `db.uri` into archive NAME under
+ * `storage.output_path`, with the driver `db.type` names (driver.h).
+ * PostgreSQL is read on `runtime.thread_count` connections that all
+ * share one exported snapshot, a SQLite file (`db.type: sqlite`) page
+ * by page; other types load plugin libdbeetle_<type>.so. With
+ * `db.incremental_enabled` and `db.incremental_strategy: logical`, a
+ * PostgreSQL backup is a full one that starts a chain on slot
+ * `db.cdc_slot`, or the row changes since the last one. With
+ * `db.incremental_strategy: blocks` (the default) and `db.data_dir`
+ * set, that directory tree is backed up instead, storing only the
+ * blocks changed since the last backup (incremental.h), in backup
+ * mode with its WAL when `db.uri` is the PostgreSQL server running
+ * in it; without `db.data_dir` the driver dump above is taken, as
+ * before. The logical strategy on a database other than PostgreSQL
+ * fails rather than falling back to a full dump. With
+ * `db.incremental_enabled: false` the dump is a full one. With
+ * `storage.output_path: -` the archive goes to stdout, and the
+ * report to stderr.
+ * Return: process exit status
+ */
+int run_backup(int argc, char **argv)
+{
+    const char *required[] = {"archive", NULL};
+    AppConfig_t *cfg = NULL;
+    Argument_t *parsed = NULL;
+    DriverError_t *err = NULL;
+    const char *archive;
+    int status = EXIT_FAILURE;
+
+    if (load_subcommand_config(argc, argv, required, NULL, "Usage: dbeetle backup --config_path FILE --archive NAME\n",
+            &cfg, &parsed) != 0)
+        return EXIT_FAILURE;
+    archive = restore_arg(parsed, "archive");
+
+    if (cdc_selected(cfg->db))
+        status = backup_logical(cfg, archive);
+    else if (incremental_selected(cfg->db))
+        status = backup_blocks(cfg, archive);
+    else if (cfg->db->incremental_enabled && strcmp(cfg->db->incremental_strategy, "logical") == 0)
+        fprintf(stderr, "Error: db.incremental_strategy: logical needs a PostgreSQL db.uri, not %s; set "
+                        "db.incremental_enabled: false for a full dump\n", cfg->db->type);
+    else if (driver_run_backup(cfg, archive, &err) != DRIVER_OK)
+        fprintf(stderr, "Error: %s\n", err ? err->message : "backup failed");
+    else if (storage_to_stdout(cfg->storage))
+    {
+        // stdout carried the archive
+        fprintf(stderr, "backed up %s to stdout as %s\n", cfg->db->type, archive);
+        status = EXIT_SUCCESS;
+    }
+    else
+    {
+        printf("backed up %s to %s/%s\n", cfg->db->type, cfg->storage->output_path, archive);
+        status = EXIT_SUCCESS;
+    }
+
+    destroy_driver_error(&err);
+    unload_subcommand_config(&cfg, &parsed);
+    return status;
+}
+
+/**
+ * run_clone - `dbeetle clone --config_path FILE --archive NAME`
+ * @argc: argument count, from the `clone` word on
+ * @argv: argument vector
+ *
+ * Backs up the directory tree `db.data_dir` as directory NAME under
+ * `storage.output_path`, cloned file by file with reflinks where the
+ * file system shares extents, copied by the kernel elsewhere (clone.h).
+ * `dbeetle restore --archive NAME --output DIR` copies it back.
+ * Return: process exit status
+ */
+int run_clone(int argc, char **argv)
+{
+    const char *required[] = {"archive", NULL};
+    AppConfig_t *cfg = NULL;
+    Argument_t *parsed = NULL;
+    CloneError_t *err = NULL;
+    CloneStats_t stats;
+    const char *archive;
+    int status = EXIT_FAILURE;
+
+    if (load_subcommand_config(argc, argv, required, NULL, "Usage: dbeetle clone --config_path FILE --archive NAME\n",
+            &cfg, &parsed) != 0)
+        return EXIT_FAILURE;
+    archive = restore_arg(parsed, "archive");
+
+    if (!cfg->db->data_dir[0])
+        fprintf(stderr, "Error: set db.data_dir to the directory to clone\n");
+    else if (clone_backup(cfg, cfg->db->data_dir, archive, &stats, &err) != CLONE_OK)
+        fprintf(stderr, "Error: %s\n", err ? err->message : "clone failed");
+    else
+    {
+        printf("cloned %s to %s/%s: %llu files, %llu bytes, %llu shared with the source\n", cfg->db->data_dir,
+            cfg->storage->output_path, archive, (unsigned long long)stats.files, (unsigned long long)stats.bytes,
+            (unsigned long long)stats.bytes_cloned);
+        status = EXIT_SUCCESS;
+    }
+
+    destroy_clone_error(&err);
+    unload_subcommand_config(&cfg, &parsed);
+    return status;
+}
+
+static int archive_stop;
+
+void archive_on_signal(int signo)
+{
+    (void)signo;
+    __atomic_store_n(&archive_stop, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * run_archive - `dbeetle archive --config_path FILE`
+ * @argc: argument count, from the `archive` word on
+ * @argv: argument vector
+ *
+ * Streams the WAL of the PostgreSQL server at `db.uri` into batches
+ * under `storage.output_path` until SIGINT or SIGTERM, carrying on
+ * from the last archived segment (walarchive.h). Every segment
+ * received in full is committed before it exits.
+ * Return: process exit status
+ */
+int run_archive(int argc, char **argv)
+{
+    const char *required[] = {NULL};
+    AppConfig_t *cfg = NULL;
+    Argument_t *parsed = NULL;
+    WalArchiveError_t *err = NULL;
+    WalArchive_t *archive = NULL;
+    struct sigaction sa;
+    int status = EXIT_FAILURE;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = archive_on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    if (load_subcommand_config(argc, argv, required, NULL, "Usage: dbeetle archive --config_path FILE\n", &cfg,
+            &parsed) != 0)
+        return EXIT_FAILURE;
+
+    if (!(archive = init_wal_archive(cfg, &err)))
+        fprintf(stderr, "Error: %s\n", err ? err->message : "cannot start archiving");
+    else if (wal_archive_run(archive, &archive_stop, &err) != WAL_ARCHIVE_OK)
+        fprintf(stderr, "Error: %s\n", err ? err->message : "archiving failed");
+    else
+    {
+        printf("archived %llu segments to %s\n", (unsigned long long)archive->segments, cfg->storage->output_path);
+        status = EXIT_SUCCESS;
+    }
+
+    destroy_wal_archive(&archive);
+    destroy_wal_archive_error(&err);
+    unload_subcommand_config(&cfg, &parsed);
+    return status;
+}
+
+/**
+ * run_wal_fetch - `dbeetle wal-fetch --config_path FILE --segment NAME
+ * --output PATH`
+ * @argc: argument count, from the `wal-fetch` word on
+ * @argv: argument vector
+ *
+ * Writes archived WAL segment NAME to PATH, found through the segment
+ * index; meant as the server's restore_command,
+ * `dbeetle wal-fetch --config_path FILE --segment %f --output %p`.
+ * Return: process exit status, failure for a segment not archived
+ */
+int run_wal_fetch(int argc, char **argv)
+{
+    const char *required[] = {"segment", "output", NULL};
+    AppConfig_t *cfg = NULL;
+    Argument_t *parsed = NULL;
+    WalArchiveError_t *err = NULL;
+    int status = EXIT_FAILURE;
+
+    if (load_subcommand_config(argc, argv, required, NULL,
+            "Usage: dbeetle wal-fetch --config_path FILE --segment NAME --output PATH\n", &cfg, &parsed) != 0)
+        return EXIT_FAILURE;
+
+    if (wal_archive_fetch(cfg, restore_arg(parsed, "segment"), restore_arg(parsed, "output"), &err) != WAL_ARCHIVE_OK)
+        fprintf(stderr, "Error: %s\n", err ? err->message : "fetch failed");
+    else
+        status = EXIT_SUCCESS;
+
+    destroy_wal_archive_error(&err);
+    unload_subcommand_config(&cfg, &parsed);
+    return status;
+}
+
+/**
+ * run_rotate_key - `dbeetle rotate-key --config_path FILE --new_key_path KEY`
+ * @argc: argument count, from the `rotate-key` word on
+ * @argv: argument vector
+ *
+ * Rewraps the data key of every encrypted archive under
+ * `storage.output_path` from `storage.encryption_key_path` to KEY,
+ * without decrypting a byte of data (cipher.h). Point
+ * `encryption_key_path` at KEY once it is done; a run that was
+ * interrupted is simply run again. Copies already uploaded to
+ * `storage.remote_target` are not rewrapped: they still need the old
+ * key until they are replaced or expire.
+ * Return: process exit status
+ */
+int run_rotate_key(int argc, char **argv)
+{
+    const char *required[] = {"new_key_path", NULL};
+    AppConfig_t *cfg = NULL;
+    Argument_t *parsed = NULL;
+    StorageError_t *err = NULL;
+    const char *new_key_path;
+    size_t count = 0;
+    int status = EXIT_FAILURE;
+
+    if (load_subcommand_config(argc, argv, required, NULL,
+            "Usage: dbeetle rotate-key --config_path FILE --new_key_path FILE\n", &cfg, &parsed) != 0)
+        return EXIT_FAILURE;
+    new_key_path = restore_arg(parsed, "new_key_path");
+
+    if (storage_rewrap_archives(cfg->storage, new_key_path, &count, &err) != STORAGE_OK)
+        fprintf(stderr, "Error: %s (%zu archives rewrapped before)\n", err ? err->message : "rotation failed", count);
+    else
+    {
+        printf("rewrapped %zu archives in %s, set encryption_key_path to %s\n", count, cfg->storage->output_path,
+            new_key_path);
+        if (remote_enabled(cfg->storage))
+            printf("copies on %s keep the old key\n", cfg->storage->remote_target);
+        status = EXIT_SUCCESS;
+    }
+
+    destroy_storage_error(&err);
+    unload_subcommand_config(&cfg, &parsed);
+    return status;
+}
 
 int main(int argc, char **argv)
 {
     Arguments *args;
-    ArgParser *parser = register_args();
+    ArgParser *parser;
     Options opt;
 
+    if (argc > 1 && strcmp(argv[1], "restore") == 0)
+        return run_restore(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "backup") == 0)
+        return run_backup(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "clone") == 0)
+        return run_clone(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "archive") == 0)
+        return run_archive(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "wal-fetch") == 0)
+        return run_wal_fetch(argc - 1, argv + 1);
+    if (argc > 1 && strcmp(argv[1], "rotate-key") == 0)
+        return run_rotate_key(argc - 1, argv + 1);
+
+    parser = register_args();
+
     // register flags
     arg_string(parser, "type", ARG_LONG_FLAG, "provide database type for to perform backup on", &opt.dbtype, true);
     arg_bool(parser, "help", ARG_LONG_FLAG, "provide help about dbeetle", &opt.help, false);